@@ -410,8 +410,18 @@ void ConditionalSharedAsyncFetch::HandleHeadersComplete() {
     serving_cached_value_ = true;
     int64 implicit_cache_ttl_ms = response_headers()->implicit_cache_ttl_ms();
     int64 min_cache_ttl_ms = response_headers()->min_cache_ttl_ms();
+    // The 304's Date and caching headers take over from the stored ones, so
+    // that the entry lives on as the origin now says, and is put back in
+    // the cache with the same content.
+    ResponseHeaders not_modified(request_context()->options());
+    not_modified.CopyFrom(*response_headers());
     response_headers()->Clear();
     cached_value_.ExtractHeaders(response_headers(), handler_);
+    response_headers()->UpdateFromNotModified(not_modified);
+    response_headers()->ComputeCaching();
+    StringPiece contents;
+    cached_value_.ExtractContents(&contents);
+    set_content_length(contents.size());
     if (response_headers()->is_implicitly_cacheable()) {
       response_headers()->SetCacheControlMaxAge(implicit_cache_ttl_ms);
       response_headers()->ComputeCaching();
@@ -420,8 +430,6 @@ void ConditionalSharedAsyncFetch::HandleHeadersComplete() {
       response_headers()->ComputeCaching();
     }
     SharedAsyncFetch::HandleHeadersComplete();
-    StringPiece contents;
-    cached_value_.ExtractContents(&contents);
     SharedAsyncFetch::HandleWrite(contents, handler_);
     SharedAsyncFetch::HandleFlush(handler_);
     // Do not call Done() on the base fetch yet since it could delete shared
@@ -22,7 +22,9 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
+#include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/http_options.h"
 #include "pagespeed/kernel/http/response_headers.h"
@@ -129,6 +131,38 @@ TEST_F(AsyncFetchTest, ContentLengthPropagatesToConditional) {
   EXPECT_EQ(42, string_fetch_.content_length());
 }
 
+TEST_F(AsyncFetchTest, NotModifiedUpdatesCachedHeaders) {
+  ResponseHeaders cached_headers;
+  cached_headers.SetStatusAndReason(HttpStatus::kOK);
+  cached_headers.Add(HttpAttributes::kEtag, "\"abc\"");
+  cached_headers.SetDateAndCaching(MockTimer::kApr_5_2010_ms,
+                                   10 * Timer::kSecondMs);
+  fallback_value_.SetHeaders(&cached_headers);
+  fallback_value_.Write("cached", &handler_);
+
+  ConditionalSharedAsyncFetch* fetch = new ConditionalSharedAsyncFetch(
+      &string_fetch_, &fallback_value_, &handler_);
+  EXPECT_STREQ("\"abc\"", fetch->request_headers()->Lookup1(
+      HttpAttributes::kIfNoneMatch));
+  int64 now_ms = MockTimer::kApr_5_2010_ms + Timer::kMinuteMs;
+  fetch->response_headers()->SetStatusAndReason(HttpStatus::kNotModified);
+  fetch->response_headers()->SetDateAndCaching(now_ms, Timer::kHourMs);
+  fetch->response_headers()->Add(HttpAttributes::kContentLength, "0");
+  fetch->set_content_length(0);
+  fetch->HeadersComplete();
+  fetch->Done(true);
+
+  // The cached response is served, with the lifetime the 304 gave it.
+  ResponseHeaders* headers = string_fetch_.response_headers();
+  EXPECT_TRUE(string_fetch_.success());
+  EXPECT_EQ(HttpStatus::kOK, headers->status_code());
+  EXPECT_STREQ("cached", string_fetch_.buffer());
+  EXPECT_EQ(6, string_fetch_.content_length());
+  EXPECT_EQ(now_ms, headers->date_ms());
+  EXPECT_EQ(Timer::kHourMs, headers->cache_ttl_ms());
+  EXPECT_STREQ("\"abc\"", headers->Lookup1(HttpAttributes::kEtag));
+}
+
 TEST_F(AsyncFetchTest, ViaHandling) {
   EXPECT_FALSE(CheckCacheControlPublicWithVia(NULL));
   EXPECT_TRUE(CheckCacheControlPublicWithVia("1.1 google"));
@@ -22,6 +22,7 @@
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/async_fetch_with_lock.h"
 #include "net/instaweb/http/public/http_cache.h"
+#include "net/instaweb/http/public/http_cache_refresher.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/http_value_writer.h"
 #include "net/instaweb/http/public/log_record.h"  // for AbstractLogRecord
@@ -250,6 +251,7 @@ class CacheFindCallback : public HTTPCache::Callback {
         fragment_(fragment),
         async_op_hooks_(async_op_hooks),
         fetcher_(owner->fetcher()),
+        http_cache_refresher_(owner->http_cache_refresher()),
         backend_first_byte_latency_(
             owner->backend_first_byte_latency_histogram()),
         fallback_responses_served_(owner->fallback_responses_served()),
@@ -266,6 +268,7 @@ class CacheFindCallback : public HTTPCache::Callback {
         default_cache_html_(owner->default_cache_html()),
         proactively_freshen_user_facing_request_(
             owner->proactively_freshen_user_facing_request()),
+        refresh_imminently_expiring_(owner->refresh_imminently_expiring()),
         serve_stale_while_revalidate_threshold_sec_(
             owner->serve_stale_while_revalidate_threshold_sec()) {
     // Note that this is a cache lookup: there are no request-headers.  At
@@ -282,6 +285,14 @@ class CacheFindCallback : public HTTPCache::Callback {
         VLOG(1) << "Found in cache: " << url_ << " (" << fragment_ << ")";
         http_value()->ExtractHeaders(response_headers(), handler_);
 
+        // If the refresher is keeping this response fresh, we needn't.
+        bool refreshed_in_background = false;
+        if (http_cache_refresher_ != NULL) {
+          response_headers()->ComputeCaching();
+          refreshed_in_background = http_cache_refresher_->NoteHit(
+              url_, fragment_, *response_headers());
+        }
+
         bool is_imminently_expiring = false;
 
         // Respond with a 304 if the If-Modified-Since / If-None-Match values
@@ -321,7 +332,8 @@ class CacheFindCallback : public HTTPCache::Callback {
         if (fetcher_ != NULL &&
             proactively_freshen_user_facing_request_ &&
             async_op_hooks_ != NULL &&
-            is_imminently_expiring) {
+            is_imminently_expiring &&
+            !refreshed_in_background) {
           // Triggers the background fetch to freshen the value in cache if
           // resource is about to expire.
           if (num_proactively_freshen_user_facing_request_ != NULL) {
@@ -400,6 +412,17 @@ class CacheFindCallback : public HTTPCache::Callback {
     return base_fetch_->IsCachedResultValid(headers);
   }
 
+  virtual bool IsFresh(const ResponseHeaders& headers) {
+    return !refresh_imminently_expiring_ || !IsImminentlyExpiring(headers);
+  }
+
+  virtual bool IsFreshFromSummary(const HTTPValue::HeadersSummary& summary) {
+    return !refresh_imminently_expiring_ ||
+        !ResponseHeaders::IsImminentlyExpiring(
+            summary.date_ms, summary.expiration_time_ms,
+            cache_->timer()->NowMs(), http_options_);
+  }
+
   virtual ResponseHeaders::VaryOption RespectVaryOnResources() const {
     return respect_vary_;
   }
@@ -543,6 +566,7 @@ class CacheFindCallback : public HTTPCache::Callback {
   GoogleString fragment_;
   CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks_;
   UrlAsyncFetcher* fetcher_;
+  HTTPCacheRefresher* http_cache_refresher_;
   Histogram* backend_first_byte_latency_;
   Variable* fallback_responses_served_;
   Variable* fallback_responses_served_while_revalidate_;
@@ -557,6 +581,7 @@ class CacheFindCallback : public HTTPCache::Callback {
   bool serve_stale_if_fetch_error_;
   bool default_cache_html_;
   bool proactively_freshen_user_facing_request_;
+  bool refresh_imminently_expiring_;
   int64 serve_stale_while_revalidate_threshold_sec_;
 
   DISALLOW_COPY_AND_ASSIGN(CacheFindCallback);
@@ -576,6 +601,7 @@ CacheUrlAsyncFetcher::CacheUrlAsyncFetcher(const Hasher* lock_hasher,
       fragment_(fragment),
       fetcher_(fetcher),
       async_op_hooks_(async_op_hooks),
+      http_cache_refresher_(NULL),
       backend_first_byte_latency_(NULL),
       fallback_responses_served_(NULL),
       fallback_responses_served_while_revalidate_(NULL),
@@ -586,6 +612,7 @@ CacheUrlAsyncFetcher::CacheUrlAsyncFetcher(const Hasher* lock_hasher,
       serve_stale_if_fetch_error_(false),
       default_cache_html_(false),
       proactively_freshen_user_facing_request_(false),
+      refresh_imminently_expiring_(false),
       own_fetcher_(false),
       serve_stale_while_revalidate_threshold_sec_(0) {
 }
@@ -599,6 +626,12 @@ CacheUrlAsyncFetcher::~CacheUrlAsyncFetcher() {
 
 void CacheUrlAsyncFetcher::Fetch(
     const GoogleString& url, MessageHandler* handler, AsyncFetch* base_fetch) {
+  FetchInFragment(url, fragment_, handler, base_fetch);
+}
+
+void CacheUrlAsyncFetcher::FetchInFragment(
+    const GoogleString& url, const GoogleString& fragment,
+    MessageHandler* handler, AsyncFetch* base_fetch) {
   switch (base_fetch->request_headers()->method()) {
     case RequestHeaders::kHead:
       // HEAD is identical to GET, with the body trimmed.  Even though we are
@@ -614,12 +647,12 @@ void CacheUrlAsyncFetcher::Fetch(
                 lock_hasher_,
                 lock_manager_,
                 url,
-                fragment_,
+                fragment,
                 base_fetch,
                 this,
                 async_op_hooks_,
                 handler);
-        http_cache_->Find(url, fragment_, handler, find_callback);
+        http_cache_->Find(url, fragment, handler, find_callback);
       }
       return;
 
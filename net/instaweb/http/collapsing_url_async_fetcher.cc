@@ -0,0 +1,272 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/http/public/collapsing_url_async_fetcher.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kRange[] = "Range";
+
+// All the values of a request header, in order, as one string.
+GoogleString JoinedValues(const RequestHeaders& request_headers,
+                          StringPiece name) {
+  GoogleString joined;
+  ConstStringStarVector values;
+  if (request_headers.Lookup(name, &values)) {
+    for (int i = 0, n = values.size(); i < n; ++i) {
+      StrAppend(&joined, (i == 0) ? "" : ", ",
+                (values[i] == NULL) ? StringPiece() : StringPiece(*values[i]));
+    }
+  }
+  return joined;
+}
+
+}  // namespace
+
+const char CollapsingUrlAsyncFetcher::kCollapsedFetchCount[] =
+    "collapsed-fetch-count";
+const char CollapsingUrlAsyncFetcher::kCollapsedFetchVaryMismatchCount[] =
+    "collapsed-fetch-vary-mismatch-count";
+
+// The single fetch made from the base fetcher on behalf of every caller
+// collapsed into it.  It has request headers of its own, copied from the
+// first caller's, as the base fetcher may modify them.  The callers are
+// all background fetches or all not, as that is part of the collapse key.
+class CollapsingUrlAsyncFetcher::CollapsedFetch : public AsyncFetch {
+ public:
+  CollapsedFetch(CollapsingUrlAsyncFetcher* fetcher, const GoogleString& key,
+                 const GoogleString& url, MessageHandler* handler,
+                 AsyncFetch* first)
+      : AsyncFetch(first->request_context()),
+        fetcher_(fetcher),
+        key_(key),
+        url_(url),
+        handler_(handler),
+        background_(first->IsBackgroundFetch()) {
+    request_headers()->CopyFrom(*first->request_headers());
+    AddWaiter(first);
+  }
+
+  virtual ~CollapsedFetch() {}
+
+  // Must be called with fetcher_->mutex_ held, until StopJoining.
+  void AddWaiter(AsyncFetch* fetch) {
+    waiters_.push_back(fetch);
+    writable_.push_back(true);
+  }
+
+  virtual bool IsBackgroundFetch() const { return background_; }
+
+ protected:
+  virtual void HandleHeadersComplete() {
+    // From here on the waiters belong to this fetch alone.
+    fetcher_->StopJoining(key_, this);
+
+    std::vector<AsyncFetch*> compatible;
+    for (int i = 0, n = waiters_.size(); i < n; ++i) {
+      if ((i == 0) || VaryMatches(waiters_[i])) {
+        compatible.push_back(waiters_[i]);
+      } else {
+        mismatched_.push_back(waiters_[i]);
+      }
+    }
+    if (!mismatched_.empty()) {
+      fetcher_->vary_mismatch_count_->Add(mismatched_.size());
+      waiters_.swap(compatible);
+      writable_.assign(waiters_.size(), true);
+    }
+
+    for (int i = 0, n = waiters_.size(); i < n; ++i) {
+      AsyncFetch* waiter = waiters_[i];
+      waiter->response_headers()->CopyFrom(*response_headers());
+      if (content_length_known()) {
+        waiter->set_content_length(content_length());
+      }
+      waiter->HeadersComplete();
+    }
+  }
+
+  virtual bool HandleWrite(const StringPiece& content,
+                           MessageHandler* handler) {
+    bool any_writable = false;
+    for (int i = 0, n = waiters_.size(); i < n; ++i) {
+      if (writable_[i]) {
+        writable_[i] = waiters_[i]->Write(content, handler);
+        any_writable |= writable_[i];
+      }
+    }
+    return any_writable;
+  }
+
+  virtual bool HandleFlush(MessageHandler* handler) {
+    for (int i = 0, n = waiters_.size(); i < n; ++i) {
+      if (writable_[i]) {
+        waiters_[i]->Flush(handler);
+      }
+    }
+    return true;
+  }
+
+  virtual void HandleDone(bool success) {
+    const ResponseHeaders* extra = extra_response_headers();
+    for (int i = 0, n = waiters_.size(); i < n; ++i) {
+      AsyncFetch* waiter = waiters_[i];
+      for (int j = 0, m = extra->NumAttributes(); j < m; ++j) {
+        waiter->extra_response_headers()->Add(extra->Name(j),
+                                              extra->Value(j));
+      }
+      waiter->Done(success && writable_[i]);
+    }
+    // Like RateController's deferred fetches, these are started from the
+    // completion of the fetch that held them up.
+    for (int i = 0, n = mismatched_.size(); i < n; ++i) {
+      fetcher_->base_fetcher_->Fetch(url_, handler_, mismatched_[i]);
+    }
+    delete this;
+  }
+
+ private:
+  // Returns whether the response may be served to 'waiter', given the Vary
+  // in the response and the request headers of the first caller, which
+  // went to the origin.
+  bool VaryMatches(AsyncFetch* waiter) {
+    ConstStringStarVector vary;
+    if (!response_headers()->Lookup(HttpAttributes::kVary, &vary)) {
+      return true;
+    }
+    for (int i = 0, n = vary.size(); i < n; ++i) {
+      StringPiece name(*vary[i]);
+      if (name == "*") {
+        return false;
+      }
+      // Accept-Encoding is part of the collapse key.
+      if (!StringCaseEqual(name, HttpAttributes::kAcceptEncoding) &&
+          (JoinedValues(*request_headers(), name) !=
+           JoinedValues(*waiter->request_headers(), name))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  CollapsingUrlAsyncFetcher* fetcher_;
+  GoogleString key_;
+  GoogleString url_;
+  MessageHandler* handler_;
+  bool background_;
+  std::vector<AsyncFetch*> waiters_;
+  std::vector<bool> writable_;
+  std::vector<AsyncFetch*> mismatched_;
+
+  DISALLOW_COPY_AND_ASSIGN(CollapsedFetch);
+};
+
+CollapsingUrlAsyncFetcher::CollapsingUrlAsyncFetcher(
+    UrlAsyncFetcher* fetcher, ThreadSystem* thread_system,
+    Statistics* statistics)
+    : base_fetcher_(fetcher),
+      mutex_(thread_system->NewMutex()),
+      collapsed_fetch_count_(statistics->GetVariable(kCollapsedFetchCount)),
+      vary_mismatch_count_(
+          statistics->GetVariable(kCollapsedFetchVaryMismatchCount)) {
+}
+
+CollapsingUrlAsyncFetcher::~CollapsingUrlAsyncFetcher() {
+  DCHECK(joinable_fetches_.empty());
+}
+
+void CollapsingUrlAsyncFetcher::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kCollapsedFetchCount);
+  statistics->AddVariable(kCollapsedFetchVaryMismatchCount);
+}
+
+GoogleString CollapsingUrlAsyncFetcher::CollapseKey(
+    const GoogleString& url, const RequestHeaders& request_headers,
+    bool is_background_fetch) {
+  if ((request_headers.method() != RequestHeaders::kGet) ||
+      request_headers.Has(HttpAttributes::kAuthorization) ||
+      request_headers.Has(HttpAttributes::kCookie) ||
+      request_headers.Has(HttpAttributes::kCookie2) ||
+      request_headers.Has(kRange)) {
+    return GoogleString();
+  }
+  return StrCat(
+      url,
+      "\n", JoinedValues(request_headers, HttpAttributes::kAcceptEncoding),
+      "\n", JoinedValues(request_headers, HttpAttributes::kIfModifiedSince),
+      "\n", JoinedValues(request_headers, HttpAttributes::kIfNoneMatch),
+      "\n", is_background_fetch ? "background" : "foreground");
+}
+
+void CollapsingUrlAsyncFetcher::Fetch(const GoogleString& url,
+                                      MessageHandler* message_handler,
+                                      AsyncFetch* fetch) {
+  GoogleString key = CollapseKey(url, *fetch->request_headers(),
+                                 fetch->IsBackgroundFetch());
+  if (key.empty()) {
+    base_fetcher_->Fetch(url, message_handler, fetch);
+    return;
+  }
+
+  CollapsedFetch* collapsed_fetch;
+  {
+    ScopedMutex lock(mutex_.get());
+    FetchMap::iterator p = joinable_fetches_.find(key);
+    if (p != joinable_fetches_.end()) {
+      p->second->AddWaiter(fetch);
+      collapsed_fetch_count_->Add(1);
+      return;
+    }
+    collapsed_fetch = new CollapsedFetch(this, key, url, message_handler,
+                                         fetch);
+    joinable_fetches_[key] = collapsed_fetch;
+  }
+  base_fetcher_->Fetch(url, message_handler, collapsed_fetch);
+}
+
+void CollapsingUrlAsyncFetcher::StopJoining(const GoogleString& key,
+                                            CollapsedFetch* fetch) {
+  ScopedMutex lock(mutex_.get());
+  FetchMap::iterator p = joinable_fetches_.find(key);
+  if ((p != joinable_fetches_.end()) && (p->second == fetch)) {
+    joinable_fetches_.erase(p);
+  }
+}
+
+int CollapsingUrlAsyncFetcher::num_joinable_fetches() const {
+  ScopedMutex lock(mutex_.get());
+  return joinable_fetches_.size();
+}
+
+void CollapsingUrlAsyncFetcher::ShutDown() {
+  base_fetcher_->ShutDown();
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/http/public/collapsing_url_async_fetcher.h"
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/mock_url_fetcher.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "net/instaweb/http/public/wait_url_async_fetcher.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kUrl[] = "http://www.example.com/a.css";
+const char kVaryUrl[] = "http://www.example.com/vary.css";
+const char kBody[] = "a{color:red}";
+
+class BackgroundStringAsyncFetch : public StringAsyncFetch {
+ public:
+  explicit BackgroundStringAsyncFetch(const RequestContextPtr& request_ctx)
+      : StringAsyncFetch(request_ctx) {}
+  virtual bool IsBackgroundFetch() const { return true; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BackgroundStringAsyncFetch);
+};
+
+class CollapsingUrlAsyncFetcherTest : public ::testing::Test {
+ protected:
+  CollapsingUrlAsyncFetcherTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms) {
+    CollapsingUrlAsyncFetcher::InitStats(&stats_);
+    wait_fetcher_.reset(new WaitUrlAsyncFetcher(
+        &mock_fetcher_, thread_system_->NewMutex()));
+    counting_fetcher_.reset(new CountingUrlAsyncFetcher(wait_fetcher_.get()));
+    collapsing_fetcher_.reset(new CollapsingUrlAsyncFetcher(
+        counting_fetcher_.get(), thread_system_.get(), &stats_));
+
+    SetupResponse(kUrl, NULL);
+    SetupResponse(kVaryUrl, HttpAttributes::kUserAgent);
+  }
+
+  void SetupResponse(const GoogleString& url, const char* vary) {
+    ResponseHeaders headers;
+    headers.set_major_version(1);
+    headers.set_minor_version(1);
+    headers.SetStatusAndReason(HttpStatus::kOK);
+    headers.SetDateAndCaching(timer_.NowMs(), Timer::kHourMs);
+    if (vary != NULL) {
+      headers.Add(HttpAttributes::kVary, vary);
+    }
+    mock_fetcher_.SetResponse(url, headers, kBody);
+  }
+
+  StringAsyncFetch* NewFetch() {
+    return new StringAsyncFetch(
+        RequestContext::NewTestRequestContext(thread_system_.get()));
+  }
+
+  void ExpectFetched(StringAsyncFetch* fetch) {
+    EXPECT_TRUE(fetch->done());
+    EXPECT_TRUE(fetch->success());
+    EXPECT_EQ(HttpStatus::kOK, fetch->response_headers()->status_code());
+    EXPECT_STREQ(kBody, fetch->buffer());
+  }
+
+  int64 Stat(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  MockUrlFetcher mock_fetcher_;
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  MockTimer timer_;
+  scoped_ptr<WaitUrlAsyncFetcher> wait_fetcher_;
+  scoped_ptr<CountingUrlAsyncFetcher> counting_fetcher_;
+  scoped_ptr<CollapsingUrlAsyncFetcher> collapsing_fetcher_;
+  NullMessageHandler handler_;
+};
+
+TEST_F(CollapsingUrlAsyncFetcherTest, IdenticalFetchesCollapse) {
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch3(NewFetch());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch1.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch2.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch3.get());
+  EXPECT_EQ(1, counting_fetcher_->fetch_start_count());
+  EXPECT_EQ(1, collapsing_fetcher_->num_joinable_fetches());
+  EXPECT_EQ(2, Stat(CollapsingUrlAsyncFetcher::kCollapsedFetchCount));
+  EXPECT_FALSE(fetch1->done());
+
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch1.get());
+  ExpectFetched(fetch2.get());
+  ExpectFetched(fetch3.get());
+  EXPECT_EQ(1, counting_fetcher_->fetch_count());
+  EXPECT_EQ(0, collapsing_fetcher_->num_joinable_fetches());
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, FetchAfterCompletionGoesToOrigin) {
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch1.get());
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch1.get());
+
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch2.get());
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch2.get());
+  EXPECT_EQ(2, counting_fetcher_->fetch_count());
+  EXPECT_EQ(0, Stat(CollapsingUrlAsyncFetcher::kCollapsedFetchCount));
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, DifferentAcceptEncodingNotCollapsed) {
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  fetch2->request_headers()->Add(HttpAttributes::kAcceptEncoding, "gzip");
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch1.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch2.get());
+  EXPECT_EQ(2, counting_fetcher_->fetch_start_count());
+  EXPECT_EQ(2, collapsing_fetcher_->num_joinable_fetches());
+
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch1.get());
+  ExpectFetched(fetch2.get());
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, BackgroundAndForegroundNotCollapsed) {
+  scoped_ptr<StringAsyncFetch> background1(new BackgroundStringAsyncFetch(
+      RequestContext::NewTestRequestContext(thread_system_.get())));
+  scoped_ptr<StringAsyncFetch> background2(new BackgroundStringAsyncFetch(
+      RequestContext::NewTestRequestContext(thread_system_.get())));
+  scoped_ptr<StringAsyncFetch> foreground1(NewFetch());
+  scoped_ptr<StringAsyncFetch> foreground2(NewFetch());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, background1.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, foreground1.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, background2.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, foreground2.get());
+
+  // A user-facing fetch must not wait on, or fail with, a background fetch
+  // that a rate controller may queue or drop, so each kind goes to the
+  // origin separately.
+  EXPECT_EQ(2, counting_fetcher_->fetch_start_count());
+  EXPECT_EQ(2, collapsing_fetcher_->num_joinable_fetches());
+  EXPECT_EQ(2, Stat(CollapsingUrlAsyncFetcher::kCollapsedFetchCount));
+
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(background1.get());
+  ExpectFetched(background2.get());
+  ExpectFetched(foreground1.get());
+  ExpectFetched(foreground2.get());
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, CookiesAndNonGetNotCollapsed) {
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch3(NewFetch());
+  fetch2->request_headers()->Add(HttpAttributes::kCookie, "a=b");
+  fetch3->request_headers()->set_method(RequestHeaders::kHead);
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch1.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch2.get());
+  collapsing_fetcher_->Fetch(kUrl, &handler_, fetch3.get());
+  EXPECT_EQ(3, counting_fetcher_->fetch_start_count());
+  EXPECT_EQ(1, collapsing_fetcher_->num_joinable_fetches());
+  EXPECT_EQ(0, Stat(CollapsingUrlAsyncFetcher::kCollapsedFetchCount));
+
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch1.get());
+  ExpectFetched(fetch2.get());
+  EXPECT_TRUE(fetch3->done());
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, VaryMismatchRefetched) {
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch3(NewFetch());
+  fetch1->request_headers()->Add(HttpAttributes::kUserAgent, "A");
+  fetch2->request_headers()->Add(HttpAttributes::kUserAgent, "A");
+  fetch3->request_headers()->Add(HttpAttributes::kUserAgent, "B");
+  collapsing_fetcher_->Fetch(kVaryUrl, &handler_, fetch1.get());
+  collapsing_fetcher_->Fetch(kVaryUrl, &handler_, fetch2.get());
+  collapsing_fetcher_->Fetch(kVaryUrl, &handler_, fetch3.get());
+  EXPECT_EQ(1, counting_fetcher_->fetch_start_count());
+
+  // The response varies on User-Agent, so only the fetch with the same one
+  // as went to the origin can share it.  The other is sent on its own.
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch1.get());
+  ExpectFetched(fetch2.get());
+  EXPECT_FALSE(fetch3->done());
+  EXPECT_EQ(2, counting_fetcher_->fetch_start_count());
+  EXPECT_EQ(1, Stat(
+      CollapsingUrlAsyncFetcher::kCollapsedFetchVaryMismatchCount));
+
+  wait_fetcher_->CallCallbacks();
+  ExpectFetched(fetch3.get());
+}
+
+TEST_F(CollapsingUrlAsyncFetcherTest, FailurePropagatesToAllWaiters) {
+  const char kMissingUrl[] = "http://www.example.com/missing.css";
+  mock_fetcher_.set_fail_on_unexpected(false);
+  scoped_ptr<StringAsyncFetch> fetch1(NewFetch());
+  scoped_ptr<StringAsyncFetch> fetch2(NewFetch());
+  collapsing_fetcher_->Fetch(kMissingUrl, &handler_, fetch1.get());
+  collapsing_fetcher_->Fetch(kMissingUrl, &handler_, fetch2.get());
+  EXPECT_EQ(1, counting_fetcher_->fetch_start_count());
+
+  wait_fetcher_->CallCallbacks();
+  EXPECT_TRUE(fetch1->done());
+  EXPECT_FALSE(fetch1->success());
+  EXPECT_TRUE(fetch2->done());
+  EXPECT_FALSE(fetch2->success());
+  EXPECT_EQ(0, collapsing_fetcher_->num_joinable_fetches());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
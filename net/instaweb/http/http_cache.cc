@@ -67,6 +67,8 @@ const char HTTPCache::kCacheDeletes[] = "cache_deletes";
 // This used for doing prefix match for etag in fetcher code.
 const char HTTPCache::kEtagPrefix[] = "W/\"PSA-";
 
+const char HTTPCache::kIdentityVariantPrefix[] = "identity/";
+
 HTTPCache::HTTPCache(CacheInterface* cache, Timer* timer, Hasher* hasher,
                      Statistics* stats)
     : cache_(cache),
@@ -76,6 +78,7 @@ HTTPCache::HTTPCache(CacheInterface* cache, Timer* timer, Hasher* hasher,
       disable_html_caching_on_https_(false),
       cache_levels_(1),
       compression_level_(0),
+      store_identity_variant_(false),
       cache_time_us_(stats->GetVariable(kCacheTimeUs)),
       cache_hits_(stats->GetVariable(kCacheHits)),
       cache_misses_(stats->GetVariable(kCacheMisses)),
@@ -123,10 +126,12 @@ class HTTPCacheCallback : public CacheInterface::Callback {
  public:
   HTTPCacheCallback(const GoogleString& key,
                     const GoogleString& fragment,
+                    bool identity_variant,
                     MessageHandler* handler,
                     HTTPCache::Callback* callback, HTTPCache* http_cache)
       : key_(key),
         fragment_(fragment),
+        identity_variant_(identity_variant),
         handler_(handler),
         callback_(callback),
         http_cache_(http_cache),
@@ -143,7 +148,9 @@ class HTTPCacheCallback : public CacheInterface::Callback {
     int64 now_ms = now_us / 1000;
     ResponseHeaders* headers = callback_->response_headers();
     bool is_expired = false;
+    int64 override_cache_ttl_ms = -1;
     if ((backend_state == CacheInterface::kAvailable) &&
+        !RejectedBySummary(now_ms, &override_cache_ttl_ms, &is_expired) &&
         callback_->http_value()->Link(value(), headers, handler_) &&
         (http_cache_->force_caching_ ||
          headers->IsProxyCacheable(callback_->req_properties(),
@@ -176,7 +183,6 @@ class HTTPCacheCallback : public CacheInterface::Callback {
       // could have a fresher response. We don't need to pass request_headers
       // here, as we shouldn't have put things in here that required
       // Authorization in the first place.
-      int64 override_cache_ttl_ms = callback_->OverrideCacheTtlMs(key_);
       if (override_cache_ttl_ms > 0) {
         // Use the OverrideCacheTtlMs if specified.
         headers->ForceCaching(override_cache_ttl_ms);
@@ -245,6 +251,15 @@ class HTTPCacheCallback : public CacheInterface::Callback {
       }
     }
 
+    if (identity_variant_ && result_.status != HTTPCache::kFound) {
+      // Done will look up the gzipped entry instead, and that lookup
+      // accounts for stats, latency and fallbacks.
+      callback_->fallback_http_value()->Clear();
+      headers->Clear();
+      callback_->http_value()->Clear();
+      return false;
+    }
+
     // TODO(gee): Perhaps all of this belongs in TimingInfo.
     int64 elapsed_us = std::max(static_cast<int64>(0), now_us - start_us_);
     http_cache_->cache_time_us()->Add(elapsed_us);
@@ -274,13 +289,52 @@ class HTTPCacheCallback : public CacheInterface::Callback {
   }
 
   virtual void Done(CacheInterface::KeyState backend_state) {
-    callback_->Done(result_);
+    if (identity_variant_ && result_.status != HTTPCache::kFound) {
+      http_cache_->FindInternal(key_, fragment_, false /* identity_variant */,
+                                handler_, callback_);
+    } else {
+      callback_->Done(result_);
+    }
     delete this;
   }
 
  private:
+  // Decides from the summary of the headers stored with the entry, if it has
+  // one, whether the entry is invalidated, or is stale with nothing to keep
+  // as a fallback, so it can be treated as a miss without parsing its
+  // headers.  Fresh hits and stale fallbacks are parsed by the caller, as
+  // the callback gets their headers.  Sets *override_cache_ttl_ms, and
+  // *is_expired when rejecting an expired entry.
+  bool RejectedBySummary(int64 now_ms, int64* override_cache_ttl_ms,
+                         bool* is_expired) {
+    *override_cache_ttl_ms = callback_->OverrideCacheTtlMs(key_);
+    HTTPValue::HeadersSummary summary;
+    if (!callback_->http_value()->Link(value(), &summary)) {
+      return false;
+    }
+    if (!callback_->IsCacheValidFromSummary(key_, summary)) {
+      return true;
+    }
+    // As in HTTPCache::IsExpired; an overridden TTL is applied to the
+    // parsed headers.
+    bool expired = !http_cache_->force_caching_ &&
+        (*override_cache_ttl_ms <= 0) &&
+        (summary.expiration_time_ms <= now_ms);
+    if (!expired && callback_->IsFreshFromSummary(summary)) {
+      return false;
+    }
+    // Remembered failures are never kept as fallbacks.
+    if (HttpCacheFailure::IsFailureCachingStatus(
+            static_cast<HttpStatus::Code>(summary.status_code))) {
+      *is_expired = expired;
+      return true;
+    }
+    return false;
+  }
+
   GoogleString key_;
   GoogleString fragment_;
+  bool identity_variant_;
   RequestHeaders::Properties req_properties_;
   MessageHandler* handler_;
   HTTPCache::Callback* callback_;
@@ -295,9 +349,24 @@ class HTTPCacheCallback : public CacheInterface::Callback {
 
 void HTTPCache::Find(const GoogleString& key, const GoogleString& fragment,
                      MessageHandler* handler, Callback* callback) {
+  // Requests that can't take gzip try the uncompressed variant first, so
+  // they needn't inflate the gzipped entry.
+  bool identity_variant =
+      store_identity_variant_ &&
+      callback->request_context().get() != NULL &&
+      !callback->request_context()->accepts_gzip();
+  FindInternal(key, fragment, identity_variant, handler, callback);
+}
+
+void HTTPCache::FindInternal(const GoogleString& key,
+                             const GoogleString& fragment,
+                             bool identity_variant, MessageHandler* handler,
+                             Callback* callback) {
   HTTPCacheCallback* cb = new HTTPCacheCallback(
-      key, fragment, handler, callback, this);
-  cache_->Get(CompositeKey(key, fragment), cb);
+      key, fragment, identity_variant, handler, callback, this);
+  cache_->Get(identity_variant ? IdentityVariantKey(key, fragment)
+                               : CompositeKey(key, fragment),
+              cb);
 }
 
 void HTTPCache::UpdateStats(
@@ -400,6 +469,7 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
                             HTTPValue* value, ResponseHeaders* response_headers,
                             MessageHandler* handler) {
   HTTPValue compressed_value;
+  HTTPValue* uncompressed_value = NULL;
   // Check to see if the HTTPValue is worth gzipping.
   // TODO(jcrowell): investigate switching to mod_gzip from mod_deflate so that
   // we can set some heuristic on minimum size where compressing the data no
@@ -424,6 +494,7 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
         // The resource is text (js, css, html, svg, etc.), and not previously
         // compressed, so we'll compress it and stick the new compressed version
         // in the cache.
+        uncompressed_value = value;
         value = &compressed_value;
       }
     }
@@ -431,12 +502,42 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
   // TODO(jcrowell): prevent the unzip-rezip flow when sending compressed data
   // directly to a client through InflatingFetch.
   cache_->Put(CompositeKey(key, fragment), value->share());
+  if (store_identity_variant_) {
+    PutIdentityVariant(key, fragment, uncompressed_value, value, handler);
+  }
   if (cache_time_us_ != NULL) {
     int64 delta_us = timer_->NowUs() - start_us;
     cache_time_us_->Add(delta_us);
   }
 }
 
+void HTTPCache::PutIdentityVariant(const GoogleString& key,
+                                   const GoogleString& fragment,
+                                   HTTPValue* uncompressed_value,
+                                   HTTPValue* value, MessageHandler* handler) {
+  // If the origin served the value gzipped, inflate it once here rather
+  // than on every hit from a client that doesn't accept gzip.
+  HTTPValue inflated_value;
+  HTTPValue::HeadersSummary summary;
+  if (uncompressed_value == NULL &&
+      (!value->ExtractHeadersSummary(&summary) || summary.gzipped)) {
+    ResponseHeaders headers;
+    if (value->ExtractHeaders(&headers, handler) && headers.IsGzipped() &&
+        InflatingFetch::UnGzipValueIfCompressed(*value, &headers,
+                                                &inflated_value, handler)) {
+      uncompressed_value = &inflated_value;
+    }
+  }
+  GoogleString variant_key = IdentityVariantKey(key, fragment);
+  if (uncompressed_value != NULL) {
+    cache_->Put(variant_key, uncompressed_value->share());
+  } else {
+    // The entry isn't gzipped, so it serves every client; make sure a
+    // variant left over from an earlier Put doesn't shadow it.
+    cache_->Delete(variant_key);
+  }
+}
+
 // We do not check cache invalidation in Put. It is assumed that the date header
 // will be greater than the cache_invalidation_timestamp, if any, in domain
 // config.
@@ -540,6 +641,9 @@ bool HTTPCache::MayCacheUrl(const GoogleString& url,
 void HTTPCache::Delete(const GoogleString& key, const GoogleString& fragment) {
   cache_deletes_->Add(1);
   DeleteInternal(CompositeKey(key, fragment));
+  if (store_identity_variant_) {
+    DeleteInternal(IdentityVariantKey(key, fragment));
+  }
 }
 
 void HTTPCache::DeleteInternal(const GoogleString& key_fragment) {
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/http/public/http_cache_refresher.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/cache_url_async_fetcher.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// The sketch counts hits on every URL looked up, not just the tracked ones,
+// so it is sized for this many times as many keys.
+const int kSketchEntriesPerEntry = 8;
+
+// Returns when the response should be refreshed, or -1 if it shouldn't.
+int64 RefreshTimeMs(const ResponseHeaders& headers) {
+  if (headers.status_code() != HttpStatus::kOK) {
+    return -1;
+  }
+  return ResponseHeaders::ImminentExpirationTimeMs(
+      headers.date_ms(), headers.CacheExpirationTimeMs(),
+      headers.http_options());
+}
+
+}  // namespace
+
+const char HTTPCacheRefresher::kHttpCacheRefreshes[] = "http-cache-refreshes";
+const char HTTPCacheRefresher::kHttpCacheRefreshFailures[] =
+    "http-cache-refresh-failures";
+const char HTTPCacheRefresher::kHttpCacheRefreshEntries[] =
+    "http-cache-refresh-entries";
+
+// Discards the response, which the cache fetcher writes to the cache, and
+// reports how the refresh went.
+class HTTPCacheRefresher::RefreshFetch : public AsyncFetch {
+ public:
+  RefreshFetch(HTTPCacheRefresher* refresher, const GoogleString& key,
+               const RequestContextPtr& request_context)
+      : AsyncFetch(request_context),
+        refresher_(refresher),
+        key_(key) {
+    request_headers()->set_method(RequestHeaders::kGet);
+  }
+  virtual ~RefreshFetch() {}
+
+  virtual bool IsBackgroundFetch() const { return true; }
+
+ protected:
+  virtual void HandleHeadersComplete() {}
+  virtual bool HandleWrite(const StringPiece& content,
+                           MessageHandler* handler) {
+    return true;
+  }
+  virtual bool HandleFlush(MessageHandler* handler) { return true; }
+  virtual void HandleDone(bool success) {
+    refresher_->RefreshDone(key_, success, *response_headers());
+    delete this;
+  }
+
+ private:
+  HTTPCacheRefresher* refresher_;
+  GoogleString key_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefreshFetch);
+};
+
+HTTPCacheRefresher::HTTPCacheRefresher(CacheUrlAsyncFetcher* cache_fetcher,
+                                       const HttpOptions& http_options,
+                                       Scheduler* scheduler,
+                                       QueuedWorkerPool* workers,
+                                       ThreadSystem* thread_system,
+                                       Statistics* statistics,
+                                       MessageHandler* handler,
+                                       int max_entries)
+    : cache_fetcher_(cache_fetcher),
+      http_options_(http_options),
+      scheduler_(scheduler),
+      workers_(workers),
+      sequence_(workers->NewSequence()),
+      thread_system_(thread_system),
+      timer_(scheduler->timer()),
+      handler_(handler),
+      max_entries_(max_entries),
+      sketch_(static_cast<int64>(max_entries) * kSketchEntriesPerEntry),
+      mutex_(thread_system->NewMutex()),
+      outstanding_refreshes_(0),
+      next_sweep_ms_(0),
+      refreshes_(statistics->GetVariable(kHttpCacheRefreshes)),
+      refresh_failures_(statistics->GetVariable(kHttpCacheRefreshFailures)),
+      tracked_entries_(
+          statistics->GetUpDownCounter(kHttpCacheRefreshEntries)) {
+  DCHECK(cache_fetcher_->http_cache_refresher() == NULL);
+  cache_fetcher_->set_refresh_imminently_expiring(true);
+  // Serving a stale response to a refresh would only start a freshen of its
+  // own, and those need AsyncOpHooks.
+  cache_fetcher_->set_serve_stale_while_revalidate_threshold_sec(0);
+  cache_fetcher_->set_proactively_freshen_user_facing_request(false);
+  if (sequence_ != NULL) {
+    scheduler_->RegisterWorker(sequence_);
+  }
+}
+
+HTTPCacheRefresher::~HTTPCacheRefresher() {
+  if (sequence_ != NULL) {
+    scheduler_->UnregisterWorker(sequence_);
+    workers_->FreeSequence(sequence_);
+  }
+  ScopedMutex lock(mutex_.get());
+  tracked_entries_->Add(-static_cast<int64>(entries_.size()));
+}
+
+void HTTPCacheRefresher::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kHttpCacheRefreshes);
+  statistics->AddVariable(kHttpCacheRefreshFailures);
+  statistics->AddUpDownCounter(kHttpCacheRefreshEntries);
+}
+
+GoogleString HTTPCacheRefresher::Key(const GoogleString& url,
+                                     const GoogleString& fragment) {
+  return StrCat(fragment, "\n", url);
+}
+
+uint64 HTTPCacheRefresher::KeyHash(const GoogleString& key) {
+  return HashString<CasePreserve, uint64>(key.data(), key.size());
+}
+
+bool HTTPCacheRefresher::NoteHit(const GoogleString& url,
+                                 const GoogleString& fragment,
+                                 const ResponseHeaders& headers) {
+  if (sequence_ == NULL) {
+    return false;
+  }
+  GoogleString key = Key(url, fragment);
+  uint64 hash = KeyHash(key);
+  sketch_.Increment(hash);
+  int64 refresh_at_ms = RefreshTimeMs(headers);
+  if ((refresh_at_ms < 0) || (sketch_.Estimate(hash) < kMinHits)) {
+    return false;
+  }
+
+  int64 now_ms = timer_->NowMs();
+  bool sweep = false;
+  bool tracked = true;
+  {
+    ScopedMutex lock(mutex_.get());
+    EntryMap::iterator p = entries_.find(key);
+    if (p != entries_.end()) {
+      // The entry may have been refreshed by someone else.
+      if (!p->second.refreshing) {
+        p->second.refresh_at_ms = refresh_at_ms;
+      }
+    } else if (static_cast<int>(entries_.size()) < max_entries_) {
+      Entry* entry = &entries_[key];
+      entry->url = url;
+      entry->fragment = fragment;
+      entry->refresh_at_ms = refresh_at_ms;
+      tracked_entries_->Add(1);
+    } else {
+      tracked = false;
+    }
+    if (now_ms >= next_sweep_ms_) {
+      next_sweep_ms_ = now_ms + kSweepIntervalMs;
+      sweep = true;
+    }
+  }
+  if (sweep) {
+    sequence_->Add(MakeFunction(this, &HTTPCacheRefresher::Sweep));
+  }
+  return tracked;
+}
+
+void HTTPCacheRefresher::Sweep() {
+  int64 now_ms = timer_->NowMs();
+  std::vector<Entry> due;
+  StringVector due_keys;
+  {
+    ScopedMutex lock(mutex_.get());
+    for (EntryMap::iterator p = entries_.begin(); p != entries_.end(); ) {
+      Entry* entry = &p->second;
+      if (entry->refreshing || (entry->refresh_at_ms > now_ms)) {
+        ++p;
+      } else if (sketch_.Estimate(KeyHash(p->first)) < kMinHits) {
+        // It is no longer popular, so let it expire.
+        entries_.erase(p++);
+        tracked_entries_->Add(-1);
+      } else if (outstanding_refreshes_ < kMaxOutstandingRefreshes) {
+        entry->refreshing = true;
+        ++outstanding_refreshes_;
+        due.push_back(*entry);
+        due_keys.push_back(p->first);
+        ++p;
+      } else {
+        break;
+      }
+    }
+  }
+
+  for (int i = 0, n = due.size(); i < n; ++i) {
+    RequestContextPtr request_context(new RequestContext(
+        http_options_, thread_system_->NewMutex(), timer_));
+    // Keep gzipped entries as they are, rather than falling back to, and
+    // revalidating, their uncompressed content.
+    request_context->SetAcceptsGzip(true);
+    cache_fetcher_->FetchInFragment(
+        due[i].url, due[i].fragment, handler_,
+        new RefreshFetch(this, due_keys[i], request_context));
+  }
+}
+
+void HTTPCacheRefresher::RefreshDone(const GoogleString& key, bool success,
+                                     const ResponseHeaders& headers) {
+  int64 refresh_at_ms = success ? RefreshTimeMs(headers) : -1;
+  if (refresh_at_ms >= 0) {
+    refreshes_->Add(1);
+  } else {
+    refresh_failures_->Add(1);
+  }
+
+  ScopedMutex lock(mutex_.get());
+  --outstanding_refreshes_;
+  EntryMap::iterator p = entries_.find(key);
+  if (p == entries_.end()) {
+    return;
+  }
+  if (refresh_at_ms >= 0) {
+    p->second.refreshing = false;
+    p->second.refresh_at_ms = refresh_at_ms;
+  } else {
+    // Leave it to user traffic to bring it back, if it's still cacheable.
+    entries_.erase(p);
+    tracked_entries_->Add(-1);
+  }
+}
+
+int HTTPCacheRefresher::num_entries() const {
+  ScopedMutex lock(mutex_.get());
+  return entries_.size();
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/http/public/http_cache_refresher.h"
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/cache_url_async_fetcher.h"
+#include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/http_cache.h"
+#include "net/instaweb/http/public/mock_url_fetcher.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_hasher.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/http_options.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/thread/mock_scheduler.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kUrl[] = "http://www.example.com/a.css";
+const char kOtherUrl[] = "http://www.example.com/b.css";
+const char kBody[] = "a{color:red}";
+const char kEtag[] = "\"abc\"";
+const int64 kTtlMs = 10 * Timer::kMinuteMs;
+
+class HTTPCacheRefresherTest : public ::testing::Test {
+ protected:
+  HTTPCacheRefresherTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        scheduler_(thread_system_.get(), &timer_),
+        workers_(1, "refresh", thread_system_.get()),
+        lru_cache_(100 * 1000),
+        counting_fetcher_(&mock_fetcher_) {
+    HTTPCache::InitStats(&stats_);
+    HTTPCacheRefresher::InitStats(&stats_);
+    http_cache_.reset(new HTTPCache(&lru_cache_, &timer_, &hasher_, &stats_));
+    mock_fetcher_.set_timer(&timer_);
+    mock_fetcher_.set_update_date_headers(true);
+
+    ResponseHeaders headers;
+    headers.SetStatusAndReason(HttpStatus::kOK);
+    headers.Add(HttpAttributes::kContentType, "text/css");
+    headers.SetDateAndCaching(timer_.NowMs(), kTtlMs);
+    mock_fetcher_.SetConditionalResponse(kUrl, -1, kEtag, headers, kBody);
+    mock_fetcher_.SetResponse(kOtherUrl, headers, kBody);
+
+    cache_fetcher_.reset(NewCacheFetcher(""));
+    ResetRefresher(100);
+  }
+
+  virtual ~HTTPCacheRefresherTest() {
+    workers_.ShutDown();
+  }
+
+  CacheUrlAsyncFetcher* NewCacheFetcher(const GoogleString& fragment) {
+    return new CacheUrlAsyncFetcher(&hasher_, NULL, http_cache_.get(),
+                                    fragment, NULL, &counting_fetcher_);
+  }
+
+  void ResetRefresher(int max_entries) {
+    cache_fetcher_->set_http_cache_refresher(NULL);
+    refresher_.reset(new HTTPCacheRefresher(
+        NewCacheFetcher(""), kDefaultHttpOptionsForTests, &scheduler_,
+        &workers_, thread_system_.get(), &stats_, &handler_, max_entries));
+    cache_fetcher_->set_http_cache_refresher(refresher_.get());
+  }
+
+  // Fetches url through the user-facing cache fetcher, then waits for any
+  // sweep that started.
+  void Fetch(const char* url) {
+    StringAsyncFetch fetch(
+        RequestContext::NewTestRequestContext(thread_system_.get()));
+    cache_fetcher_->Fetch(url, &handler_, &fetch);
+    scheduler_.AwaitQuiescence();
+    EXPECT_TRUE(fetch.done());
+    EXPECT_TRUE(fetch.success());
+    EXPECT_STREQ(kBody, fetch.buffer());
+  }
+
+  int64 Stat(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  MockTimer timer_;
+  MockScheduler scheduler_;
+  QueuedWorkerPool workers_;
+  MockHasher hasher_;
+  LRUCache lru_cache_;
+  scoped_ptr<HTTPCache> http_cache_;
+  MockUrlFetcher mock_fetcher_;
+  CountingUrlAsyncFetcher counting_fetcher_;
+  NullMessageHandler handler_;
+  scoped_ptr<CacheUrlAsyncFetcher> cache_fetcher_;
+  scoped_ptr<HTTPCacheRefresher> refresher_;
+};
+
+TEST_F(HTTPCacheRefresherTest, PopularEntryStaysFresh) {
+  Fetch(kUrl);  // Miss.
+  Fetch(kUrl);  // One hit is not enough to track it.
+  EXPECT_EQ(0, refresher_->num_entries());
+  Fetch(kUrl);
+  EXPECT_EQ(1, refresher_->num_entries());
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+
+  // Nothing is refreshed until the entry is imminently expiring, 80% of the
+  // way through its TTL.
+  scheduler_.AdvanceTimeMs(kTtlMs / 2);
+  Fetch(kUrl);
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, Stat(HTTPCacheRefresher::kHttpCacheRefreshes));
+
+  // Then a hit gets the refresher to revalidate it in the background, while
+  // it is still served from the cache.
+  scheduler_.AdvanceTimeMs(kTtlMs * 2 / 5);
+  Fetch(kUrl);
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, Stat(HTTPCacheRefresher::kHttpCacheRefreshes));
+  EXPECT_EQ(0, Stat(HTTPCacheRefresher::kHttpCacheRefreshFailures));
+  EXPECT_EQ(1, refresher_->num_entries());
+
+  // The entry was due to expire by now, but the refresh extended it.
+  scheduler_.AdvanceTimeMs(kTtlMs / 5);
+  Fetch(kUrl);
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+}
+
+TEST_F(HTTPCacheRefresherTest, RefreshesInFragmentOfHits) {
+  cache_fetcher_.reset(NewCacheFetcher("example.com"));
+  cache_fetcher_->set_http_cache_refresher(refresher_.get());
+  Fetch(kUrl);
+  Fetch(kUrl);
+  Fetch(kUrl);
+  EXPECT_EQ(1, refresher_->num_entries());
+
+  scheduler_.AdvanceTimeMs(kTtlMs * 9 / 10);
+  Fetch(kUrl);
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, Stat(HTTPCacheRefresher::kHttpCacheRefreshes));
+
+  // It was the entry under example.com that was extended.
+  scheduler_.AdvanceTimeMs(kTtlMs / 5);
+  Fetch(kUrl);
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+}
+
+TEST_F(HTTPCacheRefresherTest, EntriesAreBounded) {
+  ResetRefresher(1);
+  for (int i = 0; i < 3; ++i) {
+    Fetch(kUrl);
+    Fetch(kOtherUrl);
+  }
+  EXPECT_EQ(1, refresher_->num_entries());
+  EXPECT_EQ(1, stats_.GetUpDownCounter(
+      HTTPCacheRefresher::kHttpCacheRefreshEntries)->Get());
+}
+
+TEST_F(HTTPCacheRefresherTest, FailedRefreshStopsTracking) {
+  Fetch(kUrl);
+  Fetch(kUrl);
+  Fetch(kUrl);
+  EXPECT_EQ(1, refresher_->num_entries());
+
+  mock_fetcher_.set_fail_on_unexpected(false);
+  mock_fetcher_.Disable();
+  scheduler_.AdvanceTimeMs(kTtlMs * 9 / 10);
+  Fetch(kUrl);
+  EXPECT_EQ(1, Stat(HTTPCacheRefresher::kHttpCacheRefreshFailures));
+  EXPECT_EQ(0, refresher_->num_entries());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -69,6 +69,8 @@ class HTTPCacheTest : public testing::Test {
     explicit Callback(const RequestContextPtr& ctx) : HTTPCache::Callback(ctx) {
       called_ = false;
       cache_valid_ = true;
+      cache_valid_from_summary_ = true;
+      num_is_cache_valid_calls_ = 0;
       fresh_ = true;
       override_cache_ttl_ms_= -1;
       http_value()->Clear();
@@ -81,8 +83,13 @@ class HTTPCacheTest : public testing::Test {
     virtual bool IsCacheValid(const GoogleString& key,
                               const ResponseHeaders& headers) {
       // For unit testing, we are simply stubbing IsCacheValid.
+      ++num_is_cache_valid_calls_;
       return cache_valid_;
     }
+    virtual bool IsCacheValidFromSummary(
+        const GoogleString& key, const HTTPValue::HeadersSummary& summary) {
+      return cache_valid_from_summary_;
+    }
     virtual bool IsFresh(const ResponseHeaders& headers) {
       // For unit testing, we are simply stubbing IsFresh.
       return fresh_;
@@ -99,6 +106,8 @@ class HTTPCacheTest : public testing::Test {
     bool called_;
     HTTPCache::FindResult result_;
     bool cache_valid_;
+    bool cache_valid_from_summary_;
+    int num_is_cache_valid_calls_;
     bool fresh_;
     int64 override_cache_ttl_ms_;
   };
@@ -638,6 +647,42 @@ TEST_F(HTTPCacheTest, CacheInvalidation) {
       Find(kUrl, kFragment, &value, &meta_data_out, &message_handler_, false));
 }
 
+TEST_F(HTTPCacheTest, CacheInvalidationFromSummary) {
+  ResponseHeaders meta_data_in, meta_data_out;
+  InitHeaders(&meta_data_in, "max-age=300");
+  Put(kUrl, kFragment, &meta_data_in, "content", &message_handler_);
+  HTTPValue value;
+
+  // A hit has its headers parsed and checked in full before it is returned.
+  scoped_ptr<Callback> callback(NewCallback());
+  EXPECT_EQ(kFoundResult,
+            FindWithCallback(kUrl, kFragment, &value, &meta_data_out,
+                             &message_handler_, callback.get()));
+  EXPECT_EQ(1, callback->num_is_cache_valid_calls_);
+
+  // An entry invalidated by its summary is a miss without its headers ever
+  // being parsed, and is not kept as a fallback.
+  callback.reset(NewCallback());
+  value.Clear();
+  callback->cache_valid_from_summary_ = false;
+  EXPECT_EQ(kNotFoundResult,
+            FindWithCallback(kUrl, kFragment, &value, &meta_data_out,
+                             &message_handler_, callback.get()));
+  EXPECT_EQ(0, callback->num_is_cache_valid_calls_);
+  EXPECT_TRUE(callback->fallback_http_value()->Empty());
+
+  // So is a remembered failure once it has expired.
+  http_cache_->RememberFailure(kUrl, kFragment, kFetchStatusOtherError,
+                               &message_handler_);
+  mock_timer_.AdvanceMs(301 * 1000);
+  callback.reset(NewCallback());
+  EXPECT_EQ(kNotFoundResult,
+            FindWithCallback(kUrl, kFragment, &value, &meta_data_out,
+                             &message_handler_, callback.get()));
+  EXPECT_EQ(0, callback->num_is_cache_valid_calls_);
+  EXPECT_TRUE(callback->fallback_http_value()->Empty());
+}
+
 TEST_F(HTTPCacheTest, IsFresh) {
   const char kDataIn[] = "content";
   ResponseHeaders meta_data_in, meta_data_out;
@@ -936,6 +981,91 @@ TEST_F(HTTPCacheTest, LeaveFallbackCompressed) {
       HttpAttributes::kContentEncoding, "gzip"));
 }
 
+TEST_F(HTTPCacheTest, IdentityVariant) {
+  http_cache_->set_store_identity_variant(true);
+  ResponseHeaders response_headers;
+  PopulateGzippedEntry("max-age=300", &response_headers);
+  // The entry and its uncompressed variant.
+  EXPECT_EQ(static_cast<size_t>(2), lru_cache_.num_elements());
+
+  // A request without gzip is served the stored uncompressed variant.
+  HTTPValue value;
+  response_headers.Clear();
+  EXPECT_EQ(kFoundResult, Find(kUrl, kFragment, &value, &response_headers,
+                               &message_handler_));
+  EXPECT_FALSE(response_headers.IsGzipped());
+  StringPiece contents;
+  ASSERT_TRUE(value.ExtractContents(&contents));
+  EXPECT_EQ(".a         {color:blue;}                  ", contents);
+
+  // A request that accepts gzip still gets the gzipped entry.
+  value.Clear();
+  response_headers.Clear();
+  EXPECT_EQ(kFoundResult, FindAcceptGzip(
+      kUrl, kFragment, &value, &response_headers, &message_handler_));
+  EXPECT_TRUE(response_headers.IsGzipped());
+
+  // Without the variant, we fall back to inflating the gzipped entry, and
+  // count the lookup only once.
+  lru_cache_.Delete(http_cache_->IdentityVariantKey(kUrl, kFragment));
+  value.Clear();
+  response_headers.Clear();
+  EXPECT_EQ(kFoundResult, Find(kUrl, kFragment, &value, &response_headers,
+                               &message_handler_));
+  EXPECT_FALSE(response_headers.IsGzipped());
+  ASSERT_TRUE(value.ExtractContents(&contents));
+  EXPECT_EQ(".a         {color:blue;}                  ", contents);
+  EXPECT_EQ(3, GetStat(HTTPCache::kCacheHits));
+  EXPECT_EQ(0, GetStat(HTTPCache::kCacheMisses));
+
+  response_headers.Clear();
+  PopulateGzippedEntry("max-age=300", &response_headers);
+  EXPECT_EQ(static_cast<size_t>(2), lru_cache_.num_elements());
+  http_cache_->Delete(kUrl, kFragment);
+  EXPECT_EQ(static_cast<size_t>(0), lru_cache_.num_elements());
+}
+
+TEST_F(HTTPCacheTest, IdentityVariantFallbackValue) {
+  http_cache_->set_store_identity_variant(true);
+  ResponseHeaders response_headers;
+  PopulateGzippedEntry("max-age=300", &response_headers);
+  mock_timer_.AdvanceMs(310 * Timer::kSecondMs);  // Makes entry stale.
+  response_headers.Clear();
+
+  // The stale variant is passed over, and the stale gzipped entry supplies
+  // the fallback value, uncompressed as before.
+  scoped_ptr<Callback> callback(NewCallback());
+  HTTPValue value;
+  EXPECT_EQ(kNotFoundResult, FindWithCallback(
+      kUrl, kFragment, &value, &response_headers, &message_handler_,
+      callback.get()));
+  EXPECT_TRUE(callback->fallback_http_value()->ExtractHeaders(
+      &response_headers, &message_handler_));
+  EXPECT_FALSE(response_headers.IsGzipped());
+  EXPECT_EQ(1, GetStat(HTTPCache::kCacheMisses));
+  EXPECT_EQ(1, GetStat(HTTPCache::kCacheFallbacks));
+}
+
+TEST_F(HTTPCacheTest, IdentityVariantDroppedByUncompressedPut) {
+  http_cache_->set_store_identity_variant(true);
+  ResponseHeaders response_headers;
+  PopulateGzippedEntry("max-age=300", &response_headers);
+  // The entry and its uncompressed variant.
+  EXPECT_EQ(static_cast<size_t>(2), lru_cache_.num_elements());
+
+  // Replacing the entry with one that isn't gzipped drops the variant, so
+  // it can't shadow the new value.
+  http_cache_->SetCompressionLevel(0);
+  Put(kUrl, kFragment, &response_headers, "new", &message_handler_);
+  EXPECT_EQ(static_cast<size_t>(1), lru_cache_.num_elements());
+  HTTPValue value;
+  EXPECT_EQ(kFoundResult, Find(kUrl, kFragment, &value, &response_headers,
+                               &message_handler_));
+  StringPiece contents;
+  ASSERT_TRUE(value.ExtractContents(&contents));
+  EXPECT_EQ("new", contents);
+}
+
 class HTTPCacheWriteThroughTest : public HTTPCacheTest {
  protected:
   // Unlike HTTPCacheTest::Callback this can produce different validity for
@@ -1228,14 +1358,14 @@ TEST_F(HTTPCacheWriteThroughTest, PutGet) {
 // Check size-limits for the small cache
 TEST_F(HTTPCacheWriteThroughTest, SizeLimit) {
   ClearStats();
-  write_through_cache_.set_cache1_limit(183);  // See below.
+  write_through_cache_.set_cache1_limit(221);  // See below.
   ResponseHeaders headers_in;
   InitHeaders(&headers_in, "max-age=300");
 
   // This one will fit. Size:
   // Key: v2/www.test.com/http://www.test.com/1 --- 37 bytes.
-  // Value: 145 bytes
-  // 145 + 37 = 182.
+  // Value: 145 bytes, plus a 38 byte summary of the headers.
+  // 145 + 38 + 37 = 220.
   Put(key_, fragment_, &headers_in, "Name", &message_handler_);
   EXPECT_EQ(0, GetStat(HTTPCache::kCacheHits));
   EXPECT_EQ(0, GetStat(HTTPCache::kCacheMisses));
@@ -23,6 +23,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/http/response_headers_parser.h"
 
@@ -34,13 +35,145 @@ namespace {
 // and vice versa.  Both the headers and body are variable length, and to avoid
 // having to re-shuffle memory, we encode which is first in the buffer as the
 // first byte.  The next four bytes encode the size.
+//
+// Values written with the upper-case type identifiers start their headers
+// with a summary of them (see HTTPValue::HeadersSummary), so that hot paths
+// can read the fields they need without parsing the serialized headers.  All
+// integers are little-endian:
+//   2 bytes   size of the summary, including this field
+//   4 bytes   status code
+//   1 byte    flags: kSummaryProxyCacheable, ...
+//   8 bytes   date in ms
+//   8 bytes   cache expiration time in ms
+//   then Content-Type, Etag and Last-Modified, each a 2-byte length followed
+//   by the header's value.
+// New fields may be added at the end; readers skip what they don't know.
+// The lower-case identifiers, without a summary, are still read, and are
+// written when a summary field doesn't fit.
 const char kHeadersFirst = 'h';
 const char kBodyFirst = 'b';
+const char kHeadersFirstWithSummary = 'H';
+const char kBodyFirstWithSummary = 'B';
 
 const int kStorageTypeOverhead = 1;
 const int kStorageSizeOverhead = 4;
 const int kStorageOverhead = kStorageTypeOverhead + kStorageSizeOverhead;
 
+const int kSummarySizeBytes = 2;
+const int kSummaryStringSizeBytes = 2;
+const size_t kMaxSummaryString = 0xffff;
+
+const uint8 kSummaryProxyCacheable = 1;
+const uint8 kSummaryBrowserCacheable = 2;
+const uint8 kSummaryGzipped = 4;
+
+bool IsHeadersFirst(char type_id) {
+  return type_id == kHeadersFirst || type_id == kHeadersFirstWithSummary;
+}
+
+bool IsBodyFirst(char type_id) {
+  return type_id == kBodyFirst || type_id == kBodyFirstWithSummary;
+}
+
+bool HasSummary(char type_id) {
+  return type_id == kHeadersFirstWithSummary ||
+      type_id == kBodyFirstWithSummary;
+}
+
+void AppendLittleEndian(uint64 value, int num_bytes, GoogleString* out) {
+  for (int i = 0; i < num_bytes; ++i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+// Reads the fields of a summary in order, failing once one runs off the end.
+class SummaryReader {
+ public:
+  explicit SummaryReader(StringPiece data) : data_(data) {}
+
+  bool ReadInt(int num_bytes, uint64* value) {
+    if (data_.size() < static_cast<size_t>(num_bytes)) {
+      return false;
+    }
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(data_.data());
+    *value = 0;
+    for (int i = 0; i < num_bytes; ++i) {
+      *value |= static_cast<uint64>(bytes[i]) << (8 * i);
+    }
+    data_.remove_prefix(num_bytes);
+    return true;
+  }
+
+  bool ReadString(StringPiece* value) {
+    uint64 size;
+    if (!ReadInt(kSummaryStringSizeBytes, &size) || data_.size() < size) {
+      return false;
+    }
+    *value = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+ private:
+  StringPiece data_;
+};
+
+// Returns the size of the summary at the start of the headers chunk, or 0 if
+// it's malformed.
+size_t SummarySize(StringPiece chunk) {
+  uint64 size;
+  SummaryReader reader(chunk);
+  if (!reader.ReadInt(kSummarySizeBytes, &size) ||
+      size < static_cast<uint64>(kSummarySizeBytes) || size > chunk.size()) {
+    return 0;
+  }
+  return size;
+}
+
+// Encodes the summary of headers, which must have had their caching
+// computed.  Returns false if a value is too long to be stored in one.
+bool EncodeSummary(const net_instaweb::ResponseHeaders& headers,
+                   GoogleString* summary) {
+  using net_instaweb::HttpAttributes;
+  const char* strings[] = {
+    headers.Lookup1(HttpAttributes::kContentType),
+    headers.Lookup1(HttpAttributes::kEtag),
+    headers.Lookup1(HttpAttributes::kLastModified)
+  };
+  uint8 flags = 0;
+  if (headers.IsProxyCacheable()) {
+    flags |= kSummaryProxyCacheable;
+  }
+  if (headers.IsBrowserCacheable()) {
+    flags |= kSummaryBrowserCacheable;
+  }
+  if (headers.IsGzipped()) {
+    flags |= kSummaryGzipped;
+  }
+  summary->clear();
+  AppendLittleEndian(0, kSummarySizeBytes, summary);  // Filled in below.
+  AppendLittleEndian(static_cast<uint32>(headers.status_code()), 4, summary);
+  AppendLittleEndian(flags, 1, summary);
+  AppendLittleEndian(headers.date_ms(), 8, summary);
+  AppendLittleEndian(headers.CacheExpirationTimeMs(), 8, summary);
+  for (int i = 0, n = arraysize(strings); i < n; ++i) {
+    StringPiece value(strings[i] == NULL ? "" : strings[i]);
+    if (value.size() > kMaxSummaryString) {
+      return false;
+    }
+    AppendLittleEndian(value.size(), kSummaryStringSizeBytes, summary);
+    value.AppendToString(summary);
+  }
+  if (summary->size() > 0xffff) {
+    return false;
+  }
+  GoogleString size;
+  AppendLittleEndian(summary->size(), kSummarySizeBytes, &size);
+  summary->replace(0, kSummarySizeBytes, size);
+  return true;
+}
+
 }  // namespace
 
 namespace net_instaweb {
@@ -60,10 +193,17 @@ void HTTPValue::SetHeaders(ResponseHeaders* headers) {
   CopyOnWrite();
   GoogleString headers_string;
   StringWriter writer(&headers_string);
+  // This computes the caching fields if need be, as the summary requires.
   headers->WriteAsBinary(&writer, NULL);
+  GoogleString summary;
+  bool has_summary = EncodeSummary(*headers, &summary);
+  if (!has_summary) {
+    summary.clear();
+  }
   if (storage_.empty()) {
-    storage_.Append(&kHeadersFirst, 1);
-    SetSizeOfFirstChunk(headers_string.size());
+    char type_id = has_summary ? kHeadersFirstWithSummary : kHeadersFirst;
+    storage_.Append(&type_id, 1);
+    SetSizeOfFirstChunk(summary.size() + headers_string.size());
   } else {
     CHECK(type_identifier() == kBodyFirst);
     // Using 'unsigned int' to facilitate bit-shifting in
@@ -71,7 +211,11 @@ void HTTPValue::SetHeaders(ResponseHeaders* headers) {
     // want to worry about sign extension.
     int size = SizeOfFirstChunk();
     CHECK_EQ(storage_.size(), (kStorageOverhead + size));
+    if (has_summary) {
+      storage_.WriteAt(0, &kBodyFirstWithSummary, 1);
+    }
   }
+  storage_.Append(summary);
   storage_.Append(headers_string);
 }
 
@@ -87,13 +231,23 @@ bool HTTPValue::Write(const StringPiece& str, MessageHandler* handler) {
     CHECK(string_size == storage_.size() - kStorageOverhead);
     SetSizeOfFirstChunk(str.size() + string_size);
   } else {
-    CHECK(type_identifier() == kHeadersFirst);
+    CHECK(IsHeadersFirst(type_identifier()));
   }
   storage_.Append(str.data(), str.size());
   contents_size_ += str.size();
   return true;
 }
 
+void HTTPValue::ReserveContents(int64 contents_size) {
+  DCHECK(storage_.empty());
+  // Leave some room for the headers, which will follow the contents.
+  const int64 kHeadersReserve = 1024;
+  int64 capacity = kStorageOverhead + contents_size + kHeadersReserve;
+  if (storage_.empty() && (capacity <= kint32max)) {
+    storage_.Reserve(static_cast<int>(capacity));
+  }
+}
+
 bool HTTPValue::Flush(MessageHandler* handler) {
   return true;
 }
@@ -128,33 +282,76 @@ unsigned int HTTPValue::SizeOfFirstChunk() const {
   return size;
 }
 
-// Note that we avoid CHECK, and instead return false on error.  So if
-// our cache gets corrupted (say) on disk, we just consider it an
-// invalid entry rather than aborting the server.
-bool HTTPValue::ExtractHeaders(ResponseHeaders* headers,
-                               MessageHandler* handler) const {
+bool HTTPValue::HeadersChunk(StringPiece* chunk) const {
   bool ret = false;
-  headers->Clear();
   if (storage_.size() >= kStorageOverhead) {
     char type_id = type_identifier();
     const char* start = storage_.data() + kStorageOverhead;
     int size = SizeOfFirstChunk();
     if (size <= storage_.size() - kStorageOverhead) {
-      if (type_id == kBodyFirst) {
+      if (IsBodyFirst(type_id)) {
         start += size;
         size = storage_.size() - size - kStorageOverhead;
         ret = true;
       } else {
-        ret = (type_id == kHeadersFirst);
-      }
-      if (ret) {
-        ret = headers->ReadFromBinary(StringPiece(start, size), handler);
+        ret = IsHeadersFirst(type_id);
       }
+      *chunk = StringPiece(start, size);
     }
   }
   return ret;
 }
 
+// Note that we avoid CHECK, and instead return false on error.  So if
+// our cache gets corrupted (say) on disk, we just consider it an
+// invalid entry rather than aborting the server.
+bool HTTPValue::ExtractHeaders(ResponseHeaders* headers,
+                               MessageHandler* handler) const {
+  headers->Clear();
+  StringPiece chunk;
+  if (!HeadersChunk(&chunk)) {
+    return false;
+  }
+  if (HasSummary(type_identifier())) {
+    size_t summary_size = SummarySize(chunk);
+    if (summary_size == 0) {
+      return false;
+    }
+    chunk.remove_prefix(summary_size);
+  }
+  return headers->ReadFromBinary(chunk, handler);
+}
+
+bool HTTPValue::ExtractHeadersSummary(HeadersSummary* summary) const {
+  StringPiece chunk;
+  if (!HeadersChunk(&chunk) || !HasSummary(type_identifier())) {
+    return false;
+  }
+  size_t summary_size = SummarySize(chunk);
+  if (summary_size == 0) {
+    return false;
+  }
+  SummaryReader reader(chunk.substr(kSummarySizeBytes,
+                                    summary_size - kSummarySizeBytes));
+  uint64 status_code, flags, date_ms, expiration_time_ms;
+  if (!reader.ReadInt(4, &status_code) ||
+      !reader.ReadInt(1, &flags) ||
+      !reader.ReadInt(8, &date_ms) ||
+      !reader.ReadInt(8, &expiration_time_ms) ||
+      !reader.ReadString(&summary->content_type) ||
+      !reader.ReadString(&summary->etag) ||
+      !reader.ReadString(&summary->last_modified)) {
+    return false;
+  }
+  summary->status_code = static_cast<int32>(status_code);
+  summary->date_ms = static_cast<int64>(date_ms);
+  summary->expiration_time_ms = static_cast<int64>(expiration_time_ms);
+  summary->proxy_cacheable = (flags & kSummaryProxyCacheable) != 0;
+  summary->browser_cacheable = (flags & kSummaryBrowserCacheable) != 0;
+  summary->gzipped = (flags & kSummaryGzipped) != 0;
+  return true;
+}
+
 // Note that we avoid CHECK, and instead return false on error.  So if
 // our cache gets corrupted (say) on disk, we just consider it an
 // invalid entry rather than aborting the server.
@@ -165,12 +362,12 @@ bool HTTPValue::ExtractContents(StringPiece* val) const {
     const char* start = storage_.data() + kStorageOverhead;
     int size = SizeOfFirstChunk();
     if (size <= storage_.size() - kStorageOverhead) {
-      if (type_id == kHeadersFirst) {
+      if (IsHeadersFirst(type_id)) {
         start += size;
         size = storage_.size() - size - kStorageOverhead;
         ret = true;
       } else {
-        ret = (type_id == kBodyFirst);
+        ret = IsBodyFirst(type_id);
       }
       *val = StringPiece(start, size);
     }
@@ -189,7 +386,7 @@ int64 HTTPValue::ComputeContentsSize() const {
     // If the headers are stored first then update the size with storage size -
     // first chunk size.
     if ((size <= static_cast<int64>(storage_.size() - kStorageOverhead)) &&
-        (type_id == kHeadersFirst)) {
+        IsHeadersFirst(type_id)) {
       size = storage_.size() - size - kStorageOverhead;
     }
   }
@@ -222,6 +419,23 @@ bool HTTPValue::Link(SharedString* src, ResponseHeaders* headers,
   return ok;
 }
 
+bool HTTPValue::Link(SharedString* src, HeadersSummary* summary) {
+  bool ok = false;
+  if (src->size() >= kStorageOverhead) {
+    SharedString temp(storage_);
+    int64 temp_contents_size = contents_size_;
+    storage_ = *src;
+    contents_size_ = ComputeContentsSize();
+    StringPiece contents;
+    ok = ExtractHeadersSummary(summary) && ExtractContents(&contents);
+    if (!ok) {
+      storage_ = temp;
+      contents_size_ = temp_contents_size;
+    }
+  }
+  return ok;
+}
+
 bool HTTPValue::Decode(StringPiece encoded_value, GoogleString* http_string,
                        MessageHandler* handler) {
   ResponseHeaders headers;
@@ -24,6 +24,8 @@
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
 
@@ -108,6 +110,22 @@ TEST_F(HTTPValueTest, EmptyContentsFirst) {
   CheckResponseHeaders(check_headers);
 }
 
+TEST_F(HTTPValueTest, ReservedContentsFirst) {
+  HTTPValue value;
+  ResponseHeaders headers, check_headers;
+  FillResponseHeaders(&headers);
+  value.ReserveContents(8);
+  value.Write("body", &message_handler_);
+  value.Write("body", &message_handler_);
+  value.SetHeaders(&headers);
+  StringPiece body;
+  ASSERT_TRUE(value.ExtractContents(&body));
+  EXPECT_EQ("bodybody", body.as_string());
+  EXPECT_EQ(body.size(), ComputeContentsSize(&value));
+  ASSERT_TRUE(value.ExtractHeaders(&check_headers, &message_handler_));
+  CheckResponseHeaders(check_headers);
+}
+
 TEST_F(HTTPValueTest, TestCopyOnWrite) {
   HTTPValue v1;
   v1.Write("Hello", &message_handler_);
@@ -174,6 +192,72 @@ TEST_F(HTTPValueTest, TestShare) {
   }
 }
 
+TEST_F(HTTPValueTest, HeadersSummary) {
+  ResponseHeaders headers;
+  FillResponseHeaders(&headers);
+  headers.SetDateAndCaching(1000 * Timer::kSecondMs, 300 * Timer::kSecondMs);
+  headers.Add(HttpAttributes::kContentType, "text/css");
+  headers.Add(HttpAttributes::kEtag, "\"abc\"");
+  headers.Add(HttpAttributes::kContentEncoding, HttpAttributes::kGzip);
+  headers.ComputeCaching();
+
+  for (int headers_first = 0; headers_first < 2; ++headers_first) {
+    HTTPValue value;
+    if (headers_first) {
+      value.SetHeaders(&headers);
+      value.Write("body", &message_handler_);
+    } else {
+      value.Write("body", &message_handler_);
+      value.SetHeaders(&headers);
+    }
+    HTTPValue::HeadersSummary summary;
+    ASSERT_TRUE(value.ExtractHeadersSummary(&summary));
+    EXPECT_EQ(HttpStatus::kOK, summary.status_code);
+    EXPECT_EQ(1000 * Timer::kSecondMs, summary.date_ms);
+    EXPECT_EQ(1300 * Timer::kSecondMs, summary.expiration_time_ms);
+    EXPECT_TRUE(summary.proxy_cacheable);
+    EXPECT_TRUE(summary.browser_cacheable);
+    EXPECT_TRUE(summary.gzipped);
+    EXPECT_EQ("text/css", summary.content_type);
+    EXPECT_EQ("\"abc\"", summary.etag);
+    EXPECT_EQ("", summary.last_modified);
+
+    // The summary doesn't get in the way of the headers or the contents.
+    ResponseHeaders check_headers;
+    ASSERT_TRUE(value.ExtractHeaders(&check_headers, &message_handler_));
+    EXPECT_EQ(headers.ToString(), check_headers.ToString());
+    StringPiece body;
+    ASSERT_TRUE(value.ExtractContents(&body));
+    EXPECT_EQ("body", body);
+    EXPECT_EQ(body.size(), ComputeContentsSize(&value));
+  }
+}
+
+TEST_F(HTTPValueTest, NoSummaryInOldEncoding) {
+  // Values written before summaries were stored are still read.
+  ResponseHeaders headers;
+  FillResponseHeaders(&headers);
+  GoogleString headers_string;
+  StringWriter writer(&headers_string);
+  headers.WriteAsBinary(&writer, &message_handler_);
+  GoogleString encoded("h");
+  for (int i = 0; i < 4; ++i) {
+    encoded.push_back(static_cast<char>(headers_string.size() >> (8 * i)));
+  }
+  StrAppend(&encoded, headers_string, "body");
+
+  SharedString storage(encoded);
+  HTTPValue value;
+  ResponseHeaders check_headers;
+  ASSERT_TRUE(value.Link(&storage, &check_headers, &message_handler_));
+  CheckResponseHeaders(check_headers);
+  StringPiece body;
+  ASSERT_TRUE(value.ExtractContents(&body));
+  EXPECT_EQ("body", body);
+  HTTPValue::HeadersSummary summary;
+  EXPECT_FALSE(value.ExtractHeadersSummary(&summary));
+}
+
 TEST_F(HTTPValueTest, LinkEmpty) {
   SharedString storage;
   HTTPValue value;
@@ -196,6 +280,11 @@ TEST_F(HTTPValueTest, LinkCorrupt) {
   ASSERT_FALSE(value.Link(&storage, &headers, &message_handler_));
   storage.Append("xyz");
   ASSERT_FALSE(value.Link(&storage, &headers, &message_handler_));
+
+  // A summary whose size runs past the headers.
+  storage.Assign("H");
+  storage.Append("\x2\0\0\0\xff\xff", 6);
+  ASSERT_FALSE(value.Link(&storage, &headers, &message_handler_));
 }
 
 class HTTPValueEncodeTest : public testing::Test {
@@ -311,13 +400,37 @@ TEST_F(HTTPValueEncodeTest, EncodeDecodeGold) {
   StringPiece body_first_golden_value(
       body_first_golden_value_buf, STATIC_STRLEN(body_first_golden_value_buf));
 
+  // The same, with a summary of the headers ahead of them.
+  const char summary_golden_value_buf[] =
+      "H\xCA\x1\0\0"
+      "T\0\xC8\0\0\0\x3\x80\x84\x85YM\x1\0\0@\xAC\x8EYM\x1\0\0"
+      "\b\0text/css\x12\0W/\"PSA-35DPOkCBal\"\x1D\0"
+      "Fri, 20 Feb 2015 18:10:04 GMT"
+      "\b\xC8\x1\x12\x2OK\x18\x1 \x1(\xC0\xD8\xBA\xCC\xD5)0\x80\x89"
+      "\x96\xCC\xD5)8\x1@\x1JR\n\x6"
+      "Server\x12HApache/2.2.29 (Unix) mod_ssl/2.2.29 OpenSSL/1.0.1j DAV/2"
+      " mod_fcgid/2.3.9J.\n\r"
+      "Last-Modified\x12\x1D" "Fri, 20 Feb 2015 18:10:04 GMTJ\x16\n\r"
+      "Accept-Ranges\x12\x5" "bytesJ\x14\n\xE"
+      "Content-Length\x12\x2" "21J\x13\n\xE"
+      "X-Extra-Header\x12\x1" "1J$\n\r"
+      "Cache-Control\x12\x13public, max-age=600J\x18\n\f"
+      "Content-Type\x12\btext/cssJ\x1A\n\x4"
+      "Etag\x12\x12W/\"PSA-35DPOkCBal\"J%\n\x4"
+      "Date\x12\x1D" "Fri, 15 May 2015 21:40:32 GMTP"
+      "\xE0\xC8\xBA\xC1\xBA)X\xC0\xCF$h\0p\0."
+      "blue {color: blue;}\n";
+  StringPiece summary_golden_value(
+      summary_golden_value_buf, STATIC_STRLEN(summary_golden_value_buf));
+
   // These tests should work even if proto formats change.
   EXPECT_STREQ(example_http, Decode(header_first_golden_value));
   EXPECT_STREQ(example_http, Decode(body_first_golden_value));
+  EXPECT_STREQ(example_http, Decode(summary_golden_value));
 
   // Note: This might change when proto formats change.
   // Note: Can't use STREQ, it doesn't check past embedded nulls.
-  EXPECT_EQ(header_first_golden_value, Encode(example_http));
+  EXPECT_EQ(summary_golden_value, Encode(example_http));
 }
 
 TEST_F(HTTPValueEncodeTest, EncodeInvalid) {
@@ -29,6 +29,7 @@ class AsyncFetch;
 class Hasher;
 class Histogram;
 class HTTPCache;
+class HTTPCacheRefresher;
 class MessageHandler;
 class NamedLockManager;
 class Variable;
@@ -52,7 +53,8 @@ class Variable;
 // which ever is minimum), it will trigger background fetch to freshen the value
 // in cache. Background fetch only be triggered only if async_op_hooks_ != NULL,
 // otherwise, fetcher object accessed by BackgroundFreshenFetch may be deleted
-// by the time origin fetch finishes.
+// by the time origin fetch finishes.  Hits on responses that an
+// HTTPCacheRefresher agrees to keep fresh are left to it instead.
 //
 // TODO(sligocki): In order to use this for fetching resources for rewriting
 // we'd need to integrate resource locking in this class. Do we want that?
@@ -86,6 +88,12 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
                      MessageHandler* message_handler,
                      AsyncFetch* base_fetch);
 
+  // Like Fetch, but looks up and caches the response under 'fragment' rather
+  // than fragment().
+  void FetchInFragment(const GoogleString& url, const GoogleString& fragment,
+                       MessageHandler* message_handler,
+                       AsyncFetch* base_fetch);
+
   // HTTP status code used to indicate that we failed the Fetch because
   // result was not found in cache. (Only happens if fetcher_ == NULL).
   static const int kNotInCacheStatus;
@@ -169,6 +177,24 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
     return proactively_freshen_user_facing_request_;
   }
 
+  // Treat cached responses that are about to expire as stale, revalidating
+  // them with the origin instead of serving them.  This is how an
+  // HTTPCacheRefresher refreshes entries through this fetcher.
+  void set_refresh_imminently_expiring(bool x) {
+    refresh_imminently_expiring_ = x;
+  }
+  bool refresh_imminently_expiring() const {
+    return refresh_imminently_expiring_;
+  }
+
+  // Cache hits are reported to the refresher, if any.  Not owned.
+  void set_http_cache_refresher(HTTPCacheRefresher* x) {
+    http_cache_refresher_ = x;
+  }
+  HTTPCacheRefresher* http_cache_refresher() const {
+    return http_cache_refresher_;
+  }
+
   void set_own_fetcher(bool x) { own_fetcher_ = x; }
 
  private:
@@ -179,6 +205,7 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
   GoogleString fragment_;
   UrlAsyncFetcher* fetcher_;  // may be NULL.
   AsyncOpHooks* async_op_hooks_;
+  HTTPCacheRefresher* http_cache_refresher_;  // may be NULL.
 
   Histogram* backend_first_byte_latency_;  // may be NULL.
   Variable* fallback_responses_served_;  // may be NULL.
@@ -191,6 +218,7 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
   bool serve_stale_if_fetch_error_;
   bool default_cache_html_;
   bool proactively_freshen_user_facing_request_;
+  bool refresh_imminently_expiring_;
   bool own_fetcher_;  // set true to transfer ownership of fetcher to this.
   int64 serve_stale_while_revalidate_threshold_sec_;
 
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NET_INSTAWEB_HTTP_PUBLIC_COLLAPSING_URL_ASYNC_FETCHER_H_
+#define NET_INSTAWEB_HTTP_PUBLIC_COLLAPSING_URL_ASYNC_FETCHER_H_
+
+#include <map>
+
+#include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+namespace net_instaweb {
+
+class AsyncFetch;
+class MessageHandler;
+class RequestHeaders;
+class Statistics;
+class ThreadSystem;
+class Variable;
+
+// Fetcher that collapses concurrent fetches of the same resource into one
+// fetch from the fetcher it wraps, streaming the response to every caller.
+// When a cold resource is wanted by many rewrites or IPRO requests at once,
+// the origin then sees a single request rather than a stampede.
+//
+// Fetches are identical when they are GETs of the same URL with the same
+// Accept-Encoding and conditional headers, and are either all background
+// fetches or all not: a fetch a user is waiting on must not end up queued
+// or dropped behind a background one by a RateController underneath.
+// Requests carrying credentials, cookies or a Range are never collapsed, as
+// their responses may be specific to them.  A fetch may join one already in
+// flight until its response headers arrive.  If those carry a Vary on some
+// other request header, callers whose value for it differs from that of the
+// fetch that went to the origin are sent on as fetches of their own, once it
+// is done.
+class CollapsingUrlAsyncFetcher : public UrlAsyncFetcher {
+ public:
+  static const char kCollapsedFetchCount[];
+  static const char kCollapsedFetchVaryMismatchCount[];
+
+  // Does not take ownership of 'fetcher'.
+  CollapsingUrlAsyncFetcher(UrlAsyncFetcher* fetcher,
+                            ThreadSystem* thread_system,
+                            Statistics* statistics);
+  virtual ~CollapsingUrlAsyncFetcher();
+
+  static void InitStats(Statistics* statistics);
+
+  virtual bool SupportsHttps() const {
+    return base_fetcher_->SupportsHttps();
+  }
+
+  virtual void Fetch(const GoogleString& url,
+                     MessageHandler* message_handler,
+                     AsyncFetch* fetch);
+
+  virtual void ShutDown();
+
+  // Number of distinct fetches that can still be joined.
+  int num_joinable_fetches() const;
+
+ private:
+  class CollapsedFetch;
+  typedef std::map<GoogleString, CollapsedFetch*> FetchMap;
+
+  // Returns the key under which a fetch may be collapsed with others, or
+  // the empty string if it must not be.
+  static GoogleString CollapseKey(const GoogleString& url,
+                                  const RequestHeaders& request_headers,
+                                  bool is_background_fetch);
+
+  // Stops later fetches from joining 'fetch', once its headers are in.
+  void StopJoining(const GoogleString& key, CollapsedFetch* fetch);
+
+  UrlAsyncFetcher* base_fetcher_;
+  scoped_ptr<AbstractMutex> mutex_;
+  FetchMap joinable_fetches_ GUARDED_BY(mutex_);
+  Variable* collapsed_fetch_count_;
+  Variable* vary_mismatch_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(CollapsingUrlAsyncFetcher);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_HTTP_PUBLIC_COLLAPSING_URL_ASYNC_FETCHER_H_
@@ -61,6 +61,9 @@ class HTTPCache {
   // The prefix used for Etags.
   static const char kEtagPrefix[];
 
+  // The prefix for the keys of uncompressed variants of gzipped entries.
+  static const char kIdentityVariantPrefix[];
+
   // Function to format etags.
   static GoogleString FormatEtag(StringPiece hash);
 
@@ -104,6 +107,7 @@ class HTTPCache {
   };
 
   void set_hasher(Hasher* hasher) { hasher_ = hasher; }
+  Hasher* hasher() const { return hasher_; }
 
   // Class to handle an asynchronous cache lookup response.
   //
@@ -164,6 +168,19 @@ class HTTPCache {
     // fallback_http_value() with the cached response.
     virtual bool IsFresh(const ResponseHeaders& headers) { return true; }
 
+    // Like IsCacheValid and IsFresh, but given only the summary of the
+    // headers stored with the entry, so that invalidated and stale entries
+    // can be turned away without parsing their headers.  Entries that pass
+    // are parsed, and checked with IsCacheValid and IsFresh, before they
+    // are returned.  Entries stored without a summary skip these checks.
+    virtual bool IsCacheValidFromSummary(
+        const GoogleString& key, const HTTPValue::HeadersSummary& summary) {
+      return true;
+    }
+    virtual bool IsFreshFromSummary(const HTTPValue::HeadersSummary& summary) {
+      return true;
+    }
+
     // Overrides the cache ttl of the cached response with the given value. Note
     // that this has no effect if the returned value is negative or less than
     // the cache ttl of the stored value.
@@ -348,6 +365,13 @@ class HTTPCache {
   }
   int compression_level() const { return compression_level_; }
 
+  // When set, every gzipped entry is stored along with an uncompressed
+  // variant of it, made at insert time, which Find serves to requests that
+  // don't accept gzip rather than inflating the gzipped entry on each hit.
+  // This trades cache space for CPU on those requests.
+  void set_store_identity_variant(bool x) { store_identity_variant_ = x; }
+  bool store_identity_variant() const { return store_identity_variant_; }
+
   GoogleString Name() const { return FormatName(cache_->Name()); }
   static GoogleString FormatName(StringPiece cache);
 
@@ -359,6 +383,12 @@ class HTTPCache {
     return StrCat(version_prefix_, fragment, fragment.empty() ? "" : "/", key);
   }
 
+  // The key of the uncompressed variant of a gzipped entry; see
+  // set_store_identity_variant.
+  GoogleString IdentityVariantKey(StringPiece key, StringPiece fragment) const {
+    return StrCat(kIdentityVariantPrefix, CompositeKey(key, fragment));
+  }
+
  private:
   friend class HTTPCacheCallback;
   FRIEND_TEST(HTTPCacheTest, UpdateVersion);
@@ -374,6 +404,18 @@ class HTTPCache {
                    MessageHandler* handler);
   void DeleteInternal(const GoogleString& key_fragment);
 
+  // Looks up an entry, or its uncompressed variant.
+  void FindInternal(const GoogleString& key, const GoogleString& fragment,
+                    bool identity_variant, MessageHandler* handler,
+                    Callback* callback);
+
+  // Stores the uncompressed variant of the gzipped value being Put, if
+  // there's a point to it, and otherwise drops any stale one.
+  void PutIdentityVariant(const GoogleString& key,
+                          const GoogleString& fragment,
+                          HTTPValue* uncompressed_value,
+                          HTTPValue* value, MessageHandler* handler);
+
   // Used by constructor and tests.
   void SetVersion(int version_number);
   void set_version_prefix(StringPiece version_prefix) {
@@ -404,6 +446,7 @@ class HTTPCache {
 
   int cache_levels_;
   int compression_level_;
+  bool store_identity_variant_;
 
   // Total cumulative time spent accessing backend cache.
   Variable* cache_time_us_;
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NET_INSTAWEB_HTTP_PUBLIC_HTTP_CACHE_REFRESHER_H_
+#define NET_INSTAWEB_HTTP_PUBLIC_HTTP_CACHE_REFRESHER_H_
+
+#include <map>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+#include "pagespeed/kernel/http/http_options.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+
+namespace net_instaweb {
+
+class CacheUrlAsyncFetcher;
+class MessageHandler;
+class ResponseHeaders;
+class Statistics;
+class ThreadSystem;
+class UpDownCounter;
+class Variable;
+
+// Keeps popular HTTPCache entries fresh, so that requests for them neither
+// find them expired nor have to start revalidating them.
+//
+// CacheUrlAsyncFetcher reports its cache hits with NoteHit.  Once a URL has
+// been hit often enough, as estimated by a FrequencySketch, it is tracked,
+// up to max_entries of them, until it stops being popular.  At most every
+// kSweepIntervalMs, a hit queues a sweep on a low-priority worker, which
+// refreshes the tracked entries that have become imminently expiring (as
+// defined by ResponseHeaders::IsImminentlyExpiring), with at most
+// kMaxOutstandingRefreshes in flight.  Refreshes go through a
+// CacheUrlAsyncFetcher that treats such entries as stale, so it revalidates
+// them with a conditional request and writes the result back to the cache.
+// Its fetches are background fetches, so they are subject to any rate
+// limiting of those.
+class HTTPCacheRefresher {
+ public:
+  static const char kHttpCacheRefreshes[];
+  static const char kHttpCacheRefreshFailures[];
+  static const char kHttpCacheRefreshEntries[];
+
+  static const int64 kSweepIntervalMs = 10 * Timer::kSecondMs;
+  static const int kMaxOutstandingRefreshes = 8;
+  // Estimated number of recent hits before an entry is tracked, or below
+  // which it is no longer refreshed.
+  static const int kMinHits = 2;
+
+  // Takes ownership of cache_fetcher, which should fetch from the origin and
+  // must not itself report hits to a refresher.  Each entry is refreshed
+  // through it under the fragment it was hit in.  http_options are those of
+  // the refresh fetches.
+  HTTPCacheRefresher(CacheUrlAsyncFetcher* cache_fetcher,
+                     const HttpOptions& http_options,
+                     Scheduler* scheduler,
+                     QueuedWorkerPool* workers,
+                     ThreadSystem* thread_system,
+                     Statistics* statistics,
+                     MessageHandler* handler,
+                     int max_entries);
+
+  // Must be deleted after the worker pool and the fetcher have been shut
+  // down, so that no sweep or refresh can still be running.
+  ~HTTPCacheRefresher();
+
+  static void InitStats(Statistics* statistics);
+
+  // Records a hit on url's cached response, whose headers must have had
+  // ComputeCaching called.  Returns true if the entry is being tracked, in
+  // which case the caller need not freshen it.
+  bool NoteHit(const GoogleString& url, const GoogleString& fragment,
+               const ResponseHeaders& headers);
+
+  // Number of entries being tracked.
+  int num_entries() const;
+
+ private:
+  class RefreshFetch;
+
+  struct Entry {
+    Entry() : refresh_at_ms(0), refreshing(false) {}
+
+    GoogleString url;
+    GoogleString fragment;
+    int64 refresh_at_ms;
+    bool refreshing;
+  };
+  // Keyed by Key(url, fragment).
+  typedef std::map<GoogleString, Entry> EntryMap;
+
+  static GoogleString Key(const GoogleString& url,
+                          const GoogleString& fragment);
+  static uint64 KeyHash(const GoogleString& key);
+
+  // Starts refreshes of the entries due for one.  Runs on sequence_.
+  void Sweep();
+
+  void RefreshDone(const GoogleString& key, bool success,
+                   const ResponseHeaders& headers);
+
+  scoped_ptr<CacheUrlAsyncFetcher> cache_fetcher_;
+  const HttpOptions http_options_;
+  Scheduler* scheduler_;
+  QueuedWorkerPool* workers_;
+  QueuedWorkerPool::Sequence* sequence_;
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  MessageHandler* handler_;
+  const int max_entries_;
+  FrequencySketch sketch_;
+
+  scoped_ptr<AbstractMutex> mutex_;
+  EntryMap entries_ GUARDED_BY(mutex_);
+  int outstanding_refreshes_ GUARDED_BY(mutex_);
+  int64 next_sweep_ms_ GUARDED_BY(mutex_);
+
+  Variable* refreshes_;
+  Variable* refresh_failures_;
+  UpDownCounter* tracked_entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(HTTPCacheRefresher);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_HTTP_PUBLIC_HTTP_CACHE_REFRESHER_H_
@@ -37,6 +37,28 @@ class MessageHandler;
 // the cache, which from which data may be evicted at any time.
 class HTTPValue : public Writer {
  public:
+  // The response header fields most often needed for serving and freshness
+  // decisions.  SetHeaders stores these in a fixed layout ahead of the
+  // serialized headers, so they can be read without parsing the headers.
+  // The StringPieces point into the HTTPValue's storage, so they are valid
+  // only while the HTTPValue is unchanged.
+  struct HeadersSummary {
+    HeadersSummary()
+        : status_code(0), date_ms(0), expiration_time_ms(0),
+          proxy_cacheable(false), browser_cacheable(false), gzipped(false) {
+    }
+
+    int status_code;
+    int64 date_ms;
+    int64 expiration_time_ms;  // ResponseHeaders::CacheExpirationTimeMs().
+    bool proxy_cacheable;      // ResponseHeaders::IsProxyCacheable().
+    bool browser_cacheable;
+    bool gzipped;
+    StringPiece content_type;  // The headers' values, empty if absent.
+    StringPiece etag;
+    StringPiece last_modified;
+  };
+
   HTTPValue() : contents_size_(0) {}
 
   // Clears the value (both headers and content)
@@ -63,9 +85,20 @@ class HTTPValue : public Writer {
   virtual bool Write(const StringPiece& str, MessageHandler* handler);
   virtual bool Flush(MessageHandler* handler);
 
+  // Makes room for contents_size bytes of contents, so that Writes of that
+  // many don't have to reallocate and copy the ones before them.  Must be
+  // called before any Write or SetHeaders.
+  void ReserveContents(int64 contents_size);
+
   // Retrieves the headers, returning false if empty.
   bool ExtractHeaders(ResponseHeaders* headers, MessageHandler* handler) const;
 
+  // Retrieves the summary of the headers, without parsing them.  Returns
+  // false if there are no headers, or if the value was encoded without a
+  // summary, as values written by older servers were; callers should then
+  // use ExtractHeaders.
+  bool ExtractHeadersSummary(HeadersSummary* summary) const;
+
   // Retrieves the contents, returning false if empty.  Note that the
   // contents are only guaranteed valid as long as the HTTPValue
   // object is in scope.
@@ -82,6 +115,11 @@ class HTTPValue : public Writer {
   bool Link(SharedString* src, ResponseHeaders* headers,
             MessageHandler* handler);
 
+  // Like the above, but only retrieves the summary of the headers, so they
+  // are not parsed.  Returns false, leaving this unchanged, if src is not
+  // well-formed or was encoded without a summary.
+  bool Link(SharedString* src, HeadersSummary* summary);
+
   // Links two HTTPValues together, using the contents of 'src' and discarding
   // the contents of this.
   void Link(HTTPValue* src) {
@@ -112,6 +150,9 @@ class HTTPValue : public Writer {
   char type_identifier() const { return *storage_.data(); }
 
   unsigned int SizeOfFirstChunk() const;
+  // Finds the headers, including any summary, in storage_, returning false
+  // if they are missing or storage_ is malformed.
+  bool HeadersChunk(StringPiece* chunk) const;
   void SetSizeOfFirstChunk(unsigned int size);
   int64 ComputeContentsSize() const;
 
@@ -35,6 +35,7 @@ class MessageHandler;
 class Statistics;
 class ThreadSystem;
 class TimedVariable;
+class Timer;
 class UpDownCounter;
 class UrlAsyncFetcher;
 
@@ -49,6 +50,19 @@ class UrlAsyncFetcher;
 // If a request is dropped, the response will have HttpAttributes::kXPsaLoadShed
 // set on the response headers.
 //
+// With adaptive concurrency enabled, the per-host limit on outgoing fetches is
+// no longer fixed at per_host_outgoing_request_threshold, but starts there and
+// is adjusted for each host from the fetches made to it, additive-increase/
+// multiplicative-decrease style.  While fetches succeed promptly and the host
+// is using all of its limit, the limit grows by one per limit's worth of
+// completed fetches, up to kMaxConcurrencyMultiple times the threshold.  A
+// failed fetch (including 429 and 5xx responses) halves it, and one taking
+// more than kLatencyToleranceMultiple times the host's baseline latency cuts it
+// by kLatencyBackoffPercent; either at most once per smoothed latency, as the
+// fetches already in flight when a host slows down will be slow as well.  The
+// limit never goes below 1.  User-facing fetches are not limited, but count
+// against the limit and are measured like any other.
+//
 // Note: this requires working statistics to work.
 class RateController {
  public:
@@ -78,6 +92,22 @@ class RateController {
   // Initializes statistics variables associated with this class.
   static void InitStats(Statistics* statistics);
 
+  // Turns on adaptive per-host concurrency, described above, using timer to
+  // measure fetch latencies.  Must be called before any fetches.
+  void EnableAdaptiveConcurrency(Timer* timer);
+  bool adaptive_concurrency() const { return timer_ != NULL; }
+
+  // Describes the per-host state of this controller, one host per line, for
+  // the admin pages.
+  GoogleString HostStatsToString() const;
+
+  static const int kMaxConcurrencyMultiple = 4;
+  static const int kLatencyToleranceMultiple = 2;
+  static const int kLatencyBackoffPercent = 10;
+  // In adaptive mode, per-host state is kept while idle, for up to this many
+  // hosts.
+  static const int kMaxIdleHosts = 256;
+
  private:
   class HostFetchInfo;
   class CustomFetch;
@@ -97,6 +127,7 @@ class RateController {
   // The maximum number of queued requests allowed per host.
   const int per_host_queued_request_threshold_;
   ThreadSystem* thread_system_;
+  Timer* timer_;  // NULL unless adaptive concurrency is enabled.
 
   // Map containing per-host information tracking outgoing and queued fetches.
   HostFetchInfoMap fetch_info_map_;
@@ -59,6 +59,8 @@ class RateControllingUrlAsyncFetcher : public UrlAsyncFetcher {
 
   virtual void ShutDown();
 
+  RateController* rate_controller() { return rate_controller_.get(); }
+
  private:
   UrlAsyncFetcher* base_fetcher_;
   scoped_ptr<RateController> rate_controller_;
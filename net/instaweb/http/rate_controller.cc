@@ -18,6 +18,7 @@
 
 #include "net/instaweb/http/public/rate_controller.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <queue>
 #include <utility>
@@ -29,9 +30,11 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/google_url.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
@@ -40,6 +43,17 @@ namespace net_instaweb {
 
 namespace {
 
+// Not in HttpStatus, but a response an origin may send when overloaded.
+const int kTooManyRequests = 429;
+
+// Below this, latencies are considered equally fast, so that noise in small
+// ones isn't mistaken for a slowdown.
+const int64 kMinBaselineLatencyMs = 10;
+
+// A host's baseline latency is the smallest measured over this many fetches,
+// so that it can also go up, for instance when its content changes.
+const int kBaselineWindowFetches = 100;
+
 // Keeps track of the objects required while deferring a fetch.
 struct DeferredFetch {
   DeferredFetch(const GoogleString& in_url,
@@ -69,7 +83,8 @@ const char RateController::kDroppedFetchCount[] =
 const char RateController::kCurrentGlobalFetchQueueSize[] =
     "current-fetch-queue-size";
 
-// Keeps track of all the pending and enqueued fetches for a given host.
+// Keeps track of all the pending and enqueued fetches for a given host, and,
+// with adaptive concurrency, of how fetches to it have been going.
 class RateController::HostFetchInfo
     : public RefCounted<RateController::HostFetchInfo> {
  public:
@@ -77,12 +92,24 @@ class RateController::HostFetchInfo
   HostFetchInfo(const GoogleString& host,
                 int per_host_outgoing_request_threshold,
                 int per_host_queued_request_threshold,
+                bool adaptive,
                 AbstractMutex* mutex)
       : host_(host),
         num_outbound_fetches_(0),
         per_host_outgoing_request_threshold_(
             per_host_outgoing_request_threshold),
         per_host_queued_request_threshold_(per_host_queued_request_threshold),
+        adaptive_(adaptive),
+        concurrency_limit_(
+            std::max(1, per_host_outgoing_request_threshold)),
+        max_concurrency_limit_(concurrency_limit_ * kMaxConcurrencyMultiple),
+        num_fetches_(0),
+        num_failed_fetches_(0),
+        smoothed_latency_ms_(-1),
+        baseline_latency_ms_(-1),
+        window_min_latency_ms_(-1),
+        window_fetches_(0),
+        last_decrease_ms_(-1),
         mutex_(mutex) {}
 
   ~HostFetchInfo() {}
@@ -98,7 +125,7 @@ class RateController::HostFetchInfo
   // otherwise.
   bool IncrementIfCanTriggerFetch() {
     ScopedMutex lock(mutex_.get());
-    if (num_outbound_fetches_ < per_host_outgoing_request_threshold_) {
+    if (num_outbound_fetches_ < OutgoingLimit()) {
       ++num_outbound_fetches_;
       return true;
     }
@@ -118,6 +145,49 @@ class RateController::HostFetchInfo
     DCHECK_GE(num_outbound_fetches_, 0);
     ++num_outbound_fetches_;
   }
+
+  // Adapts the concurrency limit to a fetch that has just completed, before
+  // it is no longer counted as outbound.
+  void RecordFetch(int64 latency_ms, bool ok, int64 now_ms) {
+    ScopedMutex lock(mutex_.get());
+    ++num_fetches_;
+    if (!ok) {
+      ++num_failed_fetches_;
+    }
+    // Smoothed like TCP's round-trip time.
+    if (smoothed_latency_ms_ < 0) {
+      smoothed_latency_ms_ = latency_ms;
+    } else {
+      smoothed_latency_ms_ += (latency_ms - smoothed_latency_ms_) / 8.0;
+    }
+    if ((window_min_latency_ms_ < 0) || (latency_ms < window_min_latency_ms_)) {
+      window_min_latency_ms_ = latency_ms;
+    }
+    if ((baseline_latency_ms_ < 0) || (latency_ms < baseline_latency_ms_)) {
+      baseline_latency_ms_ = latency_ms;
+    }
+    if (++window_fetches_ >= kBaselineWindowFetches) {
+      baseline_latency_ms_ = window_min_latency_ms_;
+      window_min_latency_ms_ = -1;
+      window_fetches_ = 0;
+    }
+
+    bool slow = (latency_ms > kLatencyToleranceMultiple * std::max(
+        baseline_latency_ms_, kMinBaselineLatencyMs));
+    if (!ok || slow) {
+      if ((last_decrease_ms_ < 0) ||
+          (now_ms - last_decrease_ms_ >= smoothed_latency_ms_)) {
+        double factor = ok ? (100 - kLatencyBackoffPercent) / 100.0 : 0.5;
+        concurrency_limit_ = std::max(1.0, concurrency_limit_ * factor);
+        last_decrease_ms_ = now_ms;
+      }
+    } else if (num_outbound_fetches_ >= OutgoingLimit()) {
+      // Only grow the limit while it is what holds the host back.
+      concurrency_limit_ = std::min(
+          max_concurrency_limit_, concurrency_limit_ + 1 / concurrency_limit_);
+    }
+  }
+
   // Pushes the fetch to the back of the queue.
   bool EnqueueFetchIfWithinThreshold(const GoogleString& url,
                                      UrlAsyncFetcher* fetcher,
@@ -135,8 +205,7 @@ class RateController::HostFetchInfo
   // Gets the next fetch from the queue. Returns NULL if the queue is empty.
   DeferredFetch* PopNextFetchAndIncrementCountIfWithinThreshold() {
     ScopedMutex lock(mutex_.get());
-    if (fetch_queue_.empty() ||
-        num_outbound_fetches_ >= per_host_outgoing_request_threshold_) {
+    if (fetch_queue_.empty() || num_outbound_fetches_ >= OutgoingLimit()) {
       return NULL;
     }
     DeferredFetch* fetch = fetch_queue_.front();
@@ -154,11 +223,47 @@ class RateController::HostFetchInfo
     return num_outbound_fetches_ > 0 || !fetch_queue_.empty();
   }
 
+  void AppendStats(GoogleString* out) const {
+    ScopedMutex lock(mutex_.get());
+    StrAppend(out, host_,
+              " outgoing=", IntegerToString(num_outbound_fetches_),
+              " queued=", IntegerToString(fetch_queue_.size()),
+              " limit=", IntegerToString(OutgoingLimit()));
+    if (adaptive_) {
+      StrAppend(out,
+                " fetches=", Integer64ToString(num_fetches_),
+                " failed=", Integer64ToString(num_failed_fetches_),
+                " latency_ms=", Integer64ToString(
+                    static_cast<int64>(smoothed_latency_ms_)),
+                " baseline_ms=", Integer64ToString(baseline_latency_ms_));
+    }
+    StrAppend(out, "\n");
+  }
+
  private:
+  // Requires mutex_ to be held.
+  int OutgoingLimit() const {
+    return adaptive_ ? static_cast<int>(concurrency_limit_)
+                     : per_host_outgoing_request_threshold_;
+  }
+
   GoogleString host_;
   int num_outbound_fetches_;
   const int per_host_outgoing_request_threshold_;
   const int per_host_queued_request_threshold_;
+
+  // Adaptive concurrency state.
+  const bool adaptive_;
+  double concurrency_limit_;
+  const double max_concurrency_limit_;
+  int64 num_fetches_;
+  int64 num_failed_fetches_;
+  double smoothed_latency_ms_;
+  int64 baseline_latency_ms_;
+  int64 window_min_latency_ms_;
+  int window_fetches_;
+  int64 last_decrease_ms_;
+
   scoped_ptr<AbstractMutex> mutex_;
   std::queue<DeferredFetch*> fetch_queue_;
 
@@ -175,16 +280,30 @@ class RateController::CustomFetch : public SharedAsyncFetch {
               RateController* controller)
       : SharedAsyncFetch(fetch),
         fetch_info_(fetch_info),
-        controller_(controller) {}
+        controller_(controller),
+        start_ms_((controller->timer_ == NULL) ?
+                  0 : controller->timer_->NowMs()) {}
 
   virtual void HandleDone(bool success) {
+    if (controller_->timer_ != NULL) {
+      // The response belongs to the base fetch, so look at it first.
+      int status = response_headers()->status_code();
+      bool ok = success && (status != kTooManyRequests) &&
+          ((status < HttpStatus::kInternalServerError) || (status >= 600));
+      int64 now_ms = controller_->timer_->NowMs();
+      fetch_info_->RecordFetch(now_ms - start_ms_, ok, now_ms);
+    }
     SharedAsyncFetch::HandleDone(success);
     fetch_info_->decrement_num_outbound_fetches();
-    // Check if there is any fetch queued up for this host and the number of
-    // outstanding fetches for the host is less than the threshold.
-    DeferredFetch* deferred_fetch =
-        fetch_info_->PopNextFetchAndIncrementCountIfWithinThreshold();
-    if (deferred_fetch != NULL) {
+    // Start any fetches queued up for this host that the number of outstanding
+    // fetches for the host now allows.  With adaptive concurrency, that may be
+    // more than one.
+    bool started_deferred_fetch = false;
+    DeferredFetch* deferred_fetch;
+    while ((deferred_fetch =
+            fetch_info_->PopNextFetchAndIncrementCountIfWithinThreshold()) !=
+           NULL) {
+      started_deferred_fetch = true;
       DCHECK_GT(controller_->current_global_fetch_queue_size_->Get(), 0);
       controller_->current_global_fetch_queue_size_->Add(-1);
       // Trigger a fetch for the queued up request.
@@ -202,7 +321,8 @@ class RateController::CustomFetch : public SharedAsyncFetch {
                                        wrapper_fetch);
       }
       delete deferred_fetch;
-    } else {
+    }
+    if (!started_deferred_fetch) {
       controller_->DeleteFetchInfoIfPossible(fetch_info_);
     }
     delete this;
@@ -211,6 +331,7 @@ class RateController::CustomFetch : public SharedAsyncFetch {
  private:
   HostFetchInfoPtr fetch_info_;
   RateController* controller_;
+  int64 start_ms_;
   DISALLOW_COPY_AND_ASSIGN(CustomFetch);
 };
 
@@ -225,6 +346,7 @@ RateController::RateController(
           per_host_outgoing_request_threshold),
       per_host_queued_request_threshold_(per_host_queued_request_threshold),
       thread_system_(thread_system),
+      timer_(NULL),
       mutex_(thread_system->NewMutex()) {
   CHECK_GE(max_global_queue_size, 0);
   CHECK_GE(per_host_outgoing_request_threshold, 0);
@@ -237,6 +359,14 @@ RateController::RateController(
 }
 
 RateController::~RateController() {
+  // With adaptive concurrency, idle hosts are kept.
+  STLDeleteValues(&fetch_info_map_);
+}
+
+void RateController::EnableAdaptiveConcurrency(Timer* timer) {
+  ScopedMutex lock(mutex_.get());
+  DCHECK(fetch_info_map_.empty());
+  timer_ = timer;
 }
 
 void RateController::Fetch(UrlAsyncFetcher* fetcher,
@@ -280,6 +410,7 @@ void RateController::Fetch(UrlAsyncFetcher* fetcher,
     HostFetchInfoPtr* new_fetch_info_ptr = new HostFetchInfoPtr(
         new HostFetchInfo(host, per_host_outgoing_request_threshold_,
                           per_host_queued_request_threshold_,
+                          adaptive_concurrency(),
                           thread_system_->NewMutex()));
     fetch_info_ptr = *new_fetch_info_ptr;
     fetch_info_map_[host] = new_fetch_info_ptr;
@@ -329,7 +460,9 @@ void RateController::InitStats(Statistics* statistics) {
 void RateController::DeleteFetchInfoIfPossible(
     const HostFetchInfoPtr& fetch_info) {
   ScopedMutex lock(mutex_.get());
-  if (fetch_info->AnyInFlightOrQueuedFetches()) {
+  if (fetch_info->AnyInFlightOrQueuedFetches() ||
+      (adaptive_concurrency() &&
+       (static_cast<int>(fetch_info_map_.size()) <= kMaxIdleHosts))) {
     return;
   }
 
@@ -340,4 +473,14 @@ void RateController::DeleteFetchInfoIfPossible(
   }
 }
 
+GoogleString RateController::HostStatsToString() const {
+  GoogleString out;
+  ScopedMutex lock(mutex_.get());
+  for (HostFetchInfoMap::const_iterator p = fetch_info_map_.begin(),
+           e = fetch_info_map_.end(); p != e; ++p) {
+    (*p->second)->AppendStats(&out);
+  }
+  return out;
+}
+
 }  // namespace net_instaweb
@@ -120,6 +120,24 @@ class RateControllingUrlAsyncFetcherTest : public ::testing::Test {
     mock_fetcher_.SetResponse(url, headers, body);
   }
 
+  // Starts n background fetches of url, adding them to fetches, and returns
+  // how many of them were sent on to the base fetcher right away.
+  int StartBackgroundFetches(const GoogleString& url, int n,
+                             std::vector<MockFetch*>* fetches) {
+    int start_count = counting_fetcher_->fetch_start_count();
+    for (int i = 0; i < n; ++i) {
+      MockFetch* fetch = new MockFetch(
+          RequestContext::NewTestRequestContext(thread_system_.get()), true);
+      fetches->push_back(fetch);
+      rate_controlling_fetcher_->Fetch(url, &handler_, fetch);
+    }
+    return counting_fetcher_->fetch_start_count() - start_count;
+  }
+
+  RateController* rate_controller() {
+    return rate_controlling_fetcher_->rate_controller();
+  }
+
   int global_fetch_queue_size() {
     return stats_.GetUpDownCounter(
         RateController::kCurrentGlobalFetchQueueSize)->Get();
@@ -405,6 +423,88 @@ TEST_F(RateControllingUrlAsyncFetcherTest,
   STLDeleteContainerPointers(fetch_vector.begin(), fetch_vector.end());
 }
 
+TEST_F(RateControllingUrlAsyncFetcherTest, AdaptiveLimitGrowsForFastHost) {
+  rate_controller()->EnableAdaptiveConcurrency(&timer_);
+  std::vector<MockFetch*> fetches;
+  EXPECT_EQ(2, StartBackgroundFetches(domain1_url1_, 6, &fetches));
+
+  // Keep the host busy up to its limit, with its fetches all completing
+  // promptly.
+  for (int i = 0; i < 20; ++i) {
+    wait_fetcher_->CallCallbacks();
+    StartBackgroundFetches(domain1_url1_, 4, &fetches);
+  }
+  while (global_fetch_queue_size() > 0) {
+    wait_fetcher_->CallCallbacks();
+  }
+  wait_fetcher_->CallCallbacks();
+
+  // It has grown, though no more than the queued fetches could use, and the
+  // host keeps it while idle.
+  int started = StartBackgroundFetches(domain1_url1_, 10, &fetches);
+  EXPECT_LT(2, started);
+  EXPECT_GE(2 * RateController::kMaxConcurrencyMultiple, started);
+  EXPECT_TRUE(StringPiece(rate_controller()->HostStatsToString()).starts_with(
+      StrCat("www.d1.com outgoing=", IntegerToString(started), " queued=",
+             IntegerToString(10 - started), " limit=")));
+  while (global_fetch_queue_size() > 0) {
+    wait_fetcher_->CallCallbacks();
+  }
+  wait_fetcher_->CallCallbacks();
+  STLDeleteContainerPointers(fetches.begin(), fetches.end());
+}
+
+TEST_F(RateControllingUrlAsyncFetcherTest, AdaptiveLimitHalvesOnFailure) {
+  const char kFailingUrl[] = "http://www.d4.com/overloaded";
+  ResponseHeaders headers;
+  headers.SetStatusAndReason(HttpStatus::kUnavailable);
+  mock_fetcher_.SetResponse(kFailingUrl, headers, "");
+
+  rate_controller()->EnableAdaptiveConcurrency(&timer_);
+  std::vector<MockFetch*> fetches;
+  EXPECT_EQ(2, StartBackgroundFetches(kFailingUrl, 2, &fetches));
+  wait_fetcher_->CallCallbacks();
+  EXPECT_EQ(1, StartBackgroundFetches(kFailingUrl, 2, &fetches));
+  wait_fetcher_->CallCallbacks();
+  wait_fetcher_->CallCallbacks();
+
+  // Other hosts are unaffected.
+  EXPECT_EQ(2, StartBackgroundFetches(domain2_url1_, 2, &fetches));
+  wait_fetcher_->CallCallbacks();
+  STLDeleteContainerPointers(fetches.begin(), fetches.end());
+}
+
+TEST_F(RateControllingUrlAsyncFetcherTest, AdaptiveLimitBacksOffWhenSlow) {
+  rate_controller()->EnableAdaptiveConcurrency(&timer_);
+  std::vector<MockFetch*> fetches;
+  // Prompt fetches set the host's baseline latency.
+  EXPECT_EQ(2, StartBackgroundFetches(domain1_url1_, 2, &fetches));
+  wait_fetcher_->CallCallbacks();
+
+  // Then it slows down.  The limit is only cut once for the fetches that
+  // were in flight together.
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(2, StartBackgroundFetches(domain1_url1_, 2, &fetches));
+    timer_.AdvanceMs(100);
+    wait_fetcher_->CallCallbacks();
+  }
+  EXPECT_EQ(1, StartBackgroundFetches(domain1_url1_, 2, &fetches));
+  wait_fetcher_->CallCallbacks();
+  wait_fetcher_->CallCallbacks();
+  STLDeleteContainerPointers(fetches.begin(), fetches.end());
+}
+
+TEST_F(RateControllingUrlAsyncFetcherTest, FixedLimitByDefault) {
+  std::vector<MockFetch*> fetches;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(2, StartBackgroundFetches(domain1_url1_, 2, &fetches));
+    wait_fetcher_->CallCallbacks();
+  }
+  // Idle hosts are forgotten.
+  EXPECT_EQ("", rate_controller()->HostStatsToString());
+  STLDeleteContainerPointers(fetches.begin(), fetches.end());
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -1372,9 +1372,11 @@
         'http/async_fetch.cc',
         'http/async_fetch_with_lock.cc',
         'http/cache_url_async_fetcher.cc',
+        'http/collapsing_url_async_fetcher.cc',
         'http/external_url_fetcher.cc',
         'http/http_cache.cc',
         'http/http_cache_failure.cc',
+        'http/http_cache_refresher.cc',
         'http/http_dump_url_async_writer.cc',
         'http/http_dump_url_fetcher.cc',
         'http/http_response_parser.cc',
@@ -1781,6 +1783,7 @@
         'rewriter/google_font_service_input_resource.cc',
         'rewriter/handle_noscript_redirect_filter.cc',
         'rewriter/header_decision_tree.cc',
+        'rewriter/html_filter_profile_stats.cc',
         'rewriter/iframe_fetcher.cc',
         'rewriter/image_rewrite_filter.cc',
         'rewriter/in_place_rewrite_context.cc',
@@ -1893,8 +1896,15 @@
         '<(DEPTH)/pagespeed/system/admin_site.cc',
         '<(DEPTH)/pagespeed/system/apr_mem_cache.cc',
         '<(DEPTH)/pagespeed/system/apr_thread_compatible_pool.cc',
+        '<(DEPTH)/pagespeed/system/binary_mem_cache.cc',
+        '<(DEPTH)/pagespeed/system/http2_protocol.cc',
+        '<(DEPTH)/pagespeed/system/http2_url_async_fetcher.cc',
         '<(DEPTH)/pagespeed/system/in_place_resource_recorder.cc',
+        '<(DEPTH)/pagespeed/system/ketama_ring.cc',
         '<(DEPTH)/pagespeed/system/loopback_route_fetcher.cc',
+        '<(DEPTH)/pagespeed/system/memcached_binary_protocol.cc',
+        '<(DEPTH)/pagespeed/system/redis_cache.cc',
+        '<(DEPTH)/pagespeed/system/resp_protocol.cc',
         '<(DEPTH)/pagespeed/system/serf_url_async_fetcher.cc',
         '<(DEPTH)/pagespeed/system/system_cache_path.cc',
         '<(DEPTH)/pagespeed/system/system_caches.cc',
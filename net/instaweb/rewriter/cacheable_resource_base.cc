@@ -601,6 +601,12 @@ class CacheableResourceBase::FreshenHttpCacheCallback
         options_->ComputeHttpOptions());
   }
 
+  virtual bool IsFreshFromSummary(const HTTPValue::HeadersSummary& summary) {
+    return !ResponseHeaders::IsImminentlyExpiring(
+        summary.date_ms, summary.expiration_time_ms,
+        server_context_->timer()->NowMs(), options_->ComputeHttpOptions());
+  }
+
  private:
   GoogleString url_;
   GoogleString cache_key_;
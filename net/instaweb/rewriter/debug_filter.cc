@@ -26,6 +26,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/http/google_url.h"
 
@@ -164,6 +165,21 @@ GoogleString DebugFilter::FormatEndDocumentMessage(
   return str;
 }
 
+GoogleString DebugFilter::FormatFilterProfileMessage(
+    const HtmlFilterProfile& profile) {
+  // This is called from the final flush, so the filters from Debug onwards
+  // have not been charged for it yet.
+  GoogleString str(
+      "\n#Filter costs in cycles (the last flush counted up to Debug):\n");
+  StringPieceVector lines;
+  GoogleString profile_string = profile.ToString();
+  SplitStringPieceToVector(profile_string, "\n", &lines, true);
+  for (int i = 0, n = lines.size(); i < n; ++i) {
+    StrAppend(&str, "#  ", lines[i], "\n");
+  }
+  return str;
+}
+
 GoogleString DebugFilter::ListActiveFiltersAndOptions() const {
   const RewriteOptions* options = driver_->options();
   GoogleString settings_list("\nmod_pagespeed on\nFilters:\n");
@@ -233,8 +249,12 @@ void DebugFilter::Flush() {
   idle_.AddToTotal();
 
   if (end_document_seen_) {
+    GoogleString profile_message;
+    if (driver_->filter_profile() != NULL) {
+      profile_message = FormatFilterProfileMessage(*driver_->filter_profile());
+    }
     driver_->InsertComment(
-        StrCat(ListActiveFiltersAndOptions(),
+        StrCat(ListActiveFiltersAndOptions(), profile_message,
                FormatEndDocumentMessage(
                    time_since_init_parse_us, parse_.total_us(),
                    render_.total_us(), idle_.total_us(), num_flushes_,
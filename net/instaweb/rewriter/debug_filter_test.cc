@@ -199,6 +199,15 @@ TEST_F(DebugFilterTest, CheckFiltersAndOptions) {
   EXPECT_HAS_SUBSTR("Options:", flush_messages[0]);
 }
 
+TEST_F(DebugFilterTest, FilterCosts) {
+  StringPieceVector flush_messages;
+  ParseAndMaybeFlushTwice(true, &flush_messages);
+  ASSERT_EQ(4, flush_messages.size());
+  EXPECT_HAS_SUBSTR("#Filter costs in cycles", flush_messages[3]);
+  EXPECT_HAS_SUBSTR("#  CacheExtender: ", flush_messages[3]);
+  EXPECT_HAS_SUBSTR(" events, 3 passes", flush_messages[3]);
+}
+
 TEST_F(DebugFilterTest, FlushWithDelayedCache) {
   RewriteScriptToWarmTheCache();
   int64 delay_us = InjectCacheDelay();
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/rewriter/public/html_filter_profile_stats.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// HtmlFilter::Name() of the filters that get statistics of their own.
+// Adding a filter?  Add its name here, or it will be counted as "Other".
+const char* const kProfiledFilters[] = {
+  "AddHead",
+  "AddIdsFilter",
+  "AddInstrumentation",
+  "BaseTag",
+  "CacheExtender",
+  "CacheHtmlFilter",
+  "CanonicalAttributes",
+  "Collect Flush Early Content Filter",
+  "CollapseWhitespace",
+  "ComputeVisibleTextFilter",
+  "ConvertMetaTags",
+  "CriticalCss",
+  "CriticalCssBeacon",
+  "CriticalImagesBeacon",
+  "CriticalSelectorFilter",
+  "CssCombine",
+  "CssFilter",
+  "CssMoveToHead",
+  "Debug",
+  "DecodeRewrittenUrlsFilter",
+  "DedupInlinedImages",
+  "DeferIframe",
+  "DelayImages",
+  "DeterministicJs",
+  "Dom Statistics",
+  "DomainRewrite",
+  "ElideAttributes",
+  "ExplicitCloseTag",
+  "FixReflowFilter",
+  "FlushHtmlFilter",
+  "GoogleAnalytics",
+  "HandleNoscriptRedirect",
+  "HtmlAttributeQuoteRemoval",
+  "HtmlWriter",
+  "ImageCombine",
+  "ImageRewrite",
+  "InlineCss",
+  "InlineGoogleFontCss",
+  "InlineImportToLinkCss",
+  "InlineJs",
+  "InsertDnsPrefetchFilter",
+  "InsertGASnippet",
+  "Javascript",
+  "JsCombine",
+  "JsDeferDisabledFilter",
+  "JsDisableFilter",
+  "Lazyload Images",
+  "LocalStorageCache",
+  "MakeShowAdsAsyncFilter",
+  "MobilizeLabel",
+  "MobilizeMenu",
+  "MobilizeMenuRenderFilter",
+  "MobilizeRewrite",
+  "OutlineCss",
+  "OutlineJs",
+  "Pedantic",
+  "RedirectOnSizeLimit",
+  "RemoveComments",
+  "ResponsiveImageFirst",
+  "ResponsiveImageSecond",
+  "RewrittenContentScanningFilter",
+  "Scan",
+  "SplitHtmlBeacon",
+  "SplitHtmlFilter",
+  "SplitHtmlHelperFilter",
+  "StripNonCacheableFilter",
+  "StripScripts",
+  "StripSubresourceHints",
+  "SupportNoscript",
+  "UrlLeftTrim",
+  "WebscaleMakeScriptsAsync",
+  "WebscaleMakeScriptsDefer",
+};
+
+const char kKcyclesHistogramPrefix[] = "HTML Filter Kilocycles: ";
+const char kEventsPrefix[] = "html_filter_events_";
+
+// Most filters take well under a millisecond per document; the last bucket
+// catches the rest.
+const int kKcyclesHistogramMaxValue = 5000;
+const int kKcyclesHistogramNumBuckets = 100;
+
+GoogleString EventsName(StringPiece filter_name) {
+  GoogleString name = StrCat(kEventsPrefix, filter_name);
+  std::replace(name.begin(), name.end(), ' ', '_');
+  return name;
+}
+
+struct Row {
+  const char* name;
+  double documents;
+  double average;
+  double total;
+  double p90;
+  double p99;
+  int64 events;
+};
+
+bool CostsMore(const Row& a, const Row& b) {
+  return a.total > b.total;
+}
+
+}  // namespace
+
+const char HtmlFilterProfileStats::kOtherFilters[] = "Other";
+
+HtmlFilterProfileStats::HtmlFilterProfileStats(Statistics* statistics) {
+  for (int i = 0, n = arraysize(kProfiledFilters); i <= n; ++i) {
+    FilterStats stats;
+    stats.name = (i < n) ? kProfiledFilters[i] : kOtherFilters;
+    stats.kcycles = statistics->GetHistogram(
+        StrCat(kKcyclesHistogramPrefix, stats.name));
+    stats.kcycles->SetMaxValue(kKcyclesHistogramMaxValue);
+    stats.events = statistics->GetVariable(EventsName(stats.name));
+    filters_.push_back(stats);
+    if (i < n) {
+      index_[stats.name] = i;
+    }
+  }
+}
+
+HtmlFilterProfileStats::~HtmlFilterProfileStats() {
+}
+
+void HtmlFilterProfileStats::InitStats(Statistics* statistics) {
+  for (int i = 0, n = arraysize(kProfiledFilters); i <= n; ++i) {
+    const char* name = (i < n) ? kProfiledFilters[i] : kOtherFilters;
+    Histogram* kcycles =
+        statistics->AddHistogram(StrCat(kKcyclesHistogramPrefix, name));
+    kcycles->SetMaxValue(kKcyclesHistogramMaxValue);
+    kcycles->SetSuggestedNumBuckets(kKcyclesHistogramNumBuckets);
+    statistics->AddVariable(EventsName(name));
+  }
+}
+
+bool HtmlFilterProfileStats::ShouldSample(int sample_rate) {
+  if (sample_rate <= 0) {
+    return false;
+  }
+  uint32 count = sample_count_.NoBarrierIncrement(1);
+  return (count % sample_rate) == 0;
+}
+
+void HtmlFilterProfileStats::Add(const HtmlFilterProfile& profile) {
+  // Filters without statistics of their own are added up, so Other gets
+  // one value per document like the rest.
+  uint64 other_cycles = 0;
+  int64 other_events = 0;
+  bool saw_other = false;
+  const std::vector<HtmlFilterProfile::Entry>& entries = profile.entries();
+  for (int i = 0, n = entries.size(); i < n; ++i) {
+    const HtmlFilterProfile::Entry& entry = entries[i];
+    NameIndexMap::const_iterator p = index_.find(entry.name);
+    if (p != index_.end()) {
+      AddToFilter(&filters_[p->second], entry.cycles, entry.events);
+    } else {
+      other_cycles += entry.cycles;
+      other_events += entry.events;
+      saw_other = true;
+    }
+  }
+  if (saw_other) {
+    AddToFilter(&filters_.back(), other_cycles, other_events);
+  }
+}
+
+void HtmlFilterProfileStats::AddToFilter(FilterStats* stats, uint64 cycles,
+                                         int64 events) {
+  stats->kcycles->Add(cycles / 1000.0);
+  stats->events->Add(events);
+}
+
+GoogleString HtmlFilterProfileStats::ToString() {
+  std::vector<Row> rows;
+  for (int i = 0, n = filters_.size(); i < n; ++i) {
+    Histogram* kcycles = filters_[i].kcycles;
+    Row row;
+    row.documents = kcycles->Count();
+    if (row.documents == 0) {
+      continue;
+    }
+    row.name = filters_[i].name;
+    row.average = kcycles->Average();
+    row.total = row.average * row.documents;
+    row.p90 = kcycles->Percentile(90);
+    row.p99 = kcycles->Percentile(99);
+    row.events = filters_[i].events->Get();
+    rows.push_back(row);
+  }
+  std::stable_sort(rows.begin(), rows.end(), CostsMore);
+
+  GoogleString out = StringPrintf(
+      "%-36s %10s %10s %10s %10s %12s\n", "Filter", "Documents",
+      "Avg kcyc", "90% kcyc", "99% kcyc", "Cycles/event");
+  for (int i = 0, n = rows.size(); i < n; ++i) {
+    const Row& row = rows[i];
+    double cycles_per_event =
+        (row.events == 0) ? 0 : row.total * 1000 / row.events;
+    StrAppend(&out, StringPrintf(
+        "%-36s %10.0f %10.1f %10.1f %10.1f %12.1f\n", row.name,
+        row.documents, row.average, row.p90, row.p99, cycles_per_event));
+  }
+  return out;
+}
+
+}  // namespace net_instaweb
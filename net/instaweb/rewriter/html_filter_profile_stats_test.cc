@@ -0,0 +1,109 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the aggregation of HTML filter profiles into statistics.
+
+#include "net/instaweb/rewriter/public/html_filter_profile_stats.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class NamedFilter : public EmptyHtmlFilter {
+ public:
+  explicit NamedFilter(const char* name) : name_(name) {}
+  virtual const char* Name() const { return name_; }
+
+ private:
+  const char* name_;
+
+  DISALLOW_COPY_AND_ASSIGN(NamedFilter);
+};
+
+class HtmlFilterProfileStatsTest : public testing::Test {
+ protected:
+  HtmlFilterProfileStatsTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()) {
+    HtmlFilterProfileStats::InitStats(&stats_);
+    filter_stats_.reset(new HtmlFilterProfileStats(&stats_));
+  }
+
+  double DocumentCount(const char* filter_name) {
+    return stats_.GetHistogram(
+        StrCat("HTML Filter Kilocycles: ", filter_name))->Count();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  scoped_ptr<HtmlFilterProfileStats> filter_stats_;
+};
+
+TEST_F(HtmlFilterProfileStatsTest, UnknownFiltersAreOther) {
+  NamedFilter known("CollapseWhitespace");
+  NamedFilter unknown1("Unknown1");
+  NamedFilter unknown2("Unknown2");
+  HtmlFilterProfile profile;
+  profile.Record(&known, 3000, 10);
+  profile.Record(&unknown1, 1000, 10);
+  profile.Record(&unknown2, 2000, 10);
+  filter_stats_->Add(profile);
+
+  EXPECT_EQ(1, DocumentCount("CollapseWhitespace"));
+  EXPECT_EQ(1, DocumentCount(HtmlFilterProfileStats::kOtherFilters));
+  EXPECT_EQ(0, DocumentCount("HtmlWriter"));
+  EXPECT_EQ(10, stats_.GetVariable(
+      "html_filter_events_CollapseWhitespace")->Get());
+  EXPECT_EQ(20, stats_.GetVariable("html_filter_events_Other")->Get());
+
+  // Spaces in filter names don't make it into variable names.
+  EXPECT_TRUE(stats_.FindVariable("html_filter_events_Lazyload_Images") !=
+              NULL);
+
+  GoogleString table = filter_stats_->ToString();
+  EXPECT_NE(GoogleString::npos, table.find("CollapseWhitespace"));
+  EXPECT_NE(GoogleString::npos, table.find("Other"));
+  EXPECT_EQ(GoogleString::npos, table.find("HtmlWriter"));
+}
+
+TEST_F(HtmlFilterProfileStatsTest, Sampling) {
+  EXPECT_FALSE(filter_stats_->ShouldSample(0));
+  int sampled = 0;
+  for (int i = 0; i < 30; ++i) {
+    if (filter_stats_->ShouldSample(3)) {
+      ++sampled;
+    }
+  }
+  EXPECT_EQ(10, sampled);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(filter_stats_->ShouldSample(1));
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
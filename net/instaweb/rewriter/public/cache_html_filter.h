@@ -52,6 +52,9 @@ class CacheHtmlFilter : public HtmlWriterFilter {
   void WriteString(StringPiece str);
   virtual void Flush();
   virtual const char* Name() const { return "CacheHtmlFilter"; }
+  // Unlike the plain HtmlWriterFilter, this one decides what to write from
+  // state it builds up across elements, so it keeps a pass of its own.
+  virtual bool IsStreamingSafe() const { return false; }
 
  private:
   void SendCookies();
@@ -58,6 +58,10 @@ class ComputeVisibleTextFilter : public HtmlWriterFilter {
   virtual void Directive(HtmlDirectiveNode* directive);
   virtual void EndDocument();
   virtual const char* Name() const { return "ComputeVisibleTextFilter"; }
+  // Unlike the plain HtmlWriterFilter, this one writes straight to the
+  // driver's writer at the end of the document, so it keeps a pass of its
+  // own.
+  virtual bool IsStreamingSafe() const { return false; }
 
  private:
   RewriteDriver* rewrite_driver_;
@@ -27,6 +27,7 @@
 namespace net_instaweb {
 
 class HtmlElement;
+class HtmlFilterProfile;
 class RewriteDriver;
 class Timer;
 
@@ -72,6 +73,9 @@ class DebugFilter : public EmptyHtmlFilter {
       int num_flushes, bool is_critical_images_beacon_enabled,
       const StringSet& critical_image_urls,
       const StringVector& dynamically_disabled_filter_list);
+  // Formats the per-filter costs measured while the document was parsed.
+  static GoogleString FormatFilterProfileMessage(
+      const HtmlFilterProfile& profile);
   // Gets the list of active filters from the RewriteDriver for logging to debug
   // message.
   GoogleString ListActiveFiltersAndOptions() const;
@@ -67,6 +67,11 @@ class FlushEarlyContentWriterFilter : public HtmlWriterFilter {
 
   virtual void Characters(HtmlCharactersNode* characters_node);
 
+  // Unlike the plain HtmlWriterFilter, this one swaps the driver's writer
+  // and decides what to write from state it builds up across elements, so
+  // it keeps a pass of its own.
+  virtual bool IsStreamingSafe() const { return false; }
+
  protected:
   virtual void Clear();
 
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NET_INSTAWEB_REWRITER_PUBLIC_HTML_FILTER_PROFILE_STATS_H_
+#define NET_INSTAWEB_REWRITER_PUBLIC_HTML_FILTER_PROFILE_STATS_H_
+
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class Histogram;
+class HtmlFilterProfile;
+class Statistics;
+class Variable;
+
+// Aggregates the HtmlFilterProfiles of sampled documents into statistics, so
+// the cost of each filter can be compared across processes.  For each filter
+// name there is a histogram of the thousands of cycles the filter took per
+// document, and a variable counting the events it was shown.
+//
+// Statistics must all be declared before shared memory is set up, so the
+// filter names come from a fixed list in the .cc; filters that are not on it
+// are counted together under kOtherFilters.
+class HtmlFilterProfileStats {
+ public:
+  static const char kOtherFilters[];
+
+  explicit HtmlFilterProfileStats(Statistics* statistics);
+  ~HtmlFilterProfileStats();
+
+  static void InitStats(Statistics* statistics);
+
+  // Returns true for one in sample_rate calls, to pick the documents to
+  // profile.  Never true if sample_rate <= 0.  Thread-safe.
+  bool ShouldSample(int sample_rate);
+
+  // Adds the costs of one document.
+  void Add(const HtmlFilterProfile& profile);
+
+  // A plain-text table of the filters that have been profiled, costliest
+  // first: the number of documents, the average, 90th and 99th percentile
+  // thousands of cycles per document, and the cycles per event.
+  GoogleString ToString();
+
+ private:
+  struct FilterStats {
+    const char* name;
+    Histogram* kcycles;
+    Variable* events;
+  };
+  typedef std::map<StringPiece, int> NameIndexMap;  // Indexes filters_.
+
+  void AddToFilter(FilterStats* stats, uint64 cycles, int64 events);
+
+  std::vector<FilterStats> filters_;  // Last is kOtherFilters.
+  NameIndexMap index_;
+  AtomicInt32 sample_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlFilterProfileStats);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_REWRITER_PUBLIC_HTML_FILTER_PROFILE_STATS_H_
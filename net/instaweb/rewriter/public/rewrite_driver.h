@@ -57,6 +57,7 @@
 #include "pagespeed/kernel/base/writer.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_filter.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/html/html_parse.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -1756,6 +1757,12 @@ class RewriteDriver : public HtmlParse {
   // Start time for HTML requests. Used for statistics reporting.
   int64 start_time_ms_;
 
+  // Per-filter costs of this document, measured when it is sampled for
+  // HtmlFilterProfileStats (see RewriteOptions::kHtmlFilterProfileSampleRate)
+  // or when the debug filter is on to report them.
+  HtmlFilterProfile html_filter_profile_;
+  bool html_filter_profile_sampled_;
+
   scoped_ptr<RequestProperties> request_properties_;
 
   // Helps make sure RewriteDriver and its children are initialized exactly
@@ -1790,6 +1797,8 @@ class OptionsAwareHTTPCacheCallback : public HTTPCache::Callback {
   virtual ~OptionsAwareHTTPCacheCallback();
   virtual bool IsCacheValid(const GoogleString& key,
                             const ResponseHeaders& headers);
+  virtual bool IsCacheValidFromSummary(
+      const GoogleString& key, const HTTPValue::HeadersSummary& summary);
   virtual int64 OverrideCacheTtlMs(const GoogleString& key);
   virtual ResponseHeaders::VaryOption RespectVaryOnResources() const;
 
@@ -281,6 +281,7 @@ class RewriteOptions {
   static const char kGoogleFontCssInlineMaxBytes[];
   static const char kForbidAllDisabledFilters[];
   static const char kHideRefererUsingMeta[];
+  static const char kHtmlFilterProfileSampleRate[];
   static const char kHttpCacheCompressionLevel[];
   static const char kIdleFlushTimeMs[];
   static const char kImageInlineMaxBytes[];
@@ -1934,6 +1935,13 @@ class RewriteOptions {
   }
   bool log_rewrite_timing() const { return log_rewrite_timing_.value(); }
 
+  void set_html_filter_profile_sample_rate(int x) {
+    set_option(x, &html_filter_profile_sample_rate_);
+  }
+  int html_filter_profile_sample_rate() const {
+    return html_filter_profile_sample_rate_.value();
+  }
+
   void set_log_url_indices(bool x) {
     set_option(x, &log_url_indices_);
   }
@@ -3946,6 +3954,8 @@ class RewriteOptions {
   Option<bool> log_background_rewrites_;
   Option<bool> log_mobilization_samples_;
   Option<bool> log_rewrite_timing_;   // Should we time HtmlParser?
+  // Profile the filters of one in this many HTML documents; 0 is never.
+  Option<int> html_filter_profile_sample_rate_;
   Option<bool> log_url_indices_;
   Option<bool> lowercase_html_names_;
   Option<bool> always_rewrite_css_;  // For tests/debugging.
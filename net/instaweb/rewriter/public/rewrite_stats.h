@@ -21,6 +21,7 @@
 
 #include <vector>
 
+#include "net/instaweb/rewriter/public/html_filter_profile_stats.h"
 #include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
 #include "pagespeed/kernel/base/basictypes.h"
 
@@ -132,6 +133,11 @@ class RewriteStats {
   TimedVariable* num_rewrites_executed() { return num_rewrites_executed_; }
   TimedVariable* num_rewrites_dropped() { return num_rewrites_dropped_; }
 
+  // Per-filter costs of the HTML documents that were profiled.
+  HtmlFilterProfileStats* html_filter_profile_stats() {
+    return &html_filter_profile_stats_;
+  }
+
  private:
   Variable* cached_output_hits_;
   Variable* cached_output_missed_deadline_;
@@ -170,6 +176,8 @@ class RewriteStats {
 
   std::vector<Waveform*> thread_queue_depths_;
 
+  HtmlFilterProfileStats html_filter_profile_stats_;
+
   DISALLOW_COPY_AND_ASSIGN(RewriteStats);
 };
 
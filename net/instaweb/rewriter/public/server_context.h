@@ -66,6 +66,7 @@ class ExperimentMatcher;
 class FileSystem;
 class FlushEarlyInfoFinder;
 class GoogleUrl;
+class HTTPCacheRefresher;
 class MessageHandler;
 class MobilizeCachedFinder;
 class NamedLock;
@@ -226,6 +227,14 @@ class ServerContext {
   HTTPCache* http_cache() const { return http_cache_.get(); }
   void set_http_cache(HTTPCache* x) { http_cache_.reset(x); }
 
+  // Keeps popular entries in http_cache() fresh, if set; otherwise NULL.
+  // Cache fetchers created afterwards report their hits to it.
+  HTTPCacheRefresher* http_cache_refresher() const {
+    return http_cache_refresher_.get();
+  }
+  // Takes ownership.
+  void set_http_cache_refresher(HTTPCacheRefresher* x);
+
   // Creates PagePropertyCache object with the provided PropertyStore object.
   void MakePagePropertyCache(PropertyStore* property_store);
 
@@ -756,6 +765,7 @@ class ServerContext {
 
   Timer* timer_;
   scoped_ptr<HTTPCache> http_cache_;
+  scoped_ptr<HTTPCacheRefresher> http_cache_refresher_;
   scoped_ptr<PropertyCache> page_property_cache_;
   CacheInterface* filesystem_metadata_cache_;
   CacheInterface* metadata_cache_;
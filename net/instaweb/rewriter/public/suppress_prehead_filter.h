@@ -50,6 +50,9 @@ class SuppressPreheadFilter : public HtmlWriterFilter {
 
   virtual void EndDocument();
 
+  // Unlike the plain HtmlWriterFilter, this one adds nodes to the DOM.
+  virtual bool IsStreamingSafe() const { return false; }
+
  protected:
   virtual void Clear();
   RewriteDriver* driver() const { return driver_; }
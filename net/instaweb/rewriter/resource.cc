@@ -266,8 +266,13 @@ void Resource::LinkFallbackValue(HTTPValue* value) {
 }
 
 StringPiece Resource::ExtractUncompressedContents() const {
+  // The summary, when there is one, spares parsing the headers of the
+  // common uncompressed resource.
+  HTTPValue::HeadersSummary summary;
   ResponseHeaders headers;
-  if (!extracted_ && value_.ExtractHeaders(&headers, NULL)) {
+  if (!extracted_ &&
+      (!value_.ExtractHeadersSummary(&summary) || summary.gzipped) &&
+      value_.ExtractHeaders(&headers, NULL)) {
     if (headers.IsGzipped()) {
       StringWriter inflate_writer(&extracted_contents_);
       if (GzipInflater::Inflate(raw_contents(), GzipInflater::kGzip,
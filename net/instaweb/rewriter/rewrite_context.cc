@@ -212,7 +212,11 @@ class RewriteContext::OutputCacheCallback : public CacheInterface::Callback {
 
   OutputCacheCallback(RewriteContext* rc, CacheResultHandlerFunction function)
       : rewrite_context_(rc), function_(function),
-        cache_result_(new CacheLookupResult) {}
+        cache_result_(new CacheLookupResult) {
+    // We only look at the value in ValidateCandidate, where we decode it, so
+    // caches that can are welcome to lend it to us rather than copy it.
+    set_accepts_borrowed_value(true);
+  }
 
   virtual ~OutputCacheCallback() {}
 
@@ -240,7 +244,7 @@ class RewriteContext::OutputCacheCallback : public CacheInterface::Callback {
     // used as we update cache_result_->cache_ok directly.
     CacheLookupResult candidate_cache_result;
     bool local_cache_ok = TryDecodeCacheResult(
-        state, *value(), &candidate_cache_result);
+        state, ValueView(), &candidate_cache_result);
 
     // cache_ok determines whether or not a second level cache is looked up. If
     // this is a stale rewrite, ensure there is an additional look up in the
@@ -525,7 +529,7 @@ class RewriteContext::OutputCacheCallback : public CacheInterface::Callback {
   // Will return false with result->can_revalidate = false if the cached result
   // is entirely unsalvageable.
   bool TryDecodeCacheResult(CacheInterface::KeyState state,
-                            const SharedString& value,
+                            StringPiece val_str,
                             CacheLookupResult* result) {
     bool* can_revalidate = &(result->can_revalidate);
     InputInfoStarVector* revalidate = &(result->revalidate);
@@ -539,7 +543,6 @@ class RewriteContext::OutputCacheCallback : public CacheInterface::Callback {
     }
     // We've got a hit on the output metadata; the contents should
     // be a protobuf.  Try to parse it.
-    StringPiece val_str = value.Value();
     ArrayInputStream input(val_str.data(), val_str.size());
     if (partitions->ParseFromZeroCopyStream(&input) &&
         IsOtherDependencyValid(partitions, is_stale_rewrite)) {
@@ -300,6 +300,7 @@ RewriteDriver::RewriteDriver(MessageHandler* message_handler,
       is_nested_(false),
       request_context_(NULL),
       start_time_ms_(0),
+      html_filter_profile_sampled_(false),
       tried_to_distribute_fetch_(false),
       defer_instrumentation_script_(false),
       downstream_cache_purger_(this)
@@ -457,6 +458,9 @@ void RewriteDriver::Clear() NO_THREAD_SAFETY_ANALYSIS {
   status_code_ = 0;
   flush_requested_ = false;
   flush_occurred_ = false;
+  set_filter_profile(NULL);
+  html_filter_profile_.Clear();
+  html_filter_profile_sampled_ = false;
   flushed_cached_html_ = false;
   flushing_cached_html_ = false;
   flushed_early_ = false;
@@ -675,20 +679,8 @@ void RewriteDriver::FlushAsync(Function* callback) {
   // can modify urls.
   DetermineFiltersBehavior();
 
-  for (FilterList::iterator it = early_pre_render_filters_.begin();
-      it != early_pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
-  for (FilterList::iterator it = pre_render_filters_.begin();
-      it != pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
+  ApplyFilters(early_pre_render_filters_);
+  ApplyFilters(pre_render_filters_);
 
   int num_rewrites = rewrites_.size();
 
@@ -2413,6 +2405,12 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
   }
   start_time_ms_ = server_context_->timer()->NowMs();
   set_log_rewrite_timing(options()->log_rewrite_timing());
+  html_filter_profile_sampled_ =
+      server_context_->rewrite_stats()->html_filter_profile_stats()->
+      ShouldSample(options()->html_filter_profile_sample_rate());
+  if (html_filter_profile_sampled_ || (debug_filter_ != NULL)) {
+    set_filter_profile(&html_filter_profile_);
+  }
 
   if (debug_filter_ != NULL) {
     debug_filter_->InitParse();
@@ -2790,6 +2788,9 @@ void RewriteDriver::FinishParseAfterFlush(Function* user_callback) {
   stats->rewrite_latency_histogram()->Add(
       server_context_->timer()->NowMs() - start_time_ms_);
   stats->total_rewrite_count()->IncBy(1);
+  if (html_filter_profile_sampled_) {
+    stats->html_filter_profile_stats()->Add(html_filter_profile_);
+  }
 
   // Update statistics log.
   StatisticsLogger* stats_logger =
@@ -3174,6 +3175,15 @@ bool OptionsAwareHTTPCacheCallback::IsCacheValid(
   return IsCacheValid(key, *rewrite_options_, request_context(), headers);
 }
 
+bool OptionsAwareHTTPCacheCallback::IsCacheValidFromSummary(
+    const GoogleString& key, const HTTPValue::HeadersSummary& summary) {
+  // The webp check in IsCacheValid needs the Vary header, so it waits for
+  // the headers to be parsed; cache flushes only need the date.
+  return ((summary.date_ms > 0) &&
+          rewrite_options_->IsUrlCacheValid(key, summary.date_ms,
+                                            true /* search_wildcards */));
+}
+
 ResponseHeaders::VaryOption
 OptionsAwareHTTPCacheCallback::RespectVaryOnResources() const {
   return ResponseHeaders::GetVaryOption(rewrite_options_->respect_vary());
@@ -150,6 +150,8 @@ const char RewriteOptions::kForbidAllDisabledFilters[] =
 const char RewriteOptions::kGoogleFontCssInlineMaxBytes[] =
     "GoogleFontCssInlineMaxBytes";
 const char RewriteOptions::kHideRefererUsingMeta[] = "HideRefererUsingMeta";
+const char RewriteOptions::kHtmlFilterProfileSampleRate[] =
+    "HtmlFilterProfileSampleRate";
 const char RewriteOptions::kHttpCacheCompressionLevel[] =
     "HttpCacheCompressionLevel";
 const char RewriteOptions::kIdleFlushTimeMs[] = "IdleFlushTimeMs";
@@ -1549,6 +1551,13 @@ void RewriteOptions::AddProperties() {
       kLogRewriteTiming,
       kDirectoryScope,
       "Whether or not to report timing information about HtmlParse.", false);
+  AddBaseProperty(
+      0, &RewriteOptions::html_filter_profile_sample_rate_, "hfps",
+      kHtmlFilterProfileSampleRate,
+      kServerScope,
+      "Measure the cost of each HTML filter on one in this many documents, "
+      "for the admin site's Filter Costs page.  0 (the default) turns "
+      "profiling off.", true);
   AddBaseProperty(
       false, &RewriteOptions::log_url_indices_, "lui",
       kLogUrlIndices,
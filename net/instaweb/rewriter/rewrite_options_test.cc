@@ -985,6 +985,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kForbidAllDisabledFilters,
     RewriteOptions::kGoogleFontCssInlineMaxBytes,
     RewriteOptions::kHideRefererUsingMeta,
+    RewriteOptions::kHtmlFilterProfileSampleRate,
     RewriteOptions::kHttpCacheCompressionLevel,
     RewriteOptions::kIdleFlushTimeMs,
     RewriteOptions::kImageInlineMaxBytes,
@@ -151,6 +151,7 @@ void RewriteStats::InitStats(Statistics* statistics) {
   for (int i = 0; i < RewriteDriverFactory::kNumWorkerPools; ++i) {
     statistics->AddUpDownCounter(kWaveFormCounters[i]);
   }
+  HtmlFilterProfileStats::InitStats(statistics);
 }
 
 // This is called when a RewriteDriverFactory is created, and adds
@@ -217,7 +218,8 @@ RewriteStats::RewriteStats(Statistics* stats,
       total_fetch_count_(stats->GetTimedVariable(kTotalFetchCount)),
       total_rewrite_count_(stats->GetTimedVariable(kTotalRewriteCount)),
       num_rewrites_executed_(stats->GetTimedVariable(kRewritesExecuted)),
-      num_rewrites_dropped_(stats->GetTimedVariable(kRewritesDropped)) {
+      num_rewrites_dropped_(stats->GetTimedVariable(kRewritesDropped)),
+      html_filter_profile_stats_(stats) {
   // Timers are not guaranteed to go forward in time, however
   // Histograms will CHECK-fail given a negative value unless
   // EnableNegativeBuckets is called, allowing bars to be created with
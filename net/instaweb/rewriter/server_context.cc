@@ -26,6 +26,7 @@
 #include "net/instaweb/config/rewrite_options_manager.h"
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/http_cache.h"
+#include "net/instaweb/http/public/http_cache_refresher.h"
 #include "net/instaweb/http/public/sync_fetcher_adapter_callback.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
 #include "net/instaweb/rewriter/cached_result.pb.h"
@@ -1063,6 +1064,10 @@ void ServerContext::MakePagePropertyCache(PropertyStore* property_store) {
   page_property_cache_.reset(pcache);
 }
 
+void ServerContext::set_http_cache_refresher(HTTPCacheRefresher* x) {
+  http_cache_refresher_.reset(x);
+}
+
 void ServerContext::set_cache_html_info_finder(CacheHtmlInfoFinder* finder) {
   cache_html_info_finder_.reset(finder);
 }
@@ -1476,6 +1481,7 @@ CacheUrlAsyncFetcher* ServerContext::CreateCustomCacheFetcher(
       stats->num_proactively_freshen_user_facing_request());
   cache_fetcher->set_serve_stale_while_revalidate_threshold_sec(
       options->serve_stale_while_revalidate_threshold_sec());
+  cache_fetcher->set_http_cache_refresher(http_cache_refresher_.get());
   return cache_fetcher;
 }
 
@@ -77,9 +77,11 @@
         'config/rewrite_options_manager_test.cc',
         'http/async_fetch_test.cc',
         'http/cache_url_async_fetcher_test.cc',
+        'http/collapsing_url_async_fetcher_test.cc',
         'http/fetcher_test.cc',
         'http/headers_cookie_util_test.cc',
         'http/http_cache_test.cc',
+        'http/http_cache_refresher_test.cc',
         'http/http_dump_url_async_writer_test.cc',
         'http/http_dump_url_fetcher_test.cc',
         'http/http_response_parser_test.cc',
@@ -162,6 +164,7 @@
         'rewriter/google_font_css_inline_filter_test.cc',
         'rewriter/google_font_service_input_resource_test.cc',
         'rewriter/handle_noscript_redirect_filter_test.cc',
+        'rewriter/html_filter_profile_stats_test.cc',
         'rewriter/iframe_fetcher_test.cc',
         'rewriter/image_combine_filter_test.cc',
         'rewriter/image_endian_test.cc',
@@ -237,12 +240,18 @@
         'spriter/image_spriter_test.cc',
         'spriter/libpng_image_library_test.cc',
         '<(DEPTH)/pagespeed/system/apr_mem_cache_test.cc',
+        '<(DEPTH)/pagespeed/system/binary_mem_cache_test.cc',
+        '<(DEPTH)/pagespeed/system/http2_protocol_test.cc',
+        '<(DEPTH)/pagespeed/system/ketama_ring_test.cc',
+        '<(DEPTH)/pagespeed/system/redis_cache_test.cc',
+        '<(DEPTH)/pagespeed/system/resp_protocol_test.cc',
         '<(DEPTH)/pagespeed/system/admin_site_test.cc',
         '<(DEPTH)/pagespeed/system/system_message_handler_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/annotated_message_handler_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/arena_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/base64_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/callback_test.cc',
+        '<(DEPTH)/pagespeed/kernel/base/char_arena_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/charset_util_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/chunking_writer_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/circular_buffer_test.cc',
@@ -278,24 +287,33 @@
         '<(DEPTH)/pagespeed/kernel/base/wildcard_group_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/wildcard_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/async_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/blocking_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_batcher_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/cache_codec_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_stats_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/coalescing_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/delay_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/fallback_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/file_cache_index_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/frequency_sketch_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/file_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/key_value_codec_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/mock_time_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_context_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_set_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/sequenced_callback_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/threadsafe_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/tiered_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/write_through_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/canonical_attributes_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/collapse_whitespace_filter_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/doctype_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/elide_attributes_filter_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_attribute_quote_removal_test.cc',
+        '<(DEPTH)/pagespeed/kernel/html/html_event_list_test.cc',
+        '<(DEPTH)/pagespeed/kernel/html/html_filter_profile_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_keywords_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_name_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_parse_test.cc',
@@ -349,6 +367,7 @@
         '<(DEPTH)/pagespeed/kernel/util/gzip_inflater_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/hashed_nonce_generator_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/input_file_nonce_generator_test.cc',
+        '<(DEPTH)/pagespeed/kernel/util/lz4_block_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/mem_lock_manager_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/nonce_generator_test_base.cc',
         '<(DEPTH)/pagespeed/kernel/util/re2_test.cc',
@@ -429,6 +448,7 @@
         '<(DEPTH)/pagespeed/apache/mock_apache.cc',
         '<(DEPTH)/pagespeed/apache/speed_test.cc',
         '<(DEPTH)/pagespeed/system/add_headers_fetcher_test.cc',
+        '<(DEPTH)/pagespeed/system/http2_url_async_fetcher_test.cc',
         '<(DEPTH)/pagespeed/system/in_place_resource_recorder_test.cc',
         '<(DEPTH)/pagespeed/system/loopback_route_fetcher_test.cc',
         '<(DEPTH)/pagespeed/system/serf_url_async_fetcher_test.cc',
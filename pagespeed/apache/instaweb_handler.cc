@@ -504,6 +504,13 @@ bool InstawebHandler::HandleAsInPlace() {
         server_context_->http_cache(),
         server_context_->statistics(),
         server_context_->message_handler());
+    // Spool large recordings next to the file cache, whose cleaning will
+    // also reclaim any left behind by a crash.
+    if (!options_->file_cache_path().empty()) {
+      recorder->EnableSpooling(
+          server_context_->file_system(), options_->file_cache_path(),
+          InPlaceResourceRecorder::kDefaultSpoolThresholdBytes);
+    }
     ap_add_output_filter(kModPagespeedInPlaceFilterName, recorder,
                          request_, request_->connection);
     ap_add_output_filter(kModPagespeedInPlaceCheckHeadersName, recorder,
@@ -39,6 +39,7 @@
         'kernel/base/abstract_mutex.cc',
         'kernel/base/annotated_message_handler.cc',
         'kernel/base/atom.cc',
+        'kernel/base/char_arena.cc',
         'kernel/base/debug.cc',
         'kernel/base/file_message_handler.cc',
         'kernel/base/file_system.cc',
@@ -192,22 +193,30 @@
       'type': '<(library)',
       'sources': [
         'kernel/cache/async_cache.cc',
+        'kernel/cache/blocking_cache.cc',
         'kernel/cache/cache_batcher.cc',
+        'kernel/cache/cache_codec.cc',
         'kernel/cache/cache_stats.cc',
+        'kernel/cache/coalescing_cache.cc',
         'kernel/cache/compressed_cache.cc',
         'kernel/cache/delegating_cache_callback.cc',
         'kernel/cache/fallback_cache.cc',
         'kernel/cache/file_cache.cc',
+        'kernel/cache/file_cache_index.cc',
+        'kernel/cache/frequency_sketch.cc',
         'kernel/cache/key_value_codec.cc',
         'kernel/cache/lru_cache.cc',
         'kernel/cache/purge_context.cc',
         'kernel/cache/purge_set.cc',
+        'kernel/cache/sequenced_callback_cache.cc',
         'kernel/cache/threadsafe_cache.cc',
+        'kernel/cache/tiered_cache.cc',
         'kernel/cache/write_through_cache.cc',
        ],
       'dependencies': [
         'pagespeed_base',
         '<(DEPTH)/third_party/rdestl/rdestl.gyp:rdestl',
+        '<(DEPTH)/third_party/zlib/zlib.gyp:zlib',
       ],
       'include_dirs': [
         '<(DEPTH)',
@@ -239,7 +248,9 @@
         'kernel/html/html_attribute_quote_removal.cc',
         'kernel/html/html_element.cc',
         'kernel/html/html_event.cc',
+        'kernel/html/html_event_list.cc',
         'kernel/html/html_filter.cc',
+        'kernel/html/html_filter_profile.cc',
         'kernel/html/html_keywords.cc',
         'kernel/html/html_lexer.cc',
         'kernel/html/html_node.cc',
@@ -389,6 +400,7 @@
         'kernel/util/gzip_inflater.cc',
         'kernel/util/hashed_nonce_generator.cc',
         'kernel/util/input_file_nonce_generator.cc',
+        'kernel/util/lz4_block.cc',
         'kernel/util/nonce_generator.cc',
         'kernel/util/simple_random.cc',
         'kernel/util/statistics_logger.cc',
@@ -540,7 +552,9 @@
       ],
       'dependencies': [
         'pagespeed_base',
+        'pagespeed_cache',
         'pagespeed_sharedmem_pb',
+        '<(DEPTH)/third_party/zlib/zlib.gyp:zlib',
       ],
       'include_dirs': [
         '<(DEPTH)',
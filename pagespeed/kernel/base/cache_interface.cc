@@ -42,9 +42,26 @@ CacheInterface::CacheInterface() {
 CacheInterface::~CacheInterface() {
 }
 
+CacheInterface::Callback::Callback()
+    : has_borrowed_value_(false),
+      accepts_borrowed_value_(false) {
+}
+
 CacheInterface::Callback::~Callback() {
 }
 
+bool CacheInterface::Callback::ValidateBorrowedCandidate(
+    const GoogleString& key, KeyState state, StringPiece borrowed_value) {
+  DCHECK(accepts_borrowed_value_);
+  DCHECK(!has_borrowed_value_);
+  borrowed_value_ = borrowed_value;
+  has_borrowed_value_ = true;
+  bool valid = ValidateCandidate(key, state);
+  borrowed_value_.clear();
+  has_borrowed_value_ = false;
+  return valid;
+}
+
 CacheInterface* CacheInterface::Backend() {
   return this;
 }
@@ -58,6 +75,12 @@ void CacheInterface::ValidateAndReportResult(const GoogleString& key,
   callback->Done(state);
 }
 
+CacheInterface::KeyState CacheInterface::ValidateBorrowedResult(
+    const GoogleString& key, StringPiece borrowed_value, Callback* callback) {
+  return callback->ValidateBorrowedCandidate(key, kAvailable, borrowed_value)
+      ? kAvailable : kNotFound;
+}
+
 void CacheInterface::MultiGet(MultiGetRequest* request) {
   for (int i = 0, n = request->size(); i < n; ++i) {
     KeyCallback* key_callback = &(*request)[i];
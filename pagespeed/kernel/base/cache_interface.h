@@ -41,9 +41,27 @@ class CacheInterface {
 
   class Callback {
    public:
+    Callback();
     virtual ~Callback();
     SharedString* value() { return &value_; }
 
+    // Callbacks that only look at candidate values from within
+    // ValidateCandidate() can opt in to having caches that support it lend
+    // them a read-only view of the value in the cache's own storage, rather
+    // than copying it into value(). Such callbacks must read the value with
+    // ValueView(), since value() stays empty for borrowed values, and must
+    // not hang on to the view after ValidateCandidate() returns.
+    bool accepts_borrowed_value() const { return accepts_borrowed_value_; }
+    void set_accepts_borrowed_value(bool x) { accepts_borrowed_value_ = x; }
+
+    // True while ValidateCandidate() is looking at a borrowed value.
+    bool has_borrowed_value() const { return has_borrowed_value_; }
+
+    // Returns the candidate value, whether borrowed or in value().
+    StringPiece ValueView() const {
+      return has_borrowed_value_ ? borrowed_value_ : value_.Value();
+    }
+
     // These methods are meant for use of callback subclasses that wrap
     // around other callbacks. Normal cache implementations should
     // just use CacheInterface::ValidateAndReportResult.
@@ -51,6 +69,12 @@ class CacheInterface {
       return ValidateCandidate(key, state);
     }
 
+    bool DelegatedValidateBorrowedCandidate(const GoogleString& key,
+                                            KeyState state,
+                                            StringPiece borrowed_value) {
+      return ValidateBorrowedCandidate(key, state, borrowed_value);
+    }
+
     void DelegatedDone(KeyState state) {
       Done(state);
     }
@@ -83,7 +107,14 @@ class CacheInterface {
     virtual void Done(KeyState state) = 0;
 
    private:
+    // Runs ValidateCandidate() with ValueView() returning borrowed_value.
+    bool ValidateBorrowedCandidate(const GoogleString& key, KeyState state,
+                                   StringPiece borrowed_value);
+
     SharedString value_;
+    StringPiece borrowed_value_;
+    bool has_borrowed_value_;
+    bool accepts_borrowed_value_;
   };
 
   // Helper class for use with implementations for which IsBlocking is true.
@@ -218,6 +249,19 @@ class CacheInterface {
   void ValidateAndReportResult(const GoogleString& key, KeyState state,
                                Callback* callback);
 
+  // Zero-copy counterpart of ValidateAndReportResult for a found value, for
+  // use when callback->accepts_borrowed_value(). The cache must keep
+  // 'borrowed_value' valid and unchanged until this returns, and then call
+  // ReportResult with the returned state once it has let go of it.
+  KeyState ValidateBorrowedResult(const GoogleString& key,
+                                  StringPiece borrowed_value,
+                                  Callback* callback);
+
+  // Invokes callback->Done().
+  void ReportResult(KeyState state, Callback* callback) {
+    callback->Done(state);
+  }
+
   // Helper method to report a NotFound on each MultiGet key.  Deletes
   // the request.
   void ReportMultiGetNotFound(MultiGetRequest* request);
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/base/char_arena.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace {
+
+// As in SymbolTable, leave room for any per-allocation overhead of malloc.
+const size_t kChunkSize = 16384 - 16;
+
+}  // namespace
+
+namespace net_instaweb {
+
+CharArena::CharArena()
+    : next_ptr_(NULL),
+      chunk_end_(NULL),
+      bytes_allocated_(0) {
+}
+
+CharArena::~CharArena() {
+  Clear();
+  for (int i = 0, n = chunks_.size(); i < n; ++i) {
+    std::free(chunks_[i]);
+  }
+}
+
+void CharArena::NewChunk() {
+  next_ptr_ = static_cast<char*>(std::malloc(kChunkSize));
+  chunk_end_ = next_ptr_ + kChunkSize;
+  chunks_.push_back(next_ptr_);
+}
+
+char* CharArena::Allocate(size_t size) {
+  bytes_allocated_ += size;
+  if (size > kChunkSize / 4) {
+    char* storage = static_cast<char*>(std::malloc(size));
+    large_.push_back(storage);
+    return storage;
+  }
+  if (static_cast<size_t>(chunk_end_ - next_ptr_) < size) {
+    NewChunk();
+  }
+  char* storage = next_ptr_;
+  next_ptr_ += size;
+  return storage;
+}
+
+char* CharArena::Copy(const StringPiece& src) {
+  if (src.data() == NULL) {
+    return NULL;
+  }
+  char* dst = Allocate(src.size() + 1);
+  memcpy(dst, src.data(), src.size());
+  dst[src.size()] = '\0';
+  return dst;
+}
+
+void CharArena::Clear() {
+  for (int i = 0, n = large_.size(); i < n; ++i) {
+    std::free(large_[i]);
+  }
+  large_.clear();
+  if (!chunks_.empty()) {
+    for (int i = 1, n = chunks_.size(); i < n; ++i) {
+      std::free(chunks_[i]);
+    }
+    chunks_.resize(1);
+    next_ptr_ = chunks_[0];
+    chunk_end_ = next_ptr_ + kChunkSize;
+  }
+  bytes_allocated_ = 0;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_BASE_CHAR_ARENA_H_
+#define PAGESPEED_KERNEL_BASE_CHAR_ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Bump-pointer allocator for character data whose lifetimes all end at
+// the same time, such as the strings belonging to one parse of a document.
+// Unlike Arena<T>, nothing is destroyed: individual allocations are never
+// freed, and Clear releases them all at once.  The first chunk is kept
+// across Clear, so an arena reused for many small documents does not go
+// back to malloc for each of them.
+//
+// Not thread-safe.
+class CharArena {
+ public:
+  CharArena();
+  ~CharArena();
+
+  // Returns uninitialized storage for size bytes, owned by the arena.
+  char* Allocate(size_t size);
+
+  // Returns a NUL-terminated copy of src, owned by the arena.  A src with
+  // NULL data yields NULL, so that an absent string stays distinct from
+  // an empty one.
+  char* Copy(const StringPiece& src);
+
+  // Releases everything allocated, invalidating all the returned pointers.
+  void Clear();
+
+  // Bytes handed out since the last Clear.
+  size_t bytes_allocated() const { return bytes_allocated_; }
+
+ private:
+  // Allocates a new chunk of storage for small strings.
+  void NewChunk();
+
+  // Chunks that small allocations are bumped out of; next_ptr_ points into
+  // the last one.  Allocations above a quarter of a chunk are malloced on
+  // their own and kept in large_, as SymbolTable does, so they don't
+  // waste the rest of a chunk.
+  std::vector<char*> chunks_;
+  std::vector<char*> large_;
+  char* next_ptr_;
+  char* chunk_end_;
+  size_t bytes_allocated_;
+
+  DISALLOW_COPY_AND_ASSIGN(CharArena);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_CHAR_ARENA_H_
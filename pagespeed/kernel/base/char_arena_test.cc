@@ -0,0 +1,76 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the character arena.
+
+#include "pagespeed/kernel/base/char_arena.h"
+
+#include <vector>
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+TEST(CharArenaTest, CopiesAreNulTerminated) {
+  CharArena arena;
+  const char* a = arena.Copy("hello");
+  const char* b = arena.Copy(StringPiece("world!", 5));
+  EXPECT_STREQ("hello", a);
+  EXPECT_STREQ("world", b);
+  EXPECT_EQ(12U, arena.bytes_allocated());
+}
+
+TEST(CharArenaTest, NullAndEmptyAreDistinct) {
+  CharArena arena;
+  EXPECT_TRUE(arena.Copy(StringPiece()) == NULL);
+  const char* empty = arena.Copy("");
+  ASSERT_TRUE(empty != NULL);
+  EXPECT_STREQ("", empty);
+}
+
+TEST(CharArenaTest, ManyAndLargeStrings) {
+  CharArena arena;
+  GoogleString large(100000, 'x');
+  const char* large_copy = arena.Copy(large);
+  StringVector expected;
+  std::vector<const char*> copies;
+  for (int i = 0; i < 10000; ++i) {
+    expected.push_back(IntegerToString(i));
+    copies.push_back(arena.Copy(expected.back()));
+  }
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_STREQ(expected[i].c_str(), copies[i]);
+  }
+  EXPECT_EQ(large, large_copy);
+}
+
+TEST(CharArenaTest, ClearReusesStorage) {
+  CharArena arena;
+  const char* first = arena.Copy("first");
+  arena.Copy(GoogleString(100000, 'x'));
+  arena.Clear();
+  EXPECT_EQ(0U, arena.bytes_allocated());
+  EXPECT_EQ(first, arena.Copy("again"));
+  EXPECT_STREQ("again", first);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -27,6 +27,13 @@
 
 namespace net_instaweb {
 
+Hasher::Incremental::~Incremental() {
+}
+
+GoogleString Hasher::Incremental::Hash() {
+  return hasher_->EncodeRawHash(RawHash());
+}
+
 Hasher::Hasher(int max_chars): max_chars_(max_chars) {
   CHECK_LE(0, max_chars);
 }
@@ -35,7 +42,10 @@ Hasher::~Hasher() {
 }
 
 GoogleString Hasher::Hash(const StringPiece& content) const {
-  GoogleString raw_hash = RawHash(content);
+  return EncodeRawHash(RawHash(content));
+}
+
+GoogleString Hasher::EncodeRawHash(const GoogleString& raw_hash) const {
   GoogleString out;
   Web64Encode(raw_hash, &out);
 
@@ -65,4 +75,8 @@ uint64 Hasher::HashToUint64(const StringPiece& content) const {
   return result;
 }
 
+Hasher::Incremental* Hasher::NewIncremental() const {
+  return NULL;
+}
+
 }  // namespace net_instaweb
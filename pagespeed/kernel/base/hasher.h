@@ -29,6 +29,32 @@ namespace net_instaweb {
 
 class Hasher {
  public:
+  // Computes the Hash() of content that arrives in pieces, so that the
+  // caller need not assemble it first.  Not thread-safe.
+  class Incremental {
+   public:
+    virtual ~Incremental();
+
+    virtual void Add(const StringPiece& content) = 0;
+
+    // Returns what the hasher's Hash() would of everything added.  Call at
+    // most once.
+    GoogleString Hash();
+
+   protected:
+    explicit Incremental(const Hasher* hasher) : hasher_(hasher) {}
+
+    const Hasher* hasher() const { return hasher_; }
+
+    // Returns what the hasher's RawHash() would of everything added.
+    virtual GoogleString RawHash() = 0;
+
+   private:
+    const Hasher* hasher_;
+
+    DISALLOW_COPY_AND_ASSIGN(Incremental);
+  };
+
   // The passed in max_chars will be used to limit the length of
   // Hash() and HashSizeInChars()
   explicit Hasher(int max_chars);
@@ -59,7 +85,15 @@ class Hasher {
   // The number of bytes RawHash will produce.
   virtual int RawHashSizeInBytes() const = 0;
 
+  // Returns a new Incremental computation of this hasher's Hash(), owned by
+  // the caller, or NULL if this hasher can only hash content all at once.
+  // The default returns NULL.
+  virtual Incremental* NewIncremental() const;
+
  private:
+  // Web64-encodes raw_hash, and truncates it to HashSizeInChars().
+  GoogleString EncodeRawHash(const GoogleString& raw_hash) const;
+
   int max_chars_;  // limit on length of Hash/HashSizeInChars set by subclass.
 
   DISALLOW_COPY_AND_ASSIGN(Hasher);
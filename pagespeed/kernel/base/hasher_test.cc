@@ -20,6 +20,7 @@
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 
 namespace net_instaweb {
 
@@ -62,6 +63,12 @@ TEST(HasherTest, HashToUint64) {
                                 "\x31\x33\x70\x31\x33\x70"));
 }
 
+TEST(HasherTest, NoDefaultIncremental) {
+  const DummyHasher hasher;
+  scoped_ptr<Hasher::Incremental> incremental(hasher.NewIncremental());
+  EXPECT_TRUE(incremental.get() == NULL);
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
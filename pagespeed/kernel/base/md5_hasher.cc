@@ -21,7 +21,11 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "base/md5.h"
 #if !defined(CHROMIUM_REVISION) || CHROMIUM_REVISION >= 92861
+using base::MD5Context;
 using base::MD5Digest;
+using base::MD5Final;
+using base::MD5Init;
+using base::MD5Update;
 #endif
 
 namespace net_instaweb {
@@ -32,6 +36,30 @@ const int kMD5NumBytes = sizeof(MD5Digest);
 
 }  // namespace
 
+class MD5Hasher::MD5Incremental : public Hasher::Incremental {
+ public:
+  explicit MD5Incremental(const MD5Hasher* hasher) : Incremental(hasher) {
+    MD5Init(&context_);
+  }
+  virtual ~MD5Incremental() {}
+
+  virtual void Add(const StringPiece& content) {
+    MD5Update(&context_, content);
+  }
+
+ protected:
+  virtual GoogleString RawHash() {
+    MD5Digest digest;
+    MD5Final(&digest, &context_);
+    return GoogleString(reinterpret_cast<char*>(digest.a), sizeof(digest.a));
+  }
+
+ private:
+  MD5Context context_;
+
+  DISALLOW_COPY_AND_ASSIGN(MD5Incremental);
+};
+
 MD5Hasher::~MD5Hasher() {
 }
 
@@ -52,4 +80,8 @@ int MD5Hasher::RawHashSizeInBytes() const {
   return kMD5NumBytes;
 }
 
+Hasher::Incremental* MD5Hasher::NewIncremental() const {
+  return new MD5Incremental(this);
+}
+
 }  // namespace net_instaweb
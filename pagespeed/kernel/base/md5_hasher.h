@@ -35,8 +35,11 @@ class MD5Hasher : public Hasher {
 
   virtual GoogleString RawHash(const StringPiece& content) const;
   virtual int RawHashSizeInBytes() const;
+  virtual Incremental* NewIncremental() const;
 
  private:
+  class MD5Incremental;
+
   DISALLOW_COPY_AND_ASSIGN(MD5Hasher);
 };
 
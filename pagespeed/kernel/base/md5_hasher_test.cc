@@ -17,6 +17,8 @@
 #include "pagespeed/kernel/base/md5_hasher.h"
 
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/hasher.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 
 namespace net_instaweb {
@@ -48,6 +50,21 @@ TEST_F(MD5HasherTest, HashesDiffer) {
             hasher.Hash(GoogleString(5001, 'z')));
 }
 
+TEST_F(MD5HasherTest, IncrementalMatchesHash) {
+  MD5Hasher hasher;
+  GoogleString content;
+  scoped_ptr<Hasher::Incremental> incremental(hasher.NewIncremental());
+  for (int i = 0; i < 100; ++i) {
+    GoogleString piece(i, 'a' + (i % 26));
+    incremental->Add(piece);
+    content += piece;
+  }
+  EXPECT_EQ(hasher.Hash(content), incremental->Hash());
+
+  incremental.reset(hasher.NewIncremental());
+  EXPECT_EQ(hasher.Hash(""), incremental->Hash());
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -122,6 +122,11 @@ void SharedString::Extend(int new_size) {
   }
 }
 
+void SharedString::Reserve(int capacity) {
+  UniquifyIfTruncated();
+  ref_string_->reserve(capacity + skip_);
+}
+
 void SharedString::WriteAt(int dest_offset, const char* source, int count) {
   DCHECK_LT(dest_offset, size());
   DCHECK_LE(dest_offset + count, size());
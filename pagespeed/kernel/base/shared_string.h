@@ -103,6 +103,11 @@ class SharedString {
   // detached prior to extending it.
   void Extend(int new_size);
 
+  // Lets the underlying storage grow to 'capacity' bytes without being
+  // reallocated.  Like Extend(), this does not detach other SharedStrings,
+  // unless this one has been truncated.
+  void Reserve(int capacity);
+
   // Swaps storage with the the passed-in string, detaching from any other
   // previously-linked SharedStrings.
   void SwapWithString(GoogleString* str);
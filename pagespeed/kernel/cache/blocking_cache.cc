@@ -0,0 +1,151 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/blocking_cache.h"
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+// Lets a thread wait for a number of callbacks to have run.
+class BlockingCache::Latch {
+ public:
+  Latch(ThreadSystem* thread_system, int count)
+      : mutex_(thread_system->NewMutex()),
+        condvar_(mutex_->NewCondvar()),
+        count_(count) {
+  }
+
+  void CountDown() {
+    ScopedMutex lock(mutex_.get());
+    if (--count_ == 0) {
+      condvar_->Signal();
+    }
+  }
+
+  void Wait() {
+    ScopedMutex lock(mutex_.get());
+    while (count_ > 0) {
+      condvar_->Wait();
+    }
+  }
+
+ private:
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> condvar_;
+  int count_;
+
+  DISALLOW_COPY_AND_ASSIGN(Latch);
+};
+
+// Captures the result on whatever thread the underlying cache calls back on,
+// then counts down the latch.  The caller's own callback is only run once the
+// waiting thread wakes up (see ReportResult), so it is free to issue cache
+// operations of its own -- even blocking ones through this cache -- without
+// waiting on a thread that is busy running it.
+class BlockingCache::LatchedCallback : public CacheInterface::Callback {
+ public:
+  explicit LatchedCallback(Latch* latch)
+      : latch_(latch),
+        state_(CacheInterface::kNotFound) {
+  }
+
+  CacheInterface::KeyState state() const { return state_; }
+
+ protected:
+  // The caller's callback gets to validate the value in ReportResult, so
+  // take the first candidate offered.
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    return true;
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    state_ = state;
+    latch_->CountDown();
+  }
+
+ private:
+  Latch* latch_;
+  CacheInterface::KeyState state_;
+
+  DISALLOW_COPY_AND_ASSIGN(LatchedCallback);
+};
+
+BlockingCache::BlockingCache(CacheInterface* cache,
+                             ThreadSystem* thread_system)
+    : cache_(cache),
+      thread_system_(thread_system) {
+}
+
+BlockingCache::~BlockingCache() {
+}
+
+GoogleString BlockingCache::FormatName(StringPiece cache) {
+  return StrCat("Blocking(", cache, ")");
+}
+
+void BlockingCache::Get(const GoogleString& key, Callback* callback) {
+  Latch latch(thread_system_, 1);
+  LatchedCallback latched(&latch);
+  cache_->Get(key, &latched);
+  latch.Wait();
+  ReportResult(key, &latched, callback);
+}
+
+void BlockingCache::MultiGet(MultiGetRequest* request) {
+  // Issue the lookups together, so a cache that batches them still can.
+  // The underlying cache deletes the request, so hang on to the caller's
+  // keys and callbacks.
+  MultiGetRequest callers(*request);
+  int n = request->size();
+  Latch latch(thread_system_, n);
+  scoped_array<LatchedCallback*> latched(new LatchedCallback*[n]);
+  for (int i = 0; i < n; ++i) {
+    latched[i] = new LatchedCallback(&latch);
+    (*request)[i].callback = latched[i];
+  }
+  cache_->MultiGet(request);
+  latch.Wait();
+  for (int i = 0; i < n; ++i) {
+    ReportResult(callers[i].key, latched[i], callers[i].callback);
+    delete latched[i];
+  }
+}
+
+void BlockingCache::ReportResult(const GoogleString& key,
+                                 LatchedCallback* latched,
+                                 Callback* callback) {
+  *callback->value() = *latched->value();
+  ValidateAndReportResult(key, latched->state(), callback);
+}
+
+void BlockingCache::Put(const GoogleString& key, SharedString* value) {
+  cache_->Put(key, value);
+}
+
+void BlockingCache::Delete(const GoogleString& key) {
+  cache_->Delete(key);
+}
+
+}  // namespace net_instaweb
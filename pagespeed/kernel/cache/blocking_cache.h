@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_BLOCKING_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_BLOCKING_CACHE_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class SharedString;
+class ThreadSystem;
+
+// The inverse of AsyncCache: presents a non-blocking cache through the
+// blocking interface, for users that insist on IsBlocking(), by having Get
+// and MultiGet wait until the underlying cache has called back.  Puts and
+// Deletes are passed straight through.
+//
+// The underlying cache must run its callbacks on some other thread, since
+// the thread calling Get is stalled until they run.  Those callbacks only
+// record the result: the caller's callback is run on the calling thread once
+// it wakes up, so the underlying cache's thread never runs client code.  This
+// also means each lookup takes the first candidate the underlying cache
+// offers, so it should not be a multi-level cache.
+class BlockingCache : public CacheInterface {
+ public:
+  // Does not take ownership of the cache or the thread system.
+  BlockingCache(CacheInterface* cache, ThreadSystem* thread_system);
+  virtual ~BlockingCache();
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  virtual void MultiGet(MultiGetRequest* request);
+  static GoogleString FormatName(StringPiece cache);
+  virtual GoogleString Name() const { return FormatName(cache_->Name()); }
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+  virtual bool MustEncodeKeyInValueOnPut() const {
+    return cache_->MustEncodeKeyInValueOnPut();
+  }
+  virtual void PutWithKeyInValue(const GoogleString& key,
+                                 SharedString* key_and_value) {
+    cache_->PutWithKeyInValue(key, key_and_value);
+  }
+
+ private:
+  class Latch;
+  class LatchedCallback;
+
+  // Hands the result captured by 'latched' to the caller's callback.
+  void ReportResult(const GoogleString& key, LatchedCallback* latched,
+                    Callback* callback);
+
+  CacheInterface* cache_;
+  ThreadSystem* thread_system_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockingCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_BLOCKING_CACHE_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test BlockingCache, layered over an AsyncCache so that callbacks
+// run on a worker thread.
+
+#include "pagespeed/kernel/cache/blocking_cache.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/async_cache.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const size_t kMaxSize = 100;
+
+// Looks up another key through the same cache once its own lookup is done.
+class NestedGetCallback : public CacheTestBase::Callback {
+ public:
+  NestedGetCallback(CacheInterface* cache, const GoogleString& inner_key)
+      : cache_(cache),
+        inner_key_(inner_key) {
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    Callback::Done(state);
+    cache_->Get(inner_key_, &inner_);
+  }
+
+  CacheTestBase::Callback* inner() { return &inner_; }
+
+ private:
+  CacheInterface* cache_;
+  GoogleString inner_key_;
+  CacheTestBase::Callback inner_;
+
+  DISALLOW_COPY_AND_ASSIGN(NestedGetCallback);
+};
+
+class BlockingCacheTest : public CacheTestBase {
+ protected:
+  BlockingCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        lru_cache_(kMaxSize),
+        threadsafe_cache_(&lru_cache_, thread_system_->NewMutex()),
+        pool_(1, "cache", thread_system_.get()),
+        async_cache_(&threadsafe_cache_, &pool_),
+        blocking_cache_(&async_cache_, thread_system_.get()) {
+  }
+
+  ~BlockingCacheTest() {
+    pool_.ShutDown();
+  }
+
+  virtual CacheInterface* Cache() { return &blocking_cache_; }
+
+  virtual void PostOpCleanup() {
+    // Puts are not blocking, so let them land before the next lookup.
+    while (async_cache_.outstanding_operations() != 0) {
+      timer_->SleepMs(1);
+    }
+  }
+
+  virtual void SetUp() {
+    timer_.reset(thread_system_->NewTimer());
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  LRUCache lru_cache_;
+  ThreadsafeCache threadsafe_cache_;
+  QueuedWorkerPool pool_;
+  AsyncCache async_cache_;
+  BlockingCache blocking_cache_;
+};
+
+// The CacheTestBase callbacks' Wait() does nothing, and checks that Done was
+// already called, so these verify that lookups block.
+TEST_F(BlockingCacheTest, PutGetDelete) {
+  EXPECT_TRUE(blocking_cache_.IsBlocking());
+  EXPECT_FALSE(async_cache_.IsBlocking());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(BlockingCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+// The AsyncCache has a single worker, so were the outer callback run on it,
+// the inner lookup could never be served.
+TEST_F(BlockingCacheTest, CallbackDoesBlockingGet) {
+  CheckPut("Outer", "Outer Value");
+  CheckPut("Inner", "Inner Value");
+  NestedGetCallback callback(&blocking_cache_, "Inner");
+  blocking_cache_.Get("Outer", &callback);
+  ASSERT_TRUE(callback.called());
+  EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+  EXPECT_EQ("Outer Value", callback.value_str());
+  ASSERT_TRUE(callback.inner()->called());
+  EXPECT_EQ(CacheInterface::kAvailable, callback.inner()->state());
+  EXPECT_EQ("Inner Value", callback.inner()->value_str());
+}
+
+TEST_F(BlockingCacheTest, InvalidValueNotFound) {
+  CheckPut("Name", "Value");
+  set_invalid_value("Value");
+  CheckNotFound("Name");
+}
+
+TEST_F(BlockingCacheTest, Name) {
+  EXPECT_EQ("Blocking(Async(ThreadsafeCache(LRUCache)))",
+            blocking_cache_.Name());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
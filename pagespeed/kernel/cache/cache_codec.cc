@@ -0,0 +1,327 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/cache_codec.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"  // NOLINT
+#include "zconf.h"  // NOLINT
+#else
+#include "third_party/zlib/zlib.h"
+#include "third_party/zlib/zconf.h"
+#endif
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/util/lz4_block.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Every zlib stream written with the default 32k window starts with this.
+const char kZlibTag = 0x78;
+const char kDictionaryDeflateTag = 'D';
+
+// Size of the uncompressed-size and checksum fields framing an LZ4 block.
+const size_t kLz4HeaderSize = 8;
+// LZ4 can't expand data by more than this, which bounds the size we are
+// willing to allocate for a corrupt header.
+const size_t kLz4MaxRatio = 255;
+
+// TrainDictionary scores segments of this size by their substrings of
+// kGramSize, counting those with a table of 2^kGramHashLog buckets.
+const size_t kSegmentSize = 64;
+const size_t kGramSize = 8;
+const int kGramHashLog = 20;
+
+void AppendUint32(uint32 value, GoogleString* out) {
+  char bytes[4];
+  for (int i = 0; i < 4; ++i) {
+    bytes[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+  out->append(bytes, sizeof(bytes));
+}
+
+uint32 ReadUint32(const char* p) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(p);
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+      (static_cast<uint32>(bytes[3]) << 24);
+}
+
+uint32 Adler32(StringPiece data) {
+  return adler32(adler32(0, Z_NULL, 0),
+                 reinterpret_cast<const Bytef*>(data.data()), data.size());
+}
+
+uint32 GramBucket(const char* p) {
+  uint64 gram;
+  memcpy(&gram, p, sizeof(gram));
+  return static_cast<uint32>((gram * 0x9E3779B97F4A7C15ULL) >>
+                             (64 - kGramHashLog));
+}
+
+// Sums the sample counts of the grams in segment that occur in other samples
+// too.
+int64 ScoreSegment(StringPiece segment, const std::vector<int>& counts) {
+  int64 score = 0;
+  for (size_t i = 0; i + kGramSize <= segment.size(); ++i) {
+    int count = counts[GramBucket(segment.data() + i)];
+    if (count > 1) {
+      score += count;
+    }
+  }
+  return score;
+}
+
+typedef std::pair<int64, StringPiece> ScoredSegment;
+
+struct ScoreLess {
+  bool operator()(const ScoredSegment& a, const ScoredSegment& b) const {
+    return a.first < b.first;
+  }
+};
+
+}  // namespace
+
+const char CacheCodec::kDeflate[] = "deflate";
+const char CacheCodec::kDeflateFast[] = "deflate-fast";
+const char CacheCodec::kLz4[] = "lz4";
+
+const int DeflateCodec::kDefaultLevel = Z_DEFAULT_COMPRESSION;
+const int DeflateCodec::kFastestLevel = Z_BEST_SPEED;
+
+CacheCodec::~CacheCodec() {
+}
+
+CacheCodec* CacheCodec::Create(StringPiece name, StringPiece dictionary) {
+  if (StringCaseEqual(name, kDeflate)) {
+    return new DeflateCodec(DeflateCodec::kDefaultLevel, dictionary);
+  } else if (StringCaseEqual(name, kDeflateFast)) {
+    return new DeflateCodec(DeflateCodec::kFastestLevel, dictionary);
+  } else if (StringCaseEqual(name, kLz4)) {
+    return new Lz4Codec;
+  }
+  return NULL;
+}
+
+GoogleString CacheCodec::TrainDictionary(const StringVector& samples,
+                                         size_t max_size) {
+  // Count the samples each gram occurs in.
+  std::vector<int> counts(1 << kGramHashLog, 0);
+  std::vector<uint32> buckets;
+  for (int i = 0, n = samples.size(); i < n; ++i) {
+    const GoogleString& sample = samples[i];
+    buckets.clear();
+    for (size_t j = 0; j + kGramSize <= sample.size(); ++j) {
+      buckets.push_back(GramBucket(sample.data() + j));
+    }
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+    for (int j = 0, m = buckets.size(); j < m; ++j) {
+      ++counts[buckets[j]];
+    }
+  }
+
+  // Greedily pick the best-scoring half-overlapping segments.  Once a
+  // segment is picked its grams stop counting, so scores only drop, and a
+  // popped segment whose rescore still beats the next one is the best.
+  std::priority_queue<ScoredSegment, std::vector<ScoredSegment>, ScoreLess>
+      queue;
+  for (int i = 0, n = samples.size(); i < n; ++i) {
+    StringPiece sample(samples[i]);
+    for (size_t j = 0; j < sample.size(); j += kSegmentSize / 2) {
+      StringPiece segment = sample.substr(j, kSegmentSize);
+      int64 score = ScoreSegment(segment, counts);
+      if (score > 0) {
+        queue.push(ScoredSegment(score, segment));
+      }
+    }
+  }
+  std::vector<StringPiece> picked;
+  size_t size = 0;
+  while (!queue.empty() && (size < max_size)) {
+    ScoredSegment top = queue.top();
+    queue.pop();
+    int64 score = ScoreSegment(top.second, counts);
+    if (score == 0) {
+      continue;
+    } else if (!queue.empty() && (score < queue.top().first)) {
+      queue.push(ScoredSegment(score, top.second));
+      continue;
+    }
+    StringPiece segment = top.second.substr(0, max_size - size);
+    picked.push_back(segment);
+    size += segment.size();
+    for (size_t i = 0; i + kGramSize <= segment.size(); ++i) {
+      counts[GramBucket(segment.data() + i)] = 0;
+    }
+  }
+
+  GoogleString dictionary;
+  dictionary.reserve(size);
+  for (int i = picked.size() - 1; i >= 0; --i) {
+    picked[i].AppendToString(&dictionary);
+  }
+  return dictionary;
+}
+
+DeflateCodec::DeflateCodec(int compression_level, StringPiece dictionary)
+    : compression_level_(compression_level) {
+  dictionary.CopyToString(&dictionary_);
+}
+
+DeflateCodec::~DeflateCodec() {
+}
+
+const char* DeflateCodec::name() const {
+  return (compression_level_ == kFastestLevel) ? kDeflateFast : kDeflate;
+}
+
+char DeflateCodec::tag() const {
+  return dictionary_.empty() ? kZlibTag : kDictionaryDeflateTag;
+}
+
+bool DeflateCodec::Encode(StringPiece in, GoogleString* out) const {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit(&strm, compression_level_) != Z_OK) {
+    return false;
+  }
+  if (!dictionary_.empty() &&
+      (deflateSetDictionary(
+          &strm, reinterpret_cast<const Bytef*>(dictionary_.data()),
+          dictionary_.size()) != Z_OK)) {
+    deflateEnd(&strm);
+    return false;
+  }
+
+  // Deflate in one shot into a buffer big enough for any result.
+  size_t out_start = out->size();
+  if (!dictionary_.empty()) {
+    out->push_back(kDictionaryDeflateTag);
+  }
+  size_t stream_start = out->size();
+  size_t bound = deflateBound(&strm, in.size());
+  out->resize(stream_start + bound);
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  strm.avail_in = in.size();
+  strm.next_out = reinterpret_cast<Bytef*>(&(*out)[stream_start]);
+  strm.avail_out = bound;
+  int ret = deflate(&strm, Z_FINISH);
+  deflateEnd(&strm);
+  if (ret != Z_STREAM_END) {
+    out->resize(out_start);
+    return false;
+  }
+  out->resize(stream_start + strm.total_out);
+  DCHECK_EQ(kZlibTag, (*out)[stream_start]);
+  return true;
+}
+
+bool DeflateCodec::Decode(StringPiece in, GoogleString* out) const {
+  if (in.empty() || (in[0] != tag())) {
+    return false;
+  }
+  if (!dictionary_.empty()) {
+    in.remove_prefix(1);
+  }
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit(&strm) != Z_OK) {
+    return false;
+  }
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  strm.avail_in = in.size();
+
+  // Inflate into the free space at the end of *out, growing it as needed.
+  size_t out_start = out->size();
+  size_t used = out_start;
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    if (used == out->size()) {
+      out->resize(std::max(2 * out->size(), used + 4 * in.size() + 64));
+    }
+    strm.next_out = reinterpret_cast<Bytef*>(&(*out)[used]);
+    strm.avail_out = out->size() - used;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    used = out->size() - strm.avail_out;
+    if ((ret == Z_NEED_DICT) && !dictionary_.empty()) {
+      // Fails unless the stream was written with our dictionary.
+      ret = inflateSetDictionary(
+          &strm, reinterpret_cast<const Bytef*>(dictionary_.data()),
+          dictionary_.size());
+    } else if ((ret == Z_BUF_ERROR) && (strm.avail_out == 0)) {
+      ret = Z_OK;
+    }
+  }
+  // Anything after the end of the stream is corruption too.
+  bool ok = (ret == Z_STREAM_END) && (strm.avail_in == 0);
+  inflateEnd(&strm);
+  out->resize(ok ? used : out_start);
+  return ok;
+}
+
+Lz4Codec::Lz4Codec() {
+}
+
+Lz4Codec::~Lz4Codec() {
+}
+
+bool Lz4Codec::Encode(StringPiece in, GoogleString* out) const {
+  if (in.size() > kuint32max) {
+    return false;
+  }
+  out->reserve(out->size() + 1 + kLz4HeaderSize +
+               Lz4Block::MaxCompressedSize(in.size()));
+  out->push_back(tag());
+  AppendUint32(in.size(), out);
+  AppendUint32(Adler32(in), out);
+  Lz4Block::Compress(in, out);
+  return true;
+}
+
+bool Lz4Codec::Decode(StringPiece in, GoogleString* out) const {
+  if ((in.size() < 1 + kLz4HeaderSize) || (in[0] != tag())) {
+    return false;
+  }
+  size_t size = ReadUint32(in.data() + 1);
+  uint32 checksum = ReadUint32(in.data() + 5);
+  StringPiece block = in.substr(1 + kLz4HeaderSize);
+  if (size > kLz4MaxRatio * block.size()) {
+    return false;
+  }
+  size_t out_start = out->size();
+  if (!Lz4Block::Decompress(block, size, out)) {
+    return false;
+  }
+  if (Adler32(StringPiece(*out).substr(out_start)) != checksum) {
+    out->resize(out_start);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace net_instaweb
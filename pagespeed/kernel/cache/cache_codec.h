@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
+#define PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// A compression format for CompressedCache.  Every encoding starts with the
+// codec's tag byte, so a reader can tell which codec wrote an entry and
+// entries survive a change of codec.
+class CacheCodec {
+ public:
+  virtual ~CacheCodec();
+
+  // Names accepted by Create.
+  static const char kDeflate[];
+  static const char kDeflateFast[];
+  static const char kLz4[];
+
+  // Creates the codec with the given name, or returns NULL if there is no
+  // such codec.  A non-empty dictionary is used by the deflate codecs,
+  // whose encodings can then only be decoded with the same dictionary.
+  static CacheCodec* Create(StringPiece name, StringPiece dictionary);
+
+  // Builds a dictionary of at most max_size bytes from representative
+  // values, by picking the segments of them that share the most 8-byte
+  // substrings with the other samples.  The most useful segments go last,
+  // where deflate can reach them with the shortest distances.
+  static GoogleString TrainDictionary(const StringVector& samples,
+                                      size_t max_size);
+
+  virtual const char* name() const = 0;
+  virtual char tag() const = 0;
+
+  // Appends the encoding of in, starting with tag(), to *out.  Returns false
+  // on failure, though none are expected.
+  virtual bool Encode(StringPiece in, GoogleString* out) const = 0;
+
+  // Appends the decoding of in, which starts with tag(), to *out.  Returns
+  // false if in is corrupt.
+  virtual bool Decode(StringPiece in, GoogleString* out) const = 0;
+
+ protected:
+  CacheCodec() {}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CacheCodec);
+};
+
+// zlib streams, optionally with a preset dictionary.  Without a dictionary
+// the tag is 'x', the first byte of every zlib stream with the default
+// window, so this also decodes entries written before codecs had tags.
+class DeflateCodec : public CacheCodec {
+ public:
+  // zlib's default level, and its fastest.
+  static const int kDefaultLevel;
+  static const int kFastestLevel;
+
+  // compression_level is as for zlib: 1 is fastest, 9 smallest.
+  DeflateCodec(int compression_level, StringPiece dictionary);
+  virtual ~DeflateCodec();
+
+  virtual const char* name() const;
+  virtual char tag() const;
+  virtual bool Encode(StringPiece in, GoogleString* out) const;
+  virtual bool Decode(StringPiece in, GoogleString* out) const;
+
+ private:
+  int compression_level_;
+  GoogleString dictionary_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflateCodec);
+};
+
+// LZ4 blocks, framed with the uncompressed size and its Adler-32 checksum
+// so that corruption is detected as reliably as with zlib.
+class Lz4Codec : public CacheCodec {
+ public:
+  Lz4Codec();
+  virtual ~Lz4Codec();
+
+  virtual const char* name() const { return kLz4; }
+  virtual char tag() const { return 'L'; }
+  virtual bool Encode(StringPiece in, GoogleString* out) const;
+  virtual bool Decode(StringPiece in, GoogleString* out) const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Lz4Codec);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
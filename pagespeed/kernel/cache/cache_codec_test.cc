@@ -0,0 +1,173 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/cache_codec.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/util/simple_random.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class CacheCodecTest : public testing::Test {
+ protected:
+  CacheCodecTest() : random_(new NullMutex) {}
+
+  // Returns a page of HTML like the ones a site serves many variations of.
+  static GoogleString Page(int id) {
+    GoogleString html = StrCat(
+        "<!DOCTYPE html><html><head><title>Product ", IntegerToString(id),
+        "</title><link rel=\"stylesheet\" href=\"/static/site.css\">"
+        "<script src=\"/static/jquery.min.js\"></script></head>"
+        "<body><div id=\"header\"><ul class=\"nav\"><li><a href=\"/\">Home"
+        "</a></li><li><a href=\"/about\">About us</a></li></ul></div>");
+    StrAppend(&html, "<div class=\"product\" data-id=\"", IntegerToString(id),
+              "\"><h1>Product number ", IntegerToString(id * 7919),
+              "</h1></div><div id=\"footer\">Copyright Example Corp.</div>"
+              "</body></html>");
+    return html;
+  }
+
+  // Encodes value, checks that it decodes back, and returns the encoding.
+  GoogleString RoundTrip(const CacheCodec& codec, StringPiece value) {
+    GoogleString encoded("prefix");
+    EXPECT_TRUE(codec.Encode(value, &encoded));
+    StringPiece encoding = StringPiece(encoded).substr(STATIC_STRLEN("prefix"));
+    EXPECT_EQ(codec.tag(), encoding[0]);
+    GoogleString decoded("prefix");
+    EXPECT_TRUE(codec.Decode(encoding, &decoded));
+    EXPECT_EQ(StrCat("prefix", value), decoded);
+    return encoding.as_string();
+  }
+
+  void TestRoundTrips(const CacheCodec& codec) {
+    RoundTrip(codec, "");
+    RoundTrip(codec, "a");
+    EXPECT_GT(1000, RoundTrip(codec, GoogleString(100000, 'a')).size());
+    RoundTrip(codec, random_.GenerateHighEntropyString(100000));
+    RoundTrip(codec, Page(1));
+  }
+
+  // Checks that truncating or extending an encoding is detected.
+  void TestCorruption(const CacheCodec& codec) {
+    GoogleString encoded = RoundTrip(codec, Page(1));
+    GoogleString out;
+    EXPECT_FALSE(codec.Decode("", &out));
+    EXPECT_FALSE(codec.Decode(StringPiece(encoded).substr(0, 1), &out));
+    EXPECT_FALSE(codec.Decode(
+        StringPiece(encoded).substr(0, encoded.size() - 1), &out));
+    EXPECT_FALSE(codec.Decode(StrCat(encoded, "x"), &out));
+    GoogleString flipped = encoded;
+    flipped[flipped.size() / 2] ^= 0x10;
+    EXPECT_FALSE(codec.Decode(flipped, &out));
+    EXPECT_TRUE(out.empty());
+  }
+
+  SimpleRandom random_;
+};
+
+TEST_F(CacheCodecTest, Create) {
+  scoped_ptr<CacheCodec> codec(CacheCodec::Create("deflate", ""));
+  ASSERT_TRUE(codec.get() != NULL);
+  EXPECT_STREQ("deflate", codec->name());
+  EXPECT_EQ('x', codec->tag());
+  codec.reset(CacheCodec::Create("Deflate-Fast", "dictionary"));
+  ASSERT_TRUE(codec.get() != NULL);
+  EXPECT_STREQ("deflate-fast", codec->name());
+  EXPECT_EQ('D', codec->tag());
+  codec.reset(CacheCodec::Create("lz4", ""));
+  ASSERT_TRUE(codec.get() != NULL);
+  EXPECT_STREQ("lz4", codec->name());
+  EXPECT_EQ('L', codec->tag());
+  EXPECT_TRUE(CacheCodec::Create("zstd", "") == NULL);
+}
+
+TEST_F(CacheCodecTest, Deflate) {
+  DeflateCodec codec(DeflateCodec::kDefaultLevel, "");
+  TestRoundTrips(codec);
+  TestCorruption(codec);
+}
+
+TEST_F(CacheCodecTest, DeflateFast) {
+  DeflateCodec codec(DeflateCodec::kFastestLevel, "");
+  TestRoundTrips(codec);
+  TestCorruption(codec);
+}
+
+TEST_F(CacheCodecTest, Lz4) {
+  Lz4Codec codec;
+  TestRoundTrips(codec);
+  TestCorruption(codec);
+
+  // A size field claiming more than LZ4 can expand to is rejected without
+  // trying to allocate it.
+  GoogleString encoded = RoundTrip(codec, "hello");
+  encoded[4] = 0x7f;
+  GoogleString out;
+  EXPECT_FALSE(codec.Decode(encoded, &out));
+}
+
+TEST_F(CacheCodecTest, DeflateDictionary) {
+  StringVector samples;
+  for (int i = 0; i < 50; ++i) {
+    samples.push_back(Page(i));
+  }
+  GoogleString dictionary = CacheCodec::TrainDictionary(samples, 1024);
+  EXPECT_LT(0, dictionary.size());
+  EXPECT_GE(1024, dictionary.size());
+
+  DeflateCodec plain(DeflateCodec::kDefaultLevel, "");
+  DeflateCodec with_dictionary(DeflateCodec::kDefaultLevel, dictionary);
+  TestRoundTrips(with_dictionary);
+  TestCorruption(with_dictionary);
+
+  // A page that wasn't in the samples compresses much better with the
+  // dictionary.
+  GoogleString page = Page(1000);
+  size_t plain_size = RoundTrip(plain, page).size();
+  size_t dictionary_size = RoundTrip(with_dictionary, page).size();
+  EXPECT_GT(plain_size / 2, dictionary_size)
+      << plain_size << " vs " << dictionary_size;
+
+  // Only the same dictionary can decode it.
+  GoogleString encoded = RoundTrip(with_dictionary, page);
+  DeflateCodec other(DeflateCodec::kDefaultLevel, "some other dictionary");
+  GoogleString out;
+  EXPECT_FALSE(other.Decode(encoded, &out));
+  EXPECT_TRUE(out.empty());
+}
+
+TEST_F(CacheCodecTest, TrainDictionaryEdgeCases) {
+  StringVector samples;
+  EXPECT_EQ("", CacheCodec::TrainDictionary(samples, 1024));
+  // Nothing is shared by a single sample.
+  samples.push_back(Page(1));
+  EXPECT_EQ("", CacheCodec::TrainDictionary(samples, 1024));
+  samples.push_back(Page(2));
+  EXPECT_EQ(10, CacheCodec::TrainDictionary(samples, 10).size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
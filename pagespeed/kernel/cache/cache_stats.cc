@@ -109,18 +109,27 @@ class CacheStats::StatsCallback : public DelegatingCacheCallback {
                 CacheInterface::Callback* callback)
       : DelegatingCacheCallback(callback),
         stats_(stats),
-        timer_(timer) {
+        timer_(timer),
+        value_size_(0) {
     start_time_us_ = timer->NowUs();
   }
 
   virtual ~StatsCallback() {
   }
 
+  // Borrowed values are gone by the time Done() is called, so note the size
+  // here.
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    value_size_ = ValueView().size();
+    return DelegatingCacheCallback::ValidateCandidate(key, state);
+  }
+
   virtual void Done(CacheInterface::KeyState state) {
     if (state == CacheInterface::kAvailable) {
       int64 end_time_us = timer_->NowUs();
       stats_->hits_->Add(1);
-      stats_->lookup_size_bytes_histogram_->Add(value()->size());
+      stats_->lookup_size_bytes_histogram_->Add(value_size_);
       stats_->hit_latency_us_histogram_->Add(end_time_us - start_time_us_);
     } else {
       stats_->misses_->Add(1);
@@ -132,6 +141,7 @@ class CacheStats::StatsCallback : public DelegatingCacheCallback {
   CacheStats* stats_;
   Timer* timer_;
   int64 start_time_us_;
+  int value_size_;
 
   DISALLOW_COPY_AND_ASSIGN(StatsCallback);
 };
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/coalescing_cache.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace {
+
+const char kCoalescedGets[] = "coalescing_cache_coalesced_gets";
+
+}  // namespace
+
+namespace net_instaweb {
+
+// The callbacks waiting for the result of one lookup.
+class CoalescingCache::Flight {
+ public:
+  struct Waiter {
+    explicit Waiter(Callback* callback_in)
+        : callback(callback_in), validated(false), accepted(false) {
+    }
+
+    Callback* callback;
+    bool validated;  // ValidateCandidate has been called.
+    bool accepted;   // It accepted an available value.
+  };
+
+  explicit Flight(const GoogleString& key) : key_(key), landed_(false) {}
+
+  const GoogleString& key() const { return key_; }
+  std::vector<Waiter>* waiters() { return &waiters_; }
+
+  // Once landed, the flight is no longer in the map and takes no more
+  // waiters, so it can be looked at without the mutex.
+  bool landed() const { return landed_; }
+  void set_landed() { landed_ = true; }
+
+ private:
+  GoogleString key_;
+  std::vector<Waiter> waiters_;
+  bool landed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Flight);
+};
+
+// Receives the result of a flight's lookup and hands it to the waiters.
+// It does not accept borrowed values: sharing value()'s storage with each
+// waiter beats copying a borrowed value for each of them.
+class CoalescingCache::FlightCallback : public CacheInterface::Callback {
+ public:
+  FlightCallback(CoalescingCache* cache, Flight* flight)
+      : cache_(cache), flight_(flight) {
+  }
+
+  virtual ~FlightCallback() {}
+
+  // An underlying two-level cache may offer several candidates.  Each
+  // waiter keeps the first it accepts, and we keep looking as long as any
+  // waiter is unsatisfied.
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    cache_->Land(flight_);
+    bool all_accepted = true;
+    std::vector<Flight::Waiter>* waiters = flight_->waiters();
+    for (int i = 0, n = waiters->size(); i < n; ++i) {
+      Flight::Waiter* waiter = &(*waiters)[i];
+      if (!waiter->accepted) {
+        *waiter->callback->value() = *value();
+        waiter->validated = true;
+        waiter->accepted =
+            waiter->callback->DelegatedValidateCandidate(key, state) &&
+            (state == CacheInterface::kAvailable);
+        all_accepted &= waiter->accepted;
+      }
+    }
+    return all_accepted;
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    cache_->Land(flight_);
+    std::vector<Flight::Waiter>* waiters = flight_->waiters();
+    for (int i = 0, n = waiters->size(); i < n; ++i) {
+      Flight::Waiter* waiter = &(*waiters)[i];
+      CacheInterface::KeyState waiter_state = state;
+      if (waiter->accepted) {
+        waiter_state = CacheInterface::kAvailable;
+      } else if (state == CacheInterface::kAvailable) {
+        waiter_state = CacheInterface::kNotFound;  // The waiter rejected it.
+      }
+      if (!waiter->validated) {
+        // Only possible if the cache skipped ValidateCandidate, e.g. on
+        // failure.
+        DCHECK_NE(CacheInterface::kAvailable, state);
+        waiter->callback->DelegatedValidateCandidate(flight_->key(),
+                                                     waiter_state);
+      }
+      waiter->callback->DelegatedDone(waiter_state);
+    }
+    delete flight_;
+    delete this;
+  }
+
+ private:
+  CoalescingCache* cache_;
+  Flight* flight_;
+
+  DISALLOW_COPY_AND_ASSIGN(FlightCallback);
+};
+
+CoalescingCache::CoalescingCache(CacheInterface* cache, AbstractMutex* mutex,
+                                 Statistics* statistics)
+    : cache_(cache),
+      mutex_(mutex),
+      coalesced_gets_(statistics->GetVariable(kCoalescedGets)) {
+}
+
+CoalescingCache::~CoalescingCache() {
+  DCHECK(flights_.empty());
+}
+
+void CoalescingCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kCoalescedGets);
+}
+
+GoogleString CoalescingCache::FormatName(StringPiece cache) {
+  return StrCat("Coalescing(", cache, ")");
+}
+
+bool CoalescingCache::JoinFlight(const GoogleString& key, Callback* callback,
+                                 FlightCallback** flight_callback) {
+  ScopedMutex lock(mutex_.get());
+  std::pair<FlightMap::iterator, bool> result =
+      flights_.insert(FlightMap::value_type(key, NULL));
+  Flight* flight = result.first->second;
+  if (!result.second) {
+    flight->waiters()->push_back(Flight::Waiter(callback));
+    return true;
+  }
+  flight = new Flight(key);
+  flight->waiters()->push_back(Flight::Waiter(callback));
+  result.first->second = flight;
+  *flight_callback = new FlightCallback(this, flight);
+  return false;
+}
+
+void CoalescingCache::Land(Flight* flight) {
+  ScopedMutex lock(mutex_.get());
+  if (!flight->landed()) {
+    flight->set_landed();
+    FlightMap::iterator p = flights_.find(flight->key());
+    if ((p != flights_.end()) && (p->second == flight)) {
+      flights_.erase(p);
+    }
+  }
+}
+
+void CoalescingCache::Detach(const GoogleString& key) {
+  ScopedMutex lock(mutex_.get());
+  FlightMap::iterator p = flights_.find(key);
+  if (p != flights_.end()) {
+    // The flight still completes, but it is up to it to land.
+    flights_.erase(p);
+  }
+}
+
+void CoalescingCache::Get(const GoogleString& key, Callback* callback) {
+  if (cache_->IsBlocking()) {
+    cache_->Get(key, callback);
+    return;
+  }
+  FlightCallback* flight_callback = NULL;
+  if (JoinFlight(key, callback, &flight_callback)) {
+    coalesced_gets_->Add(1);
+  } else {
+    cache_->Get(key, flight_callback);
+  }
+}
+
+void CoalescingCache::MultiGet(MultiGetRequest* request) {
+  if (cache_->IsBlocking()) {
+    cache_->MultiGet(request);
+    return;
+  }
+  // Keep the keys that start flights together, so that the underlying cache
+  // can still batch them.
+  MultiGetRequest* new_request = new MultiGetRequest;
+  int num_coalesced = 0;
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    FlightCallback* flight_callback = NULL;
+    if (JoinFlight(key_callback->key, key_callback->callback,
+                   &flight_callback)) {
+      ++num_coalesced;
+    } else {
+      new_request->push_back(KeyCallback(key_callback->key, flight_callback));
+    }
+  }
+  delete request;
+  if (num_coalesced != 0) {
+    coalesced_gets_->Add(num_coalesced);
+  }
+  if (new_request->empty()) {
+    delete new_request;
+  } else {
+    cache_->MultiGet(new_request);
+  }
+}
+
+void CoalescingCache::Put(const GoogleString& key, SharedString* value) {
+  Detach(key);
+  cache_->Put(key, value);
+}
+
+void CoalescingCache::Delete(const GoogleString& key) {
+  Detach(key);
+  cache_->Delete(key);
+}
+
+int CoalescingCache::NumInFlight() {
+  ScopedMutex lock(mutex_.get());
+  return flights_.size();
+}
+
+}  // namespace net_instaweb
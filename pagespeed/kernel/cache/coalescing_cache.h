@@ -0,0 +1,99 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_COALESCING_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_COALESCING_CACHE_H_
+
+#include <map>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class SharedString;
+class Statistics;
+class Variable;
+
+// Merges concurrent lookups of the same key into one.  While a Get for a
+// key is outstanding in the underlying cache, further Gets for that key
+// just wait for its result, which is then delivered to every waiting
+// callback.  Each callback still gets to validate the value for itself.
+//
+// This is meant to sit in front of a slow asynchronous cache, such as
+// AsyncCache, CacheBatcher or FallbackCache wrapping memcached, where a
+// burst of lookups for a popular key would otherwise each pay the round
+// trip.  With a blocking cache, Gets are passed straight through, since
+// a Get that joined another thread's lookup could not block until it
+// completed.
+//
+// A Put or Delete of a key detaches any lookup in flight for it, so that
+// later Gets see the write, though callbacks already waiting may not.
+class CoalescingCache : public CacheInterface {
+ public:
+  // Does not take ownership of the cache. Takes ownership of the mutex.
+  CoalescingCache(CacheInterface* cache, AbstractMutex* mutex,
+                  Statistics* statistics);
+  virtual ~CoalescingCache();
+
+  static void InitStats(Statistics* statistics);
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void MultiGet(MultiGetRequest* request);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  static GoogleString FormatName(StringPiece cache);
+  virtual GoogleString Name() const { return FormatName(cache_->Name()); }
+  virtual bool IsBlocking() const { return cache_->IsBlocking(); }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+
+  // Number of keys with a lookup in flight.  For tests.
+  int NumInFlight();
+
+ private:
+  class Flight;
+  class FlightCallback;
+  typedef std::map<GoogleString, Flight*> FlightMap;
+
+  // Joins callback to the flight for key if there is one, returning true.
+  // Otherwise starts a new flight and returns a callback with which to
+  // look the key up.
+  bool JoinFlight(const GoogleString& key, Callback* callback,
+                  FlightCallback** flight_callback);
+
+  // Stops new Gets from joining 'flight', which is about to complete.
+  void Land(Flight* flight);
+
+  // Called with a Put or Delete for the key.
+  void Detach(const GoogleString& key);
+
+  CacheInterface* cache_;
+  scoped_ptr<AbstractMutex> mutex_;
+  FlightMap flights_ GUARDED_BY(mutex_);
+  Variable* coalesced_gets_;
+
+  DISALLOW_COPY_AND_ASSIGN(CoalescingCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_COALESCING_CACHE_H_
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test CoalescingCache over an LRUCache whose lookups a test can hold.
+
+#include "pagespeed/kernel/cache/coalescing_cache.h"
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const size_t kMaxSize = 100;
+
+// Can defer a lookup until Release is called.  Unlike DelayCache, which
+// only defers Done, this holds back ValidateCandidate too, as an
+// asynchronous cache would.
+class HeldCache : public CacheInterface {
+ public:
+  explicit HeldCache(CacheInterface* cache) : cache_(cache), hold_(false) {}
+
+  virtual void Get(const GoogleString& key, Callback* callback) {
+    if (hold_) {
+      hold_ = false;
+      held_.push_back(KeyCallback(key, callback));
+    } else {
+      cache_->Get(key, callback);
+    }
+  }
+  virtual void Put(const GoogleString& key, SharedString* value) {
+    cache_->Put(key, value);
+  }
+  virtual void Delete(const GoogleString& key) { cache_->Delete(key); }
+  virtual GoogleString Name() const { return cache_->Name(); }
+  virtual bool IsBlocking() const { return false; }
+  virtual bool IsHealthy() const { return true; }
+  virtual void ShutDown() {}
+
+  // Holds the next lookup.
+  void Hold() { hold_ = true; }
+
+  // Runs the held lookup.
+  void Release() {
+    std::vector<KeyCallback> held;
+    held.swap(held_);
+    for (int i = 0, n = held.size(); i < n; ++i) {
+      cache_->Get(held[i].key, held[i].callback);
+    }
+  }
+
+ private:
+  CacheInterface* cache_;
+  bool hold_;
+  std::vector<KeyCallback> held_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeldCache);
+};
+
+class CoalescingCacheTest : public CacheTestBase {
+ protected:
+  CoalescingCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        statistics_(thread_system_.get()),
+        lru_cache_(kMaxSize),
+        held_cache_(&lru_cache_) {
+    CoalescingCache::InitStats(&statistics_);
+    coalescing_cache_.reset(new CoalescingCache(
+        &held_cache_, thread_system_->NewMutex(), &statistics_));
+  }
+
+  virtual CacheInterface* Cache() { return coalescing_cache_.get(); }
+
+  int64 CoalescedGets() {
+    return statistics_.GetVariable("coalescing_cache_coalesced_gets")->Get();
+  }
+
+  int BackendGets() {
+    return lru_cache_.num_hits() + lru_cache_.num_misses();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats statistics_;
+  LRUCache lru_cache_;
+  HeldCache held_cache_;
+  scoped_ptr<CoalescingCache> coalescing_cache_;
+};
+
+TEST_F(CoalescingCacheTest, PutGetDelete) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(0, CoalescedGets());
+  EXPECT_EQ(0, coalescing_cache_->NumInFlight());
+}
+
+TEST_F(CoalescingCacheTest, Name) {
+  EXPECT_EQ("Coalescing(LRUCache)", coalescing_cache_->Name());
+}
+
+TEST_F(CoalescingCacheTest, ConcurrentGetsShareOneLookup) {
+  CheckPut("Name", "Value");
+  held_cache_.Hold();
+  Callback* first = InitiateGet("Name");
+  Callback* second = InitiateGet("Name");
+  Callback* third = InitiateGet("Name");
+  EXPECT_EQ(1, coalescing_cache_->NumInFlight());
+  EXPECT_EQ(2, CoalescedGets());
+  EXPECT_FALSE(first->called());
+  EXPECT_FALSE(third->called());
+
+  held_cache_.Release();
+  WaitAndCheck(first, "Value");
+  WaitAndCheck(second, "Value");
+  WaitAndCheck(third, "Value");
+  EXPECT_EQ(1, BackendGets());
+  EXPECT_EQ(0, coalescing_cache_->NumInFlight());
+
+  // Once the lookup has completed, the next one goes to the backend.
+  CheckGet("Name", "Value");
+  EXPECT_EQ(2, BackendGets());
+}
+
+TEST_F(CoalescingCacheTest, MissesAreShared) {
+  held_cache_.Hold();
+  Callback* first = InitiateGet("Name");
+  Callback* second = InitiateGet("Name");
+  held_cache_.Release();
+  WaitAndCheckNotFound(first);
+  WaitAndCheckNotFound(second);
+  EXPECT_EQ(1, BackendGets());
+}
+
+TEST_F(CoalescingCacheTest, EachCallbackValidates) {
+  CheckPut("Name", "Value");
+  held_cache_.Hold();
+  Callback* picky = InitiateGet("Name");
+  picky->set_invalid_value("Value");
+  Callback* easy = InitiateGet("Name");
+  held_cache_.Release();
+  WaitAndCheckNotFound(picky);
+  WaitAndCheck(easy, "Value");
+}
+
+TEST_F(CoalescingCacheTest, MultiGet) {
+  PopulateCache(3);
+  held_cache_.Hold();
+  Callback* n1 = InitiateGet("n1");
+
+  // n1 joins the outstanding lookup; n0 and n2 go to the backend together.
+  Callback* n0 = AddCallback();
+  Callback* again = AddCallback();
+  Callback* n2 = AddCallback();
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  request->push_back(CacheInterface::KeyCallback("n0", n0));
+  request->push_back(CacheInterface::KeyCallback("n1", again));
+  request->push_back(CacheInterface::KeyCallback("n2", n2));
+  coalescing_cache_->MultiGet(request);
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n2, "v2");
+  EXPECT_FALSE(again->called());
+  EXPECT_EQ(1, CoalescedGets());
+
+  held_cache_.Release();
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(again, "v1");
+  EXPECT_EQ(3, BackendGets());
+}
+
+TEST_F(CoalescingCacheTest, PutDetachesFlight) {
+  CheckPut("Name", "Old");
+  held_cache_.Hold();
+  Callback* before = InitiateGet("Name");
+  CheckPut("Name", "New");
+  EXPECT_EQ(0, coalescing_cache_->NumInFlight());
+
+  // A Get after the Put doesn't join the lookup that started before it.
+  CheckGet("Name", "New");
+  held_cache_.Release();
+  WaitAndCheck(before, "New");  // Looked up on release.
+  EXPECT_EQ(0, CoalescedGets());
+}
+
+TEST_F(CoalescingCacheTest, BlockingCachePassesThrough) {
+  CoalescingCache cache(&lru_cache_, thread_system_->NewMutex(),
+                        &statistics_);
+  EXPECT_TRUE(cache.IsBlocking());
+  CheckPut(&cache, "Name", "Value");
+  CheckGet(&cache, "Name", "Value");
+  EXPECT_EQ(0, cache.NumInFlight());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -22,9 +22,8 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string_util.h"
-#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
-#include "pagespeed/kernel/util/gzip_inflater.h"
 
 namespace net_instaweb {
 
@@ -49,11 +48,15 @@ const char kCompressedCacheCompressedSize[] =
 const char kCompressedCacheCorruptPayloads[] =
     "compressed_cache_corrupt_payloads";
 
-class CompressedCallback : public CacheInterface::Callback {
+}  // namespace
+
+class CompressedCache::CompressedCallback : public CacheInterface::Callback {
  public:
   CompressedCallback(CacheInterface::Callback* callback,
+                     const CompressedCache* cache,
                      Variable* corrupt_payloads)
       : callback_(callback),
+        cache_(cache),
         corrupt_payloads_(corrupt_payloads),
         validate_candidate_called_(false) {
   }
@@ -66,13 +69,7 @@ class CompressedCallback : public CacheInterface::Callback {
     bool ret = false;
     if (state == CacheInterface::kAvailable) {
       GoogleString uncompressed;
-      StringWriter writer(&uncompressed);
-      StringPiece compressed = value()->Value();
-      if (compressed.ends_with(
-              StringPiece(kTrailer, STATIC_STRLEN(kTrailer))) &&
-          GzipInflater::Inflate(
-              compressed.substr(0, compressed.size() - STATIC_STRLEN(kTrailer)),
-              GzipInflater::kDeflate, &writer)) {
+      if (cache_->Decode(value()->Value(), &uncompressed)) {
         callback_->value()->SwapWithString(&uncompressed);
         ret = true;
       } else {
@@ -91,14 +88,27 @@ class CompressedCallback : public CacheInterface::Callback {
   }
 
   Callback* callback_;
+  const CompressedCache* cache_;
   Variable* corrupt_payloads_;
   bool validate_candidate_called_;
 };
 
-}  // namespace
-
 CompressedCache::CompressedCache(CacheInterface* cache, Statistics* stats)
-    : cache_(cache) {
+    : cache_(cache),
+      codec_(new DeflateCodec(DeflateCodec::kDefaultLevel, "")),
+      deflate_codec_(DeflateCodec::kDefaultLevel, "") {
+  InitVariables(stats);
+}
+
+CompressedCache::CompressedCache(CacheInterface* cache, CacheCodec* codec,
+                                 Statistics* stats)
+    : cache_(cache),
+      codec_(codec),
+      deflate_codec_(DeflateCodec::kDefaultLevel, "") {
+  InitVariables(stats);
+}
+
+void CompressedCache::InitVariables(Statistics* stats) {
 #if INCLUDE_HISTOGRAMS
   compressed_cache_savings_ = stats->GetHistogram(kCompressedCacheSavings);
 #endif
@@ -124,7 +134,8 @@ void CompressedCache::InitStats(Statistics* statistics) {
 }
 
 void CompressedCache::Get(const GoogleString& key, Callback* callback) {
-  CompressedCallback* cb = new CompressedCallback(callback, corrupt_payloads_);
+  CompressedCallback* cb = new CompressedCallback(callback, this,
+                                                  corrupt_payloads_);
   cache_->Get(key, cb);
 }
 
@@ -132,9 +143,8 @@ void CompressedCache::Put(const GoogleString& key, SharedString* value) {
   int64 old_size = value->size();
   GoogleString buf;
   buf.reserve(old_size + STATIC_STRLEN(kTrailer));
-  StringWriter writer(&buf);
   original_size_->Add(old_size);
-  if (GzipInflater::Deflate(value->Value(), GzipInflater::kDeflate, &writer)) {
+  if (codec_->Encode(value->Value(), &buf)) {
     buf.append(kTrailer, STATIC_STRLEN(kTrailer));
 #if INCLUDE_HISTOGRAMS
     compressed_cache_savings_->Add(
@@ -145,6 +155,28 @@ void CompressedCache::Put(const GoogleString& key, SharedString* value) {
   }
 }
 
+bool CompressedCache::Decode(StringPiece payload, GoogleString* value) const {
+  if (!payload.ends_with(StringPiece(kTrailer, STATIC_STRLEN(kTrailer)))) {
+    return false;
+  }
+  payload.remove_suffix(STATIC_STRLEN(kTrailer));
+  if (payload.empty()) {
+    return false;
+  }
+  char tag = payload[0];
+  const CacheCodec* codec = NULL;
+  if (tag == codec_->tag()) {
+    codec = codec_.get();
+  } else if (tag == deflate_codec_.tag()) {
+    codec = &deflate_codec_;
+  } else if (tag == lz4_codec_.tag()) {
+    codec = &lz4_codec_;
+  } else {
+    return false;
+  }
+  return codec->Decode(payload, value);
+}
+
 void CompressedCache::Delete(const GoogleString& key) {
   cache_->Delete(key);
 }
@@ -20,8 +20,10 @@
 #define PAGESPEED_KERNEL_CACHE_COMPRESSED_CACHE_H_
 
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 
 namespace net_instaweb {
@@ -31,11 +33,15 @@ class SharedString;
 class Statistics;
 class Variable;
 
-// Compressed cache adapter.
+// Compressed cache adapter.  Values are written with one CacheCodec, and
+// read with whichever codec wrote them, so changing codecs doesn't lose the
+// entries already in the cache.
 class CompressedCache : public CacheInterface {
  public:
-  // Does not takes ownership of cache or stats.
+  // Does not takes ownership of cache or stats.  Compresses with deflate.
   CompressedCache(CacheInterface* cache, Statistics* stats);
+  // As above, but compresses with codec, which this takes ownership of.
+  CompressedCache(CacheInterface* cache, CacheCodec* codec, Statistics* stats);
   virtual ~CompressedCache();
 
   static void InitStats(Statistics* stats);
@@ -63,7 +69,19 @@ class CompressedCache : public CacheInterface {
   int64 CompressedSize() const;
 
  private:
+  class CompressedCallback;
+
+  void InitVariables(Statistics* stats);
+
+  // Decodes the physical payload of an entry into *value, returning false
+  // if it is corrupt.
+  bool Decode(StringPiece payload, GoogleString* value) const;
+
   CacheInterface* cache_;
+  scoped_ptr<CacheCodec> codec_;
+  // Entries written with a codec other than codec_ are read with these.
+  DeflateCodec deflate_codec_;
+  Lz4Codec lz4_codec_;
   Histogram* compressed_cache_savings_;
   Variable* corrupt_payloads_;
   Variable* original_size_;
@@ -16,19 +16,33 @@
 
 // Author: jmarantz@google.com (Joshua Marantz)
 //
-// Tests the overhead of the CompressedCache adapter, using 1k/1M insert sizes,
-// with two different levels of entropy.  For high entropy we use a big block
-// of randomly generated bytes.  For low entropy we use a smaller block of
-// randomly generated bytes, concatenated together to form the total size
-// we want.
+// Tests the overhead of the CompressedCache adapter with each codec, using
+// 1k/1M insert sizes, with two different levels of entropy.  For high entropy
+// we use a big block of randomly generated bytes.  For low entropy we use a
+// smaller block of randomly generated bytes, concatenated together to form
+// the total size we want.  The dictionary benchmark trains a dictionary on
+// other values built from the same block, as for a site whose pages share
+// most of their markup.
 //
+// Benchmark                                 Time(ns)
+// -------------------------------------------------
+// BM_Compress1MHighEntropyDeflate           35112480
+// BM_Compress1MHighEntropyDeflateFast       31822329
+// BM_Compress1MHighEntropyLz4                1205083
+// BM_Compress1KHighEntropyDeflate              35419
+// BM_Compress1KHighEntropyDeflateFast          31747
+// BM_Compress1KHighEntropyLz4                   2036
+// BM_Compress1MLowEntropyDeflate             4455718
+// BM_Compress1MLowEntropyDeflateFast         2443026
+// BM_Compress1MLowEntropyLz4                 1109638
+// BM_Compress1KLowEntropyDeflate               11954
+// BM_Compress1KLowEntropyDeflateFast            8937
+// BM_Compress1KLowEntropyLz4                    1551
+// BM_Compress1KLowEntropyDeflateDictionary      7131
 //
-// Benchmark                  Time(ns)    CPU(ns) Iterations
-// ---------------------------------------------------------
-// BM_Compress1MHighEntropy   38755898   38600000        100
-// BM_Compress1KHighEntropy      62425      63000      10000
-// BM_Compress1MLowEntropy     7175143    7100000        100
-// BM_Compress1KLowEntropy       16620      16514      41176
+// Each benchmark also reports its compression ratio; see ReportRatio.
+
+#include <cstdio>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/benchmark.h"
@@ -37,7 +51,9 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/util/platform.h"
@@ -56,47 +72,148 @@ class EmptyCallback : public net_instaweb::CacheInterface::Callback {
   DISALLOW_COPY_AND_ASSIGN(EmptyCallback);
 };
 
-void TestCachePayload(int payload_size, int chunk_size, int iters) {
+GoogleString MakePayload(const GoogleString& chunk, int payload_size) {
   GoogleString value;
-  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
-  GoogleString chunk = random.GenerateHighEntropyString(chunk_size);
   while (static_cast<int>(value.size()) < payload_size) {
     value += chunk;
   }
+  return value;
+}
+
+// Prints the compression ratio, uncompressed size over compressed size, for
+// a benchmark's first run, on a line of its own:
+//
+// Codec                       Payload/Chunk    Ratio
+// --------------------------------------------------
+// deflate                     1000000/1000    165.56
+// deflate-fast                1000000/1000    127.89
+// lz4                         1000000/1000    202.27
+// deflate                        1000/50       13.33
+// deflate with dictionary        1000/50       33.33
+void ReportRatio(const char* codec_name, bool use_dictionary,
+                 int payload_size, int chunk_size,
+                 const net_instaweb::CompressedCache& compressed_cache) {
+  GoogleString codec = codec_name;
+  if (use_dictionary) {
+    codec += " with dictionary";
+  }
+  printf("%-24s %10d/%-6d %7.2f\n", codec.c_str(), payload_size, chunk_size,
+         static_cast<double>(compressed_cache.OriginalSize()) /
+             compressed_cache.CompressedSize());
+}
+
+void TestCachePayload(const char* codec_name, bool use_dictionary,
+                      int payload_size, int chunk_size, int iters) {
+  StopBenchmarkTiming();
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  GoogleString chunk = random.GenerateHighEntropyString(chunk_size);
+  GoogleString value = MakePayload(chunk, payload_size);
+  GoogleString dictionary;
+  if (use_dictionary) {
+    // Samples that share the chunk, but at other alignments.
+    net_instaweb::StringVector samples;
+    for (int i = 1; i <= 10; ++i) {
+      samples.push_back(MakePayload(chunk.substr(i) + chunk.substr(0, i),
+                                    payload_size));
+    }
+    dictionary = net_instaweb::CacheCodec::TrainDictionary(samples, 4096);
+  }
   net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
       net_instaweb::Platform::CreateThreadSystem());
   net_instaweb::SimpleStats stats(thread_system.get());
   net_instaweb::CompressedCache::InitStats(&stats);
-  net_instaweb::LRUCache* lru_cache =
-      new net_instaweb::LRUCache(value.size() * 2);
-  net_instaweb::CompressedCache compressed_cache(lru_cache, &stats);
+  net_instaweb::scoped_ptr<net_instaweb::LRUCache> lru_cache(
+      new net_instaweb::LRUCache(value.size() * 2));
+  net_instaweb::CompressedCache compressed_cache(
+      lru_cache.get(), net_instaweb::CacheCodec::Create(codec_name, dictionary),
+      &stats);
   EmptyCallback empty_callback;
   net_instaweb::SharedString str(value);
+  StartBenchmarkTiming();
   for (int i = 0; i < iters; ++i) {
     compressed_cache.Put("key", &str);
     compressed_cache.Get("key", &empty_callback);
   }
+  StopBenchmarkTiming();
+  if (iters == 1) {
+    ReportRatio(codec_name, use_dictionary, payload_size, chunk_size,
+                compressed_cache);
+  }
+}
+
+static void BM_Compress1MHighEntropyDeflate(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflate, false, 1000*1000,
+                   1000*1000, iters);
+}
+
+static void BM_Compress1MHighEntropyDeflateFast(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflateFast, false, 1000*1000,
+                   1000*1000, iters);
+}
+
+static void BM_Compress1MHighEntropyLz4(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kLz4, false, 1000*1000,
+                   1000*1000, iters);
+}
+
+static void BM_Compress1KHighEntropyDeflate(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflate, false, 1000,
+                   1000, iters);
+}
+
+static void BM_Compress1KHighEntropyDeflateFast(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflateFast, false, 1000,
+                   1000, iters);
+}
+
+static void BM_Compress1KHighEntropyLz4(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kLz4, false, 1000, 1000, iters);
+}
+
+static void BM_Compress1MLowEntropyDeflate(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflate, false, 1000*1000,
+                   1000, iters);
+}
+
+static void BM_Compress1MLowEntropyDeflateFast(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflateFast, false, 1000*1000,
+                   1000, iters);
+}
+
+static void BM_Compress1MLowEntropyLz4(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kLz4, false, 1000*1000,
+                   1000, iters);
 }
 
-static void BM_Compress1MHighEntropy(int iters) {
-  TestCachePayload(1000*1000, 1000*1000, iters);
+static void BM_Compress1KLowEntropyDeflate(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflate, false, 1000, 50, iters);
 }
 
-static void BM_Compress1KHighEntropy(int iters) {
-  TestCachePayload(1000, 1000, iters);
+static void BM_Compress1KLowEntropyDeflateFast(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflateFast, false, 1000,
+                   50, iters);
 }
 
-static void BM_Compress1MLowEntropy(int iters) {
-  TestCachePayload(1000*1000, 1000, iters);
+static void BM_Compress1KLowEntropyLz4(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kLz4, false, 1000, 50, iters);
 }
 
-static void BM_Compress1KLowEntropy(int iters) {
-  TestCachePayload(1000, 50, iters);
+static void BM_Compress1KLowEntropyDeflateDictionary(int iters) {
+  TestCachePayload(net_instaweb::CacheCodec::kDeflate, true, 1000, 50, iters);
 }
 
 }  // namespace
 
-BENCHMARK(BM_Compress1MHighEntropy);
-BENCHMARK(BM_Compress1KHighEntropy);
-BENCHMARK(BM_Compress1MLowEntropy);
-BENCHMARK(BM_Compress1KLowEntropy);
+BENCHMARK(BM_Compress1MHighEntropyDeflate);
+BENCHMARK(BM_Compress1MHighEntropyDeflateFast);
+BENCHMARK(BM_Compress1MHighEntropyLz4);
+BENCHMARK(BM_Compress1KHighEntropyDeflate);
+BENCHMARK(BM_Compress1KHighEntropyDeflateFast);
+BENCHMARK(BM_Compress1KHighEntropyLz4);
+BENCHMARK(BM_Compress1MLowEntropyDeflate);
+BENCHMARK(BM_Compress1MLowEntropyDeflateFast);
+BENCHMARK(BM_Compress1MLowEntropyLz4);
+BENCHMARK(BM_Compress1KLowEntropyDeflate);
+BENCHMARK(BM_Compress1KLowEntropyDeflateFast);
+BENCHMARK(BM_Compress1KLowEntropyLz4);
+BENCHMARK(BM_Compress1KLowEntropyDeflateDictionary);
@@ -26,10 +26,13 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/stack_buffer.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_test_base.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_random.h"
 #include "pagespeed/kernel/util/simple_stats.h"
@@ -62,6 +65,13 @@ class CompressedCacheTest : public CacheTestBase {
     return ret;
   }
 
+  // Replaces compressed_cache_ with one that writes with the named codec,
+  // over the same LRU cache.
+  void UseCodec(StringPiece name, StringPiece dictionary) {
+    compressed_cache_.reset(new CompressedCache(
+        lru_cache_.get(), CacheCodec::Create(name, dictionary), &stats_));
+  }
+
   virtual CacheInterface* Cache() { return compressed_cache_.get(); }
 
   GoogleMessageHandler handler_;
@@ -181,4 +191,62 @@ TEST_F(CompressedCacheTest, RemoveOneByteFromMiddle) {
   EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
 }
 
+// Entries written before codecs had tags are still readable.
+TEST_F(CompressedCacheTest, UntaggedDeflateEntry) {
+  GoogleString raw_value;
+  StringWriter writer(&raw_value);
+  ASSERT_TRUE(GzipInflater::Deflate("Value", GzipInflater::kDeflate, &writer));
+  StrAppend(&raw_value, "[[]]");
+  lru_cache_->PutSwappingString("Name", &raw_value);
+  CheckGet("Name", "Value");
+  UseCodec(CacheCodec::kLz4, "");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, Lz4) {
+  UseCodec(CacheCodec::kLz4, "");
+  GoogleString value(3 * kStackBufferSize, 'a');
+  CheckPut("Name", value);
+  EXPECT_EQ('L', GetRawValue("Name")[0]);
+  CheckGet("Name", value);
+  EXPECT_GT(200, compressed_cache_->CompressedSize());
+  CheckPut("Name", "");
+  CheckGet("Name", "");
+
+  value = random_.GenerateHighEntropyString(5 * kStackBufferSize);
+  CheckPut("key", value);
+  CheckGet("key", value);
+  GoogleString raw_value = GetRawValue("key");
+  raw_value.insert(raw_value.size() / 2, "crap");
+  lru_cache_->PutSwappingString("key", &raw_value);
+  CheckNotFound("key");
+  EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
+}
+
+// Entries stay readable when the codec changes, in either direction.
+TEST_F(CompressedCacheTest, ChangeCodec) {
+  CheckPut("deflate", "deflated value");
+  UseCodec(CacheCodec::kLz4, "");
+  CheckPut("lz4", "lz4 value");
+  CheckGet("deflate", "deflated value");
+  UseCodec(CacheCodec::kDeflateFast, "");
+  CheckGet("lz4", "lz4 value");
+  CheckGet("deflate", "deflated value");
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, Dictionary) {
+  UseCodec(CacheCodec::kDeflate, "<html><head><title>");
+  CheckPut("Name", "<html><head><title>Hello</title></head></html>");
+  EXPECT_EQ('D', GetRawValue("Name")[0]);
+  CheckGet("Name", "<html><head><title>Hello</title></head></html>");
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+
+  // Without the dictionary, the entry can't be read.
+  UseCodec(CacheCodec::kDeflate, "<html><body>");
+  CheckNotFound("Name");
+  EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
+}
+
 }  // namespace net_instaweb
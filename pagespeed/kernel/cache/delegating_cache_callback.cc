@@ -30,6 +30,9 @@ DelegatingCacheCallback::DelegatingCacheCallback(
     CacheInterface::Callback* callback)
     : callback_(callback),
       validate_candidate_called_(false) {
+  // We can pass on borrowed values as long as the callback we wrap can take
+  // them.
+  set_accepts_borrowed_value(callback->accepts_borrowed_value());
 }
 
 DelegatingCacheCallback::~DelegatingCacheCallback() {
@@ -41,6 +44,10 @@ DelegatingCacheCallback::~DelegatingCacheCallback() {
 bool DelegatingCacheCallback::ValidateCandidate(
     const GoogleString& key, CacheInterface::KeyState state) {
   validate_candidate_called_ = true;
+  if (has_borrowed_value()) {
+    return callback_->DelegatedValidateBorrowedCandidate(key, state,
+                                                         ValueView());
+  }
   *callback_->value() = *value();
   return callback_->DelegatedValidateCandidate(key, state);
 }
@@ -38,6 +38,7 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/file_cache_index.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
 #include "pagespeed/kernel/util/url_to_filename_encoder.h"
 
@@ -54,6 +55,20 @@ struct CompareByAtime {
   }
 };
 
+// Reads the next snapshot entry that 'delta' does not mention, returning
+// false at the end of the snapshot.
+bool NextUntouchedEntry(FileCacheIndex::Reader* reader,
+                        const FileCacheIndex::Delta& delta,
+                        FileCacheIndex::Record* record) {
+  while ((reader->Next(record) == FileCacheIndex::Reader::kOk) &&
+         (record->op == FileCacheIndex::kPutOp)) {
+    if (!delta.Contains(record->name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 class FileCache::CacheCleanFunction : public Function {
@@ -76,12 +91,17 @@ const char FileCache::kCleanups[] = "file_cache_cleanups";
 const char FileCache::kDiskChecks[] = "file_cache_disk_checks";
 const char FileCache::kEvictions[] = "file_cache_evictions";
 const char FileCache::kWriteErrors[] = "file_cache_write_errors";
+const char FileCache::kIndexRebuilds[] = "file_cache_index_rebuilds";
 
 // Filenames for the next scheduled clean time and the lockfile.  In
 // order to prevent these from colliding with actual cachefiles, they
 // contain characters that our filename encoder would escape.
 const char FileCache::kCleanTimeName[] = "!clean!time!";
 const char FileCache::kCleanLockName[] = "!clean!lock!";
+const char FileCache::kIndexSnapshotName[] = "!index!snapshot!";
+const char FileCache::kIndexJournalName[] = "!index!journal!";
+const char FileCache::kIndexCompactingName[] = "!index!compacting!";
+const char FileCache::kShmCacheImageName[] = "!shm_cache!image!";
 
 // TODO(abliss): remove policy from constructor; provide defaults here
 // and setters below.
@@ -103,7 +123,8 @@ FileCache::FileCache(const GoogleString& path, FileSystem* file_system,
       cleanups_(stats->GetVariable(kCleanups)),
       evictions_(stats->GetVariable(kEvictions)),
       bytes_freed_in_cleanup_(stats->GetVariable(kBytesFreedInCleanup)),
-      write_errors_(stats->GetVariable(kWriteErrors)) {
+      write_errors_(stats->GetVariable(kWriteErrors)),
+      index_rebuilds_(stats->GetVariable(kIndexRebuilds)) {
   if (policy->cleaning_enabled()) {
     next_clean_ms_ = policy->timer->NowMs() + policy->clean_interval_ms / 2;
   }
@@ -111,6 +132,12 @@ FileCache::FileCache(const GoogleString& path, FileSystem* file_system,
   StrAppend(&clean_time_path_, kCleanTimeName);
   EnsureEndsInSlash(&clean_lock_path_);
   StrAppend(&clean_lock_path_, kCleanLockName);
+  GoogleString prefix = path;
+  EnsureEndsInSlash(&prefix);
+  index_snapshot_path_ = StrCat(prefix, kIndexSnapshotName);
+  index_journal_path_ = StrCat(prefix, kIndexJournalName);
+  index_compacting_path_ = StrCat(prefix, kIndexCompactingName);
+  shm_cache_image_path_ = StrCat(prefix, kShmCacheImageName);
 }
 
 FileCache::~FileCache() {
@@ -122,6 +149,7 @@ void FileCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kDiskChecks);
   statistics->AddVariable(kEvictions);
   statistics->AddVariable(kWriteErrors);
+  statistics->AddVariable(kIndexRebuilds);
 }
 
 void FileCache::Get(const GoogleString& key, Callback* callback) {
@@ -136,16 +164,24 @@ void FileCache::Get(const GoogleString& key, Callback* callback) {
     GoogleString buf;
     ret = file_system_->ReadFile(filename.c_str(), &buf, &null_handler);
     callback->value()->SwapWithString(&buf);
+    if (ret) {
+      RecordIndexOp(FileCacheIndex::kAccessOp, filename, 0);
+    }
   }
   ValidateAndReportResult(key, ret ? kAvailable : kNotFound, callback);
 }
 
 void FileCache::Put(const GoogleString& key, SharedString* value) {
   GoogleString filename;
-  if (EncodeFilename(key, &filename) &&
-      !file_system_->WriteFileAtomic(filename, value->Value(),
-                                     message_handler_)) {
-    write_errors_->Add(1);
+  if (EncodeFilename(key, &filename)) {
+    if (file_system_->WriteFileAtomic(filename, value->Value(),
+                                      message_handler_)) {
+      // Note that we index the value size rather than the space allocated on
+      // disk, which Clean would see via GetDirInfo.
+      RecordIndexOp(FileCacheIndex::kPutOp, filename, value->size());
+    } else {
+      write_errors_->Add(1);
+    }
   }
   CleanIfNeeded();
 }
@@ -157,6 +193,55 @@ void FileCache::Delete(const GoogleString& key) {
   }
   NullMessageHandler null_handler;  // Do not emit messages on delete failures.
   file_system_->RemoveFile(filename.c_str(), &null_handler);
+  RecordIndexOp(FileCacheIndex::kDeleteOp, filename, 0);
+}
+
+void FileCache::RecordIndexOp(char op, const GoogleString& filename,
+                              int64 size_bytes) {
+  if (!cache_policy_->use_index) {
+    return;
+  }
+  // Journal names are relative to the cache root so the index stays valid
+  // if the cache directory is moved.
+  StringPiece name(filename);
+  if (!name.starts_with(path_)) {
+    return;
+  }
+  name.remove_prefix(path_.size());
+  while (name.starts_with("/")) {
+    name.remove_prefix(1);
+  }
+  if (name.empty()) {
+    return;
+  }
+  const int64 now_sec = cache_policy_->timer->NowMs() / Timer::kSecondMs;
+  GoogleString record;
+  FileCacheIndex::AppendRecord(op, name, size_bytes, now_sec, &record);
+
+  // Each record is appended with a single small write to a freshly opened
+  // file, so records from concurrent processes interleave whole, a crash
+  // loses at most the record being written, and a clean that renames the
+  // journal away only races with appends already in flight.
+  FileSystem::OutputFile* journal = file_system_->OpenOutputFileForAppend(
+      index_journal_path_.c_str(), message_handler_);
+  if (journal == NULL) {
+    write_errors_->Add(1);
+    return;
+  }
+  bool ok = journal->Write(record, message_handler_);
+  ok &= file_system_->Close(journal, message_handler_);
+  if (!ok) {
+    write_errors_->Add(1);
+  }
+}
+
+bool FileCache::IsInternalFile(StringPiece filename) const {
+  return ((filename == clean_time_path_) ||
+          (filename == clean_lock_path_) ||
+          (filename == index_snapshot_path_) ||
+          (filename == index_journal_path_) ||
+          (filename == index_compacting_path_) ||
+          (filename == shm_cache_image_path_));
 }
 
 bool FileCache::EncodeFilename(const GoogleString& key,
@@ -185,8 +270,35 @@ namespace {
 const int64 kEmptyDirCleanAgeSec = 60;
 }  // namespace
 
+bool FileCache::RemoveEmptyDirs(const StringVector& empty_dirs,
+                                int64* inode_count) {
+  bool everything_ok = true;
+  StringVector::const_iterator it;
+  for (it = empty_dirs.begin(); it != empty_dirs.end(); ++it) {
+    // StdioFileSystem uses an empty directory as a file lock. Avoid deleting
+    // these file locks by not removing the file cache clean lock file, and
+    // making sure empty directories are at least n seconds old before removing
+    // them, where n is double ServerContext::kBreakLockMs.
+    int64 timestamp_sec;
+    file_system_->Mtime(*it, &timestamp_sec, message_handler_);
+    const int64 now_sec = cache_policy_->timer->NowMs() / Timer::kSecondMs;
+    int64 age_sec = now_sec - timestamp_sec;
+    if (age_sec > kEmptyDirCleanAgeSec &&
+        clean_lock_path_.compare(it->c_str()) != 0) {
+      everything_ok &= file_system_->RemoveDir(it->c_str(), message_handler_);
+    }
+    // Decrement inode_count even if RemoveDir failed. This is likely
+    // because the directory has already been removed.
+    --*inode_count;
+  }
+  return everything_ok;
+}
+
 bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   DCHECK(cache_policy_->cleaning_enabled());
+  if (cache_policy_->use_index) {
+    return CleanWithIndex(target_size_bytes, target_inode_count);
+  }
   // TODO(jud): this function can delete .lock and .outputlock files, is this
   // problematic?
   message_handler_->Message(kInfo,
@@ -225,25 +337,7 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   cleanups_->Add(1);
 
   // Remove empty directories.
-  StringVector::iterator it;
-  for (it = dir_info.empty_dirs.begin(); it != dir_info.empty_dirs.end();
-       ++it) {
-    // StdioFileSystem uses an empty directory as a file lock. Avoid deleting
-    // these file locks by not removing the file cache clean lock file, and
-    // making sure empty directories are at least n seconds old before removing
-    // them, where n is double ServerContext::kBreakLockMs.
-    int64 timestamp_sec;
-    file_system_->Mtime(*it, &timestamp_sec, message_handler_);
-    const int64 now_sec = cache_policy_->timer->NowMs() / Timer::kSecondMs;
-    int64 age_sec = now_sec - timestamp_sec;
-    if (age_sec > kEmptyDirCleanAgeSec &&
-        clean_lock_path_.compare(it->c_str()) != 0) {
-      everything_ok &= file_system_->RemoveDir(it->c_str(), message_handler_);
-    }
-    // Decrement cache_inode_count even if RemoveDir failed. This is likely
-    // because the directory has already been removed.
-    --cache_inode_count;
-  }
+  everything_ok &= RemoveEmptyDirs(dir_info.empty_dirs, &cache_inode_count);
 
   // Save original cache size to track how many bytes we've cleaned up.
   int64 orig_cache_size = cache_size;
@@ -266,9 +360,11 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
     // Don't clean the clean_time or clean_lock files! They ought to be the
     // newest files (and very small) so they would normally not be deleted
     // anyway. But on some systems (e.g. mounted noatime?) they were getting
-    // deleted.
+    // deleted. Nor the shared memory cache image, which is only read at
+    // startup, so looks old.
     if (clean_time_path_.compare(file.name) == 0 ||
-        clean_lock_path_.compare(file.name) == 0) {
+        clean_lock_path_.compare(file.name) == 0 ||
+        shm_cache_image_path_.compare(file.name) == 0) {
       continue;
     }
     cache_size -= file.size_bytes;
@@ -288,6 +384,289 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   return everything_ok;
 }
 
+bool FileCache::CleanWithIndex(int64 target_size_bytes,
+                               int64 target_inode_count) {
+  message_handler_->Message(kInfo,
+                            "Checking indexed cache size against target %s "
+                            "and inode count against target %s",
+                            Integer64ToString(target_size_bytes).c_str(),
+                            Integer64ToString(target_inode_count).c_str());
+  disk_checks_->Add(1);
+  bool everything_ok = true;
+
+  FileCacheIndex::Delta delta;
+  ReadIndexJournal(&delta);
+
+  // Only the entries the journal mentions are held in memory; the rest of
+  // the snapshot is streamed, once here to size the cache and once more
+  // when writing it back.
+  FileCacheIndex touched;
+  int64 untouched_bytes = 0;
+  int64 untouched_count = 0;
+  int64 rebuilt_sec = 0;
+  const int64 now_sec = cache_policy_->timer->NowMs() / Timer::kSecondMs;
+  bool use_snapshot = ScanIndexSnapshot(delta, &touched, &untouched_bytes,
+                                        &untouched_count, &rebuilt_sec);
+  if (!use_snapshot) {
+    message_handler_->Message(kWarning,
+                              "File cache index %s is missing or corrupt; "
+                              "rebuilding it from a directory scan.",
+                              index_snapshot_path_.c_str());
+  } else if (now_sec - rebuilt_sec >= kIndexRebuildIntervalSec) {
+    message_handler_->Message(kInfo,
+                              "Rebuilding file cache index %s from a "
+                              "directory scan.",
+                              index_snapshot_path_.c_str());
+    use_snapshot = false;
+  }
+  if (!use_snapshot) {
+    index_rebuilds_->Add(1);
+    everything_ok &= RebuildIndex(&touched);
+    untouched_bytes = 0;
+    untouched_count = 0;
+    rebuilt_sec = now_sec;
+  }
+  delta.ApplyTo(&touched);
+
+  int64 cache_size = untouched_bytes + touched.total_bytes();
+  int64 cache_inode_count = untouched_count + touched.num_entries();
+  bool needs_cleanup = (cache_size >= target_size_bytes ||
+                        (target_inode_count != 0 &&
+                         cache_inode_count >= target_inode_count));
+  if (!needs_cleanup) {
+    message_handler_->Message(kInfo,
+                              "File cache size is %s and contains %s files; "
+                              "no cleanup needed.",
+                              Integer64ToString(cache_size).c_str(),
+                              Integer64ToString(cache_inode_count).c_str());
+    if (use_snapshot && delta.empty()) {
+      return everything_ok;  // The snapshot is already up to date.
+    }
+  } else {
+    message_handler_->Message(kInfo,
+                              "File cache size is %s and contains %s files; "
+                              "beginning cleanup.",
+                              Integer64ToString(cache_size).c_str(),
+                              Integer64ToString(cache_inode_count).c_str());
+    cleanups_->Add(1);
+    target_size_bytes = (target_size_bytes * 3) / 4;
+    target_inode_count = (target_inode_count * 3) / 4;
+  }
+
+  // Even with no cleanup needed we write the snapshot back, compacting the
+  // journal into it.  Being under target, nothing is evicted.
+  int64 orig_cache_size = cache_size;
+  everything_ok &= WriteIndexSnapshot(
+      use_snapshot, delta, rebuilt_sec, target_size_bytes, target_inode_count,
+      &touched, &cache_size, &cache_inode_count);
+
+  if (needs_cleanup) {
+    int64 bytes_freed = orig_cache_size - cache_size;
+    message_handler_->Message(kInfo,
+                              "File cache cleanup complete; freed %s bytes",
+                              Integer64ToString(bytes_freed).c_str());
+    bytes_freed_in_cleanup_->Add(bytes_freed);
+  }
+  return everything_ok;
+}
+
+void FileCache::ReadIndexJournal(FileCacheIndex::Delta* delta) {
+  // Move the shared journal aside, so that records appended by other
+  // processes while we clean land in a fresh journal for the next pass.  If
+  // an interrupted clean left a compacting journal behind, that is merged on
+  // its own and the live journal waits for the next pass.
+  NullMessageHandler null_handler;
+  if (!file_system_->Exists(index_compacting_path_.c_str(),
+                            &null_handler).is_true()) {
+    file_system_->RenameFile(index_journal_path_.c_str(),
+                             index_compacting_path_.c_str(), &null_handler);
+  }
+  FileSystem::InputFile* file = file_system_->OpenInputFile(
+      index_compacting_path_.c_str(), &null_handler);
+  if (file == NULL) {
+    return;
+  }
+  // Malformed records, e.g. one torn by a crash, are skipped.
+  FileCacheIndex::Reader reader(file, &null_handler);
+  FileCacheIndex::Record record;
+  FileCacheIndex::Reader::Status status;
+  while ((status = reader.Next(&record)) != FileCacheIndex::Reader::kEnd) {
+    if (status == FileCacheIndex::Reader::kOk) {
+      delta->Apply(record);
+    }
+  }
+  file_system_->Close(file, &null_handler);
+}
+
+bool FileCache::ScanIndexSnapshot(const FileCacheIndex::Delta& delta,
+                                  FileCacheIndex* touched,
+                                  int64* untouched_bytes,
+                                  int64* untouched_count,
+                                  int64* rebuilt_sec) {
+  NullMessageHandler null_handler;
+  FileSystem::InputFile* file = file_system_->OpenInputFile(
+      index_snapshot_path_.c_str(), &null_handler);
+  if (file == NULL) {
+    return false;
+  }
+  FileCacheIndex::Reader reader(file, &null_handler);
+  FileCacheIndex::Record record;
+  bool ok = ((reader.Next(&record) == FileCacheIndex::Reader::kOk) &&
+             (record.op == FileCacheIndex::kHeaderOp) &&
+             (record.size_bytes == FileCacheIndex::kSnapshotVersion) &&
+             (record.name == FileCacheIndex::kSnapshotMagic));
+  *rebuilt_sec = record.atime_sec;
+  *untouched_bytes = 0;
+  *untouched_count = 0;
+  int64 total_bytes = 0;
+  int64 num_entries = 0;
+  int64 last_atime_sec = 0;
+  bool ended = false;
+  while (ok && !ended) {
+    if (reader.Next(&record) != FileCacheIndex::Reader::kOk) {
+      ok = false;
+    } else if (record.op == FileCacheIndex::kEndOp) {
+      ended = true;
+      ok = ((record.atime_sec == num_entries) &&
+            (record.size_bytes == total_bytes) &&
+            record.name.empty());
+    } else if ((record.op != FileCacheIndex::kPutOp) ||
+               (record.atime_sec < last_atime_sec)) {
+      // WriteIndexSnapshot relies on entries being in atime order.
+      ok = false;
+    } else {
+      ++num_entries;
+      total_bytes += record.size_bytes;
+      last_atime_sec = record.atime_sec;
+      if (delta.Contains(record.name)) {
+        touched->Put(record.name, record.size_bytes, record.atime_sec);
+      } else {
+        ++*untouched_count;
+        *untouched_bytes += record.size_bytes;
+      }
+    }
+  }
+  ok = ok && (reader.Next(&record) == FileCacheIndex::Reader::kEnd);
+  file_system_->Close(file, &null_handler);
+  if (!ok) {
+    touched->Clear();
+  }
+  return ok;
+}
+
+bool FileCache::WriteIndexSnapshot(bool use_snapshot,
+                                   const FileCacheIndex::Delta& delta,
+                                   int64 rebuilt_sec, int64 target_size_bytes,
+                                   int64 target_inode_count,
+                                   FileCacheIndex* touched, int64* cache_size,
+                                   int64* cache_inode_count) {
+  NullMessageHandler null_handler;
+  FileSystem::InputFile* input = NULL;
+  if (use_snapshot) {
+    input = file_system_->OpenInputFile(index_snapshot_path_.c_str(),
+                                        message_handler_);
+    if (input == NULL) {
+      return false;
+    }
+  }
+  FileSystem::OutputFile* output = file_system_->OpenTempFile(
+      StrCat(index_snapshot_path_, ".temp"), message_handler_);
+  if (output == NULL) {
+    if (input != NULL) {
+      file_system_->Close(input, &null_handler);
+    }
+    write_errors_->Add(1);
+    return false;
+  }
+  // Store the filename early, since it's invalidated by Close.
+  GoogleString temp_path = output->filename();
+  FileCacheIndex::Writer writer(output, message_handler_);
+  writer.Write(FileCacheIndex::kHeaderOp, FileCacheIndex::kSnapshotMagic,
+               FileCacheIndex::kSnapshotVersion, rebuilt_sec);
+
+  // Both sources are in ascending atime order, so merging them visits the
+  // entries least recently used first.
+  scoped_ptr<FileCacheIndex::Reader> reader;
+  FileCacheIndex::Record from_snapshot, from_touched;
+  bool have_snapshot = false;
+  if (input != NULL) {
+    reader.reset(new FileCacheIndex::Reader(input, &null_handler));
+    reader->Next(&from_snapshot);  // Skip the header.
+    have_snapshot = NextUntouchedEntry(reader.get(), delta, &from_snapshot);
+  }
+  bool have_touched = touched->PopOldest(&from_touched);
+  GoogleString prefix = path_;
+  EnsureEndsInSlash(&prefix);
+  int64 total_bytes = 0;
+  int64 num_entries = 0;
+  while (have_snapshot || have_touched) {
+    bool take_snapshot =
+        (have_snapshot &&
+         (!have_touched ||
+          (from_snapshot.atime_sec <= from_touched.atime_sec)));
+    const FileCacheIndex::Record& record =
+        take_snapshot ? from_snapshot : from_touched;
+    if (*cache_size > target_size_bytes ||
+        (target_inode_count != 0 && *cache_inode_count > target_inode_count)) {
+      *cache_size -= record.size_bytes;
+      --*cache_inode_count;
+      // The file may legitimately be gone already, e.g. removed by Delete
+      // in a process whose journal records we have not seen yet.
+      file_system_->RemoveFile(StrCat(prefix, record.name).c_str(),
+                               &null_handler);
+      evictions_->Add(1);
+    } else {
+      writer.Write(FileCacheIndex::kPutOp, record.name, record.size_bytes,
+                   record.atime_sec);
+      total_bytes += record.size_bytes;
+      ++num_entries;
+    }
+    if (take_snapshot) {
+      have_snapshot = NextUntouchedEntry(reader.get(), delta, &from_snapshot);
+    } else {
+      have_touched = touched->PopOldest(&from_touched);
+    }
+  }
+  writer.Write(FileCacheIndex::kEndOp, "", total_bytes, num_entries);
+
+  bool ok = writer.Flush();
+  ok &= file_system_->Close(output, message_handler_);
+  if (input != NULL) {
+    file_system_->Close(input, &null_handler);
+  }
+  // Only once the new snapshot is in place is it safe to drop the journal
+  // we merged into it.
+  if (ok && file_system_->RenameFile(temp_path.c_str(),
+                                     index_snapshot_path_.c_str(),
+                                     message_handler_)) {
+    file_system_->RemoveFile(index_compacting_path_.c_str(), &null_handler);
+    return true;
+  }
+  file_system_->RemoveFile(temp_path.c_str(), &null_handler);
+  write_errors_->Add(1);
+  return false;
+}
+
+bool FileCache::RebuildIndex(FileCacheIndex* index) {
+  FileSystem::DirInfo dir_info;
+  file_system_->GetDirInfo(path_, &dir_info, message_handler_);
+  int64 inode_count = dir_info.inode_count;
+  bool everything_ok = RemoveEmptyDirs(dir_info.empty_dirs, &inode_count);
+
+  GoogleString prefix = path_;
+  EnsureEndsInSlash(&prefix);
+  index->Clear();
+  for (int i = 0, n = dir_info.files.size(); i < n; ++i) {
+    const FileSystem::FileInfo& file = dir_info.files[i];
+    StringPiece name(file.name);
+    if (!IsInternalFile(name) && name.starts_with(prefix)) {
+      name.remove_prefix(prefix.size());
+      index->Put(name, file.size_bytes, file.atime_sec);
+    }
+  }
+  return everything_ok;
+}
+
 void FileCache::CleanWithLocking(int64 next_clean_time_ms) {
   if (file_system_->TryLockWithTimeout(
           clean_lock_path_, Timer::kHourMs, cache_policy_->timer,
@@ -23,7 +23,9 @@
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/file_cache_index.h"
 
 namespace net_instaweb {
 
@@ -44,12 +46,17 @@ class FileCache : public CacheInterface {
                 int64 target_size_bytes, int64 target_inode_count)
         : timer(timer), hasher(hasher), clean_interval_ms(clean_interval_ms),
           target_size_bytes(target_size_bytes),
-          target_inode_count(target_inode_count) {}
+          target_inode_count(target_inode_count),
+          use_index(false) {}
     const Timer* timer;
     const Hasher* hasher;
     int64 clean_interval_ms;
     int64 target_size_bytes;
     int64 target_inode_count;
+    // When true, the cache journals every write, read and delete into an
+    // on-disk index so that cleaning does not need to walk the directory
+    // tree.  See FileCacheIndex.
+    bool use_index;
     bool cleaning_enabled() { return clean_interval_ms != kDisableCleaning; }
    private:
     DISALLOW_COPY_AND_ASSIGN(CachePolicy);
@@ -88,11 +95,25 @@ class FileCache : public CacheInterface {
   // Files evicted from cache during cleanup.
   static const char kEvictions[];
   static const char kWriteErrors[];
+  // Number of times the index had to be rebuilt from a directory scan
+  // because its snapshot was missing, corrupt or due for a rebuild.
+  static const char kIndexRebuilds[];
 
   // What to set clean_interval_ms to in order to disable cleaning.  This needs
   // to be -1, because that's what we have in our public documentation.
   static const int kDisableCleaning = -1;
 
+  // How often the indexed cleaner rebuilds its snapshot from a directory
+  // scan even when the snapshot is intact, so that files the journal never
+  // heard about, e.g. written while use_index was off, are eventually indexed
+  // and evicted.
+  static const int64 kIndexRebuildIntervalSec = 24 * 60 * 60;
+
+  // The filename of any image of a shared memory cache in front of this one,
+  // kept here by its owner across restarts; see SharedMemCache::SaveImage.
+  // Cleaning leaves it alone.
+  static const char kShmCacheImageName[];
+
  private:
   class CacheCleanFunction;
   friend class FileCacheTest;
@@ -105,6 +126,50 @@ class FileCache : public CacheInterface {
   // target_inode_count of 0 means no inode limit is applied.
   bool Clean(int64 target_size_bytes, int64 target_inode_count);
 
+  // Implementation of Clean used when cache_policy_->use_index is set.  The
+  // snapshot is streamed, and only the files being evicted are touched on
+  // disk.  Note that in this mode the inode count reflects files only;
+  // directories are pruned only when the index is rebuilt.
+  bool CleanWithIndex(int64 target_size_bytes, int64 target_inode_count);
+
+  // Moves the live journal aside, unless an interrupted clean left one
+  // behind, and collects the records in it into *delta.
+  void ReadIndexJournal(FileCacheIndex::Delta* delta);
+
+  // Streams through the index snapshot, checking that it is well formed.
+  // Snapshot entries mentioned in 'delta' are added to *touched; the others
+  // are only counted.  Returns false if the snapshot is missing or corrupt.
+  bool ScanIndexSnapshot(const FileCacheIndex::Delta& delta,
+                         FileCacheIndex* touched, int64* untouched_bytes,
+                         int64* untouched_count, int64* rebuilt_sec);
+
+  // Writes a new index snapshot by merging, in atime order, the untouched
+  // entries of the existing snapshot (if use_snapshot) with *touched, which
+  // is emptied.  While the cache is over either target the oldest entries
+  // are evicted rather than written, updating *cache_size and
+  // *cache_inode_count.
+  bool WriteIndexSnapshot(bool use_snapshot,
+                          const FileCacheIndex::Delta& delta,
+                          int64 rebuilt_sec, int64 target_size_bytes,
+                          int64 target_inode_count, FileCacheIndex* touched,
+                          int64* cache_size, int64* cache_inode_count);
+
+  // Populates *index by walking the cache directory, removing old empty
+  // directories along the way.  This is the fallback for a missing or
+  // corrupt index snapshot, and is also run every kIndexRebuildIntervalSec.
+  bool RebuildIndex(FileCacheIndex* index);
+
+  // Removes the empty directories found by GetDirInfo that are old enough
+  // not to be lock directories, decrementing *inode_count for each.
+  bool RemoveEmptyDirs(const StringVector& empty_dirs, int64* inode_count);
+
+  // Appends an index journal record for 'filename' to the on-disk journal.
+  void RecordIndexOp(char op, const GoogleString& filename, int64 size_bytes);
+
+  // Returns true for the bookkeeping files that FileCache keeps in path_,
+  // which must never be evicted or indexed.
+  bool IsInternalFile(StringPiece filename) const;
+
   // Clean the cache, taking care of interprocess locking, as well as timestamp
   // update.
   void CleanWithLocking(int64 next_clean_time_ms) LOCKS_EXCLUDED(mutex_);
@@ -132,17 +197,28 @@ class FileCache : public CacheInterface {
   // The full paths to our cleanup timestamp and lock files.
   GoogleString clean_time_path_;
   GoogleString clean_lock_path_;
+  // The full paths to the index snapshot and journal.  The journal is renamed
+  // to index_compacting_path_ while a clean is merging it into the snapshot.
+  GoogleString index_snapshot_path_;
+  GoogleString index_journal_path_;
+  GoogleString index_compacting_path_;
+  GoogleString shm_cache_image_path_;
 
   Variable* disk_checks_;
   Variable* cleanups_;
   Variable* evictions_;
   Variable* bytes_freed_in_cleanup_;
   Variable* write_errors_;
+  Variable* index_rebuilds_;
 
   // The filename where we keep the next scheduled cleanup time in seconds.
   static const char kCleanTimeName[];
   // The name of the global mutex protecting reads and writes to that file.
   static const char kCleanLockName[];
+  // The filenames of the index snapshot, journal, and journal being compacted.
+  static const char kIndexSnapshotName[];
+  static const char kIndexJournalName[];
+  static const char kIndexCompactingName[];
 
   DISALLOW_COPY_AND_ASSIGN(FileCache);
 };
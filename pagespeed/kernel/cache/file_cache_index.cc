@@ -0,0 +1,307 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/file_cache_index.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kReadBufferSize = 64 * 1024;
+const int kWriteBufferSize = 64 * 1024;
+
+// Enough for any atime or size we write, while still fitting in an int64.
+const int kMaxDigits = 18;
+
+}  // namespace
+
+const char FileCacheIndex::kSnapshotMagic[] = "pagespeed_file_cache_index";
+
+FileCacheIndex::Reader::Reader(FileSystem::InputFile* file,
+                               MessageHandler* handler)
+    : file_(file),
+      handler_(handler),
+      buffer_pos_(0),
+      eof_(false) {
+}
+
+FileCacheIndex::Reader::~Reader() {
+}
+
+bool FileCacheIndex::Reader::Peek(char* c) {
+  if (buffer_pos_ == static_cast<int>(buffer_.size())) {
+    if (eof_) {
+      return false;
+    }
+    buffer_.resize(kReadBufferSize);
+    int bytes = file_->Read(&buffer_[0], kReadBufferSize, handler_);
+    buffer_pos_ = 0;
+    if (bytes <= 0) {
+      buffer_.clear();
+      eof_ = true;
+      return false;
+    }
+    buffer_.resize(bytes);
+  }
+  *c = buffer_[buffer_pos_];
+  return true;
+}
+
+bool FileCacheIndex::Reader::Expect(char expected) {
+  char c;
+  if (Peek(&c) && (c == expected)) {
+    ++buffer_pos_;
+    return true;
+  }
+  return false;
+}
+
+bool FileCacheIndex::Reader::ReadNumber(int64* value) {
+  *value = 0;
+  int digits = 0;
+  char c;
+  while (Peek(&c) && (c >= '0') && (c <= '9')) {
+    if (++digits > kMaxDigits) {
+      return false;
+    }
+    *value = (*value * 10) + (c - '0');
+    ++buffer_pos_;
+  }
+  return (digits != 0) && Expect(' ');
+}
+
+void FileCacheIndex::Reader::SkipLine() {
+  char c;
+  while (Peek(&c)) {
+    ++buffer_pos_;
+    if (c == '\n') {
+      break;
+    }
+  }
+}
+
+FileCacheIndex::Reader::Status FileCacheIndex::Reader::Next(Record* record) {
+  char c;
+  if (!Peek(&c)) {
+    return kEnd;
+  }
+  ++buffer_pos_;
+  if (c == '\n') {
+    return kMalformed;  // Already at the start of the next line.
+  }
+  record->op = c;
+  int64 name_size;
+  if (!Expect(' ') ||
+      !ReadNumber(&record->atime_sec) ||
+      !ReadNumber(&record->size_bytes) ||
+      !ReadNumber(&name_size) ||
+      (name_size > kMaxNameSize)) {
+    SkipLine();
+    return kMalformed;
+  }
+  record->name.clear();
+  while ((name_size > 0) && Peek(&c)) {
+    int64 available = std::min(
+        name_size, static_cast<int64>(buffer_.size() - buffer_pos_));
+    record->name.append(buffer_, buffer_pos_, available);
+    buffer_pos_ += available;
+    name_size -= available;
+  }
+  // Since a name may itself contain newlines, a record torn mid-name can
+  // cost us the record that follows it too, but we resynchronize after that.
+  if ((name_size != 0) || !Expect('\n')) {
+    SkipLine();
+    return kMalformed;
+  }
+  return kOk;
+}
+
+FileCacheIndex::Writer::Writer(FileSystem::OutputFile* file,
+                               MessageHandler* handler)
+    : file_(file),
+      handler_(handler),
+      ok_(true) {
+}
+
+FileCacheIndex::Writer::~Writer() {
+}
+
+bool FileCacheIndex::Writer::Write(char op, StringPiece name,
+                                   int64 size_bytes, int64 atime_sec) {
+  AppendRecord(op, name, size_bytes, atime_sec, &buffer_);
+  if (buffer_.size() >= static_cast<size_t>(kWriteBufferSize)) {
+    return Flush();
+  }
+  return ok_;
+}
+
+bool FileCacheIndex::Writer::Flush() {
+  if (ok_ && !buffer_.empty()) {
+    ok_ = file_->Write(buffer_, handler_);
+  }
+  buffer_.clear();
+  return ok_;
+}
+
+FileCacheIndex::Delta::Delta() {
+}
+
+FileCacheIndex::Delta::~Delta() {
+}
+
+void FileCacheIndex::Delta::Apply(const Record& record) {
+  switch (record.op) {
+    case kPutOp: {
+      Change& change = changes_[record.name];
+      change.deleted = false;
+      change.size_bytes = record.size_bytes;
+      change.atime_sec = record.atime_sec;
+      break;
+    }
+    case kAccessOp: {
+      std::pair<ChangeMap::iterator, bool> result =
+          changes_.insert(std::make_pair(record.name, Change()));
+      Change& change = result.first->second;
+      if (result.second) {
+        change.deleted = false;
+        change.size_bytes = -1;
+        change.atime_sec = record.atime_sec;
+      } else if (!change.deleted && (record.atime_sec > change.atime_sec)) {
+        change.atime_sec = record.atime_sec;
+      }
+      break;
+    }
+    case kDeleteOp: {
+      Change& change = changes_[record.name];
+      change.deleted = true;
+      change.size_bytes = -1;
+      change.atime_sec = 0;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+bool FileCacheIndex::Delta::Contains(StringPiece name) const {
+  return changes_.find(name.as_string()) != changes_.end();
+}
+
+void FileCacheIndex::Delta::ApplyTo(FileCacheIndex* index) const {
+  for (ChangeMap::const_iterator p = changes_.begin(), e = changes_.end();
+       p != e; ++p) {
+    const Change& change = p->second;
+    if (change.deleted) {
+      index->Delete(p->first);
+    } else if (change.size_bytes >= 0) {
+      index->Put(p->first, change.size_bytes, change.atime_sec);
+    } else {
+      index->Access(p->first, change.atime_sec);
+    }
+  }
+}
+
+FileCacheIndex::FileCacheIndex() : total_bytes_(0) {
+}
+
+FileCacheIndex::~FileCacheIndex() {
+}
+
+void FileCacheIndex::Clear() {
+  entries_.clear();
+  atime_order_.clear();
+  total_bytes_ = 0;
+}
+
+bool FileCacheIndex::Contains(StringPiece name) const {
+  return entries_.find(name.as_string()) != entries_.end();
+}
+
+void FileCacheIndex::Touch(EntryMap::iterator iter, int64 atime_sec) {
+  Entry& entry = iter->second;
+  if (entry.order != atime_order_.end()) {
+    atime_order_.erase(entry.order);
+  }
+  entry.atime_sec = atime_sec;
+  entry.order = atime_order_.insert(std::make_pair(atime_sec, &iter->first));
+}
+
+void FileCacheIndex::Put(StringPiece name, int64 size_bytes, int64 atime_sec) {
+  std::pair<EntryMap::iterator, bool> result = entries_.insert(
+      std::make_pair(name.as_string(), Entry()));
+  Entry& entry = result.first->second;
+  if (result.second) {
+    entry.order = atime_order_.end();
+  } else {
+    total_bytes_ -= entry.size_bytes;
+  }
+  entry.size_bytes = size_bytes;
+  total_bytes_ += size_bytes;
+  Touch(result.first, atime_sec);
+}
+
+void FileCacheIndex::Access(StringPiece name, int64 atime_sec) {
+  EntryMap::iterator iter = entries_.find(name.as_string());
+  if ((iter != entries_.end()) && (atime_sec > iter->second.atime_sec)) {
+    Touch(iter, atime_sec);
+  }
+}
+
+void FileCacheIndex::Delete(StringPiece name) {
+  EntryMap::iterator iter = entries_.find(name.as_string());
+  if (iter != entries_.end()) {
+    total_bytes_ -= iter->second.size_bytes;
+    atime_order_.erase(iter->second.order);
+    entries_.erase(iter);
+  }
+}
+
+bool FileCacheIndex::PopOldest(Record* record) {
+  if (atime_order_.empty()) {
+    return false;
+  }
+  AtimeOrder::iterator oldest = atime_order_.begin();
+  EntryMap::iterator iter = entries_.find(*oldest->second);
+  DCHECK(iter != entries_.end());
+  record->op = kPutOp;
+  record->name = iter->first;
+  record->size_bytes = iter->second.size_bytes;
+  record->atime_sec = iter->second.atime_sec;
+  total_bytes_ -= iter->second.size_bytes;
+  atime_order_.erase(oldest);
+  entries_.erase(iter);
+  return true;
+}
+
+void FileCacheIndex::AppendRecord(char op, StringPiece name, int64 size_bytes,
+                                  int64 atime_sec, GoogleString* out) {
+  out->push_back(op);
+  StrAppend(out, " ", Integer64ToString(atime_sec), " ",
+            Integer64ToString(size_bytes), " ",
+            Integer64ToString(name.size()), " ", name, "\n");
+}
+
+}  // namespace net_instaweb
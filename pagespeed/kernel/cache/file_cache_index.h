@@ -0,0 +1,209 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
+#define PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
+
+#include <map>
+#include <utility>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+// In-memory index of files in a FileCache, tracking the size and last access
+// time of each file so that the cache can be cleaned without walking and
+// stat'ing the directory tree.
+//
+// The index is persisted as a snapshot plus an append-only journal of
+// mutations.  Both are sequences of records of the form
+//
+//   "<op> <atime_sec> <size_bytes> <name_size> <name>\n"
+//
+// where <name> is exactly <name_size> bytes, so names may contain any
+// character.  Journal ops are Put, Access and Delete.  A snapshot is a Header
+// record holding the format version and the time the snapshot was last
+// rebuilt from a directory scan, then one Put record per file in ascending
+// atime order, then an End record holding the entry count and total size so
+// that truncation is detected.  Snapshots are read and written as streams
+// via Reader and Writer, so they need never be held in memory.
+//
+// Names are file paths relative to the cache root.  None of these classes
+// are thread-safe; FileCache only uses them from the cleaning thread.
+class FileCacheIndex {
+ public:
+  struct Record {
+    Record() : op(kPutOp), atime_sec(0), size_bytes(0) {}
+
+    char op;
+    int64 atime_sec;
+    int64 size_bytes;
+    GoogleString name;
+  };
+
+  // Reads records sequentially from a file.
+  class Reader {
+   public:
+    enum Status {
+      kOk,
+      // The record was malformed, e.g. torn by a crash.  The reader has
+      // skipped to the next newline, so the caller may keep reading.
+      kMalformed,
+      kEnd,
+    };
+
+    // 'file' remains owned by the caller, and must outlive the Reader.
+    Reader(FileSystem::InputFile* file, MessageHandler* handler);
+    ~Reader();
+
+    Status Next(Record* record);
+
+   private:
+    bool Peek(char* c);
+    bool ReadNumber(int64* value);
+    bool Expect(char c);
+    void SkipLine();
+
+    FileSystem::InputFile* file_;
+    MessageHandler* handler_;
+    GoogleString buffer_;
+    int buffer_pos_;
+    bool eof_;
+
+    DISALLOW_COPY_AND_ASSIGN(Reader);
+  };
+
+  // Writes records to a file, buffering them into large writes.
+  class Writer {
+   public:
+    // 'file' remains owned by the caller, and must outlive the Writer.
+    Writer(FileSystem::OutputFile* file, MessageHandler* handler);
+    ~Writer();
+
+    // Returns false if this or any earlier write failed.
+    bool Write(char op, StringPiece name, int64 size_bytes, int64 atime_sec);
+    bool Flush();
+
+   private:
+    FileSystem::OutputFile* file_;
+    MessageHandler* handler_;
+    GoogleString buffer_;
+    bool ok_;
+
+    DISALLOW_COPY_AND_ASSIGN(Writer);
+  };
+
+  // The net effect of a sequence of journal records on each name they
+  // mention.  This is the only part of the index a clean holds in full, and
+  // it is bounded by the cache traffic between cleans rather than the size
+  // of the cache.
+  class Delta {
+   public:
+    Delta();
+    ~Delta();
+
+    void Apply(const Record& record);
+    bool Contains(StringPiece name) const;
+    bool empty() const { return changes_.empty(); }
+
+    // Updates *index with the changes, ignoring accesses to names it does
+    // not contain, since their size is unknown.
+    void ApplyTo(FileCacheIndex* index) const;
+
+   private:
+    struct Change {
+      bool deleted;
+      int64 size_bytes;  // -1 if the name was only accessed.
+      int64 atime_sec;
+    };
+    typedef std::map<GoogleString, Change> ChangeMap;
+
+    ChangeMap changes_;
+
+    DISALLOW_COPY_AND_ASSIGN(Delta);
+  };
+
+  FileCacheIndex();
+  ~FileCacheIndex();
+
+  // Records that 'name' was written with the given size at atime_sec.
+  void Put(StringPiece name, int64 size_bytes, int64 atime_sec);
+
+  // Records an access to 'name'.  Accesses to unknown names are ignored,
+  // since we do not know their size.
+  void Access(StringPiece name, int64 atime_sec);
+
+  // Forgets about 'name'.
+  void Delete(StringPiece name);
+
+  // Removes the least recently accessed entry, storing it as a Put record.
+  // Returns false if the index is empty.
+  bool PopOldest(Record* record);
+
+  void Clear();
+
+  int64 total_bytes() const { return total_bytes_; }
+  int64 num_entries() const { return entries_.size(); }
+  bool Contains(StringPiece name) const;
+
+  // Appends a single record to *out.
+  static void AppendRecord(char op, StringPiece name, int64 size_bytes,
+                           int64 atime_sec, GoogleString* out);
+
+  static const char kPutOp = 'P';
+  static const char kAccessOp = 'A';
+  static const char kDeleteOp = 'D';
+  // Snapshot framing.  The Header record's atime field holds the time of the
+  // last rebuild, its size field kSnapshotVersion and its name
+  // kSnapshotMagic.  The End record's atime field holds the entry count, its
+  // size field the total size, and its name is empty.
+  static const char kHeaderOp = 'H';
+  static const char kEndOp = 'E';
+
+  static const char kSnapshotMagic[];
+  static const int64 kSnapshotVersion = 2;
+
+  // Names longer than this are rejected as corrupt when reading.
+  static const int64 kMaxNameSize = 8192;
+
+ private:
+  // Ordered by ascending atime; the value points at the key in entries_.
+  typedef std::multimap<int64, const GoogleString*> AtimeOrder;
+
+  struct Entry {
+    int64 size_bytes;
+    int64 atime_sec;
+    AtimeOrder::iterator order;
+  };
+  typedef std::map<GoogleString, Entry> EntryMap;
+
+  void Touch(EntryMap::iterator iter, int64 atime_sec);
+
+  EntryMap entries_;
+  AtimeOrder atime_order_;
+  int64 total_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileCacheIndex);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
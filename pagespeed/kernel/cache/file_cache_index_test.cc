@@ -0,0 +1,220 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Unit-test the file cache index.
+
+#include "pagespeed/kernel/cache/file_cache_index.h"
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kFilename[] = "/index";
+
+class FileCacheIndexTest : public testing::Test {
+ protected:
+  FileCacheIndexTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewMutex(), 0),
+        file_system_(thread_system_.get(), &timer_) {
+  }
+
+  // Pops the oldest entry, returning its name, or "" if the index is empty.
+  GoogleString PopOldest() {
+    FileCacheIndex::Record record;
+    if (!index_.PopOldest(&record)) {
+      return "";
+    }
+    return record.name;
+  }
+
+  // Reads kFilename back as records, returning the well-formed ones and
+  // counting the malformed ones.
+  void ReadRecords(std::vector<FileCacheIndex::Record>* records,
+                   int* malformed) {
+    FileSystem::InputFile* file =
+        file_system_.OpenInputFile(kFilename, &handler_);
+    ASSERT_TRUE(file != NULL);
+    FileCacheIndex::Reader reader(file, &handler_);
+    FileCacheIndex::Record record;
+    FileCacheIndex::Reader::Status status;
+    *malformed = 0;
+    while ((status = reader.Next(&record)) != FileCacheIndex::Reader::kEnd) {
+      if (status == FileCacheIndex::Reader::kOk) {
+        records->push_back(record);
+      } else {
+        ++*malformed;
+      }
+    }
+    file_system_.Close(file, &handler_);
+  }
+
+  void ExpectRecord(const FileCacheIndex::Record& record, char op,
+                    StringPiece name, int64 size_bytes, int64 atime_sec) {
+    EXPECT_EQ(op, record.op);
+    EXPECT_EQ(name, record.name);
+    EXPECT_EQ(size_bytes, record.size_bytes);
+    EXPECT_EQ(atime_sec, record.atime_sec);
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  MemFileSystem file_system_;
+  NullMessageHandler handler_;
+  FileCacheIndex index_;
+};
+
+TEST_F(FileCacheIndexTest, EvictsInAccessOrder) {
+  index_.Put("a", 10, 1);
+  index_.Put("b", 20, 2);
+  index_.Put("c", 30, 3);
+  EXPECT_EQ(60, index_.total_bytes());
+  EXPECT_EQ(3, index_.num_entries());
+
+  index_.Access("a", 4);
+  index_.Access("unknown", 5);  // Ignored.
+  index_.Access("c", 0);  // Stale access times don't move entries back.
+  EXPECT_EQ(3, index_.num_entries());
+
+  EXPECT_EQ("b", PopOldest());
+  EXPECT_EQ("c", PopOldest());
+  EXPECT_EQ(10, index_.total_bytes());
+  EXPECT_EQ("a", PopOldest());
+  EXPECT_EQ("", PopOldest());
+  EXPECT_EQ(0, index_.total_bytes());
+}
+
+TEST_F(FileCacheIndexTest, RewriteAndDelete) {
+  index_.Put("a", 10, 1);
+  index_.Put("b", 20, 2);
+  index_.Put("a", 15, 3);  // Rewriting updates both size and recency.
+  EXPECT_EQ(35, index_.total_bytes());
+  EXPECT_EQ(2, index_.num_entries());
+  index_.Delete("b");
+  index_.Delete("b");
+  EXPECT_FALSE(index_.Contains("b"));
+  EXPECT_EQ(15, index_.total_bytes());
+  EXPECT_EQ("a", PopOldest());
+}
+
+// Names are length-prefixed, so they may contain the record separators.
+TEST_F(FileCacheIndexTest, NamesWithSpacesRoundTrip) {
+  FileSystem::OutputFile* file =
+      file_system_.OpenOutputFile(kFilename, &handler_);
+  ASSERT_TRUE(file != NULL);
+  FileCacheIndex::Writer writer(file, &handler_);
+  EXPECT_TRUE(writer.Write(FileCacheIndex::kPutOp, "dir/with space", 10, 7));
+  EXPECT_TRUE(writer.Write(FileCacheIndex::kPutOp, "two\nlines ", 20, 8));
+  EXPECT_TRUE(writer.Write(FileCacheIndex::kAccessOp, " 1 2 3 ", 0, 9));
+  EXPECT_TRUE(writer.Write(FileCacheIndex::kEndOp, "", 30, 2));
+  EXPECT_TRUE(writer.Flush());
+  EXPECT_TRUE(file_system_.Close(file, &handler_));
+
+  std::vector<FileCacheIndex::Record> records;
+  int malformed;
+  ReadRecords(&records, &malformed);
+  EXPECT_EQ(0, malformed);
+  ASSERT_EQ(4, records.size());
+  ExpectRecord(records[0], FileCacheIndex::kPutOp, "dir/with space", 10, 7);
+  ExpectRecord(records[1], FileCacheIndex::kPutOp, "two\nlines ", 20, 8);
+  ExpectRecord(records[2], FileCacheIndex::kAccessOp, " 1 2 3 ", 0, 9);
+  ExpectRecord(records[3], FileCacheIndex::kEndOp, "", 30, 2);
+}
+
+TEST_F(FileCacheIndexTest, MalformedRecordsSkipped) {
+  GoogleString journal;
+  FileCacheIndex::AppendRecord(FileCacheIndex::kPutOp, "a", 10, 1, &journal);
+  journal.append("garbage\n");
+  journal.append("\n");
+  journal.append("P 1 2 999999 too long\n");
+  journal.append("P 1 2 3 short\n");
+  FileCacheIndex::AppendRecord(FileCacheIndex::kDeleteOp, "b", 0, 2, &journal);
+  // A final record torn by a crash.
+  journal.append("P 6 40 4 to");
+  ASSERT_TRUE(file_system_.WriteFile(kFilename, journal, &handler_));
+
+  std::vector<FileCacheIndex::Record> records;
+  int malformed;
+  ReadRecords(&records, &malformed);
+  EXPECT_EQ(5, malformed);
+  ASSERT_EQ(2, records.size());
+  ExpectRecord(records[0], FileCacheIndex::kPutOp, "a", 10, 1);
+  ExpectRecord(records[1], FileCacheIndex::kDeleteOp, "b", 0, 2);
+}
+
+TEST_F(FileCacheIndexTest, DeltaCollapsesJournal) {
+  index_.Put("kept", 1, 1);
+  index_.Put("accessed", 2, 2);
+  index_.Put("deleted", 3, 3);
+  index_.Put("rewritten", 4, 4);
+
+  FileCacheIndex::Delta delta;
+  EXPECT_TRUE(delta.empty());
+  FileCacheIndex::Record record;
+  record.op = FileCacheIndex::kAccessOp;
+  record.name = "accessed";
+  record.atime_sec = 10;
+  delta.Apply(record);
+  record.name = "unknown";  // Accesses to unknown names are ignored.
+  delta.Apply(record);
+  record.op = FileCacheIndex::kDeleteOp;
+  record.name = "deleted";
+  delta.Apply(record);
+  record.op = FileCacheIndex::kAccessOp;
+  record.atime_sec = 11;
+  delta.Apply(record);  // Cannot resurrect a deleted entry.
+  record.op = FileCacheIndex::kPutOp;
+  record.name = "rewritten";
+  record.size_bytes = 40;
+  record.atime_sec = 5;
+  delta.Apply(record);
+  record.name = "new";
+  record.size_bytes = 50;
+  record.atime_sec = 6;
+  delta.Apply(record);
+  EXPECT_FALSE(delta.empty());
+  EXPECT_TRUE(delta.Contains("deleted"));
+  EXPECT_FALSE(delta.Contains("kept"));
+
+  delta.ApplyTo(&index_);
+  EXPECT_EQ(4, index_.num_entries());
+  EXPECT_EQ(93, index_.total_bytes());
+  EXPECT_FALSE(index_.Contains("deleted"));
+  EXPECT_FALSE(index_.Contains("unknown"));
+  EXPECT_EQ("kept", PopOldest());
+  EXPECT_EQ("rewritten", PopOldest());
+  EXPECT_EQ("new", PopOldest());
+  EXPECT_EQ("accessed", PopOldest());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
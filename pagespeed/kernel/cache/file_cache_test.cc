@@ -66,11 +66,18 @@ class FileCacheTest : public CacheTestBase {
   }
 
   void ResetFileCache(int64 clean_interval_ms, int64 target_size_bytes) {
+    ResetFileCacheWithIndex(clean_interval_ms, target_size_bytes, false);
+  }
+
+  void ResetFileCacheWithIndex(int64 clean_interval_ms,
+                               int64 target_size_bytes, bool use_index) {
+    FileCache::CachePolicy* policy = new FileCache::CachePolicy(
+        &mock_timer_, &hasher_, clean_interval_ms, target_size_bytes,
+        kTargetInodeLimit);
+    policy->use_index = use_index;
     cache_.reset(new FileCache(
         GTestTempDir(), &file_system_, thread_system_.get(), &worker_,
-        new FileCache::CachePolicy(&mock_timer_, &hasher_, clean_interval_ms,
-                                   target_size_bytes, kTargetInodeLimit),
-        &stats_, &message_handler_));
+        policy, &stats_, &message_handler_));
   }
 
   void CheckCleanTimestamp(int64 min_time_ms) {
@@ -95,6 +102,22 @@ class FileCacheTest : public CacheTestBase {
     return cache_->Clean(size, inode_count);
   }
 
+  const GoogleString& index_snapshot_path() {
+    return cache_->index_snapshot_path_;
+  }
+
+  const GoogleString& index_journal_path() {
+    return cache_->index_journal_path_;
+  }
+
+  const GoogleString& index_compacting_path() {
+    return cache_->index_compacting_path_;
+  }
+
+  bool Exists(const GoogleString& path) {
+    return file_system_.Exists(path.c_str(), &message_handler_).is_true();
+  }
+
   void RunClean() {
     cache_->CleanIfNeeded();
     while (worker_.IsBusy()) {
@@ -332,4 +355,142 @@ TEST_F(FileCacheTest, CheckPartialCleanWithCleaningDisabled) {
   CheckGet("Name3", "Value3");
 }
 
+// Test that the indexed cleaner evicts by access recency without needing a
+// directory scan once the index snapshot exists.
+TEST_F(FileCacheTest, IndexedClean) {
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+  Variable* index_rebuilds = stats_.GetVariable(FileCache::kIndexRebuilds);
+
+  CheckPut("Name1", "Value1");
+  CheckPut("Name2", "Value2");
+  CheckPut("Name3", "Value3");
+  CheckGet("Name1", "Value1");  // Name1 is now the most recently used.
+
+  // The first clean has no snapshot to work from, so it scans the directory
+  // once.  The index holds 18 bytes against a target of 12, so we clean down
+  // to 9 bytes, evicting the two least recently used entries.
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(1, index_rebuilds->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(2, evictions_->Get());
+  EXPECT_EQ(12, bytes_freed_in_cleanup_->Get());
+  CheckNotFound("Name2");
+  CheckNotFound("Name3");
+  CheckGet("Name1", "Value1");
+  EXPECT_TRUE(Exists(index_snapshot_path()));
+  EXPECT_FALSE(Exists(index_compacting_path()));
+
+  // Subsequent cleans work from the snapshot plus the journal.
+  stats_.Clear();
+  CheckPut("Name4", "Value4");
+  CheckPut("Name5", "Value5");
+  cache_->Delete("Name1");
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(0, index_rebuilds->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(1, evictions_->Get());
+  CheckNotFound("Name4");
+  CheckGet("Name5", "Value5");
+
+  // Nothing to do when under target.
+  stats_.Clear();
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(1, disk_checks_->Get());
+  EXPECT_EQ(0, cleanups_->Get());
+  CheckGet("Name5", "Value5");
+}
+
+// Test that a corrupt snapshot is rebuilt from the directory contents, and
+// that the index limits inodes too.
+TEST_F(FileCacheTest, IndexedCleanRebuildsCorruptSnapshot) {
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+  Variable* index_rebuilds = stats_.GetVariable(FileCache::kIndexRebuilds);
+
+  CheckPut("a", "1");
+  CheckPut("b", "2");
+  CheckPut("c", "3");
+  CheckPut("d", "4");
+  EXPECT_TRUE(file_system_.WriteFile(index_snapshot_path().c_str(),
+                                     "not an index", &message_handler_));
+
+  EXPECT_TRUE(Clean(kTargetSize, 4));
+  EXPECT_EQ(1, index_rebuilds->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(1, evictions_->Get());  // Down to 3 == (4 * 3) / 4 inodes.
+  CheckNotFound("a");
+  CheckGet("b", "2");
+  CheckGet("c", "3");
+  CheckGet("d", "4");
+}
+
+// Test that journal records reach disk as they happen, so that a process
+// that dies without cleaning, or even mid-append, loses nothing it completed.
+TEST_F(FileCacheTest, IndexedCleanAfterCrash) {
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+  Variable* index_rebuilds = stats_.GetVariable(FileCache::kIndexRebuilds);
+  CheckPut("a", "1");
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(1, index_rebuilds->Get());
+  EXPECT_EQ(0, cleanups_->Get());
+
+  CheckPut("Name1", "Value1");
+  CheckPut("Name2", "Value2");
+  CheckPut("Name3", "Value3");
+  GoogleString journal;
+  ASSERT_TRUE(file_system_.ReadFile(index_journal_path().c_str(), &journal,
+                                    &message_handler_));
+  EXPECT_NE(GoogleString::npos, journal.find("Name3"));
+
+  // Simulate a crash partway through appending another record, then
+  // restart.
+  journal.append("P 99 1000 8 Name");
+  ASSERT_TRUE(file_system_.WriteFile(index_journal_path().c_str(), journal,
+                                     &message_handler_));
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+
+  // The snapshot is still good, and the journal tells us about the 18 bytes
+  // written since, so we clean down to 9 bytes without a directory scan.
+  stats_.Clear();
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(0, index_rebuilds->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(3, evictions_->Get());
+  CheckNotFound("a");
+  CheckNotFound("Name1");
+  CheckNotFound("Name2");
+  CheckGet("Name3", "Value3");
+  EXPECT_FALSE(Exists(index_compacting_path()));
+}
+
+// Test that files the journal never saw, here because they were written
+// with the index turned off, are picked up by the periodic rebuild.
+TEST_F(FileCacheTest, IndexedCleanPeriodicallyRebuilds) {
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+  Variable* index_rebuilds = stats_.GetVariable(FileCache::kIndexRebuilds);
+  CheckPut("a", "1");
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(1, index_rebuilds->Get());
+
+  ResetFileCache(kCleanIntervalMs, kTargetSize);
+  CheckPut("Name1", "Value1");
+  CheckPut("Name2", "Value2");
+  ResetFileCacheWithIndex(kCleanIntervalMs, kTargetSize, true);
+
+  // The snapshot only knows about "a", so looks to be well under target.
+  stats_.Clear();
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(0, index_rebuilds->Get());
+  EXPECT_EQ(0, cleanups_->Get());
+
+  // Once the snapshot is old enough it is rebuilt, finding all 13 bytes.
+  mock_timer_.AdvanceMs(FileCache::kIndexRebuildIntervalSec * Timer::kSecondMs);
+  EXPECT_TRUE(Clean(kTargetSize, 0));
+  EXPECT_EQ(1, index_rebuilds->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(2, evictions_->Get());
+  CheckNotFound("a");
+  CheckNotFound("Name1");
+  CheckGet("Name2", "Value2");
+}
+
 }  // namespace net_instaweb
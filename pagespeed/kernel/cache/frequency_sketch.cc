@@ -0,0 +1,199 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kCountersPerWord = 8;
+const int kMinCountersPerRow = 64;
+
+// Caps the table at 4 * 2^26 nibbles (128MB), which also keeps sample_size_
+// within an int32.
+const int kMaxCountersPerRowLog2 = 26;
+
+// How many increments, per counter in a row, between agings. TinyLFU
+// suggests sampling about 10 times as many accesses as the cache has
+// entries.
+const int kSampleFactor = 10;
+
+}  // namespace
+
+const int FrequencySketch::kDepth;
+const int FrequencySketch::kMaxCount;
+const int FrequencySketch::kHeaderWords;
+
+bool ParseCacheAdmissionPolicy(StringPiece value,
+                               CacheAdmissionPolicy* policy) {
+  if (StringCaseEqual(value, "lru")) {
+    *policy = kLruAdmission;
+  } else if (StringCaseEqual(value, "tinylfu")) {
+    *policy = kTinyLfuAdmission;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* CacheAdmissionPolicyName(CacheAdmissionPolicy policy) {
+  switch (policy) {
+    case kLruAdmission:
+      return "lru";
+    case kTinyLfuAdmission:
+      return "tinylfu";
+  }
+  return "";
+}
+
+FrequencySketch::FrequencySketch(int64 expected_entries) {
+  int32 counters = CountersPerRow(expected_entries);
+  owned_memory_.reset(new base::subtle::Atomic32[
+      kHeaderWords + kDepth * counters / kCountersPerWord]);
+  additions_ = owned_memory_.get();
+  table_ = additions_ + kHeaderWords;
+  row_mask_ = counters - 1;
+  words_per_row_ = counters / kCountersPerWord;
+  sample_size_ = kSampleFactor * counters;
+  Clear();
+}
+
+FrequencySketch::FrequencySketch(int64 expected_entries, char* memory) {
+  int32 counters = CountersPerRow(expected_entries);
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(memory) %
+            sizeof(base::subtle::Atomic32));
+  additions_ = reinterpret_cast<base::subtle::Atomic32*>(memory);
+  table_ = additions_ + kHeaderWords;
+  row_mask_ = counters - 1;
+  words_per_row_ = counters / kCountersPerWord;
+  sample_size_ = kSampleFactor * counters;
+}
+
+FrequencySketch::~FrequencySketch() {
+}
+
+int32 FrequencySketch::CountersPerRow(int64 expected_entries) {
+  int32 counters = kMinCountersPerRow;
+  while ((counters < expected_entries) &&
+         (counters < (1 << kMaxCountersPerRowLog2))) {
+    counters <<= 1;
+  }
+  return counters;
+}
+
+size_t FrequencySketch::RequiredSize(int64 expected_entries) {
+  int32 counters = CountersPerRow(expected_entries);
+  return sizeof(base::subtle::Atomic32) *
+      (kHeaderWords + kDepth * counters / kCountersPerWord);
+}
+
+void FrequencySketch::Clear() {
+  for (int i = 0, n = kDepth * words_per_row_; i < n; ++i) {
+    base::subtle::NoBarrier_Store(&table_[i], 0);
+  }
+  base::subtle::NoBarrier_Store(additions_, 0);
+}
+
+uint64 FrequencySketch::Mix(uint64 hash) {
+  // The finalizer from MurmurHash3, so that callers can pass in hashes
+  // whose low bits alone are not well distributed.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void FrequencySketch::Locate(uint64 mixed_hash, int row, int* word,
+                             int* shift) const {
+  // Each row rehashes with its own seed, so that keys colliding in one row
+  // are unlikely to collide in the others, even in small tables.
+  static const uint64 kSeeds[kDepth] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+    0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+  };
+  uint64 hash = (mixed_hash + kSeeds[row]) * kSeeds[row];
+  uint32 index = static_cast<uint32>(hash + (hash >> 32)) & row_mask_;
+  *word = row * words_per_row_ + index / kCountersPerWord;
+  *shift = 4 * (index % kCountersPerWord);
+}
+
+int FrequencySketch::Estimate(uint64 hash) const {
+  uint64 mixed = Mix(hash);
+  int estimate = kMaxCount;
+  for (int row = 0; row < kDepth; ++row) {
+    int word, shift;
+    Locate(mixed, row, &word, &shift);
+    uint32 value = base::subtle::NoBarrier_Load(&table_[word]);
+    estimate = std::min(estimate, static_cast<int>((value >> shift) & 0xf));
+  }
+  return estimate;
+}
+
+void FrequencySketch::Increment(uint64 hash) {
+  uint64 mixed = Mix(hash);
+  int words[kDepth], shifts[kDepth], counts[kDepth];
+  int min_count = kMaxCount;
+  for (int row = 0; row < kDepth; ++row) {
+    Locate(mixed, row, &words[row], &shifts[row]);
+    uint32 value = base::subtle::NoBarrier_Load(&table_[words[row]]);
+    counts[row] = (value >> shifts[row]) & 0xf;
+    min_count = std::min(min_count, counts[row]);
+  }
+  if (min_count == kMaxCount) {
+    return;
+  }
+
+  // Conservative update: only the counters that determine the estimate
+  // need to grow, which keeps keys sharing the other counters from being
+  // overestimated.
+  for (int row = 0; row < kDepth; ++row) {
+    if (counts[row] == min_count) {
+      base::subtle::Atomic32* cell = &table_[words[row]];
+      uint32 value = base::subtle::NoBarrier_Load(cell);
+      if (((value >> shifts[row]) & 0xf) != kMaxCount) {
+        base::subtle::NoBarrier_Store(
+            cell, static_cast<int32>(value + (1u << shifts[row])));
+      }
+    }
+  }
+
+  // Only the incrementer that hits the sample size exactly ages the table,
+  // so concurrent users do not halve it twice.
+  if (base::subtle::NoBarrier_AtomicIncrement(additions_, 1) == sample_size_) {
+    Age();
+  }
+}
+
+void FrequencySketch::Age() {
+  for (int i = 0, n = kDepth * words_per_row_; i < n; ++i) {
+    uint32 value = base::subtle::NoBarrier_Load(&table_[i]);
+    base::subtle::NoBarrier_Store(
+        &table_[i], static_cast<int32>((value >> 1) & 0x77777777u));
+  }
+  base::subtle::NoBarrier_AtomicIncrement(additions_, -sample_size_ / 2);
+}
+
+}  // namespace net_instaweb
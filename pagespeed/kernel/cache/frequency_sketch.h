@@ -0,0 +1,128 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+#define PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// How a cache decides whether to store a new entry when that requires
+// evicting others.
+enum CacheAdmissionPolicy {
+  kLruAdmission,      // Always store it, evicting least recently used entries.
+  kTinyLfuAdmission,  // Store it only if it is more popular than its victims,
+                      // as estimated by a FrequencySketch.
+};
+
+// Parses "lru" or "tinylfu" (case-insensitively) into *policy, returning
+// false for anything else.
+bool ParseCacheAdmissionPolicy(StringPiece value, CacheAdmissionPolicy* policy);
+
+// Returns the name of the policy as accepted by ParseCacheAdmissionPolicy.
+const char* CacheAdmissionPolicyName(CacheAdmissionPolicy policy);
+
+// Compact count-min sketch estimating how often keys have been accessed
+// recently, as used by TinyLFU-style cache admission: when inserting a key
+// would evict another, the insertion is only worthwhile if the new key has
+// been accessed more often than the one it would displace.
+//
+// The sketch has kDepth rows of 4-bit saturating counters, 8 to a 32-bit
+// word, and uses conservative updates (only the smallest of a key's counters
+// are bumped). Once the number of increments reaches sample_size(), every
+// counter is halved so that the estimates track recent popularity rather
+// than all-time popularity.
+//
+// The sketch may live in memory it owns, or in a caller-provided region
+// (e.g. shared memory), in which case all of its state is kept in that
+// region. Concurrent use is safe but lossy: simultaneous increments of the
+// same word may drop one of them, which only makes the estimates slightly
+// less accurate.
+class FrequencySketch {
+ public:
+  static const int kDepth = 4;
+  static const int kMaxCount = 15;
+
+  // Creates a sketch sized for a cache holding about expected_entries
+  // entries, in memory owned by the sketch.
+  explicit FrequencySketch(int64 expected_entries);
+
+  // Creates a sketch in 'memory', which must be at least
+  // RequiredSize(expected_entries) bytes and 4-byte aligned, and must
+  // outlive the sketch. The region is not initialized; exactly one of the
+  // processes sharing it should call Clear() before use.
+  FrequencySketch(int64 expected_entries, char* memory);
+
+  ~FrequencySketch();
+
+  // Number of bytes needed for a sketch for expected_entries entries.
+  static size_t RequiredSize(int64 expected_entries);
+
+  // Forgets all counts.
+  void Clear();
+
+  // Records an access to the key with the given hash.
+  void Increment(uint64 hash);
+
+  // Returns the estimated number of recent accesses to the key with the
+  // given hash, in [0, kMaxCount]. The estimate may be too high, but is
+  // never too low (modulo aging and lost concurrent updates).
+  int Estimate(uint64 hash) const;
+
+  // Returns whether a key with candidate_hash should be admitted into the
+  // cache at the cost of evicting the key with victim_hash.
+  bool Admit(uint64 candidate_hash, uint64 victim_hash) const {
+    return Estimate(candidate_hash) > Estimate(victim_hash);
+  }
+
+  int32 sample_size() const { return sample_size_; }
+  int32 counters_per_row() const { return row_mask_ + 1; }
+
+ private:
+  // Halves every counter; called each time sample_size_ increments have
+  // been recorded.
+  void Age();
+
+  // Computes the index of the word and the shift of the nibble holding the
+  // hash's counter in the given row.
+  void Locate(uint64 mixed_hash, int row, int* word, int* shift) const;
+
+  static uint64 Mix(uint64 hash);
+  static int32 CountersPerRow(int64 expected_entries);
+
+  // Position of the first counter word in memory; the words before it hold
+  // the increment count.
+  static const int kHeaderWords = 2;
+
+  uint32 row_mask_;
+  int words_per_row_;
+  int32 sample_size_;
+  base::subtle::Atomic32* additions_;
+  base::subtle::Atomic32* table_;
+  scoped_array<base::subtle::Atomic32> owned_memory_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrequencySketch);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
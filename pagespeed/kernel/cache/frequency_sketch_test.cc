@@ -0,0 +1,111 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the frequency sketch used for cache admission.
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class FrequencySketchTest : public testing::Test {
+ protected:
+  FrequencySketchTest() : sketch_(100) {}
+
+  void IncrementTimes(uint64 hash, int times) {
+    for (int i = 0; i < times; ++i) {
+      sketch_.Increment(hash);
+    }
+  }
+
+  FrequencySketch sketch_;
+};
+
+TEST_F(FrequencySketchTest, Sizing) {
+  EXPECT_EQ(128, sketch_.counters_per_row());
+  EXPECT_EQ(1280, sketch_.sample_size());
+  FrequencySketch tiny(0);
+  EXPECT_EQ(64, tiny.counters_per_row());
+  // 2 header words plus 4 rows of 128 nibbles.
+  EXPECT_EQ(8u + 256u, FrequencySketch::RequiredSize(100));
+}
+
+TEST_F(FrequencySketchTest, CountsAndSaturates) {
+  EXPECT_EQ(0, sketch_.Estimate(1));
+  IncrementTimes(1, 3);
+  IncrementTimes(2, 1);
+  EXPECT_EQ(3, sketch_.Estimate(1));
+  EXPECT_EQ(1, sketch_.Estimate(2));
+  EXPECT_EQ(0, sketch_.Estimate(3));
+  EXPECT_TRUE(sketch_.Admit(1, 2));
+  EXPECT_FALSE(sketch_.Admit(2, 1));
+  EXPECT_FALSE(sketch_.Admit(3, 3));  // Ties keep the incumbent.
+
+  IncrementTimes(1, 100);
+  EXPECT_EQ(FrequencySketch::kMaxCount, sketch_.Estimate(1));
+
+  sketch_.Clear();
+  EXPECT_EQ(0, sketch_.Estimate(1));
+}
+
+TEST_F(FrequencySketchTest, Aging) {
+  IncrementTimes(1, 8);
+  for (int i = 8; i < sketch_.sample_size() - 1; ++i) {
+    sketch_.Increment(1000 + i);
+  }
+  // Other keys may share some of hash 1's counters, but nothing has been
+  // halved yet.
+  int before = sketch_.Estimate(1);
+  EXPECT_LE(8, before);
+
+  // Reaching the sample size halves all counts.
+  sketch_.Increment(5000000);
+  int after = sketch_.Estimate(1);
+  EXPECT_LE(before / 2, after);
+  EXPECT_GE((before + 1) / 2, after);
+}
+
+TEST_F(FrequencySketchTest, ExternalMemory) {
+  scoped_array<char> memory(new char[FrequencySketch::RequiredSize(100)]);
+  FrequencySketch writer(100, memory.get());
+  writer.Clear();
+  writer.Increment(42);
+  writer.Increment(42);
+
+  // A second sketch over the same memory sees the counts.
+  FrequencySketch reader(100, memory.get());
+  EXPECT_EQ(2, reader.Estimate(42));
+}
+
+TEST_F(FrequencySketchTest, ParsePolicy) {
+  CacheAdmissionPolicy policy = kLruAdmission;
+  EXPECT_TRUE(ParseCacheAdmissionPolicy("TinyLFU", &policy));
+  EXPECT_EQ(kTinyLfuAdmission, policy);
+  EXPECT_STREQ("tinylfu", CacheAdmissionPolicyName(policy));
+  EXPECT_TRUE(ParseCacheAdmissionPolicy("lru", &policy));
+  EXPECT_EQ(kLruAdmission, policy);
+  EXPECT_FALSE(ParseCacheAdmissionPolicy("lfu", &policy));
+  EXPECT_EQ(kLruAdmission, policy);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -22,12 +22,14 @@
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 
 namespace net_instaweb {
 
 LRUCache::LRUCache(size_t max_size)
     : base_(max_size, &value_helper_),
-      is_healthy_(true) {
+      is_healthy_(true),
+      admission_policy_(kLruAdmission) {
   ClearStats();
 }
 
@@ -35,6 +37,17 @@ LRUCache::~LRUCache() {
   Clear();
 }
 
+void LRUCache::set_admission_policy(CacheAdmissionPolicy policy) {
+  admission_policy_ = policy;
+  if (policy == kTinyLfuAdmission) {
+    admission_sketch_.reset(new FrequencySketch(
+        base_.max_bytes_in_cache() / kExpectedEntryBytes));
+  } else {
+    admission_sketch_.reset(NULL);
+  }
+  base_.set_admission_sketch(admission_sketch_.get());
+}
+
 void LRUCache::Get(const GoogleString& key, Callback* callback) {
   if (!is_healthy_) {
     ValidateAndReportResult(key, kNotFound, callback);
@@ -22,9 +22,11 @@
 #include <cstddef>
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/cache/lru_cache_base.h"
 
 namespace net_instaweb {
@@ -43,9 +45,19 @@ namespace net_instaweb {
 // should be added.
 class LRUCache : public CacheInterface {
  public:
+  // Entry size assumed when sizing the frequency sketch used for
+  // kTinyLfuAdmission, since the cache itself is only bounded in bytes.
+  static const size_t kExpectedEntryBytes = 512;
+
   explicit LRUCache(size_t max_size);
   virtual ~LRUCache();
 
+  // Selects how new entries compete with existing ones when the cache is
+  // full; see LRUCacheBase. Defaults to kLruAdmission. Switching to
+  // kTinyLfuAdmission starts from an empty frequency sketch.
+  void set_admission_policy(CacheAdmissionPolicy policy);
+  CacheAdmissionPolicy admission_policy() const { return admission_policy_; }
+
   virtual void Get(const GoogleString& key, Callback* callback);
 
   // Puts an object into the cache, sharing the bytes.
@@ -78,6 +90,9 @@ class LRUCache : public CacheInterface {
     return base_.num_identical_reinserts();
   }
   size_t num_deletes() const { return base_.num_deletes(); }
+  size_t num_admission_rejections() const {
+    return base_.num_admission_rejections();
+  }
 
   // Sanity check the cache data structures.
   void SanityCheck() { base_.SanityCheck(); }
@@ -116,6 +131,8 @@ class LRUCache : public CacheInterface {
   Base base_;
   bool is_healthy_;
   SharedStringHelper value_helper_;
+  CacheAdmissionPolicy admission_policy_;
+  scoped_ptr<FrequencySketch> admission_sketch_;
 
   DISALLOW_COPY_AND_ASSIGN(LRUCache);
 };
@@ -28,6 +28,7 @@
 #include "pagespeed/kernel/base/rde_hash_map.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 
 
 namespace net_instaweb {
@@ -55,6 +56,12 @@ namespace net_instaweb {
 //                      const ValueType& new_value) const;
 //
 // ValueType must support copy-construction and assign-by-value.
+//
+// By default new entries always displace the least recently used ones. If a
+// FrequencySketch is supplied with set_admission_sketch, lookups are counted
+// in it and a new key is only inserted if it has been looked up more often
+// than every entry it would evict (TinyLFU admission), so that a burst of
+// keys that are only ever used once cannot flush out popular entries.
 template<class ValueType, class ValueHelper>
 class LRUCacheBase {
   typedef std::pair<GoogleString, ValueType> KeyValuePair;
@@ -93,7 +100,8 @@ class LRUCacheBase {
   LRUCacheBase(size_t max_size, ValueHelper* value_helper)
       : max_bytes_in_cache_(max_size),
         current_bytes_in_cache_(0),
-        value_helper_(value_helper) {
+        value_helper_(value_helper),
+        admission_sketch_(NULL) {
     ClearStats();
   }
   ~LRUCacheBase() {
@@ -107,11 +115,18 @@ class LRUCacheBase {
     max_bytes_in_cache_ = max_size;
   }
 
+  // Enables TinyLFU admission using the passed-in sketch, which must outlive
+  // this object, or goes back to plain LRU if sketch is NULL.
+  void set_admission_sketch(FrequencySketch* sketch) {
+    admission_sketch_ = sketch;
+  }
+
   // Returns a pointer to the stored value, or NULL if not found, freshening
   // the entry in the lru-list.  Note: this pointer is safe to use until the
   // next call to Put or Delete in the cache.
   ValueType* GetFreshen(const GoogleString& key) {
     ValueType* value = NULL;
+    RecordAccess(key);
     typename Map::iterator p = map_.find(key);
     if (p != map_.end()) {
       ListNode cell = p->second;
@@ -131,6 +146,7 @@ class LRUCacheBase {
 
   ValueType* GetNoFreshen(const GoogleString& key) const {
     ValueType* value = NULL;
+    RecordAccess(key);
     typename Map::const_iterator p = map_.find(key);
     if (p != map_.end()) {
       ListNode cell = p->second;
@@ -188,8 +204,12 @@ class LRUCacheBase {
       // is removed from the list, so we can treat replacements and new
       // insertions the same way.  In both cases, the new key is in the map
       // as a result of the call to map_.insert above.
-
-      if (EvictIfNecessary(key.size() + value_helper_->size(*new_value))) {
+      size_t bytes_needed = key.size() + value_helper_->size(*new_value);
+      if (!found && !Admit(key, bytes_needed)) {
+        // The new key is less popular than what it would displace.
+        map_.erase(map_iter);
+        ++num_admission_rejections_;
+      } else if (EvictIfNecessary(bytes_needed)) {
         // The new value fits.  Put it in the LRU-list.
         KeyValuePair* kvp = new KeyValuePair(map_iter->first, *new_value);
         lru_ordered_list_.push_front(kvp);
@@ -238,6 +258,7 @@ class LRUCacheBase {
     num_inserts_ += src.num_inserts_;
     num_identical_reinserts_ += src.num_identical_reinserts_;
     num_deletes_ += src.num_deletes_;
+    num_admission_rejections_ += src.num_admission_rejections_;
   }
 
   // Total size in bytes of keys and values stored.
@@ -255,6 +276,7 @@ class LRUCacheBase {
   size_t num_inserts() const { return num_inserts_; }
   size_t num_identical_reinserts() const { return num_identical_reinserts_; }
   size_t num_deletes() const { return num_deletes_; }
+  size_t num_admission_rejections() const { return num_admission_rejections_; }
 
   // Sanity check the cache data structures.
   void SanityCheck() {
@@ -307,6 +329,7 @@ class LRUCacheBase {
     num_inserts_ = 0;
     num_identical_reinserts_ = 0;
     num_deletes_ = 0;
+    num_admission_rejections_ = 0;
   }
 
   // Iterators for walking cache entries from oldest to youngest.
@@ -341,6 +364,37 @@ class LRUCacheBase {
     ++num_deletes_;
   }
 
+  static uint64 KeyHash(const GoogleString& key) {
+    return HashString<CasePreserve, uint64>(key.data(), key.size());
+  }
+
+  void RecordAccess(const GoogleString& key) const {
+    if (admission_sketch_ != NULL) {
+      admission_sketch_->Increment(KeyHash(key));
+    }
+  }
+
+  // Returns whether a new entry for key, taking bytes_needed, should be
+  // inserted given the entries EvictIfNecessary would evict for it.
+  bool Admit(const GoogleString& key, size_t bytes_needed) const {
+    if ((admission_sketch_ == NULL) || (bytes_needed >= max_bytes_in_cache_)) {
+      return true;
+    }
+    uint64 candidate = KeyHash(key);
+    size_t bytes_in_cache = current_bytes_in_cache_;
+    for (typename EntryList::const_reverse_iterator
+             victim = lru_ordered_list_.rbegin(),
+             e = lru_ordered_list_.rend();
+         (victim != e) && (bytes_needed + bytes_in_cache > max_bytes_in_cache_);
+         ++victim) {
+      if (!admission_sketch_->Admit(candidate, KeyHash((*victim)->first))) {
+        return false;
+      }
+      bytes_in_cache -= EntrySize(*victim);
+    }
+    return true;
+  }
+
   bool EvictIfNecessary(size_t bytes_needed) {
     bool ret = false;
     if (bytes_needed < max_bytes_in_cache_) {
@@ -369,9 +423,11 @@ class LRUCacheBase {
   size_t num_inserts_;
   size_t num_identical_reinserts_;
   size_t num_deletes_;
+  size_t num_admission_rejections_;
   EntryList lru_ordered_list_;
   Map map_;
   ValueHelper* value_helper_;
+  FrequencySketch* admission_sketch_;
 
   DISALLOW_COPY_AND_ASSIGN(LRUCacheBase);
 };
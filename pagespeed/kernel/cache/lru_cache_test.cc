@@ -179,4 +179,54 @@ TEST_F(LRUCacheTest, MultiGet) {
   TestMultiGet();
 }
 
+TEST_F(LRUCacheTest, TinyLfuResistsScan) {
+  cache_.set_admission_policy(kTinyLfuAdmission);
+
+  // Fill the cache with 10 entries that are each read a few times.
+  GoogleString keys[10], values[10];
+  for (int i = 0; i < 10; ++i) {
+    SStringPrintf(&keys[i], "name%d", i);
+    SStringPrintf(&values[i], "valu%d", i);
+    CheckPut(keys[i], values[i]);
+  }
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int i = 0; i < 10; ++i) {
+      CheckGet(keys[i], values[i]);
+    }
+  }
+  EXPECT_EQ(kMaxSize, cache_.size_bytes());
+
+  // A scan of keys that are looked up once and then inserted does not
+  // displace anything.
+  for (int i = 0; i < 20; ++i) {
+    GoogleString key = StringPrintf("scan%d", i);
+    CheckNotFound(key.c_str());
+    CheckPut(key, "value");
+  }
+  EXPECT_EQ(static_cast<size_t>(20), cache_.num_admission_rejections());
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_evictions());
+  for (int i = 0; i < 10; ++i) {
+    CheckGet(keys[i], values[i]);
+  }
+
+  // A key that becomes more popular than the LRU victim gets in.
+  for (int i = 0; i < 6; ++i) {
+    CheckNotFound("nameA");
+  }
+  CheckPut("nameA", "valuA");
+  CheckGet("nameA", "valuA");
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_evictions());
+  CheckNotFound("name0");
+
+  // Rewriting an existing key is never subject to admission.
+  CheckPut("name1", "VALU1");
+  CheckGet("name1", "VALU1");
+  EXPECT_EQ(static_cast<size_t>(20), cache_.num_admission_rejections());
+
+  // Plain LRU admits everything again.
+  cache_.set_admission_policy(kLruAdmission);
+  CheckPut("scan0", "value");
+  CheckGet("scan0", "value");
+}
+
 }  // namespace net_instaweb
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/sequenced_callback_cache.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+
+namespace net_instaweb {
+
+// Captures the result on the underlying cache's thread and queues the
+// client's callback in the sequence.
+class SequencedCallbackCache::SequencedCallback
+    : public CacheInterface::Callback {
+ public:
+  SequencedCallback(SequencedCallbackCache* cache, const GoogleString& key,
+                    Callback* callback)
+      : cache_(cache),
+        key_(key),
+        callback_(callback),
+        state_(CacheInterface::kNotFound) {
+  }
+
+  const GoogleString& key() const { return key_; }
+  Callback* callback() const { return callback_; }
+  CacheInterface::KeyState state() const { return state_; }
+
+ protected:
+  // The client's callback gets to validate the value in the sequence, so
+  // take the first candidate offered.
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    return true;
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    state_ = state;
+    cache_->sequence_->Add(
+        MakeFunction(cache_, &SequencedCallbackCache::ReportResult,
+                     &SequencedCallbackCache::CancelResult, this));
+  }
+
+ private:
+  SequencedCallbackCache* cache_;
+  GoogleString key_;
+  Callback* callback_;
+  CacheInterface::KeyState state_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequencedCallback);
+};
+
+SequencedCallbackCache::SequencedCallbackCache(CacheInterface* cache,
+                                               QueuedWorkerPool* pool)
+    : cache_(cache),
+      sequence_(pool->NewSequence()) {
+}
+
+SequencedCallbackCache::~SequencedCallbackCache() {
+}
+
+GoogleString SequencedCallbackCache::FormatName(StringPiece cache) {
+  return StrCat("SequencedCallback(", cache, ")");
+}
+
+void SequencedCallbackCache::Get(const GoogleString& key,
+                                 Callback* callback) {
+  cache_->Get(key, new SequencedCallback(this, key, callback));
+}
+
+void SequencedCallbackCache::MultiGet(MultiGetRequest* request) {
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    key_callback->callback = new SequencedCallback(this, key_callback->key,
+                                                   key_callback->callback);
+  }
+  cache_->MultiGet(request);
+}
+
+void SequencedCallbackCache::ReportResult(SequencedCallback* sequenced) {
+  Callback* callback = sequenced->callback();
+  *callback->value() = *sequenced->value();
+  ValidateAndReportResult(sequenced->key(), sequenced->state(), callback);
+  delete sequenced;
+}
+
+void SequencedCallbackCache::CancelResult(SequencedCallback* sequenced) {
+  ValidateAndReportResult(sequenced->key(), CacheInterface::kNotFound,
+                          sequenced->callback());
+  delete sequenced;
+}
+
+void SequencedCallbackCache::Put(const GoogleString& key,
+                                 SharedString* value) {
+  cache_->Put(key, value);
+}
+
+void SequencedCallbackCache::Delete(const GoogleString& key) {
+  cache_->Delete(key);
+}
+
+}  // namespace net_instaweb
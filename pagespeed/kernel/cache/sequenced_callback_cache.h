@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_SEQUENCED_CALLBACK_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_SEQUENCED_CALLBACK_CACHE_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+
+namespace net_instaweb {
+
+class SharedString;
+
+// Moves the callbacks of a non-blocking cache off the thread it calls them
+// on and into a QueuedWorkerPool::Sequence.  This is for caches such as
+// BinaryMemCache that call back from a private event thread: were client
+// code to run there, a callback doing a blocking lookup in the same cache
+// would wait forever on the one thread that could answer it.
+//
+// Only the result is captured on the underlying cache's thread; the client's
+// ValidateCandidate and Done both run in the sequence.  Each lookup thus
+// takes the first candidate the underlying cache offers, so it should not
+// be a multi-level cache.  Puts and Deletes are passed straight through.
+class SequencedCallbackCache : public CacheInterface {
+ public:
+  // Does not take ownership of the cache or the pool.
+  SequencedCallbackCache(CacheInterface* cache, QueuedWorkerPool* pool);
+  virtual ~SequencedCallbackCache();
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  virtual void MultiGet(MultiGetRequest* request);
+  static GoogleString FormatName(StringPiece cache);
+  virtual GoogleString Name() const { return FormatName(cache_->Name()); }
+  virtual bool IsBlocking() const { return false; }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+  virtual bool MustEncodeKeyInValueOnPut() const {
+    return cache_->MustEncodeKeyInValueOnPut();
+  }
+  virtual void PutWithKeyInValue(const GoogleString& key,
+                                 SharedString* key_and_value) {
+    cache_->PutWithKeyInValue(key, key_and_value);
+  }
+
+ private:
+  class SequencedCallback;
+
+  // Runs in sequence_ to hand the result captured by 'sequenced' to the
+  // client's callback.  Canceling reports kNotFound instead.
+  void ReportResult(SequencedCallback* sequenced);
+  void CancelResult(SequencedCallback* sequenced);
+
+  CacheInterface* cache_;
+  QueuedWorkerPool::Sequence* sequence_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequencedCallbackCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_SEQUENCED_CALLBACK_CACHE_H_
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Unit-test SequencedCallbackCache, layered over an AsyncCache whose worker
+// stands in for the event thread of a non-blocking cache.
+
+#include "pagespeed/kernel/cache/sequenced_callback_cache.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/async_cache.h"
+#include "pagespeed/kernel/cache/blocking_cache.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const size_t kMaxSize = 100;
+
+class SequencedCallbackCacheTest : public CacheTestBase {
+ protected:
+  class SyncPointCallback : public CacheTestBase::Callback {
+   public:
+    explicit SyncPointCallback(SequencedCallbackCacheTest* test)
+        : Callback(test),
+          sync_point_(test->thread_system_.get()) {
+    }
+
+    virtual void Done(CacheInterface::KeyState state) {
+      Callback::Done(state);
+      sync_point_.Notify();
+    }
+
+    virtual void Wait() { sync_point_.Wait(); }
+
+   private:
+    WorkerTestBase::SyncPoint sync_point_;
+  };
+
+  // Once its own lookup is done, looks up another key in the blocking
+  // cache, as a client of both memcached interfaces might.
+  class NestedGetCallback : public SyncPointCallback {
+   public:
+    NestedGetCallback(SequencedCallbackCacheTest* test,
+                      const GoogleString& inner_key)
+        : SyncPointCallback(test),
+          cache_(&test->blocking_cache_),
+          inner_key_(inner_key) {
+    }
+
+    virtual void Done(CacheInterface::KeyState state) {
+      cache_->Get(inner_key_, &inner_);
+      SyncPointCallback::Done(state);
+    }
+
+    CacheTestBase::Callback* inner() { return &inner_; }
+
+   private:
+    CacheInterface* cache_;
+    GoogleString inner_key_;
+    CacheTestBase::Callback inner_;
+
+    DISALLOW_COPY_AND_ASSIGN(NestedGetCallback);
+  };
+
+  SequencedCallbackCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        lru_cache_(kMaxSize),
+        threadsafe_cache_(&lru_cache_, thread_system_->NewMutex()),
+        cache_pool_(1, "cache", thread_system_.get()),
+        callback_pool_(1, "callback", thread_system_.get()),
+        async_cache_(&threadsafe_cache_, &cache_pool_),
+        sequenced_cache_(&async_cache_, &callback_pool_),
+        blocking_cache_(&async_cache_, thread_system_.get()) {
+    set_mutex(thread_system_->NewMutex());
+  }
+
+  ~SequencedCallbackCacheTest() {
+    cache_pool_.ShutDown();
+    callback_pool_.ShutDown();
+  }
+
+  virtual CacheInterface* Cache() { return &sequenced_cache_; }
+  virtual Callback* NewCallback() { return new SyncPointCallback(this); }
+
+  virtual void PostOpCleanup() {
+    // Puts are not blocking, so let them land before the next lookup.
+    while (async_cache_.outstanding_operations() != 0) {
+      timer_->SleepMs(1);
+    }
+  }
+
+  virtual void SetUp() {
+    timer_.reset(thread_system_->NewTimer());
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  LRUCache lru_cache_;
+  ThreadsafeCache threadsafe_cache_;
+  QueuedWorkerPool cache_pool_;
+  QueuedWorkerPool callback_pool_;
+  AsyncCache async_cache_;
+  SequencedCallbackCache sequenced_cache_;
+  BlockingCache blocking_cache_;
+};
+
+TEST_F(SequencedCallbackCacheTest, PutGetDelete) {
+  EXPECT_FALSE(sequenced_cache_.IsBlocking());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(SequencedCallbackCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(SequencedCallbackCacheTest, InvalidValueNotFound) {
+  CheckPut("Name", "Value");
+  set_invalid_value("Value");
+  CheckNotFound("Name");
+}
+
+// The AsyncCache's single worker serves both lookups, so were the outer
+// callback run on it, the inner one could never be served.
+TEST_F(SequencedCallbackCacheTest, CallbackDoesBlockingGet) {
+  CheckPut("Outer", "Outer Value");
+  CheckPut("Inner", "Inner Value");
+  NestedGetCallback callback(this, "Inner");
+  sequenced_cache_.Get("Outer", &callback);
+  callback.Wait();
+  ASSERT_TRUE(callback.called());
+  EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+  EXPECT_EQ("Outer Value", callback.value_str());
+  ASSERT_TRUE(callback.inner()->called());
+  EXPECT_EQ(CacheInterface::kAvailable, callback.inner()->state());
+  EXPECT_EQ("Inner Value", callback.inner()->value_str());
+}
+
+TEST_F(SequencedCallbackCacheTest, Name) {
+  EXPECT_EQ("SequencedCallback(Async(ThreadsafeCache(LRUCache)))",
+            sequenced_cache_.Name());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/tiered_cache.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kMemoryHits[] = "tiered_cache_memory_hits";
+const char kMemoryHitBytes[] = "tiered_cache_memory_hit_bytes";
+const char kDiskHits[] = "tiered_cache_disk_hits";
+const char kDiskHitBytes[] = "tiered_cache_disk_hit_bytes";
+const char kMisses[] = "tiered_cache_misses";
+const char kMemoryInserts[] = "tiered_cache_memory_inserts";
+const char kMemoryInsertBytes[] = "tiered_cache_memory_insert_bytes";
+const char kDiskInserts[] = "tiered_cache_disk_inserts";
+const char kDiskInsertBytes[] = "tiered_cache_disk_insert_bytes";
+const char kPromotions[] = "tiered_cache_promotions";
+const char kDemotions[] = "tiered_cache_demotions";
+
+}  // namespace
+
+// Looks the key up in memory, then on disk, and reports the outcome to the
+// TieredCache before passing it on.
+class TieredCache::TieredCallback : public CacheInterface::Callback {
+ public:
+  TieredCallback(TieredCache* cache, const GoogleString& key,
+                 CacheInterface::Callback* callback)
+      : cache_(cache),
+        key_(key),
+        callback_(callback),
+        trying_disk_(false),
+        candidate_size_(0) {
+    // The memory tier can lend us its value as long as the callback we wrap
+    // can take it.
+    set_accepts_borrowed_value(callback->accepts_borrowed_value());
+  }
+
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    candidate_size_ = ValueView().size();
+    if (has_borrowed_value()) {
+      return callback_->DelegatedValidateBorrowedCandidate(key, state,
+                                                           ValueView());
+    }
+    *callback_->value() = *value();
+    return callback_->DelegatedValidateCandidate(key, state);
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    if (state == CacheInterface::kAvailable) {
+      cache_->RecordHit(trying_disk_, key_, candidate_size_, value());
+    } else if (!trying_disk_) {
+      trying_disk_ = true;
+      // A disk hit may get promoted, which needs a copy of the value.
+      set_accepts_borrowed_value(false);
+      cache_->disk_->Get(key_, this);
+      return;
+    } else {
+      cache_->RecordMiss();
+    }
+    callback_->DelegatedDone(state);
+    delete this;
+  }
+
+ private:
+  TieredCache* cache_;
+  GoogleString key_;
+  CacheInterface::Callback* callback_;
+  bool trying_disk_;
+  size_t candidate_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(TieredCallback);
+};
+
+TieredCache::TieredCache(CacheInterface* memory, CacheInterface* disk,
+                         size_t memory_value_limit, FrequencySketch* sketch,
+                         Statistics* stats)
+    : memory_(memory),
+      disk_(disk),
+      memory_value_limit_(memory_value_limit),
+      promotion_threshold_(kDefaultPromotionThreshold),
+      account_for_key_size_(true),
+      sketch_(sketch),
+      memory_hits_(stats->GetVariable(kMemoryHits)),
+      memory_hit_bytes_(stats->GetVariable(kMemoryHitBytes)),
+      disk_hits_(stats->GetVariable(kDiskHits)),
+      disk_hit_bytes_(stats->GetVariable(kDiskHitBytes)),
+      misses_(stats->GetVariable(kMisses)),
+      memory_inserts_(stats->GetVariable(kMemoryInserts)),
+      memory_insert_bytes_(stats->GetVariable(kMemoryInsertBytes)),
+      disk_inserts_(stats->GetVariable(kDiskInserts)),
+      disk_insert_bytes_(stats->GetVariable(kDiskInsertBytes)),
+      promotions_(stats->GetVariable(kPromotions)),
+      demotions_(stats->GetVariable(kDemotions)) {
+}
+
+TieredCache::~TieredCache() {
+}
+
+void TieredCache::InitStats(Statistics* stats) {
+  stats->AddVariable(kMemoryHits);
+  stats->AddVariable(kMemoryHitBytes);
+  stats->AddVariable(kDiskHits);
+  stats->AddVariable(kDiskHitBytes);
+  stats->AddVariable(kMisses);
+  stats->AddVariable(kMemoryInserts);
+  stats->AddVariable(kMemoryInsertBytes);
+  stats->AddVariable(kDiskInserts);
+  stats->AddVariable(kDiskInsertBytes);
+  stats->AddVariable(kPromotions);
+  stats->AddVariable(kDemotions);
+}
+
+GoogleString TieredCache::DumpStats(Statistics* stats) {
+  GoogleString out;
+  StrAppend(&out, "memory: ",
+            Integer64ToString(stats->GetVariable(kMemoryHits)->Get()),
+            " hits (",
+            Integer64ToString(stats->GetVariable(kMemoryHitBytes)->Get()),
+            " bytes), ");
+  StrAppend(&out,
+            Integer64ToString(stats->GetVariable(kMemoryInserts)->Get()),
+            " inserts (",
+            Integer64ToString(stats->GetVariable(kMemoryInsertBytes)->Get()),
+            " bytes)\n");
+  StrAppend(&out, "disk: ",
+            Integer64ToString(stats->GetVariable(kDiskHits)->Get()),
+            " hits (",
+            Integer64ToString(stats->GetVariable(kDiskHitBytes)->Get()),
+            " bytes), ");
+  StrAppend(&out,
+            Integer64ToString(stats->GetVariable(kDiskInserts)->Get()),
+            " inserts (",
+            Integer64ToString(stats->GetVariable(kDiskInsertBytes)->Get()),
+            " bytes)\n");
+  StrAppend(&out, "misses: ",
+            Integer64ToString(stats->GetVariable(kMisses)->Get()),
+            ", promotions: ",
+            Integer64ToString(stats->GetVariable(kPromotions)->Get()),
+            ", demotions: ",
+            Integer64ToString(stats->GetVariable(kDemotions)->Get()), "\n");
+  return out;
+}
+
+GoogleString TieredCache::FormatName(StringPiece memory, StringPiece disk) {
+  return StrCat("Tiered(memory=", memory, ",disk=", disk, ")");
+}
+
+uint64 TieredCache::KeyHash(const GoogleString& key) {
+  return HashString<CasePreserve, uint64>(key.data(), key.size());
+}
+
+bool TieredCache::FitsInMemory(const GoogleString& key,
+                               const SharedString& value) const {
+  size_t size = value.size();
+  if (account_for_key_size_) {
+    size += key.size();
+  }
+  return size <= memory_value_limit_;
+}
+
+bool TieredCache::IsPopular(const GoogleString& key) const {
+  return sketch_->Estimate(KeyHash(key)) >= promotion_threshold_;
+}
+
+void TieredCache::Get(const GoogleString& key, Callback* callback) {
+  sketch_->Increment(KeyHash(key));
+  memory_->Get(key, new TieredCallback(this, key, callback));
+}
+
+void TieredCache::RecordHit(bool from_disk, const GoogleString& key,
+                            size_t size, SharedString* value) {
+  if (!from_disk) {
+    memory_hits_->Add(1);
+    memory_hit_bytes_->Add(size);
+    return;
+  }
+  disk_hits_->Add(1);
+  disk_hit_bytes_->Add(size);
+  if (FitsInMemory(key, *value) && IsPopular(key)) {
+    // The disk copy stays, so nothing is lost if memory evicts it again.
+    promotions_->Add(1);
+    PutInMemory(key, value);
+  }
+}
+
+void TieredCache::RecordMiss() {
+  misses_->Add(1);
+}
+
+void TieredCache::Put(const GoogleString& key, SharedString* value) {
+  if (!FitsInMemory(key, *value)) {
+    memory_->Delete(key);
+    PutOnDisk(key, value);
+  } else if (IsPopular(key)) {
+    PutInMemory(key, value);
+    PutOnDisk(key, value);
+  } else {
+    demotions_->Add(1);
+    memory_->Delete(key);
+    PutOnDisk(key, value);
+  }
+}
+
+void TieredCache::PutInMemory(const GoogleString& key, SharedString* value) {
+  memory_inserts_->Add(1);
+  memory_insert_bytes_->Add(value->size());
+  memory_->Put(key, value);
+}
+
+void TieredCache::PutOnDisk(const GoogleString& key, SharedString* value) {
+  disk_inserts_->Add(1);
+  disk_insert_bytes_->Add(value->size());
+  disk_->Put(key, value);
+}
+
+void TieredCache::Delete(const GoogleString& key) {
+  memory_->Delete(key);
+  disk_->Delete(key);
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_TIERED_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_TIERED_CACHE_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class FrequencySketch;
+class SharedString;
+class Statistics;
+class Variable;
+
+// Splits entries between a small, fast memory tier, such as a
+// SharedMemCache, and a large disk tier, such as a FileCache, by size and
+// popularity, so that the memory tier holds the hot working set:
+//
+//  - Values too big for the memory tier only go to disk.
+//  - Other values go to memory if their key has been read at least
+//    promotion_threshold() times recently, and otherwise are demoted to
+//    disk only.
+//  - A disk hit on a key that has become popular promotes the value into
+//    memory.
+//
+// Popularity is estimated with a FrequencySketch of this process's reads,
+// which all the TieredCaches in front of the same memory tier should share,
+// so that they agree on what is hot.  Every value also goes to disk: the
+// memory tier may be shared with other processes and only knows hashes of
+// its keys, so there is no way to demote what it evicts, but with a copy on
+// disk those evictions lose nothing.
+class TieredCache : public CacheInterface {
+ public:
+  static const int kDefaultPromotionThreshold = 2;
+
+  // Does not take ownership of the caches, sketch or stats.
+  // memory_value_limit is the largest value, counting the key unless
+  // set_account_for_key_size is turned off, that is put in the memory tier.
+  // The sketch should be sized for the number of entries the memory tier
+  // holds.
+  TieredCache(CacheInterface* memory, CacheInterface* disk,
+              size_t memory_value_limit, FrequencySketch* sketch,
+              Statistics* stats);
+  virtual ~TieredCache();
+
+  static void InitStats(Statistics* stats);
+
+  // Returns a plain-text summary of the tier statistics.
+  static GoogleString DumpStats(Statistics* stats);
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  virtual GoogleString Name() const {
+    return FormatName(memory_->Name(), disk_->Name());
+  }
+  static GoogleString FormatName(StringPiece memory, StringPiece disk);
+  virtual bool IsBlocking() const {
+    // We can fulfill our guarantee only if both caches block.
+    return memory_->IsBlocking() && disk_->IsBlocking();
+  }
+  virtual bool IsHealthy() const {
+    return memory_->IsHealthy() && disk_->IsHealthy();
+  }
+  virtual void ShutDown() {
+    memory_->ShutDown();
+    disk_->ShutDown();
+  }
+
+  // Number of recent reads of a key that qualify it for the memory tier.
+  // 0 puts every value that fits in memory.
+  void set_promotion_threshold(int x) { promotion_threshold_ = x; }
+  int promotion_threshold() const { return promotion_threshold_; }
+
+  // If true (the default) the key size is added to the value size when
+  // checking it against memory_value_limit.
+  void set_account_for_key_size(bool x) { account_for_key_size_ = x; }
+
+ private:
+  class TieredCallback;
+
+  static uint64 KeyHash(const GoogleString& key);
+  bool FitsInMemory(const GoogleString& key, const SharedString& value) const;
+  bool IsPopular(const GoogleString& key) const;
+
+  // Called by TieredCallback with the result of a lookup.  value is empty
+  // if the memory tier lent the value out rather than copying it.
+  void RecordHit(bool from_disk, const GoogleString& key, size_t size,
+                 SharedString* value);
+  void RecordMiss();
+
+  void PutInMemory(const GoogleString& key, SharedString* value);
+  void PutOnDisk(const GoogleString& key, SharedString* value);
+
+  CacheInterface* memory_;
+  CacheInterface* disk_;
+  size_t memory_value_limit_;
+  int promotion_threshold_;
+  bool account_for_key_size_;
+  FrequencySketch* sketch_;
+
+  Variable* memory_hits_;
+  Variable* memory_hit_bytes_;
+  Variable* disk_hits_;
+  Variable* disk_hit_bytes_;
+  Variable* misses_;
+  Variable* memory_inserts_;
+  Variable* memory_insert_bytes_;
+  Variable* disk_inserts_;
+  Variable* disk_insert_bytes_;
+  Variable* promotions_;
+  Variable* demotions_;
+
+  DISALLOW_COPY_AND_ASSIGN(TieredCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_TIERED_CACHE_H_
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Unit-test the tiered cache.
+
+#include "pagespeed/kernel/cache/tiered_cache.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Values of up to 20 bytes, counting the key, go in memory.
+const size_t kMemoryValueLimit = 20;
+
+// Lends callbacks that accept it a view of the value in an LRUCache, the way
+// SharedMemCache does.
+class LendingCache : public CacheInterface {
+ public:
+  explicit LendingCache(LRUCache* cache) : cache_(cache), loans_(0) {}
+
+  virtual void Get(const GoogleString& key, Callback* callback) {
+    SynchronousCallback lookup;
+    cache_->Get(key, &lookup);
+    if ((lookup.state() == kAvailable) && callback->accepts_borrowed_value()) {
+      ++loans_;
+      KeyState state = ValidateBorrowedResult(key, lookup.value()->Value(),
+                                              callback);
+      ReportResult(state, callback);
+    } else {
+      *callback->value() = *lookup.value();
+      ValidateAndReportResult(key, lookup.state(), callback);
+    }
+  }
+  virtual void Put(const GoogleString& key, SharedString* value) {
+    cache_->Put(key, value);
+  }
+  virtual void Delete(const GoogleString& key) { cache_->Delete(key); }
+  virtual GoogleString Name() const {
+    return StrCat("Lending(", cache_->Name(), ")");
+  }
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const { return true; }
+  virtual void ShutDown() {}
+
+  int loans() const { return loans_; }
+
+ private:
+  LRUCache* cache_;
+  int loans_;
+
+  DISALLOW_COPY_AND_ASSIGN(LendingCache);
+};
+
+class BorrowingCallback : public CacheInterface::Callback {
+ public:
+  BorrowingCallback() : state_(CacheInterface::kNotFound) {
+    set_accepts_borrowed_value(true);
+  }
+
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    ValueView().CopyToString(&contents_);
+    return true;
+  }
+
+  virtual void Done(CacheInterface::KeyState state) { state_ = state; }
+
+  CacheInterface::KeyState state() const { return state_; }
+  const GoogleString& contents() const { return contents_; }
+
+ private:
+  CacheInterface::KeyState state_;
+  GoogleString contents_;
+
+  DISALLOW_COPY_AND_ASSIGN(BorrowingCallback);
+};
+
+class TieredCacheTest : public CacheTestBase {
+ protected:
+  TieredCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        memory_cache_(1000),
+        disk_cache_(10000),
+        sketch_(100) {
+    TieredCache::InitStats(&stats_);
+    tiered_cache_.reset(new TieredCache(&memory_cache_, &disk_cache_,
+                                        kMemoryValueLimit, &sketch_, &stats_));
+  }
+
+  virtual CacheInterface* Cache() { return tiered_cache_.get(); }
+  virtual void PostOpCleanup() {
+    memory_cache_.SanityCheck();
+    disk_cache_.SanityCheck();
+  }
+
+  int64 Stat(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  LRUCache memory_cache_;
+  LRUCache disk_cache_;
+  FrequencySketch sketch_;
+  scoped_ptr<TieredCache> tiered_cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TieredCacheTest);
+};
+
+TEST_F(TieredCacheTest, ColdValuesAreDemotedThenPromoted) {
+  // Nobody has read "Name" yet, so it only goes to disk.
+  CheckPut("Name", "Value");
+  CheckNotFound(&memory_cache_, "Name");
+  CheckGet(&disk_cache_, "Name", "Value");
+  EXPECT_EQ(1, Stat("tiered_cache_demotions"));
+
+  // The first read comes from disk, and the second, which makes it popular
+  // enough, promotes it.
+  CheckGet("Name", "Value");
+  CheckNotFound(&memory_cache_, "Name");
+  CheckGet("Name", "Value");
+  CheckGet(&memory_cache_, "Name", "Value");
+  EXPECT_EQ(2, Stat("tiered_cache_disk_hits"));
+  EXPECT_EQ(10, Stat("tiered_cache_disk_hit_bytes"));
+  EXPECT_EQ(1, Stat("tiered_cache_promotions"));
+
+  // Now it's read from memory.
+  CheckGet("Name", "Value");
+  EXPECT_EQ(1, Stat("tiered_cache_memory_hits"));
+  EXPECT_EQ(5, Stat("tiered_cache_memory_hit_bytes"));
+  EXPECT_EQ(2, Stat("tiered_cache_disk_hits"));
+
+  // And a new value for it goes to both tiers.
+  CheckPut("Name", "New");
+  CheckGet(&memory_cache_, "Name", "New");
+  CheckGet(&disk_cache_, "Name", "New");
+  EXPECT_EQ(1, Stat("tiered_cache_demotions"));
+}
+
+TEST_F(TieredCacheTest, PopularMisses) {
+  // Lookups that miss count towards popularity too, as they will be
+  // followed by a Put.
+  CheckNotFound("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(2, Stat("tiered_cache_misses"));
+  CheckPut("Name", "Value");
+  CheckGet(&memory_cache_, "Name", "Value");
+  CheckGet(&disk_cache_, "Name", "Value");
+  EXPECT_EQ(0, Stat("tiered_cache_demotions"));
+  EXPECT_EQ(1, Stat("tiered_cache_memory_inserts"));
+  EXPECT_EQ(5, Stat("tiered_cache_memory_insert_bytes"));
+  EXPECT_EQ(1, Stat("tiered_cache_disk_inserts"));
+}
+
+TEST_F(TieredCacheTest, LargeValuesOnlyGoToDisk) {
+  tiered_cache_->set_promotion_threshold(0);
+  GoogleString large(kMemoryValueLimit, 'x');
+  CheckPut("Small", "Value");
+  CheckPut("Large", large);
+  CheckGet(&memory_cache_, "Small", "Value");
+  CheckNotFound(&memory_cache_, "Large");
+  CheckGet("Large", large);
+  CheckGet("Large", large);
+  CheckNotFound(&memory_cache_, "Large");
+  EXPECT_EQ(0, Stat("tiered_cache_promotions"));
+
+  // A value that outgrows memory leaves no stale copy there.
+  CheckPut("Small", large);
+  CheckNotFound(&memory_cache_, "Small");
+  CheckGet("Small", large);
+
+  // The key counts unless told otherwise.
+  GoogleString fits(kMemoryValueLimit - 3, 'y');
+  CheckPut("Key", fits);
+  CheckGet(&memory_cache_, "Key", fits);
+  CheckPut("Key", fits + "y");
+  CheckNotFound(&memory_cache_, "Key");
+  tiered_cache_->set_account_for_key_size(false);
+  CheckPut("Key", large);
+  CheckGet(&memory_cache_, "Key", large);
+}
+
+TEST_F(TieredCacheTest, ColdPutDropsStaleMemoryCopy) {
+  tiered_cache_->set_promotion_threshold(0);
+  CheckPut("Name", "Value");
+  CheckGet(&memory_cache_, "Name", "Value");
+  tiered_cache_->set_promotion_threshold(10);
+  CheckPut("Name", "New");
+  CheckNotFound(&memory_cache_, "Name");
+  CheckGet("Name", "New");
+}
+
+TEST_F(TieredCacheTest, MemoryEvictionLosesNothing) {
+  tiered_cache_->set_promotion_threshold(0);
+  CheckPut("Name", "Value");
+  CheckGet(&memory_cache_, "Name", "Value");
+  CheckGet(&disk_cache_, "Name", "Value");
+  memory_cache_.Delete("Name");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(1, Stat("tiered_cache_disk_hits"));
+}
+
+TEST_F(TieredCacheTest, SharedSketch) {
+  // Reads through one TieredCache make a key popular for another sharing
+  // its sketch.
+  TieredCache other(&memory_cache_, &disk_cache_, kMemoryValueLimit,
+                    &sketch_, &stats_);
+  CheckNotFound("Name");
+  CheckNotFound(&other, "Name");
+  CheckPut(&other, "Name", "Value");
+  CheckGet(&memory_cache_, "Name", "Value");
+  EXPECT_EQ(0, Stat("tiered_cache_demotions"));
+}
+
+TEST_F(TieredCacheTest, BorrowedValues) {
+  LendingCache lending_cache(&memory_cache_);
+  TieredCache tiered(&lending_cache, &disk_cache_, kMemoryValueLimit,
+                     &sketch_, &stats_);
+  tiered.set_promotion_threshold(0);
+  CheckPut(&tiered, "Name", "Value");
+
+  // Memory hits are passed on without copying, to callbacks that take that.
+  BorrowingCallback borrowing;
+  tiered.Get("Name", &borrowing);
+  EXPECT_EQ(CacheInterface::kAvailable, borrowing.state());
+  EXPECT_EQ("Value", borrowing.contents());
+  EXPECT_TRUE(borrowing.value()->empty());
+  EXPECT_EQ(1, lending_cache.loans());
+  EXPECT_EQ(1, Stat("tiered_cache_memory_hits"));
+  EXPECT_EQ(5, Stat("tiered_cache_memory_hit_bytes"));
+
+  // Others get a copy.
+  CheckGet(&tiered, "Name", "Value");
+  EXPECT_EQ(1, lending_cache.loans());
+
+  // Disk hits are copied, so they can be promoted.
+  memory_cache_.Delete("Name");
+  BorrowingCallback from_disk;
+  tiered.Get("Name", &from_disk);
+  EXPECT_EQ(CacheInterface::kAvailable, from_disk.state());
+  EXPECT_EQ("Value", from_disk.contents());
+  CheckGet(&memory_cache_, "Name", "Value");
+  EXPECT_EQ(1, Stat("tiered_cache_promotions"));
+}
+
+TEST_F(TieredCacheTest, Delete) {
+  tiered_cache_->set_promotion_threshold(0);
+  CheckPut("Name", "Value");
+  CheckDelete("Name");
+  CheckNotFound(&memory_cache_, "Name");
+  CheckNotFound(&disk_cache_, "Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(TieredCacheTest, MultiGet) {
+  tiered_cache_->set_promotion_threshold(0);
+  TestMultiGet();
+}
+
+TEST_F(TieredCacheTest, NameAndStats) {
+  EXPECT_EQ("Tiered(memory=LRUCache,disk=LRUCache)", tiered_cache_->Name());
+  EXPECT_TRUE(tiered_cache_->IsBlocking());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Other");
+  EXPECT_EQ("memory: 0 hits (0 bytes), 0 inserts (0 bytes)\n"
+            "disk: 1 hits (5 bytes), 1 inserts (5 bytes)\n"
+            "misses: 1, promotions: 0, demotions: 1\n",
+            TieredCache::DumpStats(&stats_));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -48,6 +48,7 @@ class CollapseWhitespaceFilter : public EmptyHtmlFilter {
   virtual void StartElement(HtmlElement* element);
   virtual void EndElement(HtmlElement* element);
   virtual void Characters(HtmlCharactersNode* characters);
+  virtual bool IsStreamingSafe() const { return true; }
   virtual const char* Name() const { return "CollapseWhitespace"; }
 
  private:
@@ -21,6 +21,7 @@
 #include <cstdio>
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/char_arena.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -31,9 +32,10 @@
 namespace net_instaweb {
 
 HtmlElement::HtmlElement(HtmlElement* parent, const HtmlName& name,
-    const HtmlEventListIterator& begin, const HtmlEventListIterator& end)
+    const HtmlEventListIterator& begin, const HtmlEventListIterator& end,
+    CharArena* arena)
     : HtmlNode(parent),
-      data_(new Data(name, begin, end)) {
+      data_(new Data(name, begin, end, arena)) {
 }
 
 HtmlElement::~HtmlElement() {
@@ -41,14 +43,16 @@ HtmlElement::~HtmlElement() {
 
 HtmlElement::Data::Data(const HtmlName& name,
                         const HtmlEventListIterator& begin,
-                        const HtmlEventListIterator& end)
+                        const HtmlEventListIterator& end,
+                        CharArena* arena)
     : begin_line_number_(0),
       live_(1),
       end_line_number_(0),
       style_(AUTO_CLOSE),
       name_(name),
       begin_(begin),
-      end_(end) {
+      end_(end),
+      arena_(arena) {
 }
 
 HtmlElement::Data::~Data() {
@@ -170,11 +174,12 @@ void HtmlElement::DebugPrint() const {
 void HtmlElement::AddAttribute(const Attribute& src_attr) {
   Attribute* attr = new Attribute(src_attr.name(),
                                   src_attr.escaped_value(),
-                                  src_attr.quote_style());
+                                  src_attr.quote_style(),
+                                  data_->arena_);
   if (src_attr.decoded_value_computed_) {
     attr->decoded_value_computed_ = true;
     attr->decoding_error_ = src_attr.decoding_error_;
-    Attribute::CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
+    attr->ReplaceValue(src_attr.decoded_value_, &attr->decoded_value_);
   }
   data_->attributes_.Append(attr);
 }
@@ -185,42 +190,63 @@ void HtmlElement::AddAttribute(const HtmlName& name,
   GoogleString buf;
   Attribute* attr = new Attribute(name,
                                   HtmlKeywords::Escape(decoded_value, &buf),
-                                  quote_style);
+                                  quote_style,
+                                  data_->arena_);
   attr->decoded_value_computed_ = true;
   attr->decoding_error_ = false;
-  Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  attr->ReplaceValue(decoded_value, &attr->decoded_value_);
   data_->attributes_.Append(attr);
 }
 
 void HtmlElement::AddEscapedAttribute(const HtmlName& name,
                                       const StringPiece& escaped_value,
                                       QuoteStyle quote_style) {
-  Attribute* attr = new Attribute(name, escaped_value, quote_style);
+  Attribute* attr = new Attribute(name, escaped_value, quote_style,
+                                  data_->arena_);
   data_->attributes_.Append(attr);
 }
 
-void HtmlElement::Attribute::CopyValue(const StringPiece& src,
-                                       scoped_array<char>* dst) {
+void HtmlElement::Attribute::ReplaceValue(const StringPiece& src,
+                                          char** dst) const {
+  char* old_value = *dst;
   if (src.data() == NULL) {
     // This case indicates attribute without value <tag attr>, as opposed
     // to data()=="", which implies an empty value <tag attr=>.
-    dst->reset();
+    *dst = NULL;
+  } else if (arena_ != NULL) {
+    *dst = arena_->Copy(src);
   } else {
     char* buf = new char[src.size() + 1];
     memcpy(buf, src.data(), src.size());
     buf[src.size()] = '\0';
-    dst->reset(buf);
+    *dst = buf;
+  }
+  FreeValue(old_value);
+}
+
+void HtmlElement::Attribute::FreeValue(char* value) const {
+  if (arena_ == NULL) {
+    delete [] value;
   }
 }
 
 HtmlElement::Attribute::Attribute(const HtmlName& name,
                                   const StringPiece& escaped_value,
-                                  QuoteStyle quote_style)
+                                  QuoteStyle quote_style,
+                                  CharArena* arena)
     : name_(name),
       quote_style_(quote_style),
       decoding_error_(false),
-      decoded_value_computed_(false) {
-  CopyValue(escaped_value, &escaped_value_);
+      decoded_value_computed_(false),
+      escaped_value_(NULL),
+      decoded_value_(NULL),
+      arena_(arena) {
+  ReplaceValue(escaped_value, &escaped_value_);
+}
+
+HtmlElement::Attribute::~Attribute() {
+  FreeValue(escaped_value_);
+  FreeValue(decoded_value_);
 }
 
 // Modify value of attribute (eg to rewrite dest of src or href).
@@ -231,12 +257,12 @@ void HtmlElement::Attribute::SetValue(const StringPiece& decoded_value) {
   // Note that we execute the lines in this order in case value
   // is a substring of value_.  This copies the value just prior
   // to deallocation of the old value_.
-  const char* escaped_chars = escaped_value_.get();
+  const char* escaped_chars = escaped_value_;
   DCHECK(decoded_value.data() + decoded_value.size() < escaped_chars ||
          escaped_chars + strlen(escaped_chars) < decoded_value.data())
       << "Setting unescaped value from substring of escaped value.";
-  CopyValue(HtmlKeywords::Escape(decoded_value, &buf), &escaped_value_);
-  CopyValue(decoded_value, &decoded_value_);
+  ReplaceValue(HtmlKeywords::Escape(decoded_value, &buf), &escaped_value_);
+  ReplaceValue(decoded_value, &decoded_value_);
 }
 
 void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
@@ -244,18 +270,19 @@ void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
   // Note that we execute the lines in this order in case value
   // is a substring of value_.  This copies the value just prior
   // to deallocation of the old value_.
-  const char* value_chars = decoded_value_.get();
+  const char* value_chars = decoded_value_;
   if (value_chars != NULL) {
     DCHECK(value_chars + strlen(value_chars) < escaped_value.data() ||
            escaped_value.data() + escaped_value.size() < value_chars)
         << "Setting escaped value from substring of unescaped value.";
   }
 
-  decoded_value_.reset();
+  FreeValue(decoded_value_);
+  decoded_value_ = NULL;
   decoding_error_ = false;
   decoded_value_computed_ = false;
 
-  CopyValue(escaped_value, &escaped_value_);
+  ReplaceValue(escaped_value, &escaped_value_);
 }
 
 const char* HtmlElement::Attribute::quote_str() const {
@@ -273,8 +300,8 @@ const char* HtmlElement::Attribute::quote_str() const {
 void HtmlElement::Attribute::ComputeDecodedValue() const {
   GoogleString buf;
   StringPiece unescaped_value = HtmlKeywords::Unescape(
-      escaped_value_.get(), &buf, &decoding_error_);
-  CopyValue(unescaped_value, &decoded_value_);
+      escaped_value_, &buf, &decoding_error_);
+  ReplaceValue(unescaped_value, &decoded_value_);
   decoded_value_computed_ = true;
 }
 
@@ -29,6 +29,8 @@
 
 namespace net_instaweb {
 
+class CharArena;
+
 // Represents an HTML tag, including all its attributes.  These are never
 // constructed independently, but are managed by class HtmlParse.  They
 // are constructed when parsing an HTML document, and they can also be
@@ -71,7 +73,9 @@ class HtmlElement : public HtmlNode {
 
     // The result of DecodedValueOrNull() and escaped_value() is still
     // owned by this, and will be invalidated by a subsequent call to
-    // SetValue() or SetUnescapedValue
+    // SetValue() or SetUnescapedValue.  For attributes of elements created
+    // by an HtmlParse, the values are allocated from its arena, and remain
+    // valid until the end of the document.
 
     // Returns the attribute name, which is not guaranteed to be case-folded.
     // Compare keyword() to the Keyword constant found in html_name.h for
@@ -88,7 +92,7 @@ class HtmlElement : public HtmlNode {
 
     // Returns the value in its original directly from the HTML source.
     // This may have HTML escapes in it, such as "&amp;".
-    const char* escaped_value() const { return escaped_value_.get(); }
+    const char* escaped_value() const { return escaped_value_; }
 
     // The result of DecodedValueOrNull() is still owned by this, and
     // will be invalidated by a subsequent call to SetValue().
@@ -119,7 +123,7 @@ class HtmlElement : public HtmlNode {
       if (!decoded_value_computed_) {
         ComputeDecodedValue();
       }
-      return decoded_value_.get();
+      return decoded_value_;
     }
 
     void set_decoding_error(bool x) { decoding_error_ = x; }
@@ -166,17 +170,22 @@ class HtmlElement : public HtmlNode {
       quote_style_ = new_quote_style;
     }
 
+    ~Attribute();
+
     friend class HtmlElement;
 
    private:
     void ComputeDecodedValue() const;
 
-    // This should only be called from AddAttribute
+    // This should only be called from AddAttribute.  arena may be NULL, in
+    // which case the values are allocated on the heap.
     Attribute(const HtmlName& name, const StringPiece& escaped_value,
-              QuoteStyle quote_style);
+              QuoteStyle quote_style, CharArena* arena);
 
-    static inline void CopyValue(const StringPiece& src,
-                                 scoped_array<char>* dst);
+    // Replaces *dst with a NUL-terminated copy of src, or NULL if src has
+    // NULL data.  src may point into the old value.
+    void ReplaceValue(const StringPiece& src, char** dst) const;
+    void FreeValue(char* value) const;
 
     HtmlName name_;
     QuoteStyle quote_style_ : 8;
@@ -191,7 +200,7 @@ class HtmlElement : public HtmlNode {
     // Note that it is acceptable to have 8-bit characters in escape
     // sequences (typically iso8859).  However we will not be able to
     // decode such attributes.
-    scoped_array<char> escaped_value_;
+    char* escaped_value_;
 
     // An 8-bit representation of the escaped_value.  Escape sequences
     // that contain character-codes >= 256 are not decoded, and will
@@ -209,7 +218,11 @@ class HtmlElement : public HtmlNode {
     // Note that we do not decode non-ASCII characters but we can
     // represent them in escaped_value_.  We can get 8-bit characters
     // into decoded_value_ via &#129; etc.
-    mutable scoped_array<char> decoded_value_;
+    mutable char* decoded_value_;
+
+    // Where the values come from, or NULL for the heap.  Values in an arena
+    // are never freed individually.
+    CharArena* arena_;
 
     DISALLOW_COPY_AND_ASSIGN(Attribute);
   };
@@ -353,7 +366,8 @@ class HtmlElement : public HtmlNode {
   struct Data {
     Data(const HtmlName& name,
          const HtmlEventListIterator& begin,
-         const HtmlEventListIterator& end);
+         const HtmlEventListIterator& end,
+         CharArena* arena);
     ~Data();
 
     // Max value for the line numbers below.  Since they are 24-bits,
@@ -380,6 +394,7 @@ class HtmlElement : public HtmlNode {
     AttributeList attributes_;
     HtmlEventListIterator begin_;
     HtmlEventListIterator end_;
+    CharArena* arena_;
   };
 
   // Begin/end event iterators are used by HtmlParse to keep track
@@ -391,10 +406,12 @@ class HtmlElement : public HtmlNode {
   void set_begin_line_number(int line) { data_->begin_line_number_ = line; }
   void set_end_line_number(int line) { data_->end_line_number_ = line; }
 
-  // construct via HtmlParse::NewElement
+  // construct via HtmlParse::NewElement.  Attribute values are allocated
+  // from arena.
   HtmlElement(HtmlElement* parent, const HtmlName& name,
               const HtmlEventListIterator& begin,
-              const HtmlEventListIterator& end);
+              const HtmlEventListIterator& end,
+              CharArena* arena);
 
   // HtmlElement data is held in HtmlElement::Data*, which is freed
   // when a CloseElement is Flushed.  The pointers themselves are
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/html/html_event_list.h"
+
+#include <cstddef>
+
+#include "base/logging.h"
+
+namespace {
+
+// 256 cells of three pointers is 6k on 64-bit machines.
+const int kCellsPerChunk = 256;
+
+}  // namespace
+
+namespace net_instaweb {
+
+HtmlEventList::Pool::Pool()
+    : free_list_(NULL),
+      next_cell_(NULL),
+      chunk_end_(NULL),
+      num_cells_in_use_(0) {
+}
+
+HtmlEventList::Pool::~Pool() {
+  DCHECK_EQ(0, num_cells_in_use_);
+  for (int i = 0, n = chunks_.size(); i < n; ++i) {
+    delete [] chunks_[i];
+  }
+}
+
+HtmlEventList::Cell* HtmlEventList::Pool::Allocate() {
+  ++num_cells_in_use_;
+  Cell* cell = free_list_;
+  if (cell != NULL) {
+    free_list_ = cell->next;
+    return cell;
+  }
+  if (next_cell_ == chunk_end_) {
+    next_cell_ = new Cell[kCellsPerChunk];
+    chunk_end_ = next_cell_ + kCellsPerChunk;
+    chunks_.push_back(next_cell_);
+  }
+  return next_cell_++;
+}
+
+void HtmlEventList::Pool::Free(Cell* cell) {
+  DCHECK_LT(0, num_cells_in_use_);
+  if (--num_cells_in_use_ == 0) {
+    Reset();
+  } else {
+    cell->next = free_list_;
+    free_list_ = cell;
+  }
+}
+
+void HtmlEventList::Pool::Reset() {
+  DCHECK_EQ(0, num_cells_in_use_);
+  free_list_ = NULL;
+  if (!chunks_.empty()) {
+    for (int i = 1, n = chunks_.size(); i < n; ++i) {
+      delete [] chunks_[i];
+    }
+    chunks_.resize(1);
+    next_cell_ = chunks_[0];
+    chunk_end_ = next_cell_ + kCellsPerChunk;
+  }
+}
+
+HtmlEventList::HtmlEventList(Pool* pool)
+    : pool_(pool),
+      size_(0) {
+  sentinel_.prev = &sentinel_;
+  sentinel_.next = &sentinel_;
+  sentinel_.event = NULL;
+}
+
+HtmlEventList::~HtmlEventList() {
+  clear();
+}
+
+HtmlEventList::iterator HtmlEventList::insert(iterator pos, HtmlEvent* event) {
+  Cell* cell = pool_->Allocate();
+  Cell* next = pos.cell_;
+  cell->event = event;
+  cell->prev = next->prev;
+  cell->next = next;
+  next->prev->next = cell;
+  next->prev = cell;
+  ++size_;
+  return iterator(cell);
+}
+
+HtmlEventList::iterator HtmlEventList::erase(iterator pos) {
+  Cell* cell = pos.cell_;
+  DCHECK(cell != &sentinel_);
+  Cell* next = cell->next;
+  cell->prev->next = next;
+  next->prev = cell->prev;
+  pool_->Free(cell);
+  --size_;
+  return iterator(next);
+}
+
+void HtmlEventList::splice(iterator pos, HtmlEventList& other,  // NOLINT
+                           iterator first, iterator last) {
+  DCHECK(pool_ == other.pool_);
+  if (first == last) {
+    return;
+  }
+  if (&other != this) {
+    size_t count = 0;
+    for (iterator p = first; p != last; ++p) {
+      ++count;
+    }
+    other.size_ -= count;
+    size_ += count;
+  }
+
+  // Unlink [first, last_cell] from other.
+  Cell* first_cell = first.cell_;
+  Cell* last_cell = last.cell_->prev;
+  first_cell->prev->next = last.cell_;
+  last.cell_->prev = first_cell->prev;
+
+  // And link it in before pos.
+  Cell* next = pos.cell_;
+  first_cell->prev = next->prev;
+  last_cell->next = next;
+  next->prev->next = first_cell;
+  next->prev = last_cell;
+}
+
+void HtmlEventList::clear() {
+  Cell* cell = sentinel_.next;
+  while (cell != &sentinel_) {
+    Cell* next = cell->next;
+    pool_->Free(cell);
+    cell = next;
+  }
+  sentinel_.prev = &sentinel_;
+  sentinel_.next = &sentinel_;
+  size_ = 0;
+}
+
+}  // namespace net_instaweb
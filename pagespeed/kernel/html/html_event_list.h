@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
+#define PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+class HtmlEvent;
+
+// Doubly-linked list of HtmlEvent*, with the subset of the std::list
+// interface that HtmlParse uses.  As with std::list, iterators stay valid
+// across insertions, erasures of other events, and splices, including
+// splices into another list, so HtmlNodes can hold on to them.
+//
+// The difference is where the links live: rather than a heap allocation
+// per event, each list takes its cells from a Pool, which hands them out
+// of fixed-size chunks in order.  Events parsed in sequence thus sit next
+// to each other in memory, and walking the queue is mostly sequential.
+// Once all of a pool's cells have been released -- typically at the end
+// of each flush window -- it starts again from the beginning of its first
+// chunk.
+//
+// Not thread-safe.
+class HtmlEventList {
+ private:
+  struct Cell {
+    Cell* prev;
+    Cell* next;
+    HtmlEvent* event;
+  };
+
+ public:
+  // Storage for the cells of the lists constructed with it.  Events can
+  // only be spliced between lists that share a pool.  The pool must
+  // outlive its lists.
+  class Pool {
+   public:
+    Pool();
+    ~Pool();
+
+    // Number of cells in use by lists.
+    int num_cells_in_use() const { return num_cells_in_use_; }
+
+   private:
+    friend class HtmlEventList;
+
+    Cell* Allocate();
+    void Free(Cell* cell);
+
+    // Returns the pool to its initial state, keeping the first chunk.
+    void Reset();
+
+    std::vector<Cell*> chunks_;
+    Cell* free_list_;       // Released cells, linked through next.
+    Cell* next_cell_;       // Next never-used cell of the last chunk.
+    Cell* chunk_end_;
+    int num_cells_in_use_;
+
+    DISALLOW_COPY_AND_ASSIGN(Pool);
+  };
+
+  class iterator {
+   public:
+    iterator() : cell_(NULL) {}
+
+    HtmlEvent*& operator*() const { return cell_->event; }
+    iterator& operator++() {
+      cell_ = cell_->next;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      cell_ = cell_->next;
+      return old;
+    }
+    iterator& operator--() {
+      cell_ = cell_->prev;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator old = *this;
+      cell_ = cell_->prev;
+      return old;
+    }
+    bool operator==(const iterator& that) const { return cell_ == that.cell_; }
+    bool operator!=(const iterator& that) const { return cell_ != that.cell_; }
+
+   private:
+    friend class HtmlEventList;
+    explicit iterator(Cell* cell) : cell_(cell) {}
+
+    Cell* cell_;
+  };
+
+  explicit HtmlEventList(Pool* pool);
+
+  // Releases the cells, but not the events they point to.
+  ~HtmlEventList();
+
+  // end() is fixed for the lifetime of the list, so, as with std::list,
+  // it can be used as a "no position" marker.
+  iterator begin() const { return iterator(sentinel()->next); }
+  iterator end() const { return iterator(sentinel()); }
+  bool empty() const { return sentinel_.next == &sentinel_; }
+  size_t size() const { return size_; }
+
+  void push_back(HtmlEvent* event) { insert(end(), event); }
+  void push_front(HtmlEvent* event) { insert(begin(), event); }
+
+  // Inserts event before pos, returning its position.
+  iterator insert(iterator pos, HtmlEvent* event);
+
+  // Removes the event at pos from the list, returning the position that
+  // followed it.  The event itself is not deleted.
+  iterator erase(iterator pos);
+
+  // Moves the events in [first, last) of other to just before pos.  This
+  // is O(1) within a list and linear in the number of events moved
+  // between lists, which must share a pool.
+  void splice(iterator pos, HtmlEventList& other,  // NOLINT
+              iterator first, iterator last);
+
+  // Removes all the events, without deleting them.
+  void clear();
+
+ private:
+  Cell* sentinel() const { return const_cast<Cell*>(&sentinel_); }
+
+  Pool* pool_;
+  Cell sentinel_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlEventList);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the event list used by HtmlParse.
+
+#include "pagespeed/kernel/html/html_event_list.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_event.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class HtmlEventListTest : public testing::Test {
+ protected:
+  HtmlEventListTest() : list_(&pool_), other_(&pool_) {}
+
+  virtual ~HtmlEventListTest() {
+    STLDeleteElements(&list_);
+    STLDeleteElements(&other_);
+  }
+
+  // Events are told apart by their line numbers.
+  static HtmlEvent* NewEvent(int line_number) {
+    return new HtmlStartDocumentEvent(line_number);
+  }
+
+  static GoogleString Contents(const HtmlEventList& list) {
+    GoogleString contents;
+    for (HtmlEventList::iterator p = list.begin(); p != list.end(); ++p) {
+      StrAppend(&contents, (contents.empty() ? "" : ","),
+                IntegerToString((*p)->line_number()));
+    }
+    return contents;
+  }
+
+  // Fills list with events numbered [first, last).
+  static void Fill(HtmlEventList* list, int first, int last) {
+    for (int i = first; i < last; ++i) {
+      list->push_back(NewEvent(i));
+    }
+  }
+
+  HtmlEventList::Pool pool_;
+  HtmlEventList list_;
+  HtmlEventList other_;
+};
+
+TEST_F(HtmlEventListTest, InsertAndErase) {
+  EXPECT_TRUE(list_.empty());
+  EXPECT_TRUE(list_.begin() == list_.end());
+  Fill(&list_, 1, 4);
+  EXPECT_EQ("1,2,3", Contents(list_));
+  EXPECT_EQ(3U, list_.size());
+
+  list_.push_front(NewEvent(0));
+  HtmlEventList::iterator three = list_.end();
+  --three;
+  HtmlEventList::iterator two_and_a_half = list_.insert(three, NewEvent(25));
+  EXPECT_EQ("0,1,2,25,3", Contents(list_));
+  EXPECT_EQ(25, (*two_and_a_half)->line_number());
+
+  delete *two_and_a_half;
+  HtmlEventList::iterator next = list_.erase(two_and_a_half);
+  EXPECT_TRUE(next == three);
+  EXPECT_EQ("0,1,2,3", Contents(list_));
+  EXPECT_EQ(4U, list_.size());
+  EXPECT_EQ(4, pool_.num_cells_in_use());
+}
+
+TEST_F(HtmlEventListTest, SpliceWithinList) {
+  Fill(&list_, 0, 6);
+  HtmlEventList::iterator two = list_.begin();
+  ++two;
+  ++two;
+  HtmlEventList::iterator four = two;
+  ++four;
+  ++four;
+
+  // Move [2, 4) to the end; the iterators follow their events.
+  list_.splice(list_.end(), list_, two, four);
+  EXPECT_EQ("0,1,4,5,2,3", Contents(list_));
+  EXPECT_EQ(6U, list_.size());
+  EXPECT_EQ(2, (*two)->line_number());
+  EXPECT_EQ(4, (*four)->line_number());
+  --two;
+  EXPECT_EQ(5, (*two)->line_number());
+}
+
+TEST_F(HtmlEventListTest, SpliceBetweenLists) {
+  Fill(&list_, 0, 4);
+  Fill(&other_, 10, 12);
+  HtmlEventList::iterator one = list_.begin();
+  ++one;
+  HtmlEventList::iterator end = list_.end();
+
+  other_.splice(other_.begin(), list_, one, end);
+  EXPECT_EQ("0", Contents(list_));
+  EXPECT_EQ("1,2,3,10,11", Contents(other_));
+  EXPECT_EQ(1U, list_.size());
+  EXPECT_EQ(5U, other_.size());
+  EXPECT_TRUE(list_.end() == end);
+
+  list_.splice(list_.end(), other_, other_.begin(), other_.end());
+  EXPECT_EQ("0,1,2,3,10,11", Contents(list_));
+  EXPECT_TRUE(other_.empty());
+  EXPECT_EQ(6U, list_.size());
+  EXPECT_EQ(1, (*one)->line_number());
+}
+
+TEST_F(HtmlEventListTest, CellsAreReusedInOrder) {
+  Fill(&list_, 0, 1000);
+  HtmlEventList::iterator first = list_.begin();
+  HtmlEvent* const* first_cell = &*first;
+  EXPECT_EQ(1000, pool_.num_cells_in_use());
+  STLDeleteElements(&list_);
+  EXPECT_EQ(0, pool_.num_cells_in_use());
+
+  // With every cell released, the pool starts over from the beginning.
+  Fill(&list_, 0, 2);
+  EXPECT_EQ(first_cell, &*list_.begin());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
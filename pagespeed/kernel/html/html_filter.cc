@@ -29,4 +29,8 @@ HtmlFilter::~HtmlFilter() {
 void HtmlFilter::RenderDone() {
 }
 
+bool HtmlFilter::IsStreamingSafe() const {
+  return false;
+}
+
 }  // namespace net_instaweb
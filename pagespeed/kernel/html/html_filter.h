@@ -107,6 +107,16 @@ class HtmlFilter {
   // rewrite any urls.
   virtual bool CanModifyUrls() = 0;
 
+  // Returns whether this filter is streaming-safe, which lets HtmlParse run
+  // it in the same pass over the event queue as its streaming-safe
+  // neighbors, rather than giving it a pass of its own.  A streaming-safe
+  // filter handles each event without looking ahead at later events, and
+  // may only modify the node the event is for, while it is being called
+  // for that event.  It never inserts, deletes, moves or defers nodes, and
+  // does not change the DOM from Flush().  Default implementation returns
+  // false.
+  virtual bool IsStreamingSafe() const;
+
   // The name of this filter -- used for logging and debugging.
   virtual const char* Name() const = 0;
 
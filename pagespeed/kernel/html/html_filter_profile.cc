@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/html/html_filter_profile.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_filter.h"
+
+namespace net_instaweb {
+
+namespace {
+
+typedef std::vector<const HtmlFilterProfile::Entry*> EntryVector;
+
+bool CostsMore(const HtmlFilterProfile::Entry* a,
+               const HtmlFilterProfile::Entry* b) {
+  return a->cycles > b->cycles;
+}
+
+}  // namespace
+
+HtmlFilterProfile::HtmlFilterProfile() {
+}
+
+HtmlFilterProfile::~HtmlFilterProfile() {
+}
+
+void HtmlFilterProfile::Record(HtmlFilter* filter, uint64 cycles,
+                               int64 events) {
+  std::pair<FilterIndexMap::iterator, bool> inserted =
+      index_.insert(FilterIndexMap::value_type(filter, entries_.size()));
+  if (inserted.second) {
+    Entry entry;
+    entry.name = filter->Name();
+    entry.cycles = 0;
+    entry.events = 0;
+    entry.passes = 0;
+    entries_.push_back(entry);
+  }
+  Entry* entry = &entries_[inserted.first->second];
+  entry->cycles += cycles;
+  entry->events += events;
+  ++entry->passes;
+}
+
+void HtmlFilterProfile::Clear() {
+  index_.clear();
+  entries_.clear();
+}
+
+uint64 HtmlFilterProfile::total_cycles() const {
+  uint64 total = 0;
+  for (int i = 0, n = entries_.size(); i < n; ++i) {
+    total += entries_[i].cycles;
+  }
+  return total;
+}
+
+GoogleString HtmlFilterProfile::ToString() const {
+  EntryVector sorted;
+  for (int i = 0, n = entries_.size(); i < n; ++i) {
+    sorted.push_back(&entries_[i]);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), CostsMore);
+  GoogleString out;
+  for (int i = 0, n = sorted.size(); i < n; ++i) {
+    const Entry* entry = sorted[i];
+    StrAppend(&out, entry->name, ": ",
+              Integer64ToString(entry->cycles), " cycles, ",
+              Integer64ToString(entry->events), " events, ");
+    StrAppend(&out, IntegerToString(entry->passes), " passes\n");
+  }
+  return out;
+}
+
+}  // namespace net_instaweb
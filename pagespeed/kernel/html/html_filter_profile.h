@@ -0,0 +1,72 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTML_HTML_FILTER_PROFILE_H_
+#define PAGESPEED_KERNEL_HTML_HTML_FILTER_PROFILE_H_
+
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+
+namespace net_instaweb {
+
+class HtmlFilter;
+
+// The CPU cost of each filter run over one document, filled in by HtmlParse
+// while a profile is attached to it (see HtmlParse::set_filter_profile).
+// Costs are in ReadCycleCounter units and include the filter's Flush.
+//
+// Not thread-safe.
+class HtmlFilterProfile {
+ public:
+  struct Entry {
+    GoogleString name;  // HtmlFilter::Name()
+    uint64 cycles;
+    int64 events;       // Number of events shown to the filter.
+    int passes;         // Number of flush windows the filter ran over.
+  };
+
+  HtmlFilterProfile();
+  ~HtmlFilterProfile();
+
+  // Adds one pass of filter over events events, taking cycles.
+  void Record(HtmlFilter* filter, uint64 cycles, int64 events);
+
+  void Clear();
+
+  // Entries in the order their filters first ran.
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  // Sum of the cycles of all the entries.
+  uint64 total_cycles() const;
+
+  // One line per filter, costliest first.
+  GoogleString ToString() const;
+
+ private:
+  typedef std::map<HtmlFilter*, int> FilterIndexMap;
+
+  FilterIndexMap index_;  // Maps filters to their entries.
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlFilterProfile);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTML_HTML_FILTER_PROFILE_H_
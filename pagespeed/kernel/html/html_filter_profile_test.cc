@@ -0,0 +1,67 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the per-document filter profile.
+
+#include "pagespeed/kernel/html/html_filter_profile.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/html/empty_html_filter.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class NamedFilter : public EmptyHtmlFilter {
+ public:
+  explicit NamedFilter(const char* name) : name_(name) {}
+  virtual const char* Name() const { return name_; }
+
+ private:
+  const char* name_;
+
+  DISALLOW_COPY_AND_ASSIGN(NamedFilter);
+};
+
+TEST(HtmlFilterProfileTest, PassesAccumulate) {
+  NamedFilter cheap("Cheap");
+  NamedFilter costly("Costly");
+  HtmlFilterProfile profile;
+  profile.Record(&cheap, 100, 10);
+  profile.Record(&costly, 5000, 10);
+  profile.Record(&cheap, 50, 4);
+
+  ASSERT_EQ(2U, profile.entries().size());
+  const HtmlFilterProfile::Entry& entry = profile.entries()[0];
+  EXPECT_EQ("Cheap", entry.name);
+  EXPECT_EQ(150U, entry.cycles);
+  EXPECT_EQ(14, entry.events);
+  EXPECT_EQ(2, entry.passes);
+  EXPECT_EQ(5150U, profile.total_cycles());
+
+  EXPECT_EQ("Costly: 5000 cycles, 10 events, 1 passes\n"
+            "Cheap: 150 cycles, 14 events, 2 passes\n",
+            profile.ToString());
+
+  profile.Clear();
+  EXPECT_TRUE(profile.entries().empty());
+  EXPECT_EQ("", profile.ToString());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -23,6 +23,12 @@
 #include <cstdarg>
 #include <cstddef>  // for size_t
 #include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define HTML_LEXER_USE_SSE2 1
+#endif
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -145,6 +151,41 @@ bool IsInSet(const HtmlName::Keyword* keywords, int num,
 #define IS_IN_SET(keywords, keyword) \
     IsInSet(keywords, arraysize(keywords), keyword)
 
+// Returns the first occurrence of c in [begin, end), or end.  memchr is
+// vectorized by the C library, using the widest instructions the CPU has.
+inline const char* FindChar(const char* begin, const char* end, char c) {
+  const void* found = memchr(begin, c, end - begin);
+  return (found == NULL) ? end : static_cast<const char*>(found);
+}
+
+// Returns the first occurrence of a, b or c in [begin, end), or end,
+// 16 bytes at a time where SSE2 is available.
+inline const char* FindFirstOf3(const char* begin, const char* end,
+                                char a, char b, char c) {
+  const char* p = begin;
+#ifdef HTML_LEXER_USE_SSE2
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)),
+        _mm_cmpeq_epi8(chunk, vc));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end; ++p) {
+    if ((*p == a) || (*p == b) || (*p == c)) {
+      return p;
+    }
+  }
+  return end;
+}
+
 }  // namespace
 
 // TODO(jmarantz): support multi-byte encodings
@@ -1022,6 +1063,72 @@ void HtmlLexer::EmitDirective() {
   state_ = START;
 }
 
+// Most of a document's bytes are text, comment bodies, scripts, styles and
+// attribute values, where all but a few characters just get appended to
+// the buffers.  This finds the next character at or after text[i] that the
+// Eval method for state_ would do more with, and appends everything before
+// it as that method would, in bulk.  Returns that character's index, or
+// size if there is none.
+int HtmlLexer::SkipInsignificantBytes(const char* text, int i, int size) {
+  const char* begin = text + i;
+  const char* end = text + size;
+  const char* stop;
+  GoogleString* token = NULL;  // Also accumulates the bytes, if non-NULL.
+  switch (state_) {
+    case START:
+      stop = FindChar(begin, end, '<');
+      break;
+    case COMMENT_BODY:
+      stop = FindChar(begin, end, '-');
+      token = &token_;
+      break;
+    case CDATA_BODY:
+      stop = FindChar(begin, end, ']');
+      token = &token_;
+      break;
+    case DIRECTIVE:
+      stop = FindChar(begin, end, '>');
+      token = &token_;
+      break;
+    case LITERAL_TAG:
+    case BOGUS_COMMENT:
+      stop = FindChar(begin, end, '>');
+      break;
+    case TAG_ATTR_VALDQ:
+      stop = FindChar(begin, end, '"');
+      token = &attr_value_;
+      break;
+    case TAG_ATTR_VALSQ:
+      stop = FindChar(begin, end, '\'');
+      token = &attr_value_;
+      break;
+    case SCRIPT_TAG: {
+      // EvalScriptTag also acts on whitespace and '/', but only right
+      // after "<script" or "</script", so those are left to it within 8
+      // bytes of a '<'.
+      StringPiece tail(literal_);
+      if (tail.size() > STATIC_STRLEN("</script")) {
+        tail.remove_prefix(tail.size() - STATIC_STRLEN("</script"));
+      }
+      if (tail.find('<') != StringPiece::npos) {
+        return i;
+      }
+      stop = FindFirstOf3(begin, end, '<', '-', '>');
+      break;
+    }
+    default:
+      return i;
+  }
+  if (stop != begin) {
+    line_ += std::count(begin, stop, '\n');
+    literal_.append(begin, stop - begin);
+    if (token != NULL) {
+      token->append(begin, stop - begin);
+    }
+  }
+  return stop - text;
+}
+
 void HtmlLexer::Parse(const char* text, int size) {
   num_bytes_parsed_ += size;
   if (size_limit_ > 0 && num_bytes_parsed_ > size_limit_) {
@@ -1035,6 +1142,10 @@ void HtmlLexer::Parse(const char* text, int size) {
       // Return without doing anything if skip_parsing_ is true.
       return;
     }
+    i = SkipInsignificantBytes(text, i, size);
+    if (i == size) {
+      break;
+    }
     char c = text[i];
     if (c == '\n') {
       ++line_;
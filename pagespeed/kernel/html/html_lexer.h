@@ -96,6 +96,10 @@ class HtmlLexer {
   bool size_limit_exceeded() const { return size_limit_exceeded_; }
 
  private:
+  // Appends the run of bytes from text[i] that the Eval method for the
+  // current state would only accumulate, and returns the index after it.
+  inline int SkipInsignificantBytes(const char* text, int i, int size);
+
   // Most of these routines expect c to be the last character of literal_
   inline void EvalStart(char c);
   inline void EvalTag(char c);
@@ -20,7 +20,6 @@
 #define PAGESPEED_KERNEL_HTML_HTML_NODE_H_
 
 #include <cstddef>
-#include <list>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/arena.h"
@@ -28,13 +27,12 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_event_list.h"
 
 namespace net_instaweb {
 
 class HtmlElement;
-class HtmlEvent;
 
-typedef std::list<HtmlEvent*> HtmlEventList;
 typedef HtmlEventList::iterator HtmlEventListIterator;
 
 // Base class for HtmlElement and HtmlLeafNode.  Generally represents all
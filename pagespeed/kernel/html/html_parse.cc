@@ -24,6 +24,8 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/arena.h"
 #include "pagespeed/kernel/base/atom.h"
+#include "pagespeed/kernel/base/char_arena.h"
+#include "pagespeed/kernel/base/cycle_counter.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/print_message_handler.h"
 #include "pagespeed/kernel/base/stl_util.h"
@@ -35,6 +37,7 @@
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_event.h"
 #include "pagespeed/kernel/html/html_filter.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
 #include "pagespeed/kernel/html/html_keywords.h"
 #include "pagespeed/kernel/html/html_lexer.h"
 #include "pagespeed/kernel/html/html_name.h"
@@ -47,6 +50,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
     : lexer_(NULL),  // Can't initialize here, since "this" should not be used
                      // in the initializer list (it generates an error in
                      // Visual Studio builds).
+      queue_(&event_cells_),
       current_(queue_.end()),
       message_handler_(message_handler),
       line_number_(1),
@@ -62,6 +66,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       parse_start_time_us_(0),
       timer_(NULL),
       current_filter_(NULL),
+      filter_profile_(NULL),
       dynamically_disabled_filter_list_(NULL) {
   lexer_ = new HtmlLexer(this);
   HtmlKeywords::Init();
@@ -217,7 +222,8 @@ void HtmlParse::InsertScriptAfterCurrent(StringPiece text, bool external) {
 
 HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
   HtmlElement* element =
-      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end());
+      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end(),
+                                &attribute_values_);
   if (IsOptionallyClosedTag(name.keyword())) {
     // When we programmatically insert HTML nodes we should default to
     // including an explicit close-tag if they are optionally closed
@@ -354,6 +360,10 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   // node-deferrals with the filter that requested them.
   DCHECK(current_filter_ == NULL);
   current_filter_ = filter;
+  uint64 start_cycles = 0;
+  if (filter_profile_ != NULL) {
+    start_cycles = ReadCycleCounter();
+  }
 
   // If, in a previous flush window, the current filter requested the deferral
   // of an element that has not yet been closed, then move any events we've seen
@@ -385,12 +395,17 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   }
 
   ShowProgress(StrCat("ApplyFilter:", filter->Name()).c_str());
+  int64 num_events = queue_.size();
   for (current_ = queue_.begin(); current_ != queue_.end(); NextEvent()) {
     HtmlEvent* event = *current_;
     line_number_ = event->line_number();
     event->Run(filter);
   }
   filter->Flush();
+  if (filter_profile_ != NULL) {
+    filter_profile_->Record(filter, ReadCycleCounter() - start_cycles,
+                            num_events);
+  }
 
   if (need_sanity_check_) {
     SanityCheck();
@@ -399,6 +414,93 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   current_filter_ = NULL;
 }
 
+void HtmlParse::ApplyFilters(const FilterList& filters) {
+  DCHECK(fused_filters_.empty());
+  for (FilterList::const_iterator i = filters.begin(); i != filters.end();
+       ++i) {
+    HtmlFilter* filter = *i;
+    if (!filter->is_enabled()) {
+      continue;
+    }
+    if (filter->IsStreamingSafe()) {
+      fused_filters_.push_back(filter);
+    } else {
+      ApplyFusedFilters();
+      ApplyFilter(filter);
+    }
+  }
+  ApplyFusedFilters();
+}
+
+void HtmlParse::ApplyFusedFilters() {
+  if (fused_filters_.empty()) {
+    return;
+  } else if (fused_filters_.size() == 1) {
+    ApplyFilter(fused_filters_[0]);
+    fused_filters_.clear();
+    return;
+  }
+  DCHECK(current_filter_ == NULL);
+
+  if (coalesce_characters_ && need_coalesce_characters_) {
+    CoalesceAdjacentCharactersNodes();
+    DelayLiteralTag();
+    need_coalesce_characters_ = false;
+  }
+
+  ShowProgress("ApplyFusedFilters");
+  int num_filters = fused_filters_.size();
+  int64 num_events = queue_.size();
+
+  // When profiling, the counter is read once after each filter has run,
+  // and the difference from the previous reading charged to that filter.
+  bool profiling = (filter_profile_ != NULL);
+  uint64 cycles = 0;
+  if (profiling) {
+    fused_cycles_.assign(num_filters, 0);
+    cycles = ReadCycleCounter();
+  }
+  for (current_ = queue_.begin(); current_ != queue_.end(); ++current_) {
+    HtmlEvent* event = *current_;
+    line_number_ = event->line_number();
+    for (int i = 0; i < num_filters; ++i) {
+      current_filter_ = fused_filters_[i];
+      event->Run(current_filter_);
+      DCHECK(!skip_increment_ && (*current_ == event))
+          << current_filter_->Name()
+          << " moved the current event, so is not streaming-safe";
+      if (profiling) {
+        uint64 now = ReadCycleCounter();
+        fused_cycles_[i] += now - cycles;
+        cycles = now;
+      }
+    }
+  }
+  for (int i = 0; i < num_filters; ++i) {
+    current_filter_ = fused_filters_[i];
+    DCHECK(open_deferred_nodes_.find(current_filter_) ==
+           open_deferred_nodes_.end());
+    current_filter_->Flush();
+    if (profiling) {
+      uint64 now = ReadCycleCounter();
+      fused_cycles_[i] += now - cycles;
+      cycles = now;
+    }
+  }
+  current_filter_ = NULL;
+  if (profiling) {
+    for (int i = 0; i < num_filters; ++i) {
+      filter_profile_->Record(fused_filters_[i], fused_cycles_[i], num_events);
+    }
+  }
+  fused_filters_.clear();
+
+  if (need_sanity_check_) {
+    SanityCheck();
+    need_sanity_check_ = false;
+  }
+}
+
 void HtmlParse::NextEvent() {
   if (skip_increment_) {
     skip_increment_ = false;
@@ -544,12 +646,7 @@ void HtmlParse::Flush() {
   if (url_valid_) {
     ShowProgress("Flush");
 
-    for (FilterList::iterator i = filters_.begin(); i != filters_.end(); ++i) {
-      HtmlFilter* filter = *i;
-      if (filter->is_enabled()) {
-        ApplyFilter(filter);
-      }
-    }
+    ApplyFilters(filters_);
     ClearEvents();
   }
 }
@@ -807,18 +904,8 @@ bool HtmlParse::MoveCurrentBeforeEvent(const HtmlEventListIterator& move_to) {
       queue_.splice(move_to, queue_, begin, end);
       --current_;
 
-      // TODO(jmarantz): According to
-      // http://www.cplusplus.com/reference/stl/list/splice/
-      // the moved iterators are no longer valid, and we
-      // are retaining them in the HtmlNode, so we need to fix them.
-      //
-      // However, in practice they appear to remain valid.  And
-      // I can't think of a reason they should be invalidated,
-      // as the iterator is a pointer to a node structure with
-      // next/prev pointers.  splice can mutate the next/prev pointers
-      // in place.
-      //
-      // See http://stackoverflow.com/questions/143156
+      // HtmlEventList::splice relinks the moved cells in place, so the
+      // iterators retained in the moved HtmlNodes remain valid.
 
       need_sanity_check_ = true;
       need_coalesce_characters_ = true;
@@ -1007,6 +1094,7 @@ bool HtmlParse::IsInEventWindow(const HtmlEventListIterator& iter) const {
 void HtmlParse::ClearElements() {
   ClearDeferredNodes();
   nodes_.DestroyObjects();
+  attribute_values_.Clear();
   DCHECK(!running_filters_);
 }
 
@@ -1297,7 +1385,7 @@ void HtmlParse::DeferCurrentNode() {
   //      StartElement event is not in the flush window.  We avoid this
   //      case by requiring that callers run DeferCurentNode from the
   //      StartElement event.
-  HtmlEventList* node_events = new HtmlEventList;
+  HtmlEventList* node_events = new HtmlEventList(&event_cells_);
   deferred_nodes_[node] = node_events;
   HtmlEventListIterator node_last = node->end();
   if (node_last != queue_.end()) {
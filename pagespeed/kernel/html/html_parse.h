@@ -29,12 +29,14 @@
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/arena.h"
+#include "pagespeed/kernel/base/char_arena.h"
 #include "pagespeed/kernel/base/printf_format.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/symbol_table.h"
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_event_list.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -45,6 +47,7 @@ namespace net_instaweb {
 class DocType;
 class HtmlEvent;
 class HtmlFilter;
+class HtmlFilterProfile;
 class HtmlLexer;
 class MessageHandler;
 class Timer;
@@ -71,7 +74,7 @@ typedef std::set <const HtmlEvent*> ConstHtmlEventSet;
 //     comment
 //
 // The parser retains the sequence of events as a data structure:
-// list<HtmlEvent>.  HtmlEvents are sent to filters (HtmlFilter), as follows:
+// HtmlEventList.  HtmlEvents are sent to filters (HtmlFilter), as follows:
 //   foreach filter in filter-chain
 //     foreach event in flush-window
 //       apply filter to event
@@ -449,6 +452,14 @@ class HtmlParse {
   Timer* timer() const { return timer_; }
   void set_log_rewrite_timing(bool x) { log_rewrite_timing_ = x; }
 
+  // While profile is non-NULL, the cycles each filter takes, and the number
+  // of events it is shown, are added to it as the filters run.  The profile
+  // is not owned.  NULL, the default, turns profiling off.
+  void set_filter_profile(HtmlFilterProfile* profile) {
+    filter_profile_ = profile;
+  }
+  HtmlFilterProfile* filter_profile() const { return filter_profile_; }
+
   // Adds a filter to be called during parsing as new events are added.
   // Takes ownership of the HtmlFilter passed in.
   void add_event_listener(HtmlFilter* listener);
@@ -556,6 +567,13 @@ class HtmlParse {
 
   void CheckFilterBehavior(HtmlFilter* filter);
 
+  // Runs the enabled filters in the list on the current queue of parse
+  // nodes, in order.  Runs of consecutive streaming-safe filters (see
+  // HtmlFilter::IsStreamingSafe) share a single pass over the queue, with
+  // each event dispatched to all of them in turn; the other filters get
+  // a pass each via ApplyFilter.
+  void ApplyFilters(const FilterList& filters);
+
   // Call DetermineEnabled() on each filter. Should be called after
   // the property cache lookup has finished since some filters depend on
   // pcache results in their DetermineEnabled implementation. If a subclass has
@@ -568,6 +586,8 @@ class HtmlParse {
 
  private:
   void ApplyFilterHelper(HtmlFilter* filter);
+  // Runs the streaming-safe filters in fused_filters_ in one pass.
+  void ApplyFusedFilters();
   HtmlEventListIterator Last();  // Last element in queue
   bool IsInEventWindow(const HtmlEventListIterator& iter) const;
   void InsertNodeBeforeEvent(const HtmlEventListIterator& event,
@@ -609,11 +629,16 @@ class HtmlParse {
   // right before calling the Filters.
   void DelayLiteralTag();
 
+
   FilterVector event_listeners_;
   SymbolTableSensitive string_table_;
   FilterList filters_;
   HtmlLexer* lexer_;
   Arena<HtmlNode> nodes_;
+  // Attribute values of the elements in nodes_, released along with them.
+  CharArena attribute_values_;
+  // Cells for queue_ and the event lists of deferred nodes.
+  HtmlEventList::Pool event_cells_;
   HtmlEventList queue_;
   HtmlEventListIterator current_;
   // Have we deleted current? Then we shouldn't do certain manipulations to it.
@@ -636,6 +661,9 @@ class HtmlParse {
   scoped_ptr<HtmlEvent> delayed_start_literal_;
   Timer* timer_;
   HtmlFilter* current_filter_;      // Filter currently running in ApplyFilter
+  FilterVector fused_filters_;      // Scratch space for ApplyFilters
+  HtmlFilterProfile* filter_profile_;
+  std::vector<uint64> fused_cycles_;  // Per-filter cycles in ApplyFusedFilters
 
   // When deferring a node that spans a flush window, we present upstream
   // filters with a view of the event-stream that is not impacted by the
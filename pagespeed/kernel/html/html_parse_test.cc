@@ -36,6 +36,7 @@
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_event.h"
 #include "pagespeed/kernel/html/html_filter.h"
+#include "pagespeed/kernel/html/html_filter_profile.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/html/html_parse.h"
@@ -1991,6 +1992,17 @@ TEST_F(AttributeManipulationTest, ModifyKeepAttribute) {
                 " selected />");
 }
 
+TEST_F(AttributeManipulationTest, ReplacedValueLastsUntilEndOfDocument) {
+  HtmlElement::Attribute* href = node_->FindAttribute(HtmlName::kHref);
+  ASSERT_TRUE(href != NULL);
+  const char* old_value = href->escaped_value();
+  href->SetValue("google");
+  // Values come from the parser's arena, so the old one is still there.
+  EXPECT_STREQ("http://www.google.com/", old_value);
+  EXPECT_STREQ("google", href->escaped_value());
+  CheckExpected("<a href=\"google\" id=37 class='search!' selected />");
+}
+
 TEST_F(AttributeManipulationTest, BadUrl) {
   EXPECT_FALSE(html_parse_.StartParse(")(*&)(*&(*"));
 
@@ -3162,4 +3174,103 @@ TEST_F(HtmlParseTestNoBody, InsertExternalScriptAfterEndOfHead) {
                    "<head>text</head><script src=\"inserted\"></script>");
 }
 
+namespace {
+
+// Logs the elements it sees to a log shared with other filters, so tests
+// can tell in which order the parser dispatched events to the filters.
+class EventOrderFilter : public EmptyHtmlFilter {
+ public:
+  EventOrderFilter(const char* name, bool streaming_safe, GoogleString* log)
+      : name_(name), streaming_safe_(streaming_safe), log_(log) {}
+
+  virtual void StartElement(HtmlElement* element) {
+    StrAppend(log_, (log_->empty() ? "" : " "), name_, "+",
+              element->name_str());
+  }
+  virtual void EndElement(HtmlElement* element) {
+    StrAppend(log_, (log_->empty() ? "" : " "), name_, "-",
+              element->name_str());
+  }
+  virtual void Flush() {
+    StrAppend(log_, " ", name_, "[F]");
+  }
+  virtual bool IsStreamingSafe() const { return streaming_safe_; }
+  virtual const char* Name() const { return name_; }
+
+ private:
+  const char* name_;
+  bool streaming_safe_;
+  GoogleString* log_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventOrderFilter);
+};
+
+}  // namespace
+
+class FusedFilterTest : public HtmlParseTestNoBody {
+ protected:
+  virtual bool AddHtmlTags() const { return false; }
+
+  GoogleString log_;
+};
+
+TEST_F(FusedFilterTest, StreamingSafeFiltersShareAPass) {
+  EventOrderFilter a("a", true, &log_);
+  EventOrderFilter b("b", true, &log_);
+  html_parse_.AddFilter(&a);
+  html_parse_.AddFilter(&b);
+  SetupWriter();
+  ValidateNoChanges("fused", "<div></div>");
+  EXPECT_EQ("a+div b+div a-div b-div a[F] b[F]", log_);
+}
+
+TEST_F(FusedFilterTest, OtherFiltersGetTheirOwnPass) {
+  EventOrderFilter a("a", true, &log_);
+  EventOrderFilter b("b", false, &log_);
+  EventOrderFilter c("c", true, &log_);
+  EventOrderFilter d("d", true, &log_);
+  html_parse_.AddFilter(&a);
+  html_parse_.AddFilter(&b);
+  html_parse_.AddFilter(&c);
+  html_parse_.AddFilter(&d);
+  SetupWriter();
+  ValidateNoChanges("unfused", "<div></div>");
+  EXPECT_EQ("a+div a-div a[F] b+div b-div b[F] "
+            "c+div d+div c-div d-div c[F] d[F]", log_);
+}
+
+TEST_F(FusedFilterTest, ProfileEveryFilter) {
+  EventOrderFilter a("a", true, &log_);
+  EventOrderFilter b("b", false, &log_);
+  EventOrderFilter c("c", true, &log_);
+  EventOrderFilter d("d", true, &log_);
+  html_parse_.AddFilter(&a);
+  html_parse_.AddFilter(&b);
+  html_parse_.AddFilter(&c);
+  html_parse_.AddFilter(&d);
+  HtmlFilterProfile profile;
+  html_parse_.set_filter_profile(&profile);
+  ValidateNoChanges("profiled", "<div></div>");
+
+  // Fused or not, each filter gets an entry, and is shown every event.
+  // The writer, added by ValidateNoChanges, is fused with c and d.
+  const std::vector<HtmlFilterProfile::Entry>& entries = profile.entries();
+  ASSERT_EQ(5U, entries.size());
+  EXPECT_EQ("a", entries[0].name);
+  EXPECT_EQ("b", entries[1].name);
+  EXPECT_EQ("c", entries[2].name);
+  EXPECT_EQ("d", entries[3].name);
+  EXPECT_EQ("HtmlWriter", entries[4].name);
+  EXPECT_LT(0, entries[0].events);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(entries[0].events, entries[i].events);
+    EXPECT_EQ(1, entries[i].passes);
+  }
+
+  // Turning profiling off leaves the profile alone.
+  html_parse_.set_filter_profile(NULL);
+  ValidateNoChanges("unprofiled", "<div></div>");
+  EXPECT_EQ(1, profile.entries()[0].passes);
+}
+
 }  // namespace net_instaweb
@@ -57,6 +57,8 @@ class HtmlWriterFilter : public HtmlFilter {
   virtual void DetermineEnabled(GoogleString* disabled_reason);
   // This filter will not change urls.
   virtual bool CanModifyUrls() { return false; }
+  // Serializing only reads each event as it goes by.
+  virtual bool IsStreamingSafe() const { return true; }
 
   void set_max_column(int max_column) { max_column_ = max_column; }
   void set_case_fold(bool case_fold) { case_fold_ = case_fold; }
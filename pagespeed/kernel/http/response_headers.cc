@@ -94,6 +94,13 @@ void ApplyTimeDelta(const char* attr, int64 delta_ms,
 bool ResponseHeaders::IsImminentlyExpiring(
     int64 start_date_ms, int64 expire_ms, int64 now_ms,
     const HttpOptions& http_options) {
+  int64 imminent_ms =
+      ImminentExpirationTimeMs(start_date_ms, expire_ms, http_options);
+  return (imminent_ms >= 0) && (now_ms > imminent_ms);
+}
+
+int64 ResponseHeaders::ImminentExpirationTimeMs(
+    int64 start_date_ms, int64 expire_ms, const HttpOptions& http_options) {
   // Consider a resource with 5 minute expiration time (the default
   // assumed by mod_pagespeed when a potentialy cacheable resource
   // lacks a cache control header, which happens a lot).  If the
@@ -114,12 +121,12 @@ bool ResponseHeaders::IsImminentlyExpiring(
   // not honor it here. Fix that.
 
   if (ttl_ms < http_options.implicit_cache_ttl_ms) {
-    return false;
+    return -1;
   }
   int64 freshen_threshold = std::min(
       http_options.implicit_cache_ttl_ms,
       ((100 - kRefreshExpirePercent) * ttl_ms) / 100);
-  return (expire_ms - now_ms < freshen_threshold);
+  return expire_ms - freshen_threshold;
 }
 
 void ResponseHeaders::FixDateHeaders(int64 now_ms) {
@@ -352,6 +359,31 @@ void ResponseHeaders::UpdateFrom(const Headers<HttpResponseHeaders>& other) {
   Headers<HttpResponseHeaders>::UpdateFrom(other);
 }
 
+void ResponseHeaders::UpdateFromNotModified(
+    const ResponseHeaders& not_modified) {
+  // The headers a 304 may carry to update the stored response, per RFC 7232
+  // section 4.1, plus Last-Modified, which belongs with the validator.  Any
+  // others, such as a Content-Length of 0, describe the 304 itself.
+  static const char* const kUpdatedHeaders[] = {
+    HttpAttributes::kCacheControl,
+    HttpAttributes::kDate,
+    HttpAttributes::kEtag,
+    HttpAttributes::kExpires,
+    HttpAttributes::kLastModified,
+    HttpAttributes::kVary,
+  };
+  ResponseHeaders updates;
+  for (int i = 0, n = not_modified.NumAttributes(); i < n; ++i) {
+    for (int j = 0; j < static_cast<int>(arraysize(kUpdatedHeaders)); ++j) {
+      if (StringCaseEqual(not_modified.Name(i), kUpdatedHeaders[j])) {
+        updates.Add(not_modified.Name(i), not_modified.Value(i));
+        break;
+      }
+    }
+  }
+  UpdateFrom(updates);
+}
+
 void ResponseHeaders::UpdateFromProto(const HttpResponseHeaders& proto) {
   Clear();
   cache_fields_dirty_ = true;
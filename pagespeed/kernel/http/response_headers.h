@@ -58,6 +58,11 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
       int64 start_date_ms, int64 expire_ms, int64 now_ms,
       const HttpOptions& options);
 
+  // Returns the time after which IsImminentlyExpiring becomes true for a
+  // resource with the given date and TTL, or -1 if it never does.
+  static int64 ImminentExpirationTimeMs(
+      int64 start_date_ms, int64 expire_ms, const HttpOptions& options);
+
   // This will set Date and (if supplied in the first place, Expires)
   // header to now if the delta of date header wrt now_ms is more than
   // a tolerance.  Leaves the ComputeCaching state dirty if it came in
@@ -86,6 +91,11 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // so that we don't expose the base UpdateFrom (and to avoid "hiding" errors).
   virtual void UpdateFrom(const Headers<HttpResponseHeaders>& other);
 
+  // Updates these headers, of a stored response, with the caching and
+  // validator headers of a 304 Not Modified that revalidated it.  The status
+  // and any headers describing the content are left as they are.
+  void UpdateFromNotModified(const ResponseHeaders& not_modified);
+
   // Initializes the response headers with the one in proto, clearing the
   // existing fields.
   void UpdateFromProto(const HttpResponseHeaders& proto);
@@ -999,6 +999,47 @@ TEST_F(ResponseHeadersTest, TestUpdateFrom) {
   EXPECT_EQ(expected_merged_header_string, actual_merged_header_string);
 }
 
+TEST_F(ResponseHeadersTest, TestUpdateFromNotModified) {
+  const char old_header_string[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Date: Fri, 22 Apr 2011 19:34:33 GMT\r\n"
+      "Etag: \"a\"\r\n"
+      "Content-Length: 241260\r\n"
+      "Cache-control: public, max-age=600\r\n"
+      "Content-Type: image/jpeg\r\n"
+      "\r\n";
+  const char new_header_string[] =
+      "HTTP/1.1 304 Not Modified\r\n"
+      "Date: Fri, 22 Apr 2011 19:49:59 GMT\r\n"
+      "Content-Length: 0\r\n"
+      "Cache-control: public, max-age=3600\r\n"
+      "Set-Cookie: LA=1275937193\r\n"
+      "\r\n";
+  const char expected_merged_header_string[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Etag: \"a\"\r\n"
+      "Content-Length: 241260\r\n"
+      "Content-Type: image/jpeg\r\n"
+      "Date: Fri, 22 Apr 2011 19:49:59 GMT\r\n"
+      "Cache-control: public, max-age=3600\r\n"
+      "\r\n";
+
+  ResponseHeaders old_headers, new_headers;
+  ResponseHeadersParser old_parser(&old_headers), new_parser(&new_headers);
+  old_parser.ParseChunk(old_header_string, &message_handler_);
+  new_parser.ParseChunk(new_header_string, &message_handler_);
+
+  // Only the 304's Date and caching headers are taken.
+  old_headers.UpdateFromNotModified(new_headers);
+  old_headers.ComputeCaching();
+  EXPECT_EQ(3600 * Timer::kSecondMs, old_headers.cache_ttl_ms());
+
+  GoogleString actual_merged_header_string;
+  StringWriter merged_writer(&actual_merged_header_string);
+  old_headers.WriteAsHttp(&merged_writer, &message_handler_);
+  EXPECT_EQ(expected_merged_header_string, actual_merged_header_string);
+}
+
 TEST_F(ResponseHeadersTest, TestCachingVaryStar) {
   ParseHeaders(StrCat("HTTP/1.0 200 OK\r\n"
                       "Date: ", start_time_string_, "\r\n"
@@ -62,9 +62,14 @@
 //    (But note that the size of the hash portion is dependent on the Hasher;
 //     and the struct is padded to be 8-aligned).
 //
+// 7) A FrequencySketch counting recent lookups of keys in this sector, only
+//    present when admission_policy() is kTinyLfuAdmission: a new key then
+//    only replaces an existing entry in its associativity set if it has been
+//    looked up more often. The sketch is updated without the sector lock.
+//
 // Padding to align to block size.
 //
-// 7) The data blocks. These contain the actual payload.
+// 8) The data blocks. These contain the actual payload.
 //
 // ----------------------------------------------------------------------------
 // Cache directory usage
@@ -101,25 +106,48 @@
 // ::Put() fail, but the filter would proceeds anyway as it has no way of
 // knowing?
 //
-// creating and open_count are used to lock the particular entry for
-// reading or writing while the main sector lock is released.
-//
-// The following are the possible combinations:
-// Creating?  Open_count
-// False      0           Entry unlocked --- can read, write, etc. freely
-// False      n > 0       n processes reading. More readers can freely join.
-// True       n > 0       n processes reading. Writer waiting for them to
-//                          finish. Readers can't join.
-// True       0           Writer working.
+// sequence lets readers work without taking the sector lock at all, seqlock
+// style. Writers make it odd (under the sector lock) before they change the
+// entry's key, size, block list or payload, or hand its blocks to another
+// entry, and make it even again once done. An odd sequence also locks the
+// entry for writing while the main sector lock is released; other writers
+// give up on such entries. A reader samples the sequence, gives up if it's
+// odd, copies out the key and payload, and then re-checks the sequence; if it
+// changed, a writer got in the way and the copy is discarded and retried.
+// A Get of an entry that's being written is a miss, as it always was.
+// Readers only take the lock (via TryLock, so they don't block) to move a hit
+// entry to the front of the LRU.
 //
-// For now, writers wait in sleep loop, while readers simply fail/miss.
+// pin_count lets readers that want to look at the payload in place, rather
+// than copy it, keep writers out in the meantime. A reader atomically
+// increments it and then checks that the sequence didn't change, while
+// writers make the sequence odd and then wait for pin_count to go to 0 (or,
+// when evicting, just pick another entry). This is only done for payloads
+// stored in consecutive blocks; blocks are handed out in ascending order and
+// sorted when allocated for a value to make that the common case.
 //
 // TODO(morlovich): Evaluate using chaining and one more layer of indirection
 // instead, as it should hopefully produce much better utilization and avoid
 // conflict misses entirely.
+//
+// ----------------------------------------------------------------------------
+// Image format
+// ----------------------------------------------------------------------------
+//
+// SaveImage writes out, in native byte order:
+//
+// 1) An ImageHeader, identifying the format version and the cache geometry.
+//
+// 2) For each sector, an Adler-32 checksum of its image, padded to align to
+//    8, followed by the image: the sector's memory as described above, minus
+//    the mutex and its padding. Everything is thus 8-aligned.
+//
+// Keeping each checksum next to its sector lets the image be written and
+// read back a sector at a time.
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 
+#include <algorithm>
 #include <cstddef>                     // for size_t
 #include <cstring>
 #include <map>
@@ -129,6 +157,7 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/base64_util.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
@@ -141,8 +170,14 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_snapshot.pb.h"
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"  // NOLINT
+#else
+#include "third_party/zlib/zlib.h"
+#endif
 
 namespace net_instaweb {
 
@@ -158,6 +193,109 @@ using SharedMemCacheData::kHashSize;
 
 namespace {
 
+// How many times Get will redo a lock-free read that was invalidated by a
+// concurrent writer before calling it a miss.
+const int kMaxGetRetries = 3;
+
+// How long a writer waits for readers that have an entry pinned before giving
+// up on the write. Pins are only held for the duration of a
+// ValidateCandidate() call, so running out of time almost certainly means the
+// reader died holding one.
+const int64 kMaxPinWaitUs = 100 * Timer::kMsUs;
+
+// Header of images written by SaveImage. Bump kImageVersion whenever the
+// layout of sectors changes.
+struct ImageHeader {
+  char magic[8];
+  uint32 byte_order_mark;
+  uint32 version;
+  uint32 block_size;
+  int32 num_sectors;
+  int32 entries_per_sector;
+  int32 blocks_per_sector;
+  uint64 sector_image_size;
+};
+
+const char kImageMagic[] = "PSSHMIMG";  // not NUL-terminated in images
+const uint32 kImageByteOrderMark = 0x01020304;
+const uint32 kImageVersion = 3;
+
+// Precedes each sector's image.
+struct SectorImageHeader {
+  uint32 checksum;  // Adler-32 of the sector's image.
+  uint32 padding;
+};
+
+void FillImageHeader(size_t block_size, int num_sectors,
+                     int entries_per_sector, int blocks_per_sector,
+                     size_t sector_image_size, ImageHeader* header) {
+  std::memset(header, 0, sizeof(*header));
+  std::memcpy(header->magic, kImageMagic, sizeof(header->magic));
+  header->byte_order_mark = kImageByteOrderMark;
+  header->version = kImageVersion;
+  header->block_size = block_size;
+  header->num_sectors = num_sectors;
+  header->entries_per_sector = entries_per_sector;
+  header->blocks_per_sector = blocks_per_sector;
+  header->sector_image_size = sector_image_size;
+}
+
+uint32 Adler32(const char* data, size_t size) {
+  return adler32(adler32(0, Z_NULL, 0),
+                 reinterpret_cast<const Bytef*>(data), size);
+}
+
+// Reads exactly size bytes from file into buf, returning false if there
+// aren't that many.
+bool ReadFully(FileSystem::InputFile* file, char* buf, size_t size,
+               MessageHandler* handler) {
+  while (size > 0) {
+    int bytes_read = file->Read(
+        buf, static_cast<int>(std::min<size_t>(size, kint32max)), handler);
+    if (bytes_read <= 0) {
+      return false;
+    }
+    buf += bytes_read;
+    size -= bytes_read;
+  }
+  return true;
+}
+
+// Seqlock helpers for CacheEntry::sequence. Writers hold the sector lock.
+void BeginEntryWrite(CacheEntry* entry) {
+  DCHECK_EQ(0, entry->sequence & 1);
+  base::subtle::NoBarrier_Store(&entry->sequence, entry->sequence + 1);
+  // Make sure readers see the odd sequence before any of our changes.
+  base::subtle::MemoryBarrier();
+}
+
+void EndEntryWrite(CacheEntry* entry) {
+  DCHECK_EQ(1, entry->sequence & 1);
+  base::subtle::Release_Store(&entry->sequence, entry->sequence + 1);
+}
+
+// Key hash fed to the sector's FrequencySketch. The raw hashes are already
+// very random, so any 8 bytes will do.
+uint64 SketchHash(const char* hash_bytes) {
+  uint64 hash;
+  std::memcpy(&hash, hash_bytes, sizeof(hash));
+  return hash;
+}
+
+bool IsBeingWritten(const CacheEntry* entry) {
+  return (base::subtle::NoBarrier_Load(&entry->sequence) & 1) != 0;
+}
+
+bool IsPinned(const CacheEntry* entry) {
+  return base::subtle::NoBarrier_Load(&entry->pin_count) != 0;
+}
+
+void UnpinEntry(CacheEntry* entry) {
+  // The barrier makes sure we are done reading the payload before a writer
+  // can see the pin go away.
+  base::subtle::Barrier_AtomicIncrement(&entry->pin_count, -1);
+}
+
 bool IsAllNil(const StringPiece& raw_hash) {
   bool all_nil = true;
   for (size_t c = 0; c < raw_hash.length(); ++c) {
@@ -202,7 +340,8 @@ SharedMemCache<kBlockSize>::SharedMemCache(
       num_sectors_(sectors),
       entries_per_sector_(entries_per_sector),
       blocks_per_sector_(blocks_per_sector),
-      handler_(handler) {
+      handler_(handler),
+      admission_policy_(kLruAdmission) {
 }
 
 template<size_t kBlockSize>
@@ -217,9 +356,11 @@ SharedMemCache<kBlockSize>::~SharedMemCache() {
 
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
+  bool with_frequency_sketch = (admission_policy_ == kTinyLfuAdmission);
   size_t sector_size =
       Sector<kBlockSize>::RequiredSize(shm_runtime_, entries_per_sector_,
-                                       blocks_per_sector_);
+                                       blocks_per_sector_,
+                                       with_frequency_sketch);
   size_t size = num_sectors_ * sector_size;
 
   if (parent) {
@@ -241,7 +382,8 @@ bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
   for (int s = 0; s < num_sectors_; ++s) {
     scoped_ptr<Sector<kBlockSize> > sec(
         new Sector<kBlockSize>(segment_.get(), s * sector_size,
-                               entries_per_sector_, blocks_per_sector_));
+                               entries_per_sector_, blocks_per_sector_,
+                               with_frequency_sketch));
     bool ok;
     if (parent) {
       ok = sec->Initialize(handler_);
@@ -321,6 +463,7 @@ GoogleString SharedMemCache<kBlockSize>::DumpStats() {
   SectorStats aggregate;
   for (size_t c = 0; c < sectors_.size(); ++c) {
     sectors_[c]->mutex()->Lock();
+    sectors_[c]->FoldUnlockedStats();
     aggregate.Add(*sectors_[c]->sector_stats());
     sectors_[c]->mutex()->Unlock();
   }
@@ -344,9 +487,9 @@ void SharedMemCache<kBlockSize>::AddSectorToSnapshot(
 
     // It's possible that the sector got unlocked while a Put is
     // updating the payload for an entry. In that case, the entry will
-    // have its creating bit set (but the metadata will be valid).
+    // have an odd sequence number (but the metadata will be valid).
     // We skip those.
-    if (!cur_entry->creating) {
+    if (!IsBeingWritten(cur_entry)) {
       SharedMemCacheDumpEntry* dump_entry = dest->add_entry();
       dump_entry->set_raw_key(cur_entry->hash_bytes, kHashSize);
       dump_entry->set_last_use_timestamp_ms(cur_entry->last_use_timestamp_ms);
@@ -402,6 +545,101 @@ void SharedMemCache<kBlockSize>::DemarshalSnapshot(
   out->ParseFromZeroCopyStream(&input);
 }
 
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::SaveImage(FileSystem::OutputFile* file) {
+  DCHECK_EQ(static_cast<size_t>(num_sectors_), sectors_.size());
+  ImageHeader header;
+  FillImageHeader(kBlockSize, num_sectors_, entries_per_sector_,
+                  blocks_per_sector_, sectors_[0]->ImageSize(), &header);
+  if (!file->Write(StringPiece(reinterpret_cast<const char*>(&header),
+                               sizeof(header)), handler_)) {
+    return false;
+  }
+
+  // Reused for every sector, so it's only ever one sector large.
+  GoogleString sector_image;
+  sector_image.reserve(header.sector_image_size);
+  for (size_t s = 0; s < sectors_.size(); ++s) {
+    Sector<kBlockSize>* sector = sectors_[s];
+    sector_image.clear();
+    sector->mutex()->Lock();
+    sector->SaveImage(&sector_image);
+    sector->mutex()->Unlock();
+
+    SectorImageHeader sector_header;
+    sector_header.checksum = Adler32(sector_image.data(), sector_image.size());
+    sector_header.padding = 0;
+    if (!file->Write(StringPiece(reinterpret_cast<const char*>(&sector_header),
+                                 sizeof(sector_header)), handler_) ||
+        !file->Write(sector_image, handler_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::RestoreImage(FileSystem::InputFile* file) {
+  DCHECK_EQ(static_cast<size_t>(num_sectors_), sectors_.size());
+  ImageHeader expected, header;
+  FillImageHeader(kBlockSize, num_sectors_, entries_per_sector_,
+                  blocks_per_sector_, sectors_[0]->ImageSize(), &expected);
+  if (!ReadFully(file, reinterpret_cast<char*>(&header), sizeof(header),
+                 handler_)) {
+    handler_->Message(kWarning, "SharedMemCache: image for %s is truncated",
+                      filename_.c_str());
+    return false;
+  }
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    handler_->Message(
+        kWarning, "SharedMemCache: image for %s is from a different version "
+        "or configuration of the cache; ignoring it", filename_.c_str());
+    return false;
+  }
+
+  // Only one sector is read in at a time.
+  size_t sector_image_size = header.sector_image_size;
+  scoped_array<char> sector_image(new char[sector_image_size]);
+  for (size_t s = 0; s < sectors_.size(); ++s) {
+    SectorImageHeader sector_header;
+    if (!ReadFully(file, reinterpret_cast<char*>(&sector_header),
+                   sizeof(sector_header), handler_) ||
+        !ReadFully(file, sector_image.get(), sector_image_size, handler_)) {
+      handler_->Message(
+          kWarning, "SharedMemCache: image for %s is truncated at sector %d; "
+          "restored the sectors before it", filename_.c_str(),
+          static_cast<int>(s));
+      return false;
+    }
+    if (Adler32(sector_image.get(), sector_image_size) !=
+        sector_header.checksum) {
+      handler_->Message(
+          kWarning, "SharedMemCache: sector %d of image for %s is corrupt; "
+          "skipping it", static_cast<int>(s), filename_.c_str());
+      continue;
+    }
+
+    Sector<kBlockSize>* sector = sectors_[s];
+    sector->mutex()->Lock();
+    sector->RestoreImage(sector_image.get());
+
+    // Puts copy the payload with the sector unlocked, so the image may have
+    // caught some halfway. Their metadata is consistent, so just free them.
+    for (EntryNum e = 0; e < entries_per_sector_; ++e) {
+      CacheEntry* entry = sector->EntryAt(e);
+      if (IsBeingWritten(entry)) {
+        BlockVector blocks;
+        sector->BlockListForEntry(entry, &blocks);
+        sector->ReturnBlocksToFreeList(blocks);
+        MarkEntryFree(sector, e);
+        FinishWriting(sector, entry);
+      }
+    }
+    sector->mutex()->Unlock();
+  }
+  return true;
+}
+
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Put(const GoogleString& key,
                                      SharedString* value) {
@@ -432,7 +670,7 @@ void SharedMemCache<kBlockSize>::PutRawHash(
 
   Sector<kBlockSize>* sector = sectors_[pos.sector];
   SectorStats* stats = sector->sector_stats();
-  sector->mutex()->Lock();
+  LockSector(sector);
   ++stats->num_put;
 
   // See if our key already exists. Note that if it does, we will attempt to
@@ -444,10 +682,13 @@ void SharedMemCache<kBlockSize>::PutRawHash(
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
     if (KeyMatch(cand, raw_hash)) {
-      if (!cand->creating) {
+      if (!IsBeingWritten(cand)) {
         ++stats->num_put_update;
-        EnsureReadyForWriting(sector, cand);
-        PutIntoEntry(sector, cand_key, last_use_timestamp_ms, value);
+        if (EnsureReadyForWriting(sector, cand)) {
+          PutIntoEntry(sector, cand_key, last_use_timestamp_ms, value);
+        } else {
+          sector->mutex()->Unlock();
+        }
       } else {
         ++stats->num_put_concurrent_create;
         sector->mutex()->Unlock();
@@ -458,7 +699,7 @@ void SharedMemCache<kBlockSize>::PutRawHash(
 
   // We don't have a current entry with our key, but see if we can overwrite
   // something  unrelated. In this case, we even give up if there are only
-  // readers, as it's unclear that they are any less important than us.
+  // pinned readers, as it's unclear that they are any less important than us.
   EntryNum best_key = kInvalidEntry;
   CacheEntry* best = NULL;
   for (int p = 0; p < kAssociativity; ++p) {
@@ -482,11 +723,23 @@ void SharedMemCache<kBlockSize>::PutRawHash(
 
   if (best->byte_size != 0 ||
       !IsAllNil(StringPiece(best->hash_bytes, kHashSize))) {
+    if ((admission_policy_ == kTinyLfuAdmission) &&
+        !sector->frequency_sketch()->Admit(SketchHash(raw_hash.data()),
+                                           SketchHash(best->hash_bytes))) {
+      ++stats->num_put_rejected;
+      sector->mutex()->Unlock();
+      return;
+    }
     ++stats->num_put_replace;
   }
 
-  // Wait for readers before touching the key.
-  EnsureReadyForWriting(sector, best);
+  // Lock out other writers and invalidate readers before touching the key.
+  // Writeable() made sure nobody had the entry pinned, but a reader may have
+  // pinned it since.
+  if (!EnsureReadyForWriting(sector, best)) {
+    sector->mutex()->Unlock();
+    return;
+  }
   std::memcpy(best->hash_bytes, raw_hash.data(), kHashSize);
   PutIntoEntry(sector, best_key, last_use_timestamp_ms, value);
 }
@@ -498,8 +751,7 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
   const char* data = value->data();
 
   CacheEntry* entry = sector->EntryAt(entry_num);
-  DCHECK(entry->creating);
-  DCHECK_EQ(0u, entry->open_count);
+  DCHECK(IsBeingWritten(entry));
 
   // Adjust space allocation....
   size_t want_blocks = sector->DataBlocksForSize(value->size());
@@ -514,14 +766,16 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
       // and fail the insertion. This should be pretty much impossible.
       // TODO(morlovich): log warning?
       sector->ReturnBlocksToFreeList(blocks);
-      entry->creating = false;
       MarkEntryFree(sector, entry_num);
+      FinishWriting(sector, entry);
       sector->mutex()->Unlock();
       return;
     }
   }
 
-  // Free up any room we don't need.
+  // Free up any room we don't need, keeping the lowest-numbered blocks so the
+  // value is as likely as possible to be contiguous.
+  std::sort(blocks.begin(), blocks.end());
   if (blocks.size() > want_blocks) {
     BlockVector extras;
     while (blocks.size() > want_blocks) {
@@ -547,16 +801,17 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
 
   // Now we can write out the data. We can do it w/o the lock held
   // since we've already removed them from the freelist, and the LRU/directory
-  // entry is locked, so can't be concurrently freed.
+  // entry is locked, so can't be concurrently freed. Any lock-free readers
+  // will see the odd sequence number and keep away.
 
   for (size_t b = 0; b < want_blocks; ++b) {
     size_t bytes = sector->BytesInPortion(entry->byte_size, b, want_blocks);
     std::memcpy(sector->BlockBytes(blocks[b]), data + b * kBlockSize, bytes);
   }
 
-  // We're done, clear creating bit.
-  sector->mutex()->Lock();
-  entry->creating = false;
+  // We're done, let readers in.
+  LockSector(sector);
+  FinishWriting(sector, entry);
   sector->mutex()->Unlock();
 }
 
@@ -567,66 +822,181 @@ void SharedMemCache<kBlockSize>::Get(const GoogleString& key,
   Position pos;
   ExtractPosition(raw_hash, &pos);
   Sector<kBlockSize>* sector = sectors_[pos.sector];
-  sector->mutex()->Lock();
-  SectorStats* stats = sector->sector_stats();
-  ++stats->num_get;
+  if (admission_policy_ == kTinyLfuAdmission) {
+    sector->frequency_sketch()->Increment(SketchHash(raw_hash.data()));
+  }
 
+  // Note that we do not take the sector lock here; see the discussion of
+  // CacheEntry::sequence at the top of the file.
+  bool borrow = callback->accepts_borrowed_value();
+  int retries = 0;
   for (int p = 0; p < kAssociativity; ++p) {
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
-    if (KeyMatch(cand, raw_hash)) {
-      ++stats->num_get_hit;
-      GetFromEntry(key, sector, cand_key, callback);
+    int32 sequence = 0;
+    StringPiece view;
+    ReadResult result = kReadScattered;
+    if (borrow) {
+      result = TryPinEntry(sector, cand, raw_hash, &view, &sequence);
+      while ((result == kReadRaced) && (retries < kMaxGetRetries)) {
+        ++retries;
+        result = TryPinEntry(sector, cand, raw_hash, &view, &sequence);
+      }
+    }
+    if (result == kReadScattered) {
+      // Either the callback wants its own copy, or we can't give it a
+      // contiguous view.
+      result =
+          TryReadEntry(sector, cand, raw_hash, callback->value(), &sequence);
+      while ((result == kReadRaced) && (retries < kMaxGetRetries)) {
+        ++retries;
+        result =
+            TryReadEntry(sector, cand, raw_hash, callback->value(), &sequence);
+      }
+    }
+    if (result == kReadNoMatch) {
+      continue;
+    }
+
+    if ((result != kReadOk) && (result != kReadPinned)) {
+      // For now, consider concurrent creation a miss.
+      sector->RecordUnlockedGet(false, false, retries, false);
+      ValidateAndReportResult(key, kNotFound, callback);
       return;
     }
+
+    bool pinned = (result == kReadPinned);
+    RecordHit(sector, cand_key, sequence, pinned, retries);
+    if (pinned) {
+      KeyState state = ValidateBorrowedResult(key, view, callback);
+      UnpinEntry(cand);
+      ReportResult(state, callback);
+    } else {
+      ValidateAndReportResult(key, kAvailable, callback);
+    }
+    return;
   }
 
-  sector->mutex()->Unlock();
+  sector->RecordUnlockedGet(false, false, retries, false);
   ValidateAndReportResult(key, kNotFound, callback);
 }
 
 template<size_t kBlockSize>
-void SharedMemCache<kBlockSize>::GetFromEntry(
-    const GoogleString& key,
-    Sector<kBlockSize>* sector,
-    EntryNum entry_num,
-    Callback* callback) {
-  CacheEntry* entry = sector->EntryAt(entry_num);
-  if (entry->creating) {
-    // For now, consider concurrent creation a miss.
+void SharedMemCache<kBlockSize>::RecordHit(Sector<kBlockSize>* sector,
+                                           EntryNum entry_num, int32 sequence,
+                                           bool borrowed, int retries) {
+  // Update the LRU, but only if we can do so without waiting: a slightly
+  // stale LRU is a much better deal than readers queueing up behind
+  // writers on a hot sector.
+  if (sector->mutex()->TryLock()) {
+    SectorStats* stats = sector->sector_stats();
+    ++stats->num_get;
+    ++stats->num_get_hit;
+    if (borrowed) {
+      ++stats->num_get_borrowed;
+    }
+    stats->num_get_retries += retries;
+    // If the sequence number is unchanged, the entry still holds our key.
+    CacheEntry* entry = sector->EntryAt(entry_num);
+    if (base::subtle::NoBarrier_Load(&entry->sequence) == sequence) {
+      TouchEntry(sector, timer_->NowMs(), entry_num);
+    }
     sector->mutex()->Unlock();
-    ValidateAndReportResult(key, kNotFound, callback);
-    return;
+  } else {
+    sector->RecordUnlockedGet(true, borrowed, retries, true);
   }
-  ++entry->open_count;
+}
 
-  TouchEntry(sector, timer_->NowMs(), entry_num);
+template<size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::ReadResult
+SharedMemCache<kBlockSize>::TryReadEntry(
+    Sector<kBlockSize>* sector, CacheEntry* entry,
+    const GoogleString& raw_hash, SharedString* out, int32* sequence) {
+  int32 start_sequence = base::subtle::Acquire_Load(&entry->sequence);
+  if (!KeyMatch(entry, raw_hash)) {
+    // If a writer is concurrently changing the key to ours, we might report
+    // a miss instead of a hit; that's fine.
+    return kReadNoMatch;
+  }
+  if ((start_sequence & 1) != 0) {
+    return kReadBusy;
+  }
 
+  // Snapshot the fields we need, since they may change underneath us.
+  int32 byte_size = entry->byte_size;
+  BlockNum first_block = entry->first_block;
   BlockVector blocks;
-  sector->BlockListForEntry(entry, &blocks);
-
-  // Drop the lock as the entry is now opened for reading.
-  sector->mutex()->Unlock();
+  if (!sector->BlockListForSizeUnlocked(first_block, byte_size, &blocks)) {
+    return kReadRaced;
+  }
 
   // Collect the contents.
-  SharedString* out = callback->value();
   out->DetachAndClear();
-  out->Extend(entry->byte_size);
+  out->Extend(byte_size);
 
   size_t total_blocks = blocks.size();
   int pos = 0;
   for (size_t b = 0; b < total_blocks; ++b) {
-    int bytes = sector->BytesInPortion(entry->byte_size, b, total_blocks);
+    int bytes = sector->BytesInPortion(byte_size, b, total_blocks);
     out->WriteAt(pos, sector->BlockBytes(blocks[b]), bytes);
     pos += bytes;
   }
 
-  // Now reduce the reference count.
-  // TODO(morlovich): atomic ops?
-  sector->mutex()->Lock();
-  --entry->open_count;
-  sector->mutex()->Unlock();
-  ValidateAndReportResult(key, kAvailable, callback);
+  // Make sure all of the above reads happen before we re-check the sequence.
+  base::subtle::MemoryBarrier();
+  if (base::subtle::NoBarrier_Load(&entry->sequence) != start_sequence) {
+    out->DetachAndClear();
+    return kReadRaced;
+  }
+  *sequence = start_sequence;
+  return kReadOk;
+}
+
+template<size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::ReadResult
+SharedMemCache<kBlockSize>::TryPinEntry(
+    Sector<kBlockSize>* sector, CacheEntry* entry,
+    const GoogleString& raw_hash, StringPiece* view, int32* sequence) {
+  int32 start_sequence = base::subtle::Acquire_Load(&entry->sequence);
+  if (!KeyMatch(entry, raw_hash)) {
+    return kReadNoMatch;
+  }
+  if ((start_sequence & 1) != 0) {
+    return kReadBusy;
+  }
+
+  // Pin, and then make sure no writer started in the meantime. Writers
+  // make the sequence odd before checking for pins, and both sides use full
+  // barriers, so either they will see our pin or we will see their change.
+  base::subtle::Barrier_AtomicIncrement(&entry->pin_count, 1);
+  if (base::subtle::NoBarrier_Load(&entry->sequence) != start_sequence) {
+    UnpinEntry(entry);
+    return kReadRaced;
+  }
+
+  // The entry can't change now, so it's safe to look at it.
+  BlockVector blocks;
+  bool ok = sector->BlockListForSizeUnlocked(entry->first_block,
+                                             entry->byte_size, &blocks);
+  DCHECK(ok);
+  for (size_t b = 1; b < blocks.size(); ++b) {
+    if (blocks[b] != blocks[b - 1] + 1) {
+      ok = false;
+      break;
+    }
+  }
+  if (!ok) {
+    UnpinEntry(entry);
+    return kReadScattered;
+  }
+
+  if (blocks.empty()) {
+    *view = StringPiece();
+  } else {
+    *view = StringPiece(sector->BlockBytes(blocks[0]), entry->byte_size);
+  }
+  *sequence = start_sequence;
+  return kReadPinned;
 }
 
 template<size_t kBlockSize>
@@ -636,7 +1006,7 @@ void SharedMemCache<kBlockSize>::Delete(const GoogleString& key) {
   ExtractPosition(raw_hash, &pos);
 
   Sector<kBlockSize>* sector = sectors_[pos.sector];
-  sector->mutex()->Lock();
+  LockSector(sector);
 
   for (int p = 0; p < kAssociativity; ++p) {
     EntryNum cand_key = pos.keys[p];
@@ -653,19 +1023,21 @@ template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::DeleteEntry(Sector<kBlockSize>* sector,
                                              EntryNum entry_num) {
   CacheEntry* entry = sector->EntryAt(entry_num);
-  if (entry->creating) {
+  if (IsBeingWritten(entry)) {
     // A multiple writers (Put or Delete) race. Let the other one proceed,
-    // drop this one. (Call to EnsureReadyForWriting below will deal with any
-    // outstanding readers).
+    // drop this one.
+    sector->mutex()->Unlock();
+    return;
+  }
+  if (!EnsureReadyForWriting(sector, entry)) {
     sector->mutex()->Unlock();
     return;
   }
-  EnsureReadyForWriting(sector, entry);
   BlockVector blocks;
   sector->BlockListForEntry(entry, &blocks);
   sector->ReturnBlocksToFreeList(blocks);
-  entry->creating = false;
   MarkEntryFree(sector, entry_num);
+  FinishWriting(sector, entry);
   sector->mutex()->Unlock();
 }
 
@@ -716,9 +1088,12 @@ bool SharedMemCache<kBlockSize>::TryAllocateBlocks(
   EntryNum entry_num = sector->OldestEntryNum();
   while ((entry_num != kInvalidEntry) && (got < goal)) {
     CacheEntry* entry = sector->EntryAt(entry_num);
-    if (Writeable(entry)) {
+    // Taking over the blocks is a write as far as readers are concerned.
+    // We don't want to wait for any pinned readers here, however.
+    if (Writeable(entry) && TryStartWritingUnpinned(sector, entry)) {
       got += sector->BlockListForEntry(entry, blocks);
       MarkEntryFree(sector, entry_num);
+      FinishWriting(sector, entry);
       entry_num = sector->OldestEntryNum();
     } else {
       entry_num = entry->lru_prev;
@@ -733,7 +1108,7 @@ void SharedMemCache<kBlockSize>::MarkEntryFree(Sector<kBlockSize>* sector,
                                                EntryNum entry_num) {
   sector->UnlinkEntryFromLRU(entry_num);
   CacheEntry* entry = sector->EntryAt(entry_num);
-  CHECK(Writeable(entry));
+  CHECK(IsBeingWritten(entry));
   std::memset(entry->hash_bytes, 0, kHashSize);
   entry->last_use_timestamp_ms = 0;
   entry->byte_size = 0;
@@ -752,7 +1127,7 @@ void SharedMemCache<kBlockSize>::TouchEntry(Sector<kBlockSize>* sector,
 
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::Writeable(const CacheEntry* entry) {
-  return (entry->open_count == 0) && !entry->creating;
+  return !IsBeingWritten(entry) && !IsPinned(entry);
 }
 
 template<size_t kBlockSize>
@@ -812,25 +1187,69 @@ void SharedMemCache<kBlockSize>::ExtractPosition(
 }
 
 template<size_t kBlockSize>
-void SharedMemCache<kBlockSize>::EnsureReadyForWriting(
+bool SharedMemCache<kBlockSize>::EnsureReadyForWriting(
     Sector<kBlockSize>* sector, CacheEntry* entry) {
-  // It is possible that as we are starting to write, some other processes
-  // are still in the middle of copying in read data for this entry, so we have
-  // to make sure they finish up first.
-  //
-  // First, make sure no other readers or writers can join. With ->creating set
-  // to true they will both avoid this entry. (And there are no other writers
-  // as if there were, we would have given up ourselves).
-  //
-  entry->creating = true;
-
-  // Now just wait for previous readers to leave.
-  while (entry->open_count > 0) {
+  // With an odd sequence number other writers will avoid this entry. (And
+  // there are no other writers now, as if there were, we would have given up
+  // ourselves). Copying readers may still be in the middle of copying out
+  // the old contents, but they will notice the sequence number change and
+  // discard what they got, so there is no need to wait for them. We do have
+  // to wait for readers who have the payload pinned, however --- but only
+  // for so long, as a process that dies holding a pin never lets go of it.
+  DCHECK(!IsBeingWritten(entry));
+  BeginEntryWrite(entry);
+
+  int64 deadline_us = -1;
+  while (IsPinned(entry)) {
+    int64 now_us = timer_->NowUs();
+    if (deadline_us < 0) {
+      deadline_us = now_us + kMaxPinWaitUs;
+    } else if (now_us >= deadline_us) {
+      ++sector->sector_stats()->num_put_pin_timeouts;
+      FinishWriting(sector, entry);
+      return false;
+    }
     ++sector->sector_stats()->num_put_spins;
     sector->mutex()->Unlock();
     timer_->SleepUs(50);
     sector->mutex()->Lock();
   }
+  return true;
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::TryStartWritingUnpinned(
+    Sector<kBlockSize>* sector, CacheEntry* entry) {
+  DCHECK(!IsBeingWritten(entry));
+  BeginEntryWrite(entry);
+  if (IsPinned(entry)) {
+    EndEntryWrite(entry);
+    return false;
+  }
+  return true;
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::FinishWriting(
+    Sector<kBlockSize>* sector, CacheEntry* entry) {
+  EndEntryWrite(entry);
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::LockSector(Sector<kBlockSize>* sector)
+    NO_THREAD_SAFETY_ANALYSIS {
+  AbstractMutex* mutex = sector->mutex();
+  bool contended = !mutex->TryLock();
+  int64 wait_us = 0;
+  if (contended) {
+    int64 start_us = timer_->NowUs();
+    mutex->Lock();
+    wait_us = timer_->NowUs() - start_us;
+  }
+  SectorStats* stats = sector->sector_stats();
+  ++stats->lock_wait_histogram[SectorStats::LockWaitBucket(contended,
+                                                           wait_us)];
+  sector->FoldUnlockedStats();
 }
 
 template class SharedMemCache<64>;  // metadata ("rname") cache
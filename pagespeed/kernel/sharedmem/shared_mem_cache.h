@@ -22,11 +22,15 @@
 #include <cstddef>
 #include <vector>
 
+#include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
 namespace net_instaweb {
@@ -88,11 +92,30 @@ class SharedMemCache : public CacheInterface {
                                 int* blocks_per_sector_out,
                                 int64* size_cap_out);
 
+  // Selects whether a new key may always replace the least recently used
+  // entry in its associativity set (kLruAdmission, the default), or only if
+  // it has been looked up more often (kTinyLfuAdmission). This is
+  // per-process state, so should be set before forking children, but the
+  // lookup counts it relies on are kept in shared memory, which is only set
+  // aside for kTinyLfuAdmission.  So this must be called before Initialize
+  // and Attach, except to fall back to kLruAdmission.
+  void set_admission_policy(CacheAdmissionPolicy policy) {
+    DCHECK(sectors_.empty() || (policy == kLruAdmission) ||
+           (sectors_[0]->frequency_sketch() != NULL));
+    admission_policy_ = policy;
+  }
+  CacheAdmissionPolicy admission_policy() const { return admission_policy_; }
+
   // Returns the largest size of an object this cache can store.
   size_t MaxValueSize() const {
     return (blocks_per_sector_ * kBlockSize) / 8;
   }
 
+  // Returns the most entries this cache can hold.
+  int64 MaxEntries() const {
+    return static_cast<int64>(num_sectors_) * entries_per_sector_;
+  }
+
   // Returns some statistics as plaintext.
   // TODO(morlovich): Potentially periodically push these to the main
   // Statistics system (or pull to it from these).
@@ -113,6 +136,27 @@ class SharedMemCache : public CacheInterface {
   static void DemarshalSnapshot(const GoogleString& marshaled,
                                 SharedMemCacheDump* out);
 
+  // Writes the entire cache to 'file' as an image that mirrors its memory
+  // layout, so RestoreImage can bring it back with a copy per sector rather
+  // than re-inserting each entry like RestoreSnapshot. The image is
+  // versioned and checksummed, but is only usable by a cache with the same
+  // geometry, on the same kind of machine. It's meant to be written out by
+  // the root process as it shuts down, and read back by the next one.
+  // Sectors are written one at a time, so only one sector's worth of the
+  // cache is held outside shared memory at once. Returns false if writing
+  // failed.
+  // Note: each sector is locked out in turn while it's being copied.
+  bool SaveImage(FileSystem::OutputFile* file);
+
+  // Replaces the contents of the cache with an image saved by SaveImage,
+  // read from 'file' one sector at a time. Returns false, leaving the cache
+  // untouched, if the image is for a different version or geometry. Sectors
+  // whose checksum doesn't match are skipped. If the image is truncated,
+  // the sectors before the cut are restored and false is returned. This is
+  // meant to be called from the root process right after Initialize(),
+  // before children Attach().
+  bool RestoreImage(FileSystem::InputFile* file);
+
   virtual void Get(const GoogleString& key, Callback* callback);
   virtual void Put(const GoogleString& key, SharedString* value);
   virtual void Delete(const GoogleString& key);
@@ -140,12 +184,38 @@ class SharedMemCache : public CacheInterface {
   void PutRawHash(const GoogleString& raw_hash, int64 last_use_timestamp_ms,
                   SharedString* value);
 
-  // Finish a get, with the entry matching and sector lock held.
-  // Releases lock when done.
-  void GetFromEntry(const GoogleString& key,
-                    SharedMemCacheData::Sector<kBlockSize>* sector,
-                    SharedMemCacheData::EntryNum entry_num, Callback* callback)
-      UNLOCK_FUNCTION(sector->mutex());
+  // Outcomes of an optimistic, lock-free read of an entry.
+  enum ReadResult {
+    kReadNoMatch,    // the entry holds some other key
+    kReadBusy,       // the entry holds our key, but is being written
+    kReadRaced,      // a writer changed the entry while we were reading it
+    kReadScattered,  // the payload is not contiguous, so can't be pinned
+    kReadPinned,     // the entry is pinned, and *view points to its payload
+    kReadOk          // *out holds the payload
+  };
+
+  // Tries to read the payload of the given entry into *out without the
+  // sector lock held, provided that it holds raw_hash. On kReadOk, sets
+  // *sequence to the entry's sequence number at time of the read.
+  ReadResult TryReadEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
+                          SharedMemCacheData::CacheEntry* entry,
+                          const GoogleString& raw_hash, SharedString* out,
+                          int32* sequence);
+
+  // Like TryReadEntry, but rather than copying the payload pins the entry
+  // and points *view directly at it. On kReadPinned, the caller must
+  // unpin the entry when done with *view.
+  ReadResult TryPinEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
+                         SharedMemCacheData::CacheEntry* entry,
+                         const GoogleString& raw_hash, StringPiece* view,
+                         int32* sequence);
+
+  // Accounts for a Get hit on the given entry, read at the given sequence
+  // number, and moves it to the front of the LRU if that can be done without
+  // waiting for the sector lock.
+  void RecordHit(SharedMemCacheData::Sector<kBlockSize>* sector,
+                 SharedMemCacheData::EntryNum entry_num, int32 sequence,
+                 bool borrowed, int retries);
 
   // Finish a put into the given entry. Lock is expected to be held at entry,
   // will be released when done. The hash in the entry must also be already
@@ -173,7 +243,8 @@ class SharedMemCache : public CacheInterface {
       EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
 
   // Marks the given entry free in the directory, and unlinks it from the LRU.
-  // Note that this does not touch the entry's blocks.
+  // Note that this does not touch the entry's blocks. The entry must be
+  // in the middle of a write (see EnsureReadyForWriting).
   void MarkEntryFree(SharedMemCacheData::Sector<kBlockSize>* sector,
                      SharedMemCacheData::EntryNum entry_num);
 
@@ -182,8 +253,8 @@ class SharedMemCache : public CacheInterface {
                   int64 last_use_timestamp_ms,
                   SharedMemCacheData::EntryNum entry_num);
 
-  // Returns true if the entry can be written (in particular meaning it's not
-  // opened by someone else)
+  // Returns true if the entry can be written (in particular meaning no one
+  // else is writing it or has it pinned)
   bool Writeable(const SharedMemCacheData::CacheEntry* entry);
 
   bool KeyMatch(SharedMemCacheData::CacheEntry* entry,
@@ -194,12 +265,33 @@ class SharedMemCache : public CacheInterface {
   // Given a hash, tells what sector and what entries in it to check.
   void ExtractPosition(const GoogleString& raw_hash, Position* out_pos);
 
-  // Makes sure we have exclusive write access to the entry, with no concurrent
-  // readers. Must be called with sector lock held.
-  void EnsureReadyForWriting(SharedMemCacheData::Sector<kBlockSize>* sector,
+  // Marks the entry as being written, which makes other writers avoid it and
+  // lock-free readers discard anything they read from it until
+  // FinishWriting() is called, and waits for any readers that have it
+  // pinned to finish. Must be called with sector lock held. If the pins
+  // are not released in time, gives up, leaving the entry unmodified, and
+  // returns false.
+  bool EnsureReadyForWriting(SharedMemCacheData::Sector<kBlockSize>* sector,
                              SharedMemCacheData::CacheEntry* entry)
       EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
 
+  // Like EnsureReadyForWriting, but rather than waiting for readers that
+  // have the entry pinned, returns false, leaving the entry unmodified.
+  bool TryStartWritingUnpinned(SharedMemCacheData::Sector<kBlockSize>* sector,
+                               SharedMemCacheData::CacheEntry* entry)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
+
+  // Ends a write started by EnsureReadyForWriting or TryStartWritingUnpinned.
+  // Must be called with sector lock held.
+  void FinishWriting(SharedMemCacheData::Sector<kBlockSize>* sector,
+                     SharedMemCacheData::CacheEntry* entry)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
+
+  // Acquires the sector lock on behalf of a writer, recording how long that
+  // took in the sector's lock wait histogram.
+  void LockSector(SharedMemCacheData::Sector<kBlockSize>* sector)
+      EXCLUSIVE_LOCK_FUNCTION(sector->mutex());
+
   AbstractSharedMem* shm_runtime_;
   const Hasher* hasher_;
   Timer* timer_;
@@ -208,12 +300,14 @@ class SharedMemCache : public CacheInterface {
   int entries_per_sector_;
   int blocks_per_sector_;
   MessageHandler* handler_;
+  CacheAdmissionPolicy admission_policy_;
 
   scoped_ptr<AbstractSharedMemSegment> segment_;
   std::vector<SharedMemCacheData::Sector<kBlockSize>*> sectors_;
 
   GoogleString name_;
 
+  friend class SharedMemCacheTestBase;
   DISALLOW_COPY_AND_ASSIGN(SharedMemCache);
 };
 
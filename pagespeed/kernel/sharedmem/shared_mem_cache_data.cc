@@ -21,11 +21,14 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
+#include <cstring>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 
 namespace net_instaweb {
 
@@ -45,42 +48,51 @@ double percent(int64 portion, int64 total) {
 
 template<size_t kBlockSize>
 struct Sector<kBlockSize>::MemLayout {
-  MemLayout(size_t mutex_size, size_t cache_entries, size_t data_blocks) {
+  MemLayout(size_t mutex_size, size_t cache_entries, size_t data_blocks,
+            bool with_frequency_sketch) {
     // Check out alignment assumptions -- everything must be of a size
     // that's multiple of 8. The exact sizes don't matter too much, but
     // we check it anyway to avoid surprises.
-    CHECK_EQ(96u, sizeof(SectorHeader));
+    CHECK_EQ(208u, sizeof(SectorHeader));
     CHECK_EQ(48u, sizeof(CacheEntry));
 
     header_bytes = AlignTo(8, sizeof(SectorHeader) + mutex_size);
     block_successor_list_bytes =
         AlignTo(8, sizeof(BlockNum) * data_blocks);
     size_t directory_size = sizeof(CacheEntry) * cache_entries;
-    metadata_bytes =
-        AlignTo(kBlockSize,
-                header_bytes + directory_size + block_successor_list_bytes);
+    sketch_offset =
+        header_bytes + block_successor_list_bytes + directory_size;
+    size_t sketch_size = with_frequency_sketch ?
+        FrequencySketch::RequiredSize(cache_entries) : 0;
+    metadata_bytes = AlignTo(kBlockSize, sketch_offset + sketch_size);
   }
 
   size_t header_bytes;  // also offset to the block successor list.
   size_t block_successor_list_bytes;
+  size_t sketch_offset;  // frequency sketch, if any, follows the directory.
   size_t metadata_bytes;  // e.g. offset to the blocks.
 };
 
 template<size_t kBlockSize>
 Sector<kBlockSize>::Sector(AbstractSharedMemSegment* segment,
                            size_t sector_offset, size_t cache_entries,
-                           size_t data_blocks)
+                           size_t data_blocks, bool with_frequency_sketch)
     : cache_entries_(cache_entries),
       data_blocks_(data_blocks),
       segment_(segment),
       sector_offset_(sector_offset) {
-  MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks);
+  MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks,
+                   with_frequency_sketch);
   char* base = const_cast<char*>(segment->Base()) + sector_offset;
   sector_header_ = reinterpret_cast<SectorHeader*>(base);
   block_successors_ = reinterpret_cast<BlockNum*>(base + layout.header_bytes);
   directory_base_ =
       base + layout.header_bytes + layout.block_successor_list_bytes;
   blocks_base_ = base + layout.metadata_bytes;
+  if (with_frequency_sketch) {
+    frequency_sketch_.reset(
+        new FrequencySketch(cache_entries, base + layout.sketch_offset));
+  }
 }
 
 template<size_t kBlockSize>
@@ -115,16 +127,28 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
     entry->lru_prev = kInvalidEntry;
     entry->lru_next = kInvalidEntry;
     entry->first_block = kInvalidBlock;
+    entry->pin_count = 0;
+    entry->sequence = 0;
   }
 
-  // Initialize the freelist and block successor list.
+  // Initialize the freelist and block successor list. We push the blocks
+  // in descending order so that they get handed out in ascending order,
+  // which lets multi-block values be contiguous in memory.
   sector_header_->free_list_front = kInvalidBlock;
   BlockVector all_blocks;
-  for (size_t c = 0; c < data_blocks_; ++c) {
-    all_blocks.push_back(static_cast<BlockNum>(c));
+  for (size_t c = data_blocks_; c > 0; --c) {
+    all_blocks.push_back(static_cast<BlockNum>(c - 1));
   }
   ReturnBlocksToFreeList(all_blocks);
   sector_header_->stats.used_blocks = 0;
+  sector_header_->unlocked_gets = 0;
+  sector_header_->unlocked_get_hits = 0;
+  sector_header_->unlocked_get_borrowed = 0;
+  sector_header_->unlocked_get_retries = 0;
+  sector_header_->unlocked_get_touch_skipped = 0;
+  if (frequency_sketch_.get() != NULL) {
+    frequency_sketch_->Clear();
+  }
 
   return true;
 }
@@ -132,9 +156,10 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
 template<size_t kBlockSize>
 size_t Sector<kBlockSize>::RequiredSize(AbstractSharedMem* shmem_runtime,
                                         size_t cache_entries,
-                                        size_t data_blocks) {
+                                        size_t data_blocks,
+                                        bool with_frequency_sketch) {
   MemLayout layout(shmem_runtime->SharedMutexSize(), cache_entries,
-                   data_blocks);
+                   data_blocks, with_frequency_sketch);
   return layout.metadata_bytes + data_blocks * kBlockSize;
 }
 
@@ -242,6 +267,111 @@ int Sector<kBlockSize>::BlockListForEntry(CacheEntry* entry,
   return data_blocks;
 }
 
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::BlockListForSizeUnlocked(BlockNum first_block,
+                                                  int32 byte_size,
+                                                  BlockVector* out_blocks)
+    NO_THREAD_SAFETY_ANALYSIS {
+  if ((byte_size < 0) ||
+      (DataBlocksForSize(byte_size) > data_blocks_)) {
+    return false;
+  }
+  int data_blocks = DataBlocksForSize(byte_size);
+
+  const volatile BlockNum* successors = block_successors_;
+  BlockNum block = first_block;
+  for (int d = 0; d < data_blocks; ++d) {
+    if ((block < 0) || (block >= static_cast<BlockNum>(data_blocks_))) {
+      return false;
+    }
+    out_blocks->push_back(block);
+    block = successors[block];
+  }
+  return true;
+}
+
+template<size_t kBlockSize>
+size_t Sector<kBlockSize>::ImageSize() const {
+  const char* end = blocks_base_ + data_blocks_ * kBlockSize;
+  return sizeof(SectorHeader) +
+         (end - reinterpret_cast<const char*>(block_successors_));
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::SaveImage(GoogleString* out) {
+  const char* end = blocks_base_ + data_blocks_ * kBlockSize;
+  const char* rest = reinterpret_cast<const char*>(block_successors_);
+  out->append(reinterpret_cast<const char*>(sector_header_),
+              sizeof(SectorHeader));
+  out->append(rest, end - rest);
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::RestoreImage(const char* image) {
+  char* end = blocks_base_ + data_blocks_ * kBlockSize;
+  char* rest = reinterpret_cast<char*>(block_successors_);
+  std::memcpy(sector_header_, image, sizeof(SectorHeader));
+  std::memcpy(rest, image + sizeof(SectorHeader), end - rest);
+
+  // Operation counts describe the previous run, so start over on them.
+  SectorStats stats;
+  stats.used_entries = sector_header_->stats.used_entries;
+  stats.used_blocks = sector_header_->stats.used_blocks;
+  sector_header_->stats = stats;
+  sector_header_->unlocked_gets = 0;
+  sector_header_->unlocked_get_hits = 0;
+  sector_header_->unlocked_get_borrowed = 0;
+  sector_header_->unlocked_get_retries = 0;
+  sector_header_->unlocked_get_touch_skipped = 0;
+
+  // Whoever had entries pinned is gone.
+  for (size_t c = 0; c < cache_entries_; ++c) {
+    EntryAt(c)->pin_count = 0;
+  }
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::RecordUnlockedGet(bool hit, bool borrowed,
+                                           int retries, bool touch_skipped) {
+  base::subtle::NoBarrier_AtomicIncrement(&sector_header_->unlocked_gets, 1);
+  if (hit) {
+    base::subtle::NoBarrier_AtomicIncrement(
+        &sector_header_->unlocked_get_hits, 1);
+  }
+  if (borrowed) {
+    base::subtle::NoBarrier_AtomicIncrement(
+        &sector_header_->unlocked_get_borrowed, 1);
+  }
+  if (retries != 0) {
+    base::subtle::NoBarrier_AtomicIncrement(
+        &sector_header_->unlocked_get_retries, retries);
+  }
+  if (touch_skipped) {
+    base::subtle::NoBarrier_AtomicIncrement(
+        &sector_header_->unlocked_get_touch_skipped, 1);
+  }
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::FoldUnlockedStats() {
+  // Avoid the atomic exchanges (and the cache line traffic they imply) when
+  // no unlocked Get() happened since the last fold.
+  if (base::subtle::NoBarrier_Load(&sector_header_->unlocked_gets) == 0) {
+    return;
+  }
+  SectorStats* stats = &sector_header_->stats;
+  stats->num_get += base::subtle::NoBarrier_AtomicExchange(
+      &sector_header_->unlocked_gets, 0);
+  stats->num_get_hit += base::subtle::NoBarrier_AtomicExchange(
+      &sector_header_->unlocked_get_hits, 0);
+  stats->num_get_borrowed += base::subtle::NoBarrier_AtomicExchange(
+      &sector_header_->unlocked_get_borrowed, 0);
+  stats->num_get_retries += base::subtle::NoBarrier_AtomicExchange(
+      &sector_header_->unlocked_get_retries, 0);
+  stats->num_get_touch_skipped += base::subtle::NoBarrier_AtomicExchange(
+      &sector_header_->unlocked_get_touch_skipped, 0);
+}
+
 SectorStats::SectorStats()
     : num_put(0),
       num_put_update(0),
@@ -249,10 +379,18 @@ SectorStats::SectorStats()
       num_put_concurrent_create(0),
       num_put_concurrent_full_set(0),
       num_put_spins(0),
+      num_put_pin_timeouts(0),
+      num_put_rejected(0),
       num_get(0),
       num_get_hit(0),
+      num_get_borrowed(0),
+      num_get_retries(0),
+      num_get_touch_skipped(0),
       used_entries(0),
       used_blocks(0) {
+  for (int b = 0; b < kLockWaitBuckets; ++b) {
+    lock_wait_histogram[b] = 0;
+  }
 }
 
 void SectorStats::Add(const SectorStats& other) {
@@ -262,10 +400,36 @@ void SectorStats::Add(const SectorStats& other) {
   num_put_concurrent_create += other.num_put_concurrent_create;
   num_put_concurrent_full_set += other.num_put_concurrent_full_set;
   num_put_spins += other.num_put_spins;
+  num_put_pin_timeouts += other.num_put_pin_timeouts;
+  num_put_rejected += other.num_put_rejected;
   num_get += other.num_get;
   num_get_hit += other.num_get_hit;
+  num_get_borrowed += other.num_get_borrowed;
+  num_get_retries += other.num_get_retries;
+  num_get_touch_skipped += other.num_get_touch_skipped;
   used_entries += other.used_entries;
   used_blocks += other.used_blocks;
+  for (int b = 0; b < kLockWaitBuckets; ++b) {
+    lock_wait_histogram[b] += other.lock_wait_histogram[b];
+  }
+}
+
+int SectorStats::LockWaitBucket(bool contended, int64 wait_us) {
+  if (!contended) {
+    return 0;
+  }
+  int bucket = 1;
+  while ((bucket < kLockWaitBuckets - 1) &&
+         (wait_us >= LockWaitBucketLimitUs(bucket))) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+int64 SectorStats::LockWaitBucketLimitUs(int bucket) {
+  DCHECK_LE(1, bucket);
+  DCHECK_LT(bucket, kLockWaitBuckets - 1);
+  return static_cast<int64>(1) << (2 * bucket);
 }
 
 GoogleString SectorStats::Dump(size_t total_entries,
@@ -286,12 +450,37 @@ GoogleString SectorStats::Dump(size_t total_entries,
   StringAppendF(
       &out, "  spinning sleeps performed by writers: %s\n",
       Integer64ToString(num_put_spins).c_str());
+  StringAppendF(
+      &out, "  writes abandoned behind stuck pins: %s\n",
+      Integer64ToString(num_put_pin_timeouts).c_str());
+  StringAppendF(
+      &out, "  new keys refused by admission policy: %s\n",
+      Integer64ToString(num_put_rejected).c_str());
 
   StringAppendF(&out, "Total get operations: %s\n",
                 Integer64ToString(num_get).c_str());
   StringAppendF(&out, "  hits: %s (%.2f%%)\n",
                 Integer64ToString(num_get_hit).c_str(),
                 percent(num_get_hit, num_get));
+  StringAppendF(&out, "  hits served without copying: %s\n",
+                Integer64ToString(num_get_borrowed).c_str());
+  StringAppendF(&out, "  reads retried due to concurrent writes: %s\n",
+                Integer64ToString(num_get_retries).c_str());
+  StringAppendF(&out, "  LRU updates skipped due to lock contention: %s\n",
+                Integer64ToString(num_get_touch_skipped).c_str());
+
+  StringAppendF(&out, "Writer sector lock waits:\n");
+  StringAppendF(&out, "  uncontended: %s\n",
+                Integer64ToString(lock_wait_histogram[0]).c_str());
+  for (int b = 1; b < kLockWaitBuckets - 1; ++b) {
+    StringAppendF(&out, "  < %sus: %s\n",
+                  Integer64ToString(LockWaitBucketLimitUs(b)).c_str(),
+                  Integer64ToString(lock_wait_histogram[b]).c_str());
+  }
+  StringAppendF(
+      &out, "  >= %sus: %s\n",
+      Integer64ToString(LockWaitBucketLimitUs(kLockWaitBuckets - 2)).c_str(),
+      Integer64ToString(lock_wait_histogram[kLockWaitBuckets - 1]).c_str());
 
   StringAppendF(&out, "Entries used: %s (%.2f%%)\n",
                 Integer64ToString(used_entries).c_str(),
@@ -305,6 +494,7 @@ GoogleString SectorStats::Dump(size_t total_entries,
 template<size_t kBlockSize>
 void Sector<kBlockSize>::DumpStats(MessageHandler* handler) {
   mutex()->Lock();
+  FoldUnlockedStats();
   GoogleString dump = sector_stats()->Dump(cache_entries_, data_blocks_);
   mutex()->Unlock();
   handler->MessageS(kError, dump);
@@ -26,10 +26,12 @@
 #include <vector>
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 
 namespace net_instaweb {
 
@@ -48,6 +50,9 @@ const BlockNum kInvalidBlock = -1;
 const EntryNum kInvalidEntry = -1;
 const size_t kHashSize = 16;
 
+// Number of buckets in SectorStats::lock_wait_histogram.
+const int kLockWaitBuckets = 8;
+
 struct SectorStats {
   SectorStats();
 
@@ -63,9 +68,19 @@ struct SectorStats {
   int64 num_put_replace;  // replacement of different key
   int64 num_put_concurrent_create;
   int64 num_put_concurrent_full_set;
-  int64 num_put_spins;  // # of times writers had to sleep behind readers
+  int64 num_put_spins;  // # of times writers had to sleep behind pins
+  int64 num_put_pin_timeouts;  // # of writes abandoned as pins weren't freed
+  int64 num_put_rejected;  // # of new keys refused by the admission policy
   int64 num_get;    // # of calls to get
   int64 num_get_hit;
+  int64 num_get_borrowed;  // # of hits handed out without copying
+  int64 num_get_retries;  // # of lock-free reads redone due to a writer
+  int64 num_get_touch_skipped;  // # of LRU updates skipped as sector was busy
+
+  // How long writers waited for the sector lock. Bucket 0 counts
+  // acquisitions that did not have to wait at all; see LockWaitBucket for
+  // the rest.
+  int64 lock_wait_histogram[kLockWaitBuckets];
 
   // Current state stats --- updated by SharedMemCacheData
   int64 used_entries;
@@ -76,13 +91,29 @@ struct SectorStats {
 
   // Text dump of the statistics. No concurrency control is done.
   GoogleString Dump(size_t total_entries, size_t total_blocks) const;
+
+  // Returns the lock_wait_histogram bucket for a lock acquisition that
+  // took wait_us. Bucket b >= 1 covers waits shorter than 4^b us, except
+  // for the last one, which has no upper bound.
+  static int LockWaitBucket(bool contended, int64 wait_us);
+
+  // Upper bound, in us, of the waits counted in given bucket (which
+  // must be in [1, kLockWaitBuckets - 1)).
+  static int64 LockWaitBucketLimitUs(int bucket);
 };
 
 struct SectorHeader {
   BlockNum free_list_front;
   EntryNum lru_list_front;
   EntryNum lru_list_rear;
-  int32 padding;
+
+  // Counts from Get() calls that did not take the sector lock. These are
+  // updated atomically and folded into stats by Sector::FoldUnlockedStats.
+  base::subtle::Atomic32 unlocked_gets;
+  base::subtle::Atomic32 unlocked_get_hits;
+  base::subtle::Atomic32 unlocked_get_borrowed;
+  base::subtle::Atomic32 unlocked_get_retries;
+  base::subtle::Atomic32 unlocked_get_touch_skipped;
 
   SectorStats stats;
 
@@ -102,13 +133,14 @@ struct CacheEntry {
 
   BlockNum first_block;
 
-  // When this is true, someone is trying to overwrite this entry.
-  bool creating : 1;
-
-  // Number of readers currently accessing the data.
-  uint32 open_count : 31;
+  // Number of readers currently holding a view of the payload; writers
+  // wait for this to drop to 0.
+  base::subtle::Atomic32 pin_count;
 
-  uint32 padding;  // ensures we're 8-aligned.
+  // Sequence number for lock-free readers. It is odd while a writer may be
+  // changing the entry's key, size, blocks or payload, and is advanced once
+  // more when the writer is done; see the top of shared_mem_cache.cc.
+  base::subtle::Atomic32 sequence;
 };
 
 // Helper for operating on a given sector's data structures; helping
@@ -122,14 +154,15 @@ class Sector {
   // Creates a wrapper to help operate on cache sectors in a given region of
   // memory with given geometry.  The sector should have had as much memory
   // allocated for it as returned by a call to RequiredSize with the same
-  // arguments.
+  // arguments.  The FrequencySketch used for TinyLFU admission only gets
+  // memory if with_frequency_sketch is set.
   //
   // Note that this doesn't do any imperative initialization; you must
   // call Initialize() in the parent process, and Attach() in child processes,
   // and check their results as well. Also, segment is assumed to be owned
   // separately, with lifetime longer than ours.
   Sector(AbstractSharedMemSegment* segment, size_t sector_offset,
-         size_t cache_entries, size_t data_blocks);
+         size_t cache_entries, size_t data_blocks, bool with_frequency_sketch);
   ~Sector();
 
   // This should be called from child processes to initialize client
@@ -148,7 +181,8 @@ class Sector {
   // Computes how much memory a sector will need for given number of entries.
   // Also makes sure it's padded to proper alignment.
   static size_t RequiredSize(AbstractSharedMem* shmem_runtime,
-                             size_t cache_entries, size_t data_blocks);
+                             size_t cache_entries, size_t data_blocks,
+                             bool with_frequency_sketch);
 
   // Mutex ops.
 
@@ -250,11 +284,47 @@ class Sector {
   int BlockListForEntry(CacheEntry* entry, BlockVector* out_blocks)
       EXCLUSIVE_LOCKS_REQUIRED(mutex());
 
+  // Like BlockListForEntry, but for readers not holding the lock, who pass
+  // in the entry's first_block and byte_size as they saw them. Since the
+  // successor list may be changing underneath us, everything is bounds
+  // checked, and false is returned if the list is inconsistent. A true
+  // return must still be validated against the entry's sequence number.
+  bool BlockListForSizeUnlocked(BlockNum first_block, int32 byte_size,
+                                BlockVector* out_blocks);
+
+  // Access frequency estimates for keys hashing to this sector, used for
+  // TinyLFU admission, or NULL if the sector was created without them.
+  // Safe to use without the sector lock.
+  FrequencySketch* frequency_sketch() { return frequency_sketch_.get(); }
+
+  // Images, for SharedMemCache::SaveImage/RestoreImage.
+  // ------------------------------------------------------------
+
+  // Size of the image of this sector produced by SaveImage: all of its
+  // memory except the mutex, which is specific to the shared memory runtime.
+  size_t ImageSize() const;
+
+  // Appends an image of the sector, ImageSize() bytes, to *out.
+  void SaveImage(GoogleString* out) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
+  // Overwrites the sector with an image produced by SaveImage for a sector
+  // of the same geometry. Resets pin counts and statistics other than the
+  // usage counts. Entries that were being written when the image was taken
+  // are restored as such; it's up to the caller to free them.
+  void RestoreImage(const char* image) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
   // Statistics stuff
   // ------------------------------------------------------------
 
   SectorStats* sector_stats() { return &sector_header_->stats; }
 
+  // Records a Get() performed without the sector lock held.
+  void RecordUnlockedGet(bool hit, bool borrowed, int retries,
+                         bool touch_skipped);
+
+  // Moves the counts accumulated by RecordUnlockedGet into sector_stats().
+  void FoldUnlockedStats() EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
   // Prints out all statistics in the header (some of which are maintained
   // by the higher-level)
   void DumpStats(MessageHandler* handler);
@@ -279,6 +349,7 @@ class Sector {
   BlockNum* block_successors_ PT_GUARDED_BY(mutex());
   char* directory_base_;
   char* blocks_base_;
+  scoped_ptr<FrequencySketch> frequency_sketch_;
   size_t sector_offset_;  // offset of the sector within the SHM segment
 
   DISALLOW_COPY_AND_ASSIGN(Sector);
@@ -296,7 +296,8 @@ void SharedMemCacheDataTestBase::TestBlockLists() NO_THREAD_SAFETY_ANALYSIS {
 bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
                                             Sector<kBlockSize>** out_sector) {
   size_t bytes =
-      Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(), kEntries, kBlocks);
+      Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(), kEntries, kBlocks,
+                                       false /* with_frequency_sketch */);
   AbstractSharedMemSegment* seg =
       shmem_runtime_->CreateSegment(kSegment, bytes + kExtra, &handler_);
   if (seg == NULL) {
@@ -304,7 +305,8 @@ bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
   }
 
   Sector<kBlockSize>* sector =
-      new Sector<kBlockSize>(seg, kExtra, kEntries, kBlocks);
+      new Sector<kBlockSize>(seg, kExtra, kEntries, kBlocks,
+                             false /* with_frequency_sketch */);
   *out_seg = seg;
   *out_sector = sector;
 
@@ -314,7 +316,8 @@ bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
 bool SharedMemCacheDataTestBase::ChildInit(AbstractSharedMemSegment** out_seg,
                                            Sector<kBlockSize>** out_sector) {
   size_t bytes =
-      Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(), kEntries, kBlocks);
+      Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(), kEntries, kBlocks,
+                                       false /* with_frequency_sketch */);
   AbstractSharedMemSegment* seg =
       shmem_runtime_->AttachToSegment(kSegment, bytes + kExtra, &handler_);
   if (seg == NULL) {
@@ -322,7 +325,8 @@ bool SharedMemCacheDataTestBase::ChildInit(AbstractSharedMemSegment** out_seg,
   }
 
   Sector<kBlockSize>* sector =
-      new Sector<kBlockSize>(seg, kExtra, kEntries, kBlocks);
+      new Sector<kBlockSize>(seg, kExtra, kEntries, kBlocks,
+                             false /* with_frequency_sketch */);
   *out_seg = seg;
   *out_sector = sector;
 
@@ -25,6 +25,7 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_snapshot.pb.h"
@@ -36,6 +37,7 @@ namespace {
 
 const char kSegment[] = "cache";
 const char kAltSegment[] = "alt_cache";
+const char kImagePath[] = "/cache.image";
 const int kSectors = 2;
 const int kSectorBlocks = 2000;
 const int kSectorEntries = 256;
@@ -49,6 +51,42 @@ void YieldToThread() {
   usleep(1);
 }
 
+// Callback that accepts borrowed values, copying out whatever it sees.
+class BorrowingCallback : public CacheInterface::Callback {
+ public:
+  BorrowingCallback()
+      : called_(false),
+        borrowed_(false),
+        state_(CacheInterface::kNotFound) {
+    set_accepts_borrowed_value(true);
+  }
+
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    borrowed_ = has_borrowed_value();
+    ValueView().CopyToString(&contents_);
+    return true;
+  }
+
+  virtual void Done(CacheInterface::KeyState state) {
+    called_ = true;
+    state_ = state;
+  }
+
+  bool called() const { return called_; }
+  bool borrowed() const { return borrowed_; }
+  CacheInterface::KeyState state() const { return state_; }
+  const GoogleString& contents() const { return contents_; }
+
+ private:
+  bool called_;
+  bool borrowed_;
+  CacheInterface::KeyState state_;
+  GoogleString contents_;
+
+  DISALLOW_COPY_AND_ASSIGN(BorrowingCallback);
+};
+
 }  // namespace
 
 SharedMemCacheTestBase::SharedMemCacheTestBase(SharedMemTestEnv* env)
@@ -57,6 +95,7 @@ SharedMemCacheTestBase::SharedMemCacheTestBase(SharedMemTestEnv* env)
       thread_system_(Platform::CreateThreadSystem()),
       handler_(thread_system_->NewMutex()),
       timer_(thread_system_->NewMutex(), 0),
+      file_system_(thread_system_.get(), &timer_),
       sanity_checks_enabled_(true) {
   cache_.reset(MakeCache());
   EXPECT_TRUE(cache_->Initialize());
@@ -376,6 +415,320 @@ void SharedMemCacheTestBase::TestSnapshot() {
   }
 }
 
+void SharedMemCacheTestBase::SaveImage(SharedMemCache<kBlockSize>* cache,
+                                       GoogleString* image) {
+  FileSystem::OutputFile* file =
+      file_system_.OpenOutputFile(kImagePath, &handler_);
+  ASSERT_TRUE(file != NULL);
+  EXPECT_TRUE(cache->SaveImage(file));
+  EXPECT_TRUE(file_system_.Close(file, &handler_));
+  EXPECT_TRUE(file_system_.ReadFile(kImagePath, image, &handler_));
+}
+
+bool SharedMemCacheTestBase::RestoreImage(SharedMemCache<kBlockSize>* cache,
+                                          const StringPiece& image) {
+  EXPECT_TRUE(file_system_.WriteFile(kImagePath, image, &handler_));
+  FileSystem::InputFile* file =
+      file_system_.OpenInputFile(kImagePath, &handler_);
+  EXPECT_TRUE(file != NULL);
+  bool ok = cache->RestoreImage(file);
+  EXPECT_TRUE(file_system_.Close(file, &handler_));
+  return ok;
+}
+
+void SharedMemCacheTestBase::TestImage() {
+  const int kEntries = 10;
+  for (int i = 0; i < kEntries; ++i) {
+    CheckPut(StrCat("key", IntegerToString(i)),
+             StrCat("val", IntegerToString(i)));
+  }
+  CheckPut("large", large_);
+  CheckPut("gigantic", gigantic_);
+
+  GoogleString image;
+  SaveImage(Cache(), &image);
+
+  // The image only fits a cache of the same geometry.
+  scoped_ptr<SharedMemCache<kBlockSize> > small_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment,
+                                     &timer_, &hasher_, kSectors,
+                                     kSectorEntries / 2, kSectorBlocks / 2,
+                                     &handler_));
+  ASSERT_TRUE(small_cache->Initialize());
+  EXPECT_FALSE(RestoreImage(small_cache.get(), image));
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+
+  // Truncated images only restore the sectors before the cut.
+  ResetCache();
+  EXPECT_FALSE(RestoreImage(Cache(), StringPiece(image.data(), 10)));
+  CheckNotFound("key0");
+  ResetCache();
+  EXPECT_FALSE(RestoreImage(Cache(),
+                            StringPiece(image.data(), image.size() - 1)));
+  SanityCheck();
+
+  ResetCache();
+  EXPECT_TRUE(RestoreImage(Cache(), image));
+  for (int i = 0; i < kEntries; ++i) {
+    CheckGet(StrCat("key", IntegerToString(i)),
+             StrCat("val", IntegerToString(i)));
+  }
+  CheckGet("large", large_);
+  CheckGet("gigantic", gigantic_);
+  SanityCheck();
+
+  // The restored cache keeps working as usual.
+  CheckPut("key0", large_);
+  CheckGet("key0", large_);
+  CheckDelete("large");
+  CheckNotFound("large");
+  SanityCheck();
+
+  // A sector that fails its checksum is skipped, while the rest are restored.
+  GoogleString corrupt_image = image;
+  corrupt_image[corrupt_image.size() - 1] ^= 1;
+  ResetCache();
+  EXPECT_TRUE(RestoreImage(Cache(), corrupt_image));
+  int found = 0;
+  for (int i = 0; i < kEntries; ++i) {
+    Callback* callback = InitiateGet(StrCat("key", IntegerToString(i)));
+    callback->Wait();
+    if (callback->state() == CacheInterface::kAvailable) {
+      EXPECT_EQ(StrCat("val", IntegerToString(i)), callback->value_str());
+      ++found;
+    }
+  }
+  EXPECT_LT(0, found);
+  EXPECT_GT(kEntries, found);
+  SanityCheck();
+
+  // Entries caught in the middle of a Put are dropped on restore.
+  for (size_t s = 0; s < cache_->sectors_.size(); ++s) {
+    for (int e = 0; e < kSectorEntries; ++e) {
+      SharedMemCacheData::CacheEntry* entry = cache_->sectors_[s]->EntryAt(e);
+      if (entry->byte_size != 0) {
+        ++entry->sequence;
+      }
+    }
+  }
+  SaveImage(Cache(), &image);
+  ResetCache();
+  EXPECT_TRUE(RestoreImage(Cache(), image));
+  for (int i = 0; i < kEntries; ++i) {
+    CheckNotFound(StrCat("key", IntegerToString(i)).c_str());
+  }
+  CheckNotFound("gigantic");
+  SanityCheck();
+}
+
+void SharedMemCacheTestBase::TestLockFreeGet() {
+  CheckPut("key", large_);
+
+  // Gets should neither need the sector locks nor wait for them.
+  for (size_t c = 0; c < cache_->sectors_.size(); ++c) {
+    cache_->sectors_[c]->mutex()->Lock();
+  }
+  CheckGet("key", large_);
+  CheckNotFound("404");
+  for (size_t c = 0; c < cache_->sectors_.size(); ++c) {
+    cache_->sectors_[c]->mutex()->Unlock();
+  }
+
+  // With the lock available, the hit also updates the LRU.
+  CheckGet("key", large_);
+
+  GoogleString stats = cache_->DumpStats();
+  EXPECT_TRUE(stats.find("Total get operations: 3\n") != GoogleString::npos)
+      << stats;
+  EXPECT_TRUE(stats.find("  hits: 2 ") != GoogleString::npos) << stats;
+  EXPECT_TRUE(stats.find(
+      "  LRU updates skipped due to lock contention: 1\n") !=
+          GoogleString::npos) << stats;
+  EXPECT_TRUE(stats.find("  uncontended: 2\n") != GoogleString::npos)
+      << stats;
+}
+
+void SharedMemCacheTestBase::TestConcurrentGetConsistency() {
+  CreateChild(&SharedMemCacheTestBase::TestConcurrentGetConsistencyChild);
+
+  // The child keeps rewriting 'key' with values of different sizes and
+  // contents. Whatever we read, it must never be a mix of the two.
+  GoogleString short_value(kBlockSize + 1, 'a');
+  GoogleString long_value(kBlockSize * 3 + 7, 'b');
+  for (int i = 0; i < kSpinRuns * 10; ++i) {
+    // Alternate between copying and zero-copy reads.
+    CacheTestBase::Callback callback;
+    cache_->Get("key", callback.Reset());
+    ASSERT_TRUE(callback.called());
+    if (callback.state() == CacheInterface::kAvailable) {
+      GoogleString value = callback.value()->Value().as_string();
+      EXPECT_TRUE((value == short_value) || (value == long_value))
+          << value.size();
+    }
+
+    BorrowingCallback borrowing_callback;
+    cache_->Get("key", &borrowing_callback);
+    ASSERT_TRUE(borrowing_callback.called());
+    if (borrowing_callback.state() == CacheInterface::kAvailable) {
+      const GoogleString& value = borrowing_callback.contents();
+      EXPECT_TRUE((value == short_value) || (value == long_value))
+          << value.size();
+    }
+    YieldToThread();
+  }
+
+  test_env_->WaitForChildren();
+  SanityCheck();
+}
+
+void SharedMemCacheTestBase::TestConcurrentGetConsistencyChild() {
+  scoped_ptr<SharedMemCache<kBlockSize> > child_cache(MakeCache());
+  if (!child_cache->Attach()) {
+    test_env_->ChildFailed();
+  }
+  SharedString short_value(GoogleString(kBlockSize + 1, 'a'));
+  SharedString long_value(GoogleString(kBlockSize * 3 + 7, 'b'));
+  for (int i = 0; i < kSpinRuns * 10; ++i) {
+    child_cache->Put("key", (i % 2 == 0) ? &short_value : &long_value);
+    if (i % 7 == 0) {
+      child_cache->Delete("key");
+    }
+  }
+}
+
+void SharedMemCacheTestBase::TestBorrowedGet() {
+  CheckPut("key", large_);
+  {
+    BorrowingCallback callback;
+    cache_->Get("key", &callback);
+    ASSERT_TRUE(callback.called());
+    EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+    EXPECT_TRUE(callback.borrowed());
+    EXPECT_EQ(large_, callback.contents());
+    EXPECT_TRUE(callback.value()->empty());
+  }
+
+  // The pin must be released, so the entry can be rewritten.
+  CheckPut("key", "small");
+  {
+    BorrowingCallback callback;
+    cache_->Get("key", &callback);
+    EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+    EXPECT_TRUE(callback.borrowed());
+    EXPECT_EQ("small", callback.contents());
+  }
+  CheckDelete("key");
+  {
+    BorrowingCallback callback;
+    cache_->Get("key", &callback);
+    ASSERT_TRUE(callback.called());
+    EXPECT_EQ(CacheInterface::kNotFound, callback.state());
+  }
+
+  // Plain callbacks still get copies.
+  CheckPut("key", large_);
+  CheckGet("key", large_);
+
+  GoogleString stats = cache_->DumpStats();
+  EXPECT_TRUE(stats.find("  hits served without copying: 2\n") !=
+              GoogleString::npos) << stats;
+  EXPECT_TRUE(stats.find("  spinning sleeps performed by writers: 0\n") !=
+              GoogleString::npos) << stats;
+}
+
+void SharedMemCacheTestBase::TestTinyLfuAdmission() {
+  // With a single entry per sector, every key competes for the same slot.
+  scoped_ptr<SharedMemCache<kBlockSize> > small_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/,
+                                     1 /* entries / sector */,
+                                     kSectorBlocks, &handler_));
+  small_cache->set_admission_policy(kTinyLfuAdmission);
+  ASSERT_TRUE(small_cache->Initialize());
+
+  CheckPut(small_cache.get(), "hot", "hot");
+  for (int i = 0; i < 3; ++i) {
+    CheckGet(small_cache.get(), "hot", "hot");
+  }
+
+  // Keys looked up just once before being inserted don't displace it.
+  const int kScanKeys = 5;
+  for (int i = 0; i < kScanKeys; ++i) {
+    GoogleString key = StrCat("scan", IntegerToString(i));
+    CheckNotFound(small_cache.get(), key.c_str());
+    CheckPut(small_cache.get(), key, key);
+  }
+  CheckGet(small_cache.get(), "hot", "hot");
+  SharedMemCacheData::SectorStats* stats =
+      small_cache->sectors_[0]->sector_stats();
+  EXPECT_EQ(kScanKeys, stats->num_put_rejected);
+  EXPECT_EQ(0, stats->num_put_replace);
+
+  // Updating the resident key is not subject to admission.
+  CheckPut(small_cache.get(), "hot", "HOT");
+  CheckGet(small_cache.get(), "hot", "HOT");
+
+  // A key that has become more popular than the resident one gets in.
+  for (int i = 0; i < 8; ++i) {
+    CheckNotFound(small_cache.get(), "new");
+  }
+  CheckPut(small_cache.get(), "new", "new");
+  CheckGet(small_cache.get(), "new", "new");
+  CheckNotFound(small_cache.get(), "hot");
+  EXPECT_EQ(kScanKeys, stats->num_put_rejected);
+  EXPECT_EQ(1, stats->num_put_replace);
+
+  // With plain LRU, anything goes.
+  small_cache->set_admission_policy(kLruAdmission);
+  CheckPut(small_cache.get(), "scan0", "scan0");
+  CheckGet(small_cache.get(), "scan0", "scan0");
+
+  GoogleString dump = small_cache->DumpStats();
+  EXPECT_TRUE(dump.find("  new keys refused by admission policy: 5\n") !=
+              GoogleString::npos) << dump;
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestStuckPin() {
+  // A reader that dies while it has an entry pinned never unpins it.
+  CheckPut("key", large_);
+  ASSERT_TRUE(LeakPin("key"));
+
+  // Writers give up on the entry after a while rather than wait forever,
+  // leaving it as it was.
+  int64 start_us = timer_.NowUs();
+  CheckPut("key", "small");
+  CheckGet("key", large_);
+  CheckDelete("key");
+  CheckGet("key", large_);
+  EXPECT_LT(timer_.NowUs() - start_us, Timer::kSecondUs);
+
+  // Other entries are unaffected.
+  CheckPut("other", "other");
+  CheckGet("other", "other");
+
+  GoogleString dump = cache_->DumpStats();
+  EXPECT_TRUE(dump.find("  writes abandoned behind stuck pins: 2\n") !=
+              GoogleString::npos) << dump;
+}
+
+bool SharedMemCacheTestBase::LeakPin(const GoogleString& key) {
+  GoogleString raw_hash = cache_->ToRawHash(key);
+  SharedMemCache<kBlockSize>::Position pos;
+  cache_->ExtractPosition(raw_hash, &pos);
+  SharedMemCacheData::Sector<kBlockSize>* sector = cache_->sectors_[pos.sector];
+  for (int p = 0; p < SharedMemCache<kBlockSize>::kAssociativity; ++p) {
+    StringPiece view;
+    int32 sequence;
+    if (cache_->TryPinEntry(sector, sector->EntryAt(pos.keys[p]), raw_hash,
+                            &view, &sequence) ==
+        SharedMemCache<kBlockSize>::kReadPinned) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void SharedMemCacheTestBase::CheckDelete(const char* key) {
   cache_->Delete(key);
   SanityCheck();
@@ -21,6 +21,7 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -53,6 +54,12 @@ class SharedMemCacheTestBase : public CacheTestBase {
   void TestConflict();
   void TestEvict();
   void TestSnapshot();
+  void TestImage();
+  void TestLockFreeGet();
+  void TestConcurrentGetConsistency();
+  void TestBorrowedGet();
+  void TestTinyLfuAdmission();
+  void TestStuckPin();
 
   void ResetCache();
 
@@ -65,7 +72,18 @@ class SharedMemCacheTestBase : public CacheTestBase {
 
   SharedMemCache<kBlockSize>* MakeCache();
   void CheckDelete(const char* key);
+
+  // Pins the entry holding key and never unpins it, as a reader that died
+  // would. Returns false if there is no such entry to pin.
+  bool LeakPin(const GoogleString& key);
+
+  // Save an image of cache to *image, or restore one from it, through a
+  // file in file_system_.
+  void SaveImage(SharedMemCache<kBlockSize>* cache, GoogleString* image);
+  bool RestoreImage(SharedMemCache<kBlockSize>* cache,
+                    const StringPiece& image);
   void TestReaderWriterChild();
+  void TestConcurrentGetConsistencyChild();
 
   scoped_ptr<SharedMemTestEnv> test_env_;
   scoped_ptr<AbstractSharedMem> shmem_runtime_;
@@ -74,6 +92,7 @@ class SharedMemCacheTestBase : public CacheTestBase {
   scoped_ptr<ThreadSystem> thread_system_;
   MockMessageHandler handler_;
   MockTimer timer_;
+  MemFileSystem file_system_;
 
   GoogleString large_;
   GoogleString gigantic_;
@@ -121,9 +140,36 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestSnapshot) {
   SharedMemCacheTestBase::TestSnapshot();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestImage) {
+  SharedMemCacheTestBase::TestImage();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestLockFreeGet) {
+  SharedMemCacheTestBase::TestLockFreeGet();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestConcurrentGetConsistency) {
+  SharedMemCacheTestBase::TestConcurrentGetConsistency();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestBorrowedGet) {
+  SharedMemCacheTestBase::TestBorrowedGet();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestTinyLfuAdmission) {
+  SharedMemCacheTestBase::TestTinyLfuAdmission();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestStuckPin) {
+  SharedMemCacheTestBase::TestStuckPin();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemCacheTestTemplate, TestBasic, TestReinsert,
                            TestReplacement, TestReaderWriter, TestConflict,
-                           TestEvict, TestSnapshot);
+                           TestEvict, TestSnapshot, TestImage,
+                           TestLockFreeGet, TestConcurrentGetConsistency,
+                           TestBorrowedGet, TestTinyLfuAdmission,
+                           TestStuckPin);
 
 }  // namespace net_instaweb
 
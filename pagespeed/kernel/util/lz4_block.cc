@@ -0,0 +1,257 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/util/lz4_block.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Constants from the LZ4 block format specification.
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = 65535;
+// The last match must start at least this many bytes before the end of the
+// block...
+const size_t kMatchFindLimit = 12;
+// ... and the block must end with at least this many literals.
+const size_t kLastLiterals = 5;
+// A token nibble of 15 means the length continues in following bytes.
+const size_t kRunMask = 15;
+
+// The match finder hashes 4-byte sequences into a table of up to 2^kHashLog
+// recent positions.  4096 entries keep the table in L1 cache; small inputs
+// use smaller tables, down to 2^kMinHashLog, which are quicker to clear.
+const int kHashLog = 12;
+const int kMinHashLog = 8;
+// How quickly the matcher accelerates through input that isn't matching,
+// e.g. already-compressed data: it skips one extra byte for every
+// 2^kSkipShift bytes since the last match.
+const int kSkipShift = 6;
+
+inline uint32 Read32(const char* p) {
+  uint32 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint64 Read64(const char* p) {
+  uint64 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Returns how many bytes at a and b are equal, comparing no further than
+// limit.  Skips a word at a time until the words differ.
+inline size_t MatchLength(const char* a, const char* b, const char* limit) {
+  const char* start = b;
+  while ((b + sizeof(uint64) <= limit) && (Read64(a) == Read64(b))) {
+    a += sizeof(uint64);
+    b += sizeof(uint64);
+  }
+  while ((b < limit) && (*a == *b)) {
+    ++a;
+    ++b;
+  }
+  return b - start;
+}
+
+inline uint32 HashSequence(uint32 sequence, int hash_log) {
+  return (sequence * 2654435761U) >> (32 - hash_log);
+}
+
+inline char* WriteLength(size_t length, char* op) {
+  for (; length >= 255; length -= 255) {
+    *op++ = static_cast<char>(255);
+  }
+  *op++ = static_cast<char>(length);
+  return op;
+}
+
+// Writes a sequence of literals, followed by a match unless match_length is
+// 0, and returns the new output position.
+char* WriteSequence(const char* literals, size_t literal_length,
+                    size_t offset, size_t match_length, char* op) {
+  char* token = op++;
+  if (literal_length >= kRunMask) {
+    *token = static_cast<char>(kRunMask << 4);
+    op = WriteLength(literal_length - kRunMask, op);
+  } else {
+    *token = static_cast<char>(literal_length << 4);
+  }
+  if (literal_length != 0) {
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+  }
+  if (match_length != 0) {
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    size_t length = match_length - kMinMatch;
+    if (length >= kRunMask) {
+      *token |= static_cast<char>(kRunMask);
+      op = WriteLength(length - kRunMask, op);
+    } else {
+      *token |= static_cast<char>(length);
+    }
+  }
+  return op;
+}
+
+// Reads the continuation bytes of a length, adding them to *length.
+inline bool ReadLength(const unsigned char** ip, const unsigned char* end,
+                       size_t* length) {
+  unsigned char byte;
+  do {
+    if (*ip == end) {
+      return false;
+    }
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+}  // namespace
+
+void Lz4Block::Compress(StringPiece in, GoogleString* out) {
+  const char* base = in.data();
+  size_t size = in.size();
+  size_t out_start = out->size();
+  out->resize(out_start + MaxCompressedSize(size));
+  char* op_start = &(*out)[0] + out_start;
+  char* op = op_start;
+
+  size_t anchor = 0;
+  if (size > kMatchFindLimit) {
+    int hash_log = kMinHashLog;
+    while ((hash_log < kHashLog) && ((1U << hash_log) < size)) {
+      ++hash_log;
+    }
+    uint32 table[1 << kHashLog];
+    memset(table, 0, sizeof(table[0]) << hash_log);
+    size_t match_start_limit = size - kMatchFindLimit;
+    size_t match_end_limit = size - kLastLiterals;
+    size_t pos = 0;
+    while (pos < match_start_limit) {
+      uint32 sequence = Read32(base + pos);
+      uint32* slot = &table[HashSequence(sequence, hash_log)];
+      size_t candidate = *slot;
+      *slot = static_cast<uint32>(pos);
+      if ((candidate >= pos) || (pos - candidate > kMaxOffset) ||
+          (Read32(base + candidate) != sequence)) {
+        pos += 1 + ((pos - anchor) >> kSkipShift);
+        continue;
+      }
+      // Extend the match backwards over literals, then forwards.
+      while ((pos > anchor) && (candidate > 0) &&
+             (base[pos - 1] == base[candidate - 1])) {
+        --pos;
+        --candidate;
+      }
+      size_t length = kMinMatch + MatchLength(
+          base + candidate + kMinMatch, base + pos + kMinMatch,
+          base + match_end_limit);
+      op = WriteSequence(base + anchor, pos - anchor, pos - candidate, length,
+                         op);
+      pos += length;
+      anchor = pos;
+      // Index a position inside the match so that a repeat of its tail is
+      // found right away.
+      if (pos < match_start_limit) {
+        table[HashSequence(Read32(base + pos - 2), hash_log)] =
+            static_cast<uint32>(pos - 2);
+      }
+    }
+  }
+  op = WriteSequence(base + anchor, size - anchor, 0, 0, op);
+  DCHECK_LE(static_cast<size_t>(op - op_start), MaxCompressedSize(size));
+  out->resize(out_start + (op - op_start));
+}
+
+bool Lz4Block::Decompress(StringPiece in, size_t uncompressed_size,
+                          GoogleString* out) {
+  const unsigned char* ip = reinterpret_cast<const unsigned char*>(in.data());
+  const unsigned char* in_end = ip + in.size();
+  size_t out_start = out->size();
+  out->resize(out_start + uncompressed_size);
+  char* op_start = &(*out)[0] + out_start;
+  char* op = op_start;
+  char* op_end = op_start + uncompressed_size;
+
+  bool ok = false;
+  while (ip != in_end) {
+    unsigned char token = *ip++;
+    size_t literal_length = token >> 4;
+    if ((literal_length == kRunMask) &&
+        !ReadLength(&ip, in_end, &literal_length)) {
+      break;
+    }
+    if ((literal_length > static_cast<size_t>(in_end - ip)) ||
+        (literal_length > static_cast<size_t>(op_end - op))) {
+      break;
+    }
+    memcpy(op, ip, literal_length);
+    op += literal_length;
+    ip += literal_length;
+    if (ip == in_end) {
+      // The final sequence has literals only.
+      ok = (op == op_end);
+      break;
+    }
+
+    if (in_end - ip < 2) {
+      break;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > static_cast<size_t>(op - op_start))) {
+      break;
+    }
+    size_t match_length = token & kRunMask;
+    if ((match_length == kRunMask) &&
+        !ReadLength(&ip, in_end, &match_length)) {
+      break;
+    }
+    match_length += kMinMatch;
+    if (match_length > static_cast<size_t>(op_end - op)) {
+      break;
+    }
+    // The match may overlap the bytes it produces, e.g. a run of one
+    // repeated byte.  Those repeat with a period of offset, so copy from
+    // the start of the match in chunks that double as the output grows.
+    const char* match = op - offset;
+    while (match_length != 0) {
+      size_t chunk = std::min(match_length, static_cast<size_t>(op - match));
+      memcpy(op, match, chunk);
+      op += chunk;
+      match_length -= chunk;
+    }
+  }
+  if (!ok) {
+    out->resize(out_start);
+  }
+  return ok;
+}
+
+}  // namespace net_instaweb
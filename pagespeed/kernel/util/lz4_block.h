@@ -0,0 +1,57 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_UTIL_LZ4_BLOCK_H_
+#define PAGESPEED_KERNEL_UTIL_LZ4_BLOCK_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Compression in the LZ4 block format, which trades some compression ratio
+// for being several times faster than zlib in both directions.  Only the
+// block format is implemented: framing, such as recording the uncompressed
+// size or a checksum, is left to the caller.  The single-pass greedy matcher
+// here produces blocks any conforming LZ4 decoder can read, and Decompress
+// reads blocks from any conforming encoder.
+class Lz4Block {
+ public:
+  // Appends the compressed form of in to *out.
+  static void Compress(StringPiece in, GoogleString* out);
+
+  // Appends the decompression of in, which must expand to exactly
+  // uncompressed_size bytes, to *out.  Returns false, leaving *out as it
+  // was, if the block is malformed or has a different size.
+  static bool Decompress(StringPiece in, size_t uncompressed_size,
+                         GoogleString* out);
+
+  // Largest size that Compress can produce for an input of in_size bytes.
+  static size_t MaxCompressedSize(size_t in_size) {
+    return in_size + in_size / 255 + 16;
+  }
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(Lz4Block);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_LZ4_BLOCK_H_
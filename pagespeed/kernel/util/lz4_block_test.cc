@@ -0,0 +1,138 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pagespeed/kernel/util/lz4_block.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/util/simple_random.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class Lz4BlockTest : public testing::Test {
+ protected:
+  Lz4BlockTest() : random_(new NullMutex) {}
+
+  // Compresses value, checks it decompresses back, and returns the size of
+  // the compressed block.
+  size_t RoundTrip(const GoogleString& value) {
+    GoogleString compressed;
+    Lz4Block::Compress(value, &compressed);
+    EXPECT_GE(Lz4Block::MaxCompressedSize(value.size()), compressed.size());
+    GoogleString uncompressed("prefix");
+    EXPECT_TRUE(Lz4Block::Decompress(compressed, value.size(),
+                                     &uncompressed));
+    EXPECT_EQ(StrCat("prefix", value), uncompressed);
+    return compressed.size();
+  }
+
+  SimpleRandom random_;
+};
+
+TEST_F(Lz4BlockTest, ShortValues) {
+  EXPECT_EQ(1, RoundTrip(""));
+  RoundTrip("a");
+  RoundTrip("abcd");
+  // Too short to hold a match: the format requires 12 bytes after it.
+  EXPECT_EQ(1 + 12, RoundTrip("aaaaaaaaaaaa"));
+}
+
+TEST_F(Lz4BlockTest, Repetitive) {
+  GoogleString run(100000, 'x');
+  EXPECT_GT(500, RoundTrip(run));
+
+  GoogleString html;
+  for (int i = 0; i < 1000; ++i) {
+    StrAppend(&html, "<div class=\"item\"><a href=\"/page/", IntegerToString(i),
+              "\">Item ", IntegerToString(i), "</a></div>\n");
+  }
+  EXPECT_GT(html.size() / 4, RoundTrip(html));
+}
+
+TEST_F(Lz4BlockTest, HighEntropy) {
+  GoogleString value = random_.GenerateHighEntropyString(100000);
+  RoundTrip(value);
+  // Mixed: incompressible chunks repeated at distances inside and beyond
+  // the 64k window.
+  GoogleString chunk = random_.GenerateHighEntropyString(40000);
+  RoundTrip(StrCat(chunk, value, chunk, chunk));
+}
+
+TEST_F(Lz4BlockTest, DecodesReferenceBlock) {
+  // "abcabcabcabcabcabc" + "0123456", as the reference encoder writes it:
+  // 3 literals and a 15-byte match at offset 3, then 7 final literals.
+  static const char kBlock[] = "\x3b" "abc" "\x03\x00" "\x70" "0123456";
+  GoogleString out;
+  ASSERT_TRUE(Lz4Block::Decompress(
+      StringPiece(kBlock, STATIC_STRLEN(kBlock)), 25, &out));
+  EXPECT_EQ("abcabcabcabcabcabc0123456", out);
+}
+
+TEST_F(Lz4BlockTest, RejectsMalformedBlocks) {
+  GoogleString value;
+  for (int i = 0; i < 200; ++i) {
+    StrAppend(&value, "repeat ", IntegerToString(i % 7), " ");
+  }
+  GoogleString compressed;
+  Lz4Block::Compress(value, &compressed);
+  GoogleString out("unchanged");
+
+  // Wrong sizes.
+  EXPECT_FALSE(Lz4Block::Decompress(compressed, value.size() - 1, &out));
+  EXPECT_FALSE(Lz4Block::Decompress(compressed, value.size() + 1, &out));
+  EXPECT_EQ("unchanged", out);
+
+  // Empty, and every truncation.
+  EXPECT_FALSE(Lz4Block::Decompress("", 0, &out));
+  for (size_t i = 0; i < compressed.size(); ++i) {
+    EXPECT_FALSE(Lz4Block::Decompress(StringPiece(compressed.data(), i),
+                                      value.size(), &out));
+  }
+
+  // An offset reaching back before the start of the output.
+  static const char kBadOffset[] = "\x10" "a" "\x05\x00" "\x00";
+  EXPECT_FALSE(Lz4Block::Decompress(
+      StringPiece(kBadOffset, STATIC_STRLEN(kBadOffset)), 5, &out));
+  EXPECT_EQ("unchanged", out);
+}
+
+TEST_F(Lz4BlockTest, SurvivesCorruption) {
+  // Whatever the damage, decoding stays inside its buffers.
+  GoogleString value = StrCat(random_.GenerateHighEntropyString(50),
+                              GoogleString(500, 'z'),
+                              random_.GenerateHighEntropyString(50));
+  GoogleString compressed;
+  Lz4Block::Compress(value, &compressed);
+  for (size_t i = 0; i < compressed.size(); ++i) {
+    GoogleString corrupt = compressed;
+    corrupt[i] ^= 0x5a;
+    GoogleString out;
+    if (Lz4Block::Decompress(corrupt, value.size(), &out)) {
+      EXPECT_EQ(value.size(), out.size());
+    }
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -24,6 +24,8 @@
 
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/http_cache.h"
+#include "net/instaweb/http/public/rate_controller.h"
+#include "net/instaweb/rewriter/public/html_filter_profile_stats.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/rewrite_query.h"
 #include "net/instaweb/rewriter/public/server_context.h"
@@ -93,6 +95,8 @@ const Tab kTabs[] = {
   {"Console", "Console", "console", NULL, kLongBreak},
   {"Message History", "Message History", "message_history", NULL, kLongBreak},
   {"Graphs", "Graphs", "graphs", NULL, kLongBreak},
+  {"Fetches", "Fetches", "fetches", NULL, kLongBreak},
+  {"Filter Costs", "Filter Costs", "filter_costs", NULL, kLongBreak},
 };
 
 // Controls the generation of an HTML Admin page.  Constructing it
@@ -406,8 +410,8 @@ GoogleString HackCacheDescriptor(StringPiece name) {
   // overly cryptic; it's designed for unit tests.  But let's extract
   // a few keywords out of this to understand the main pointers.
   static const char* kCacheKeywords[] = {
-    "Compressed", "Async", "SharedMemCache", "LRUCache", "AprMemCache",
-    "FileCache"
+    "Compressed", "Tiered", "Async", "SharedMemCache", "LRUCache",
+    "AprMemCache", "FileCache"
   };
   const char* delim = "";
   for (int i = 0, n = arraysize(kCacheKeywords); i < n; ++i) {
@@ -637,6 +641,37 @@ void AdminSite::PrintNormalConfig(
       fetch, message_handler_);
 }
 
+void AdminSite::PrintFetches(AdminSource source, AsyncFetch* fetch,
+                             RateController* rate_controller) {
+  AdminHtml admin_html("fetches", "", source, timer_, fetch, message_handler_);
+  if (rate_controller == NULL) {
+    fetch->Write("Background fetches are not rate-limited.", message_handler_);
+    return;
+  }
+  // The hosts this process is fetching from, or, with adaptive concurrency,
+  // has recently fetched from.
+  fetch->Write(StrCat("<p>Background fetch limits for this process, with ",
+                      rate_controller->adaptive_concurrency() ?
+                      "adaptive" : "fixed",
+                      " concurrency:</p>"),
+               message_handler_);
+  HtmlKeywords::WritePre(rate_controller->HostStatsToString(), "",
+                         fetch, message_handler_);
+}
+
+void AdminSite::PrintFilterCosts(AdminSource source, AsyncFetch* fetch,
+                                 Statistics* stats) {
+  AdminHtml admin_html("filter_costs", "", source, timer_, fetch,
+                       message_handler_);
+  HtmlFilterProfileStats filter_stats(stats);
+  fetch->Write(StrCat("<p>Thousands of CPU cycles taken by each HTML filter "
+                      "per document, over the documents sampled with ",
+                      RewriteOptions::kHtmlFilterProfileSampleRate,
+                      ":</p>"),
+               message_handler_);
+  HtmlKeywords::WritePre(filter_stats.ToString(), "", fetch, message_handler_);
+}
+
 void AdminSite::PrintSpdyConfig(AdminSource source, AsyncFetch* fetch,
                                 const SystemRewriteOptions* spdy_config) {
   AdminHtml admin_html("spdy_config", "", source, timer_, fetch,
@@ -713,7 +748,8 @@ void AdminSite::AdminPage(
     CacheInterface* metadata_cache, PropertyCache* page_property_cache,
     ServerContext* server_context, Statistics* statistics, Statistics* stats,
     SystemRewriteOptions* global_system_rewrite_options,
-    const SystemRewriteOptions* spdy_config) {
+    const SystemRewriteOptions* spdy_config,
+    RateController* rate_controller) {
   // The handler is "pagespeed_admin", so we must dispatch off of
   // the remainder of the URL.  For
   // "http://example.com/pagespeed_admin/foo?a=b" we want to pull out
@@ -776,6 +812,10 @@ void AdminSite::AdminPage(
                   page_property_cache, server_context);
     } else if (leaf == "histograms") {
       PrintHistograms(kPageSpeedAdmin, fetch, stats);
+    } else if (leaf == "fetches") {
+      PrintFetches(kPageSpeedAdmin, fetch, rate_controller);
+    } else if (leaf == "filter_costs") {
+      PrintFilterCosts(kPageSpeedAdmin, fetch, stats);
     } else {
       fetch->response_headers()->SetStatusAndReason(HttpStatus::kNotFound);
       fetch->response_headers()->Add(HttpAttributes::kContentType, "text/html");
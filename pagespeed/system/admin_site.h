@@ -30,6 +30,7 @@ class HTTPCache;
 class MessageHandler;
 class PropertyCache;
 class QueryParams;
+class RateController;
 class RewriteOptions;
 class ServerContext;
 class StaticAssetManager;
@@ -86,7 +87,8 @@ class AdminSite {
                  ServerContext* server_context, Statistics* statistics,
                  Statistics* stats,
                  SystemRewriteOptions* global_system_rewrite_options,
-                 const SystemRewriteOptions* spdy_config);
+                 const SystemRewriteOptions* spdy_config,
+                 RateController* rate_controller);
 
   // Handle a request for the legacy /*_pagespeed_statistics page, which also
   // serves as a launching point for a subset of the admin pages.  Because the
@@ -157,6 +159,16 @@ class AdminSite {
   void PrintHistograms(AdminSource source, AsyncFetch* fetch,
                        Statistics* stats);
 
+  // Print the cost of each HTML filter, over the documents sampled for
+  // profiling.
+  void PrintFilterCosts(AdminSource source, AsyncFetch* fetch,
+                        Statistics* stats);
+
+  // Print the state of background fetch rate-limiting for each host.
+  // rate_controller may be NULL.
+  void PrintFetches(AdminSource source, AsyncFetch* fetch,
+                    RateController* rate_controller);
+
   void PurgeHandler(StringPiece url, SystemCachePath* cache_path,
                     AsyncFetch* fetch);
 
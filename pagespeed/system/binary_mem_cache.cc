@@ -0,0 +1,921 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/binary_mem_cache.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/hasher.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/key_value_codec.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kDefaultMemcachedPort = 11211;
+const char kBinaryMemCacheTimeouts[] = "binary_memcache_timeouts";
+const char kLastErrorCheckpointMs[] =
+    "binary_memcache_last_error_checkpoint_ms";
+const char kErrorBurstSize[] = "binary_memcache_error_burst_size";
+
+const int kMaxEvents = 64;
+const size_t kReadChunkSize = 64 * 1024;
+
+}  // namespace
+
+const size_t BinaryMemCache::kValueSizeThreshold;
+const int64 BinaryMemCache::kHealthCheckpointIntervalMs;
+const int64 BinaryMemCache::kMaxErrorBurst;
+const int64 BinaryMemCache::kDefaultTimeoutUs;
+
+// A single request, from the time it is issued until its response (or the
+// response to a later request on the same connection) arrives.
+struct BinaryMemCache::Operation {
+  Operation()
+      : opcode(memcached_binary::kNoop), opaque(0), callback(NULL),
+        deadline_us(0) {
+  }
+
+  memcached_binary::Opcode opcode;
+  uint32 opaque;
+  GoogleString key;    // The caller's key, not the hashed one.
+  Callback* callback;  // Only for gets.
+  int64 deadline_us;
+};
+
+// Requests issued by one call, all destined for the same server.  They are
+// written to a single connection, back to back.
+struct BinaryMemCache::Batch {
+  explicit Batch(int server_index_in) : server_index(server_index_in) {}
+
+  int server_index;
+  GoogleString request;
+  std::vector<Operation> ops;
+};
+
+struct BinaryMemCache::Connection {
+  enum State {
+    kDisconnected,
+    kConnecting,
+    kConnected,
+  };
+
+  explicit Connection(Server* server_in)
+      : server(server_in), fd(-1), state(kDisconnected), write_offset(0),
+        events(0) {
+  }
+
+  Server* server;
+  int fd;
+  State state;
+  GoogleString write_buffer;
+  size_t write_offset;
+  GoogleString read_buffer;
+
+  // Every operation written, or waiting to be written, in request order.
+  // memcached answers requests on a connection in order, so a response
+  // always completes a prefix of this queue.
+  std::deque<Operation> in_flight;
+
+  uint32 events;  // What we are registered for with epoll.
+};
+
+struct BinaryMemCache::Server {
+  Server() : address_length(0), next_connection(0) {}
+  ~Server() { STLDeleteElements(&connections); }
+
+  GoogleString name;  // host:port, as used to build the ring.
+  sockaddr_storage address;
+  socklen_t address_length;
+  std::vector<Connection*> connections;
+  int next_connection;
+  AtomicInt32 num_connected;
+};
+
+class BinaryMemCache::EventThread : public ThreadSystem::Thread {
+ public:
+  EventThread(BinaryMemCache* cache, ThreadSystem* thread_system)
+      : Thread(thread_system, "memcached", ThreadSystem::kJoinable),
+        cache_(cache) {
+  }
+
+  virtual void Run() { cache_->EventLoop(); }
+
+ private:
+  BinaryMemCache* cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventThread);
+};
+
+BinaryMemCache::BinaryMemCache(const StringPiece& servers,
+                               int connections_per_server, Hasher* hasher,
+                               Statistics* statistics, Timer* timer,
+                               ThreadSystem* thread_system,
+                               MessageHandler* handler)
+    : valid_server_spec_(false),
+      connections_per_server_(std::max(1, connections_per_server)),
+      timeout_us_(kDefaultTimeoutUs),
+      hasher_(hasher),
+      timer_(timer),
+      thread_system_(thread_system),
+      epoll_fd_(-1),
+      wakeup_fd_(-1),
+      mutex_(thread_system->NewMutex()),
+      running_(false),
+      timeouts_(statistics->GetVariable(kBinaryMemCacheTimeouts)),
+      last_error_checkpoint_ms_(statistics->GetUpDownCounter(
+          kLastErrorCheckpointMs)),
+      error_burst_size_(statistics->GetUpDownCounter(kErrorBurstSize)),
+      message_handler_(handler) {
+  servers.CopyToString(&server_spec_);
+  StringPieceVector server_vector;
+  SplitStringPieceToVector(servers, ",", &server_vector, true);
+  bool success = true;
+  StringVector names;
+  for (int i = 0, n = server_vector.size(); i < n; ++i) {
+    StringPieceVector host_port;
+    int port = kDefaultMemcachedPort;
+    SplitStringPieceToVector(server_vector[i], ":", &host_port, true);
+    bool ok = false;
+    if (host_port.size() == 1) {
+      ok = true;
+    } else if (host_port.size() == 2) {
+      ok = StringToInt(host_port[1], &port);
+    }
+    if (ok) {
+      host_port[0].CopyToString(StringVectorAdd(&hosts_));
+      ports_.push_back(port);
+      Server* server = new Server;
+      server->name = StrCat(host_port[0], ":", IntegerToString(port));
+      names.push_back(server->name);
+      servers_.push_back(server);
+    } else {
+      message_handler_->Message(kError, "Invalid memcached sever: %s",
+                                server_vector[i].as_string().c_str());
+      success = false;
+    }
+  }
+  valid_server_spec_ = success && !server_vector.empty();
+  ring_.Build(names);
+}
+
+BinaryMemCache::~BinaryMemCache() {
+  ShutDown();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  STLDeleteElements(&servers_);
+}
+
+void BinaryMemCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kBinaryMemCacheTimeouts);
+  statistics->AddUpDownCounter(kLastErrorCheckpointMs);
+  statistics->AddUpDownCounter(kErrorBurstSize);
+}
+
+bool BinaryMemCache::Connect() {
+  if (!valid_server_spec_ || (event_thread_.get() != NULL)) {
+    return false;
+  }
+  for (int i = 0, n = servers_.size(); i < n; ++i) {
+    Server* server = servers_[i];
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    int error = getaddrinfo(hosts_[i].c_str(),
+                            IntegerToString(ports_[i]).c_str(),
+                            &hints, &result);
+    if ((error != 0) || (result == NULL)) {
+      message_handler_->Message(
+          kError, "Failed to resolve memcached server %s: %s",
+          server->name.c_str(), gai_strerror(error));
+      return false;
+    }
+    memcpy(&server->address, result->ai_addr, result->ai_addrlen);
+    server->address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+    for (int j = 0; j < connections_per_server_; ++j) {
+      server->connections.push_back(new Connection(server));
+    }
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((epoll_fd_ < 0) || (wakeup_fd_ < 0)) {
+    message_handler_->Message(kError, "BinaryMemCache: %s",
+                              strerror(errno));
+    return false;
+  }
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;  // Distinguishes the wakeup fd from connections.
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) != 0) {
+    message_handler_->Message(kError, "BinaryMemCache: %s",
+                              strerror(errno));
+    return false;
+  }
+
+  {
+    ScopedMutex lock(mutex_.get());
+    running_ = true;
+  }
+  event_thread_.reset(new EventThread(this, thread_system_));
+  if (!event_thread_->Start()) {
+    ScopedMutex lock(mutex_.get());
+    running_ = false;
+    message_handler_->Message(kError,
+                              "BinaryMemCache: failed to start thread");
+    return false;
+  }
+  return true;
+}
+
+void BinaryMemCache::DecodeValueMatchingKeyAndCallCallback(
+    const GoogleString& key, StringPiece data, Callback* callback) {
+  SharedString key_and_value;
+  key_and_value.Assign(data.data(), data.size());
+  GoogleString actual_key;
+  if (key_value_codec::Decode(&key_and_value, &actual_key, callback->value())) {
+    if (key == actual_key) {
+      ValidateAndReportResult(actual_key, CacheInterface::kAvailable, callback);
+    } else {
+      message_handler_->Message(
+          kError, "BinaryMemCache::Get key collision %s != %s",
+          key.c_str(), actual_key.c_str());
+      ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+    }
+  } else {
+    message_handler_->Message(
+        kError, "BinaryMemCache::Get decoding error on key %s", key.c_str());
+    ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+  }
+}
+
+void BinaryMemCache::Get(const GoogleString& key, Callback* callback) {
+  if (!IsHealthy()) {
+    ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+    return;
+  }
+  GoogleString hashed_key = hasher_->Hash(key);
+  Batch* batch = new Batch(ring_.ServerForKey(hashed_key));
+  Operation op;
+  op.opcode = memcached_binary::kGet;
+  op.opaque = next_opaque_.NoBarrierIncrement(1);
+  op.key = key;
+  op.callback = callback;
+  memcached_binary::AppendPacket(
+      memcached_binary::kRequestMagic, memcached_binary::kGet, 0, op.opaque,
+      StringPiece(), hashed_key, StringPiece(), &batch->request);
+  batch->ops.push_back(op);
+  Enqueue(batch);
+}
+
+void BinaryMemCache::MultiGet(MultiGetRequest* request) {
+  if (!IsHealthy()) {
+    ReportMultiGetNotFound(request);
+    return;
+  }
+
+  // Send all the keys for each server as a run of quiet gets, which only
+  // produce responses for hits, followed by a Noop to mark the end.
+  std::vector<Batch*> batches(servers_.size(), NULL);
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    GoogleString hashed_key = hasher_->Hash(key_callback->key);
+    int server_index = ring_.ServerForKey(hashed_key);
+    Batch* batch = batches[server_index];
+    if (batch == NULL) {
+      batch = batches[server_index] = new Batch(server_index);
+    }
+    Operation op;
+    op.opcode = memcached_binary::kGetQ;
+    op.opaque = next_opaque_.NoBarrierIncrement(1);
+    op.key = key_callback->key;
+    op.callback = key_callback->callback;
+    memcached_binary::AppendGetQ(hashed_key, op.opaque, &batch->request);
+    batch->ops.push_back(op);
+  }
+  delete request;
+
+  for (int i = 0, n = batches.size(); i < n; ++i) {
+    Batch* batch = batches[i];
+    if (batch != NULL) {
+      Operation op;
+      op.opaque = next_opaque_.NoBarrierIncrement(1);
+      memcached_binary::AppendNoop(op.opaque, &batch->request);
+      batch->ops.push_back(op);
+      Enqueue(batch);
+    }
+  }
+}
+
+void BinaryMemCache::PutHelper(const GoogleString& key,
+                               SharedString* key_and_value) {
+  GoogleString hashed_key = hasher_->Hash(key);
+  Batch* batch = new Batch(ring_.ServerForKey(hashed_key));
+  Operation op;
+  op.opcode = memcached_binary::kSet;
+  op.opaque = next_opaque_.NoBarrierIncrement(1);
+  op.key = key;
+  memcached_binary::AppendSet(hashed_key, key_and_value->Value(), op.opaque,
+                              &batch->request);
+  batch->ops.push_back(op);
+  Enqueue(batch);
+}
+
+void BinaryMemCache::PutWithKeyInValue(const GoogleString& key,
+                                       SharedString* key_and_value) {
+  if (!IsHealthy()) {
+    return;
+  }
+  PutHelper(key, key_and_value);
+}
+
+void BinaryMemCache::Put(const GoogleString& key, SharedString* value) {
+  if (!IsHealthy()) {
+    return;
+  }
+
+  SharedString key_and_value;
+  if (key_value_codec::Encode(key, value, &key_and_value)) {
+    PutHelper(key, &key_and_value);
+  } else {
+    message_handler_->Message(
+        kError, "BinaryMemCache::Put error: key size %d too large, first "
+        "100 bytes of key is: %s",
+        static_cast<int>(key.size()), key.substr(0, 100).c_str());
+  }
+}
+
+void BinaryMemCache::Delete(const GoogleString& key) {
+  if (!IsHealthy()) {
+    return;
+  }
+  // See AprMemCache::Delete regarding values stored in the fallback cache.
+  GoogleString hashed_key = hasher_->Hash(key);
+  Batch* batch = new Batch(ring_.ServerForKey(hashed_key));
+  Operation op;
+  op.opcode = memcached_binary::kDelete;
+  op.opaque = next_opaque_.NoBarrierIncrement(1);
+  op.key = key;
+  memcached_binary::AppendDelete(hashed_key, op.opaque, &batch->request);
+  batch->ops.push_back(op);
+  Enqueue(batch);
+}
+
+void BinaryMemCache::Enqueue(Batch* batch) {
+  for (int i = 0, n = batch->ops.size(); i < n; ++i) {
+    if (batch->ops[i].opcode != memcached_binary::kNoop) {
+      outstanding_operations_.NoBarrierIncrement(1);
+    }
+  }
+
+  bool queued = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (running_) {
+      int64 deadline_us = timer_->NowUs() + timeout_us_;
+      for (int i = 0, n = batch->ops.size(); i < n; ++i) {
+        batch->ops[i].deadline_us = deadline_us;
+      }
+      pending_batches_.push_back(batch);
+      queued = true;
+    }
+  }
+
+  if (queued) {
+    Wakeup();
+  } else {
+    for (int i = 0, n = batch->ops.size(); i < n; ++i) {
+      FailOperation(&batch->ops[i]);
+    }
+    delete batch;
+  }
+}
+
+void BinaryMemCache::Wakeup() {
+  uint64 one = 1;
+  // This can only fail if the counter would overflow, in which case the
+  // event thread is already due to wake up.
+  ssize_t written = write(wakeup_fd_, &one, sizeof(one));
+  DCHECK(written == sizeof(one) || errno == EAGAIN);
+}
+
+void BinaryMemCache::FailOperation(Operation* op) {
+  if (op->opcode == memcached_binary::kNoop) {
+    return;
+  }
+  if (op->callback != NULL) {
+    ValidateAndReportResult(op->key, CacheInterface::kNotFound, op->callback);
+  }
+  outstanding_operations_.NoBarrierIncrement(-1);
+}
+
+void BinaryMemCache::CompleteOperation(Operation* op, uint16 status,
+                                       StringPiece value) {
+  switch (op->opcode) {
+    case memcached_binary::kGet:
+    case memcached_binary::kGetQ:
+      if (status == memcached_binary::kNoError) {
+        DecodeValueMatchingKeyAndCallCallback(op->key, value, op->callback);
+      } else {
+        if (status != memcached_binary::kKeyNotFound) {
+          RecordError();
+          message_handler_->Message(
+              kError, "BinaryMemCache::Get error: status 0x%x on key %s",
+              status, op->key.c_str());
+        }
+        ValidateAndReportResult(op->key, CacheInterface::kNotFound,
+                                op->callback);
+      }
+      break;
+    case memcached_binary::kSet:
+      if (status != memcached_binary::kNoError) {
+        RecordError();
+        message_handler_->Message(
+            kError, "BinaryMemCache::Put error: status 0x%x on key %s",
+            status, op->key.c_str());
+      }
+      break;
+    case memcached_binary::kDelete:
+      if ((status != memcached_binary::kNoError) &&
+          (status != memcached_binary::kKeyNotFound)) {
+        RecordError();
+        message_handler_->Message(
+            kError, "BinaryMemCache::Delete error: status 0x%x on key %s",
+            status, op->key.c_str());
+      }
+      break;
+    case memcached_binary::kNoop:
+      return;
+  }
+  outstanding_operations_.NoBarrierIncrement(-1);
+}
+
+void BinaryMemCache::EventLoop() {
+  epoll_event events[kMaxEvents];
+  while (true) {
+    int timeout_ms = -1;
+    int64 deadline_us = NextDeadlineUs();
+    if (deadline_us >= 0) {
+      int64 now_us = timer_->NowUs();
+      timeout_ms = (deadline_us <= now_us) ? 0 :
+          (deadline_us - now_us + Timer::kMsUs - 1) / Timer::kMsUs;
+    }
+    int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if ((num_events < 0) && (errno != EINTR)) {
+      message_handler_->Message(kError, "BinaryMemCache: epoll_wait: %s",
+                                strerror(errno));
+      break;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      Connection* connection = static_cast<Connection*>(events[i].data.ptr);
+      if (connection == NULL) {
+        uint64 count;
+        ssize_t bytes_read = read(wakeup_fd_, &count, sizeof(count));
+        DCHECK(bytes_read == sizeof(count) || errno == EAGAIN);
+      } else {
+        HandleEvents(connection, events[i].events);
+      }
+    }
+
+    bool running;
+    {
+      ScopedMutex lock(mutex_.get());
+      running = running_;
+    }
+    if (!running) {
+      break;
+    }
+    DrainPendingBatches();
+    ExpireTimedOutConnections();
+  }
+
+  // Fail whatever is left.  Once running_ is false nothing more can be
+  // queued, so this is everything.
+  std::vector<Batch*> batches;
+  {
+    ScopedMutex lock(mutex_.get());
+    running_ = false;
+    batches.swap(pending_batches_);
+  }
+  for (int i = 0, n = batches.size(); i < n; ++i) {
+    for (int j = 0, m = batches[i]->ops.size(); j < m; ++j) {
+      FailOperation(&batches[i]->ops[j]);
+    }
+  }
+  STLDeleteElements(&batches);
+  for (int i = 0, n = servers_.size(); i < n; ++i) {
+    for (int j = 0, m = servers_[i]->connections.size(); j < m; ++j) {
+      CloseConnection(servers_[i]->connections[j]);
+    }
+  }
+}
+
+void BinaryMemCache::DrainPendingBatches() {
+  std::vector<Batch*> batches;
+  {
+    ScopedMutex lock(mutex_.get());
+    batches.swap(pending_batches_);
+  }
+  for (int i = 0, n = batches.size(); i < n; ++i) {
+    SendBatch(batches[i]);
+  }
+  STLDeleteElements(&batches);
+}
+
+void BinaryMemCache::SendBatch(Batch* batch) {
+  Server* server = servers_[batch->server_index];
+  Connection* connection = server->connections[server->next_connection];
+  server->next_connection =
+      (server->next_connection + 1) % server->connections.size();
+
+  if (connection->write_buffer.empty()) {
+    connection->write_buffer.swap(batch->request);
+  } else {
+    connection->write_buffer.append(batch->request);
+  }
+  for (int i = 0, n = batch->ops.size(); i < n; ++i) {
+    connection->in_flight.push_back(Operation());
+    Operation* op = &connection->in_flight.back();
+    op->opcode = batch->ops[i].opcode;
+    op->opaque = batch->ops[i].opaque;
+    op->key.swap(batch->ops[i].key);
+    op->callback = batch->ops[i].callback;
+    op->deadline_us = batch->ops[i].deadline_us;
+  }
+
+  if ((connection->state == Connection::kDisconnected) &&
+      !OpenConnection(connection)) {
+    FailConnection(connection, StrCat("connect: ", strerror(errno)), false);
+    return;
+  }
+  if ((connection->state == Connection::kConnected) &&
+      !FlushConnection(connection)) {
+    return;
+  }
+  UpdateInterest(connection);
+}
+
+bool BinaryMemCache::OpenConnection(Connection* connection) {
+  Server* server = connection->server;
+  connection->fd = socket(server->address.ss_family,
+                          SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connection->fd < 0) {
+    return false;
+  }
+  // We write whole batches and don't want them held back waiting for acks.
+  int one = 1;
+  setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(connection->fd, reinterpret_cast<sockaddr*>(&server->address),
+              server->address_length) == 0) {
+    connection->state = Connection::kConnected;
+    server->num_connected.NoBarrierIncrement(1);
+  } else if (errno == EINPROGRESS) {
+    connection->state = Connection::kConnecting;
+  } else {
+    return false;
+  }
+
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT;
+  event.data.ptr = connection;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection->fd, &event) != 0) {
+    return false;
+  }
+  connection->events = event.events;
+  return true;
+}
+
+void BinaryMemCache::UpdateInterest(Connection* connection) {
+  if (connection->fd < 0) {
+    return;
+  }
+  uint32 events = EPOLLIN;
+  if ((connection->state == Connection::kConnecting) ||
+      (connection->write_offset < connection->write_buffer.size())) {
+    events |= EPOLLOUT;
+  }
+  if (events != connection->events) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+  }
+}
+
+void BinaryMemCache::HandleEvents(Connection* connection, uint32 events) {
+  if (connection->state == Connection::kDisconnected) {
+    return;
+  }
+  if (connection->state == Connection::kConnecting) {
+    if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) == 0) {
+      return;
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error,
+                   &length) != 0) {
+      error = errno;
+    }
+    if (error != 0) {
+      FailConnection(connection, StrCat("connect: ", strerror(error)), false);
+      return;
+    }
+    connection->state = Connection::kConnected;
+    connection->server->num_connected.NoBarrierIncrement(1);
+  }
+  if (((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) &&
+      !ReadConnection(connection)) {
+    return;
+  }
+  if (!FlushConnection(connection)) {
+    return;
+  }
+  UpdateInterest(connection);
+}
+
+bool BinaryMemCache::FlushConnection(Connection* connection) {
+  GoogleString* buffer = &connection->write_buffer;
+  while (connection->write_offset < buffer->size()) {
+    ssize_t bytes = send(connection->fd,
+                         buffer->data() + connection->write_offset,
+                         buffer->size() - connection->write_offset,
+                         MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return true;
+      }
+      FailConnection(connection, StrCat("write: ", strerror(errno)), false);
+      return false;
+    }
+    connection->write_offset += bytes;
+  }
+  buffer->clear();
+  connection->write_offset = 0;
+  return true;
+}
+
+bool BinaryMemCache::ReadConnection(Connection* connection) {
+  GoogleString* buffer = &connection->read_buffer;
+  while (true) {
+    size_t old_size = buffer->size();
+    buffer->resize(old_size + kReadChunkSize);
+    ssize_t bytes = recv(connection->fd, &(*buffer)[old_size], kReadChunkSize,
+                         0);
+    buffer->resize(old_size + std::max(bytes, static_cast<ssize_t>(0)));
+    if (bytes > 0) {
+      continue;
+    } else if (bytes == 0) {
+      FailConnection(connection, "connection closed by server", false);
+      return false;
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      break;
+    }
+    FailConnection(connection, StrCat("read: ", strerror(errno)), false);
+    return false;
+  }
+
+  size_t offset = 0;
+  while (buffer->size() - offset >= memcached_binary::kHeaderSize) {
+    memcached_binary::Header header;
+    if (!memcached_binary::ParseHeader(
+            StringPiece(buffer->data() + offset, memcached_binary::kHeaderSize),
+            &header) ||
+        (header.magic != memcached_binary::kResponseMagic)) {
+      FailConnection(connection, "malformed response", false);
+      return false;
+    }
+    size_t packet_size = memcached_binary::kHeaderSize + header.body_length;
+    if (buffer->size() - offset < packet_size) {
+      break;
+    }
+    StringPiece body(buffer->data() + offset + memcached_binary::kHeaderSize,
+                     static_cast<size_t>(header.body_length));
+    if (!HandleResponse(connection, header, body)) {
+      return false;
+    }
+    offset += packet_size;
+  }
+  buffer->erase(0, offset);
+  return true;
+}
+
+bool BinaryMemCache::HandleResponse(Connection* connection,
+                                    const memcached_binary::Header& header,
+                                    StringPiece body) {
+  std::deque<Operation>* in_flight = &connection->in_flight;
+  while (!in_flight->empty()) {
+    Operation op;
+    op.opcode = in_flight->front().opcode;
+    op.opaque = in_flight->front().opaque;
+    op.key.swap(in_flight->front().key);
+    op.callback = in_flight->front().callback;
+    in_flight->pop_front();
+    if (op.opaque == header.opaque) {
+      CompleteOperation(&op, header.status,
+                        memcached_binary::Value(header, body));
+      return true;
+    } else if (op.opcode == memcached_binary::kGetQ) {
+      // Quiet gets are answered only on hits, so the server skipped this one.
+      CompleteOperation(&op, memcached_binary::kKeyNotFound, StringPiece());
+    } else {
+      FailOperation(&op);
+      break;
+    }
+  }
+  FailConnection(connection, "unexpected response", false);
+  return false;
+}
+
+void BinaryMemCache::FailConnection(Connection* connection,
+                                    const GoogleString& reason,
+                                    bool timed_out) {
+  RecordError();
+  if (timed_out) {
+    timeouts_->Add(1);
+  }
+  message_handler_->Message(
+      kError, "BinaryMemCache: %s on connection to %s, failing %d operations",
+      reason.c_str(), connection->server->name.c_str(),
+      static_cast<int>(connection->in_flight.size()));
+  CloseConnection(connection);
+}
+
+void BinaryMemCache::CloseConnection(Connection* connection) {
+  if (connection->fd >= 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  if (connection->state == Connection::kConnected) {
+    connection->server->num_connected.NoBarrierIncrement(-1);
+  }
+  connection->state = Connection::kDisconnected;
+  connection->events = 0;
+  connection->write_buffer.clear();
+  connection->write_offset = 0;
+  connection->read_buffer.clear();
+
+  // Run the callbacks only once the connection is back in a consistent
+  // state.
+  std::deque<Operation> failed;
+  failed.swap(connection->in_flight);
+  for (int i = 0, n = failed.size(); i < n; ++i) {
+    FailOperation(&failed[i]);
+  }
+}
+
+int64 BinaryMemCache::NextDeadlineUs() const {
+  int64 deadline_us = -1;
+  for (int i = 0, n = servers_.size(); i < n; ++i) {
+    const std::vector<Connection*>& connections = servers_[i]->connections;
+    for (int j = 0, m = connections.size(); j < m; ++j) {
+      // Operations are queued in deadline order, so the oldest is first.
+      if (!connections[j]->in_flight.empty()) {
+        int64 front_us = connections[j]->in_flight.front().deadline_us;
+        if ((deadline_us < 0) || (front_us < deadline_us)) {
+          deadline_us = front_us;
+        }
+      }
+    }
+  }
+  return deadline_us;
+}
+
+void BinaryMemCache::ExpireTimedOutConnections() {
+  int64 now_us = timer_->NowUs();
+  for (int i = 0, n = servers_.size(); i < n; ++i) {
+    const std::vector<Connection*>& connections = servers_[i]->connections;
+    for (int j = 0, m = connections.size(); j < m; ++j) {
+      Connection* connection = connections[j];
+      if (!connection->in_flight.empty() &&
+          (connection->in_flight.front().deadline_us <= now_us)) {
+        FailConnection(connection, "timeout", true);
+      }
+    }
+  }
+}
+
+bool BinaryMemCache::GetStatus(GoogleString* buffer) {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!running_) {
+      return false;
+    }
+  }
+  for (int i = 0, n = servers_.size(); i < n; ++i) {
+    StrAppend(buffer, "memcached server ", servers_[i]->name,
+              " (binary protocol): ",
+              IntegerToString(servers_[i]->num_connected.value()), " of ",
+              IntegerToString(connections_per_server_),
+              " connections open\n");
+  }
+  StrAppend(buffer, "outstanding operations: ",
+            IntegerToString(outstanding_operations()), "\n");
+  return true;
+}
+
+void BinaryMemCache::RecordError() {
+  // See AprMemCache::RecordError.
+  int64 time_ms = timer_->NowMs();
+  int64 last_error_checkpoint_ms = last_error_checkpoint_ms_->Get();
+  int64 delta_ms = time_ms - last_error_checkpoint_ms;
+  if (delta_ms > kHealthCheckpointIntervalMs) {
+    last_error_checkpoint_ms_->Set(time_ms);
+    error_burst_size_->Set(1);
+  } else {
+    error_burst_size_->Add(1);
+  }
+}
+
+bool BinaryMemCache::IsHealthy() const {
+  if (shutdown_.value() || servers_.empty()) {
+    return false;
+  }
+  int64 time_ms = timer_->NowMs();
+  int64 last_error_checkpoint_ms = last_error_checkpoint_ms_->Get();
+  int64 delta_ms = time_ms - last_error_checkpoint_ms;
+  int64 error_burst_size = error_burst_size_->Get();
+
+  if (delta_ms > kHealthCheckpointIntervalMs) {
+    if (error_burst_size >= kMaxErrorBurst) {
+      message_handler_->Message(
+          kInfo, "BinaryMemCache::IsHealthy error: Attempting to recover");
+    }
+    error_burst_size_->Set(0);
+    return true;
+  }
+  return error_burst_size < kMaxErrorBurst;
+}
+
+void BinaryMemCache::ShutDown() {
+  shutdown_.set_value(true);
+  bool was_running;
+  {
+    ScopedMutex lock(mutex_.get());
+    was_running = running_;
+    running_ = false;
+  }
+  // The event thread may also have stopped on its own, after an epoll
+  // failure, so join it whenever it was started.
+  if (event_thread_.get() != NULL) {
+    if (was_running) {
+      Wakeup();
+    }
+    event_thread_->Join();
+    event_thread_.reset(NULL);
+  }
+}
+
+void BinaryMemCache::set_timeout_us(int timeout_us) {
+  timeout_us_ = (timeout_us > 0) ? timeout_us : kDefaultTimeoutUs;
+}
+
+}  // namespace net_instaweb
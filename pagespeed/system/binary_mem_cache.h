@@ -0,0 +1,220 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_BINARY_MEM_CACHE_H_
+#define PAGESPEED_SYSTEM_BINARY_MEM_CACHE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/system/ketama_ring.h"
+#include "pagespeed/system/memcached_binary_protocol.h"
+
+namespace net_instaweb {
+
+class Hasher;
+class MessageHandler;
+class SharedString;
+class Statistics;
+class ThreadSystem;
+class UpDownCounter;
+class Variable;
+
+// Non-blocking memcached client speaking the binary protocol.
+//
+// Unlike AprMemCache, which makes one blocking round-trip per operation and
+// so must run under an AsyncCache, this class never blocks its callers:
+// requests are encoded on the calling thread and handed to a single event
+// thread, which multiplexes a small pool of non-blocking connections to each
+// server with epoll.  Requests are pipelined on each connection, and the
+// keys of a MultiGet are sent to each server as one batch of quiet gets
+// (GetQ) terminated by a Noop, so a MultiGet costs one round-trip per server
+// regardless of how many keys it has.  Keys are distributed across servers
+// with a ketama consistent-hashing ring, so adding or removing a server only
+// remaps the keys it owned.
+//
+// Callbacks are run on the event thread, so they must not wait on this
+// cache; wrap it in a SequencedCallbackCache or BlockingCache before handing
+// it to code that might.  As with AprMemCache, values are stored with their
+// key encoded in them (see key_value_codec) to detect collisions of the
+// hashed memcached keys.
+class BinaryMemCache : public CacheInterface {
+ public:
+  // See AprMemCache::kValueSizeThreshold; memcached's default item size
+  // limit is 1M.
+  static const size_t kValueSizeThreshold = 1 * 1000 * 1000;
+
+  // Amount of time after a burst of errors to retry memcached operations.
+  static const int64 kHealthCheckpointIntervalMs = 30 * Timer::kSecondMs;
+
+  // Maximum number of errors tolerated within kHealthCheckpointIntervalMs,
+  // after which BinaryMemCache will declare itself unhealthy for
+  // kHealthCheckpointIntervalMs.
+  static const int64 kMaxErrorBurst = 4;
+
+  // Used when set_timeout_us is not called with a positive value.
+  static const int64 kDefaultTimeoutUs = 500 * Timer::kMsUs;
+
+  // servers is a comma-separated list of host[:port] where port defaults
+  // to 11211, the memcached default.  connections_per_server is the number
+  // of connections opened to each server; operations are spread across
+  // them.
+  BinaryMemCache(const StringPiece& servers, int connections_per_server,
+                 Hasher* hasher, Statistics* statistics, Timer* timer,
+                 ThreadSystem* thread_system, MessageHandler* handler);
+  virtual ~BinaryMemCache();
+
+  static void InitStats(Statistics* statistics);
+
+  const GoogleString& server_spec() const { return server_spec_; }
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  virtual void MultiGet(MultiGetRequest* request);
+
+  // Resolves the server addresses and starts the event thread, returning
+  // whether that succeeded.  Connections are opened lazily, when the first
+  // operation for a server is issued.  Like AprMemCache, this should be
+  // called in the child processes, not the root process.
+  bool Connect();
+
+  bool valid_server_spec() const { return valid_server_spec_; }
+
+  // Appends a description of each server's connection status to
+  // status_string, returning false if Connect has not succeeded or we are
+  // shut down.
+  bool GetStatus(GoogleString* status_string);
+
+  static GoogleString FormatName() { return "BinaryMemCache"; }
+  virtual GoogleString Name() const { return FormatName(); }
+  virtual bool IsBlocking() const { return false; }
+
+  // Records in statistics that a system error occurred, helping it detect
+  // when it's unhealthy if they are too frequent.
+  void RecordError();
+
+  // Determines whether memcached is healthy enough to attempt another
+  // operation.  As with AprMemCache, errors are not tracked per server.
+  virtual bool IsHealthy() const;
+
+  // Stops the event thread, reporting any outstanding gets as not found,
+  // and closes all connections.  Operations issued afterwards fail
+  // immediately.  This must not be called from a cache callback, as those
+  // run on the event thread.
+  virtual void ShutDown();
+
+  virtual bool MustEncodeKeyInValueOnPut() const { return true; }
+  virtual void PutWithKeyInValue(const GoogleString& key,
+                                 SharedString* key_and_value);
+
+  // Sets the time allowed for each operation, in microseconds.  When an
+  // operation times out, its connection is closed, failing everything
+  // pipelined on it.  This should be called before Connect.
+  void set_timeout_us(int timeout_us);
+
+  // Number of gets, puts and deletes issued but not yet completed.
+  int32 outstanding_operations() const {
+    return outstanding_operations_.value();
+  }
+
+ private:
+  class EventThread;
+  struct Batch;
+  struct Connection;
+  struct Operation;
+  struct Server;
+
+  // Hands a batch of requests for one server to the event thread, or fails
+  // it immediately if we are shut down.
+  void Enqueue(Batch* batch);
+
+  // Issues a Set of an already-encoded value, without a health check.
+  void PutHelper(const GoogleString& key, SharedString* key_and_value);
+
+  // Completes 'op' without a response, reporting gets as not found.
+  void FailOperation(Operation* op);
+
+  void DecodeValueMatchingKeyAndCallCallback(
+      const GoogleString& key, StringPiece data, Callback* callback);
+
+  // Interrupts the event thread's wait for I/O.
+  void Wakeup();
+
+  // The remaining methods run only on the event thread.  Those returning
+  // bool return false if they had to close the connection.
+  void EventLoop();
+  void DrainPendingBatches();
+  void SendBatch(Batch* batch);
+  bool OpenConnection(Connection* connection);
+  void HandleEvents(Connection* connection, uint32 events);
+  bool FlushConnection(Connection* connection);
+  bool ReadConnection(Connection* connection);
+  bool HandleResponse(Connection* connection,
+                      const memcached_binary::Header& header,
+                      StringPiece body);
+  void CompleteOperation(Operation* op, uint16 status, StringPiece value);
+  void FailConnection(Connection* connection, const GoogleString& reason,
+                      bool timed_out);
+  void CloseConnection(Connection* connection);
+  void UpdateInterest(Connection* connection);
+  int64 NextDeadlineUs() const;
+  void ExpireTimedOutConnections();
+
+  StringVector hosts_;
+  std::vector<int> ports_;
+  GoogleString server_spec_;
+  bool valid_server_spec_;
+  int connections_per_server_;
+  int64 timeout_us_;
+  Hasher* hasher_;
+  Timer* timer_;
+  ThreadSystem* thread_system_;
+  KetamaRing ring_;
+  std::vector<Server*> servers_;
+
+  int epoll_fd_;
+  int wakeup_fd_;
+  scoped_ptr<EventThread> event_thread_;
+
+  scoped_ptr<AbstractMutex> mutex_;
+  std::vector<Batch*> pending_batches_ GUARDED_BY(mutex_);
+  bool running_ GUARDED_BY(mutex_);
+
+  AtomicBool shutdown_;
+  AtomicInt32 next_opaque_;
+  AtomicInt32 outstanding_operations_;
+  Variable* timeouts_;
+  UpDownCounter* last_error_checkpoint_ms_;
+  UpDownCounter* error_burst_size_;
+  MessageHandler* message_handler_;
+
+  DISALLOW_COPY_AND_ASSIGN(BinaryMemCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_BINARY_MEM_CACHE_H_
@@ -0,0 +1,406 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the binary-protocol memcached client against in-process fake
+// memcached servers.
+
+#include "pagespeed/system/binary_mem_cache.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/mock_hasher.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "pagespeed/system/memcached_binary_protocol.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kConnectionsPerServer = 2;
+
+// A single-threaded memcached speaking just enough of the binary protocol
+// for BinaryMemCache, listening on an ephemeral localhost port.
+class FakeMemcached : public ThreadSystem::Thread {
+ public:
+  explicit FakeMemcached(ThreadSystem* thread_system)
+      : Thread(thread_system, "fake_memcached", ThreadSystem::kJoinable),
+        mutex_(thread_system->NewMutex()),
+        listen_fd_(-1),
+        port_(0),
+        num_noops_(0) {
+  }
+
+  virtual ~FakeMemcached() {
+    stop_.set_value(true);
+    Join();
+    for (int i = 0, n = clients_.size(); i < n; ++i) {
+      close(clients_[i].fd);
+    }
+    close(listen_fd_);
+  }
+
+  // Binds the listening socket and starts serving.
+  bool Listen() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if ((bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0) ||
+        (listen(listen_fd_, 16) != 0) ||
+        (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+                     &length) != 0)) {
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    return Start();
+  }
+
+  // When set, requests are read but never answered.
+  void set_unresponsive(bool x) { unresponsive_.set_value(x); }
+
+  int port() const { return port_; }
+
+  int num_entries() {
+    ScopedMutex lock(mutex_.get());
+    return store_.size();
+  }
+  int num_noops() {
+    ScopedMutex lock(mutex_.get());
+    return num_noops_;
+  }
+
+  virtual void Run() {
+    while (!stop_.value()) {
+      std::vector<pollfd> fds(1 + clients_.size());
+      fds[0].fd = listen_fd_;
+      fds[0].events = POLLIN;
+      for (int i = 0, n = clients_.size(); i < n; ++i) {
+        fds[i + 1].fd = clients_[i].fd;
+        fds[i + 1].events = POLLIN;
+      }
+      if (poll(&fds[0], fds.size(), 10 /* ms */) <= 0) {
+        continue;
+      }
+      if ((fds[0].revents & POLLIN) != 0) {
+        Client client;
+        client.fd = accept(listen_fd_, NULL, NULL);
+        clients_.push_back(client);
+      }
+      for (int i = fds.size() - 2; i >= 0; --i) {
+        if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) != 0 &&
+            !Serve(&clients_[i])) {
+          close(clients_[i].fd);
+          clients_.erase(clients_.begin() + i);
+        }
+      }
+    }
+  }
+
+ private:
+  struct Client {
+    int fd;
+    GoogleString input;
+  };
+
+  // Reads what's available from the client and answers every complete
+  // request.  Returns false when the client has gone away.
+  bool Serve(Client* client) {
+    char buf[4096];
+    ssize_t bytes = read(client->fd, buf, sizeof(buf));
+    if (bytes <= 0) {
+      return false;
+    }
+    client->input.append(buf, bytes);
+    GoogleString output;
+    size_t offset = 0;
+    while (client->input.size() - offset >= memcached_binary::kHeaderSize) {
+      memcached_binary::Header header;
+      EXPECT_TRUE(memcached_binary::ParseHeader(
+          StringPiece(client->input.data() + offset,
+                      memcached_binary::kHeaderSize), &header));
+      EXPECT_EQ(memcached_binary::kRequestMagic, header.magic);
+      size_t size = memcached_binary::kHeaderSize + header.body_length;
+      if (client->input.size() - offset < size) {
+        break;
+      }
+      StringPiece body(
+          client->input.data() + offset + memcached_binary::kHeaderSize,
+          static_cast<size_t>(header.body_length));
+      HandleRequest(header, body, &output);
+      offset += size;
+    }
+    client->input.erase(0, offset);
+    if (!unresponsive_.value() && !output.empty()) {
+      EXPECT_EQ(static_cast<ssize_t>(output.size()),
+                write(client->fd, output.data(), output.size()));
+    }
+    return true;
+  }
+
+  void HandleRequest(const memcached_binary::Header& header, StringPiece body,
+                     GoogleString* output) {
+    GoogleString key = memcached_binary::Key(header, body).as_string();
+    uint16 status = memcached_binary::kNoError;
+    GoogleString value;
+    bool respond = true;
+    ScopedMutex lock(mutex_.get());
+    switch (header.opcode) {
+      case memcached_binary::kGet:
+      case memcached_binary::kGetQ: {
+        std::map<GoogleString, GoogleString>::iterator p = store_.find(key);
+        if (p == store_.end()) {
+          status = memcached_binary::kKeyNotFound;
+          respond = (header.opcode == memcached_binary::kGet);
+        } else {
+          value = p->second;
+        }
+        break;
+      }
+      case memcached_binary::kSet:
+        EXPECT_EQ(8, header.extras_length);
+        store_[key] = memcached_binary::Value(header, body).as_string();
+        break;
+      case memcached_binary::kDelete:
+        if (store_.erase(key) == 0) {
+          status = memcached_binary::kKeyNotFound;
+        }
+        break;
+      case memcached_binary::kNoop:
+        ++num_noops_;
+        break;
+      default:
+        status = memcached_binary::kUnknownCommand;
+        break;
+    }
+    if (respond) {
+      // Get responses carry 4 bytes of flags as extras.
+      StringPiece extras;
+      if (!value.empty()) {
+        extras = StringPiece("\0\0\0\0", 4);
+      }
+      memcached_binary::AppendPacket(
+          memcached_binary::kResponseMagic, header.opcode, status,
+          header.opaque, extras, StringPiece(), value, output);
+    }
+  }
+
+  scoped_ptr<AbstractMutex> mutex_;
+  int listen_fd_;
+  int port_;
+  AtomicBool stop_;
+  AtomicBool unresponsive_;
+  std::vector<Client> clients_;  // Only accessed by the server thread.
+  std::map<GoogleString, GoogleString> store_;
+  int num_noops_;
+
+  DISALLOW_COPY_AND_ASSIGN(FakeMemcached);
+};
+
+class BinaryMemCacheTest : public CacheTestBase {
+ protected:
+  class AsyncCallback : public CacheTestBase::Callback {
+   public:
+    explicit AsyncCallback(BinaryMemCacheTest* test)
+        : Callback(test),
+          sync_point_(test->thread_system_.get()) {
+    }
+
+    virtual void Done(CacheInterface::KeyState state) {
+      Callback::Done(state);
+      sync_point_.Notify();
+    }
+
+    virtual void Wait() { sync_point_.Wait(); }
+
+   private:
+    WorkerTestBase::SyncPoint sync_point_;
+  };
+
+  BinaryMemCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewTimer()),
+        statistics_(thread_system_.get()) {
+    set_mutex(thread_system_->NewMutex());
+    BinaryMemCache::InitStats(&statistics_);
+  }
+
+  ~BinaryMemCacheTest() {
+    // Stop the cache before its servers go away.
+    cache_.reset(NULL);
+    STLDeleteElements(&servers_);
+  }
+
+  // Starts num_servers fake servers and a cache talking to them.
+  void StartServersAndCache(int num_servers, Hasher* hasher) {
+    GoogleString spec;
+    for (int i = 0; i < num_servers; ++i) {
+      FakeMemcached* server = new FakeMemcached(thread_system_.get());
+      servers_.push_back(server);
+      ASSERT_TRUE(server->Listen());
+      StrAppend(&spec, (i == 0) ? "" : ",", "127.0.0.1:",
+                IntegerToString(server->port()));
+    }
+    StartCache(spec, hasher);
+  }
+
+  void StartCache(const GoogleString& spec, Hasher* hasher) {
+    cache_.reset(new BinaryMemCache(spec, kConnectionsPerServer, hasher,
+                                    &statistics_, timer_.get(),
+                                    thread_system_.get(), &handler_));
+    cache_->set_timeout_us(200 * Timer::kMsUs);
+    ASSERT_TRUE(cache_->Connect());
+  }
+
+  virtual CacheInterface* Cache() { return cache_.get(); }
+  virtual Callback* NewCallback() { return new AsyncCallback(this); }
+
+  virtual void PostOpCleanup() {
+    // Puts and deletes are asynchronous; wait for their responses so that
+    // later gets, which may use another connection, see their effect.
+    while (cache_->outstanding_operations() != 0) {
+      timer_->SleepMs(1);
+    }
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  SimpleStats statistics_;
+  MD5Hasher md5_hasher_;
+  NullMessageHandler handler_;
+  std::vector<FakeMemcached*> servers_;
+  scoped_ptr<BinaryMemCache> cache_;
+};
+
+TEST_F(BinaryMemCacheTest, PutGetDelete) {
+  StartServersAndCache(1, &md5_hasher_);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  CheckDelete("Name");  // Deleting a missing key is not an error.
+  EXPECT_TRUE(cache_->IsHealthy());
+}
+
+TEST_F(BinaryMemCacheTest, MultiGetBatchesPerServer) {
+  StartServersAndCache(2, &md5_hasher_);
+  TestMultiGet();  // Checks results for "n0", "not_found", and "n1".
+
+  // A MultiGet of many keys costs at most one Noop per server.
+  PopulateCache(20);
+  int noops_before = servers_[0]->num_noops() + servers_[1]->num_noops();
+  std::vector<Callback*> callbacks;
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  for (int i = 0; i < 20; ++i) {
+    Callback* callback = AddCallback();
+    callbacks.push_back(callback);
+    request->push_back(CacheInterface::KeyCallback(
+        StrCat("n", IntegerToString(i)), callback));
+  }
+  cache_->MultiGet(request);
+  for (int i = 0; i < 20; ++i) {
+    WaitAndCheck(callbacks[i], StrCat("v", IntegerToString(i)));
+  }
+  EXPECT_EQ(2, servers_[0]->num_noops() + servers_[1]->num_noops() -
+            noops_before);
+
+  // The keys are spread over both servers.
+  EXPECT_LT(0, servers_[0]->num_entries());
+  EXPECT_LT(0, servers_[1]->num_entries());
+  EXPECT_EQ(20, servers_[0]->num_entries() + servers_[1]->num_entries());
+}
+
+TEST_F(BinaryMemCacheTest, HashCollision) {
+  // With every key hashing to the same memcached key, the second Put
+  // overwrites the first, which is then detected as a collision.
+  MockHasher mock_hasher;
+  StartServersAndCache(1, &mock_hasher);
+  CheckPut("N1", "V1");
+  CheckGet("N1", "V1");
+  CheckPut("N2", "V2");
+  CheckGet("N2", "V2");
+  CheckNotFound("N1");
+}
+
+TEST_F(BinaryMemCacheTest, Timeout) {
+  StartServersAndCache(1, &md5_hasher_);
+  servers_[0]->set_unresponsive(true);
+  CheckNotFound("Name");
+  EXPECT_EQ(1, statistics_.GetVariable("binary_memcache_timeouts")->Get());
+}
+
+TEST_F(BinaryMemCacheTest, UnhealthyWhenServerIsDown) {
+  // Grab a free port, then close it so that connections are refused.
+  FakeMemcached* server = new FakeMemcached(thread_system_.get());
+  ASSERT_TRUE(server->Listen());
+  int port = server->port();
+  delete server;
+  StartCache(StrCat("127.0.0.1:", IntegerToString(port)), &md5_hasher_);
+
+  for (int i = 0; i < BinaryMemCache::kMaxErrorBurst; ++i) {
+    EXPECT_TRUE(cache_->IsHealthy());
+    CheckNotFound("Name");
+  }
+  EXPECT_FALSE(cache_->IsHealthy());
+}
+
+TEST_F(BinaryMemCacheTest, ShutDown) {
+  StartServersAndCache(1, &md5_hasher_);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+  EXPECT_EQ(0, cache_->outstanding_operations());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,680 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/http2_protocol.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace http2 {
+
+const char kConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+namespace {
+
+// The static table of RFC 7541 Appendix A.
+const char* const kStaticTable[HpackTable::kStaticTableSize][2] = {
+  {":authority", ""},
+  {":method", "GET"},
+  {":method", "POST"},
+  {":path", "/"},
+  {":path", "/index.html"},
+  {":scheme", "http"},
+  {":scheme", "https"},
+  {":status", "200"},
+  {":status", "204"},
+  {":status", "206"},
+  {":status", "304"},
+  {":status", "400"},
+  {":status", "404"},
+  {":status", "500"},
+  {"accept-charset", ""},
+  {"accept-encoding", "gzip, deflate"},
+  {"accept-language", ""},
+  {"accept-ranges", ""},
+  {"accept", ""},
+  {"access-control-allow-origin", ""},
+  {"age", ""},
+  {"allow", ""},
+  {"authorization", ""},
+  {"cache-control", ""},
+  {"content-disposition", ""},
+  {"content-encoding", ""},
+  {"content-language", ""},
+  {"content-length", ""},
+  {"content-location", ""},
+  {"content-range", ""},
+  {"content-type", ""},
+  {"cookie", ""},
+  {"date", ""},
+  {"etag", ""},
+  {"expect", ""},
+  {"expires", ""},
+  {"from", ""},
+  {"host", ""},
+  {"if-match", ""},
+  {"if-modified-since", ""},
+  {"if-none-match", ""},
+  {"if-range", ""},
+  {"if-unmodified-since", ""},
+  {"last-modified", ""},
+  {"link", ""},
+  {"location", ""},
+  {"max-forwards", ""},
+  {"proxy-authenticate", ""},
+  {"proxy-authorization", ""},
+  {"range", ""},
+  {"referer", ""},
+  {"refresh", ""},
+  {"retry-after", ""},
+  {"server", ""},
+  {"set-cookie", ""},
+  {"strict-transport-security", ""},
+  {"transfer-encoding", ""},
+  {"user-agent", ""},
+  {"vary", ""},
+  {"via", ""},
+  {"www-authenticate", ""},
+};
+
+// The Huffman code of RFC 7541 Appendix B, indexed by symbol, with symbol
+// 256 being EOS.  The code is canonical: ordering the symbols by code
+// length, then by value, gives them consecutive codes.  That lets decoding
+// find the symbol for a code of a given length from just the first code of
+// that length and the symbols in code order.
+const uint32 kHuffmanCodes[257] = {
+  0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+  0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+  0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+  0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+  0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+  0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+  0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+  0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+  0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+  0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+  0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+  0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+  0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+  0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+  0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+  0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+  0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+  0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+  0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+  0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+  0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+  0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+  0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+  0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+  0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+  0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+  0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+  0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+  0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+  0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+  0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+  0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+  0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+  0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+  0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+  0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+  0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+  0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+  0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+  0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+  0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+  0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+
+const uint8 kHuffmanCodeLengths[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+  6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+  5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+  13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+  15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+  6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30,
+};
+
+const uint16 kSymbolsByCode[257] = {
+  48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+  45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+  95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+  58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+  77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+  106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+  88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+  0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+  167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+  132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+  173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+  151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+  183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+  171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+  255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+  246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+  6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+  21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+  249, 10, 13, 22, 256,
+};
+
+const uint32 kFirstCode[31] = {
+  0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+  0x14, 0x5c, 0xf8, 0x0, 0x3f8, 0x7fa,
+  0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0x0, 0x0,
+  0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+  0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0,
+  0x3ffffffc,
+};
+
+const uint16 kFirstIndex[31] = {
+  0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79,
+  82, 84, 90, 92, 0, 0, 0, 95, 98, 106, 119, 145,
+  174, 186, 190, 205, 224, 0, 253,
+};
+
+const uint16 kCodeCount[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3,
+  2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29,
+  12, 4, 15, 19, 29, 0, 4,
+};
+
+const int kMaxHuffmanCodeLength = 30;
+const int kEndOfString = 256;
+
+void AppendBigEndian(uint64 value, int num_bytes, GoogleString* out) {
+  for (int shift = 8 * (num_bytes - 1); shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+uint64 ReadBigEndian(const char* data, int num_bytes) {
+  uint64 value = 0;
+  for (int i = 0; i < num_bytes; ++i) {
+    value = (value << 8) | static_cast<uint8>(data[i]);
+  }
+  return value;
+}
+
+// Fields that shouldn't end up in a header table, where they could be
+// probed for by a compression attack, or just crowd out more useful ones.
+bool NeverIndexed(const GoogleString& name) {
+  return ((name == "authorization") || (name == "cookie") ||
+          (name == "proxy-authorization"));
+}
+
+void AppendHpackString(StringPiece input, GoogleString* out) {
+  size_t huffman_size = HuffmanEncodedSize(input);
+  if (huffman_size < input.size()) {
+    AppendHpackInteger(huffman_size, 7, 0x80, out);
+    AppendHuffman(input, out);
+  } else {
+    AppendHpackInteger(input.size(), 7, 0x00, out);
+    input.AppendToString(out);
+  }
+}
+
+}  // namespace
+
+void AppendFrame(uint8 type, uint8 flags, uint32 stream_id,
+                 StringPiece payload, GoogleString* out) {
+  DCHECK_LE(payload.size(), 0xffffffu);
+  out->reserve(out->size() + kFrameHeaderSize + payload.size());
+  AppendBigEndian(payload.size(), 3, out);
+  out->push_back(static_cast<char>(type));
+  out->push_back(static_cast<char>(flags));
+  AppendBigEndian(stream_id & 0x7fffffff, 4, out);
+  payload.AppendToString(out);
+}
+
+void AppendSettings(const SettingVector& settings, GoogleString* out) {
+  GoogleString payload;
+  for (int i = 0, n = settings.size(); i < n; ++i) {
+    AppendBigEndian(settings[i].id, 2, &payload);
+    AppendBigEndian(settings[i].value, 4, &payload);
+  }
+  AppendFrame(kSettings, 0, 0, payload, out);
+}
+
+void AppendSettingsAck(GoogleString* out) {
+  AppendFrame(kSettings, kFlagAck, 0, StringPiece(), out);
+}
+
+void AppendPingAck(StringPiece opaque_data, GoogleString* out) {
+  AppendFrame(kPing, kFlagAck, 0, opaque_data, out);
+}
+
+void AppendWindowUpdate(uint32 stream_id, uint32 increment,
+                        GoogleString* out) {
+  GoogleString payload;
+  AppendBigEndian(increment & 0x7fffffff, 4, &payload);
+  AppendFrame(kWindowUpdate, 0, stream_id, payload, out);
+}
+
+void AppendRstStream(uint32 stream_id, ErrorCode error, GoogleString* out) {
+  GoogleString payload;
+  AppendBigEndian(error, 4, &payload);
+  AppendFrame(kRstStream, 0, stream_id, payload, out);
+}
+
+void AppendGoAway(uint32 last_stream_id, ErrorCode error,
+                  GoogleString* out) {
+  GoogleString payload;
+  AppendBigEndian(last_stream_id & 0x7fffffff, 4, &payload);
+  AppendBigEndian(error, 4, &payload);
+  AppendFrame(kGoAway, 0, 0, payload, out);
+}
+
+void AppendHeaders(uint32 stream_id, StringPiece header_block,
+                   bool end_stream, int weight, uint32 max_frame_size,
+                   GoogleString* out) {
+  DCHECK(weight >= 1 && weight <= 256);
+  const size_t kPrioritySize = 5;
+  GoogleString payload;
+  AppendBigEndian(0, 4, &payload);  // Not exclusive, and no dependency.
+  payload.push_back(static_cast<char>(weight - 1));
+  size_t fragment_size = std::min(header_block.size(),
+                                  max_frame_size - kPrioritySize);
+  header_block.substr(0, fragment_size).AppendToString(&payload);
+  header_block.remove_prefix(fragment_size);
+  uint8 flags = kFlagPriority;
+  if (end_stream) {
+    flags |= kFlagEndStream;
+  }
+  if (header_block.empty()) {
+    flags |= kFlagEndHeaders;
+  }
+  AppendFrame(kHeaders, flags, stream_id, payload, out);
+  while (!header_block.empty()) {
+    fragment_size = std::min<size_t>(header_block.size(), max_frame_size);
+    AppendFrame(kContinuation,
+                (fragment_size == header_block.size()) ? kFlagEndHeaders : 0,
+                stream_id, header_block.substr(0, fragment_size), out);
+    header_block.remove_prefix(fragment_size);
+  }
+}
+
+void ParseFrameHeader(StringPiece data, FrameHeader* header) {
+  DCHECK_GE(data.size(), kFrameHeaderSize);
+  const char* p = data.data();
+  header->length = ReadBigEndian(p, 3);
+  header->type = static_cast<uint8>(p[3]);
+  header->flags = static_cast<uint8>(p[4]);
+  header->stream_id = ReadBigEndian(p + 5, 4) & 0x7fffffff;
+}
+
+bool StripPadding(const FrameHeader& header, StringPiece* payload) {
+  size_t padding = 0;
+  if ((header.flags & kFlagPadded) != 0) {
+    if (payload->empty()) {
+      return false;
+    }
+    padding = static_cast<uint8>((*payload)[0]);
+    payload->remove_prefix(1);
+  }
+  if ((header.type == kHeaders) && ((header.flags & kFlagPriority) != 0)) {
+    if (payload->size() < 5) {
+      return false;
+    }
+    payload->remove_prefix(5);
+  }
+  if (padding > payload->size()) {
+    return false;
+  }
+  payload->remove_suffix(padding);
+  return true;
+}
+
+bool ParseSettings(StringPiece payload, SettingVector* settings) {
+  if ((payload.size() % 6) != 0) {
+    return false;
+  }
+  for (size_t pos = 0; pos < payload.size(); pos += 6) {
+    settings->push_back(Setting(ReadBigEndian(payload.data() + pos, 2),
+                                ReadBigEndian(payload.data() + pos + 2, 4)));
+  }
+  return true;
+}
+
+uint32 ReadUint32(StringPiece data) {
+  DCHECK_GE(data.size(), 4u);
+  return ReadBigEndian(data.data(), 4);
+}
+
+void AppendHpackInteger(uint64 value, int prefix_bits, uint8 first_byte,
+                        GoogleString* out) {
+  uint64 max_prefix = (1 << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out->push_back(static_cast<char>(first_byte | value));
+    return;
+  }
+  out->push_back(static_cast<char>(first_byte | max_prefix));
+  value -= max_prefix;
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool ReadHpackInteger(StringPiece* input, int prefix_bits, uint64* value) {
+  if (input->empty()) {
+    return false;
+  }
+  uint64 max_prefix = (1 << prefix_bits) - 1;
+  *value = static_cast<uint8>((*input)[0]) & max_prefix;
+  input->remove_prefix(1);
+  if (*value < max_prefix) {
+    return true;
+  }
+  // Anything needing more than 8 continuation bytes is far beyond any size
+  // we would accept.
+  for (int shift = 0; shift < 56; shift += 7) {
+    if (input->empty()) {
+      return false;
+    }
+    uint8 byte = static_cast<uint8>((*input)[0]);
+    input->remove_prefix(1);
+    *value += static_cast<uint64>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t HuffmanEncodedSize(StringPiece input) {
+  uint64 bits = 0;
+  for (size_t i = 0; i < input.size(); ++i) {
+    bits += kHuffmanCodeLengths[static_cast<uint8>(input[i])];
+  }
+  return (bits + 7) / 8;
+}
+
+void AppendHuffman(StringPiece input, GoogleString* out) {
+  uint64 buffer = 0;
+  int buffered_bits = 0;
+  for (size_t i = 0; i < input.size(); ++i) {
+    uint8 symbol = static_cast<uint8>(input[i]);
+    buffer = (buffer << kHuffmanCodeLengths[symbol]) | kHuffmanCodes[symbol];
+    buffered_bits += kHuffmanCodeLengths[symbol];
+    while (buffered_bits >= 8) {
+      buffered_bits -= 8;
+      out->push_back(static_cast<char>(buffer >> buffered_bits));
+    }
+  }
+  if (buffered_bits > 0) {
+    // Pad with the most significant bits of EOS, which are all ones.
+    int padding = 8 - buffered_bits;
+    buffer = (buffer << padding) | ((1 << padding) - 1);
+    out->push_back(static_cast<char>(buffer));
+  }
+}
+
+bool DecodeHuffman(StringPiece input, GoogleString* out) {
+  uint32 code = 0;
+  int length = 0;
+  for (size_t i = 0; i < input.size(); ++i) {
+    uint8 byte = static_cast<uint8>(input[i]);
+    for (int bit = 7; bit >= 0; --bit) {
+      code = (code << 1) | ((byte >> bit) & 1);
+      ++length;
+      if (length > kMaxHuffmanCodeLength) {
+        return false;
+      }
+      uint32 offset = code - kFirstCode[length];
+      if ((code >= kFirstCode[length]) && (offset < kCodeCount[length])) {
+        int symbol = kSymbolsByCode[kFirstIndex[length] + offset];
+        if (symbol == kEndOfString) {
+          return false;
+        }
+        out->push_back(static_cast<char>(symbol));
+        code = 0;
+        length = 0;
+      }
+    }
+  }
+  // What's left over must be padding: fewer than 8 bits of EOS.
+  return (length < 8) && (code == (1u << length) - 1);
+}
+
+HpackTable::HpackTable()
+    : size_(0),
+      max_size_(kDefaultHeaderTableSize) {
+}
+
+HpackTable::~HpackTable() {
+}
+
+bool HpackTable::Lookup(size_t index, StringPiece* name,
+                        StringPiece* value) const {
+  if ((index == 0) || (index > kStaticTableSize + dynamic_table_.size())) {
+    return false;
+  }
+  if (index <= kStaticTableSize) {
+    *name = kStaticTable[index - 1][0];
+    *value = kStaticTable[index - 1][1];
+  } else {
+    const HeaderField& field = dynamic_table_[index - kStaticTableSize - 1];
+    *name = field.name;
+    *value = field.value;
+  }
+  return true;
+}
+
+size_t HpackTable::Find(StringPiece name, StringPiece value,
+                        bool* name_only) const {
+  size_t name_index = 0;
+  for (size_t i = 0; i < kStaticTableSize; ++i) {
+    if (name == kStaticTable[i][0]) {
+      if (value == kStaticTable[i][1]) {
+        *name_only = false;
+        return i + 1;
+      }
+      if (name_index == 0) {
+        name_index = i + 1;
+      }
+    }
+  }
+  for (size_t i = 0, n = dynamic_table_.size(); i < n; ++i) {
+    const HeaderField& field = dynamic_table_[i];
+    if (name == field.name) {
+      if (value == field.value) {
+        *name_only = false;
+        return kStaticTableSize + i + 1;
+      }
+      if (name_index == 0) {
+        name_index = kStaticTableSize + i + 1;
+      }
+    }
+  }
+  *name_only = true;
+  return name_index;
+}
+
+void HpackTable::Add(const HeaderField& field) {
+  size_t field_size = field.TableSize();
+  if (field_size > max_size_) {
+    EvictToSize(0);
+    return;
+  }
+  EvictToSize(max_size_ - field_size);
+  dynamic_table_.push_front(field);
+  size_ += field_size;
+}
+
+void HpackTable::SetMaxSize(size_t max_size) {
+  max_size_ = max_size;
+  EvictToSize(max_size);
+}
+
+void HpackTable::EvictToSize(size_t size) {
+  while (size_ > size) {
+    size_ -= dynamic_table_.back().TableSize();
+    dynamic_table_.pop_back();
+  }
+}
+
+HpackEncoder::HpackEncoder() : table_size_changed_(false) {
+}
+
+HpackEncoder::~HpackEncoder() {
+}
+
+void HpackEncoder::SetMaxTableSize(size_t max_size) {
+  // We never need more than the default, whatever the peer allows.
+  max_size = std::min<size_t>(max_size, kDefaultHeaderTableSize);
+  if (max_size != table_.max_size()) {
+    table_.SetMaxSize(max_size);
+    table_size_changed_ = true;
+  }
+}
+
+void HpackEncoder::Encode(const HeaderFieldVector& fields, GoogleString* out) {
+  if (table_size_changed_) {
+    AppendHpackInteger(table_.max_size(), 5, 0x20, out);
+    table_size_changed_ = false;
+  }
+  for (int i = 0, n = fields.size(); i < n; ++i) {
+    const HeaderField& field = fields[i];
+    bool name_only = false;
+    size_t index = table_.Find(field.name, field.value, &name_only);
+    if ((index != 0) && !name_only) {
+      AppendHpackInteger(index, 7, 0x80, out);
+      continue;
+    }
+    // Values that would take up much of the table are sent as literals,
+    // rather than flushing everything else out of it.
+    bool index_field = !NeverIndexed(field.name) &&
+        (field.TableSize() <= table_.max_size() / 2);
+    if (index_field) {
+      AppendHpackInteger(index, 6, 0x40, out);
+    } else {
+      AppendHpackInteger(index, 4, NeverIndexed(field.name) ? 0x10 : 0x00,
+                         out);
+    }
+    if (index == 0) {
+      AppendHpackString(field.name, out);
+    }
+    AppendHpackString(field.value, out);
+    if (index_field) {
+      table_.Add(field);
+    }
+  }
+}
+
+HpackDecoder::HpackDecoder(size_t max_table_size)
+    : max_table_size_(max_table_size) {
+  table_.SetMaxSize(max_table_size);
+}
+
+HpackDecoder::~HpackDecoder() {
+}
+
+bool HpackDecoder::Decode(StringPiece block, HeaderFieldVector* fields) {
+  while (!block.empty()) {
+    uint8 first_byte = static_cast<uint8>(block[0]);
+    uint64 index = 0;
+    if ((first_byte & 0x80) != 0) {
+      // Indexed field.
+      StringPiece name, value;
+      if (!ReadHpackInteger(&block, 7, &index) ||
+          !table_.Lookup(index, &name, &value)) {
+        return false;
+      }
+      fields->push_back(HeaderField(name, value));
+    } else if ((first_byte & 0xe0) == 0x20) {
+      // Dynamic table size update.
+      uint64 max_size = 0;
+      if (!ReadHpackInteger(&block, 5, &max_size) ||
+          (max_size > max_table_size_)) {
+        return false;
+      }
+      table_.SetMaxSize(max_size);
+    } else {
+      // Literal field, with incremental indexing, without indexing, or
+      // never indexed.  We don't forward fields, so treat the last two
+      // alike.
+      bool add_to_table = ((first_byte & 0x40) != 0);
+      if (!ReadHpackInteger(&block, add_to_table ? 6 : 4, &index)) {
+        return false;
+      }
+      HeaderField field;
+      if (index == 0) {
+        if (!DecodeString(&block, &field.name)) {
+          return false;
+        }
+      } else {
+        StringPiece name, value;
+        if (!table_.Lookup(index, &name, &value)) {
+          return false;
+        }
+        name.CopyToString(&field.name);
+      }
+      if (!DecodeString(&block, &field.value)) {
+        return false;
+      }
+      if (add_to_table) {
+        table_.Add(field);
+      }
+      fields->push_back(field);
+    }
+  }
+  return true;
+}
+
+bool HpackDecoder::DecodeString(StringPiece* input, GoogleString* out) {
+  if (input->empty()) {
+    return false;
+  }
+  bool huffman = ((static_cast<uint8>((*input)[0]) & 0x80) != 0);
+  uint64 length = 0;
+  if (!ReadHpackInteger(input, 7, &length) || (length > input->size())) {
+    return false;
+  }
+  StringPiece encoded = input->substr(0, length);
+  input->remove_prefix(length);
+  if (huffman) {
+    return DecodeHuffman(encoded, out);
+  }
+  encoded.CopyToString(out);
+  return true;
+}
+
+}  // namespace http2
+
+}  // namespace net_instaweb
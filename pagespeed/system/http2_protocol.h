@@ -0,0 +1,269 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_HTTP2_PROTOCOL_H_
+#define PAGESPEED_SYSTEM_HTTP2_PROTOCOL_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Framing for HTTP/2 (RFC 7540) and its header compression, HPACK
+// (RFC 7541), covering what a client fetching over cleartext HTTP/2 needs.
+//
+// Every frame is a 9-byte header -- a 24-bit payload length, a type, flags
+// and a 31-bit stream id, all in network byte order -- followed by the
+// payload.
+namespace http2 {
+
+// What a client must send first on a new connection, ahead of its SETTINGS.
+extern const char kConnectionPreface[];
+const size_t kConnectionPrefaceSize = 24;
+
+const size_t kFrameHeaderSize = 9;
+
+// Initial values of the settings, until the peer says otherwise.
+const uint32 kDefaultHeaderTableSize = 4096;
+const uint32 kDefaultWindowSize = 65535;
+const uint32 kDefaultMaxFrameSize = 16384;
+
+const uint32 kMaxWindowSize = 0x7fffffff;
+
+enum FrameType {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kPriority = 0x2,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9,
+};
+
+enum Flag {
+  kFlagEndStream = 0x1,
+  kFlagAck = 0x1,  // For SETTINGS and PING.
+  kFlagEndHeaders = 0x4,
+  kFlagPadded = 0x8,
+  kFlagPriority = 0x20,
+};
+
+enum SettingId {
+  kSettingsHeaderTableSize = 0x1,
+  kSettingsEnablePush = 0x2,
+  kSettingsMaxConcurrentStreams = 0x3,
+  kSettingsInitialWindowSize = 0x4,
+  kSettingsMaxFrameSize = 0x5,
+  kSettingsMaxHeaderListSize = 0x6,
+};
+
+enum ErrorCode {
+  kNoError = 0x0,
+  kProtocolError = 0x1,
+  kInternalError = 0x2,
+  kFlowControlError = 0x3,
+  kSettingsTimeout = 0x4,
+  kStreamClosed = 0x5,
+  kFrameSizeError = 0x6,
+  kRefusedStream = 0x7,
+  kCancel = 0x8,
+  kCompressionError = 0x9,
+  kConnectError = 0xa,
+  kEnhanceYourCalm = 0xb,
+  kInadequateSecurity = 0xc,
+  kHttp11Required = 0xd,
+};
+
+struct FrameHeader {
+  uint32 length;
+  uint8 type;
+  uint8 flags;
+  uint32 stream_id;
+};
+
+struct Setting {
+  Setting(uint16 id_in, uint32 value_in) : id(id_in), value(value_in) {}
+
+  uint16 id;
+  uint32 value;
+};
+
+typedef std::vector<Setting> SettingVector;
+
+// Appends a complete frame to *out.
+void AppendFrame(uint8 type, uint8 flags, uint32 stream_id,
+                 StringPiece payload, GoogleString* out);
+
+// Convenience wrappers for the frames a client sends.
+void AppendSettings(const SettingVector& settings, GoogleString* out);
+void AppendSettingsAck(GoogleString* out);
+void AppendPingAck(StringPiece opaque_data, GoogleString* out);
+void AppendWindowUpdate(uint32 stream_id, uint32 increment, GoogleString* out);
+void AppendRstStream(uint32 stream_id, ErrorCode error, GoogleString* out);
+void AppendGoAway(uint32 last_stream_id, ErrorCode error, GoogleString* out);
+
+// Appends a HEADERS frame carrying header_block, followed by as many
+// CONTINUATION frames as it takes to keep each frame within
+// max_frame_size.  The HEADERS frame carries a priority with the given
+// weight, from 1 to 256, depending on no other stream.
+void AppendHeaders(uint32 stream_id, StringPiece header_block,
+                   bool end_stream, int weight, uint32 max_frame_size,
+                   GoogleString* out);
+
+// Decodes the frame header at the front of 'data', which must hold at least
+// kFrameHeaderSize bytes.
+void ParseFrameHeader(StringPiece data, FrameHeader* header);
+
+// Strips the padding, and for HEADERS the priority, from the payload of a
+// DATA or HEADERS frame, leaving just the data or header block fragment.
+// Returns false if the padding is longer than the payload.
+bool StripPadding(const FrameHeader& header, StringPiece* payload);
+
+// Decodes the payload of a SETTINGS frame, returning false if its length is
+// not a multiple of 6 bytes.
+bool ParseSettings(StringPiece payload, SettingVector* settings);
+
+// Decodes the 32-bit big-endian integer at the front of data, which must
+// hold at least 4 bytes.  Stream ids and window increments should be masked
+// with 0x7fffffff.
+uint32 ReadUint32(StringPiece data);
+
+// A header name and value.  HTTP/2 header names are lower-case.
+struct HeaderField {
+  HeaderField() {}
+  HeaderField(StringPiece name_in, StringPiece value_in) {
+    name_in.CopyToString(&name);
+    value_in.CopyToString(&value);
+  }
+
+  // The size the field counts for against a header table's size limit.
+  size_t TableSize() const { return name.size() + value.size() + 32; }
+
+  GoogleString name;
+  GoogleString value;
+};
+
+typedef std::vector<HeaderField> HeaderFieldVector;
+
+// The header table shared by the static table of RFC 7541 Appendix A and a
+// dynamic table of recently indexed fields, newest first.  Indices are
+// 1-based, with the dynamic table starting just past the static one.
+class HpackTable {
+ public:
+  static const size_t kStaticTableSize = 61;
+
+  HpackTable();
+  ~HpackTable();
+
+  // Sets *name and *value to the field at the given index, returning false
+  // if there is none.  They remain valid until the table is next changed.
+  bool Lookup(size_t index, StringPiece* name, StringPiece* value) const;
+
+  // Returns the index of an entry matching both name and value, or failing
+  // that, setting *name_only, of one matching just the name.  Returns 0 if
+  // neither is present.
+  size_t Find(StringPiece name, StringPiece value, bool* name_only) const;
+
+  // Adds a field to the front of the dynamic table, evicting the oldest
+  // entries to make room.  A field bigger than the whole table just empties
+  // it.
+  void Add(const HeaderField& field);
+
+  // Changes the most the dynamic table may hold, evicting as needed.
+  void SetMaxSize(size_t max_size);
+  size_t max_size() const { return max_size_; }
+  size_t size() const { return size_; }
+
+ private:
+  void EvictToSize(size_t size);
+
+  std::deque<HeaderField> dynamic_table_;
+  size_t size_;
+  size_t max_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(HpackTable);
+};
+
+// Compresses header lists into header blocks for one direction of one
+// connection.  Fields are added to the dynamic table, so repeated fields
+// (such as the user-agent and accept headers of every fetch) cost a byte or
+// two after their first appearance, except for cookies and credentials,
+// which are never indexed.  Strings are Huffman-coded when that is shorter.
+class HpackEncoder {
+ public:
+  HpackEncoder();
+  ~HpackEncoder();
+
+  // Follows a change in the peer's SETTINGS_HEADER_TABLE_SIZE.  The change
+  // is announced at the start of the next header block.
+  void SetMaxTableSize(size_t max_size);
+
+  void Encode(const HeaderFieldVector& fields, GoogleString* out);
+
+ private:
+  HpackTable table_;
+  bool table_size_changed_;
+
+  DISALLOW_COPY_AND_ASSIGN(HpackEncoder);
+};
+
+// Decompresses header blocks for one direction of one connection.  As the
+// dynamic table is shared by every block on the connection, all blocks
+// received must be decoded, in order, even those for streams we have no
+// interest in.
+class HpackDecoder {
+ public:
+  // max_table_size is our own SETTINGS_HEADER_TABLE_SIZE: the encoder may
+  // shrink its table below that, but not grow it beyond.
+  explicit HpackDecoder(size_t max_table_size);
+  ~HpackDecoder();
+
+  // Appends the fields in a complete header block to *fields.  Returns false
+  // if the block is malformed, which is a connection error.
+  bool Decode(StringPiece block, HeaderFieldVector* fields);
+
+ private:
+  bool DecodeString(StringPiece* input, GoogleString* out);
+
+  HpackTable table_;
+  size_t max_table_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(HpackDecoder);
+};
+
+// HPACK's primitive encodings, exposed for testing.  Integers are coded
+// with a prefix_bits-bit prefix, the rest of whose first byte is given by
+// first_byte.
+void AppendHpackInteger(uint64 value, int prefix_bits, uint8 first_byte,
+                        GoogleString* out);
+bool ReadHpackInteger(StringPiece* input, int prefix_bits, uint64* value);
+void AppendHuffman(StringPiece input, GoogleString* out);
+size_t HuffmanEncodedSize(StringPiece input);
+bool DecodeHuffman(StringPiece input, GoogleString* out);
+
+}  // namespace http2
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_HTTP2_PROTOCOL_H_
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the HTTP/2 framing and HPACK, largely against the examples in
+// RFC 7541 Appendix C.
+
+#include "pagespeed/system/http2_protocol.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace http2 {
+
+namespace {
+
+GoogleString FromHex(StringPiece hex) {
+  GoogleString out;
+  int nibbles = 0;
+  int byte = 0;
+  for (size_t i = 0; i < hex.size(); ++i) {
+    char c = hex[i];
+    int nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else {
+      continue;
+    }
+    byte = (byte << 4) | nibble;
+    if (++nibbles == 2) {
+      out.push_back(static_cast<char>(byte));
+      nibbles = 0;
+      byte = 0;
+    }
+  }
+  return out;
+}
+
+GoogleString ToString(const HeaderFieldVector& fields) {
+  GoogleString out;
+  for (int i = 0, n = fields.size(); i < n; ++i) {
+    StrAppend(&out, fields[i].name, ": ", fields[i].value, "\n");
+  }
+  return out;
+}
+
+TEST(Http2ProtocolTest, HpackInteger) {
+  // RFC 7541 C.1.
+  GoogleString out;
+  AppendHpackInteger(10, 5, 0, &out);
+  EXPECT_EQ(FromHex("0a"), out);
+  out.clear();
+  AppendHpackInteger(1337, 5, 0, &out);
+  EXPECT_EQ(FromHex("1f9a0a"), out);
+  out.clear();
+  AppendHpackInteger(42, 8, 0, &out);
+  EXPECT_EQ(FromHex("2a"), out);
+
+  StringPiece input(out);
+  uint64 value = 0;
+  ASSERT_TRUE(ReadHpackInteger(&input, 8, &value));
+  EXPECT_EQ(42, value);
+  EXPECT_TRUE(input.empty());
+
+  GoogleString encoded = FromHex("1f9a0a");
+  input = encoded;
+  ASSERT_TRUE(ReadHpackInteger(&input, 5, &value));
+  EXPECT_EQ(1337, value);
+
+  // Truncated.
+  encoded = FromHex("1f9a");
+  input = encoded;
+  EXPECT_FALSE(ReadHpackInteger(&input, 5, &value));
+}
+
+TEST(Http2ProtocolTest, Huffman) {
+  GoogleString encoded;
+  AppendHuffman("www.example.com", &encoded);
+  EXPECT_EQ(FromHex("f1e3c2e5f23a6ba0ab90f4ff"), encoded);
+  EXPECT_EQ(encoded.size(), HuffmanEncodedSize("www.example.com"));
+
+  GoogleString decoded;
+  ASSERT_TRUE(DecodeHuffman(encoded, &decoded));
+  EXPECT_EQ("www.example.com", decoded);
+
+  // Every byte value survives a round trip.
+  GoogleString all_bytes;
+  for (int i = 0; i < 256; ++i) {
+    all_bytes.push_back(static_cast<char>(i));
+  }
+  encoded.clear();
+  AppendHuffman(all_bytes, &encoded);
+  decoded.clear();
+  ASSERT_TRUE(DecodeHuffman(encoded, &decoded));
+  EXPECT_EQ(all_bytes, decoded);
+
+  // 'a' is 00011, so takes 3 bits of padding, which must be all ones, and
+  // there must be less than a byte of it.
+  decoded.clear();
+  ASSERT_TRUE(DecodeHuffman(FromHex("1f"), &decoded));
+  EXPECT_EQ("a", decoded);
+  decoded.clear();
+  EXPECT_FALSE(DecodeHuffman(FromHex("18"), &decoded));
+  decoded.clear();
+  EXPECT_FALSE(DecodeHuffman(FromHex("1fff"), &decoded));
+}
+
+// RFC 7541 C.4: requests, which is what we encode.
+TEST(Http2ProtocolTest, EncodeRequests) {
+  HpackEncoder encoder;
+  HeaderFieldVector fields;
+  fields.push_back(HeaderField(":method", "GET"));
+  fields.push_back(HeaderField(":scheme", "http"));
+  fields.push_back(HeaderField(":path", "/"));
+  fields.push_back(HeaderField(":authority", "www.example.com"));
+  GoogleString block;
+  encoder.Encode(fields, &block);
+  EXPECT_EQ(FromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), block);
+
+  fields.push_back(HeaderField("cache-control", "no-cache"));
+  block.clear();
+  encoder.Encode(fields, &block);
+  EXPECT_EQ(FromHex("828684be5886a8eb10649cbf"), block);
+
+  fields.clear();
+  fields.push_back(HeaderField(":method", "GET"));
+  fields.push_back(HeaderField(":scheme", "https"));
+  fields.push_back(HeaderField(":path", "/index.html"));
+  fields.push_back(HeaderField(":authority", "www.example.com"));
+  fields.push_back(HeaderField("custom-key", "custom-value"));
+  block.clear();
+  encoder.Encode(fields, &block);
+  EXPECT_EQ(FromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"),
+            block);
+}
+
+TEST(Http2ProtocolTest, DecodeRequests) {
+  HpackDecoder decoder(kDefaultHeaderTableSize);
+  HeaderFieldVector fields;
+  ASSERT_TRUE(decoder.Decode(FromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+                             &fields));
+  EXPECT_EQ(":method: GET\n"
+            ":scheme: http\n"
+            ":path: /\n"
+            ":authority: www.example.com\n", ToString(fields));
+
+  fields.clear();
+  ASSERT_TRUE(decoder.Decode(FromHex("828684be5886a8eb10649cbf"), &fields));
+  EXPECT_EQ(":method: GET\n"
+            ":scheme: http\n"
+            ":path: /\n"
+            ":authority: www.example.com\n"
+            "cache-control: no-cache\n", ToString(fields));
+}
+
+// RFC 7541 C.6: responses with a 256-byte table, so that entries are
+// evicted.
+TEST(Http2ProtocolTest, DecodeResponsesWithEviction) {
+  HpackDecoder decoder(256);
+  HeaderFieldVector fields;
+  ASSERT_TRUE(decoder.Decode(
+      FromHex("488264025885aec3771a4b6196d07abe941054d444a8200595040b8166"
+              "e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3"),
+      &fields));
+  EXPECT_EQ(":status: 302\n"
+            "cache-control: private\n"
+            "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n", ToString(fields));
+
+  // The :status 302 entry is evicted to make room for 307.
+  fields.clear();
+  ASSERT_TRUE(decoder.Decode(FromHex("4883640effc1c0bf"), &fields));
+  EXPECT_EQ(":status: 307\n"
+            "cache-control: private\n"
+            "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n", ToString(fields));
+}
+
+TEST(Http2ProtocolTest, DecodeRejectsBadBlocks) {
+  HpackDecoder decoder(kDefaultHeaderTableSize);
+  HeaderFieldVector fields;
+  // Index 0, and an index past the end of the table.
+  EXPECT_FALSE(decoder.Decode(FromHex("80"), &fields));
+  EXPECT_FALSE(decoder.Decode(FromHex("be"), &fields));
+  // A string longer than the block.
+  EXPECT_FALSE(decoder.Decode(FromHex("4005"), &fields));
+  // Growing the table past our setting.
+  EXPECT_FALSE(decoder.Decode(FromHex("3fe21f"), &fields));
+}
+
+TEST(Http2ProtocolTest, EncoderTableSizeUpdate) {
+  HpackEncoder encoder;
+  HpackDecoder decoder(kDefaultHeaderTableSize);
+  encoder.SetMaxTableSize(0);
+  HeaderFieldVector fields;
+  fields.push_back(HeaderField(":authority", "www.example.com"));
+  GoogleString block;
+  encoder.Encode(fields, &block);
+  // A size update to 0, then the field as a literal, not indexed.
+  EXPECT_EQ(FromHex("20018cf1e3c2e5f23a6ba0ab90f4ff"), block);
+
+  HeaderFieldVector decoded;
+  ASSERT_TRUE(decoder.Decode(block, &decoded));
+  EXPECT_EQ(":authority: www.example.com\n", ToString(decoded));
+}
+
+TEST(Http2ProtocolTest, CookiesAreNeverIndexed) {
+  HpackEncoder encoder;
+  HeaderFieldVector fields;
+  fields.push_back(HeaderField("cookie", "a=b"));
+  GoogleString first, second;
+  encoder.Encode(fields, &first);
+  encoder.Encode(fields, &second);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(0x10 | 0xf, static_cast<uint8>(first[0]));
+}
+
+TEST(Http2ProtocolTest, Frames) {
+  GoogleString out;
+  AppendWindowUpdate(3, 0x10000, &out);
+  ASSERT_EQ(kFrameHeaderSize + 4, out.size());
+  FrameHeader header;
+  ParseFrameHeader(out, &header);
+  EXPECT_EQ(4, header.length);
+  EXPECT_EQ(kWindowUpdate, header.type);
+  EXPECT_EQ(0, header.flags);
+  EXPECT_EQ(3, header.stream_id);
+  EXPECT_EQ(0x10000,
+            ReadUint32(StringPiece(out).substr(kFrameHeaderSize)));
+
+  SettingVector settings;
+  settings.push_back(Setting(kSettingsEnablePush, 0));
+  settings.push_back(Setting(kSettingsInitialWindowSize, 1 << 20));
+  out.clear();
+  AppendSettings(settings, &out);
+  ParseFrameHeader(out, &header);
+  EXPECT_EQ(kSettings, header.type);
+  SettingVector parsed;
+  ASSERT_TRUE(ParseSettings(StringPiece(out).substr(kFrameHeaderSize),
+                            &parsed));
+  ASSERT_EQ(2, parsed.size());
+  EXPECT_EQ(kSettingsEnablePush, parsed[0].id);
+  EXPECT_EQ(0, parsed[0].value);
+  EXPECT_EQ(kSettingsInitialWindowSize, parsed[1].id);
+  EXPECT_EQ(1 << 20, parsed[1].value);
+  EXPECT_FALSE(ParseSettings("12345", &parsed));
+}
+
+TEST(Http2ProtocolTest, HeadersAreSplitIntoContinuations) {
+  GoogleString block(40, 'x');
+  GoogleString out;
+  AppendHeaders(5, block, true, 256, 20, &out);
+
+  // HEADERS with the 5-byte priority and 15 bytes of block, then 20 and 5
+  // bytes of CONTINUATION.
+  StringPiece frames(out);
+  FrameHeader header;
+  ParseFrameHeader(frames, &header);
+  EXPECT_EQ(kHeaders, header.type);
+  EXPECT_EQ(kFlagEndStream | kFlagPriority, header.flags);
+  EXPECT_EQ(20, header.length);
+  StringPiece payload = frames.substr(kFrameHeaderSize, header.length);
+  EXPECT_EQ(255, static_cast<uint8>(payload[4]));
+  ASSERT_TRUE(StripPadding(header, &payload));
+  EXPECT_EQ(15, payload.size());
+  frames.remove_prefix(kFrameHeaderSize + header.length);
+
+  ParseFrameHeader(frames, &header);
+  EXPECT_EQ(kContinuation, header.type);
+  EXPECT_EQ(0, header.flags);
+  EXPECT_EQ(20, header.length);
+  frames.remove_prefix(kFrameHeaderSize + header.length);
+
+  ParseFrameHeader(frames, &header);
+  EXPECT_EQ(kContinuation, header.type);
+  EXPECT_EQ(kFlagEndHeaders, header.flags);
+  EXPECT_EQ(5, header.length);
+  EXPECT_EQ(kFrameHeaderSize + header.length, frames.size());
+}
+
+TEST(Http2ProtocolTest, StripPadding) {
+  FrameHeader header;
+  header.type = kData;
+  header.flags = kFlagPadded;
+  GoogleString payload_string = FromHex("02616263" "0000");
+  StringPiece payload(payload_string);
+  ASSERT_TRUE(StripPadding(header, &payload));
+  EXPECT_EQ("abc", payload);
+
+  payload_string = FromHex("0961");
+  payload = payload_string;
+  EXPECT_FALSE(StripPadding(header, &payload));
+}
+
+}  // namespace
+
+}  // namespace http2
+
+}  // namespace net_instaweb
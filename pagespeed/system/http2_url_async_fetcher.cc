@@ -0,0 +1,1408 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/http2_url_async_fetcher.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/inflating_fetch.h"
+#include "net/instaweb/public/global_constants.h"
+#include "net/instaweb/public/version.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/google_url.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kHttp2Fetches[] = "http2_fetches";
+const char kHttp2FallbackFetches[] = "http2_fallback_fetches";
+const char kHttp2ConnectionsOpened[] = "http2_connections_opened";
+const char kHttp2Http1Origins[] = "http2_http1_origins";
+const char kHttp2FetchFailures[] = "http2_fetch_failures";
+const char kHttp2FetchTimeouts[] = "http2_fetch_timeouts";
+const char kHttp2ActiveStreams[] = "http2_active_streams";
+
+const int kMaxEvents = 64;
+const size_t kReadChunkSize = 64 * 1024;
+
+// How many streams we open at once until the server's SETTINGS say
+// otherwise.  RFC 7540 recommends that servers allow at least this many.
+const uint32 kDefaultMaxConcurrentStreams = 100;
+
+// Client-initiated streams have odd ids, which run out at 2^31 - 1.
+const uint32 kMaxStreamId = 0x7fffffff;
+
+// The most a server may raise SETTINGS_MAX_FRAME_SIZE to.
+const uint32 kMaxAllowedFrameSize = (1 << 24) - 1;
+
+// Builds the request's header list: the pseudo-headers, followed by the
+// caller's headers with lower-cased names, less those HTTP/2 carries
+// differently (Host) or not at all (the hop-by-hop headers).  If ask_for_gzip
+// is set and the caller doesn't accept compressed responses, asks for gzip
+// anyway, as InflatingFetch::EnableGzipFromBackend would, but without
+// touching the caller's headers, which the fallback may yet see.
+void BuildRequestFields(const GoogleUrl& gurl,
+                        const RequestHeaders& request_headers,
+                        bool ask_for_gzip,
+                        http2::HeaderFieldVector* fields) {
+  const char* host = request_headers.Lookup1(HttpAttributes::kHost);
+  fields->push_back(http2::HeaderField(":method",
+                                       request_headers.method_string()));
+  fields->push_back(http2::HeaderField(":scheme", "http"));
+  fields->push_back(http2::HeaderField(
+      ":authority", (host != NULL) ? StringPiece(host) : gurl.HostAndPort()));
+  fields->push_back(http2::HeaderField(":path", gurl.PathAndLeaf()));
+
+  StringPieceVector hop_by_hop = HttpAttributes::SortedHopByHopHeaders();
+  GoogleString user_agent;
+  for (int i = 0, n = request_headers.NumAttributes(); i < n; ++i) {
+    const GoogleString& name = request_headers.Name(i);
+    const GoogleString& value = request_headers.Value(i);
+    if (StringCaseEqual(name, HttpAttributes::kHost) ||
+        StringCaseEqual(name, HttpAttributes::kContentLength) ||
+        std::binary_search(hop_by_hop.begin(), hop_by_hop.end(),
+                           StringPiece(name), StringCompareInsensitive())) {
+      continue;
+    }
+    if (StringCaseEqual(name, HttpAttributes::kUserAgent)) {
+      if (!user_agent.empty()) {
+        user_agent += " ";
+      }
+      user_agent += value;
+      continue;
+    }
+    GoogleString lower_name(name);
+    LowerString(&lower_name);
+    fields->push_back(http2::HeaderField(lower_name, value));
+  }
+  if (ask_for_gzip &&
+      !request_headers.HasValue(HttpAttributes::kAcceptEncoding,
+                                HttpAttributes::kGzip) &&
+      !request_headers.HasValue(HttpAttributes::kAcceptEncoding,
+                                HttpAttributes::kDeflate)) {
+    fields->push_back(http2::HeaderField("accept-encoding",
+                                         HttpAttributes::kGzip));
+  }
+
+  // Identify ourselves as SerfFetch::FixUserAgent does.
+  GoogleString version = StrCat(
+      kModPagespeedSubrequestUserAgent,
+      "/" MOD_PAGESPEED_VERSION_STRING "-" LASTCHANGE_STRING);
+  if (user_agent.empty()) {
+    user_agent = version;
+  } else if (!StringPiece(user_agent).ends_with(StrCat(version, ")"))) {
+    StrAppend(&user_agent, " (", version, ")");
+  }
+  fields->push_back(http2::HeaderField("user-agent", user_agent));
+}
+
+}  // namespace
+
+const int64 Http2UrlAsyncFetcher::kHttp1OriginMemoryMs;
+const int64 Http2UrlAsyncFetcher::kIdleConnectionTimeoutMs;
+const int Http2UrlAsyncFetcher::kForegroundWeight;
+const int Http2UrlAsyncFetcher::kBackgroundWeight;
+const uint32 Http2UrlAsyncFetcher::kStreamWindowSize;
+const uint32 Http2UrlAsyncFetcher::kConnectionWindowSize;
+
+// One fetch, from the time it is queued until it completes or is handed to
+// the fallback.
+struct Http2UrlAsyncFetcher::Stream {
+  Stream()
+      : fetch(NULL), handler(NULL), port(0), background(false),
+        deadline_ms(0), id(0), response_started(false),
+        receive_window(kStreamWindowSize), unacknowledged_bytes(0) {
+  }
+
+  GoogleString url;
+  AsyncFetch* fetch;
+  MessageHandler* handler;
+  GoogleString origin;  // host:port, identifying the connection to use.
+  GoogleString host;
+  int port;
+  http2::HeaderFieldVector request_fields;
+  bool background;
+  int64 deadline_ms;
+
+  uint32 id;              // 0 until the request is sent.
+  bool response_started;  // Once the final response headers arrive.
+  int64 receive_window;
+  uint32 unacknowledged_bytes;
+};
+
+struct Http2UrlAsyncFetcher::Connection {
+  enum State {
+    kResolving,
+    kConnecting,
+    kOpen,
+    kClosed,
+  };
+
+  explicit Connection(const GoogleString& origin_in)
+      : origin(origin_in), fd(-1), state(kResolving), write_offset(0),
+        events(0), decoder(http2::kDefaultHeaderTableSize),
+        settings_received(false), going_away(false), next_stream_id(1),
+        max_concurrent_streams(kDefaultMaxConcurrentStreams),
+        max_frame_size(http2::kDefaultMaxFrameSize),
+        receive_window(kConnectionWindowSize), unacknowledged_bytes(0),
+        header_stream_id(0), header_end_stream(false), idle_since_ms(0),
+        addresses(NULL), next_address(NULL) {
+  }
+
+  ~Connection() {
+    if (addresses != NULL) {
+      freeaddrinfo(addresses);
+    }
+  }
+
+  GoogleString origin;
+  int fd;
+  State state;
+  GoogleString write_buffer;
+  size_t write_offset;
+  GoogleString read_buffer;
+  uint32 events;  // What we are registered for with epoll.
+
+  http2::HpackEncoder encoder;
+  http2::HpackDecoder decoder;
+  bool settings_received;
+  bool going_away;  // No new streams, after a GOAWAY from either side.
+  uint32 next_stream_id;
+  uint32 max_concurrent_streams;
+  uint32 max_frame_size;
+  int64 receive_window;
+  uint32 unacknowledged_bytes;
+
+  // Streams waiting for the server to allow more concurrent streams, with
+  // user-facing fetches ahead of background ones, and those sent, by id.
+  std::deque<Stream*> queued;
+  std::map<uint32, Stream*> active;
+
+  // A header block split across HEADERS and CONTINUATION frames.
+  uint32 header_stream_id;
+  GoogleString header_block;
+  bool header_end_stream;
+
+  int64 idle_since_ms;  // When the last stream completed.
+
+  // What the origin's host name resolved to, and the next address to try
+  // if connecting to the current one fails.
+  addrinfo* addresses;
+  const addrinfo* next_address;
+};
+
+class Http2UrlAsyncFetcher::EventThread : public ThreadSystem::Thread {
+ public:
+  EventThread(Http2UrlAsyncFetcher* fetcher, ThreadSystem* thread_system)
+      : Thread(thread_system, "http2_fetch", ThreadSystem::kJoinable),
+        fetcher_(fetcher) {
+  }
+
+  virtual void Run() { fetcher_->EventLoop(); }
+
+ private:
+  Http2UrlAsyncFetcher* fetcher_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventThread);
+};
+
+class Http2UrlAsyncFetcher::ResolverThread : public ThreadSystem::Thread {
+ public:
+  ResolverThread(Http2UrlAsyncFetcher* fetcher, ThreadSystem* thread_system)
+      : Thread(thread_system, "http2_resolve", ThreadSystem::kJoinable),
+        fetcher_(fetcher) {
+  }
+
+  virtual void Run() { fetcher_->ResolveLoop(); }
+
+ private:
+  Http2UrlAsyncFetcher* fetcher_;
+
+  DISALLOW_COPY_AND_ASSIGN(ResolverThread);
+};
+
+// A host name for the resolver thread to look up, and what it found.
+struct Http2UrlAsyncFetcher::Resolution {
+  Resolution() : port(0), error(0), result(NULL) {}
+  ~Resolution() {
+    if (result != NULL) {
+      freeaddrinfo(result);
+    }
+  }
+
+  GoogleString origin;
+  GoogleString host;
+  int port;
+  int error;  // From getaddrinfo.
+  addrinfo* result;
+};
+
+Http2UrlAsyncFetcher::Http2UrlAsyncFetcher(
+    UrlAsyncFetcher* fallback, ThreadSystem* thread_system,
+    Statistics* statistics, Timer* timer, int64 timeout_ms,
+    MessageHandler* message_handler)
+    : fallback_(fallback),
+      thread_system_(thread_system),
+      timer_(timer),
+      timeout_ms_(timeout_ms),
+      message_handler_(message_handler),
+      epoll_fd_(-1),
+      wakeup_fd_(-1),
+      mutex_(thread_system->NewMutex()),
+      resolve_condvar_(mutex_->NewCondvar()),
+      running_(false),
+      shut_down_(false),
+      http2_fetches_(statistics->GetVariable(kHttp2Fetches)),
+      fallback_fetches_(statistics->GetVariable(kHttp2FallbackFetches)),
+      connections_opened_(statistics->GetVariable(kHttp2ConnectionsOpened)),
+      http1_origins_found_(statistics->GetVariable(kHttp2Http1Origins)),
+      failures_(statistics->GetVariable(kHttp2FetchFailures)),
+      timeouts_(statistics->GetVariable(kHttp2FetchTimeouts)),
+      active_streams_(statistics->GetUpDownCounter(kHttp2ActiveStreams)) {
+}
+
+Http2UrlAsyncFetcher::~Http2UrlAsyncFetcher() {
+  // The fallback may already have been deleted, so only our own threads are
+  // stopped here.
+  StopThreads();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  STLDeleteElements(&closed_connections_);
+}
+
+void Http2UrlAsyncFetcher::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kHttp2Fetches);
+  statistics->AddVariable(kHttp2FallbackFetches);
+  statistics->AddVariable(kHttp2ConnectionsOpened);
+  statistics->AddVariable(kHttp2Http1Origins);
+  statistics->AddVariable(kHttp2FetchFailures);
+  statistics->AddVariable(kHttp2FetchTimeouts);
+  statistics->AddUpDownCounter(kHttp2ActiveStreams);
+}
+
+bool Http2UrlAsyncFetcher::Start() {
+  if (event_thread_.get() != NULL) {
+    return false;
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((epoll_fd_ < 0) || (wakeup_fd_ < 0)) {
+    message_handler_->Message(kError, "Http2UrlAsyncFetcher: %s",
+                              strerror(errno));
+    return false;
+  }
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;  // Distinguishes the wakeup fd from connections.
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) != 0) {
+    message_handler_->Message(kError, "Http2UrlAsyncFetcher: %s",
+                              strerror(errno));
+    return false;
+  }
+
+  {
+    ScopedMutex lock(mutex_.get());
+    running_ = true;
+  }
+  // The resolver goes first, as no connection gets anywhere without it.
+  resolver_thread_.reset(new ResolverThread(this, thread_system_));
+  if (!resolver_thread_->Start()) {
+    resolver_thread_.reset(NULL);
+    ScopedMutex lock(mutex_.get());
+    running_ = false;
+    message_handler_->Message(kError,
+                              "Http2UrlAsyncFetcher: failed to start thread");
+    return false;
+  }
+  event_thread_.reset(new EventThread(this, thread_system_));
+  if (!event_thread_->Start()) {
+    event_thread_.reset(NULL);
+    {
+      ScopedMutex lock(mutex_.get());
+      running_ = false;
+      resolve_condvar_->Signal();
+    }
+    resolver_thread_->Join();
+    resolver_thread_.reset(NULL);
+    message_handler_->Message(kError,
+                              "Http2UrlAsyncFetcher: failed to start thread");
+    return false;
+  }
+  return true;
+}
+
+void Http2UrlAsyncFetcher::Fetch(const GoogleString& url,
+                                 MessageHandler* message_handler,
+                                 AsyncFetch* fetch) {
+  GoogleUrl gurl(url);
+  RequestHeaders::Method method = fetch->request_headers()->method();
+  GoogleString origin;
+  if (gurl.IsWebValid() && gurl.SchemeIs("http") &&
+      ((method == RequestHeaders::kGet) || (method == RequestHeaders::kHead))) {
+    origin = StrCat(gurl.Host(), ":", IntegerToString(gurl.EffectiveIntPort()));
+  }
+  if (origin.empty() || IsHttp1Origin(origin)) {
+    fallback_fetches_->Add(1);
+    fallback_->Fetch(url, message_handler, fetch);
+    return;
+  }
+
+  Stream* stream = new Stream;
+  stream->url = url;
+  stream->fetch = fetch;
+  stream->handler = message_handler;
+  stream->origin = origin;
+  gurl.Host().CopyToString(&stream->host);
+  stream->port = gurl.EffectiveIntPort();
+  stream->background = fetch->IsBackgroundFetch();
+  BuildRequestFields(gurl, *fetch->request_headers(), fetch_with_gzip(),
+                     &stream->request_fields);
+  outstanding_fetches_.NoBarrierIncrement(1);
+
+  bool queued = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (running_) {
+      stream->deadline_ms = timer_->NowMs() + timeout_ms_;
+      pending_streams_.push_back(stream);
+      queued = true;
+    }
+  }
+  if (queued) {
+    Wakeup();
+  } else {
+    FallBack(stream);
+  }
+}
+
+bool Http2UrlAsyncFetcher::IsHttp1Origin(const GoogleString& origin) {
+  ScopedMutex lock(mutex_.get());
+  std::map<GoogleString, int64>::iterator p = http1_origins_.find(origin);
+  if (p == http1_origins_.end()) {
+    return false;
+  }
+  if (p->second <= timer_->NowMs()) {
+    http1_origins_.erase(p);
+    return false;
+  }
+  return true;
+}
+
+void Http2UrlAsyncFetcher::MarkHttp1Origin(const GoogleString& origin) {
+  http1_origins_found_->Add(1);
+  message_handler_->Message(
+      kInfo, "Http2UrlAsyncFetcher: %s does not speak HTTP/2, using "
+      "HTTP/1.1 for it", origin.c_str());
+  ScopedMutex lock(mutex_.get());
+  http1_origins_[origin] = timer_->NowMs() + kHttp1OriginMemoryMs;
+}
+
+void Http2UrlAsyncFetcher::Wakeup() {
+  uint64 one = 1;
+  // This can only fail if the counter would overflow, in which case the
+  // event thread is already due to wake up.
+  ssize_t written = write(wakeup_fd_, &one, sizeof(one));
+  DCHECK(written == sizeof(one) || errno == EAGAIN);
+}
+
+void Http2UrlAsyncFetcher::ResolveLoop() {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  mutex_->Lock();
+  while (true) {
+    while (running_ && resolve_requests_.empty()) {
+      resolve_condvar_->Wait();
+    }
+    if (!running_) {
+      break;
+    }
+    Resolution* resolution = resolve_requests_.front();
+    resolve_requests_.pop_front();
+    mutex_->Unlock();
+    resolution->error = getaddrinfo(resolution->host.c_str(),
+                                    IntegerToString(resolution->port).c_str(),
+                                    &hints, &resolution->result);
+    mutex_->Lock();
+    resolutions_.push_back(resolution);
+    Wakeup();
+  }
+  mutex_->Unlock();
+}
+
+void Http2UrlAsyncFetcher::EventLoop() {
+  epoll_event events[kMaxEvents];
+  while (true) {
+    int timeout_ms = -1;
+    int64 deadline_ms = NextDeadlineMs();
+    if (deadline_ms >= 0) {
+      int64 now_ms = timer_->NowMs();
+      timeout_ms = (deadline_ms <= now_ms) ? 0 : (deadline_ms - now_ms);
+    }
+    int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if ((num_events < 0) && (errno != EINTR)) {
+      message_handler_->Message(kError, "Http2UrlAsyncFetcher: epoll_wait: %s",
+                                strerror(errno));
+      break;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      Connection* connection = static_cast<Connection*>(events[i].data.ptr);
+      if (connection == NULL) {
+        uint64 count;
+        ssize_t bytes_read = read(wakeup_fd_, &count, sizeof(count));
+        DCHECK(bytes_read == sizeof(count) || errno == EAGAIN);
+      } else {
+        HandleEvents(connection, events[i].events);
+      }
+    }
+    STLDeleteElements(&closed_connections_);
+
+    bool running;
+    {
+      ScopedMutex lock(mutex_.get());
+      running = running_;
+    }
+    if (!running) {
+      break;
+    }
+    DrainResolutions();
+    DrainPendingStreams();
+    ExpireStreams();
+    STLDeleteElements(&closed_connections_);
+  }
+
+  // Fail whatever is left.  Once running_ is false nothing more can be
+  // queued, so this is everything.
+  std::vector<Stream*> streams;
+  {
+    ScopedMutex lock(mutex_.get());
+    running_ = false;
+    resolve_condvar_->Signal();
+    streams.swap(pending_streams_);
+  }
+  std::vector<Connection*> connections(connections_);
+  for (int i = 0, n = connections.size(); i < n; ++i) {
+    Connection* connection = connections[i];
+    streams.insert(streams.end(), connection->queued.begin(),
+                   connection->queued.end());
+    for (std::map<uint32, Stream*>::iterator p = connection->active.begin(),
+             e = connection->active.end(); p != e; ++p) {
+      streams.push_back(p->second);
+    }
+    active_streams_->Add(-static_cast<int64>(connection->active.size()));
+    connection->queued.clear();
+    connection->active.clear();
+    CloseConnection(connection);
+  }
+  STLDeleteElements(&closed_connections_);
+  for (int i = 0, n = streams.size(); i < n; ++i) {
+    CompleteStream(NULL, streams[i], false);
+  }
+}
+
+void Http2UrlAsyncFetcher::DrainPendingStreams() {
+  std::vector<Stream*> streams;
+  {
+    ScopedMutex lock(mutex_.get());
+    streams.swap(pending_streams_);
+  }
+  for (int i = 0, n = streams.size(); i < n; ++i) {
+    QueueStream(streams[i]);
+  }
+}
+
+void Http2UrlAsyncFetcher::DrainResolutions() {
+  std::vector<Resolution*> resolutions;
+  {
+    ScopedMutex lock(mutex_.get());
+    resolutions.swap(resolutions_);
+  }
+  for (int i = 0, n = resolutions.size(); i < n; ++i) {
+    // The connection is gone if its streams all timed out during the lookup.
+    for (int j = 0, m = connections_.size(); j < m; ++j) {
+      Connection* connection = connections_[j];
+      if ((connection->state == Connection::kResolving) &&
+          (connection->origin == resolutions[i]->origin)) {
+        ConnectResolved(connection, resolutions[i]);
+        break;
+      }
+    }
+    delete resolutions[i];
+  }
+}
+
+void Http2UrlAsyncFetcher::QueueStream(Stream* stream) {
+  Connection* connection = ConnectionFor(stream);
+  std::deque<Stream*>* queued = &connection->queued;
+  if (stream->background) {
+    queued->push_back(stream);
+  } else {
+    std::deque<Stream*>::iterator p = queued->begin();
+    while ((p != queued->end()) && !(*p)->background) {
+      ++p;
+    }
+    queued->insert(p, stream);
+  }
+  if (connection->state == Connection::kOpen) {
+    StartStreams(connection);
+    if (!FlushConnection(connection)) {
+      return;
+    }
+    UpdateInterest(connection);
+  }
+}
+
+Http2UrlAsyncFetcher::Connection* Http2UrlAsyncFetcher::ConnectionFor(
+    Stream* stream) {
+  for (int i = 0, n = connections_.size(); i < n; ++i) {
+    Connection* connection = connections_[i];
+    if (!connection->going_away && (connection->origin == stream->origin)) {
+      return connection;
+    }
+  }
+  return OpenConnection(stream);
+}
+
+Http2UrlAsyncFetcher::Connection* Http2UrlAsyncFetcher::OpenConnection(
+    Stream* stream) {
+  Connection* connection = new Connection(stream->origin);
+  connections_.push_back(connection);
+  Resolution* resolution = new Resolution;
+  resolution->origin = stream->origin;
+  resolution->host = stream->host;
+  resolution->port = stream->port;
+  ScopedMutex lock(mutex_.get());
+  resolve_requests_.push_back(resolution);
+  resolve_condvar_->Signal();
+  return connection;
+}
+
+void Http2UrlAsyncFetcher::ConnectResolved(Connection* connection,
+                                           Resolution* resolution) {
+  if ((resolution->error != 0) || (resolution->result == NULL)) {
+    // The queued streams go to the fallback, to report whatever went wrong.
+    FailConnection(
+        connection,
+        StrCat("failed to resolve: ", gai_strerror(resolution->error)), false);
+    return;
+  }
+
+  connection->addresses = resolution->result;
+  resolution->result = NULL;
+  connection->next_address = connection->addresses;
+  connection->state = Connection::kConnecting;
+  int error = 0;
+  if (!ConnectNextAddress(connection, &error)) {
+    FailConnection(connection, StrCat("connect: ", strerror(error)), false);
+    return;
+  }
+  connections_opened_->Add(1);
+
+  // Everything up to the first request can be written without waiting for
+  // the server: the preface, our settings, and enough connection-level
+  // window that the server is not held back by the default 64k.  A server
+  // that does not speak HTTP/2 answers this with an error of its own.
+  connection->write_buffer.assign(http2::kConnectionPreface,
+                                  http2::kConnectionPrefaceSize);
+  http2::SettingVector settings;
+  settings.push_back(http2::Setting(http2::kSettingsEnablePush, 0));
+  settings.push_back(http2::Setting(http2::kSettingsInitialWindowSize,
+                                    kStreamWindowSize));
+  http2::AppendSettings(settings, &connection->write_buffer);
+  http2::AppendWindowUpdate(
+      0, kConnectionWindowSize - http2::kDefaultWindowSize,
+      &connection->write_buffer);
+}
+
+bool Http2UrlAsyncFetcher::ConnectNextAddress(Connection* connection,
+                                              int* error) {
+  while (connection->next_address != NULL) {
+    const addrinfo* address = connection->next_address;
+    connection->next_address = address->ai_next;
+    if (connection->fd >= 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, NULL);
+      close(connection->fd);
+    }
+    connection->fd = socket(address->ai_family,
+                            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection->fd < 0) {
+      *error = errno;
+      continue;
+    }
+    // Requests are small and we don't want them held back waiting for acks.
+    int one = 1;
+    setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connect(connection->fd, address->ai_addr,
+                 address->ai_addrlen) != 0) &&
+        (errno != EINPROGRESS)) {
+      *error = errno;
+      continue;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = connection;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection->fd, &event) != 0) {
+      *error = errno;
+      continue;
+    }
+    connection->events = event.events;
+    return true;
+  }
+  if (connection->fd >= 0) {
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  return false;
+}
+
+void Http2UrlAsyncFetcher::StartStreams(Connection* connection) {
+  while ((connection->state == Connection::kOpen) &&
+         !connection->going_away && !connection->queued.empty() &&
+         (connection->active.size() < connection->max_concurrent_streams)) {
+    Stream* stream = connection->queued.front();
+    connection->queued.pop_front();
+    SendRequest(connection, stream);
+  }
+}
+
+void Http2UrlAsyncFetcher::SendRequest(Connection* connection,
+                                       Stream* stream) {
+  stream->id = connection->next_stream_id;
+  connection->next_stream_id += 2;
+  if (connection->next_stream_id > kMaxStreamId) {
+    // Out of stream ids: later streams need a new connection.
+    connection->going_away = true;
+  }
+  GoogleString block;
+  connection->encoder.Encode(stream->request_fields, &block);
+  http2::AppendHeaders(
+      stream->id, block, true /* end_stream */,
+      stream->background ? kBackgroundWeight : kForegroundWeight,
+      connection->max_frame_size, &connection->write_buffer);
+  connection->active[stream->id] = stream;
+  http2_fetches_->Add(1);
+  active_streams_->Add(1);
+}
+
+void Http2UrlAsyncFetcher::UpdateInterest(Connection* connection) {
+  if ((connection->state == Connection::kResolving) ||
+      (connection->state == Connection::kClosed)) {
+    return;
+  }
+  uint32 events = EPOLLIN;
+  if ((connection->state == Connection::kConnecting) ||
+      (connection->write_offset < connection->write_buffer.size())) {
+    events |= EPOLLOUT;
+  }
+  if (events != connection->events) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+  }
+}
+
+void Http2UrlAsyncFetcher::HandleEvents(Connection* connection,
+                                        uint32 events) {
+  if (connection->state == Connection::kClosed) {
+    return;
+  }
+  if (connection->state == Connection::kConnecting) {
+    if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) == 0) {
+      return;
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error,
+                   &length) != 0) {
+      error = errno;
+    }
+    if (error != 0) {
+      // Try the origin's other addresses, if it has any.
+      if (!ConnectNextAddress(connection, &error)) {
+        FailConnection(connection, StrCat("connect: ", strerror(error)),
+                       false);
+      }
+      return;
+    }
+    connection->state = Connection::kOpen;
+    StartStreams(connection);
+  }
+  if (((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) &&
+      !ReadConnection(connection)) {
+    return;
+  }
+  if (!FlushConnection(connection)) {
+    return;
+  }
+  UpdateInterest(connection);
+}
+
+bool Http2UrlAsyncFetcher::FlushConnection(Connection* connection) {
+  GoogleString* buffer = &connection->write_buffer;
+  while (connection->write_offset < buffer->size()) {
+    ssize_t bytes = send(connection->fd,
+                         buffer->data() + connection->write_offset,
+                         buffer->size() - connection->write_offset,
+                         MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return true;
+      }
+      FailConnection(connection, StrCat("write: ", strerror(errno)),
+                     !connection->settings_received);
+      return false;
+    }
+    connection->write_offset += bytes;
+  }
+  buffer->clear();
+  connection->write_offset = 0;
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::ReadConnection(Connection* connection) {
+  GoogleString* buffer = &connection->read_buffer;
+  bool closed = false;
+  while (true) {
+    size_t old_size = buffer->size();
+    buffer->resize(old_size + kReadChunkSize);
+    ssize_t bytes = recv(connection->fd, &(*buffer)[old_size], kReadChunkSize,
+                         0);
+    buffer->resize(old_size + std::max(bytes, static_cast<ssize_t>(0)));
+    if (bytes > 0) {
+      continue;
+    } else if (bytes == 0) {
+      // Handle whatever the server sent before closing, first.
+      closed = true;
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      break;
+    }
+    FailConnection(connection, StrCat("read: ", strerror(errno)),
+                   !connection->settings_received);
+    return false;
+  }
+
+  size_t offset = 0;
+  while (buffer->size() - offset >= http2::kFrameHeaderSize) {
+    http2::FrameHeader header;
+    http2::ParseFrameHeader(StringPiece(buffer->data() + offset,
+                                        http2::kFrameHeaderSize), &header);
+    if (!connection->settings_received &&
+        ((header.type != http2::kSettings) ||
+         ((header.flags & http2::kFlagAck) != 0))) {
+      // Most likely an HTTP/1.1 server's complaint about our preface.
+      FailConnection(connection, "no SETTINGS from server", true);
+      return false;
+    }
+    if (header.length > http2::kDefaultMaxFrameSize) {
+      // We never raise SETTINGS_MAX_FRAME_SIZE.
+      return ConnectionError(connection, http2::kFrameSizeError,
+                             "oversized frame");
+    }
+    size_t frame_size = http2::kFrameHeaderSize + header.length;
+    if (buffer->size() - offset < frame_size) {
+      break;
+    }
+    StringPiece payload(buffer->data() + offset + http2::kFrameHeaderSize,
+                        static_cast<size_t>(header.length));
+    if (!HandleFrame(connection, header, payload)) {
+      return false;
+    }
+    offset += frame_size;
+  }
+  buffer->erase(0, offset);
+
+  if (closed) {
+    FailConnection(connection, "connection closed by server",
+                   !connection->settings_received);
+    return false;
+  }
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::HandleFrame(Connection* connection,
+                                       const http2::FrameHeader& header,
+                                       StringPiece payload) {
+  if ((connection->header_stream_id != 0) &&
+      (header.type != http2::kContinuation)) {
+    return ConnectionError(connection, http2::kProtocolError,
+                           "interrupted header block");
+  }
+  switch (header.type) {
+    case http2::kData:
+      return HandleData(connection, header, payload);
+    case http2::kHeaders:
+      if ((header.stream_id == 0) || !http2::StripPadding(header, &payload)) {
+        return ConnectionError(connection, http2::kProtocolError,
+                               "malformed HEADERS");
+      }
+      connection->header_stream_id = header.stream_id;
+      payload.CopyToString(&connection->header_block);
+      connection->header_end_stream =
+          ((header.flags & http2::kFlagEndStream) != 0);
+      if ((header.flags & http2::kFlagEndHeaders) != 0) {
+        return HandleHeaderBlock(connection);
+      }
+      return true;
+    case http2::kContinuation:
+      if ((connection->header_stream_id == 0) ||
+          (header.stream_id != connection->header_stream_id)) {
+        return ConnectionError(connection, http2::kProtocolError,
+                               "unexpected CONTINUATION");
+      }
+      payload.AppendToString(&connection->header_block);
+      if ((header.flags & http2::kFlagEndHeaders) != 0) {
+        return HandleHeaderBlock(connection);
+      }
+      return true;
+    case http2::kSettings:
+      return HandleSettings(connection, header, payload);
+    case http2::kPing:
+      if ((header.stream_id != 0) || (payload.size() != 8)) {
+        return ConnectionError(connection, http2::kProtocolError,
+                               "malformed PING");
+      }
+      if ((header.flags & http2::kFlagAck) == 0) {
+        http2::AppendPingAck(payload, &connection->write_buffer);
+      }
+      return true;
+    case http2::kRstStream:
+      if ((header.stream_id == 0) || (payload.size() != 4)) {
+        return ConnectionError(connection, http2::kProtocolError,
+                               "malformed RST_STREAM");
+      }
+      HandleRstStream(connection, header.stream_id,
+                      http2::ReadUint32(payload));
+      return true;
+    case http2::kGoAway:
+      if ((header.stream_id != 0) || (payload.size() < 8)) {
+        return ConnectionError(connection, http2::kProtocolError,
+                               "malformed GOAWAY");
+      }
+      HandleGoAway(connection, payload);
+      return (connection->state != Connection::kClosed);
+    case http2::kPushPromise:
+      // We disabled push in our SETTINGS.
+      return ConnectionError(connection, http2::kProtocolError,
+                             "unexpected PUSH_PROMISE");
+    default:
+      // We send no DATA, so the server's flow-control windows don't concern
+      // us; that leaves WINDOW_UPDATE, PRIORITY, and unknown frame types,
+      // which must be ignored.
+      return true;
+  }
+}
+
+bool Http2UrlAsyncFetcher::HandleSettings(Connection* connection,
+                                          const http2::FrameHeader& header,
+                                          StringPiece payload) {
+  if (header.stream_id != 0) {
+    return ConnectionError(connection, http2::kProtocolError,
+                           "malformed SETTINGS");
+  }
+  if ((header.flags & http2::kFlagAck) != 0) {
+    return true;
+  }
+  http2::SettingVector settings;
+  if (!http2::ParseSettings(payload, &settings)) {
+    return ConnectionError(connection, http2::kFrameSizeError,
+                           "malformed SETTINGS");
+  }
+  for (int i = 0, n = settings.size(); i < n; ++i) {
+    uint32 value = settings[i].value;
+    switch (settings[i].id) {
+      case http2::kSettingsHeaderTableSize:
+        connection->encoder.SetMaxTableSize(value);
+        break;
+      case http2::kSettingsMaxConcurrentStreams:
+        connection->max_concurrent_streams = value;
+        break;
+      case http2::kSettingsMaxFrameSize:
+        if ((value < http2::kDefaultMaxFrameSize) ||
+            (value > kMaxAllowedFrameSize)) {
+          return ConnectionError(connection, http2::kProtocolError,
+                                 "bad SETTINGS_MAX_FRAME_SIZE");
+        }
+        connection->max_frame_size = value;
+        break;
+      default:
+        break;
+    }
+  }
+  http2::AppendSettingsAck(&connection->write_buffer);
+  connection->settings_received = true;
+  StartStreams(connection);
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::HandleHeaderBlock(Connection* connection) {
+  uint32 stream_id = connection->header_stream_id;
+  connection->header_stream_id = 0;
+  http2::HeaderFieldVector fields;
+  // The block must be decoded even if we have lost interest in the stream,
+  // to keep the decoder's table in step with the server's.
+  bool ok = connection->decoder.Decode(connection->header_block, &fields);
+  connection->header_block.clear();
+  if (!ok) {
+    return ConnectionError(connection, http2::kCompressionError,
+                           "malformed header block");
+  }
+  std::map<uint32, Stream*>::iterator p = connection->active.find(stream_id);
+  if (p == connection->active.end()) {
+    return true;
+  }
+  Stream* stream = p->second;
+
+  if (!stream->response_started) {
+    int status = 0;
+    for (int i = 0, n = fields.size(); i < n; ++i) {
+      if (fields[i].name == ":status") {
+        StringToInt(fields[i].value, &status);
+        break;
+      }
+    }
+    if ((status < 100) || (status > 999)) {
+      ResetStream(connection, stream, http2::kProtocolError);
+      CompleteStream(connection, stream, false);
+      return true;
+    }
+    if (status < 200) {
+      // An interim response; the real one follows.
+      return true;
+    }
+    // The stream can no longer go to the fallback, which inflates for
+    // itself, so only now is the fetch wrapped to inflate what we asked to
+    // have gzipped.
+    stream->fetch = new InflatingFetch(stream->fetch);
+    ResponseHeaders* response_headers = stream->fetch->response_headers();
+    response_headers->set_major_version(1);
+    response_headers->set_minor_version(1);
+    response_headers->SetStatusAndReason(
+        static_cast<HttpStatus::Code>(status));
+    for (int i = 0, n = fields.size(); i < n; ++i) {
+      if (!StringPiece(fields[i].name).starts_with(":")) {
+        response_headers->Add(fields[i].name, fields[i].value);
+      }
+    }
+    response_headers->ComputeCaching();
+    stream->response_started = true;
+  }
+  // Otherwise these are trailers, which we drop.
+
+  if (connection->header_end_stream) {
+    CompleteStream(connection, stream, true);
+  }
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::HandleData(Connection* connection,
+                                      const http2::FrameHeader& header,
+                                      StringPiece payload) {
+  if (header.stream_id == 0) {
+    return ConnectionError(connection, http2::kProtocolError,
+                           "DATA on stream 0");
+  }
+  // Flow control counts the whole payload, padding included, and applies
+  // to the connection even for streams we have reset.
+  connection->receive_window -= header.length;
+  if (connection->receive_window < 0) {
+    return ConnectionError(connection, http2::kFlowControlError,
+                           "connection window exceeded");
+  }
+  connection->unacknowledged_bytes += header.length;
+  if (connection->unacknowledged_bytes >= kConnectionWindowSize / 2) {
+    http2::AppendWindowUpdate(0, connection->unacknowledged_bytes,
+                              &connection->write_buffer);
+    connection->receive_window += connection->unacknowledged_bytes;
+    connection->unacknowledged_bytes = 0;
+  }
+
+  std::map<uint32, Stream*>::iterator p =
+      connection->active.find(header.stream_id);
+  if (p == connection->active.end()) {
+    return true;
+  }
+  Stream* stream = p->second;
+  stream->receive_window -= header.length;
+  if (stream->receive_window < 0) {
+    return ConnectionError(connection, http2::kFlowControlError,
+                           "stream window exceeded");
+  }
+  if (!http2::StripPadding(header, &payload)) {
+    return ConnectionError(connection, http2::kProtocolError,
+                           "malformed DATA");
+  }
+  if (!stream->response_started) {
+    ResetStream(connection, stream, http2::kProtocolError);
+    CompleteStream(connection, stream, false);
+    return true;
+  }
+  if (!payload.empty() && !stream->fetch->Write(payload, stream->handler)) {
+    ResetStream(connection, stream, http2::kCancel);
+    CompleteStream(connection, stream, false);
+    return true;
+  }
+  if ((header.flags & http2::kFlagEndStream) != 0) {
+    CompleteStream(connection, stream, true);
+    return true;
+  }
+  stream->unacknowledged_bytes += header.length;
+  if (stream->unacknowledged_bytes >= kStreamWindowSize / 2) {
+    http2::AppendWindowUpdate(stream->id, stream->unacknowledged_bytes,
+                              &connection->write_buffer);
+    stream->receive_window += stream->unacknowledged_bytes;
+    stream->unacknowledged_bytes = 0;
+  }
+  return true;
+}
+
+void Http2UrlAsyncFetcher::HandleRstStream(Connection* connection,
+                                           uint32 stream_id, uint32 error) {
+  std::map<uint32, Stream*>::iterator p = connection->active.find(stream_id);
+  if (p == connection->active.end()) {
+    return;
+  }
+  Stream* stream = p->second;
+  if (!stream->response_started &&
+      ((error == http2::kRefusedStream) || (error == http2::kHttp11Required))) {
+    // The server did not process the request, so it is safe to retry it.
+    if (error == http2::kHttp11Required) {
+      MarkHttp1Origin(connection->origin);
+    }
+    DetachStream(connection, stream);
+    FallBack(stream);
+  } else {
+    CompleteStream(connection, stream, false);
+  }
+}
+
+void Http2UrlAsyncFetcher::HandleGoAway(Connection* connection,
+                                        StringPiece payload) {
+  uint32 last_stream_id = http2::ReadUint32(payload) & kMaxStreamId;
+  uint32 error = http2::ReadUint32(payload.substr(4));
+  connection->going_away = true;
+  if (error == http2::kHttp11Required) {
+    MarkHttp1Origin(connection->origin);
+  }
+
+  // Streams the server has not processed, and will not, can be retried:
+  // on a new connection if the server is just shutting this one down, and
+  // otherwise over HTTP/1.1.
+  std::vector<Stream*> retry(connection->queued.begin(),
+                             connection->queued.end());
+  connection->queued.clear();
+  for (std::map<uint32, Stream*>::iterator p =
+           connection->active.upper_bound(last_stream_id),
+           e = connection->active.end(); p != e; ++p) {
+    retry.push_back(p->second);
+  }
+  for (int i = 0, n = retry.size(); i < n; ++i) {
+    Stream* stream = retry[i];
+    if (stream->id != 0) {
+      DetachStream(connection, stream);
+    }
+    if (error == http2::kNoError) {
+      stream->id = 0;
+      QueueStream(stream);
+    } else {
+      FallBack(stream);
+    }
+  }
+  if (connection->active.empty()) {
+    CloseConnection(connection);
+  }
+}
+
+void Http2UrlAsyncFetcher::ResetStream(Connection* connection, Stream* stream,
+                                       http2::ErrorCode error) {
+  http2::AppendRstStream(stream->id, error, &connection->write_buffer);
+}
+
+void Http2UrlAsyncFetcher::DetachStream(Connection* connection,
+                                        Stream* stream) {
+  if (connection->active.erase(stream->id) != 0) {
+    active_streams_->Add(-1);
+  }
+  if (connection->active.empty() && connection->queued.empty()) {
+    connection->idle_since_ms = timer_->NowMs();
+  }
+  StartStreams(connection);
+}
+
+void Http2UrlAsyncFetcher::CompleteStream(Connection* connection,
+                                          Stream* stream, bool success) {
+  if (connection != NULL) {
+    DetachStream(connection, stream);
+  }
+  if (!success) {
+    failures_->Add(1);
+  }
+  outstanding_fetches_.NoBarrierIncrement(-1);
+  stream->fetch->Done(success);
+  delete stream;
+}
+
+void Http2UrlAsyncFetcher::FallBack(Stream* stream) {
+  fallback_fetches_->Add(1);
+  outstanding_fetches_.NoBarrierIncrement(-1);
+  fallback_->Fetch(stream->url, stream->handler, stream->fetch);
+  delete stream;
+}
+
+bool Http2UrlAsyncFetcher::ConnectionError(Connection* connection,
+                                           http2::ErrorCode error,
+                                           const char* reason) {
+  // Tell the server why, if the socket will take it.
+  uint32 last_stream_id = 0;
+  GoogleString goaway;
+  http2::AppendGoAway(last_stream_id, error, &goaway);
+  send(connection->fd, goaway.data(), goaway.size(),
+       MSG_NOSIGNAL | MSG_DONTWAIT);
+  FailConnection(connection, reason, false);
+  return false;
+}
+
+void Http2UrlAsyncFetcher::FailConnection(Connection* connection,
+                                          const GoogleString& reason,
+                                          bool http1_origin) {
+  if (http1_origin) {
+    MarkHttp1Origin(connection->origin);
+  } else {
+    message_handler_->Message(
+        kWarning, "Http2UrlAsyncFetcher: %s on connection to %s",
+        reason.c_str(), connection->origin.c_str());
+  }
+  std::vector<Stream*> streams(connection->queued.begin(),
+                               connection->queued.end());
+  for (std::map<uint32, Stream*>::iterator p = connection->active.begin(),
+           e = connection->active.end(); p != e; ++p) {
+    streams.push_back(p->second);
+  }
+  active_streams_->Add(-static_cast<int64>(connection->active.size()));
+  connection->queued.clear();
+  connection->active.clear();
+  CloseConnection(connection);
+
+  // Run the callbacks only once the connection is out of the way.  Nothing
+  // has been passed on for streams without a response yet, so the fallback
+  // can still take them.
+  for (int i = 0, n = streams.size(); i < n; ++i) {
+    if (streams[i]->response_started) {
+      CompleteStream(NULL, streams[i], false);
+    } else {
+      FallBack(streams[i]);
+    }
+  }
+}
+
+void Http2UrlAsyncFetcher::CloseConnection(Connection* connection) {
+  if (connection->state == Connection::kClosed) {
+    return;
+  }
+  if (connection->fd >= 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  connection->state = Connection::kClosed;
+  connections_.erase(std::find(connections_.begin(), connections_.end(),
+                               connection));
+  closed_connections_.push_back(connection);
+}
+
+int64 Http2UrlAsyncFetcher::NextDeadlineMs() const {
+  int64 deadline_ms = -1;
+  for (int i = 0, n = connections_.size(); i < n; ++i) {
+    const Connection* connection = connections_[i];
+    int64 connection_deadline_ms = -1;
+    if (connection->active.empty() && connection->queued.empty()) {
+      connection_deadline_ms = connection->going_away ? 0 :
+          connection->idle_since_ms + kIdleConnectionTimeoutMs;
+    }
+    // Streams are queued in priority order, not deadline order, so check
+    // them all.
+    for (int j = 0, m = connection->queued.size(); j < m; ++j) {
+      int64 stream_ms = connection->queued[j]->deadline_ms;
+      if ((connection_deadline_ms < 0) ||
+          (stream_ms < connection_deadline_ms)) {
+        connection_deadline_ms = stream_ms;
+      }
+    }
+    for (std::map<uint32, Stream*>::const_iterator p =
+             connection->active.begin(), e = connection->active.end();
+         p != e; ++p) {
+      int64 stream_ms = p->second->deadline_ms;
+      if ((connection_deadline_ms < 0) ||
+          (stream_ms < connection_deadline_ms)) {
+        connection_deadline_ms = stream_ms;
+      }
+    }
+    if ((connection_deadline_ms >= 0) &&
+        ((deadline_ms < 0) || (connection_deadline_ms < deadline_ms))) {
+      deadline_ms = connection_deadline_ms;
+    }
+  }
+  return deadline_ms;
+}
+
+void Http2UrlAsyncFetcher::ExpireStreams() {
+  int64 now_ms = timer_->NowMs();
+  // Completing streams can close connections, so work from a copy.
+  std::vector<Connection*> connections(connections_);
+  for (int i = 0, n = connections.size(); i < n; ++i) {
+    Connection* connection = connections[i];
+    if (!connection->settings_received) {
+      // Until the server has answered the preface we don't know that it
+      // speaks HTTP/2 at all, so as with other failures to establish that,
+      // the connection's streams all go to the fallback.
+      int num_expired = 0;
+      for (int j = 0, m = connection->queued.size(); j < m; ++j) {
+        if (connection->queued[j]->deadline_ms <= now_ms) {
+          ++num_expired;
+        }
+      }
+      for (std::map<uint32, Stream*>::iterator p = connection->active.begin(),
+               e = connection->active.end(); p != e; ++p) {
+        if (p->second->deadline_ms <= now_ms) {
+          ++num_expired;
+        }
+      }
+      if (num_expired > 0) {
+        timeouts_->Add(num_expired);
+        FailConnection(connection, "timeout waiting for SETTINGS", false);
+        continue;
+      }
+    }
+    std::vector<Stream*> expired;
+    std::deque<Stream*>::iterator q = connection->queued.begin();
+    while (q != connection->queued.end()) {
+      if ((*q)->deadline_ms <= now_ms) {
+        expired.push_back(*q);
+        q = connection->queued.erase(q);
+      } else {
+        ++q;
+      }
+    }
+    for (std::map<uint32, Stream*>::iterator p = connection->active.begin(),
+             e = connection->active.end(); p != e; ++p) {
+      if (p->second->deadline_ms <= now_ms) {
+        expired.push_back(p->second);
+      }
+    }
+    for (int j = 0, m = expired.size(); j < m; ++j) {
+      Stream* stream = expired[j];
+      if (stream->id != 0) {
+        ResetStream(connection, stream, http2::kCancel);
+      }
+      message_handler_->Message(kWarning, "Http2UrlAsyncFetcher: timeout "
+                                "fetching %s", stream->url.c_str());
+      timeouts_->Add(1);
+      CompleteStream(connection, stream, false);
+    }
+
+    if (connection->active.empty() && connection->queued.empty() &&
+        (connection->going_away ||
+         (connection->idle_since_ms + kIdleConnectionTimeoutMs <= now_ms))) {
+      if (connection->state == Connection::kOpen) {
+        http2::AppendGoAway(0, http2::kNoError, &connection->write_buffer);
+        FlushConnection(connection);
+      }
+      CloseConnection(connection);
+    } else if (!expired.empty() && (connection->state == Connection::kOpen) &&
+               FlushConnection(connection)) {
+      UpdateInterest(connection);
+    }
+  }
+}
+
+void Http2UrlAsyncFetcher::ShutDown() {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      return;
+    }
+    shut_down_ = true;
+  }
+  StopThreads();
+  fallback_->ShutDown();
+}
+
+void Http2UrlAsyncFetcher::StopThreads() {
+  bool was_running;
+  {
+    ScopedMutex lock(mutex_.get());
+    was_running = running_;
+    running_ = false;
+    resolve_condvar_->Signal();
+  }
+  // The event thread may also have stopped on its own, after an epoll
+  // failure, so join it whenever it was started.
+  if (event_thread_.get() != NULL) {
+    if (was_running) {
+      Wakeup();
+    }
+    event_thread_->Join();
+    event_thread_.reset(NULL);
+  }
+  if (resolver_thread_.get() != NULL) {
+    resolver_thread_->Join();
+    resolver_thread_.reset(NULL);
+  }
+  {
+    // Lookups nobody is waiting for any more.
+    ScopedMutex lock(mutex_.get());
+    STLDeleteElements(&resolve_requests_);
+    STLDeleteElements(&resolutions_);
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
+#define PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/system/http2_protocol.h"
+
+namespace net_instaweb {
+
+class AsyncFetch;
+class MessageHandler;
+class Statistics;
+class UpDownCounter;
+class Variable;
+
+// Fetches http URLs over cleartext HTTP/2, assuming prior knowledge that the
+// origin speaks it (RFC 7540 section 3.4), so that all concurrent fetches to
+// an origin share one connection as separate streams instead of each
+// needing a connection of its own.  Everything else goes to a fallback
+// fetcher, normally a SerfUrlAsyncFetcher: https URLs, which would need TLS
+// with ALPN, requests other than GET and HEAD, and origins that turn out
+// not to speak HTTP/2.  Those are recognized by whatever they send back
+// instead of the server's SETTINGS, and are then remembered for
+// kHttp1OriginMemoryMs, so their fetches go straight to the fallback.
+//
+// As with BinaryMemCache, Fetch just queues the request for a single event
+// thread, which owns every connection and runs every AsyncFetch callback.
+// User-facing fetches are given a higher stream weight than background
+// ones, and go ahead of them when the server limits concurrent streams.
+// Host names are looked up on a resolver thread of their own, so a slow
+// lookup holds up only the fetches waiting for that origin's connection.
+class Http2UrlAsyncFetcher : public UrlAsyncFetcher {
+ public:
+  static const int64 kHttp1OriginMemoryMs = 10 * Timer::kMinuteMs;
+  static const int64 kIdleConnectionTimeoutMs = Timer::kMinuteMs;
+
+  // Weights for the streams of user-facing and background fetches.
+  static const int kForegroundWeight = 256;
+  static const int kBackgroundWeight = 16;
+
+  // Flow-control windows we give the server, per stream and per connection.
+  static const uint32 kStreamWindowSize = 1 << 20;
+  static const uint32 kConnectionWindowSize = 16 << 20;
+
+  // Does not take ownership of fallback, which must outlive ShutDown, but
+  // not the destructor.
+  Http2UrlAsyncFetcher(UrlAsyncFetcher* fallback, ThreadSystem* thread_system,
+                       Statistics* statistics, Timer* timer,
+                       int64 timeout_ms, MessageHandler* message_handler);
+  virtual ~Http2UrlAsyncFetcher();
+
+  static void InitStats(Statistics* statistics);
+
+  // Starts the resolver and event threads, returning whether that
+  // succeeded.  Until it has, every fetch goes to the fallback.
+  bool Start();
+
+  virtual bool SupportsHttps() const { return fallback_->SupportsHttps(); }
+
+  virtual void Fetch(const GoogleString& url,
+                     MessageHandler* message_handler,
+                     AsyncFetch* fetch);
+
+  // Stops the event and resolver threads, failing any fetches still in
+  // progress, and shuts down the fallback.  This waits out any host name
+  // lookup that is under way.  Later calls do nothing.
+  virtual void ShutDown();
+
+  // Number of fetches queued or in progress over HTTP/2.
+  int32 outstanding_fetches() const { return outstanding_fetches_.value(); }
+
+ private:
+  class EventThread;
+  class ResolverThread;
+  struct Connection;
+  struct Resolution;
+  struct Stream;
+
+  // Returns true if fetches to origin should go to the fallback, because it
+  // was recently found not to speak HTTP/2.
+  bool IsHttp1Origin(const GoogleString& origin);
+  void MarkHttp1Origin(const GoogleString& origin);
+
+  // Interrupts the event thread's wait for I/O.
+  void Wakeup();
+
+  // Stops and joins the event and resolver threads, if started.
+  void StopThreads();
+
+  // Runs on the resolver thread, looking up each host name queued by
+  // OpenConnection and handing the result back to the event thread.
+  void ResolveLoop();
+
+  // The remaining methods run only on the event thread.  Those returning
+  // bool return false if they had to close the connection.
+  void EventLoop();
+  void DrainPendingStreams();
+  // Connects each connection whose host name has been looked up.
+  void DrainResolutions();
+  void QueueStream(Stream* stream);
+  // Returns the open connection to the stream's origin that new streams
+  // should use, opening one if there is none.
+  Connection* ConnectionFor(Stream* stream);
+  // Starts a connection to the stream's origin, which queues streams until
+  // its host name has been looked up and ConnectResolved connects it.
+  Connection* OpenConnection(Stream* stream);
+  // Takes the addresses from resolution.
+  void ConnectResolved(Connection* connection, Resolution* resolution);
+  // Starts connecting to the connection's next address that will take a
+  // connect, returning false, with the last errno in *error, if none will.
+  bool ConnectNextAddress(Connection* connection, int* error);
+  void StartStreams(Connection* connection);
+  void SendRequest(Connection* connection, Stream* stream);
+  void HandleEvents(Connection* connection, uint32 events);
+  bool FlushConnection(Connection* connection);
+  bool ReadConnection(Connection* connection);
+  bool HandleFrame(Connection* connection, const http2::FrameHeader& header,
+                   StringPiece payload);
+  bool HandleSettings(Connection* connection,
+                      const http2::FrameHeader& header, StringPiece payload);
+  bool HandleHeaderBlock(Connection* connection);
+  bool HandleData(Connection* connection, const http2::FrameHeader& header,
+                  StringPiece payload);
+  void HandleRstStream(Connection* connection, uint32 stream_id,
+                       uint32 error);
+  void HandleGoAway(Connection* connection, StringPiece payload);
+  // Sends RST_STREAM for a stream we are giving up on.
+  void ResetStream(Connection* connection, Stream* stream,
+                   http2::ErrorCode error);
+  // Forgets an active stream, making room for a queued one.
+  void DetachStream(Connection* connection, Stream* stream);
+  // Detaches the stream if connection is non-NULL, then runs its callbacks
+  // and deletes it.
+  void CompleteStream(Connection* connection, Stream* stream, bool success);
+  // Hands the stream's fetch to the fallback fetcher and deletes it.
+  void FallBack(Stream* stream);
+
+  // Sends GOAWAY with the given error, then fails the connection.  Always
+  // returns false.
+  bool ConnectionError(Connection* connection, http2::ErrorCode error,
+                       const char* reason);
+
+  // Closes the connection.  Streams with no response yet go to the
+  // fallback, and the rest fail.  If the server never spoke HTTP/2 on it,
+  // and http1_origin is set, the origin is remembered as HTTP/1-only.
+  void FailConnection(Connection* connection, const GoogleString& reason,
+                      bool http1_origin);
+  void CloseConnection(Connection* connection);
+  void UpdateInterest(Connection* connection);
+  int64 NextDeadlineMs() const;
+  void ExpireStreams();
+
+  UrlAsyncFetcher* fallback_;
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  int64 timeout_ms_;
+  MessageHandler* message_handler_;
+
+  int epoll_fd_;
+  int wakeup_fd_;
+  scoped_ptr<EventThread> event_thread_;
+  scoped_ptr<ResolverThread> resolver_thread_;
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  // Signaled when a lookup is queued for the resolver thread, or it should
+  // stop.
+  scoped_ptr<ThreadSystem::Condvar> resolve_condvar_;
+  std::vector<Stream*> pending_streams_ GUARDED_BY(mutex_);
+  std::deque<Resolution*> resolve_requests_ GUARDED_BY(mutex_);
+  std::vector<Resolution*> resolutions_ GUARDED_BY(mutex_);
+  bool running_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+  // When each origin found not to speak HTTP/2 should be tried again.
+  std::map<GoogleString, int64> http1_origins_ GUARDED_BY(mutex_);
+
+  // Owned by the event thread.  There is at most one connection per origin
+  // accepting new streams, but connections the server is winding down with
+  // GOAWAY stay until their last stream completes.  Closed connections are
+  // only deleted once the epoll events that might refer to them have been
+  // handled.
+  std::vector<Connection*> connections_;
+  std::vector<Connection*> closed_connections_;
+
+  AtomicInt32 outstanding_fetches_;
+  Variable* http2_fetches_;
+  Variable* fallback_fetches_;
+  Variable* connections_opened_;
+  Variable* http1_origins_found_;
+  Variable* failures_;
+  Variable* timeouts_;
+  UpDownCounter* active_streams_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2UrlAsyncFetcher);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
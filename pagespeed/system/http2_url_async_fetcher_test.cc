@@ -0,0 +1,650 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the HTTP/2 fetcher against an in-process fake h2c server.
+
+#include "pagespeed/system/http2_url_async_fetcher.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/mock_url_fetcher.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/http/content_type.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "pagespeed/opt/http/request_context.h"
+#include "pagespeed/system/http2_protocol.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kTimeoutMs = 500;
+const int64 kMaxWaitMs = 5000;
+
+// A single-threaded h2c server answering every GET with a short body naming
+// the path, or with the (non-empty) body set for it, respecting the
+// client's flow control.  It can instead play an HTTP/1.1 server that
+// rejects the preface, leave requests unanswered, or say nothing at all.
+class FakeHttp2Server : public ThreadSystem::Thread {
+ public:
+  explicit FakeHttp2Server(ThreadSystem* thread_system)
+      : Thread(thread_system, "fake_http2_server", ThreadSystem::kJoinable),
+        mutex_(thread_system->NewMutex()),
+        listen_fd_(-1),
+        port_(0),
+        max_concurrent_streams_(100),
+        num_connections_(0) {
+  }
+
+  virtual ~FakeHttp2Server() {
+    stop_.set_value(true);
+    Join();
+    STLDeleteElements(&clients_);
+    close(listen_fd_);
+  }
+
+  // Binds the listening socket and starts serving.
+  bool Listen() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if ((bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0) ||
+        (listen(listen_fd_, 16) != 0) ||
+        (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+                     &length) != 0)) {
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    return Start();
+  }
+
+  // Must be called before Listen.
+  void set_http1(bool x) { http1_.set_value(x); }
+  void set_max_concurrent_streams(uint32 x) { max_concurrent_streams_ = x; }
+
+  // When set, requests are read but never answered.
+  void set_unresponsive(bool x) { unresponsive_.set_value(x); }
+
+  // When set, not even the preface is answered.
+  void set_silent(bool x) { silent_.set_value(x); }
+
+  void SetBody(const GoogleString& path, const GoogleString& body) {
+    ScopedMutex lock(mutex_.get());
+    bodies_[path] = body;
+  }
+
+  int port() const { return port_; }
+
+  int num_connections() {
+    ScopedMutex lock(mutex_.get());
+    return num_connections_;
+  }
+
+  // The weight and user-agent each path was requested with.
+  int weight(const GoogleString& path) {
+    ScopedMutex lock(mutex_.get());
+    return weights_[path];
+  }
+  GoogleString user_agent(const GoogleString& path) {
+    ScopedMutex lock(mutex_.get());
+    return user_agents_[path];
+  }
+
+  virtual void Run() {
+    while (!stop_.value()) {
+      std::vector<pollfd> fds(1 + clients_.size());
+      fds[0].fd = listen_fd_;
+      fds[0].events = POLLIN;
+      for (int i = 0, n = clients_.size(); i < n; ++i) {
+        fds[i + 1].fd = clients_[i]->fd;
+        fds[i + 1].events = POLLIN;
+      }
+      if (poll(&fds[0], fds.size(), 10 /* ms */) <= 0) {
+        continue;
+      }
+      if ((fds[0].revents & POLLIN) != 0) {
+        Client* client = new Client(accept(listen_fd_, NULL, NULL));
+        clients_.push_back(client);
+        ScopedMutex lock(mutex_.get());
+        ++num_connections_;
+      }
+      for (int i = fds.size() - 2; i >= 0; --i) {
+        if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) != 0 &&
+            !Serve(clients_[i])) {
+          delete clients_[i];
+          clients_.erase(clients_.begin() + i);
+        }
+      }
+    }
+  }
+
+ private:
+  struct Client {
+    explicit Client(int fd_in)
+        : fd(fd_in), preface_read(false), decoder(4096),
+          send_window(http2::kDefaultWindowSize),
+          initial_stream_window(http2::kDefaultWindowSize),
+          header_stream_id(0) {
+    }
+    ~Client() { close(fd); }
+
+    int fd;
+    GoogleString input;
+    bool preface_read;
+    http2::HpackEncoder encoder;
+    http2::HpackDecoder decoder;
+    int64 send_window;
+    int64 initial_stream_window;
+    // Response bodies not yet sent for lack of window, and the windows.
+    std::map<uint32, GoogleString> unsent;
+    std::map<uint32, int64> stream_windows;
+    uint32 header_stream_id;
+    GoogleString header_block;
+    int header_weight;
+  };
+
+  // Reads what's available from the client and handles every complete
+  // frame.  Returns false when the client has gone away.
+  bool Serve(Client* client) {
+    char buf[4096];
+    ssize_t bytes = read(client->fd, buf, sizeof(buf));
+    if (bytes <= 0) {
+      return false;
+    }
+    if (silent_.value()) {
+      return true;
+    }
+    if (http1_.value()) {
+      const char kResponse[] =
+          "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+          "Connection: close\r\n\r\n";
+      write(client->fd, kResponse, STATIC_STRLEN(kResponse));
+      return false;
+    }
+    client->input.append(buf, bytes);
+    GoogleString output;
+    if (!client->preface_read) {
+      if (client->input.size() < http2::kConnectionPrefaceSize) {
+        return true;
+      }
+      EXPECT_EQ(StringPiece(http2::kConnectionPreface,
+                            http2::kConnectionPrefaceSize),
+                StringPiece(client->input).substr(
+                    0, http2::kConnectionPrefaceSize));
+      client->input.erase(0, http2::kConnectionPrefaceSize);
+      client->preface_read = true;
+      http2::SettingVector settings;
+      settings.push_back(http2::Setting(http2::kSettingsMaxConcurrentStreams,
+                                        max_concurrent_streams_));
+      http2::AppendSettings(settings, &output);
+    }
+    size_t offset = 0;
+    while (client->input.size() - offset >= http2::kFrameHeaderSize) {
+      http2::FrameHeader header;
+      http2::ParseFrameHeader(StringPiece(client->input).substr(offset),
+                              &header);
+      size_t size = http2::kFrameHeaderSize + header.length;
+      if (client->input.size() - offset < size) {
+        break;
+      }
+      StringPiece payload = StringPiece(client->input).substr(
+          offset + http2::kFrameHeaderSize, header.length);
+      HandleFrame(client, header, payload, &output);
+      offset += size;
+    }
+    client->input.erase(0, offset);
+    SendData(client, &output);
+    if (!output.empty()) {
+      EXPECT_EQ(static_cast<ssize_t>(output.size()),
+                write(client->fd, output.data(), output.size()));
+    }
+    return true;
+  }
+
+  void HandleFrame(Client* client, const http2::FrameHeader& header,
+                   StringPiece payload, GoogleString* output) {
+    switch (header.type) {
+      case http2::kSettings: {
+        if ((header.flags & http2::kFlagAck) != 0) {
+          break;
+        }
+        http2::SettingVector settings;
+        EXPECT_TRUE(http2::ParseSettings(payload, &settings));
+        for (int i = 0, n = settings.size(); i < n; ++i) {
+          if (settings[i].id == http2::kSettingsInitialWindowSize) {
+            client->initial_stream_window = settings[i].value;
+          }
+        }
+        http2::AppendSettingsAck(output);
+        break;
+      }
+      case http2::kWindowUpdate: {
+        int64 increment = http2::ReadUint32(payload) & 0x7fffffff;
+        if (header.stream_id == 0) {
+          client->send_window += increment;
+        } else {
+          client->stream_windows[header.stream_id] += increment;
+        }
+        break;
+      }
+      case http2::kHeaders: {
+        EXPECT_NE(0, header.flags & http2::kFlagPriority);
+        client->header_weight = static_cast<uint8>(payload[4]) + 1;
+        EXPECT_TRUE(http2::StripPadding(header, &payload));
+        client->header_stream_id = header.stream_id;
+        payload.CopyToString(&client->header_block);
+        if ((header.flags & http2::kFlagEndHeaders) != 0) {
+          HandleRequest(client, output);
+        }
+        break;
+      }
+      case http2::kContinuation:
+        EXPECT_EQ(client->header_stream_id, header.stream_id);
+        payload.AppendToString(&client->header_block);
+        if ((header.flags & http2::kFlagEndHeaders) != 0) {
+          HandleRequest(client, output);
+        }
+        break;
+      case http2::kRstStream:
+        client->unsent.erase(header.stream_id);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void HandleRequest(Client* client, GoogleString* output) {
+    http2::HeaderFieldVector fields;
+    EXPECT_TRUE(client->decoder.Decode(client->header_block, &fields));
+    GoogleString path;
+    GoogleString user_agent;
+    for (int i = 0, n = fields.size(); i < n; ++i) {
+      if (fields[i].name == ":path") {
+        path = fields[i].value;
+      } else if (fields[i].name == "user-agent") {
+        user_agent = fields[i].value;
+      }
+    }
+    GoogleString body;
+    {
+      ScopedMutex lock(mutex_.get());
+      weights_[path] = client->header_weight;
+      user_agents_[path] = user_agent;
+      std::map<GoogleString, GoogleString>::iterator p = bodies_.find(path);
+      body = (p == bodies_.end()) ? StrCat("body of ", path) : p->second;
+    }
+    if (unresponsive_.value()) {
+      return;
+    }
+
+    uint32 stream_id = client->header_stream_id;
+    http2::HeaderFieldVector response;
+    response.push_back(http2::HeaderField(":status", "200"));
+    response.push_back(http2::HeaderField("content-type", "text/plain"));
+    response.push_back(http2::HeaderField("x-stream-id",
+                                          IntegerToString(stream_id)));
+    GoogleString block;
+    client->encoder.Encode(response, &block);
+    http2::AppendFrame(http2::kHeaders, http2::kFlagEndHeaders, stream_id,
+                       block, output);
+    client->unsent[stream_id] = body;
+    client->stream_windows[stream_id] = client->initial_stream_window;
+  }
+
+  // Sends as much of each unsent body as the windows allow.
+  void SendData(Client* client, GoogleString* output) {
+    std::map<uint32, GoogleString>::iterator p = client->unsent.begin();
+    while (p != client->unsent.end()) {
+      uint32 stream_id = p->first;
+      GoogleString* body = &p->second;
+      int64* stream_window = &client->stream_windows[stream_id];
+      while (!body->empty() &&
+             (client->send_window > 0) && (*stream_window > 0)) {
+        size_t size = std::min(
+            static_cast<int64>(std::min(body->size(),
+                                        static_cast<size_t>(16384))),
+            std::min(client->send_window, *stream_window));
+        http2::AppendFrame(
+            http2::kData, (size == body->size()) ? http2::kFlagEndStream : 0,
+            stream_id, StringPiece(*body).substr(0, size), output);
+        body->erase(0, size);
+        client->send_window -= size;
+        *stream_window -= size;
+      }
+      if (body->empty()) {
+        client->unsent.erase(p++);
+      } else {
+        ++p;
+      }
+    }
+  }
+
+  scoped_ptr<AbstractMutex> mutex_;
+  int listen_fd_;
+  int port_;
+  uint32 max_concurrent_streams_;
+  AtomicBool stop_;
+  AtomicBool http1_;
+  AtomicBool unresponsive_;
+  AtomicBool silent_;
+  std::vector<Client*> clients_;  // Only accessed by the server thread.
+  std::map<GoogleString, GoogleString> bodies_;
+  std::map<GoogleString, int> weights_;
+  std::map<GoogleString, GoogleString> user_agents_;
+  int num_connections_;
+
+  DISALLOW_COPY_AND_ASSIGN(FakeHttp2Server);
+};
+
+class BackgroundStringAsyncFetch : public StringAsyncFetch {
+ public:
+  explicit BackgroundStringAsyncFetch(const RequestContextPtr& request_ctx)
+      : StringAsyncFetch(request_ctx) {
+  }
+
+  virtual bool IsBackgroundFetch() const { return true; }
+};
+
+class Http2UrlAsyncFetcherTest : public testing::Test {
+ protected:
+  Http2UrlAsyncFetcherTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewTimer()),
+        statistics_(thread_system_.get()),
+        counting_fetcher_(&mock_fetcher_) {
+    Http2UrlAsyncFetcher::InitStats(&statistics_);
+    mock_fetcher_.set_fail_on_unexpected(false);
+  }
+
+  ~Http2UrlAsyncFetcherTest() {
+    // Stop the fetcher before its server goes away.
+    fetcher_.reset(NULL);
+    server_.reset(NULL);
+  }
+
+  void StartServerAndFetcher() {
+    ASSERT_TRUE(server_->Listen());
+    fetcher_.reset(new Http2UrlAsyncFetcher(
+        &counting_fetcher_, thread_system_.get(), &statistics_, timer_.get(),
+        kTimeoutMs, &handler_));
+    ASSERT_TRUE(fetcher_->Start());
+  }
+
+  virtual void SetUp() {
+    server_.reset(new FakeHttp2Server(thread_system_.get()));
+  }
+
+  GoogleString Url(const GoogleString& path) {
+    return StrCat("http://127.0.0.1:", IntegerToString(server_->port()),
+                  path);
+  }
+
+  StringAsyncFetch* NewFetch() {
+    return new StringAsyncFetch(
+        RequestContext::NewTestRequestContext(thread_system_.get()));
+  }
+
+  void WaitFor(StringAsyncFetch* fetch) {
+    for (int64 waited_ms = 0; !fetch->done() && (waited_ms < kMaxWaitMs);
+         ++waited_ms) {
+      timer_->SleepMs(1);
+    }
+    ASSERT_TRUE(fetch->done());
+  }
+
+  int64 Stat(const char* name) {
+    return statistics_.GetVariable(name)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  SimpleStats statistics_;
+  NullMessageHandler handler_;
+  MockUrlFetcher mock_fetcher_;
+  CountingUrlAsyncFetcher counting_fetcher_;
+  scoped_ptr<FakeHttp2Server> server_;
+  scoped_ptr<Http2UrlAsyncFetcher> fetcher_;
+};
+
+TEST_F(Http2UrlAsyncFetcherTest, ConcurrentFetchesShareAConnection) {
+  StartServerAndFetcher();
+  const int kNumFetches = 10;
+  std::vector<StringAsyncFetch*> fetches;
+  for (int i = 0; i < kNumFetches; ++i) {
+    fetches.push_back(NewFetch());
+    fetcher_->Fetch(Url(StrCat("/", IntegerToString(i))), &handler_,
+                    fetches[i]);
+  }
+  for (int i = 0; i < kNumFetches; ++i) {
+    WaitFor(fetches[i]);
+    EXPECT_TRUE(fetches[i]->success());
+    EXPECT_EQ(StrCat("body of /", IntegerToString(i)), fetches[i]->buffer());
+    ResponseHeaders* response = fetches[i]->response_headers();
+    EXPECT_EQ(HttpStatus::kOK, response->status_code());
+    EXPECT_STREQ("text/plain",
+                 response->Lookup1(HttpAttributes::kContentType));
+  }
+  STLDeleteElements(&fetches);
+  EXPECT_EQ(1, server_->num_connections());
+  EXPECT_EQ(kNumFetches, Stat("http2_fetches"));
+  EXPECT_EQ(0, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, fetcher_->outstanding_fetches());
+  EXPECT_TRUE(StringPiece(server_->user_agent("/0")).starts_with(
+      "mod_pagespeed/"));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, StreamLimitQueuesFetches) {
+  server_->set_max_concurrent_streams(1);
+  StartServerAndFetcher();
+  // Wait for the server's SETTINGS before the rest of the fetches.
+  scoped_ptr<StringAsyncFetch> first(NewFetch());
+  fetcher_->Fetch(Url("/first"), &handler_, first.get());
+  WaitFor(first.get());
+  std::vector<StringAsyncFetch*> fetches;
+  for (int i = 0; i < 5; ++i) {
+    fetches.push_back(NewFetch());
+    fetcher_->Fetch(Url(StrCat("/", IntegerToString(i))), &handler_,
+                    fetches[i]);
+  }
+  for (int i = 0; i < 5; ++i) {
+    WaitFor(fetches[i]);
+    EXPECT_TRUE(fetches[i]->success());
+  }
+  STLDeleteElements(&fetches);
+  EXPECT_EQ(1, server_->num_connections());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, BackgroundFetchesGetLowerWeight) {
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> foreground(NewFetch());
+  scoped_ptr<StringAsyncFetch> background(new BackgroundStringAsyncFetch(
+      RequestContext::NewTestRequestContext(thread_system_.get())));
+  fetcher_->Fetch(Url("/foreground"), &handler_, foreground.get());
+  fetcher_->Fetch(Url("/background"), &handler_, background.get());
+  WaitFor(foreground.get());
+  WaitFor(background.get());
+  EXPECT_EQ(Http2UrlAsyncFetcher::kForegroundWeight,
+            server_->weight("/foreground"));
+  EXPECT_EQ(Http2UrlAsyncFetcher::kBackgroundWeight,
+            server_->weight("/background"));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, LargeBodyNeedsWindowUpdates) {
+  // Bigger than both the stream window and half the connection window.
+  GoogleString body;
+  for (int i = 0; body.size() < 9 * Http2UrlAsyncFetcher::kStreamWindowSize;
+       ++i) {
+    StrAppend(&body, IntegerToString(i), "\n");
+  }
+  server_->SetBody("/large", body);
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/large"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_TRUE(body == fetch->buffer());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, Http1OriginFallsBack) {
+  server_->set_http1(true);
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, Stat("http2_http1_origins"));
+
+  // The origin is remembered, so the next fetch goes straight to the
+  // fallback without connecting.
+  fetch.reset(NewFetch());
+  fetcher_->Fetch(Url("/b"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, server_->num_connections());
+  EXPECT_EQ(2, Stat("http2_fallback_fetches"));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, FallbackSeesCallersRequestHeaders) {
+  server_->set_http1(true);
+  StartServerAndFetcher();
+  fetcher_->set_fetch_with_gzip(true);
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  // Asking for gzip is left to the fallback, which inflates for itself.
+  EXPECT_FALSE(fetch->request_headers()->Has(HttpAttributes::kAcceptEncoding));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, HttpsAndPostUseFallback) {
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch("https://127.0.0.1/a", &handler_, fetch.get());
+  WaitFor(fetch.get());
+  fetch.reset(NewFetch());
+  fetch->request_headers()->set_method(RequestHeaders::kPost);
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, server_->num_connections());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, UnresolvableHostFallsBack) {
+  StartServerAndFetcher();
+  // .invalid names never resolve (RFC 6761), which the resolver thread
+  // reports back, sending the fetch to the fallback.
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch("http://unresolvable.invalid/a", &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, Stat("http2_connections_opened"));
+  EXPECT_EQ(0, fetcher_->outstanding_fetches());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, TriesEachAddress) {
+  // localhost commonly resolves to ::1 as well as 127.0.0.1, and the server
+  // only listens on the latter.
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(StrCat("http://localhost:", IntegerToString(server_->port()),
+                         "/a"),
+                  &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_EQ("body of /a", fetch->buffer());
+  EXPECT_EQ(1, Stat("http2_fetches"));
+  EXPECT_EQ(0, counting_fetcher_.fetch_count());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, TimeoutBeforeSettingsFallsBack) {
+  server_->set_silent(true);
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_EQ(1, Stat("http2_fetch_timeouts"));
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, Stat("http2_http1_origins"));
+  EXPECT_EQ(0, fetcher_->outstanding_fetches());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, Timeout) {
+  server_->set_unresponsive(true);
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  WaitFor(fetch.get());
+  EXPECT_FALSE(fetch->success());
+  EXPECT_EQ(1, Stat("http2_fetch_timeouts"));
+  EXPECT_EQ(0, counting_fetcher_.fetch_count());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, ShutDownFailsOutstandingFetches) {
+  server_->set_unresponsive(true);
+  StartServerAndFetcher();
+  scoped_ptr<StringAsyncFetch> fetch(NewFetch());
+  fetcher_->Fetch(Url("/a"), &handler_, fetch.get());
+  fetcher_->ShutDown();
+  ASSERT_TRUE(fetch->done());
+  EXPECT_FALSE(fetch->success());
+  EXPECT_EQ(0, fetcher_->outstanding_fetches());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, ShutDownOnlyOnce) {
+  scoped_ptr<CountingUrlAsyncFetcher> fallback(
+      new CountingUrlAsyncFetcher(&mock_fetcher_));
+  scoped_ptr<Http2UrlAsyncFetcher> fetcher(new Http2UrlAsyncFetcher(
+      fallback.get(), thread_system_.get(), &statistics_, timer_.get(),
+      kTimeoutMs, &handler_));
+  ASSERT_TRUE(fetcher->Start());
+  fetcher->ShutDown();
+  fetcher->ShutDown();
+  // As in SystemRewriteDriverFactory, the fallback may be deleted before
+  // the fetcher, which must then leave it alone.
+  fallback.reset(NULL);
+  fetcher.reset(NULL);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -21,6 +21,9 @@
 #include "base/logging.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/http_value.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -39,8 +42,13 @@ const char kNumFailed[] = "ipro_recorder_failed";
 const char kNumDroppedDueToLoad[] = "ipro_recorder_dropped_due_to_load";
 const char kNumDroppedDueToSize[] = "ipro_recorder_dropped_due_to_size";
 
+// Size of the chunks we read a spool file back in.
+const int kSpoolReadChunkBytes = 64 * 1024;
+
 }
 
+const char InPlaceResourceRecorder::kSpoolFilePrefix[] = "!ipro!spool!";
+
 AtomicInt32 InPlaceResourceRecorder::active_recordings_(0);
 
 InPlaceResourceRecorder::InPlaceResourceRecorder(
@@ -55,8 +63,15 @@ InPlaceResourceRecorder::InPlaceResourceRecorder(
       http_options_(request_context->options()),
       max_response_bytes_(max_response_bytes),
       max_concurrent_recordings_(max_concurrent_recordings),
-      write_to_resource_value_(request_context, &resource_value_),
-      inflating_fetch_(&write_to_resource_value_),
+      recorded_bytes_(0),
+      // NULL for hashers that can only hash all at once, in which case we
+      // hash the complete contents in DoneAndSetHeaders.
+      contents_hash_(cache->hasher()->NewIncremental()),
+      recording_fetch_(request_context, this),
+      inflating_fetch_(&recording_fetch_),
+      spool_file_system_(NULL),
+      spool_threshold_bytes_(0),
+      spool_file_(NULL),
       cache_(cache), handler_(handler),
       num_resources_(stats->GetVariable(kNumResources)),
       num_inserted_into_cache_(stats->GetVariable(kNumInsertedIntoCache)),
@@ -90,6 +105,7 @@ InPlaceResourceRecorder::InPlaceResourceRecorder(
 }
 
 InPlaceResourceRecorder::~InPlaceResourceRecorder() {
+  DiscardSpool();
   if (limit_active_recordings()) {
     active_recordings_.BarrierIncrement(-1);
   }
@@ -104,6 +120,87 @@ void InPlaceResourceRecorder::InitStats(Statistics* statistics) {
   statistics->AddVariable(kNumDroppedDueToSize);
 }
 
+void InPlaceResourceRecorder::EnableSpooling(FileSystem* file_system,
+                                             StringPiece spool_dir,
+                                             int64 threshold_bytes) {
+  DCHECK(!consider_response_headers_called_);
+  spool_file_system_ = file_system;
+  spool_path_prefix_ = spool_dir.as_string();
+  EnsureEndsInSlash(&spool_path_prefix_);
+  StrAppend(&spool_path_prefix_, kSpoolFilePrefix);
+  spool_threshold_bytes_ = threshold_bytes;
+}
+
+bool InPlaceResourceRecorder::RecordContents(StringPiece contents) {
+  if (contents_hash_.get() != NULL) {
+    contents_hash_->Add(contents);
+  }
+  recorded_bytes_ += contents.size();
+  if ((spool_file_system_ != NULL) && (spool_file_ == NULL) &&
+      (recorded_bytes_ > spool_threshold_bytes_) && !StartSpooling()) {
+    return false;
+  }
+  if (spool_file_ != NULL) {
+    return spool_file_->Write(contents, handler_);
+  }
+  return resource_value_.Write(contents, handler_);
+}
+
+bool InPlaceResourceRecorder::StartSpooling() {
+  spool_file_ = spool_file_system_->OpenTempFile(spool_path_prefix_,
+                                                 handler_);
+  if (spool_file_ == NULL) {
+    return false;
+  }
+  // Store the filename early, since it's invalidated by Close.
+  spool_path_ = spool_file_->filename();
+  StringPiece recorded;
+  resource_value_.ExtractContents(&recorded);
+  bool ok = spool_file_->Write(recorded, handler_);
+  resource_value_.Clear();
+  return ok;
+}
+
+bool InPlaceResourceRecorder::FinishSpooling() {
+  bool ok = spool_file_system_->Close(spool_file_, handler_);
+  spool_file_ = NULL;
+  FileSystem::InputFile* input = NULL;
+  if (ok) {
+    input = spool_file_system_->OpenInputFile(spool_path_.c_str(), handler_);
+    ok = (input != NULL);
+  }
+  if (ok) {
+    // This is the one point at which the whole resource is in memory, as
+    // the cache takes values whole.
+    resource_value_.ReserveContents(recorded_bytes_);
+    scoped_array<char> buffer(new char[kSpoolReadChunkBytes]);
+    int64 bytes_read = 0;
+    int bytes;
+    while (ok &&
+           (bytes = input->Read(buffer.get(), kSpoolReadChunkBytes,
+                                handler_)) > 0) {
+      ok = resource_value_.Write(StringPiece(buffer.get(), bytes), handler_);
+      bytes_read += bytes;
+    }
+    spool_file_system_->Close(input, handler_);
+    ok = ok && (bytes_read == recorded_bytes_);
+  }
+  DiscardSpool();
+  return ok;
+}
+
+void InPlaceResourceRecorder::DiscardSpool() {
+  NullMessageHandler null_handler;
+  if (spool_file_ != NULL) {
+    spool_file_system_->Close(spool_file_, &null_handler);
+    spool_file_ = NULL;
+  }
+  if (!spool_path_.empty()) {
+    spool_file_system_->RemoveFile(spool_path_.c_str(), &null_handler);
+    spool_path_.clear();
+  }
+}
+
 bool InPlaceResourceRecorder::Write(const StringPiece& contents,
                                     MessageHandler* handler) {
   DCHECK(consider_response_headers_called_);
@@ -111,10 +208,9 @@ bool InPlaceResourceRecorder::Write(const StringPiece& contents,
     return false;
   }
 
-  // Write into resource_value_ decompressing if needed.
+  // Record the contents, decompressing if needed.
   failure_ = !inflating_fetch_.Write(contents, handler_);
-  if (max_response_bytes_ <= 0 ||
-      resource_value_.contents_size() < max_response_bytes_) {
+  if (max_response_bytes_ <= 0 || recorded_bytes_ < max_response_bytes_) {
     return !failure_;
   } else {
     DroppedDueToSize();
@@ -135,8 +231,19 @@ void InPlaceResourceRecorder::ConsiderResponseHeaders(
     // care about Content-Encoding, plus AsyncFetch gets unhappy with 0
     // status code.
     inflating_fetch_.response_headers()->CopyFrom(*response_headers);
-    write_to_resource_value_.response_headers()->set_status_code(
-        HttpStatus::kOK);
+    recording_fetch_.response_headers()->set_status_code(HttpStatus::kOK);
+
+    // Gzipped content will be inflated, to a size we can't know.  Content
+    // that is going to be spooled is sized when it's read back.
+    int64 content_length;
+    if (!failure_ && !response_headers->IsGzipped() &&
+        response_headers->FindContentLength(&content_length) &&
+        content_length > 0 &&
+        (max_response_bytes_ <= 0 || content_length < max_response_bytes_) &&
+        (spool_file_system_ == NULL ||
+         content_length <= spool_threshold_bytes_)) {
+      resource_value_.ReserveContents(content_length);
+    }
   }
 
   // Shortcut for bailing out early when the response will be too large.
@@ -231,13 +338,17 @@ void InPlaceResourceRecorder::DoneAndSetHeaders(
     ConsiderResponseHeaders(kFullHeaders, response_headers);
   }
 
-  if (status_code_ == HttpStatus::kOK && resource_value_.contents_size() == 0) {
+  if (status_code_ == HttpStatus::kOK && recorded_bytes_ == 0) {
     // Ignore Empty 200 responses.
     // https://github.com/pagespeed/mod_pagespeed/issues/1050
     cache_->RememberFailure(url_, fragment_, kFetchStatusEmpty, handler_);
     failure_ = true;
   }
 
+  if (!failure_ && (spool_file_ != NULL) && !FinishSpooling()) {
+    failure_ = true;
+  }
+
   if (failure_) {
     num_failed_->Add(1);
   } else {
@@ -256,6 +367,18 @@ void InPlaceResourceRecorder::DoneAndSetHeaders(
       response_headers->RemoveAll(HttpAttributes::kContentEncoding);
     }
     response_headers->RemoveAll(HttpAttributes::kContentLength);
+    // Make the changes HTTPCache::Put would make to the headers, so that it
+    // doesn't have to copy resource_value_ to make them.
+    response_headers->Sanitize();
+    if (response_headers->Lookup1(HttpAttributes::kEtag) == NULL) {
+      // Without an incremental hash we hash the contents once here, as Put
+      // otherwise would.
+      GoogleString hash = (contents_hash_.get() != NULL)
+          ? contents_hash_->Hash()
+          : cache_->hasher()->Hash(contents);
+      response_headers->Add(HttpAttributes::kEtag,
+                            HTTPCache::FormatEtag(hash));
+    }
     resource_value_.SetHeaders(response_headers);
     cache_->Put(url_, fragment_, request_properties_, http_options_,
                 &resource_value_, handler_);
@@ -23,6 +23,9 @@
 #include "net/instaweb/http/public/request_context.h"
 #include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/hasher.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/writer.h"
@@ -40,6 +43,13 @@ class Variable;
 // Records a copy of a resource streamed through it and saves the result to
 // the cache if it's cacheable. Used in the In-Place Resource Optimization
 // (IPRO) flow to get resources into the cache.
+//
+// The resource is written into the HTTPValue that is put in the cache, or,
+// once EnableSpooling's threshold is passed, streamed to a temporary file
+// that is only read back when the complete resource goes into the cache.
+// Either way the resource is hashed as it arrives, when the cache's hasher
+// can do that, for the ETag HTTPCache would otherwise compute from it, so
+// HTTPCache::Put stores the recorded value as it is.
 class InPlaceResourceRecorder : public Writer {
  public:
   enum HeadersKind {
@@ -67,12 +77,20 @@ class InPlaceResourceRecorder : public Writer {
 
   static void InitStats(Statistics* statistics);
 
+  // Spools the recording to a temporary file in spool_dir once more than
+  // threshold_bytes have been recorded, so that a recording in progress holds
+  // at most that much in memory however large the resource is.  Must be
+  // called before ConsiderResponseHeaders.  Does not take ownership of
+  // file_system.
+  void EnableSpooling(FileSystem* file_system, StringPiece spool_dir,
+                      int64 threshold_bytes);
+
   // These take a handler for compatibility with the Writer API, but the handler
   // is not used.
   virtual bool Write(const StringPiece& contents, MessageHandler* handler);
 
-  // Flush is a no-op because we have to buffer up the whole contents before
-  // writing to cache.
+  // Flush is a no-op because the cache takes the whole contents at once, and
+  // spooled contents are only read back once the recording is complete.
   virtual bool Flush(MessageHandler* handler) { return true; }
 
   // Sometimes the response headers prohibit IPRO:
@@ -128,15 +146,46 @@ class InPlaceResourceRecorder : public Writer {
 
   const HttpOptions& http_options() const { return http_options_; }
 
+  // Prefix of the names of the temporary files recordings are spooled to.
+  static const char kSpoolFilePrefix[];
+  // A reasonable threshold for EnableSpooling: most resources are smaller,
+  // and never touch the disk.
+  static const int64 kDefaultSpoolThresholdBytes = 64 * 1024;
+
  private:
-  class HTTPValueFetch : public AsyncFetchUsingWriter {
+  // Passes the (inflated) contents on to RecordContents.
+  class RecordingFetch : public AsyncFetch {
    public:
-    HTTPValueFetch(const RequestContextPtr& request_context, HTTPValue* value)
-        : AsyncFetchUsingWriter(request_context, value) {}
+    RecordingFetch(const RequestContextPtr& request_context,
+                   InPlaceResourceRecorder* recorder)
+        : AsyncFetch(request_context),
+          recorder_(recorder) {}
     virtual void HandleDone(bool /*ok*/) {}
     virtual void HandleHeadersComplete() {}
+
+   protected:
+    virtual bool HandleWrite(const StringPiece& sp, MessageHandler* handler) {
+      return recorder_->RecordContents(sp);
+    }
+    virtual bool HandleFlush(MessageHandler* handler) { return true; }
+
+   private:
+    InPlaceResourceRecorder* recorder_;
   };
 
+  // Hashes 'contents' and appends it to resource_value_ or the spool file.
+  bool RecordContents(StringPiece contents);
+
+  // Moves what has been recorded so far out of resource_value_ and into a
+  // new spool file.
+  bool StartSpooling();
+
+  // Reads the spool file back into resource_value_.
+  bool FinishSpooling();
+
+  // Closes and removes any spool file.
+  void DiscardSpool();
+
   bool IsIproContentType(ResponseHeaders* response_headers);
 
   void DroppedDueToSize();
@@ -151,9 +200,24 @@ class InPlaceResourceRecorder : public Writer {
   const int max_concurrent_recordings_;
 
   HTTPValue resource_value_;
-  HTTPValueFetch write_to_resource_value_;
+  // Number of (inflated) bytes recorded, whether in resource_value_ or the
+  // spool file.
+  int64 recorded_bytes_;
+  // Hash of the recorded contents, with HTTPCache's hasher, or NULL if it
+  // can only hash all at once.
+  scoped_ptr<Hasher::Incremental> contents_hash_;
+  RecordingFetch recording_fetch_;
   InflatingFetch inflating_fetch_;
 
+  // Spooling is enabled when spool_file_system_ is non-NULL.  spool_file_ is
+  // non-NULL while we are writing to spool_path_, which is non-empty for as
+  // long as that file exists.
+  FileSystem* spool_file_system_;
+  GoogleString spool_path_prefix_;
+  int64 spool_threshold_bytes_;
+  FileSystem::OutputFile* spool_file_;
+  GoogleString spool_path_;
+
   HTTPCache* cache_;
   MessageHandler* handler_;
 
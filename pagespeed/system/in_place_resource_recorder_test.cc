@@ -25,6 +25,7 @@
 #include "net/instaweb/rewriter/public/rewrite_test_base.h"
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -172,6 +173,114 @@ TEST_F(InPlaceResourceRecorderTest, BasicOperation) {
   EXPECT_EQ(StrCat(kHello, kBye), contents);
 }
 
+TEST_F(InPlaceResourceRecorderTest, EtagFromRecordedContents) {
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+  ok_headers.RemoveAll(HttpAttributes::kEtag);
+  ok_headers.Add(HttpAttributes::kSetCookie, "a=b");
+  ok_headers.Add(HttpAttributes::kContentLength,
+                 IntegerToString(STATIC_STRLEN(kHello) + STATIC_STRLEN(kBye)));
+  ok_headers.ComputeCaching();
+
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kFullHeaders, &ok_headers);
+  recorder->Write(kHello, message_handler());
+  recorder->Write(kBye, message_handler());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, true /* complete response */);
+
+  // The recorder makes the header changes HTTPCache would, including the
+  // ETag.  The test hasher can't hash incrementally, so this checks that the
+  // recorder hashes the complete contents instead.
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(kFoundResult,
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+  StringPiece contents;
+  EXPECT_TRUE(value_out.ExtractContents(&contents));
+  EXPECT_EQ(StrCat(kHello, kBye), contents);
+  EXPECT_STREQ(HTTPCache::FormatEtag(
+                   http_cache()->hasher()->Hash(StrCat(kHello, kBye))),
+               headers_out.Lookup1(HttpAttributes::kEtag));
+  EXPECT_FALSE(headers_out.Has(HttpAttributes::kSetCookie));
+}
+
+TEST_F(InPlaceResourceRecorderTest, SpoolsLargeRecordings) {
+  UseMd5Hasher();
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+  ok_headers.RemoveAll(HttpAttributes::kEtag);
+  ok_headers.ComputeCaching();
+  file_system()->ClearStats();
+
+  // Spool once more than kHello has been recorded.
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->EnableSpooling(file_system(), GTestTempDir(),
+                           STATIC_STRLEN(kHello));
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kFullHeaders, &ok_headers);
+  recorder->Write(kHello, message_handler());
+  EXPECT_EQ(0, file_system()->num_temp_file_opens());
+  recorder->Write(kBye, message_handler());
+  EXPECT_EQ(1, file_system()->num_temp_file_opens());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, true /* complete response */);
+
+  // The spooled contents are read back and hashed as they were written.
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(kFoundResult,
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+  StringPiece contents;
+  EXPECT_TRUE(value_out.ExtractContents(&contents));
+  EXPECT_EQ(StrCat(kHello, kBye), contents);
+  EXPECT_STREQ(HTTPCache::FormatEtag(
+                   http_cache()->hasher()->Hash(StrCat(kHello, kBye))),
+               headers_out.Lookup1(HttpAttributes::kEtag));
+}
+
+TEST_F(InPlaceResourceRecorderTest, SmallRecordingsNotSpooled) {
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+  file_system()->ClearStats();
+
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->EnableSpooling(
+      file_system(), GTestTempDir(),
+      InPlaceResourceRecorder::kDefaultSpoolThresholdBytes);
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kFullHeaders, &ok_headers);
+  recorder->Write(kHello, message_handler());
+  recorder->Write(kBye, message_handler());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, true /* complete response */);
+
+  EXPECT_EQ(0, file_system()->num_temp_file_opens());
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(kFoundResult,
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+}
+
+TEST_F(InPlaceResourceRecorderTest, IncompleteSpooledResponse) {
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->EnableSpooling(file_system(), GTestTempDir(), 1);
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kFullHeaders, &ok_headers);
+  recorder->Write(kHello, message_handler());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, false /* incomplete response */);
+
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(kNotFoundResult,
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+}
+
 TEST_F(InPlaceResourceRecorderTest, IncompleteResponse) {
   ResponseHeaders prelim_headers;
   prelim_headers.set_status_code(HttpStatus::kOK);
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/ketama_ring.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Each 16-byte MD5 digest yields 4 ring points.
+const int kPointsPerDigest = 4;
+
+}  // namespace
+
+const int KetamaRing::kPointsPerServer;
+
+KetamaRing::KetamaRing() {
+}
+
+KetamaRing::~KetamaRing() {
+}
+
+uint32 KetamaRing::DigestWord(const GoogleString& digest, int word) const {
+  DCHECK_GE(digest.size(), 4u * (word + 1));
+  const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(digest.data()) + 4 * word;
+  // Little-endian, as in the reference ketama implementation.
+  return (static_cast<uint32>(p[3]) << 24) |
+      (static_cast<uint32>(p[2]) << 16) |
+      (static_cast<uint32>(p[1]) << 8) |
+      static_cast<uint32>(p[0]);
+}
+
+void KetamaRing::Build(const StringVector& server_names) {
+  points_.clear();
+  points_.reserve(server_names.size() * kPointsPerServer);
+  for (int server = 0, n = server_names.size(); server < n; ++server) {
+    for (int i = 0; i < kPointsPerServer / kPointsPerDigest; ++i) {
+      GoogleString digest = md5_hasher_.RawHash(
+          StrCat(server_names[server], "-", IntegerToString(i)));
+      for (int word = 0; word < kPointsPerDigest; ++word) {
+        points_.push_back(Point(DigestWord(digest, word), server));
+      }
+    }
+  }
+  std::sort(points_.begin(), points_.end());
+}
+
+uint32 KetamaRing::HashKey(StringPiece key) const {
+  return DigestWord(md5_hasher_.RawHash(key), 0);
+}
+
+int KetamaRing::ServerForKey(StringPiece key) const {
+  if (points_.empty()) {
+    return -1;
+  }
+  // Find the first point at or after the key's hash, wrapping around the
+  // ring.  Pairing with the smallest server index makes ties deterministic.
+  std::vector<Point>::const_iterator p = std::lower_bound(
+      points_.begin(), points_.end(), Point(HashKey(key), 0));
+  if (p == points_.end()) {
+    p = points_.begin();
+  }
+  return p->second;
+}
+
+}  // namespace net_instaweb
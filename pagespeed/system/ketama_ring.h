@@ -0,0 +1,70 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_KETAMA_RING_H_
+#define PAGESPEED_SYSTEM_KETAMA_RING_H_
+
+#include <utility>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Consistent hashing of keys onto a set of servers, compatible with the
+// ketama scheme used by libmemcached and other memcached clients.  Each
+// server is placed at kPointsPerServer pseudo-random points on a 32-bit
+// ring, derived from the MD5 of "<name>-<i>"; a key belongs to the server
+// owning the first point at or after the key's own hash.  Adding or
+// removing a server therefore only moves the keys adjacent to its points,
+// rather than reshuffling everything as hash-mod-N would.
+class KetamaRing {
+ public:
+  static const int kPointsPerServer = 160;
+
+  KetamaRing();
+  ~KetamaRing();
+
+  // Replaces the ring with one for the given servers, conventionally named
+  // "host:port".  ServerForKey returns indices into this vector.
+  void Build(const StringVector& server_names);
+
+  // Returns the index of the server owning the key, or -1 if the ring is
+  // empty.
+  int ServerForKey(StringPiece key) const;
+
+  // The position of a key on the ring.
+  uint32 HashKey(StringPiece key) const;
+
+  int num_points() const { return points_.size(); }
+
+ private:
+  // (ring position, server index), sorted by position.
+  typedef std::pair<uint32, int> Point;
+
+  uint32 DigestWord(const GoogleString& digest, int word) const;
+
+  MD5Hasher md5_hasher_;
+  std::vector<Point> points_;
+
+  DISALLOW_COPY_AND_ASSIGN(KetamaRing);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_KETAMA_RING_H_
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the ketama consistent-hashing ring.
+
+#include "pagespeed/system/ketama_ring.h"
+
+#include <vector>
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumKeys = 10000;
+
+class KetamaRingTest : public testing::Test {
+ protected:
+  void BuildRing(int num_servers) {
+    StringVector names;
+    for (int i = 0; i < num_servers; ++i) {
+      names.push_back(StrCat("10.0.0.", IntegerToString(i + 1), ":11211"));
+    }
+    ring_.Build(names);
+  }
+
+  GoogleString Key(int i) {
+    return StrCat("http://example.com/", IntegerToString(i));
+  }
+
+  KetamaRing ring_;
+};
+
+TEST_F(KetamaRingTest, EmptyRing) {
+  EXPECT_EQ(-1, ring_.ServerForKey("a"));
+  BuildRing(1);
+  EXPECT_EQ(KetamaRing::kPointsPerServer, ring_.num_points());
+  EXPECT_EQ(0, ring_.ServerForKey("a"));
+}
+
+TEST_F(KetamaRingTest, Balanced) {
+  const int kNumServers = 4;
+  BuildRing(kNumServers);
+  std::vector<int> counts(kNumServers, 0);
+  for (int i = 0; i < kNumKeys; ++i) {
+    int server = ring_.ServerForKey(Key(i));
+    ASSERT_LE(0, server);
+    ASSERT_GT(kNumServers, server);
+    ++counts[server];
+  }
+  for (int i = 0; i < kNumServers; ++i) {
+    EXPECT_LT(kNumKeys / 8, counts[i]) << i;
+    EXPECT_GT(kNumKeys / 2, counts[i]) << i;
+  }
+}
+
+TEST_F(KetamaRingTest, AddingServerMovesFewKeys) {
+  BuildRing(4);
+  std::vector<int> before;
+  for (int i = 0; i < kNumKeys; ++i) {
+    before.push_back(ring_.ServerForKey(Key(i)));
+  }
+  BuildRing(5);
+  int moved = 0;
+  for (int i = 0; i < kNumKeys; ++i) {
+    int server = ring_.ServerForKey(Key(i));
+    if (server != before[i]) {
+      // Keys only ever move to the new server.
+      EXPECT_EQ(4, server);
+      ++moved;
+    }
+  }
+  // About a fifth of the keys should move; hash-mod-N would move 80%.
+  EXPECT_LT(kNumKeys / 10, moved);
+  EXPECT_GT(kNumKeys / 3, moved);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/memcached_binary_protocol.h"
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace memcached_binary {
+
+namespace {
+
+void AppendBigEndian(uint64 value, int num_bytes, GoogleString* out) {
+  for (int shift = 8 * (num_bytes - 1); shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+uint64 ReadBigEndian(const char* data, int num_bytes) {
+  uint64 value = 0;
+  for (int i = 0; i < num_bytes; ++i) {
+    value = (value << 8) | static_cast<uint8>(data[i]);
+  }
+  return value;
+}
+
+}  // namespace
+
+void AppendPacket(uint8 magic, uint8 opcode, uint16 status, uint32 opaque,
+                  StringPiece extras, StringPiece key, StringPiece value,
+                  GoogleString* out) {
+  DCHECK_LE(extras.size(), 0xffu);
+  DCHECK_LE(key.size(), 0xffffu);
+  size_t body_length = extras.size() + key.size() + value.size();
+  out->reserve(out->size() + kHeaderSize + body_length);
+  out->push_back(static_cast<char>(magic));
+  out->push_back(static_cast<char>(opcode));
+  AppendBigEndian(key.size(), 2, out);
+  out->push_back(static_cast<char>(extras.size()));
+  out->push_back(0);  // data type: raw bytes.
+  AppendBigEndian(status, 2, out);
+  AppendBigEndian(body_length, 4, out);
+  AppendBigEndian(opaque, 4, out);
+  AppendBigEndian(0, 8, out);  // cas
+  extras.AppendToString(out);
+  key.AppendToString(out);
+  value.AppendToString(out);
+}
+
+void AppendGetQ(StringPiece key, uint32 opaque, GoogleString* out) {
+  AppendPacket(kRequestMagic, kGetQ, 0, opaque, StringPiece(), key,
+               StringPiece(), out);
+}
+
+void AppendSet(StringPiece key, StringPiece value, uint32 opaque,
+               GoogleString* out) {
+  // 4 bytes of flags and 4 bytes of expiration time, all zero.
+  static const char kSetExtras[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  AppendPacket(kRequestMagic, kSet, 0, opaque,
+               StringPiece(kSetExtras, sizeof(kSetExtras)), key, value, out);
+}
+
+void AppendDelete(StringPiece key, uint32 opaque, GoogleString* out) {
+  AppendPacket(kRequestMagic, kDelete, 0, opaque, StringPiece(), key,
+               StringPiece(), out);
+}
+
+void AppendNoop(uint32 opaque, GoogleString* out) {
+  AppendPacket(kRequestMagic, kNoop, 0, opaque, StringPiece(), StringPiece(),
+               StringPiece(), out);
+}
+
+bool ParseHeader(StringPiece data, Header* header) {
+  DCHECK_GE(data.size(), kHeaderSize);
+  const char* p = data.data();
+  header->magic = static_cast<uint8>(p[0]);
+  header->opcode = static_cast<uint8>(p[1]);
+  header->key_length = ReadBigEndian(p + 2, 2);
+  header->extras_length = static_cast<uint8>(p[4]);
+  header->data_type = static_cast<uint8>(p[5]);
+  header->status = ReadBigEndian(p + 6, 2);
+  header->body_length = ReadBigEndian(p + 8, 4);
+  header->opaque = ReadBigEndian(p + 12, 4);
+  header->cas = ReadBigEndian(p + 16, 8);
+  return (static_cast<uint64>(header->extras_length) + header->key_length <=
+          header->body_length);
+}
+
+StringPiece Extras(const Header& header, StringPiece body) {
+  return body.substr(0, header.extras_length);
+}
+
+StringPiece Key(const Header& header, StringPiece body) {
+  return body.substr(header.extras_length, header.key_length);
+}
+
+StringPiece Value(const Header& header, StringPiece body) {
+  return body.substr(header.extras_length + header.key_length);
+}
+
+}  // namespace memcached_binary
+
+}  // namespace net_instaweb
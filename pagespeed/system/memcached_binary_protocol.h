@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_MEMCACHED_BINARY_PROTOCOL_H_
+#define PAGESPEED_SYSTEM_MEMCACHED_BINARY_PROTOCOL_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Framing for the memcached binary protocol, as described in
+// https://github.com/memcached/memcached/wiki/BinaryProtocolRevamped.
+//
+// Every packet is a 24-byte header followed by a body consisting of, in
+// order, the extras, the key, and the value.  All multi-byte header fields
+// are in network byte order.
+namespace memcached_binary {
+
+const size_t kHeaderSize = 24;
+
+const uint8 kRequestMagic = 0x80;
+const uint8 kResponseMagic = 0x81;
+
+// The subset of opcodes we use.  The "quiet" variants (GetQ) send no
+// response on a miss, so a batch of them is terminated with a Noop: once
+// the Noop's response arrives, every earlier GetQ with no response missed.
+enum Opcode {
+  kGet = 0x00,
+  kSet = 0x01,
+  kDelete = 0x04,
+  kGetQ = 0x09,
+  kNoop = 0x0a,
+};
+
+enum Status {
+  kNoError = 0x0000,
+  kKeyNotFound = 0x0001,
+  kKeyExists = 0x0002,
+  kValueTooLarge = 0x0003,
+  kInvalidArguments = 0x0004,
+  kItemNotStored = 0x0005,
+  kUnknownCommand = 0x0081,
+  kOutOfMemory = 0x0082,
+};
+
+struct Header {
+  uint8 magic;
+  uint8 opcode;
+  uint16 key_length;
+  uint8 extras_length;
+  uint8 data_type;
+  uint16 status;  // The vbucket id in requests.
+  uint32 body_length;
+  uint32 opaque;
+  uint64 cas;
+};
+
+// Appends a complete packet to *out.
+void AppendPacket(uint8 magic, uint8 opcode, uint16 status, uint32 opaque,
+                  StringPiece extras, StringPiece key, StringPiece value,
+                  GoogleString* out);
+
+// Convenience wrappers for the requests we issue.  Sets are stored with no
+// flags and no expiration.
+void AppendGetQ(StringPiece key, uint32 opaque, GoogleString* out);
+void AppendSet(StringPiece key, StringPiece value, uint32 opaque,
+               GoogleString* out);
+void AppendDelete(StringPiece key, uint32 opaque, GoogleString* out);
+void AppendNoop(uint32 opaque, GoogleString* out);
+
+// Decodes the header at the front of 'data', which must hold at least
+// kHeaderSize bytes.  Returns false if the header is inconsistent, i.e. its
+// extras and key don't fit in its body.  The magic is not checked.
+bool ParseHeader(StringPiece data, Header* header);
+
+// Splits the body following 'header' into its parts.  'body' must be
+// exactly header.body_length bytes.
+StringPiece Extras(const Header& header, StringPiece body);
+StringPiece Key(const Header& header, StringPiece body);
+StringPiece Value(const Header& header, StringPiece body);
+
+}  // namespace memcached_binary
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_MEMCACHED_BINARY_PROTOCOL_H_
@@ -0,0 +1,706 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/redis_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kDefaultRedisPort = 6379;
+const char kRedisTimeouts[] = "redis_timeouts";
+const char kRedisRedirections[] = "redis_cluster_redirections";
+const char kLastErrorCheckpointMs[] = "redis_last_error_checkpoint_ms";
+const char kErrorBurstSize[] = "redis_error_burst_size";
+
+const size_t kReadChunkSize = 64 * 1024;
+
+// Splits "host:port", where the host may itself contain colons (IPv6).
+bool ParseHostPort(StringPiece spec, GoogleString* host, int* port) {
+  size_t colon = spec.rfind(':');
+  if (colon == StringPiece::npos) {
+    spec.CopyToString(host);
+    *port = kDefaultRedisPort;
+    return !host->empty();
+  }
+  spec.substr(0, colon).CopyToString(host);
+  return StringToInt(spec.substr(colon + 1).as_string(), port) &&
+      (*port > 0) && (*port < 65536);
+}
+
+}  // namespace
+
+const size_t RedisCache::kValueSizeThreshold;
+const int64 RedisCache::kHealthCheckpointIntervalMs;
+const int64 RedisCache::kMaxErrorBurst;
+const int64 RedisCache::kDefaultTimeoutUs;
+const int RedisCache::kMaxRedirections;
+
+struct RedisCache::Node {
+  Node(const GoogleString& host_in, int port_in, ThreadSystem* thread_system)
+      : host(host_in),
+        port(port_in),
+        name(StrCat(host_in, ":", IntegerToString(port_in))),
+        mutex(thread_system->NewMutex()),
+        fd(-1) {
+  }
+
+  const GoogleString host;
+  const int port;
+  const GoogleString name;
+
+  // Held for the whole of each exchange with the node, so that replies
+  // are read by the thread that sent the commands.
+  scoped_ptr<AbstractMutex> mutex;
+  int fd GUARDED_BY(mutex);
+};
+
+RedisCache::RedisCache(const StringPiece& servers, bool cluster, int ttl_sec,
+                       Statistics* statistics, Timer* timer,
+                       ThreadSystem* thread_system, MessageHandler* handler)
+    : valid_server_spec_(false),
+      cluster_(cluster),
+      timeout_us_(kDefaultTimeoutUs),
+      timer_(timer),
+      thread_system_(thread_system),
+      nodes_mutex_(thread_system->NewMutex()),
+      slots_(resp::kNumClusterSlots, static_cast<Node*>(NULL)),
+      slots_fetched_(false),
+      timeouts_(statistics->GetVariable(kRedisTimeouts)),
+      redirections_(statistics->GetVariable(kRedisRedirections)),
+      last_error_checkpoint_ms_(statistics->GetUpDownCounter(
+          kLastErrorCheckpointMs)),
+      error_burst_size_(statistics->GetUpDownCounter(kErrorBurstSize)),
+      message_handler_(handler) {
+  if (ttl_sec > 0) {
+    ttl_sec_ = IntegerToString(ttl_sec);
+  }
+  servers.CopyToString(&server_spec_);
+  StringPieceVector server_vector;
+  SplitStringPieceToVector(servers, ",", &server_vector, true);
+  bool success = true;
+  for (int i = 0, n = server_vector.size(); i < n; ++i) {
+    GoogleString host;
+    int port;
+    StringPiece server = server_vector[i];
+    TrimWhitespace(&server);
+    if (ParseHostPort(server, &host, &port)) {
+      FindOrAddNode(host, port);
+    } else {
+      message_handler_->Message(kError, "Invalid redis server: %s",
+                                server.as_string().c_str());
+      success = false;
+    }
+  }
+  if (!cluster_ && (server_vector.size() > 1)) {
+    message_handler_->Message(
+        kError, "Multiple redis servers (%s) need cluster mode",
+        server_spec_.c_str());
+    success = false;
+  }
+  valid_server_spec_ = success && !server_vector.empty();
+}
+
+RedisCache::~RedisCache() {
+  ShutDown();
+  STLDeleteElements(&nodes_);
+}
+
+void RedisCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kRedisTimeouts);
+  statistics->AddVariable(kRedisRedirections);
+  statistics->AddUpDownCounter(kLastErrorCheckpointMs);
+  statistics->AddUpDownCounter(kErrorBurstSize);
+}
+
+bool RedisCache::Connect() {
+  if (!valid_server_spec_) {
+    return false;
+  }
+  std::vector<Node*> nodes;
+  {
+    ScopedMutex lock(nodes_mutex_.get());
+    nodes = nodes_;
+  }
+  for (int i = 0, n = nodes.size(); i < n; ++i) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    int error = getaddrinfo(nodes[i]->host.c_str(),
+                            IntegerToString(nodes[i]->port).c_str(),
+                            &hints, &result);
+    if ((error != 0) || (result == NULL)) {
+      message_handler_->Message(
+          kError, "Failed to resolve redis server %s: %s",
+          nodes[i]->name.c_str(), gai_strerror(error));
+      return false;
+    }
+    freeaddrinfo(result);
+  }
+  return true;
+}
+
+void RedisCache::set_timeout_us(int timeout_us) {
+  timeout_us_ = (timeout_us > 0) ? timeout_us : kDefaultTimeoutUs;
+}
+
+bool RedisCache::OpenConnection(Node* node) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = NULL;
+  if (getaddrinfo(node->host.c_str(), IntegerToString(node->port).c_str(),
+                  &hints, &result) != 0) {
+    return false;
+  }
+  int timeout_ms = std::max(static_cast<int64>(1), timeout_us_ / 1000);
+  for (addrinfo* address = result; address != NULL;
+       address = address->ai_next) {
+    int fd = socket(address->ai_family,
+                    address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    // Connect without blocking, so that an unreachable host costs at most
+    // one timeout.
+    bool connected =
+        (connect(fd, address->ai_addr, address->ai_addrlen) == 0);
+    if (!connected && (errno == EINPROGRESS)) {
+      pollfd poll_fd;
+      poll_fd.fd = fd;
+      poll_fd.events = POLLOUT;
+      int error = 0;
+      socklen_t length = sizeof(error);
+      connected =
+          (poll(&poll_fd, 1, timeout_ms) == 1) &&
+          (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0) &&
+          (error == 0);
+    }
+    if (connected) {
+      // From here on, I/O blocks, bounded by the timeout.
+      timeval timeout;
+      timeout.tv_sec = timeout_us_ / Timer::kSecondUs;
+      timeout.tv_usec = timeout_us_ % Timer::kSecondUs;
+      int one = 1;
+      connected =
+          (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == 0) &&
+          (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                      sizeof(timeout)) == 0) &&
+          (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                      sizeof(timeout)) == 0) &&
+          (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0);
+    }
+    if (connected) {
+      node->fd = fd;
+      break;
+    }
+    close(fd);
+  }
+  freeaddrinfo(result);
+  return node->fd >= 0;
+}
+
+void RedisCache::CloseConnection(Node* node) {
+  if (node->fd >= 0) {
+    close(node->fd);
+    node->fd = -1;
+  }
+}
+
+void RedisCache::FailConnection(Node* node, const char* reason) {
+  message_handler_->Message(kError, "RedisCache: %s on connection to %s",
+                            reason, node->name.c_str());
+  CloseConnection(node);
+  RecordError();
+}
+
+bool RedisCache::Execute(Node* node, const GoogleString& request,
+                         int num_replies, std::vector<resp::Reply>* replies) {
+  ScopedMutex lock(node->mutex.get());
+  if (shutdown_.value()) {
+    return false;
+  }
+  if ((node->fd < 0) && !OpenConnection(node)) {
+    message_handler_->Message(kError, "RedisCache: cannot connect to %s",
+                              node->name.c_str());
+    RecordError();
+    return false;
+  }
+
+  for (size_t written = 0; written < request.size(); ) {
+    ssize_t bytes = send(node->fd, request.data() + written,
+                         request.size() - written, MSG_NOSIGNAL);
+    if (bytes > 0) {
+      written += bytes;
+    } else if ((bytes < 0) && (errno == EINTR)) {
+      continue;
+    } else {
+      if ((bytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        timeouts_->Add(1);
+      }
+      FailConnection(node, "write failed");
+      return false;
+    }
+  }
+
+  // Read until all the replies have arrived, then parse them in one go.
+  GoogleString buffer;
+  size_t complete = 0;  // Bytes of buffer holding complete replies.
+  int num_complete = 0;
+  while (num_complete < num_replies) {
+    size_t consumed;
+    resp::ParseResult result = resp::ParseReply(
+        StringPiece(buffer).substr(complete), NULL, &consumed);
+    if (result == resp::kParseOk) {
+      complete += consumed;
+      ++num_complete;
+      continue;
+    } else if (result == resp::kParseError) {
+      FailConnection(node, "protocol error");
+      return false;
+    }
+    size_t old_size = buffer.size();
+    buffer.resize(old_size + kReadChunkSize);
+    ssize_t bytes = recv(node->fd, &buffer[old_size], kReadChunkSize, 0);
+    if (bytes > 0) {
+      buffer.resize(old_size + bytes);
+    } else if ((bytes < 0) && (errno == EINTR)) {
+      buffer.resize(old_size);
+    } else {
+      if ((bytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        timeouts_->Add(1);
+        FailConnection(node, "timeout");
+      } else {
+        FailConnection(node, (bytes == 0) ? "connection closed" :
+                       "read failed");
+      }
+      return false;
+    }
+  }
+  if (complete != buffer.size()) {
+    FailConnection(node, "unexpected data");
+    return false;
+  }
+
+  replies->clear();
+  replies->resize(num_replies);
+  StringPiece input(buffer);
+  for (int i = 0; i < num_replies; ++i) {
+    size_t consumed;
+    CHECK_EQ(resp::kParseOk,
+             resp::ParseReply(input, &(*replies)[i], &consumed));
+    input.remove_prefix(consumed);
+  }
+  return true;
+}
+
+RedisCache::Node* RedisCache::FindOrAddNode(const GoogleString& host,
+                                            int port) {
+  GoogleString name = StrCat(host, ":", IntegerToString(port));
+  ScopedMutex lock(nodes_mutex_.get());
+  std::map<GoogleString, Node*>::iterator p = nodes_by_name_.find(name);
+  if (p != nodes_by_name_.end()) {
+    return p->second;
+  }
+  Node* node = new Node(host, port, thread_system_);
+  nodes_.push_back(node);
+  nodes_by_name_[name] = node;
+  return node;
+}
+
+RedisCache::Node* RedisCache::NodeForKey(StringPiece key) {
+  if (cluster_) {
+    bool fetch_slots;
+    {
+      ScopedMutex lock(nodes_mutex_.get());
+      fetch_slots = !slots_fetched_;
+      slots_fetched_ = true;
+    }
+    if (fetch_slots) {
+      RefreshSlots();
+    }
+  }
+  ScopedMutex lock(nodes_mutex_.get());
+  Node* node = NULL;
+  if (cluster_) {
+    node = slots_[resp::KeyHashSlot(key)];
+  }
+  // Slots we know nothing about go to the first seed, which will redirect
+  // us if need be.
+  return (node != NULL) ? node : nodes_[0];
+}
+
+void RedisCache::RefreshSlots() {
+  std::vector<Node*> seeds;
+  {
+    ScopedMutex lock(nodes_mutex_.get());
+    seeds = nodes_;
+  }
+  GoogleString request;
+  StringPieceVector args;
+  args.push_back("CLUSTER");
+  args.push_back("SLOTS");
+  resp::AppendCommand(args, &request);
+  for (int i = 0, n = seeds.size(); i < n; ++i) {
+    std::vector<resp::Reply> replies;
+    if (!Execute(seeds[i], request, 1, &replies) ||
+        (replies[0].type != resp::Reply::kArray)) {
+      continue;
+    }
+    // Each element is [first slot, last slot, [master host, port, ...],
+    // replicas...].
+    const std::vector<resp::Reply>& ranges = replies[0].elements;
+    for (int j = 0, m = ranges.size(); j < m; ++j) {
+      const resp::Reply& range = ranges[j];
+      if ((range.type != resp::Reply::kArray) ||
+          (range.elements.size() < 3) ||
+          (range.elements[0].type != resp::Reply::kInteger) ||
+          (range.elements[1].type != resp::Reply::kInteger) ||
+          (range.elements[2].type != resp::Reply::kArray) ||
+          (range.elements[2].elements.size() < 2) ||
+          (range.elements[2].elements[1].type != resp::Reply::kInteger)) {
+        continue;
+      }
+      int64 first = std::max(static_cast<int64>(0), range.elements[0].integer);
+      int64 last = std::min(static_cast<int64>(resp::kNumClusterSlots - 1),
+                            range.elements[1].integer);
+      GoogleString host = range.elements[2].elements[0].str;
+      if (host.empty()) {
+        host = seeds[i]->host;
+      }
+      Node* master = FindOrAddNode(
+          host, static_cast<int>(range.elements[2].elements[1].integer));
+      ScopedMutex lock(nodes_mutex_.get());
+      for (int64 slot = first; slot <= last; ++slot) {
+        slots_[slot] = master;
+      }
+    }
+    return;
+  }
+  message_handler_->Message(
+      kWarning, "RedisCache: could not fetch cluster slots from %s; "
+      "relying on redirections", server_spec_.c_str());
+}
+
+bool RedisCache::HandleRedirection(const resp::Reply& reply, Node** node,
+                                   bool* asking) {
+  if (reply.type != resp::Reply::kError) {
+    return false;
+  }
+  // The error is "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>".
+  StringPieceVector fields;
+  SplitStringPieceToVector(reply.str, " ", &fields, true);
+  bool moved = (fields.size() == 3) && (fields[0] == "MOVED");
+  bool ask = (fields.size() == 3) && (fields[0] == "ASK");
+  int slot;
+  GoogleString host;
+  int port;
+  if ((!moved && !ask) ||
+      !StringToInt(fields[1].as_string(), &slot) ||
+      (slot < 0) || (slot >= resp::kNumClusterSlots) ||
+      !ParseHostPort(fields[2], &host, &port)) {
+    return false;
+  }
+  if (host.empty()) {
+    host = (*node)->host;
+  }
+  redirections_->Add(1);
+  *node = FindOrAddNode(host, port);
+  *asking = ask;
+  if (moved) {
+    ScopedMutex lock(nodes_mutex_.get());
+    slots_[slot] = *node;
+  }
+  return true;
+}
+
+bool RedisCache::ExecuteForKey(const StringPieceVector& args, StringPiece key,
+                               resp::Reply* reply) {
+  Node* node = NodeForKey(key);
+  bool asking = false;
+  for (int i = 0; i <= kMaxRedirections; ++i) {
+    GoogleString request;
+    int num_replies = 1;
+    if (asking) {
+      // An ASK redirection applies to the next command only.
+      StringPieceVector asking_args;
+      asking_args.push_back("ASKING");
+      resp::AppendCommand(asking_args, &request);
+      ++num_replies;
+    }
+    resp::AppendCommand(args, &request);
+    std::vector<resp::Reply> replies;
+    if (!Execute(node, request, num_replies, &replies)) {
+      return false;
+    }
+    std::swap(*reply, replies.back());
+    if (!cluster_ || !HandleRedirection(*reply, &node, &asking)) {
+      return true;
+    }
+  }
+  message_handler_->Message(kError, "RedisCache: too many redirections for %s",
+                            key.as_string().c_str());
+  return false;
+}
+
+void RedisCache::ReportGetReply(const GoogleString& key, resp::Reply* reply,
+                                Callback* callback) {
+  if (reply->type == resp::Reply::kBulkString) {
+    callback->value()->SwapWithString(&reply->str);
+    ValidateAndReportResult(key, CacheInterface::kAvailable, callback);
+    return;
+  }
+  if (reply->type != resp::Reply::kNil) {
+    message_handler_->Message(
+        kError, "RedisCache::Get unexpected reply on key %s: %s",
+        key.c_str(), reply->str.c_str());
+  }
+  ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+}
+
+void RedisCache::Get(const GoogleString& key, Callback* callback) {
+  if (!IsHealthy()) {
+    ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+    return;
+  }
+  StringPieceVector args;
+  args.push_back("GET");
+  args.push_back(key);
+  resp::Reply reply;
+  if (ExecuteForKey(args, key, &reply)) {
+    ReportGetReply(key, &reply, callback);
+  } else {
+    ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
+  }
+}
+
+void RedisCache::MultiGet(MultiGetRequest* request) {
+  if (!IsHealthy()) {
+    ReportMultiGetNotFound(request);
+    return;
+  }
+
+  // Without a cluster, a single MGET does the job.  In a cluster MGET only
+  // works when every key hashes to the same slot, so instead each node gets
+  // a pipelined run of GETs for its keys.
+  typedef std::map<Node*, std::vector<int> > KeysByNode;
+  KeysByNode keys_by_node;
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    Node* node = NodeForKey((*request)[i].key);
+    keys_by_node[node].push_back(i);
+  }
+  for (KeysByNode::iterator p = keys_by_node.begin(),
+           e = keys_by_node.end(); p != e; ++p) {
+    Node* node = p->first;
+    const std::vector<int>& indices = p->second;
+    GoogleString commands;
+    StringPieceVector args;
+    if (!cluster_) {
+      args.push_back("MGET");
+    }
+    for (int j = 0, m = indices.size(); j < m; ++j) {
+      const GoogleString& key = (*request)[indices[j]].key;
+      if (cluster_) {
+        args.clear();
+        args.push_back("GET");
+        args.push_back(key);
+        resp::AppendCommand(args, &commands);
+      } else {
+        args.push_back(key);
+      }
+    }
+    int num_replies = indices.size();
+    if (!cluster_) {
+      resp::AppendCommand(args, &commands);
+      num_replies = 1;
+    }
+
+    std::vector<resp::Reply> replies;
+    bool ok = Execute(node, commands, num_replies, &replies);
+    if (ok && !cluster_) {
+      // Unpack the MGET's array of values.
+      ok = (replies[0].type == resp::Reply::kArray) &&
+          (replies[0].elements.size() == indices.size());
+      if (ok) {
+        std::vector<resp::Reply> values;
+        values.swap(replies[0].elements);
+        replies.swap(values);
+      } else {
+        message_handler_->Message(
+            kError, "RedisCache::MultiGet unexpected reply for %d keys: %s",
+            static_cast<int>(indices.size()), replies[0].str.c_str());
+      }
+    }
+
+    for (int j = 0, m = indices.size(); j < m; ++j) {
+      KeyCallback* key_callback = &(*request)[indices[j]];
+      if (!ok) {
+        ValidateAndReportResult(key_callback->key, CacheInterface::kNotFound,
+                                key_callback->callback);
+        continue;
+      }
+      resp::Reply* reply = &replies[j];
+      Node* redirected_node = node;
+      bool asking;
+      if (cluster_ && HandleRedirection(*reply, &redirected_node, &asking)) {
+        // The slot has moved since we routed the key; retry it on its own,
+        // which also sends any remaining keys of that slot to the right
+        // node next time.
+        Get(key_callback->key, key_callback->callback);
+      } else {
+        ReportGetReply(key_callback->key, reply, key_callback->callback);
+      }
+    }
+  }
+  delete request;
+}
+
+void RedisCache::Put(const GoogleString& key, SharedString* value) {
+  if (!IsHealthy()) {
+    return;
+  }
+  StringPieceVector args;
+  args.push_back("SET");
+  args.push_back(key);
+  args.push_back(value->Value());
+  if (!ttl_sec_.empty()) {
+    args.push_back("EX");
+    args.push_back(ttl_sec_);
+  }
+  resp::Reply reply;
+  if (ExecuteForKey(args, key, &reply) &&
+      (reply.type != resp::Reply::kStatus)) {
+    message_handler_->Message(
+        kError, "RedisCache::Put error: %s on key %s, value-size %d",
+        reply.str.c_str(), key.c_str(), static_cast<int>(value->size()));
+  }
+}
+
+void RedisCache::Delete(const GoogleString& key) {
+  if (!IsHealthy()) {
+    return;
+  }
+  StringPieceVector args;
+  args.push_back("DEL");
+  args.push_back(key);
+  resp::Reply reply;
+  if (ExecuteForKey(args, key, &reply) &&
+      (reply.type != resp::Reply::kInteger)) {
+    message_handler_->Message(kError, "RedisCache::Delete error: %s on key %s",
+                              reply.str.c_str(), key.c_str());
+  }
+}
+
+bool RedisCache::GetStatus(GoogleString* buffer) {
+  std::vector<Node*> nodes;
+  {
+    ScopedMutex lock(nodes_mutex_.get());
+    nodes = nodes_;
+  }
+  GoogleString request;
+  StringPieceVector args;
+  args.push_back("INFO");
+  args.push_back("server");
+  resp::AppendCommand(args, &request);
+  bool ret = true;
+  for (int i = 0, n = nodes.size(); i < n; ++i) {
+    std::vector<resp::Reply> replies;
+    StrAppend(buffer, "\nRedis server ", nodes[i]->name, ":\n");
+    if (Execute(nodes[i], request, 1, &replies) &&
+        (replies[0].type == resp::Reply::kBulkString)) {
+      StrAppend(buffer, replies[0].str);
+    } else {
+      StrAppend(buffer, "unreachable\n");
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+void RedisCache::RecordError() {
+  // See AprMemCache::RecordError.
+  int64 time_ms = timer_->NowMs();
+  int64 last_error_checkpoint_ms = last_error_checkpoint_ms_->Get();
+  int64 delta_ms = time_ms - last_error_checkpoint_ms;
+  if (delta_ms > kHealthCheckpointIntervalMs) {
+    last_error_checkpoint_ms_->Set(time_ms);
+    error_burst_size_->Set(1);
+  } else {
+    error_burst_size_->Add(1);
+  }
+}
+
+bool RedisCache::IsHealthy() const {
+  if (shutdown_.value() || !valid_server_spec_) {
+    return false;
+  }
+  int64 time_ms = timer_->NowMs();
+  int64 last_error_checkpoint_ms = last_error_checkpoint_ms_->Get();
+  int64 delta_ms = time_ms - last_error_checkpoint_ms;
+  int64 error_burst_size = error_burst_size_->Get();
+
+  if (delta_ms > kHealthCheckpointIntervalMs) {
+    if (error_burst_size >= kMaxErrorBurst) {
+      message_handler_->Message(
+          kInfo, "RedisCache::IsHealthy error: Attempting to recover");
+    }
+    error_burst_size_->Set(0);
+    return true;
+  }
+  return error_burst_size < kMaxErrorBurst;
+}
+
+void RedisCache::ShutDown() {
+  shutdown_.set_value(true);
+  std::vector<Node*> nodes;
+  {
+    ScopedMutex lock(nodes_mutex_.get());
+    nodes = nodes_;
+  }
+  // Waits for any exchange in progress, which is bounded by the timeout.
+  for (int i = 0, n = nodes.size(); i < n; ++i) {
+    ScopedMutex lock(nodes[i]->mutex.get());
+    CloseConnection(nodes[i]);
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_REDIS_CACHE_H_
+#define PAGESPEED_SYSTEM_REDIS_CACHE_H_
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/system/resp_protocol.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+class SharedString;
+class Statistics;
+class ThreadSystem;
+class UpDownCounter;
+class Variable;
+
+// Interface to redis, or anything else speaking RESP, over plain sockets.
+//
+// Like AprMemCache this is a blocking implementation, suitable for
+// instantiating underneath an AsyncCache.  Each redis node gets one
+// connection, shared by all threads.  MultiGet is sent as a single MGET, or
+// in cluster mode as one pipelined run of GETs per node, so a batch of
+// lookups costs one round trip per node.
+//
+// In cluster mode the configured servers are only used as seeds: keys are
+// routed by hash slot, and the slot map is learned from CLUSTER SLOTS and
+// kept up to date by following MOVED and ASK redirections.
+class RedisCache : public CacheInterface {
+ public:
+  // Values beyond this size are best kept out of redis; see FallbackCache.
+  static const size_t kValueSizeThreshold = 1 * 1000 * 1000;
+
+  // See AprMemCache.
+  static const int64 kHealthCheckpointIntervalMs = 30 * Timer::kSecondMs;
+  static const int64 kMaxErrorBurst = 4;
+
+  // Used when set_timeout_us is not called with a positive value.
+  static const int64 kDefaultTimeoutUs = 500 * Timer::kMsUs;
+
+  // How many redirections we will follow for a single key before giving up.
+  static const int kMaxRedirections = 5;
+
+  // servers is a comma-separated list of host[:port], where port defaults
+  // to 6379.  Without cluster mode only a single server is allowed.
+  // Entries are written with a time-to-live of ttl_sec, or none if it is 0.
+  RedisCache(const StringPiece& servers, bool cluster, int ttl_sec,
+             Statistics* statistics, Timer* timer, ThreadSystem* thread_system,
+             MessageHandler* handler);
+  virtual ~RedisCache();
+
+  static void InitStats(Statistics* statistics);
+
+  const GoogleString& server_spec() const { return server_spec_; }
+
+  // Get, MultiGet, Put and Delete block until redis replies.
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void Delete(const GoogleString& key);
+  virtual void MultiGet(MultiGetRequest* request);
+
+  // Resolves the configured servers, returning false if any of them could
+  // not be.  Connections themselves are opened on first use.
+  bool Connect();
+
+  bool valid_server_spec() const { return valid_server_spec_; }
+
+  // Appends the state of each node's connection to *status_string,
+  // returning false if any node fails to answer PING.
+  bool GetStatus(GoogleString* status_string);
+
+  static GoogleString FormatName() { return "RedisCache"; }
+  virtual GoogleString Name() const { return FormatName(); }
+
+  virtual bool IsBlocking() const { return true; }
+
+  // Records in statistics that a system error occurred, helping it detect
+  // when it's unhealthy if they are too frequent.
+  void RecordError();
+
+  // Determines whether redis is healthy enough to attempt another
+  // operation.  As with AprMemCache, errors on any node count against all.
+  virtual bool IsHealthy() const;
+
+  // Closes all connections; later operations report misses.
+  virtual void ShutDown();
+
+  // Sets the connect and I/O timeout in microseconds.  This should be called
+  // at setup time and not while there are operations in flight.
+  void set_timeout_us(int timeout_us);
+
+ private:
+  struct Node;
+
+  // Sends 'request', which holds num_replies commands, to the node and
+  // reads the replies.  On failure the connection is closed and false is
+  // returned.
+  bool Execute(Node* node, const GoogleString& request, int num_replies,
+               std::vector<resp::Reply>* replies);
+
+  // Runs a single-key command, following cluster redirections.  Returns
+  // false if no usable reply was obtained.
+  bool ExecuteForKey(const StringPieceVector& args, StringPiece key,
+                     resp::Reply* reply);
+
+  // If reply is a MOVED or ASK error, points *node at its target, learning
+  // the slot's new owner for MOVED, and returns true.
+  bool HandleRedirection(const resp::Reply& reply, Node** node, bool* asking);
+
+  // These must be called with node->mutex held.
+  bool OpenConnection(Node* node);
+  void CloseConnection(Node* node);
+  void FailConnection(Node* node, const char* reason);
+
+  // Returns the node to send a key to.  In cluster mode the first call
+  // fetches the slot map.
+  Node* NodeForKey(StringPiece key);
+  Node* FindOrAddNode(const GoogleString& host, int port);
+  void RefreshSlots();
+
+  // Reports a GET reply to the callback, taking the value from *reply.
+  void ReportGetReply(const GoogleString& key, resp::Reply* reply,
+                      Callback* callback);
+
+  GoogleString server_spec_;
+  bool valid_server_spec_;
+  bool cluster_;
+  GoogleString ttl_sec_;  // Empty if entries do not expire.
+  int64 timeout_us_;
+  Timer* timer_;
+  ThreadSystem* thread_system_;
+  AtomicBool shutdown_;
+
+  // Nodes are added, in cluster mode, as redirections reveal them, but never
+  // removed, so Node pointers stay valid for the life of the cache.
+  scoped_ptr<AbstractMutex> nodes_mutex_;
+  std::vector<Node*> nodes_ GUARDED_BY(nodes_mutex_);
+  std::map<GoogleString, Node*> nodes_by_name_ GUARDED_BY(nodes_mutex_);
+  std::vector<Node*> slots_ GUARDED_BY(nodes_mutex_);  // NULL if unknown.
+  bool slots_fetched_ GUARDED_BY(nodes_mutex_);  // Even if it failed.
+
+  Variable* timeouts_;
+  Variable* redirections_;
+  UpDownCounter* last_error_checkpoint_ms_;
+  UpDownCounter* error_burst_size_;
+  MessageHandler* message_handler_;
+
+  DISALLOW_COPY_AND_ASSIGN(RedisCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_REDIS_CACHE_H_
@@ -0,0 +1,500 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the redis client against in-process fake redis servers.
+
+#include "pagespeed/system/redis_cache.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "pagespeed/system/resp_protocol.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// A single-threaded redis speaking just enough RESP for RedisCache,
+// listening on an ephemeral localhost port.  It can pose as a cluster node
+// that has handed all of its slots to another node.
+class FakeRedis : public ThreadSystem::Thread {
+ public:
+  explicit FakeRedis(ThreadSystem* thread_system)
+      : Thread(thread_system, "fake_redis", ThreadSystem::kJoinable),
+        mutex_(thread_system->NewMutex()),
+        listen_fd_(-1),
+        port_(0),
+        moved_to_port_(0),
+        ask_to_port_(0),
+        slots_port_(0),
+        num_key_commands_(0),
+        num_mgets_(0),
+        num_askings_(0) {
+  }
+
+  virtual ~FakeRedis() {
+    stop_.set_value(true);
+    Join();
+    for (int i = 0, n = clients_.size(); i < n; ++i) {
+      close(clients_[i].fd);
+    }
+    close(listen_fd_);
+  }
+
+  // Binds the listening socket and starts serving.
+  bool Listen() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if ((bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0) ||
+        (listen(listen_fd_, 16) != 0) ||
+        (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+                     &length) != 0)) {
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    return Start();
+  }
+
+  // When set, commands are read but never answered.
+  void set_unresponsive(bool x) { unresponsive_.set_value(x); }
+
+  // Answers every key command with a MOVED, or an ASK, to the given port.
+  void set_moved_to_port(int port) {
+    ScopedMutex lock(mutex_.get());
+    moved_to_port_ = port;
+  }
+  void set_ask_to_port(int port) {
+    ScopedMutex lock(mutex_.get());
+    ask_to_port_ = port;
+  }
+
+  // Answers CLUSTER SLOTS with every slot served by the given port, rather
+  // than with an error.
+  void set_slots_port(int port) {
+    ScopedMutex lock(mutex_.get());
+    slots_port_ = port;
+  }
+
+  int port() const { return port_; }
+
+  int num_entries() {
+    ScopedMutex lock(mutex_.get());
+    return store_.size();
+  }
+  int num_key_commands() {
+    ScopedMutex lock(mutex_.get());
+    return num_key_commands_;
+  }
+  int num_mgets() {
+    ScopedMutex lock(mutex_.get());
+    return num_mgets_;
+  }
+  int num_askings() {
+    ScopedMutex lock(mutex_.get());
+    return num_askings_;
+  }
+  GoogleString last_ttl() {
+    ScopedMutex lock(mutex_.get());
+    return last_ttl_;
+  }
+
+  virtual void Run() {
+    while (!stop_.value()) {
+      std::vector<pollfd> fds(1 + clients_.size());
+      fds[0].fd = listen_fd_;
+      fds[0].events = POLLIN;
+      for (int i = 0, n = clients_.size(); i < n; ++i) {
+        fds[i + 1].fd = clients_[i].fd;
+        fds[i + 1].events = POLLIN;
+      }
+      if (poll(&fds[0], fds.size(), 10 /* ms */) <= 0) {
+        continue;
+      }
+      if ((fds[0].revents & POLLIN) != 0) {
+        Client client;
+        client.fd = accept(listen_fd_, NULL, NULL);
+        client.asking = false;
+        clients_.push_back(client);
+      }
+      for (int i = fds.size() - 2; i >= 0; --i) {
+        if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) != 0 &&
+            !Serve(&clients_[i])) {
+          close(clients_[i].fd);
+          clients_.erase(clients_.begin() + i);
+        }
+      }
+    }
+  }
+
+ private:
+  struct Client {
+    int fd;
+    GoogleString input;
+    bool asking;
+  };
+
+  // Reads what's available from the client and answers every complete
+  // command.  Returns false when the client has gone away.
+  bool Serve(Client* client) {
+    char buf[4096];
+    ssize_t bytes = read(client->fd, buf, sizeof(buf));
+    if (bytes <= 0) {
+      return false;
+    }
+    client->input.append(buf, bytes);
+    GoogleString output;
+    StringPiece input(client->input);
+    // Commands are arrays of bulk strings, which parse like replies.
+    resp::Reply command;
+    size_t consumed;
+    while (resp::ParseReply(input, &command, &consumed) == resp::kParseOk) {
+      EXPECT_EQ(resp::Reply::kArray, command.type);
+      HandleCommand(command.elements, client, &output);
+      input.remove_prefix(consumed);
+    }
+    client->input = input.as_string();
+    if (!unresponsive_.value() && !output.empty()) {
+      EXPECT_EQ(static_cast<ssize_t>(output.size()),
+                write(client->fd, output.data(), output.size()));
+    }
+    return true;
+  }
+
+  void HandleCommand(const std::vector<resp::Reply>& args, Client* client,
+                     GoogleString* output) {
+    ASSERT_FALSE(args.empty());
+    const GoogleString& name = args[0].str;
+    ScopedMutex lock(mutex_.get());
+    bool asking = client->asking;
+    client->asking = false;
+    if (name == "ASKING") {
+      ++num_askings_;
+      client->asking = true;
+      StrAppend(output, "+OK\r\n");
+      return;
+    } else if (name == "INFO") {
+      StrAppend(output, "$18\r\nredis_version:fake\r\n");
+      return;
+    } else if (name == "CLUSTER") {
+      if (slots_port_ == 0) {
+        StrAppend(output, "-ERR This instance has cluster support disabled"
+                  "\r\n");
+      } else {
+        StrAppend(output, "*1\r\n*3\r\n:0\r\n:16383\r\n*2\r\n",
+                  "$9\r\n127.0.0.1\r\n:", IntegerToString(slots_port_),
+                  "\r\n");
+      }
+      return;
+    }
+
+    ASSERT_LE(2, args.size());
+    ++num_key_commands_;
+    int slot = resp::KeyHashSlot(args[1].str);
+    if (moved_to_port_ != 0) {
+      StrAppend(output, "-MOVED ", IntegerToString(slot), " 127.0.0.1:",
+                IntegerToString(moved_to_port_), "\r\n");
+      return;
+    }
+    if ((ask_to_port_ != 0) && !asking) {
+      StrAppend(output, "-ASK ", IntegerToString(slot), " 127.0.0.1:",
+                IntegerToString(ask_to_port_), "\r\n");
+      return;
+    }
+
+    if (name == "GET") {
+      AppendValue(args[1].str, output);
+    } else if (name == "MGET") {
+      ++num_mgets_;
+      StrAppend(output, "*", IntegerToString(args.size() - 1), "\r\n");
+      for (int i = 1, n = args.size(); i < n; ++i) {
+        AppendValue(args[i].str, output);
+      }
+    } else if (name == "SET") {
+      ASSERT_LE(3, args.size());
+      store_[args[1].str] = args[2].str;
+      last_ttl_.clear();
+      if (args.size() == 5) {
+        EXPECT_EQ("EX", args[3].str);
+        last_ttl_ = args[4].str;
+      }
+      StrAppend(output, "+OK\r\n");
+    } else if (name == "DEL") {
+      StrAppend(output, ":", IntegerToString(store_.erase(args[1].str)),
+                "\r\n");
+    } else {
+      StrAppend(output, "-ERR unknown command '", name, "'\r\n");
+    }
+  }
+
+  void AppendValue(const GoogleString& key, GoogleString* output) {
+    std::map<GoogleString, GoogleString>::iterator p = store_.find(key);
+    if (p == store_.end()) {
+      StrAppend(output, "$-1\r\n");
+    } else {
+      StrAppend(output, "$", IntegerToString(p->second.size()), "\r\n",
+                p->second, "\r\n");
+    }
+  }
+
+  scoped_ptr<AbstractMutex> mutex_;
+  int listen_fd_;
+  int port_;
+  AtomicBool stop_;
+  AtomicBool unresponsive_;
+  std::vector<Client> clients_;  // Only accessed by the server thread.
+  std::map<GoogleString, GoogleString> store_;
+  int moved_to_port_;
+  int ask_to_port_;
+  int slots_port_;
+  int num_key_commands_;
+  int num_mgets_;
+  int num_askings_;
+  GoogleString last_ttl_;
+
+  DISALLOW_COPY_AND_ASSIGN(FakeRedis);
+};
+
+class RedisCacheTest : public CacheTestBase {
+ protected:
+  RedisCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewTimer()),
+        statistics_(thread_system_.get()) {
+    RedisCache::InitStats(&statistics_);
+  }
+
+  ~RedisCacheTest() {
+    // Stop the cache before its servers go away.
+    cache_.reset(NULL);
+    STLDeleteElements(&servers_);
+  }
+
+  FakeRedis* StartServer() {
+    FakeRedis* server = new FakeRedis(thread_system_.get());
+    servers_.push_back(server);
+    EXPECT_TRUE(server->Listen());
+    return server;
+  }
+
+  GoogleString Spec(FakeRedis* server) {
+    return StrCat("127.0.0.1:", IntegerToString(server->port()));
+  }
+
+  void StartCache(const GoogleString& spec, bool cluster, int ttl_sec) {
+    cache_.reset(new RedisCache(spec, cluster, ttl_sec, &statistics_,
+                                timer_.get(), thread_system_.get(),
+                                &handler_));
+    cache_->set_timeout_us(200 * Timer::kMsUs);
+    ASSERT_TRUE(cache_->Connect());
+  }
+
+  int64 Redirections() {
+    return statistics_.GetVariable("redis_cluster_redirections")->Get();
+  }
+
+  virtual CacheInterface* Cache() { return cache_.get(); }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  SimpleStats statistics_;
+  NullMessageHandler handler_;
+  std::vector<FakeRedis*> servers_;
+  scoped_ptr<RedisCache> cache_;
+};
+
+TEST_F(RedisCacheTest, PutGetDelete) {
+  StartCache(Spec(StartServer()), false, 0);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+
+  // Values and keys are binary-safe.
+  GoogleString binary("a\r\n\0b", 5);
+  CheckPut(binary, binary);
+  CheckGet(binary, binary);
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  CheckDelete("Name");  // Deleting a missing key is not an error.
+  EXPECT_TRUE(cache_->IsHealthy());
+  EXPECT_EQ("", servers_[0]->last_ttl());
+}
+
+TEST_F(RedisCacheTest, Ttl) {
+  StartCache(Spec(StartServer()), false, 3600);
+  CheckPut("Name", "Value");
+  EXPECT_EQ("3600", servers_[0]->last_ttl());
+  CheckGet("Name", "Value");
+}
+
+TEST_F(RedisCacheTest, MultiGetIsOneMget) {
+  StartCache(Spec(StartServer()), false, 0);
+  TestMultiGet();  // Checks results for "n0", "not_found", and "n1".
+  EXPECT_EQ(1, servers_[0]->num_mgets());
+}
+
+TEST_F(RedisCacheTest, GetStatus) {
+  StartCache(Spec(StartServer()), false, 0);
+  GoogleString status;
+  EXPECT_TRUE(cache_->GetStatus(&status));
+  EXPECT_NE(GoogleString::npos, status.find("redis_version:fake")) << status;
+}
+
+TEST_F(RedisCacheTest, Timeout) {
+  StartCache(Spec(StartServer()), false, 0);
+  servers_[0]->set_unresponsive(true);
+  CheckNotFound("Name");
+  EXPECT_EQ(1, statistics_.GetVariable("redis_timeouts")->Get());
+
+  // The connection with the stray reply is not reused.
+  servers_[0]->set_unresponsive(false);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+}
+
+TEST_F(RedisCacheTest, UnhealthyWhenServerIsDown) {
+  // Grab a free port, then close it so that connections are refused.
+  FakeRedis* server = new FakeRedis(thread_system_.get());
+  ASSERT_TRUE(server->Listen());
+  GoogleString spec = Spec(server);
+  delete server;
+  StartCache(spec, false, 0);
+
+  for (int i = 0; i < RedisCache::kMaxErrorBurst; ++i) {
+    EXPECT_TRUE(cache_->IsHealthy());
+    CheckNotFound("Name");
+  }
+  EXPECT_FALSE(cache_->IsHealthy());
+}
+
+TEST_F(RedisCacheTest, MultipleServersNeedCluster) {
+  FakeRedis* server1 = StartServer();
+  FakeRedis* server2 = StartServer();
+  cache_.reset(new RedisCache(StrCat(Spec(server1), ",", Spec(server2)),
+                              false, 0, &statistics_, timer_.get(),
+                              thread_system_.get(), &handler_));
+  EXPECT_FALSE(cache_->valid_server_spec());
+  EXPECT_FALSE(cache_->Connect());
+  EXPECT_FALSE(cache_->IsHealthy());
+}
+
+TEST_F(RedisCacheTest, ClusterFollowsMoved) {
+  FakeRedis* seed = StartServer();
+  FakeRedis* owner = StartServer();
+  seed->set_moved_to_port(owner->port());
+  StartCache(Spec(seed), true, 0);
+
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, Redirections());
+  EXPECT_EQ(1, owner->num_entries());
+
+  // Now that we know where the slot lives, we go straight there.
+  CheckGet("Name", "Value");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(1, seed->num_key_commands());
+  EXPECT_EQ(1, Redirections());
+}
+
+TEST_F(RedisCacheTest, ClusterSlots) {
+  FakeRedis* seed = StartServer();
+  FakeRedis* owner = StartServer();
+  seed->set_slots_port(owner->port());
+  seed->set_moved_to_port(owner->port());
+  StartCache(Spec(seed), true, 0);
+
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(0, seed->num_key_commands());
+  EXPECT_EQ(0, Redirections());
+}
+
+TEST_F(RedisCacheTest, ClusterMultiGet) {
+  FakeRedis* seed = StartServer();
+  FakeRedis* owner = StartServer();
+  seed->set_moved_to_port(owner->port());
+  StartCache(Spec(seed), true, 0);
+
+  // The first MultiGet has each key redirected individually.
+  TestMultiGet();
+  EXPECT_EQ(0, owner->num_mgets());
+
+  // But afterwards keys in known slots go straight to their node, as GETs.
+  int seed_commands = seed->num_key_commands();
+  Callback* n0 = InitiateGet("n0");
+  EXPECT_EQ(seed_commands, seed->num_key_commands());
+  WaitAndCheck(n0, "v0");
+}
+
+TEST_F(RedisCacheTest, ClusterFollowsAsk) {
+  FakeRedis* seed = StartServer();
+  FakeRedis* owner = StartServer();
+  seed->set_ask_to_port(owner->port());
+  StartCache(Spec(seed), true, 0);
+
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, owner->num_askings());
+  EXPECT_EQ(1, owner->num_entries());
+
+  // ASK, unlike MOVED, is not remembered.
+  CheckGet("Name", "Value");
+  EXPECT_EQ(2, seed->num_key_commands());
+  EXPECT_EQ(2, owner->num_askings());
+  EXPECT_EQ(2, Redirections());
+}
+
+TEST_F(RedisCacheTest, ShutDown) {
+  StartCache(Spec(StartServer()), false, 0);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
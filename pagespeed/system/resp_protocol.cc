@@ -0,0 +1,186 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/system/resp_protocol.h"
+
+namespace net_instaweb {
+
+namespace resp {
+
+namespace {
+
+// Replies nested deeper than this are rejected rather than risk blowing
+// the stack on a hostile or corrupt stream.
+const int kMaxNestingDepth = 8;
+
+// Finds the CRLF-terminated line starting at 'pos'.  Returns false if the
+// line is not complete yet.
+bool FindLine(StringPiece input, size_t pos, StringPiece* line,
+              size_t* next) {
+  size_t end = input.find("\r\n", pos);
+  if (end == StringPiece::npos) {
+    return false;
+  }
+  *line = input.substr(pos, end - pos);
+  *next = end + 2;
+  return true;
+}
+
+// Parses the reply starting at 'pos', storing it in *reply unless that is
+// NULL, and setting *next to the position following it.
+ParseResult ParseReplyAt(StringPiece input, size_t pos, int depth,
+                         Reply* reply, size_t* next) {
+  if (pos >= input.size()) {
+    return kParseIncomplete;
+  }
+  if (depth > kMaxNestingDepth) {
+    return kParseError;
+  }
+  char type = input[pos];
+  StringPiece line;
+  size_t after_line;
+  if (!FindLine(input, pos + 1, &line, &after_line)) {
+    return kParseIncomplete;
+  }
+  switch (type) {
+    case '+':
+    case '-':
+      if (reply != NULL) {
+        reply->type = (type == '+') ? Reply::kStatus : Reply::kError;
+        line.CopyToString(&reply->str);
+      }
+      *next = after_line;
+      return kParseOk;
+    case ':': {
+      int64 integer;
+      if (!StringToInt64(line.as_string(), &integer)) {
+        return kParseError;
+      }
+      if (reply != NULL) {
+        reply->type = Reply::kInteger;
+        reply->integer = integer;
+      }
+      *next = after_line;
+      return kParseOk;
+    }
+    case '$': {
+      int64 length;
+      if (!StringToInt64(line.as_string(), &length) || (length < -1)) {
+        return kParseError;
+      }
+      if (length == -1) {
+        if (reply != NULL) {
+          reply->type = Reply::kNil;
+        }
+        *next = after_line;
+        return kParseOk;
+      }
+      size_t end = after_line + static_cast<size_t>(length);
+      if (end + 2 > input.size()) {
+        return kParseIncomplete;
+      }
+      if ((input[end] != '\r') || (input[end + 1] != '\n')) {
+        return kParseError;
+      }
+      if (reply != NULL) {
+        reply->type = Reply::kBulkString;
+        input.substr(after_line, length).CopyToString(&reply->str);
+      }
+      *next = end + 2;
+      return kParseOk;
+    }
+    case '*': {
+      int64 count;
+      if (!StringToInt64(line.as_string(), &count) || (count < -1)) {
+        return kParseError;
+      }
+      if (count == -1) {
+        if (reply != NULL) {
+          reply->type = Reply::kNil;
+        }
+        *next = after_line;
+        return kParseOk;
+      }
+      // Each element takes at least 3 bytes, so don't trust a count that
+      // could not possibly fit in what we have so far.
+      if (count > static_cast<int64>(input.size() - after_line) / 3 + 1) {
+        return kParseIncomplete;
+      }
+      if (reply != NULL) {
+        reply->type = Reply::kArray;
+        reply->elements.clear();
+        reply->elements.resize(count);
+      }
+      size_t element_pos = after_line;
+      for (int64 i = 0; i < count; ++i) {
+        Reply* element = (reply == NULL) ? NULL : &reply->elements[i];
+        ParseResult result = ParseReplyAt(input, element_pos, depth + 1,
+                                          element, &element_pos);
+        if (result != kParseOk) {
+          return result;
+        }
+      }
+      *next = element_pos;
+      return kParseOk;
+    }
+    default:
+      return kParseError;
+  }
+}
+
+}  // namespace
+
+void AppendCommand(const StringPieceVector& args, GoogleString* out) {
+  StrAppend(out, "*", IntegerToString(args.size()), "\r\n");
+  for (int i = 0, n = args.size(); i < n; ++i) {
+    StrAppend(out, "$", IntegerToString(args[i].size()), "\r\n",
+              args[i], "\r\n");
+  }
+}
+
+ParseResult ParseReply(StringPiece input, Reply* reply, size_t* consumed) {
+  return ParseReplyAt(input, 0, 0, reply, consumed);
+}
+
+uint16 Crc16(StringPiece data) {
+  uint16 crc = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    crc ^= static_cast<uint16>(static_cast<uint8>(data[i])) << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      if ((crc & 0x8000) != 0) {
+        crc = (crc << 1) ^ 0x1021;
+      } else {
+        crc <<= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+int KeyHashSlot(StringPiece key) {
+  size_t open = key.find('{');
+  if (open != StringPiece::npos) {
+    size_t close = key.find('}', open + 1);
+    if ((close != StringPiece::npos) && (close != open + 1)) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+  return Crc16(key) & (kNumClusterSlots - 1);
+}
+
+}  // namespace resp
+
+}  // namespace net_instaweb
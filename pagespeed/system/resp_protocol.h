@@ -0,0 +1,81 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_SYSTEM_RESP_PROTOCOL_H_
+#define PAGESPEED_SYSTEM_RESP_PROTOCOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Framing for RESP, the REdis Serialization Protocol, as described in
+// http://redis.io/topics/protocol, plus the key-to-slot mapping used by
+// Redis Cluster (http://redis.io/topics/cluster-spec).
+namespace resp {
+
+// Redis Cluster divides the key space into this many hash slots.
+const int kNumClusterSlots = 16384;
+
+struct Reply {
+  enum Type {
+    kStatus,       // +OK
+    kError,        // -ERR ...
+    kInteger,      // :1
+    kBulkString,   // $3\r\nfoo
+    kNil,          // $-1 or *-1
+    kArray,        // *2 followed by two more replies
+  };
+
+  Reply() : type(kNil), integer(0) {}
+
+  Type type;
+  GoogleString str;  // For kStatus, kError and kBulkString.
+  int64 integer;     // For kInteger.
+  std::vector<Reply> elements;  // For kArray.
+};
+
+enum ParseResult {
+  kParseOk,
+  kParseIncomplete,  // More data is needed.
+  kParseError,       // The input is not RESP; the connection is unusable.
+};
+
+// Appends a command, encoded as an array of bulk strings, to *out.
+void AppendCommand(const StringPieceVector& args, GoogleString* out);
+
+// Parses the reply at the front of 'input' into *reply.  On kParseOk,
+// *consumed is set to the number of bytes it occupied.  'reply' may be NULL
+// to just find out whether a complete reply has arrived, which is much
+// cheaper than parsing it.
+ParseResult ParseReply(StringPiece input, Reply* reply, size_t* consumed);
+
+// Returns the CRC16 (XMODEM variant) that Redis Cluster uses to hash keys.
+uint16 Crc16(StringPiece data);
+
+// Returns the cluster slot for a key.  If the key contains a non-empty
+// "{hash tag}", only the tag is hashed.
+int KeyHashSlot(StringPiece key);
+
+}  // namespace resp
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_RESP_PROTOCOL_H_
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2016 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test RESP framing and cluster key hashing.
+
+#include "pagespeed/system/resp_protocol.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+TEST(RespProtocolTest, AppendCommand) {
+  StringPieceVector args;
+  args.push_back("SET");
+  args.push_back("key");
+  args.push_back(StringPiece("a\r\nb\0", 5));
+  GoogleString out;
+  resp::AppendCommand(args, &out);
+  EXPECT_EQ(GoogleString("*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\na\r\nb\0\r\n",
+                         33),
+            out);
+}
+
+TEST(RespProtocolTest, ParseScalars) {
+  resp::Reply reply;
+  size_t consumed;
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply("+OK\r\nextra", &reply,
+                                             &consumed));
+  EXPECT_EQ(resp::Reply::kStatus, reply.type);
+  EXPECT_EQ("OK", reply.str);
+  EXPECT_EQ(5, consumed);
+
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply("-ERR bad\r\n", &reply,
+                                             &consumed));
+  EXPECT_EQ(resp::Reply::kError, reply.type);
+  EXPECT_EQ("ERR bad", reply.str);
+
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply(":-42\r\n", &reply, &consumed));
+  EXPECT_EQ(resp::Reply::kInteger, reply.type);
+  EXPECT_EQ(-42, reply.integer);
+
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply("$-1\r\n", &reply, &consumed));
+  EXPECT_EQ(resp::Reply::kNil, reply.type);
+
+  // Bulk strings may contain CRLF.
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply("$4\r\na\r\nb\r\n", &reply,
+                                             &consumed));
+  EXPECT_EQ(resp::Reply::kBulkString, reply.type);
+  EXPECT_EQ("a\r\nb", reply.str);
+  EXPECT_EQ(10, consumed);
+}
+
+TEST(RespProtocolTest, ParseArray) {
+  GoogleString input = "*3\r\n$3\r\nfoo\r\n$-1\r\n*1\r\n:7\r\n";
+  resp::Reply reply;
+  size_t consumed;
+  ASSERT_EQ(resp::kParseOk, resp::ParseReply(input, &reply, &consumed));
+  EXPECT_EQ(input.size(), consumed);
+  ASSERT_EQ(resp::Reply::kArray, reply.type);
+  ASSERT_EQ(3, reply.elements.size());
+  EXPECT_EQ("foo", reply.elements[0].str);
+  EXPECT_EQ(resp::Reply::kNil, reply.elements[1].type);
+  ASSERT_EQ(1, reply.elements[2].elements.size());
+  EXPECT_EQ(7, reply.elements[2].elements[0].integer);
+
+  // Every proper prefix is incomplete, whether or not we want the reply.
+  for (size_t i = 0; i < input.size(); ++i) {
+    StringPiece prefix(input.data(), i);
+    EXPECT_EQ(resp::kParseIncomplete,
+              resp::ParseReply(prefix, &reply, &consumed)) << i;
+    EXPECT_EQ(resp::kParseIncomplete,
+              resp::ParseReply(prefix, NULL, &consumed)) << i;
+  }
+  EXPECT_EQ(resp::kParseOk, resp::ParseReply(input, NULL, &consumed));
+  EXPECT_EQ(input.size(), consumed);
+}
+
+TEST(RespProtocolTest, ParseErrors) {
+  resp::Reply reply;
+  size_t consumed;
+  EXPECT_EQ(resp::kParseError, resp::ParseReply("?\r\n", &reply, &consumed));
+  EXPECT_EQ(resp::kParseError, resp::ParseReply(":x\r\n", &reply,
+                                                &consumed));
+  EXPECT_EQ(resp::kParseError, resp::ParseReply("$3\r\nfooxx", &reply,
+                                                &consumed));
+  EXPECT_EQ(resp::kParseError, resp::ParseReply("$-2\r\n", &reply,
+                                                &consumed));
+}
+
+TEST(RespProtocolTest, KeyHashSlot) {
+  EXPECT_EQ(0x31c3, resp::Crc16("123456789"));
+  EXPECT_EQ(12182, resp::KeyHashSlot("foo"));
+  EXPECT_EQ(5061, resp::KeyHashSlot("bar"));
+
+  // Only the hash tag counts, if there is a non-empty one.
+  EXPECT_EQ(resp::KeyHashSlot("user1000"),
+            resp::KeyHashSlot("{user1000}.following"));
+  EXPECT_EQ(resp::KeyHashSlot("{user1000}.following"),
+            resp::KeyHashSlot("{user1000}.followers"));
+  EXPECT_EQ(resp::Crc16("{}foo") & 16383, resp::KeyHashSlot("{}foo"));
+  EXPECT_EQ(resp::KeyHashSlot("bar"), resp::KeyHashSlot("foo{bar}{zap}"));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -22,8 +22,11 @@
 
 #include "pagespeed/system/serf_url_async_fetcher.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <list>
+#include <map>
+#include <utility>
 #include <vector>
 
 #include "apr.h"
@@ -43,6 +46,8 @@
 #include "pagespeed/kernel/base/pool_element.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_hash.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -85,6 +90,10 @@ apr_status_t serf_ssl_set_certificates_file(serf_ssl_context_t *ssl_ctx,
                                             const char* file);
 int serf_ssl_check_host(const serf_ssl_certificate_t *cert,
                         const char* hostname);
+ssl_session_st* serf_ssl_get1_session(serf_ssl_context_t *ssl_ctx);
+apr_status_t serf_ssl_set_session(serf_ssl_context_t *ssl_ctx,
+                                  ssl_session_st* session);
+void serf_ssl_session_free(ssl_session_st* session);
 
 }  // extern "C"
 
@@ -100,6 +109,46 @@ const char SerfStats::kSerfFetchActiveCount[] =
 const char SerfStats::kSerfFetchTimeoutCount[] = "serf_fetch_timeout_count";
 const char SerfStats::kSerfFetchFailureCount[] = "serf_fetch_failure_count";
 const char SerfStats::kSerfFetchCertErrors[] = "serf_fetch_cert_errors";
+const char SerfStats::kSerfConnectionPoolHits[] = "serf_connection_pool_hits";
+const char SerfStats::kSerfConnectionPoolMisses[] =
+    "serf_connection_pool_misses";
+const char SerfStats::kSerfFetchThreadPrefix[] = "serf_fetch_thread_";
+const char SerfStats::kSerfFetchThreadActiveSuffix[] = "_active_count";
+const char SerfStats::kSerfFetchThreadQueuedSuffix[] = "_queued_count";
+
+const int SerfUrlAsyncFetcher::kDefaultMaxIdleConnectionsPerHost = 4;
+const int64 SerfUrlAsyncFetcher::kDefaultIdleConnectionTimeoutMs =
+    4 * Timer::kSecondMs;
+const int SerfUrlAsyncFetcher::kMaxThreads = 8;
+
+namespace {
+
+// The most idle connections a fetcher keeps open across all hosts, and the
+// most TLS sessions it remembers.
+const size_t kMaxIdleConnections = 64;
+const size_t kMaxTlsSessions = 256;
+
+// A host's fetches move off its own thread only when that thread has this
+// many more fetches outstanding than the alternative.
+const int kMaxThreadImbalance = 4;
+
+GoogleString ThreadStatName(int index, const char* suffix) {
+  return StrCat(SerfStats::kSerfFetchThreadPrefix, IntegerToString(index),
+                suffix);
+}
+
+// Returns the scheme, host and port of url, the part that decides which
+// connections a fetch can use.
+StringPiece UrlOrigin(StringPiece url) {
+  stringpiece_ssize_type host_start = url.find("://");
+  if (host_start == StringPiece::npos) {
+    return url;
+  }
+  stringpiece_ssize_type host_end = url.find_first_of("/?#", host_start + 3);
+  return (host_end == StringPiece::npos) ? url : url.substr(0, host_end);
+}
+
+}  // namespace
 
 GoogleString GetAprErrorString(apr_status_t status) {
   char error_str[1024];
@@ -107,6 +156,256 @@ GoogleString GetAprErrorString(apr_status_t status) {
   return error_str;
 }
 
+// A serf connection to one host, which outlives the fetch it was opened for
+// so that later fetches with the same SerfFetch::ConnectionKey() can reuse
+// its socket, and TLS session, instead of connecting afresh.  It owns the
+// pool, bucket allocator and SSL context the serf connection uses, and is the
+// baton for serf's connection callbacks, passing certificate checks on to
+// the fetch currently using it.
+class SerfConnection {
+ public:
+  SerfConnection(SerfUrlAsyncFetcher* fetcher, const GoogleString& key,
+                 const char* sni_host)
+      : fetcher_(fetcher),
+        key_(key),
+        pool_(NULL),
+        bucket_alloc_(NULL),
+        connection_(NULL),
+        fetch_(NULL),
+        sni_host_(NULL),
+        ssl_context_(NULL),
+        socket_open_(false),
+        reused_socket_(false),
+        reset_(false),
+        idle_since_ms_(0) {
+    apr_pool_create(&pool_, fetcher_->pool());
+    bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
+    if (sni_host != NULL) {
+      sni_host_ = apr_pstrdup(pool_, sni_host);
+    }
+  }
+
+  ~SerfConnection() {
+    if (connection_ != NULL) {
+      serf_connection_close(connection_);
+    }
+    apr_pool_destroy(pool_);
+  }
+
+  apr_status_t Open(const apr_uri_t& url) {
+    return serf_connection_create2(&connection_, fetcher_->serf_context(), url,
+                                   ConnectionSetup, this,
+                                   ClosedConnection, this,
+                                   pool_);
+  }
+
+  // Hands the connection to fetch, which will issue the next request on it.
+  void Attach(SerfFetch* fetch) {
+    fetch_ = fetch;
+    reused_socket_ = socket_open_;
+    reset_ = false;
+  }
+
+  // Marks the connection idle once its fetch is done with it.
+  void Detach(int64 now_ms) {
+    fetch_ = NULL;
+    idle_since_ms_ = now_ms;
+#if SERF_HTTPS_FETCHING
+    // Let connections opened while this one is idle resume its session.
+    SaveTlsSession();
+#endif
+  }
+
+  const GoogleString& key() const { return key_; }
+  serf_connection_t* connection() const { return connection_; }
+  int64 idle_since_ms() const { return idle_since_ms_; }
+
+  // Whether the socket is still open, so the next request skips the connect.
+  bool socket_open() const { return socket_open_; }
+
+  // Whether the current request went out on a socket that was already open
+  // when the fetch was attached.
+  bool reused_socket() const { return reused_socket_; }
+
+  // Whether serf has closed the socket since the fetch was attached.  It
+  // reopens it for any requests it has requeued, so this is not an error.
+  bool reset() const { return reset_; }
+
+ private:
+  static apr_status_t ConnectionSetup(
+      apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
+      void* setup_baton, apr_pool_t* pool);
+  static void ClosedConnection(serf_connection_t* conn,
+                               void* closed_baton,
+                               apr_status_t why,
+                               apr_pool_t* pool);
+
+  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
+  // (surfacepatterns@gmail.com).
+  //
+  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
+  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
+#if SERF_HTTPS_FETCHING
+  static apr_status_t SSLCertValidate(void *data, int failures,
+                                      const serf_ssl_certificate_t *cert);
+
+  static apr_status_t SSLCertChainValidate(
+      void *data, int failures, int error_depth,
+      const serf_ssl_certificate_t * const *certs,
+      apr_size_t certs_count);
+
+  // Creates ssl_context_ on the first read bucket of a new socket, loads the
+  // trusted certificates, and offers any session saved for key_.
+  apr_status_t InitSslContext(serf_bucket_t* read_bkt);
+  void SaveTlsSession();
+#endif
+
+  SerfUrlAsyncFetcher* fetcher_;
+  const GoogleString key_;
+  apr_pool_t* pool_;
+  serf_bucket_alloc_t* bucket_alloc_;
+  serf_connection_t* connection_;
+  SerfFetch* fetch_;  // NULL while idle.
+  const char* sni_host_;  // in pool_, NULL for http.
+  serf_ssl_context_t* ssl_context_;  // Owned by the socket's SSL buckets.
+  bool socket_open_;
+  bool reused_socket_;
+  bool reset_;
+  int64 idle_since_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfConnection);
+};
+
+#if SERF_HTTPS_FETCHING
+// static
+apr_status_t SerfConnection::SSLCertValidate(
+    void *data, int failures, const serf_ssl_certificate_t *cert) {
+  SerfFetch* fetch = static_cast<SerfConnection*>(data)->fetch_;
+  if (fetch == NULL) {
+    return APR_SUCCESS;
+  }
+  return fetch->HandleSSLCertValidation(failures, 0, cert);
+}
+
+// static
+apr_status_t SerfConnection::SSLCertChainValidate(
+    void *data, int failures, int error_depth,
+    const serf_ssl_certificate_t * const *certs,
+    apr_size_t certs_count) {
+  SerfFetch* fetch = static_cast<SerfConnection*>(data)->fetch_;
+  if (fetch == NULL) {
+    return APR_SUCCESS;
+  }
+  return fetch->HandleSSLCertValidation(failures, error_depth, NULL);
+}
+
+apr_status_t SerfConnection::InitSslContext(serf_bucket_t* read_bkt) {
+  ssl_context_ = serf_bucket_ssl_decrypt_context_get(read_bkt);
+  if (ssl_context_ == NULL) {
+    return APR_EGENERAL;
+  }
+  apr_status_t status = APR_SUCCESS;
+  const GoogleString& certs_dir = fetcher_->ssl_certificates_dir();
+  const GoogleString& certs_file = fetcher_->ssl_certificates_file();
+
+  if (!certs_file.empty()) {
+    status = serf_ssl_set_certificates_file(ssl_context_, certs_file.c_str());
+  }
+  if ((status == APR_SUCCESS) && !certs_dir.empty()) {
+    status = serf_ssl_set_certificates_directory(ssl_context_,
+                                                 certs_dir.c_str());
+  }
+
+  // If no explicit file or directory is specified, then use the
+  // compiled-in default.
+  if (certs_dir.empty() && certs_file.empty()) {
+    status = serf_ssl_use_default_certificates(ssl_context_);
+  }
+
+  if (status == APR_SUCCESS) {
+    ssl_session_st* session = fetcher_->FindTlsSession(key_);
+    if (session != NULL) {
+      // Failing to resume just costs us a full handshake.
+      serf_ssl_set_session(ssl_context_, session);
+    }
+  }
+  return status;
+}
+
+void SerfConnection::SaveTlsSession() {
+  if (ssl_context_ != NULL) {
+    ssl_session_st* session = serf_ssl_get1_session(ssl_context_);
+    if (session != NULL) {
+      fetcher_->SaveTlsSession(key_, session);
+    }
+  }
+}
+#endif
+
+// static
+apr_status_t SerfConnection::ConnectionSetup(
+    apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
+    void* setup_baton, apr_pool_t* pool) {
+  SerfConnection* connection = static_cast<SerfConnection*>(setup_baton);
+  connection->socket_open_ = true;
+  *read_bkt = serf_bucket_socket_create(socket, connection->bucket_alloc_);
+#if SERF_HTTPS_FETCHING
+  if (connection->sni_host_ != NULL) {
+    *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt,
+                                               connection->ssl_context_,
+                                               connection->bucket_alloc_);
+    if (connection->ssl_context_ == NULL) {
+      apr_status_t status = connection->InitSslContext(*read_bkt);
+      if (status != APR_SUCCESS) {
+        return status;
+      }
+    }
+
+    serf_ssl_server_cert_callback_set(
+        connection->ssl_context_, SSLCertValidate, connection);
+
+    serf_ssl_server_cert_chain_callback_set(
+        connection->ssl_context_, SSLCertValidate, SSLCertChainValidate,
+        connection);
+
+    apr_status_t status = serf_ssl_set_hostname(connection->ssl_context_,
+                                                connection->sni_host_);
+    if (status != APR_SUCCESS) {
+      LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
+                   "setup failed";
+      return status;
+    }
+    *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt,
+                                                connection->ssl_context_,
+                                                connection->bucket_alloc_);
+  }
+#endif
+  return APR_SUCCESS;
+}
+
+// static
+void SerfConnection::ClosedConnection(serf_connection_t* conn,
+                                      void* closed_baton,
+                                      apr_status_t why,
+                                      apr_pool_t* pool) {
+  SerfConnection* connection = static_cast<SerfConnection*>(closed_baton);
+  if ((why != APR_SUCCESS) && (connection->fetch_ != NULL)) {
+    SerfFetch* fetch = connection->fetch_;
+    fetch->message_handler()->Warning(
+        fetch->DebugInfo().c_str(), 0, "Connection close (code=%d %s).",
+        why, GetAprErrorString(why).c_str());
+  }
+#if SERF_HTTPS_FETCHING
+  // Serf frees the SSL context along with the socket's buckets, right after
+  // this returns, so this is our last chance to keep its session.
+  connection->SaveTlsSession();
+  connection->ssl_context_ = NULL;
+#endif
+  // Serf will open a new socket if another request is queued.
+  connection->socket_open_ = false;
+  connection->reset_ = true;
+}
+
 SerfFetch::SerfFetch(const GoogleString& url,
                      AsyncFetch* async_fetch,
                      MessageHandler* message_handler,
@@ -122,15 +421,16 @@ SerfFetch::SerfFetch(const GoogleString& url,
       saved_byte_('\0'),
       message_handler_(message_handler),
       pool_(NULL),  // filled in once assigned to a thread, to use its pool.
-      bucket_alloc_(NULL),
       host_header_(NULL),
       sni_host_(NULL),
       connection_(NULL),
+      keep_alive_(false),
+      reuse_connection_(false),
+      retried_(false),
       bytes_received_(0),
       fetch_start_ms_(0),
       fetch_end_ms_(0),
       using_https_(false),
-      ssl_context_(NULL),
       ssl_error_message_(NULL) {
   memset(&url_, 0, sizeof(url_));
 }
@@ -138,7 +438,11 @@ SerfFetch::SerfFetch(const GoogleString& url,
 SerfFetch::~SerfFetch() {
   DCHECK(async_fetch_ == NULL);
   if (connection_ != NULL) {
-    serf_connection_close(connection_);
+    if (reuse_connection_) {
+      fetcher_->ReleaseConnection(connection_);
+    } else {
+      delete connection_;
+    }
   }
   if (pool_ != NULL) {
     apr_pool_destroy(pool_);
@@ -179,7 +483,9 @@ void SerfFetch::Cancel() {
     // keep re-detecting it, which will interfere with other jobs getting
     // handled (until we finally cleanup the old fetch and close things in
     // ~SerfFetch).
-    serf_connection_close(connection_);
+    //
+    // Either way the connection may be mid-response, so it can't be reused.
+    delete connection_;
     connection_ = NULL;
   }
 
@@ -223,14 +529,23 @@ void SerfFetch::CallbackDone(bool success) {
 }
 
 void SerfFetch::CleanupIfError() {
-  if ((connection_ != NULL) &&
-      serf_connection_is_in_error_state(connection_)) {
+  if ((connection_ != NULL) && !connection_->reset() &&
+      serf_connection_is_in_error_state(connection_->connection())) {
     message_handler_->Message(
         kInfo, "Serf cleanup for error'd fetch of: %s", DebugInfo().c_str());
     Cancel();
   }
 }
 
+void SerfFetch::Retry() {
+  retried_ = true;
+  delete connection_;
+  connection_ = NULL;
+  if (!Connect(false)) {
+    CallCallback(false);
+  }
+}
+
 int64 SerfFetch::TimeDuration() const {
   if ((fetch_start_ms_ != 0) && (fetch_end_ms_ != 0)) {
     return fetch_end_ms_ - fetch_start_ms_;
@@ -239,100 +554,6 @@ int64 SerfFetch::TimeDuration() const {
   }
 }
 
-#if SERF_HTTPS_FETCHING
-// static
-apr_status_t SerfFetch::SSLCertValidate(void *data, int failures,
-                                     const serf_ssl_certificate_t *cert) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, 0, cert);
-}
-
-// static
-apr_status_t SerfFetch::SSLCertChainValidate(
-    void *data, int failures, int error_depth,
-    const serf_ssl_certificate_t * const *certs,
-    apr_size_t certs_count) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, error_depth, NULL);
-}
-#endif
-
-// static
-apr_status_t SerfFetch::ConnectionSetup(
-    apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-    void* setup_baton, apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(setup_baton);
-  *read_bkt = serf_bucket_socket_create(socket, fetch->bucket_alloc_);
-#if SERF_HTTPS_FETCHING
-  apr_status_t status = APR_SUCCESS;
-  if (fetch->using_https_) {
-    *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt,
-                                               fetch->ssl_context_,
-                                               fetch->bucket_alloc_);
-    if (fetch->ssl_context_ == NULL) {
-      fetch->ssl_context_ = serf_bucket_ssl_decrypt_context_get(*read_bkt);
-      if (fetch->ssl_context_ == NULL) {
-        status = APR_EGENERAL;
-      } else {
-        SerfUrlAsyncFetcher* fetcher = fetch->fetcher_;
-        const GoogleString& certs_dir = fetcher->ssl_certificates_dir();
-        const GoogleString& certs_file = fetcher->ssl_certificates_file();
-
-        if (!certs_file.empty()) {
-          status = serf_ssl_set_certificates_file(
-              fetch->ssl_context_, certs_file.c_str());
-        }
-        if ((status == APR_SUCCESS) && !certs_dir.empty()) {
-          status = serf_ssl_set_certificates_directory(fetch->ssl_context_,
-                                                       certs_dir.c_str());
-        }
-
-        // If no explicit file or directory is specified, then use the
-        // compiled-in default.
-        if (certs_dir.empty() && certs_file.empty()) {
-          status = serf_ssl_use_default_certificates(fetch->ssl_context_);
-        }
-      }
-      if (status != APR_SUCCESS) {
-        return status;
-      }
-    }
-
-    serf_ssl_server_cert_callback_set(
-        fetch->ssl_context_, SSLCertValidate, fetch);
-
-    serf_ssl_server_cert_chain_callback_set(
-        fetch->ssl_context_, SSLCertValidate, SSLCertChainValidate, fetch);
-
-    status = serf_ssl_set_hostname(fetch->ssl_context_, fetch->sni_host_);
-    if (status != APR_SUCCESS) {
-      LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
-                   "setup failed";
-      return status;
-    }
-    *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt,
-                                                fetch->ssl_context_,
-                                                fetch->bucket_alloc_);
-  }
-#endif
-  return APR_SUCCESS;
-}
-
-// static
-void SerfFetch::ClosedConnection(serf_connection_t* conn,
-                                 void* closed_baton,
-                                 apr_status_t why,
-                                 apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(closed_baton);
-  if (why != APR_SUCCESS) {
-    fetch->message_handler_->Warning(
-        fetch->DebugInfo().c_str(), 0, "Connection close (code=%d %s).",
-        why, GetAprErrorString(why).c_str());
-  }
-  // Connection is closed.
-  fetch->connection_ = NULL;
-}
-
 // static
 serf_bucket_t* SerfFetch::AcceptResponse(serf_request_t* request,
                                          serf_bucket_t* stream,
@@ -463,6 +684,21 @@ apr_status_t SerfFetch::HandleSSLCertValidation(
 
 apr_status_t SerfFetch::HandleResponse(serf_bucket_t* response) {
   if (response == NULL) {
+    // Serf cancels a request that was sent down a kept-alive connection the
+    // origin had already closed.  If the origin hasn't answered, it may never
+    // have seen the request, so try once more on a new connection.
+    if ((async_fetch_ != NULL) && (connection_ != NULL) &&
+        connection_->reused_socket() && !status_line_read_ && !retried_) {
+      RequestHeaders::Method method = async_fetch_->request_headers()->method();
+      if ((method == RequestHeaders::kGet) ||
+          (method == RequestHeaders::kHead)) {
+        message_handler_->Message(
+            kInfo, "Retrying %s after its kept-alive connection was closed",
+            DebugInfo().c_str());
+        fetcher_->RetryFetch(this);
+        return APR_EGENERAL;
+      }
+    }
     message_handler_->Message(
         kInfo, "serf HandlerReponse called with NULL response for %s",
         DebugInfo().c_str());
@@ -508,6 +744,10 @@ apr_status_t SerfFetch::HandleResponse(serf_bucket_t* response) {
       // conditions.
       async_fetch_->response_headers()->Clear();
     }
+    // Only a response read through to its end leaves the connection ready for
+    // the next request.
+    reuse_connection_ = success && keep_alive_ && APR_STATUS_IS_EOF(status) &&
+        (ssl_error_message_ == NULL);
     CallCallback(success);
   }
   return status;
@@ -554,6 +794,8 @@ apr_status_t SerfFetch::ReadHeaders(serf_bucket_t* response) {
   if (IsStatusOk(status) && (len > 0)) {
     if (parser_.ParseChunk(StringPiece(data, len), message_handler_)) {
       if (parser_.headers_complete()) {
+        // Check before the headers are passed on, as they may be sanitized.
+        keep_alive_ = KeepsConnectionAlive();
         ResponseHeaders* response_headers = async_fetch_->response_headers();
         if (ssl_error_message_ != NULL) {
           response_headers->set_status_code(HttpStatus::kNotFound);
@@ -751,14 +993,19 @@ bool SerfFetch::ParseUrl() {
 
 class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
  public:
-  SerfThreadedFetcher(SerfUrlAsyncFetcher* parent, const char* proxy) :
+  SerfThreadedFetcher(SerfUrlAsyncFetcher* parent, const char* proxy,
+                      Statistics* statistics, int index) :
       SerfUrlAsyncFetcher(parent, proxy),
       thread_id_(NULL),
       initiate_mutex_(parent->thread_system()->NewMutex()),
       initiate_fetches_(new SerfFetchPool()),
       initiate_fetches_nonempty_(initiate_mutex_->NewCondvar()),
       thread_finish_(false),
-      thread_started_(false) {
+      thread_started_(false),
+      queued_count_(statistics->GetUpDownCounter(
+          ThreadStatName(index, SerfStats::kSerfFetchThreadQueuedSuffix))) {
+    thread_active_count_ = statistics->GetUpDownCounter(
+        ThreadStatName(index, SerfStats::kSerfFetchThreadActiveSuffix));
   }
 
   ~SerfThreadedFetcher() {
@@ -822,11 +1069,15 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
     // spurious calls to Signal().
     bool signal = initiate_fetches_->empty();
     initiate_fetches_->Add(fetch);
+    num_outstanding_.BarrierIncrement(1);
+    queued_count_->Add(1);
     if (signal) {
       initiate_fetches_nonempty_->Signal();
     }
   }
 
+  int num_outstanding() const { return num_outstanding_.value(); }
+
   void ShutDown() {
     // See comments in the destructor above.. The big difference is that
     // because we set shutdown_ to true new jobs can't actually come in.
@@ -907,6 +1158,7 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
       mutex_->Lock();
       xfer_fetches.swap(initiate_fetches_);
     }
+    queued_count_->Add(-static_cast<int64>(xfer_fetches->size()));
 
     // Now that we've unblocked the parent thread, we can leisurely
     // queue up the fetches, employing the proper lock for the active_fetches_
@@ -982,6 +1234,9 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
   // True if we actually started the worker thread. Protected by initiate_mutex_
   bool thread_started_;
 
+  // Gauges fetches waiting in initiate_fetches_.
+  UpDownCounter* queued_count_;
+
   DISALLOW_COPY_AND_ASSIGN(SerfThreadedFetcher);
 };
 
@@ -990,7 +1245,6 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher) {
   // the pool ops.
   fetcher_ = fetcher;
   apr_pool_create(&pool_, fetcher_->pool());
-  bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
 
   fetch_start_ms_ = timer_->NowMs();
   // Parse and validate the URL.
@@ -1001,24 +1255,15 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher) {
   using_https_ = StringCaseEqual("https", url_.scheme);
   DCHECK(fetcher->allow_https() || !using_https_);
 
-  apr_status_t status = serf_connection_create2(&connection_,
-                                                fetcher_->serf_context(),
-                                                url_,
-                                                ConnectionSetup, this,
-                                                ClosedConnection, this,
-                                                pool_);
-  if (status != APR_SUCCESS) {
-    message_handler_->Error(DebugInfo().c_str(), 0,
-                            "Error status=%d (%s) serf_connection_create2",
-                            status, GetAprErrorString(status).c_str());
+  if (!Connect(true)) {
     return false;
   }
-  serf_connection_request_create(connection_, SetupRequest, this);
 
   // Start the fetch. It will connect to the remote host, send the request,
   // and accept the response, without blocking.
-  status = serf_context_run(
+  apr_status_t status = serf_context_run(
       fetcher_->serf_context(), SERF_DURATION_NOBLOCK, fetcher_->pool());
+  fetcher_->RetryLostFetches();
 
   if (status == APR_SUCCESS || APR_STATUS_IS_TIMEUP(status)) {
     return true;
@@ -1030,6 +1275,60 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher) {
   }
 }
 
+GoogleString SerfFetch::ConnectionKey() const {
+  GoogleString key = StrCat(url_.scheme, "://", url_.hostinfo);
+  if (using_https_) {
+    StrAppend(&key, " ", sni_host_);
+  }
+  return key;
+}
+
+bool SerfFetch::Connect(bool allow_reuse) {
+  GoogleString key = ConnectionKey();
+  if (allow_reuse) {
+    connection_ = fetcher_->TakeIdleConnection(key);
+  }
+  if (connection_ == NULL) {
+    connection_ = new SerfConnection(fetcher_, key,
+                                     using_https_ ? sni_host_ : NULL);
+    apr_status_t status = connection_->Open(url_);
+    if (status != APR_SUCCESS) {
+      message_handler_->Error(DebugInfo().c_str(), 0,
+                              "Error status=%d (%s) serf_connection_create2",
+                              status, GetAprErrorString(status).c_str());
+      delete connection_;
+      connection_ = NULL;
+      return false;
+    }
+  }
+  connection_->Attach(this);
+  serf_connection_request_create(connection_->connection(), SetupRequest, this);
+  return true;
+}
+
+bool SerfFetch::KeepsConnectionAlive() const {
+  const ResponseHeaders* response_headers = async_fetch_->response_headers();
+  // Serf asks for HTTP/1.1, which keeps connections open by default, but an
+  // HTTP/1.0 origin closes them unless it says otherwise.
+  bool keep_alive = (response_headers->major_version() > 1) ||
+      ((response_headers->major_version() == 1) &&
+       (response_headers->minor_version() >= 1));
+  ConstStringStarVector values;
+  if (response_headers->Lookup(HttpAttributes::kConnection, &values)) {
+    for (int i = 0, n = values.size(); i < n; ++i) {
+      if (values[i] == NULL) {
+        continue;
+      }
+      if (StringCaseEqual(*values[i], "close")) {
+        return false;
+      } else if (StringCaseEqual(*values[i], HttpAttributes::kKeepAlive)) {
+        keep_alive = true;
+      }
+    }
+  }
+  return keep_alive;
+}
+
 void SerfFetch::ParseUrlForTesting(bool* status,
                                    apr_uri_t** url,
                                    const char** host_header,
@@ -1078,8 +1377,8 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       timer_(timer),
       mutex_(NULL),
       serf_context_(NULL),
-      threaded_fetcher_(NULL),
       active_count_(NULL),
+      thread_active_count_(NULL),
       request_count_(NULL),
       byte_count_(NULL),
       time_duration_ms_(NULL),
@@ -1087,12 +1386,18 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       timeout_count_(NULL),
       failure_count_(NULL),
       cert_errors_(NULL),
+      pool_hits_(NULL),
+      pool_misses_(NULL),
       timeout_ms_(timeout_ms),
       shutdown_(false),
       list_outstanding_urls_on_error_(false),
       track_original_content_length_(false),
       https_options_(0),
-      message_handler_(message_handler) {
+      message_handler_(message_handler),
+      statistics_(statistics),
+      proxy_(proxy == NULL ? "" : proxy),
+      max_idle_connections_per_host_(kDefaultMaxIdleConnectionsPerHost),
+      idle_connection_timeout_ms_(kDefaultIdleConnectionTimeoutMs) {
   CHECK(statistics != NULL);
   request_count_  =
       statistics->GetVariable(SerfStats::kSerfFetchRequestCount);
@@ -1105,8 +1410,10 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
   timeout_count_ = statistics->GetVariable(SerfStats::kSerfFetchTimeoutCount);
   failure_count_ = statistics->GetVariable(SerfStats::kSerfFetchFailureCount);
   cert_errors_ = statistics->GetVariable(SerfStats::kSerfFetchCertErrors);
+  pool_hits_ = statistics->GetVariable(SerfStats::kSerfConnectionPoolHits);
+  pool_misses_ = statistics->GetVariable(SerfStats::kSerfConnectionPoolMisses);
   Init(pool, proxy);
-  threaded_fetcher_ = new SerfThreadedFetcher(this, proxy);
+  SetNumThreads(1);
 }
 
 SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
@@ -1116,8 +1423,8 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       timer_(parent->timer_),
       mutex_(NULL),
       serf_context_(NULL),
-      threaded_fetcher_(NULL),
       active_count_(parent->active_count_),
+      thread_active_count_(NULL),
       request_count_(parent->request_count_),
       byte_count_(parent->byte_count_),
       time_duration_ms_(parent->time_duration_ms_),
@@ -1125,12 +1432,18 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       timeout_count_(parent->timeout_count_),
       failure_count_(parent->failure_count_),
       cert_errors_(parent->cert_errors_),
+      pool_hits_(parent->pool_hits_),
+      pool_misses_(parent->pool_misses_),
       timeout_ms_(parent->timeout_ms()),
       shutdown_(false),
       list_outstanding_urls_on_error_(parent->list_outstanding_urls_on_error_),
       track_original_content_length_(parent->track_original_content_length_),
       https_options_(parent->https_options_),
-      message_handler_(parent->message_handler_) {
+      message_handler_(parent->message_handler_),
+      statistics_(parent->statistics_),
+      proxy_(parent->proxy_),
+      max_idle_connections_per_host_(parent->max_idle_connections_per_host_),
+      idle_connection_timeout_ms_(parent->idle_connection_timeout_ms_) {
   Init(parent->pool(), proxy);
 }
 
@@ -1142,32 +1455,33 @@ SerfUrlAsyncFetcher::~SerfUrlAsyncFetcher() {
     message_handler_->Message(
         kError, "SerfFetcher destructed with %d orphaned fetches.",
         orphaned_fetches);
-    if (active_count_ != NULL) {
-      active_count_->Add(-orphaned_fetches);
-    }
+    AddActiveFetches(-orphaned_fetches);
     if (cancel_count_ != NULL) {
       cancel_count_->Add(orphaned_fetches);
     }
   }
 
   active_fetches_.DeleteAll();
-  if (threaded_fetcher_ != NULL) {
-    delete threaded_fetcher_;
-  }
+  CloseIdleConnections();
+#if SERF_HTTPS_FETCHING
+  ClearTlsSessions();
+#endif
+  STLDeleteElements(&threaded_fetchers_);
   delete mutex_;
   apr_pool_destroy(pool_);  // also calls apr_allocator_destroy on the allocator
 }
 
 void SerfUrlAsyncFetcher::ShutDown() {
-  // Note that we choose not to delete the threaded_fetcher_ to avoid worrying
-  // about races on its deletion.
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->ShutDown();
+  // Note that we choose not to delete the threaded_fetchers_ to avoid worrying
+  // about races on their deletion.
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->ShutDown();
   }
 
   ScopedMutex lock(mutex_);
   shutdown_ = true;
   CancelActiveFetchesMutexHeld();
+  CloseIdleConnections();
 }
 
 void SerfUrlAsyncFetcher::Init(apr_pool_t* parent_pool, const char* proxy) {
@@ -1209,13 +1523,13 @@ void SerfUrlAsyncFetcher::CancelActiveFetchesMutexHeld() {
 
 bool SerfUrlAsyncFetcher::StartFetch(SerfFetch* fetch) {
   active_fetches_.Add(fetch);
-  active_count_->Add(1);
+  AddActiveFetches(1);
   bool started = !shutdown_ && fetch->Start(this);
   if (!started) {
     fetch->message_handler()->Message(kWarning, "Fetch failed to start: %s",
                                       fetch->DebugInfo().c_str());
     active_fetches_.Remove(fetch);
-    active_count_->Add(-1);
+    AddActiveFetches(-1);
     fetch->CallbackDone(false);
     delete fetch;
   }
@@ -1229,10 +1543,43 @@ void SerfUrlAsyncFetcher::Fetch(const GoogleString& url,
   SerfFetch* fetch = new SerfFetch(url, async_fetch, message_handler, timer_);
 
   request_count_->Add(1);
-  threaded_fetcher_->InitiateFetch(fetch);
+  ChooseThread(url)->InitiateFetch(fetch);
 
   // TODO(morlovich): There is quite a bit of code related to doing work
-  // both on 'this' and threaded_fetcher_ that could use cleaning up.
+  // both on 'this' and threaded_fetchers_ that could use cleaning up.
+}
+
+void SerfUrlAsyncFetcher::SetNumThreads(int num_threads) {
+  num_threads = std::max(1, std::min(num_threads, kMaxThreads));
+  for (int i = threaded_fetchers_.size(); i < num_threads; ++i) {
+    threaded_fetchers_.push_back(new SerfThreadedFetcher(
+        this, proxy_.c_str(), statistics_, i));
+  }
+}
+
+SerfThreadedFetcher* SerfUrlAsyncFetcher::ChooseThread(StringPiece url) {
+  int num_threads = threaded_fetchers_.size();
+  if (num_threads == 1) {
+    return threaded_fetchers_[0];
+  }
+
+  // Each host has a home thread, picked by hashing its origin, so that its
+  // fetches find the connections they kept alive there.  To stop one busy
+  // host, or an unlucky hash, from backing up its thread while others idle,
+  // the hash also names a second candidate, which is used instead once the
+  // home thread is kMaxThreadImbalance fetches further behind.
+  StringPiece origin = UrlOrigin(url);
+  size_t hash = HashString<CaseFold, size_t>(origin.data(), origin.size());
+  int home = hash % num_threads;
+  int other = (home + 1 + (hash / num_threads) % (num_threads - 1)) %
+      num_threads;
+  SerfThreadedFetcher* home_thread = threaded_fetchers_[home];
+  SerfThreadedFetcher* other_thread = threaded_fetchers_[other];
+  if (home_thread->num_outstanding() >
+      other_thread->num_outstanding() + kMaxThreadImbalance) {
+    return other_thread;
+  }
+  return home_thread;
 }
 
 void SerfUrlAsyncFetcher::PrintActiveFetches(
@@ -1253,6 +1600,7 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
   if (!active_fetches_.empty()) {
     apr_status_t status =
         serf_context_run(serf_context_, 1000*max_wait_ms, pool_);
+    RetryLostFetches();
     completed_fetches_.DeleteAll();
     if (APR_STATUS_IS_TIMEUP(status)) {
       // Remove expired fetches from the front of the queue.
@@ -1304,7 +1652,7 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
           "Serf status %d(%s) polling for %ld %s fetches for %g seconds",
           status, GetAprErrorString(status).c_str(),
           static_cast<long>(active_fetches_.size()),  // NOLINT
-          (threaded_fetcher_ == NULL) ? "threaded" : "non-blocking",
+          threaded_fetchers_.empty() ? "threaded" : "non-blocking",
           max_wait_ms/1.0e3);
       if (list_outstanding_urls_on_error_) {
         int64 now_ms = timer_->NowMs();
@@ -1339,8 +1687,18 @@ void SerfUrlAsyncFetcher::ReportCompletedFetchStats(SerfFetch* fetch) {
   if (byte_count_) {
     byte_count_->Add(fetch->bytes_received());
   }
-  if (active_count_) {
-    active_count_->Add(-1);
+  AddActiveFetches(-1);
+}
+
+void SerfUrlAsyncFetcher::AddActiveFetches(int delta) {
+  if (active_count_ != NULL) {
+    active_count_->Add(delta);
+  }
+  if (thread_active_count_ != NULL) {
+    thread_active_count_->Add(delta);
+  }
+  if (delta < 0) {
+    num_outstanding_.BarrierIncrement(delta);
   }
 }
 
@@ -1357,9 +1715,11 @@ int SerfUrlAsyncFetcher:: ApproximateNumActiveFetches() {
 bool SerfUrlAsyncFetcher::WaitForActiveFetches(
     int64 max_ms, MessageHandler* message_handler, WaitChoice wait_choice) {
   bool ret = true;
-  if ((threaded_fetcher_ != NULL) && (wait_choice != kMainlineOnly)) {
-    ret &= threaded_fetcher_->WaitForActiveFetchesHelper(
-        max_ms, message_handler);
+  if (wait_choice != kMainlineOnly) {
+    for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+      ret &= threaded_fetchers_[i]->WaitForActiveFetchesHelper(
+          max_ms, message_handler);
+    }
   }
   if (wait_choice != kThreadedOnly) {
     ret &= WaitForActiveFetchesHelper(max_ms, message_handler);
@@ -1411,6 +1771,106 @@ void SerfUrlAsyncFetcher::CleanupFetchesWithErrors() {
   }
 }
 
+SerfConnection* SerfUrlAsyncFetcher::TakeIdleConnection(
+    const GoogleString& key) {
+  if (max_idle_connections_per_host_ <= 0) {
+    return NULL;
+  }
+  CloseExpiredConnections();
+  // Prefer the most recently used connection, as the one least likely to
+  // have been closed by the origin.
+  for (ConnectionList::reverse_iterator i = idle_connections_.rbegin();
+       i != idle_connections_.rend(); ++i) {
+    SerfConnection* connection = *i;
+    if ((connection->key() == key) && connection->socket_open()) {
+      idle_connections_.erase(--i.base());
+      pool_hits_->Add(1);
+      return connection;
+    }
+  }
+  pool_misses_->Add(1);
+  return NULL;
+}
+
+void SerfUrlAsyncFetcher::ReleaseConnection(SerfConnection* connection) {
+  int num_for_host = 0;
+  for (ConnectionList::iterator i = idle_connections_.begin();
+       i != idle_connections_.end(); ++i) {
+    if ((*i)->key() == connection->key()) {
+      ++num_for_host;
+    }
+  }
+  if (shutdown_ || !connection->socket_open() ||
+      (num_for_host >= max_idle_connections_per_host_)) {
+    delete connection;
+    return;
+  }
+  connection->Detach(timer_->NowMs());
+  idle_connections_.push_back(connection);
+  CloseExpiredConnections();
+}
+
+void SerfUrlAsyncFetcher::CloseExpiredConnections() {
+  int64 expiry_ms = timer_->NowMs() - idle_connection_timeout_ms_;
+  while (!idle_connections_.empty()) {
+    SerfConnection* connection = idle_connections_.front();
+    if ((idle_connections_.size() <= kMaxIdleConnections) &&
+        (connection->idle_since_ms() > expiry_ms) &&
+        connection->socket_open()) {
+      // The rest were released later, so have not expired either.  Any that
+      // the origin has closed are skipped by TakeIdleConnection, and closed
+      // when they reach the front.
+      break;
+    }
+    idle_connections_.pop_front();
+    delete connection;
+  }
+}
+
+void SerfUrlAsyncFetcher::CloseIdleConnections() {
+  while (!idle_connections_.empty()) {
+    delete idle_connections_.front();
+    idle_connections_.pop_front();
+  }
+}
+
+void SerfUrlAsyncFetcher::RetryLostFetches() {
+  FetchVector fetches;
+  fetches.swap(retry_fetches_);
+  for (int i = 0, n = fetches.size(); i < n; ++i) {
+    fetches[i]->Retry();
+  }
+}
+
+#if SERF_HTTPS_FETCHING
+void SerfUrlAsyncFetcher::SaveTlsSession(const GoogleString& key,
+                                         ssl_session_st* session) {
+  std::pair<TlsSessionMap::iterator, bool> result = tls_sessions_.insert(
+      TlsSessionMap::value_type(key, session));
+  if (!result.second) {
+    serf_ssl_session_free(result.first->second);
+    result.first->second = session;
+  } else if (tls_sessions_.size() > kMaxTlsSessions) {
+    // Sessions expire on the server anyway, so rather than track recency
+    // just start over.
+    ClearTlsSessions();
+  }
+}
+
+ssl_session_st* SerfUrlAsyncFetcher::FindTlsSession(const GoogleString& key) {
+  TlsSessionMap::iterator p = tls_sessions_.find(key);
+  return (p == tls_sessions_.end()) ? NULL : p->second;
+}
+
+void SerfUrlAsyncFetcher::ClearTlsSessions() {
+  for (TlsSessionMap::iterator p = tls_sessions_.begin();
+       p != tls_sessions_.end(); ++p) {
+    serf_ssl_session_free(p->second);
+  }
+  tls_sessions_.clear();
+}
+#endif
+
 void SerfUrlAsyncFetcher::InitStats(Statistics* statistics) {
   statistics->AddVariable(SerfStats::kSerfFetchRequestCount);
   statistics->AddVariable(SerfStats::kSerfFetchByteCount);
@@ -1420,19 +1880,41 @@ void SerfUrlAsyncFetcher::InitStats(Statistics* statistics) {
   statistics->AddVariable(SerfStats::kSerfFetchTimeoutCount);
   statistics->AddVariable(SerfStats::kSerfFetchFailureCount);
   statistics->AddVariable(SerfStats::kSerfFetchCertErrors);
+  statistics->AddVariable(SerfStats::kSerfConnectionPoolHits);
+  statistics->AddVariable(SerfStats::kSerfConnectionPoolMisses);
+  for (int i = 0; i < kMaxThreads; ++i) {
+    statistics->AddUpDownCounter(
+        ThreadStatName(i, SerfStats::kSerfFetchThreadActiveSuffix));
+    statistics->AddUpDownCounter(
+        ThreadStatName(i, SerfStats::kSerfFetchThreadQueuedSuffix));
+  }
 }
 
 void SerfUrlAsyncFetcher::set_list_outstanding_urls_on_error(bool x) {
   list_outstanding_urls_on_error_ = x;
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_list_outstanding_urls_on_error(x);
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->set_list_outstanding_urls_on_error(x);
   }
 }
 
 void SerfUrlAsyncFetcher::set_track_original_content_length(bool x) {
   track_original_content_length_ = x;
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_track_original_content_length(x);
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->set_track_original_content_length(x);
+  }
+}
+
+void SerfUrlAsyncFetcher::set_max_idle_connections_per_host(int x) {
+  max_idle_connections_per_host_ = x;
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->set_max_idle_connections_per_host(x);
+  }
+}
+
+void SerfUrlAsyncFetcher::set_idle_connection_timeout_ms(int64 x) {
+  idle_connection_timeout_ms_ = x;
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->set_idle_connection_timeout_ms(x);
   }
 }
 
@@ -1513,23 +1995,23 @@ bool SerfUrlAsyncFetcher::SetHttpsOptions(StringPiece directive) {
     https_options_ = 0;
   }
 #endif
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_https_options(https_options_);
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->set_https_options(https_options_);
   }
   return true;
 }
 
 void SerfUrlAsyncFetcher::SetSslCertificatesDir(StringPiece dir) {
   dir.CopyToString(&ssl_certificates_dir_);
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->SetSslCertificatesDir(dir);
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->SetSslCertificatesDir(dir);
   }
 }
 
 void SerfUrlAsyncFetcher::SetSslCertificatesFile(StringPiece file) {
   file.CopyToString(&ssl_certificates_file_);
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->SetSslCertificatesFile(file);
+  for (int i = 0, n = threaded_fetchers_.size(); i < n; ++i) {
+    threaded_fetchers_[i]->SetSslCertificatesFile(file);
   }
 }
 
@@ -18,9 +18,12 @@
 #ifndef PAGESPEED_SYSTEM_SERF_URL_ASYNC_FETCHER_H_
 #define PAGESPEED_SYSTEM_SERF_URL_ASYNC_FETCHER_H_
 
+#include <list>
+#include <map>
 #include <vector>
 
 #include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest_prod.h"
 #include "pagespeed/kernel/base/pool.h"
@@ -48,12 +51,14 @@
 struct apr_pool_t;
 struct apr_uri_t;
 struct serf_context_t;
+struct ssl_session_st;
 
 namespace net_instaweb {
 
 class AsyncFetch;
 class MessageHandler;
 class Statistics;
+class SerfConnection;
 class SerfFetch;
 class SerfThreadedFetcher;
 class Timer;
@@ -69,6 +74,14 @@ struct SerfStats {
   static const char kSerfFetchTimeoutCount[];
   static const char kSerfFetchFailureCount[];
   static const char kSerfFetchCertErrors[];
+  static const char kSerfConnectionPoolHits[];
+  static const char kSerfConnectionPoolMisses[];
+
+  // Each fetcher thread has its own gauges of active and queued fetches,
+  // named kSerfFetchThreadPrefix + thread index + suffix.
+  static const char kSerfFetchThreadPrefix[];
+  static const char kSerfFetchThreadActiveSuffix[];
+  static const char kSerfFetchThreadQueuedSuffix[];
 };
 
 // Identifies the set of HTML keywords.  This is used in error messages emitted
@@ -93,6 +106,10 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
     kThreadedAndMainline
   };
 
+  static const int kDefaultMaxIdleConnectionsPerHost;
+  static const int64 kDefaultIdleConnectionTimeoutMs;
+  static const int kMaxThreads;
+
   SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
                       ThreadSystem* thread_system,
                       Statistics* statistics, Timer* timer, int64 timeout_ms,
@@ -102,6 +119,14 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
 
   static void InitStats(Statistics* statistics);
 
+  // Runs background fetches on num_threads threads (1 by default, at most
+  // kMaxThreads), each with its own serf context.  Fetches to a host go to
+  // the same thread, so they can share its kept-alive connections, unless
+  // that thread has fallen well behind another.  Must be called before the
+  // first Fetch.
+  void SetNumThreads(int num_threads);
+  int num_threads() const { return threaded_fetchers_.size(); }
+
   // Stops all active fetches and prevents further fetches from starting
   // (they will instead quickly call back to ->Done(false).
   virtual void ShutDown();
@@ -172,6 +197,22 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
     return ssl_certificates_file_;
   }
 
+  // Completed fetches leave their connection open for reuse by later fetches
+  // to the same host, keeping up to this many idle connections per host.
+  // 0 closes each connection when its fetch is done.
+  void set_max_idle_connections_per_host(int x);
+  int max_idle_connections_per_host() const {
+    return max_idle_connections_per_host_;
+  }
+
+  // Idle connections are closed rather than reused after this long, as
+  // origins drop idle keep-alive connections on their own schedule, and a
+  // request sent down a connection the origin has just closed is lost.
+  void set_idle_connection_timeout_ms(int64 x);
+  int64 idle_connection_timeout_ms() const {
+    return idle_connection_timeout_ms_;
+  }
+
  protected:
   typedef Pool<SerfFetch> SerfFetchPool;
 
@@ -208,11 +249,44 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   bool WaitForActiveFetchesHelper(int64 max_ms,
                                   MessageHandler* message_handler);
 
+  // Updates active_count_, and the thread's gauge, as fetches start and
+  // finish.
+  void AddActiveFetches(int delta);
+
   // This cleans up the serf resources for fetches that errored out.
   // Must be called only immediately after running the serf event loop.
   // Must be called with mutex_ held.
   void CleanupFetchesWithErrors();
 
+  // Returns an idle connection with the given key, taking it out of the
+  // pool, or NULL if there is none.  Must be called with mutex_ held.
+  SerfConnection* TakeIdleConnection(const GoogleString& key);
+
+  // Returns the connection of a completed fetch to the idle pool, or closes
+  // it if the pool is full.  Must not be called from within the serf event
+  // loop, as it may close connections.  Must be called with mutex_ held.
+  void ReleaseConnection(SerfConnection* connection);
+
+  // Closes idle connections that have timed out, and the oldest ones in
+  // excess of the total limit.  Must be called with mutex_ held.
+  void CloseExpiredConnections();
+  void CloseIdleConnections();
+
+  // A fetch whose request was lost because the origin closed a reused
+  // connection asks to be retried on a new connection.  The retry happens
+  // in RetryLostFetches, once we are out of the serf event loop.
+  void RetryFetch(SerfFetch* fetch) { retry_fetches_.push_back(fetch); }
+  void RetryLostFetches();
+
+#if SERF_HTTPS_FETCHING
+  // Remembers the TLS session of a connection to key, so a later connection
+  // to the same host can resume it rather than do a full handshake.  Takes
+  // ownership of session.
+  void SaveTlsSession(const GoogleString& key, ssl_session_st* session);
+  ssl_session_st* FindTlsSession(const GoogleString& key);
+  void ClearTlsSessions();
+#endif
+
   // These must be accessed with mutex_ held.
   bool shutdown() const { return shutdown_; }
   void set_shutdown(bool s) { shutdown_ = s; }
@@ -228,13 +302,29 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
 
   typedef std::vector<SerfFetch*> FetchVector;
   SerfFetchPool completed_fetches_;
-  SerfThreadedFetcher* threaded_fetcher_;
+  FetchVector retry_fetches_;
+  std::vector<SerfThreadedFetcher*> threaded_fetchers_;
+
+  // Idle connections, least recently used first.  Protected by mutex_.
+  typedef std::list<SerfConnection*> ConnectionList;
+  ConnectionList idle_connections_;
+
+#if SERF_HTTPS_FETCHING
+  typedef std::map<GoogleString, ssl_session_st*> TlsSessionMap;
+  TlsSessionMap tls_sessions_;
+#endif
 
   // This is protected because it's updated along with active_fetches_,
   // which happens in subclass SerfThreadedFetcher as well as this class.
   UpDownCounter* active_count_;
+  UpDownCounter* thread_active_count_;  // NULL except in threads.
+
+  // Fetches handed to this fetcher that have not completed yet, queued or
+  // active.  Read without any lock to pick the least loaded thread.
+  AtomicInt32 num_outstanding_;
 
  private:
+  friend class SerfConnection;  // To access the TLS session cache.
   friend class SerfFetch;  // To access stats variables below.
 
   // Note: returned string memory substring of memory in the pool.
@@ -250,6 +340,9 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   static bool ParseHttpsOptions(StringPiece directive, uint32* options,
                                 GoogleString* error_message);
 
+  // Picks the thread to run a fetch of url.
+  SerfThreadedFetcher* ChooseThread(StringPiece url);
+
   Variable* request_count_;
   Variable* byte_count_;
   Variable* time_duration_ms_;
@@ -257,14 +350,20 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   Variable* timeout_count_;
   Variable* failure_count_;
   Variable* cert_errors_;
+  Variable* pool_hits_;
+  Variable* pool_misses_;
   const int64 timeout_ms_;
   bool shutdown_;
   bool list_outstanding_urls_on_error_;
   bool track_original_content_length_;
   uint32 https_options_;  // Composed of HttpsOptions ORed together.
   MessageHandler* message_handler_;
+  Statistics* statistics_;
+  GoogleString proxy_;
   GoogleString ssl_certificates_dir_;
   GoogleString ssl_certificates_file_;
+  int max_idle_connections_per_host_;
+  int64 idle_connection_timeout_ms_;
 
   DISALLOW_COPY_AND_ASSIGN(SerfUrlAsyncFetcher);
 };
@@ -303,6 +402,11 @@ class SerfFetch : public PoolElement<SerfFetch> {
   // Must be called after serf_context_run, with fetcher's mutex_ held.
   void CleanupIfError();
 
+  // Reissues the request on a new connection, after the origin closed the
+  // reused connection it was sent on.  Must be called after serf_context_run,
+  // with fetcher's mutex_ held.
+  void Retry();
+
   // For use only by unit tests.  Calls ParseUrl(), then makes things available
   // for checking.
   void ParseUrlForTesting(bool* status,
@@ -320,30 +424,9 @@ class SerfFetch : public PoolElement<SerfFetch> {
   MessageHandler* message_handler() { return message_handler_; }
 
  private:
-  // Static functions used in callbacks.
+  friend class SerfConnection;  // To report SSL certificate validation.
 
-  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
-  // (surfacepatterns@gmail.com).
-  //
-  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
-  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
-#if SERF_HTTPS_FETCHING
-  static apr_status_t SSLCertValidate(void *data, int failures,
-                                   const serf_ssl_certificate_t *cert);
-
-  static apr_status_t SSLCertChainValidate(
-      void *data, int failures, int error_depth,
-      const serf_ssl_certificate_t * const *certs,
-      apr_size_t certs_count);
-#endif
-
-  static apr_status_t ConnectionSetup(
-      apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-      void* setup_baton, apr_pool_t* pool);
-  static void ClosedConnection(serf_connection_t* conn,
-                               void* closed_baton,
-                               apr_status_t why,
-                               apr_pool_t* pool);
+  // Static functions used in callbacks.
   static serf_bucket_t* AcceptResponse(serf_request_t* request,
                                        serf_bucket_t* stream,
                                        void* acceptor_baton,
@@ -411,6 +494,17 @@ class SerfFetch : public PoolElement<SerfFetch> {
                                    apr_pool_t* pool);
   bool ParseUrl();
 
+  // Identifies the connections this fetch can be sent on: the same scheme,
+  // host and port and, for https, the same SNI host.
+  GoogleString ConnectionKey() const;
+
+  // Finds an idle connection to reuse, if allow_reuse, or else opens a new
+  // one, and queues our request on it.
+  bool Connect(bool allow_reuse);
+
+  // Whether the origin will keep the connection open after this response.
+  bool KeepsConnectionAlive() const;
+
   SerfUrlAsyncFetcher* fetcher_;
   Timer* timer_;
   const GoogleString str_url_;
@@ -423,18 +517,19 @@ class SerfFetch : public PoolElement<SerfFetch> {
   MessageHandler* message_handler_;
 
   apr_pool_t* pool_;
-  serf_bucket_alloc_t* bucket_alloc_;
   apr_uri_t url_;
   const char* host_header_;  // in pool_
   const char* sni_host_;  // in pool_
-  serf_connection_t* connection_;
+  SerfConnection* connection_;
+  bool keep_alive_;  // The response headers allow connection reuse.
+  bool reuse_connection_;  // The response was read through to the end.
+  bool retried_;
   size_t bytes_received_;
   int64 fetch_start_ms_;
   int64 fetch_end_ms_;
 
   // Variables used for HTTPS connection handling
   bool using_https_;
-  serf_ssl_context_t* ssl_context_;
   const char* ssl_error_message_;
 
   DISALLOW_COPY_AND_ASSIGN(SerfFetch);
@@ -512,6 +512,34 @@ TEST_F(SerfUrlAsyncFetcherTest, FetchTwoURLs) {
   EXPECT_EQ(0, ActiveFetches());
 }
 
+// The second fetch from the same host should go out on the connection the
+// first one left open.
+TEST_F(SerfUrlAsyncFetcherTest, ReuseKeptAliveConnection) {
+  Variable* hits =
+      statistics_->GetVariable(SerfStats::kSerfConnectionPoolHits);
+  Variable* misses =
+      statistics_->GetVariable(SerfStats::kSerfConnectionPoolMisses);
+  EXPECT_TRUE(TestFetch(kModpagespeedSite, kModpagespeedSite));
+  EXPECT_EQ(0, hits->Get());
+  int64 first_misses = misses->Get();
+  EXPECT_EQ(1, first_misses - flaky_retries_);
+
+  EXPECT_TRUE(TestFetch(kModpagespeedSite, kModpagespeedSite));
+  EXPECT_EQ(1, hits->Get());
+  EXPECT_EQ(first_misses, misses->Get());
+  EXPECT_EQ(0, ActiveFetches());
+}
+
+TEST_F(SerfUrlAsyncFetcherTest, NoConnectionReuseWhenDisabled) {
+  serf_url_async_fetcher_->set_max_idle_connections_per_host(0);
+  EXPECT_TRUE(TestFetch(kModpagespeedSite, kModpagespeedSite));
+  EXPECT_TRUE(TestFetch(kModpagespeedSite, kModpagespeedSite));
+  EXPECT_EQ(0, statistics_->GetVariable(
+      SerfStats::kSerfConnectionPoolHits)->Get());
+  EXPECT_EQ(0, statistics_->GetVariable(
+      SerfStats::kSerfConnectionPoolMisses)->Get());
+}
+
 TEST_F(SerfUrlAsyncFetcherTest, TestCancelThreeThreaded) {
   StartFetches(kModpagespeedSite, kGoogleLogo);
 }
@@ -587,6 +615,36 @@ TEST_F(SerfUrlAsyncFetcherTest, TestThreeThreaded) {
   ValidateFetches(kModpagespeedSite, kGoogleLogo);
 }
 
+TEST_F(SerfUrlAsyncFetcherTest, TestThreeOnSeveralThreads) {
+  serf_url_async_fetcher_->SetNumThreads(3);
+  EXPECT_EQ(3, serf_url_async_fetcher_->num_threads());
+  StartFetches(kModpagespeedSite, kGoogleLogo);
+  int done = WaitTillDone(kModpagespeedSite, kGoogleLogo);
+  EXPECT_EQ(3, done);
+  ValidateFetches(kModpagespeedSite, kGoogleLogo);
+
+  // Once everything is done, every thread's gauges should be back to zero.
+  serf_url_async_fetcher_->WaitForActiveFetches(
+      kWaitTimeoutMs, &message_handler_, SerfUrlAsyncFetcher::kThreadedOnly);
+  EXPECT_EQ(0, ActiveFetches());
+  for (int i = 0; i < serf_url_async_fetcher_->num_threads(); ++i) {
+    GoogleString prefix = StrCat(SerfStats::kSerfFetchThreadPrefix,
+                                 IntegerToString(i));
+    EXPECT_EQ(0, statistics_->GetUpDownCounter(StrCat(
+        prefix, SerfStats::kSerfFetchThreadActiveSuffix))->Get());
+    EXPECT_EQ(0, statistics_->GetUpDownCounter(StrCat(
+        prefix, SerfStats::kSerfFetchThreadQueuedSuffix))->Get());
+  }
+}
+
+TEST_F(SerfUrlAsyncFetcherTest, NumThreadsIsClamped) {
+  serf_url_async_fetcher_->SetNumThreads(0);
+  EXPECT_EQ(1, serf_url_async_fetcher_->num_threads());
+  serf_url_async_fetcher_->SetNumThreads(1000);
+  EXPECT_EQ(SerfUrlAsyncFetcher::kMaxThreads,
+            serf_url_async_fetcher_->num_threads());
+}
+
 TEST_F(SerfUrlAsyncFetcherTest, TestTimeout) {
   // Try this up to 10 times.  We expect the fetch to timeout, but it might
   // fail for some other reason instead, such as 'Serf status 111(Connection
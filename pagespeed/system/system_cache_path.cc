@@ -29,6 +29,7 @@
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
@@ -39,6 +40,7 @@ namespace net_instaweb {
 
 const char SystemCachePath::kFileCache[] = "file_cache";
 const char SystemCachePath::kLruCache[] = "lru_cache";
+const char SystemCachePath::kLruCacheTinyLfu[] = "lru_cache_tinylfu";
 
 // The SystemCachePath encapsulates a cache-sharing model where a user specifies
 // a file-cache path per virtual-host.  With each file-cache object we keep
@@ -62,6 +64,7 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       clean_size_explicitly_set_(config->has_file_cache_clean_size_kb()),
       clean_inode_limit_explicitly_set_(
           config->has_file_cache_clean_inode_limit()),
+      lru_admission_policy_(kLruAdmission),
       mutex_(factory->thread_system()->NewMutex()) {
   if (cache_flush_filename_.empty()) {
     if (enable_cache_purge_) {
@@ -109,6 +112,7 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       config->file_cache_clean_interval_ms(),
       config->file_cache_clean_size_kb() * 1024,
       config->file_cache_clean_inode_limit());
+  policy->use_index = config->file_cache_index();
   file_cache_backend_ =
       new FileCache(config->file_cache_path(), factory->file_system(),
                     factory->thread_system(), NULL, policy,
@@ -122,6 +126,10 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
     LRUCache* lru_cache = new LRUCache(
         config->lru_cache_kb_per_process() * 1024);
     factory->TakeOwnership(lru_cache);
+    lru_admission_policy_ = ParseAdmissionPolicy(
+        config->lru_cache_admission_policy(), "LRUCacheAdmissionPolicy",
+        factory->message_handler());
+    lru_cache->set_admission_policy(lru_admission_policy_);
 
     // We only add the threadsafe-wrapper to the LRUCache.  The FileCache
     // is naturally thread-safe because it's got no writable member variables.
@@ -131,8 +139,12 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
         new ThreadsafeCache(lru_cache, factory->thread_system()->NewMutex());
     factory->TakeOwnership(ts_cache);
 #if CACHE_STATISTICS
-    lru_cache_ = new CacheStats(kLruCache, ts_cache, factory->timer(),
-                                factory->statistics());
+    // Stats are kept separately per admission policy so that the hit
+    // ratios of servers running different policies can be compared.
+    lru_cache_ = new CacheStats(
+        (lru_admission_policy_ == kTinyLfuAdmission) ? kLruCacheTinyLfu
+                                                     : kLruCache,
+        ts_cache, factory->timer(), factory->statistics());
     factory->TakeOwnership(lru_cache_);
 #else
     lru_cache_ = ts_cache;
@@ -143,6 +155,17 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
 SystemCachePath::~SystemCachePath() {
 }
 
+// static
+CacheAdmissionPolicy SystemCachePath::ParseAdmissionPolicy(
+    StringPiece value, const char* option_name, MessageHandler* handler) {
+  CacheAdmissionPolicy policy = kLruAdmission;
+  if (!ParseCacheAdmissionPolicy(value, &policy)) {
+    handler->Message(kWarning, "Unknown %s '%s', using lru", option_name,
+                     value.as_string().c_str());
+  }
+  return policy;
+}
+
 // static
 GoogleString SystemCachePath::CachePath(SystemRewriteOptions* config) {
   return (config->unplugged()
@@ -178,6 +201,22 @@ void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
                true, "InodeLimit",
                &policy->target_inode_count,
                &clean_inode_limit_explicitly_set_);
+
+  // Indexing is enabled for a shared cache path if any vhost asks for it;
+  // it does not change what is stored, only how cleaning finds victims.
+  policy->use_index |= config->file_cache_index();
+
+  if ((lru_cache_ != NULL) &&
+      (ParseAdmissionPolicy(config->lru_cache_admission_policy(),
+                            "LRUCacheAdmissionPolicy",
+                            factory_->message_handler()) !=
+       lru_admission_policy_)) {
+    factory_->message_handler()->Message(
+        kWarning,
+        "Conflicting settings for LRUCacheAdmissionPolicy for file-cache %s, "
+        "keeping %s", path_.c_str(),
+        CacheAdmissionPolicyName(lru_admission_policy_));
+  }
 }
 
 void SystemCachePath::MergeEntries(int64 config_value, bool config_was_set,
@@ -24,6 +24,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/util/copy_on_write.h"
 
 namespace net_instaweb {
@@ -51,6 +52,7 @@ class SystemCachePath {
   // CacheStats prefixes.
   static const char kFileCache[];
   static const char kLruCache[];
+  static const char kLruCacheTinyLfu[];
 
   SystemCachePath(const StringPiece& path,
                   const SystemRewriteOptions* config,
@@ -62,6 +64,12 @@ class SystemCachePath {
   // objects between vhosts.  This key is given to the constructor as 'path'.
   static GoogleString CachePath(SystemRewriteOptions* config);
 
+  // Parses the value of the admission policy option called option_name,
+  // warning and returning kLruAdmission if it's not understood.
+  static CacheAdmissionPolicy ParseAdmissionPolicy(StringPiece value,
+                                                   const char* option_name,
+                                                   MessageHandler* handler);
+
   // Per-process in-memory LRU, with any stats/thread safety wrappers, or NULL.
   CacheInterface* lru_cache() { return lru_cache_; }
 
@@ -80,7 +88,8 @@ class SystemCachePath {
 
   // When there are multiple configurations which specify the same cache
   // path, we must merge the other settings: the cleaning interval, size, and
-  // inode count.
+  // inode count.  The LRU cache admission policy can't be changed once the
+  // cache exists, so conflicting settings just produce a warning.
   void MergeConfig(const SystemRewriteOptions* config);
 
   // Associates a ServerContext with this CachePath, enabling cache purges
@@ -144,6 +153,7 @@ class SystemCachePath {
   bool clean_interval_explicitly_set_;
   bool clean_size_explicitly_set_;
   bool clean_inode_limit_explicitly_set_;
+  CacheAdmissionPolicy lru_admission_policy_;
 
   scoped_ptr<PurgeContext> purge_context_;
 
@@ -17,6 +17,7 @@
 
 #include "pagespeed/system/system_caches.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
 #include <utility>
@@ -28,25 +29,36 @@
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "pagespeed/system/apr_mem_cache.h"
+#include "pagespeed/system/binary_mem_cache.h"
+#include "pagespeed/system/redis_cache.h"
 #include "pagespeed/system/system_cache_path.h"
 #include "pagespeed/system/system_rewrite_options.h"
 #include "pagespeed/system/system_server_context.h"
 #include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/cache/async_cache.h"
+#include "pagespeed/kernel/cache/blocking_cache.h"
 #include "pagespeed/kernel/cache/cache_batcher.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
+#include "pagespeed/kernel/cache/coalescing_cache.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/cache/purge_context.h"
+#include "pagespeed/kernel/cache/sequenced_callback_cache.h"
+#include "pagespeed/kernel/cache/tiered_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
@@ -57,7 +69,10 @@ namespace net_instaweb {
 
 const char SystemCaches::kMemcachedAsync[] = "memcached_async";
 const char SystemCaches::kMemcachedBlocking[] = "memcached_blocking";
+const char SystemCaches::kRedisAsync[] = "redis_async";
+const char SystemCaches::kRedisBlocking[] = "redis_blocking";
 const char SystemCaches::kShmCache[] = "shm_cache";
+const char SystemCaches::kShmCacheTinyLfu[] = "shm_cache_tinylfu";
 const char SystemCaches::kDefaultSharedMemoryPath[] = "pagespeed_default_shm";
 
 SystemCaches::SystemCaches(
@@ -69,7 +84,8 @@ SystemCaches::SystemCaches(
       is_root_process_(true),
       was_shut_down_(false),
       cache_hasher_(20),
-      default_shm_metadata_cache_creation_failed_(false) {
+      default_shm_metadata_cache_creation_failed_(false),
+      tiered_cache_used_(false) {
 }
 
 SystemCaches::~SystemCaches() {
@@ -101,6 +117,7 @@ void SystemCaches::ShutDown(MessageHandler* message_handler) {
   // crash and always leak memory.  Note that if memcached crashes, as
   // opposed to hanging, it will probably not appear wedged.
   memcached_pool_.reset(NULL);
+  redis_pool_.reset(NULL);
 
   if (is_root_process_) {
     // Cleanup per-path shm resources.
@@ -113,6 +130,9 @@ void SystemCaches::ShutDown(MessageHandler* message_handler) {
     for (MetadataShmCacheMap::iterator p = metadata_shm_caches_.begin(),
              e = metadata_shm_caches_.end(); p != e; ++p) {
       if (p->second->cache_backend != NULL && p->second->initialized) {
+        if (!p->second->image_path.empty()) {
+          SaveShmMetadataCacheImage(p->second);
+        }
         MetadataShmCache::GlobalCleanup(shared_mem_runtime_, p->second->segment,
                                         message_handler);
       }
@@ -146,6 +166,17 @@ AprMemCache* SystemCaches::NewAprMemCache(const GoogleString& spec) {
   return mem_cache;
 }
 
+BinaryMemCache* SystemCaches::NewBinaryMemCache(const GoogleString& spec,
+                                                int connections_per_server) {
+  BinaryMemCache* mem_cache =
+      new BinaryMemCache(spec, connections_per_server, &cache_hasher_,
+                         factory_->statistics(), factory_->timer(),
+                         factory_->thread_system(),
+                         factory_->message_handler());
+  factory_->TakeOwnership(mem_cache);
+  return mem_cache;
+}
+
 SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
     SystemRewriteOptions* config) {
   // Find a memcache that matches the current spec, or create a new one
@@ -160,31 +191,68 @@ SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
       MemcachedMap::value_type(server_spec, MemcachedInterfaces()));
   MemcachedInterfaces& memcached = result.first->second;
   if (result.second) {
-    AprMemCache* mem_cache = NewAprMemCache(server_spec);
-    mem_cache->set_timeout_us(config->memcached_timeout_us());
-    memcache_servers_.push_back(mem_cache);
-
     int num_threads = config->memcached_threads();
-    if (num_threads != 0) {
-      if (num_threads != 1) {
-        factory_->message_handler()->Message(
-            kWarning, "ModPagespeedMemcachedThreads support for >1 thread "
-            "is not supported yet; changing to 1 thread (was %d)",
-            num_threads);
-        num_threads = 1;
-      }
+    int max_parallel_lookups = num_threads;
+    CacheInterface* mem_cache = NULL;
+    const GoogleString& protocol = config->memcached_protocol();
+    bool use_binary_protocol = StringCaseEqual(protocol, "binary");
+    if (!use_binary_protocol && !StringCaseEqual(protocol, "ascii")) {
+      factory_->message_handler()->Message(
+          kWarning, "Invalid ModPagespeedMemcachedProtocol %s; using ascii",
+          protocol.c_str());
+    }
 
+    if (use_binary_protocol) {
+      // The binary client never blocks, so it needs no worker threads for
+      // its lookups; each configured thread instead becomes a connection to
+      // every server.  It calls back from its event thread, though, which
+      // must not run client code: a callback doing a blocking lookup there
+      // would wait on itself.  So the async interface runs callbacks on a
+      // single memcached worker, and the blocking one (below) runs them on
+      // the thread that is waiting.
+      BinaryMemCache* binary_cache = NewBinaryMemCache(server_spec,
+                                                       num_threads);
+      binary_cache->set_timeout_us(config->memcached_timeout_us());
+      binary_memcache_servers_.push_back(binary_cache);
+      mem_cache = binary_cache;
       if (memcached_pool_.get() == NULL) {
-        // Note -- we will use the first value of ModPagespeedMemCacheThreads
-        // that we see in a VirtualHost, ignoring later ones.
         memcached_pool_.reset(
-            new QueuedWorkerPool(num_threads, "memcached",
-                                 factory_->thread_system()));
+            new QueuedWorkerPool(1, "memcached", factory_->thread_system()));
       }
-      memcached.async = new AsyncCache(mem_cache, memcached_pool_.get());
+      memcached.async = new SequencedCallbackCache(binary_cache,
+                                                   memcached_pool_.get());
       factory_->TakeOwnership(memcached.async);
+      memcached.value_size_threshold = BinaryMemCache::kValueSizeThreshold;
+      max_parallel_lookups = std::max(1, num_threads);
     } else {
-      memcached.async = mem_cache;
+      AprMemCache* apr_cache = NewAprMemCache(server_spec);
+      apr_cache->set_timeout_us(config->memcached_timeout_us());
+      memcache_servers_.push_back(apr_cache);
+      mem_cache = apr_cache;
+      memcached.value_size_threshold = AprMemCache::kValueSizeThreshold;
+
+      if (num_threads != 0) {
+        if (num_threads != 1) {
+          factory_->message_handler()->Message(
+              kWarning, "ModPagespeedMemcachedThreads support for >1 thread "
+              "is not supported yet; changing to 1 thread (was %d)",
+              num_threads);
+          num_threads = 1;
+          max_parallel_lookups = 1;
+        }
+
+        if (memcached_pool_.get() == NULL) {
+          // Note -- we will use the first value of ModPagespeedMemCacheThreads
+          // that we see in a VirtualHost, ignoring later ones.
+          memcached_pool_.reset(
+              new QueuedWorkerPool(num_threads, "memcached",
+                                   factory_->thread_system()));
+        }
+        memcached.async = new AsyncCache(apr_cache, memcached_pool_.get());
+        factory_->TakeOwnership(memcached.async);
+      } else {
+        memcached.async = apr_cache;
+      }
     }
 
     // Put the batcher above the stats so that the stats sees the MultiGets
@@ -201,13 +269,25 @@ SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
         memcached.async, factory_->thread_system()->NewMutex(),
         factory_->statistics());
     factory_->TakeOwnership(batcher);
-    if (num_threads != 0) {
-      batcher->set_max_parallel_lookups(num_threads);
+    if (max_parallel_lookups != 0) {
+      batcher->set_max_parallel_lookups(max_parallel_lookups);
     }
-    memcached.async = batcher;
+
+    // Lookups of a key that is already being looked up just wait for that.
+    memcached.async = new CoalescingCache(
+        batcher, factory_->thread_system()->NewMutex(),
+        factory_->statistics());
+    factory_->TakeOwnership(memcached.async);
 
     // Populate the blocking memcached interface, giving it its own
-    // statistics wrapper.
+    // statistics wrapper.  The binary client has to be made to wait for
+    // its callbacks, straight over the client rather than over the
+    // SequencedCallbackCache, so that a blocking lookup from a callback
+    // running on the memcached worker does not wait on that worker.
+    if (use_binary_protocol) {
+      mem_cache = new BlockingCache(mem_cache, factory_->thread_system());
+      factory_->TakeOwnership(mem_cache);
+    }
 #if CACHE_STATISTICS
     memcached.blocking = new CacheStats(kMemcachedBlocking, mem_cache,
                                         factory_->timer(),
@@ -220,6 +300,62 @@ SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
   return memcached;
 }
 
+SystemCaches::MemcachedInterfaces SystemCaches::GetRedis(
+    SystemRewriteOptions* config) {
+  // As with memcached, VirtualHosts with the same server spec share a
+  // RedisCache, configured by the first of them.
+  if (config->redis_servers().empty()) {
+    return MemcachedInterfaces();
+  }
+  const GoogleString& server_spec = config->redis_servers();
+  std::pair<MemcachedMap::iterator, bool> result = redis_map_.insert(
+      MemcachedMap::value_type(server_spec, MemcachedInterfaces()));
+  MemcachedInterfaces& redis = result.first->second;
+  if (result.second) {
+    RedisCache* redis_cache = new RedisCache(
+        server_spec, config->redis_cluster(), config->redis_ttl_sec(),
+        factory_->statistics(), factory_->timer(), factory_->thread_system(),
+        factory_->message_handler());
+    factory_->TakeOwnership(redis_cache);
+    redis_cache->set_timeout_us(config->redis_timeout_us());
+    redis_servers_.push_back(redis_cache);
+    redis.value_size_threshold = RedisCache::kValueSizeThreshold;
+
+    // RedisCache serializes the operations on each node's connection, so a
+    // single thread, fed MultiGets by the batcher, keeps it busy.
+    if (redis_pool_.get() == NULL) {
+      redis_pool_.reset(
+          new QueuedWorkerPool(1, "redis", factory_->thread_system()));
+    }
+    redis.async = new AsyncCache(redis_cache, redis_pool_.get());
+    factory_->TakeOwnership(redis.async);
+#if CACHE_STATISTICS
+    redis.async = new CacheStats(kRedisAsync, redis.async, factory_->timer(),
+                                 factory_->statistics());
+    factory_->TakeOwnership(redis.async);
+#endif
+
+    CacheBatcher* batcher = new CacheBatcher(
+        redis.async, factory_->thread_system()->NewMutex(),
+        factory_->statistics());
+    factory_->TakeOwnership(batcher);
+    batcher->set_max_parallel_lookups(1);
+    redis.async = new CoalescingCache(
+        batcher, factory_->thread_system()->NewMutex(),
+        factory_->statistics());
+    factory_->TakeOwnership(redis.async);
+
+#if CACHE_STATISTICS
+    redis.blocking = new CacheStats(kRedisBlocking, redis_cache,
+                                    factory_->timer(), factory_->statistics());
+    factory_->TakeOwnership(redis.blocking);
+#else
+    redis.blocking = redis_cache;
+#endif
+  }
+  return redis;
+}
+
 bool SystemCaches::CreateShmMetadataCache(
     StringPiece name, int64 size_kb, GoogleString* error_msg) {
   MetadataShmCacheInfo* cache_info = NULL;
@@ -277,6 +413,76 @@ NamedLockManager* SystemCaches::GetLockManager(SystemRewriteOptions* config) {
   return GetCache(config)->lock_manager();
 }
 
+CacheCodec* SystemCaches::NewCacheCodec(const SystemRewriteOptions* config) {
+  MessageHandler* handler = factory_->message_handler();
+  GoogleString dictionary;
+  const GoogleString& dictionary_file = config->compressed_cache_dictionary();
+  if (!dictionary_file.empty() &&
+      !factory_->file_system()->ReadFile(dictionary_file.c_str(), &dictionary,
+                                         handler)) {
+    handler->Message(
+        kWarning, "Unable to read ModPagespeedCompressedCacheDictionary %s; "
+        "compressing without it", dictionary_file.c_str());
+    dictionary.clear();
+  }
+  const GoogleString& name = config->compressed_cache_codec();
+  CacheCodec* codec = CacheCodec::Create(name, dictionary);
+  if (codec == NULL) {
+    handler->Message(
+        kWarning, "Invalid ModPagespeedCompressedCacheCodec %s; using %s",
+        name.c_str(), CacheCodec::kDeflate);
+    codec = CacheCodec::Create(CacheCodec::kDeflate, dictionary);
+  }
+  return codec;
+}
+
+void SystemCaches::RestoreShmMetadataCacheImage(
+    MetadataShmCacheInfo* cache_info) {
+  MessageHandler* handler = factory_->message_handler();
+  FileSystem* file_system = factory_->file_system();
+  NullMessageHandler null_handler;  // A missing image is not an error.
+  FileSystem::InputFile* file =
+      file_system->OpenInputFile(cache_info->image_path.c_str(),
+                                 &null_handler);
+  if (file == NULL) {
+    return;
+  }
+  if (cache_info->cache_backend->RestoreImage(file)) {
+    handler->Message(kInfo, "Restored shared memory cache %s from %s",
+                     cache_info->segment.c_str(),
+                     cache_info->image_path.c_str());
+  }
+  file_system->Close(file, handler);
+}
+
+void SystemCaches::SaveShmMetadataCacheImage(MetadataShmCacheInfo* cache_info) {
+  MessageHandler* handler = factory_->message_handler();
+  FileSystem* file_system = factory_->file_system();
+  // Like FileSystem::WriteFileAtomic, but a sector at a time, so the cache is
+  // never copied out of shared memory whole.
+  bool ok = false;
+  FileSystem::OutputFile* file = file_system->OpenTempFile(
+      StrCat(cache_info->image_path, ".temp"), handler);
+  if (file != NULL) {
+    GoogleString temp_filename = file->filename();
+    ok = cache_info->cache_backend->SaveImage(file);
+    ok = file_system->Close(file, handler) && ok;
+    if (ok) {
+      ok = file_system->RenameFile(temp_filename.c_str(),
+                                   cache_info->image_path.c_str(), handler);
+    }
+    if (!ok) {
+      NullMessageHandler null_handler;
+      file_system->RemoveFile(temp_filename.c_str(), &null_handler);
+    }
+  }
+  if (!ok) {
+    handler->Message(kWarning, "Unable to save shared memory cache %s to %s",
+                     cache_info->segment.c_str(),
+                     cache_info->image_path.c_str());
+  }
+}
+
 SystemCaches::MetadataShmCacheInfo* SystemCaches::LookupShmMetadataCache(
     const GoogleString& name) {
   if (name.empty()) {
@@ -356,7 +562,15 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
       GetShmMetadataCacheOrDefault(config);
   CacheInterface* shm_metadata_cache = (shm_metadata_cache_info != NULL) ?
       shm_metadata_cache_info->cache_to_use : NULL;
+  // Redis, if configured, takes the place of memcached.
   MemcachedInterfaces memcached = GetMemcached(config);
+  if (memcached.async == NULL) {
+    memcached = GetRedis(config);
+  } else if (!config->redis_servers().empty()) {
+    factory_->message_handler()->Message(
+        kWarning, "Both memcached and redis are configured; ignoring "
+        "ModPagespeedRedisServers %s", config->redis_servers().c_str());
+  }
   CacheInterface* property_store_cache = NULL;
   CacheInterface* http_l2 = file_cache;
   Statistics* stats = server_context->statistics();
@@ -372,13 +586,13 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     // memcache & file-cache specs as a key, so it's simpler to make a new
     // small FallbackCache object for each VirtualHost.
     memcached.async = new FallbackCache(memcached.async, file_cache,
-                                        AprMemCache::kValueSizeThreshold,
+                                        memcached.value_size_threshold,
                                         factory_->message_handler());
     http_l2 = memcached.async;
     server_context->DeleteCacheOnDestruction(memcached.async);
 
     memcached.blocking = new FallbackCache(memcached.blocking, file_cache,
-                                           AprMemCache::kValueSizeThreshold,
+                                           memcached.value_size_threshold,
                                            factory_->message_handler());
     server_context->DeleteCacheOnDestruction(memcached.blocking);
 
@@ -404,6 +618,8 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     http_cache = new HTTPCache(http_l2, factory_->timer(),
                                factory_->hasher(), stats);
     http_cache->SetCompressionLevel(config->http_cache_compression_level());
+    http_cache->set_store_identity_variant(
+        config->http_cache_identity_variant());
   } else {
     // L1 is LRU, with the L2 as computed above.
     WriteThroughCache* write_through_http_cache = new WriteThroughCache(
@@ -414,6 +630,8 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
                                factory_->hasher(), stats);
     http_cache->set_cache_levels(2);
     http_cache->SetCompressionLevel(config->http_cache_compression_level());
+    http_cache->set_store_identity_variant(
+        config->http_cache_identity_variant());
   }
 
   http_cache->set_max_cacheable_response_content_length(max_content_length);
@@ -460,8 +678,29 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
       // which would remove the need to write through to the file cache.
       MetadataShmCacheInfo* default_cache_info =
           LookupShmMetadataCache(kDefaultSharedMemoryPath);
-      if (default_cache_info != NULL &&
-          shm_metadata_cache == default_cache_info->cache_to_use) {
+      bool is_default_shm_cache =
+          (default_cache_info != NULL &&
+           shm_metadata_cache == default_cache_info->cache_to_use);
+      if (config->tiered_metadata_cache()) {
+        // Keep only popular entries in shared memory, and everything in the
+        // file cache.  All the VirtualHosts using this shared memory cache
+        // share its popularity estimates.
+        MetadataShmCache* backend = shm_metadata_cache_info->cache_backend;
+        if (shm_metadata_cache_info->tiered_sketch.get() == NULL) {
+          shm_metadata_cache_info->tiered_sketch.reset(
+              new FrequencySketch(backend->MaxEntries()));
+        }
+        TieredCache* tiered_cache = new TieredCache(
+            shm_metadata_cache, file_cache, backend->MaxValueSize(),
+            shm_metadata_cache_info->tiered_sketch.get(), stats);
+        tiered_cache->set_promotion_threshold(
+            config->tiered_cache_promotion_threshold());
+        // As for the FallbackCache below, keys don't take up value space.
+        tiered_cache->set_account_for_key_size(false);
+        server_context->DeleteCacheOnDestruction(tiered_cache);
+        metadata_l2 = tiered_cache;
+        tiered_cache_used_ = true;
+      } else if (is_default_shm_cache) {
         // They're running the SHM cache because it's the default.  Go L1/L2 to
         // be conservative.
         metadata_l1 = shm_metadata_cache;
@@ -511,9 +750,11 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     property_store_cache = metadata_l2;
   }
   if (config->compress_metadata_cache()) {
-    metadata_cache = new CompressedCache(metadata_cache, stats);
+    metadata_cache = new CompressedCache(metadata_cache,
+                                         NewCacheCodec(config), stats);
     server_context->DeleteCacheOnDestruction(metadata_cache);
-    property_store_cache = new CompressedCache(property_store_cache, stats);
+    property_store_cache = new CompressedCache(property_store_cache,
+                                               NewCacheCodec(config), stats);
     server_context->DeleteCacheOnDestruction(property_store_cache);
   }
   DCHECK(property_store_cache->IsBlocking());
@@ -534,7 +775,33 @@ void SystemCaches::RegisterConfig(SystemRewriteOptions* config) {
 
   // GetShmMetadataCacheOrDefault will create a default cache if one is needed
   // and doesn't exist yet.
-  GetShmMetadataCacheOrDefault(config);
+  MetadataShmCacheInfo* shm_cache = GetShmMetadataCacheOrDefault(config);
+  if ((shm_cache != NULL) && (shm_cache->cache_backend != NULL)) {
+    // The policy has to be settled before RootInit so that children inherit
+    // it; the first config to use a cache gets to pick it.
+    CacheAdmissionPolicy policy = SystemCachePath::ParseAdmissionPolicy(
+        config->shm_cache_admission_policy(),
+        "SharedMemoryCacheAdmissionPolicy", factory_->message_handler());
+    if (!shm_cache->admission_policy_configured) {
+      shm_cache->cache_backend->set_admission_policy(policy);
+      shm_cache->admission_policy_configured = true;
+    } else if (policy != shm_cache->cache_backend->admission_policy()) {
+      factory_->message_handler()->Message(
+          kWarning,
+          "Conflicting settings for SharedMemoryCacheAdmissionPolicy for "
+          "shared memory cache %s, keeping %s", shm_cache->segment.c_str(),
+          CacheAdmissionPolicyName(
+              shm_cache->cache_backend->admission_policy()));
+    }
+    if (!shm_cache->image_configured) {
+      if (config->shm_cache_image() && !config->file_cache_path().empty()) {
+        shm_cache->image_path = config->file_cache_path();
+        EnsureEndsInSlash(&shm_cache->image_path);
+        StrAppend(&shm_cache->image_path, FileCache::kShmCacheImageName);
+      }
+      shm_cache->image_configured = true;
+    }
+  }
 }
 
 void SystemCaches::RootInit() {
@@ -543,8 +810,14 @@ void SystemCaches::RootInit() {
     MetadataShmCacheInfo* cache_info = p->second;
     if (cache_info->cache_backend->Initialize()) {
       cache_info->initialized = true;
+      if (!cache_info->image_path.empty()) {
+        RestoreShmMetadataCacheImage(cache_info);
+      }
+      bool tiny_lfu = (cache_info->cache_backend->admission_policy() ==
+                       kTinyLfuAdmission);
       cache_info->cache_to_use =
-          new CacheStats(kShmCache, cache_info->cache_backend,
+          new CacheStats(tiny_lfu ? kShmCacheTinyLfu : kShmCache,
+                         cache_info->cache_backend,
                          factory_->timer(), factory_->statistics());
       factory_->TakeOwnership(cache_info->cache_to_use);
     } else {
@@ -595,6 +868,19 @@ void SystemCaches::ChildInit() {
       abort();  // TODO(jmarantz): is there a better way to exit?
     }
   }
+  for (int i = 0, n = binary_memcache_servers_.size(); i < n; ++i) {
+    BinaryMemCache* mem_cache = binary_memcache_servers_[i];
+    if (!mem_cache->Connect()) {
+      factory_->message_handler()->MessageS(kError, "Memory cache failed");
+      abort();
+    }
+  }
+  for (int i = 0, n = redis_servers_.size(); i < n; ++i) {
+    if (!redis_servers_[i]->Connect()) {
+      factory_->message_handler()->MessageS(kError, "Redis cache failed");
+      abort();
+    }
+  }
 }
 
 void SystemCaches::StopCacheActivity() {
@@ -615,20 +901,32 @@ void SystemCaches::StopCacheActivity() {
     CacheInterface* cache = p->second.async;
     cache->ShutDown();
   }
+  for (MemcachedMap::iterator p = redis_map_.begin(),
+           e = redis_map_.end(); p != e; ++p) {
+    p->second.async->ShutDown();
+  }
 
   // TODO(morlovich): Also shutdown shm caches
 }
 
 void SystemCaches::InitStats(Statistics* statistics) {
   AprMemCache::InitStats(statistics);
+  BinaryMemCache::InitStats(statistics);
+  RedisCache::InitStats(statistics);
   FileCache::InitStats(statistics);
   CacheStats::InitStats(SystemCachePath::kFileCache, statistics);
   CacheStats::InitStats(SystemCachePath::kLruCache, statistics);
+  CacheStats::InitStats(SystemCachePath::kLruCacheTinyLfu, statistics);
   CacheStats::InitStats(kShmCache, statistics);
+  CacheStats::InitStats(kShmCacheTinyLfu, statistics);
   CacheStats::InitStats(kMemcachedAsync, statistics);
   CacheStats::InitStats(kMemcachedBlocking, statistics);
+  CacheStats::InitStats(kRedisAsync, statistics);
+  CacheStats::InitStats(kRedisBlocking, statistics);
+  CoalescingCache::InitStats(statistics);
   CompressedCache::InitStats(statistics);
   PurgeContext::InitStats(statistics);
+  TieredCache::InitStats(statistics);
 }
 
 void SystemCaches::PrintCacheStats(StatFlags flags, GoogleString* out) {
@@ -648,6 +946,11 @@ void SystemCaches::PrintCacheStats(StatFlags flags, GoogleString* out) {
     }
   }
 
+  if (tiered_cache_used_) {
+    StrAppend(out, "\nTiered metadata cache statistics:\n",
+              TieredCache::DumpStats(factory_->statistics()));
+  }
+
   if (flags & kIncludeMemcached) {
     for (int i = 0, n = memcache_servers_.size(); i < n; ++i) {
       AprMemCache* mem_cache = memcache_servers_[i];
@@ -656,6 +959,20 @@ void SystemCaches::PrintCacheStats(StatFlags flags, GoogleString* out) {
                   mem_cache->server_spec());
       }
     }
+    for (int i = 0, n = binary_memcache_servers_.size(); i < n; ++i) {
+      BinaryMemCache* mem_cache = binary_memcache_servers_[i];
+      if (!mem_cache->GetStatus(out)) {
+        StrAppend(out, "\nError getting memcached server status for ",
+                  mem_cache->server_spec());
+      }
+    }
+    for (int i = 0, n = redis_servers_.size(); i < n; ++i) {
+      RedisCache* redis_cache = redis_servers_[i];
+      if (!redis_cache->GetStatus(out)) {
+        StrAppend(out, "\nError getting redis server status for ",
+                  redis_cache->server_spec());
+      }
+    }
   }
 }
 
@@ -26,15 +26,19 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 
 namespace net_instaweb {
 
 class AbstractSharedMem;
 class AprMemCache;
+class BinaryMemCache;
+class CacheCodec;
 class CacheInterface;
 class MessageHandler;
 class NamedLockManager;
+class RedisCache;
 class QueuedWorkerPool;
 class RewriteDriverFactory;
 class ServerContext;
@@ -61,7 +65,10 @@ class SystemCaches {
   // CacheStats prefixes.
   static const char kMemcachedAsync[];
   static const char kMemcachedBlocking[];
+  static const char kRedisAsync[];
+  static const char kRedisBlocking[];
   static const char kShmCache[];
+  static const char kShmCacheTinyLfu[];
 
   static const char kDefaultSharedMemoryPath[];
 
@@ -138,11 +145,16 @@ class SystemCaches {
   // Create a new AprMemCache from the given hostname[:port] specification.
   AprMemCache* NewAprMemCache(const GoogleString& spec);
 
+  // Create a new BinaryMemCache from the given hostname[:port] specification.
+  BinaryMemCache* NewBinaryMemCache(const GoogleString& spec,
+                                    int connections_per_server);
+
  private:
   typedef SharedMemCache<64> MetadataShmCache;
   struct MetadataShmCacheInfo {
     MetadataShmCacheInfo()
-        : cache_to_use(NULL), cache_backend(NULL), initialized(false) {}
+        : cache_to_use(NULL), cache_backend(NULL), initialized(false),
+          admission_policy_configured(false), image_configured(false) {}
 
     // Note that the fields may be NULL if e.g. initialization failed.
     CacheInterface* cache_to_use;  // may be CacheStats or such.
@@ -151,12 +163,24 @@ class SystemCaches {
     bool initialized;  // This is needed since in some scenarios we may
                        // not end up as far as calling ->Initialize() before
                        // we get shutdown.
+    bool admission_policy_configured;  // by the first config using the cache.
+    bool image_configured;  // likewise.
+    // Where to save the cache on shutdown and reload it from on startup, if
+    // anywhere; see SharedMemCache::SaveImage.
+    GoogleString image_path;
+    // Popularity estimates shared by the TieredCaches in front of this
+    // cache, if any.
+    scoped_ptr<FrequencySketch> tiered_sketch;
   };
 
+  // Also used for redis, which plays the same role.
   struct MemcachedInterfaces {
-    MemcachedInterfaces() : async(NULL), blocking(NULL) {}
+    MemcachedInterfaces()
+        : async(NULL), blocking(NULL), value_size_threshold(0) {}
     CacheInterface* async;
     CacheInterface* blocking;
+    // Larger values go to the file cache instead; see FallbackCache.
+    size_t value_size_threshold;
   };
 
   // Looks up and, if necessary, constructs memcached interfaces for a
@@ -170,6 +194,19 @@ class SystemCaches {
   // the pair will be NULL.
   MemcachedInterfaces GetMemcached(SystemRewriteOptions* config);
 
+  // Like GetMemcached, but for redis.
+  MemcachedInterfaces GetRedis(SystemRewriteOptions* config);
+
+  // Returns a new codec for CompressedCache as configured.  Warns and falls
+  // back to deflate for an unknown codec, and to no dictionary for one that
+  // can't be read.
+  CacheCodec* NewCacheCodec(const SystemRewriteOptions* config);
+
+  // Reloads a shared memory metadata cache from its image_path, if there's
+  // a usable image there, or saves it there.
+  void RestoreShmMetadataCacheImage(MetadataShmCacheInfo* cache_info);
+  void SaveShmMetadataCacheImage(MetadataShmCacheInfo* cache_info);
+
   // Returns any shared memory metadata cache configured for the given name, or
   // NULL.
   MetadataShmCacheInfo* LookupShmMetadataCache(const GoogleString& name);
@@ -217,13 +254,20 @@ class SystemCaches {
   //
   // The CacheInterface* value in the MemcachedMap now includes,
   // depending on options, instances of CacheBatcher, AsyncCache,
-  // and CacheStats.  Explicit lists of AprMemCache instances and
-  // AsyncCache objects are also included, as they require extra
-  // treatment during startup and shutdown.
+  // and CacheStats.  Explicit lists of AprMemCache and BinaryMemCache
+  // instances and AsyncCache objects are also included, as they require
+  // extra treatment during startup and shutdown.  With
+  // ModPagespeedMemcachedProtocol binary, no worker pool is used.
   typedef std::map<GoogleString, MemcachedInterfaces> MemcachedMap;
   MemcachedMap memcached_map_;
   scoped_ptr<QueuedWorkerPool> memcached_pool_;
   std::vector<AprMemCache*> memcache_servers_;
+  std::vector<BinaryMemCache*> binary_memcache_servers_;
+
+  // The same, for redis, keyed by ModPagespeedRedisServers.
+  MemcachedMap redis_map_;
+  scoped_ptr<QueuedWorkerPool> redis_pool_;
+  std::vector<RedisCache*> redis_servers_;
 
   // Map of any shared memory metadata caches we have + their CacheStats
   // wrappers. These are named explicitly to make configuration comprehensible.
@@ -236,6 +280,10 @@ class SystemCaches {
 
   bool default_shm_metadata_cache_creation_failed_;
 
+  // Whether some configuration uses a TieredCache, so its statistics are
+  // worth printing.
+  bool tiered_cache_used_;
+
   DISALLOW_COPY_AND_ASSIGN(SystemCaches);
 };
 
@@ -39,6 +39,7 @@
 #include "net/instaweb/rewriter/public/test_rewrite_driver_factory.h"
 #include "pagespeed/system/admin_site.h"
 #include "pagespeed/system/apr_mem_cache.h"
+#include "pagespeed/system/redis_cache.h"
 #include "pagespeed/system/system_cache_path.h"
 #include "pagespeed/system/system_rewrite_options.h"
 #include "pagespeed/system/system_server_context.h"
@@ -65,12 +66,15 @@
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_spammer.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
+#include "pagespeed/kernel/cache/coalescing_cache.h"
 #include "pagespeed/kernel/cache/cache_test_base.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/cache/tiered_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/request_headers.h"
@@ -436,6 +440,7 @@ class SystemCachesTest : public CustomRewriteTestBase<SystemRewriteOptions> {
     } else {
       mem_cache = Batcher(AsyncMemCacheWithStats(), num_threads_expected, 1000);
     }
+    mem_cache = Coalescing(mem_cache);
 
     EXPECT_STREQ(
         Compressed(Fallback(mem_cache, Stats("file_cache", FileCacheName()))),
@@ -469,10 +474,18 @@ class SystemCachesTest : public CustomRewriteTestBase<SystemRewriteOptions> {
     return FallbackCache::FormatName(small, large);
   }
 
+  GoogleString Tiered(StringPiece memory, StringPiece disk) {
+    return TieredCache::FormatName(memory, disk);
+  }
+
   GoogleString Batcher(StringPiece cache, int parallel, int max) {
     return CacheBatcher::FormatName(cache, parallel, max);
   }
 
+  GoogleString Coalescing(StringPiece cache) {
+    return CoalescingCache::FormatName(cache);
+  }
+
   GoogleString Stats(StringPiece prefix, StringPiece cache) {
     return CacheStats::FormatName(prefix, cache);
   }
@@ -488,6 +501,11 @@ class SystemCachesTest : public CustomRewriteTestBase<SystemRewriteOptions> {
                  AsyncCache::FormatName(AprMemCache::FormatName()));
   }
 
+  // The memcached interface used for the L2, with default settings.
+  GoogleString BatchedMemCache() {
+    return Coalescing(Batcher(AsyncMemCacheWithStats(), 1, 1000));
+  }
+
   GoogleString BlockingMemCacheWithStats() {
     return Stats(SystemCaches::kMemcachedBlocking, AprMemCache::FormatName());
   }
@@ -662,6 +680,30 @@ TEST_F(SystemCachesTest, BasicShmAndNoLru) {
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
 }
 
+TEST_F(SystemCachesTest, BasicShmTiered) {
+  GoogleString error_msg;
+  EXPECT_TRUE(system_caches_->CreateShmMetadataCache(
+      kCachePath, kUsableMetadataCacheSize, &error_msg));
+
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(0);
+  options_->set_tiered_metadata_cache(true);
+  PrepareWithConfig(options_.get());
+
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  EXPECT_STREQ(Compressed(Tiered(Stats("shm_cache", "SharedMemCache<64>"),
+                                 FileCacheWithStats())),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(HttpCache(FileCacheWithStats()),
+               server_context->http_cache()->Name());
+
+  GoogleString stats;
+  system_caches_->PrintCacheStats(SystemCaches::kDefaultStatFlags, &stats);
+  EXPECT_NE(GoogleString::npos, stats.find("Tiered metadata cache"));
+}
+
 TEST_F(SystemCachesTest, DoubleShmCreate) {
   // Proper error message on two creation attempts for the same name.
   GoogleString error_msg;
@@ -712,13 +754,13 @@ TEST_F(SystemCachesTest, BasicMemCachedAndLru) {
       SetupServerContext(options_.release()));
   EXPECT_STREQ(Compressed(
       WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
-                   Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+                   Fallback(BatchedMemCache(),
                             FileCacheWithStats()))),
                server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       HttpCache(WriteThrough(
           Stats("lru_cache", ThreadsafeLRU()),
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                            FileCacheWithStats()))),
       server_context->http_cache()->Name());
   ASSERT_TRUE(server_context->filesystem_metadata_cache() != NULL);
@@ -740,6 +782,36 @@ TEST_F(SystemCachesTest, BasicMemCachedAndNoLru_2_Threads) {
   TestBasicMemCacheAndNoLru(2, 1);  // Clamp to 1.
 }
 
+TEST_F(SystemCachesTest, BasicRedisAndNoLru) {
+  // RedisCache only connects when first used, so no server is needed to
+  // check how the caches are assembled.
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(0);
+  options_->set_redis_servers("localhost:6379");
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  GoogleString redis = Coalescing(Batcher(
+      Stats(SystemCaches::kRedisAsync,
+            AsyncCache::FormatName(RedisCache::FormatName())),
+      1, 1000));
+  EXPECT_STREQ(
+      Compressed(Fallback(redis, FileCacheWithStats())),
+      server_context->metadata_cache()->Name());
+  EXPECT_STREQ(
+      HttpCache(Fallback(redis, FileCacheWithStats())),
+      server_context->http_cache()->Name());
+  ASSERT_TRUE(server_context->filesystem_metadata_cache() != NULL);
+  EXPECT_TRUE(server_context->filesystem_metadata_cache()->IsBlocking());
+  EXPECT_STREQ(
+      Fallback(Stats(SystemCaches::kRedisBlocking, RedisCache::FormatName()),
+               FileCacheWithStats()),
+      server_context->filesystem_metadata_cache()->Name());
+}
+
 TEST_F(SystemCachesTest, BasicMemCachedLruShm) {
   if (MemCachedServerSpec().empty()) {
     return;
@@ -761,13 +833,13 @@ TEST_F(SystemCachesTest, BasicMemCachedLruShm) {
   EXPECT_STREQ(
       Compressed(WriteThrough(
           Stats("shm_cache", SharedMemCache<64>::FormatName()),
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                    FileCacheWithStats()))),
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       HttpCache(WriteThrough(
           Stats("lru_cache", ThreadsafeLRU()),
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                              FileCacheWithStats()))),
       server_context->http_cache()->Name());
 }
@@ -793,12 +865,12 @@ TEST_F(SystemCachesTest, BasicMemCachedShmNoLru) {
       Compressed(
           WriteThrough(
               Stats("shm_cache", "SharedMemCache<64>"),
-              Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+              Fallback(BatchedMemCache(),
                        FileCacheWithStats()))),
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       HttpCache(
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                    FileCacheWithStats())),
       server_context->http_cache()->Name());
   ASSERT_TRUE(server_context->filesystem_metadata_cache() != NULL);
@@ -1003,7 +1075,7 @@ TEST_F(SystemCachesTest, MemCachedShare) {
   for (int i = 0; i < 3; ++i) {
     servers.push_back(SetupServerContext(configs[i]));
     EXPECT_STREQ(
-        Compressed(Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+        Compressed(Fallback(BatchedMemCache(),
                             FileCacheWithStats())),
         servers[i]->metadata_cache()->Name());
 
@@ -1090,6 +1162,96 @@ TEST_F(SystemCachesTest, LruCacheSettings) {
   EXPECT_EQ(500, http_write_through->cache1_limit());
 }
 
+TEST_F(SystemCachesTest, ShmCacheImage) {
+  GoogleString error_msg;
+  EXPECT_TRUE(system_caches_->CreateShmMetadataCache(
+      kCachePath, kUsableMetadataCacheSize, &error_msg));
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(0);
+  options_->set_shm_cache_image(true);
+
+  // Write an entry from the root process, which has the cache save itself
+  // as it shuts down.  Small values only go to the shm cache, so the file
+  // cache doesn't need the slow worker that ChildInit would set up.
+  system_caches_->RegisterConfig(options_.get());
+  system_caches_->RootInit();
+  scoped_ptr<SystemServerContext> server_context(
+      new SystemServerContextNoProxyHtml(factory()));
+  server_context->reset_global_options(options_->Clone());
+  server_context->set_statistics(factory()->statistics());
+  server_context->set_timer(factory()->timer());
+  system_caches_->SetupCaches(server_context.get(),
+                              true /* enable_property_cache */);
+  TestPut(server_context->metadata_cache(), "key", "value");
+  server_context.reset();
+  system_caches_->StopCacheActivity();
+  system_caches_->ShutDown(factory()->message_handler());
+
+  GoogleString image_path = StrCat(kCachePath, FileCache::kShmCacheImageName);
+  EXPECT_TRUE(factory()->file_system()->Exists(
+      image_path.c_str(), factory()->message_handler()).is_true());
+
+  // The next server starts off with the entry.
+  system_caches_.reset(
+      new SystemCaches(factory(), shared_mem_.get(), kThreadLimit));
+  EXPECT_TRUE(system_caches_->CreateShmMetadataCache(
+      kCachePath, kUsableMetadataCacheSize, &error_msg));
+  PrepareWithConfig(options_.get());
+  server_context.reset(SetupServerContext(options_.release()));
+  TestGet(server_context->metadata_cache(), "key",
+          CacheInterface::kAvailable, "value");
+}
+
+TEST_F(SystemCachesTest, TinyLfuAdmissionPolicy) {
+  GoogleString error_msg;
+  EXPECT_TRUE(system_caches_->CreateShmMetadataCache(
+      kCachePath, kUsableMetadataCacheSize, &error_msg));
+
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(1024);
+  options_->set_lru_cache_admission_policy("tinylfu");
+  options_->set_shm_cache_admission_policy("TinyLFU");
+  PrepareWithConfig(options_.get());
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+
+  // Both caches report their stats under policy-specific names.
+  EXPECT_STREQ(
+      Compressed(Fallback(Stats("shm_cache_tinylfu", "SharedMemCache<64>"),
+                          FileCacheWithStats())),
+      server_context->metadata_cache()->Name());
+  EXPECT_STREQ(
+      HttpCache(WriteThrough(Stats("lru_cache_tinylfu", ThreadsafeLRU()),
+                             FileCacheWithStats())),
+      server_context->http_cache()->Name());
+
+  WriteThroughCache* http_write_through =
+      dynamic_cast<WriteThroughCache*>(server_context->http_cache()->cache());
+  ASSERT_TRUE(http_write_through != NULL);
+  LRUCache* lru_cache = dynamic_cast<LRUCache*>(
+      SkipWrappers(http_write_through->cache1()));
+  ASSERT_TRUE(lru_cache != NULL);
+  EXPECT_EQ(kTinyLfuAdmission, lru_cache->admission_policy());
+}
+
+TEST_F(SystemCachesTest, UnknownAdmissionPolicy) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_lru_cache_kb_per_process(1024);
+  options_->set_lru_cache_admission_policy("lfu");
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+
+  // Falls back to plain LRU.
+  EXPECT_STREQ(
+      HttpCache(WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
+                             FileCacheWithStats())),
+      server_context->http_cache()->Name());
+}
+
 TEST_F(SystemCachesTest, HangingMultigetTest) {
   // Test that we do not hang in the case of corrupted responses from memcached,
   // as seen in bug report 1048
@@ -1452,13 +1614,13 @@ TEST_F(BrokenShmSystemCachesTest, FallbackMemCachedLruShm) {
       Compressed(
           WriteThrough(
               Stats("lru_cache", ThreadsafeLRU()),
-              Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+              Fallback(BatchedMemCache(),
                        FileCacheWithStats()))),
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       HttpCache(WriteThrough(
           Stats("lru_cache", ThreadsafeLRU()),
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                    FileCacheWithStats()))),
       server_context->http_cache()->Name());
   EXPECT_STREQ(Pcache(Compressed(Fallback(BlockingMemCacheWithStats(),
@@ -1484,12 +1646,12 @@ TEST_F(BrokenShmSystemCachesTest, FallbackMemCachedShmNoLru) {
   scoped_ptr<ServerContext> server_context(
       SetupServerContext(options_.release()));
   EXPECT_STREQ(
-      Compressed(Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+      Compressed(Fallback(BatchedMemCache(),
                           FileCacheWithStats())),
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       HttpCache(
-          Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
+          Fallback(BatchedMemCache(),
                    FileCacheWithStats())),
       server_context->http_cache()->Name());
 }
@@ -24,6 +24,8 @@
 
 #include "apr_general.h"
 #include "base/logging.h"
+#include "net/instaweb/http/public/collapsing_url_async_fetcher.h"
+#include "net/instaweb/http/public/http_cache_refresher.h"
 #include "net/instaweb/http/public/http_dump_url_async_writer.h"
 #include "net/instaweb/http/public/http_dump_url_fetcher.h"
 #include "net/instaweb/http/public/rate_controller.h"
@@ -33,6 +35,7 @@
 #include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "net/instaweb/rewriter/public/static_asset_manager.h"
+#include "pagespeed/system/http2_url_async_fetcher.h"
 #include "pagespeed/system/in_place_resource_recorder.h"
 #include "pagespeed/system/serf_url_async_fetcher.h"
 #include "pagespeed/system/system_caches.h"
@@ -194,6 +197,9 @@ void SystemRewriteDriverFactory::InitStats(Statistics* statistics) {
 
   // Init System-specific stats.
   SerfUrlAsyncFetcher::InitStats(statistics);
+  CollapsingUrlAsyncFetcher::InitStats(statistics);
+  HTTPCacheRefresher::InitStats(statistics);
+  Http2UrlAsyncFetcher::InitStats(statistics);
   StdioFileSystem::InitStats(statistics);
   SystemCaches::InitStats(statistics);
   PropertyCache::InitCohortStats(RewriteDriver::kBeaconCohort, statistics);
@@ -502,6 +508,13 @@ void SystemRewriteDriverFactory::ShutDown() {
     defer_cleanup(new Deleter<UrlAsyncFetcher>(fetcher));
   }
   fetcher_map_.clear();
+  // Deleted only after the fetchers falling back on them, which are all
+  // queued for deletion by now.
+  for (int i = 0, n = fallback_fetchers_.size(); i < n; ++i) {
+    TakeOwnership(fallback_fetchers_[i]);
+  }
+  fallback_fetchers_.clear();
+  rate_controller_map_.clear();
   ShutDownFetchers();
 
   RewriteDriverFactory::ShutDown();
@@ -561,6 +574,16 @@ GoogleString SystemRewriteDriverFactory::GetFetcherKey(
               "\nhttps: ", config->https_options(),
               "\ncert_dir: ", config->ssl_cert_directory(),
               "\ncert_file: ", config->ssl_cert_file());
+    StrAppend(&key,
+              "\nidle_per_host: ", IntegerToString(
+                  config->fetcher_max_idle_connections_per_host()),
+              "\nidle_timeout: ", Integer64ToString(
+                  config->fetcher_idle_connection_timeout_ms()),
+              "\nthreads: ", IntegerToString(config->fetcher_threads()),
+              "\nhttp2: ", config->fetch_http2() ? "on" : "off",
+              "\ncollapse: ", config->collapse_fetches() ? "on" : "off",
+              "\nadaptive: ",
+              config->fetcher_adaptive_concurrency() ? "on" : "off");
   }
 
   return key;
@@ -592,20 +615,43 @@ UrlAsyncFetcher* SystemRewriteDriverFactory::GetFetcher(
         // Unfortunately, we need stats for load-shedding.
         if (config->statistics_enabled()) {
           TakeOwnership(fetcher);
-          fetcher = new RateControllingUrlAsyncFetcher(
-              fetcher, max_queue_size(), requests_per_host(), queued_per_host(),
-              thread_system(), statistics());
+          RateControllingUrlAsyncFetcher* rate_controlling_fetcher =
+              new RateControllingUrlAsyncFetcher(
+                  fetcher, max_queue_size(), requests_per_host(),
+                  queued_per_host(), thread_system(), statistics());
+          RateController* rate_controller =
+              rate_controlling_fetcher->rate_controller();
+          if (config->fetcher_adaptive_concurrency()) {
+            rate_controller->EnableAdaptiveConcurrency(timer());
+          }
+          rate_controller_map_[key] = rate_controller;
+          fetcher = rate_controlling_fetcher;
         } else {
           message_handler()->Message(
               kError, "Can't enable fetch rate-limiting without statistics");
         }
       }
+      // Collapse concurrent fetches before rate-limiting, so that those
+      // sharing a fetch don't take up more than one place in its queues.
+      if (config->collapse_fetches()) {
+        TakeOwnership(fetcher);
+        fetcher = new CollapsingUrlAsyncFetcher(fetcher, thread_system(),
+                                                statistics());
+      }
     }
     iter->second = fetcher;
   }
   return iter->second;
 }
 
+RateController* SystemRewriteDriverFactory::GetRateController(
+    SystemRewriteOptions* config) {
+  GetFetcher(config);
+  RateControllerMap::iterator p =
+      rate_controller_map_.find(GetFetcherKey(true, config));
+  return (p == rate_controller_map_.end()) ? NULL : p->second;
+}
+
 UrlAsyncFetcher* SystemRewriteDriverFactory::AllocateFetcher(
     SystemRewriteOptions* config) {
   SerfUrlAsyncFetcher* serf = new SerfUrlAsyncFetcher(
@@ -614,12 +660,30 @@ UrlAsyncFetcher* SystemRewriteDriverFactory::AllocateFetcher(
       thread_system(), statistics(), timer(),
       config->blocking_fetch_timeout_ms(),
       message_handler());
+  serf->SetNumThreads(config->fetcher_threads());
   serf->set_list_outstanding_urls_on_error(list_outstanding_urls_on_error_);
   serf->set_fetch_with_gzip(config->fetch_with_gzip());
   serf->set_track_original_content_length(track_original_content_length_);
   serf->SetHttpsOptions(config->https_options());
   serf->SetSslCertificatesDir(config->ssl_cert_directory());
   serf->SetSslCertificatesFile(config->ssl_cert_file());
+  serf->set_max_idle_connections_per_host(
+      config->fetcher_max_idle_connections_per_host());
+  serf->set_idle_connection_timeout_ms(
+      config->fetcher_idle_connection_timeout_ms());
+  // HTTP/2 connects straight to origins, so it can't go through a proxy.
+  if (config->fetch_http2() && config->fetcher_proxy().empty()) {
+    fallback_fetchers_.push_back(serf);
+    Http2UrlAsyncFetcher* http2 = new Http2UrlAsyncFetcher(
+        serf, thread_system(), statistics(), timer(),
+        config->blocking_fetch_timeout_ms(), message_handler());
+    http2->set_fetch_with_gzip(config->fetch_with_gzip());
+    if (!http2->Start()) {
+      message_handler()->Message(
+          kError, "Failed to start HTTP/2 fetcher; using HTTP/1.1 only");
+    }
+    return http2;
+  }
   return serf;
 }
 
@@ -38,6 +38,7 @@ class NamedLockManager;
 class NonceGenerator;
 class ProcessContext;
 class QueuedWorkerPool;
+class RateController;
 class ServerContext;
 class SharedCircularBuffer;
 class SharedMemStatistics;
@@ -189,6 +190,10 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   // its required thread).
   UrlAsyncFetcher* GetFetcher(SystemRewriteOptions* config);
 
+  // Returns the RateController of the fetcher GetFetcher returns for config,
+  // or NULL if it doesn't rate-limit background fetches.
+  RateController* GetRateController(SystemRewriteOptions* config);
+
   // Tracks the size of resources fetched from origin and populates the
   // X-Original-Content-Length header for resources derived from them.
   void set_track_original_content_length(bool x) {
@@ -363,6 +368,13 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   typedef std::map<GoogleString, UrlAsyncFetcher*> FetcherMap;
   FetcherMap base_fetcher_map_;
   FetcherMap fetcher_map_;
+  // Fetchers that others in fetcher_map_ fall back on, such as the serf
+  // fetcher under an Http2UrlAsyncFetcher.  ShutDown queues them for
+  // deletion after the fetchers using them.
+  std::vector<UrlAsyncFetcher*> fallback_fetchers_;
+  // The RateControllers in fetcher_map_'s fetchers, by the same key.
+  typedef std::map<GoogleString, RateController*> RateControllerMap;
+  RateControllerMap rate_controller_map_;
 
   // URL prefix for support files required by pagespeed.
   GoogleString static_asset_prefix_;
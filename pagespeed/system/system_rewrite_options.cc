@@ -20,6 +20,7 @@
 #include "pagespeed/system/serf_url_async_fetcher.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/tiered_cache.h"
 
 namespace net_instaweb {
 
@@ -87,11 +88,35 @@ void SystemRewriteOptions::AddProperties() {
                     RewriteOptions::kMemcachedThreads,
                     "Number of background threads to use to run "
                         "memcached fetches", true);
+  AddSystemProperty("ascii", &SystemRewriteOptions::memcached_protocol_,
+                    "ampr", "MemcachedProtocol",
+                    "Protocol to use to talk to memcached: ascii, or binary "
+                        "for a non-blocking client that pipelines requests "
+                        "and uses ModPagespeedMemcachedThreads connections "
+                        "per server", true);
   AddSystemProperty(500 * Timer::kMsUs,  // half a second
                     &SystemRewriteOptions::memcached_timeout_us_, "amo",
                     RewriteOptions::kMemcachedTimeoutUs,
                     "Maximum time in microseconds to allow for memcached "
                         "transactions", true);
+  AddSystemProperty("", &SystemRewriteOptions::redis_servers_, "ars",
+                    "RedisServers",
+                    "Comma-separated list of redis servers e.g. "
+                        "host1:port1,host2:port2.  More than one requires "
+                        "RedisCluster", false);
+  AddSystemProperty(false, &SystemRewriteOptions::redis_cluster_, "arcl",
+                    "RedisCluster",
+                    "Whether RedisServers are seeds of a redis cluster, "
+                        "with keys routed to nodes by hash slot", true);
+  AddSystemProperty(500 * Timer::kMsUs,  // half a second
+                    &SystemRewriteOptions::redis_timeout_us_, "arto",
+                    "RedisTimeoutUs",
+                    "Maximum time in microseconds to allow for redis "
+                        "connections and transactions", true);
+  AddSystemProperty(0, &SystemRewriteOptions::redis_ttl_sec_, "arttl",
+                    "RedisTtlSec",
+                    "Time-to-live, in seconds, for entries written to redis; "
+                        "0 means they never expire", true);
   AddSystemProperty(50 * Timer::kMsUs,  // 50 ms
                     &SystemRewriteOptions::slow_file_latency_threshold_us_,
                     "asflt", "SlowFileLatencyUs",
@@ -144,6 +169,11 @@ void SystemRewriteOptions::AddProperties() {
                     "afcl", RewriteOptions::kFileCacheCleanInodeLimit,
                     "Set the target number of inodes for the file cache; 0 "
                         "means no limit", true);
+  AddSystemProperty(false, &SystemRewriteOptions::file_cache_index_, "afcx",
+                    "FileCacheIndex",
+                    "Maintain an on-disk index of the file cache so that "
+                        "cleaning does not need to scan the cache directory",
+                    true);
   AddSystemProperty(0, &SystemRewriteOptions::lru_cache_byte_limit_, "alcb",
                     RewriteOptions::kLruCacheByteLimit,
                     "Set the maximum byte size entry to store in the "
@@ -152,6 +182,20 @@ void SystemRewriteOptions::AddProperties() {
                     RewriteOptions::kLruCacheKbPerProcess,
                     "Set the total size, in KB, of the per-process in-memory "
                         "LRU cache", true);
+  AddSystemProperty("lru", &SystemRewriteOptions::lru_cache_admission_policy_,
+                    "alca", "LRUCacheAdmissionPolicy",
+                    "Policy for admitting new entries into a full per-process "
+                        "in-memory LRU cache: lru or tinylfu", true);
+  AddSystemProperty("lru", &SystemRewriteOptions::shm_cache_admission_policy_,
+                    "asmca", "SharedMemoryCacheAdmissionPolicy",
+                    "Policy for admitting new entries into the shared memory "
+                        "metadata cache when they conflict with existing "
+                        "ones: lru or tinylfu", true);
+  AddSystemProperty(false, &SystemRewriteOptions::shm_cache_image_,
+                    "asmci", "SharedMemoryCacheImage",
+                    "Whether to save the shared memory metadata cache to the "
+                        "file cache directory on shutdown, and reload it on "
+                        "startup", true);
   AddSystemProperty("", &SystemRewriteOptions::cache_flush_filename_, "acff",
                     RewriteOptions::kCacheFlushFilename,
                     "Name of file to check for timestamp updates used to flush "
@@ -168,6 +212,33 @@ void SystemRewriteOptions::AddProperties() {
                     "cc", RewriteOptions::kCompressMetadataCache,
                     "Whether to compress cache entries before writing them to "
                     "memory or disk.", true);
+  AddSystemProperty("deflate", &SystemRewriteOptions::compressed_cache_codec_,
+                    "accd", "CompressedCacheCodec",
+                    "How to compress cache entries with CompressMetadataCache: "
+                        "deflate, deflate-fast, or lz4, which is several "
+                        "times faster than deflate but compresses less", true);
+  AddSystemProperty("", &SystemRewriteOptions::compressed_cache_dictionary_,
+                    "accdf", "CompressedCacheDictionary",
+                    "File holding a preset dictionary for compressing cache "
+                        "entries with deflate, e.g. markup common to most "
+                        "pages.  Every server sharing a cache must use the "
+                        "same one", false);
+  AddSystemProperty(false, &SystemRewriteOptions::tiered_metadata_cache_,
+                    "atmc", "TieredMetadataCache",
+                    "Whether to keep only frequently used metadata cache "
+                        "entries in the shared memory cache, with all of them "
+                        "on disk", true);
+  AddSystemProperty(TieredCache::kDefaultPromotionThreshold,
+                    &SystemRewriteOptions::tiered_cache_promotion_threshold_,
+                    "atcpt", "TieredCachePromotionThreshold",
+                    "With TieredMetadataCache, how many times an entry must "
+                        "be looked up before it is kept in shared memory",
+                    true);
+  AddSystemProperty(false, &SystemRewriteOptions::http_cache_identity_variant_,
+                    "ahciv", "HttpCacheIdentityVariant",
+                    "Whether to store an uncompressed copy of each gzipped "
+                        "HTTP cache entry, for clients that don't accept "
+                        "gzip", true);
   AddSystemProperty("enable", &SystemRewriteOptions::https_options_, "fhs",
                     kFetchHttps, "Controls direct fetching of HTTPS resources."
                     "  Value is comma-separated list of keywords: "
@@ -178,6 +249,44 @@ void SystemRewriteOptions::AddProperties() {
   AddSystemProperty("", &SystemRewriteOptions::ssl_cert_file_, "asslf",
                     RewriteOptions::kSslCertFile,
                     "File with SSL certificates.", false);
+  AddSystemProperty(
+      SerfUrlAsyncFetcher::kDefaultMaxIdleConnectionsPerHost,
+      &SystemRewriteOptions::fetcher_max_idle_connections_per_host_,
+      "afmic", "FetcherMaxIdleConnectionsPerHost",
+      "How many idle connections to each origin the fetcher keeps open for "
+          "reuse; 0 disables reuse", true);
+  AddSystemProperty(
+      SerfUrlAsyncFetcher::kDefaultIdleConnectionTimeoutMs,
+      &SystemRewriteOptions::fetcher_idle_connection_timeout_ms_,
+      "afict", "FetcherIdleConnectionTimeoutMs",
+      "How long the fetcher keeps an idle connection open for reuse, in "
+          "milliseconds", true);
+  AddSystemProperty(
+      1, &SystemRewriteOptions::fetcher_threads_, "afth", "FetcherThreads",
+      "How many threads run background fetches, each with its own "
+          "connections", true);
+  AddSystemProperty(
+      false, &SystemRewriteOptions::fetch_http2_, "afh2", "FetchHttp2",
+      "Fetch http resources over cleartext HTTP/2, multiplexing concurrent "
+          "fetches to an origin over one connection, falling back to "
+          "HTTP/1.1 for origins that don't support it", true);
+  AddSystemProperty(
+      true, &SystemRewriteOptions::collapse_fetches_, "acfe",
+      "CollapseFetches",
+      "Make a single origin fetch for concurrent fetches of the same "
+          "resource, sharing its response between them", true);
+  AddSystemProperty(
+      false, &SystemRewriteOptions::fetcher_adaptive_concurrency_, "afac",
+      "FetcherAdaptiveConcurrency",
+      "Adjust how many background fetches are made to each host at once "
+          "from the latency and failures of its fetches, rather than using a "
+          "fixed limit.  Requires RateLimitBackgroundFetches", true);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::http_cache_refresh_entries_, "ahcre",
+      "HttpCacheRefreshEntries",
+      "How many popular HTTP cache entries to keep fresh by revalidating "
+          "them in the background shortly before they expire, or 0 to "
+          "disable", true);
   AddSystemProperty("", &SystemRewriteOptions::slurp_directory_, "asd",
                     RewriteOptions::kSlurpDirectory,
                     "Directory from which to read slurped resources", false);
@@ -83,12 +83,36 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_file_cache_clean_inode_limit(int64 x) {
     set_option(x, &file_cache_clean_inode_limit_);
   }
+  bool file_cache_index() const {
+    return file_cache_index_.value();
+  }
+  void set_file_cache_index(bool x) {
+    set_option(x, &file_cache_index_);
+  }
   int64 lru_cache_byte_limit() const {
     return lru_cache_byte_limit_.value();
   }
   void set_lru_cache_byte_limit(int64 x) {
     set_option(x, &lru_cache_byte_limit_);
   }
+  const GoogleString& lru_cache_admission_policy() const {
+    return lru_cache_admission_policy_.value();
+  }
+  void set_lru_cache_admission_policy(const GoogleString& x) {
+    set_option(x, &lru_cache_admission_policy_);
+  }
+  const GoogleString& shm_cache_admission_policy() const {
+    return shm_cache_admission_policy_.value();
+  }
+  void set_shm_cache_admission_policy(const GoogleString& x) {
+    set_option(x, &shm_cache_admission_policy_);
+  }
+  bool shm_cache_image() const {
+    return shm_cache_image_.value();
+  }
+  void set_shm_cache_image(bool x) {
+    set_option(x, &shm_cache_image_);
+  }
   int64 lru_cache_kb_per_process() const {
     return lru_cache_kb_per_process_.value();
   }
@@ -107,6 +131,36 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_compress_metadata_cache(bool x) {
     set_option(x, &compress_metadata_cache_);
   }
+  bool tiered_metadata_cache() const {
+    return tiered_metadata_cache_.value();
+  }
+  void set_tiered_metadata_cache(bool x) {
+    set_option(x, &tiered_metadata_cache_);
+  }
+  bool http_cache_identity_variant() const {
+    return http_cache_identity_variant_.value();
+  }
+  void set_http_cache_identity_variant(bool x) {
+    set_option(x, &http_cache_identity_variant_);
+  }
+  int tiered_cache_promotion_threshold() const {
+    return tiered_cache_promotion_threshold_.value();
+  }
+  void set_tiered_cache_promotion_threshold(int x) {
+    set_option(x, &tiered_cache_promotion_threshold_);
+  }
+  const GoogleString& compressed_cache_codec() const {
+    return compressed_cache_codec_.value();
+  }
+  void set_compressed_cache_codec(const GoogleString& x) {
+    set_option(x, &compressed_cache_codec_);
+  }
+  const GoogleString& compressed_cache_dictionary() const {
+    return compressed_cache_dictionary_.value();
+  }
+  void set_compressed_cache_dictionary(const GoogleString& x) {
+    set_option(x, &compressed_cache_dictionary_);
+  }
   bool statistics_enabled() const {
     return statistics_enabled_.value();
   }
@@ -154,6 +208,12 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_memcached_threads(int x) {
     set_option(x, &memcached_threads_);
   }
+  const GoogleString& memcached_protocol() const {
+    return memcached_protocol_.value();
+  }
+  void set_memcached_protocol(const GoogleString& x) {
+    set_option(x, &memcached_protocol_);
+  }
   int memcached_timeout_us() const {
     return memcached_timeout_us_.value();
   }
@@ -163,6 +223,30 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_memcached_timeout_us(int x) {
     set_option(x, &memcached_timeout_us_);
   }
+  const GoogleString& redis_servers() const {
+    return redis_servers_.value();
+  }
+  void set_redis_servers(const GoogleString& x) {
+    set_option(x, &redis_servers_);
+  }
+  bool redis_cluster() const {
+    return redis_cluster_.value();
+  }
+  void set_redis_cluster(bool x) {
+    set_option(x, &redis_cluster_);
+  }
+  int redis_timeout_us() const {
+    return redis_timeout_us_.value();
+  }
+  void set_redis_timeout_us(int x) {
+    set_option(x, &redis_timeout_us_);
+  }
+  int redis_ttl_sec() const {
+    return redis_ttl_sec_.value();
+  }
+  void set_redis_ttl_sec(int x) {
+    set_option(x, &redis_ttl_sec_);
+  }
   int64 slow_file_latency_threshold_us() const {
     return slow_file_latency_threshold_us_.value();
   }
@@ -202,6 +286,48 @@ class SystemRewriteOptions : public RewriteOptions {
   const GoogleString& ssl_cert_file() const {
     return ssl_cert_file_.value();
   }
+  int fetcher_max_idle_connections_per_host() const {
+    return fetcher_max_idle_connections_per_host_.value();
+  }
+  void set_fetcher_max_idle_connections_per_host(int x) {
+    set_option(x, &fetcher_max_idle_connections_per_host_);
+  }
+  int64 fetcher_idle_connection_timeout_ms() const {
+    return fetcher_idle_connection_timeout_ms_.value();
+  }
+  void set_fetcher_idle_connection_timeout_ms(int64 x) {
+    set_option(x, &fetcher_idle_connection_timeout_ms_);
+  }
+  int fetcher_threads() const {
+    return fetcher_threads_.value();
+  }
+  void set_fetcher_threads(int x) {
+    set_option(x, &fetcher_threads_);
+  }
+  bool fetch_http2() const {
+    return fetch_http2_.value();
+  }
+  void set_fetch_http2(bool x) {
+    set_option(x, &fetch_http2_);
+  }
+  bool collapse_fetches() const {
+    return collapse_fetches_.value();
+  }
+  void set_collapse_fetches(bool x) {
+    set_option(x, &collapse_fetches_);
+  }
+  bool fetcher_adaptive_concurrency() const {
+    return fetcher_adaptive_concurrency_.value();
+  }
+  void set_fetcher_adaptive_concurrency(bool x) {
+    set_option(x, &fetcher_adaptive_concurrency_);
+  }
+  int http_cache_refresh_entries() const {
+    return http_cache_refresh_entries_.value();
+  }
+  void set_http_cache_refresh_entries(int x) {
+    set_option(x, &http_cache_refresh_entries_);
+  }
 
   int64 slurp_flush_limit() const {
     return slurp_flush_limit_.value();
@@ -404,12 +530,25 @@ class SystemRewriteOptions : public RewriteOptions {
   // comma-separated list of host[:port].  See AprMemCache::AprMemCache
   // for code that parses it.
   Option<GoogleString> memcached_servers_;
+  Option<GoogleString> memcached_protocol_;
+  // comma-separated list of host[:port].  See RedisCache::RedisCache.
+  Option<GoogleString> redis_servers_;
   Option<GoogleString> statistics_logging_charts_css_;
   Option<GoogleString> statistics_logging_charts_js_;
   Option<GoogleString> cache_flush_filename_;
+  Option<GoogleString> lru_cache_admission_policy_;
+  Option<GoogleString> shm_cache_admission_policy_;
+  Option<bool> shm_cache_image_;
   Option<GoogleString> ssl_cert_directory_;
   Option<GoogleString> ssl_cert_file_;
   HttpsOptions https_options_;
+  Option<int> fetcher_max_idle_connections_per_host_;
+  Option<int64> fetcher_idle_connection_timeout_ms_;
+  Option<int> fetcher_threads_;
+  Option<bool> fetch_http2_;
+  Option<bool> collapse_fetches_;
+  Option<bool> fetcher_adaptive_concurrency_;
+  Option<int> http_cache_refresh_entries_;
 
   Option<GoogleString> slurp_directory_;
   Option<GoogleString> test_proxy_slurp_;
@@ -418,6 +557,13 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<bool> statistics_logging_enabled_;
   Option<bool> use_shared_mem_locking_;
   Option<bool> compress_metadata_cache_;
+  Option<GoogleString> compressed_cache_codec_;
+  Option<bool> tiered_metadata_cache_;
+  Option<int> tiered_cache_promotion_threshold_;
+  Option<bool> http_cache_identity_variant_;
+  Option<GoogleString> compressed_cache_dictionary_;
+  Option<bool> file_cache_index_;
+  Option<bool> redis_cluster_;
 
   Option<bool> slurp_read_only_;
   Option<bool> test_proxy_;
@@ -434,6 +580,8 @@ class SystemRewriteOptions : public RewriteOptions {
 
   Option<int> memcached_threads_;
   Option<int> memcached_timeout_us_;
+  Option<int> redis_timeout_us_;
+  Option<int> redis_ttl_sec_;
 
   Option<int64> slow_file_latency_threshold_us_;
   Option<int64> file_cache_clean_inode_limit_;
@@ -17,6 +17,8 @@
 #include "pagespeed/system/system_server_context.h"
 
 #include "base/logging.h"
+#include "net/instaweb/http/public/cache_url_async_fetcher.h"
+#include "net/instaweb/http/public/http_cache_refresher.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
 #include "net/instaweb/http/public/url_async_fetcher_stats.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
@@ -68,7 +70,8 @@ SystemServerContext::SystemServerContext(
       local_statistics_(NULL),
       hostname_identifier_(StrCat(hostname, ":", IntegerToString(port))),
       system_caches_(NULL),
-      cache_path_(NULL) {
+      cache_path_(NULL),
+      rate_controller_(NULL) {
   global_system_rewrite_options()->set_description(hostname_identifier_);
 }
 
@@ -247,6 +250,8 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
     UrlAsyncFetcher* fetcher =
         factory->GetFetcher(global_system_rewrite_options());
     set_default_system_fetcher(fetcher);
+    rate_controller_ =
+        factory->GetRateController(global_system_rewrite_options());
 
     if (split_statistics_.get() != NULL) {
       // Readjust the SHM stuff for the new process
@@ -285,6 +290,19 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
         thread_system()->NewRWLock());
     factory->InitServerContext(this);
 
+    int refresh_entries =
+        global_system_rewrite_options()->http_cache_refresh_entries();
+    if (refresh_entries > 0) {
+      // Created before any fetcher that reports hits to it, and, like them,
+      // fetching through the default system fetcher.
+      set_http_cache_refresher(new HTTPCacheRefresher(
+          CreateCustomCacheFetcher(global_options(), "", NULL,
+                                   DefaultSystemFetcher()),
+          global_options()->ComputeHttpOptions(), scheduler(),
+          low_priority_rewrite_workers(), thread_system(), statistics(),
+          message_handler(), refresh_entries));
+    }
+
     html_rewrite_time_us_histogram_ = statistics()->GetHistogram(
         kHtmlRewriteTimeUsHistogram);
     html_rewrite_time_us_histogram_->SetMaxValue(2 * Timer::kSecondUs);
@@ -426,7 +444,7 @@ void SystemServerContext::AdminPage(
                          filesystem_metadata_cache(), http_cache(),
                          metadata_cache(), page_property_cache(), this,
                          statistics(), stats,  global_system_rewrite_options(),
-                         spdy_config);
+                         spdy_config, rate_controller_);
 }
 
 void SystemServerContext::StatisticsPage(bool is_global,
@@ -35,6 +35,7 @@ class GoogleUrl;
 class Histogram;
 class QueryParams;
 class PurgeSet;
+class RateController;
 class RewriteDriver;
 class RewriteDriverFactory;
 class RewriteOptions;
@@ -267,6 +268,10 @@ class SystemServerContext : public ServerContext {
 
   SystemCachePath* cache_path_;
 
+  // Of the default system fetcher, for the admin pages.  Owned by the factory;
+  // NULL if it doesn't rate-limit background fetches.
+  RateController* rate_controller_;
+
   DISALLOW_COPY_AND_ASSIGN(SystemServerContext);
 };
 
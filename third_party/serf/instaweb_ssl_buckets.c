@@ -1465,6 +1465,38 @@ apr_status_t serf_ssl_set_certificates_file(serf_ssl_context_t *ssl_ctx,
     return result ? APR_SUCCESS : APR_EGENERAL;
 }
 
+/*
+ * PageSpeed addition to resume TLS sessions across connections.  Returns a
+ * new reference to the session negotiated on ssl_ctx, or NULL if its
+ * handshake has not finished.  Release it with serf_ssl_session_free.
+ */
+SSL_SESSION *serf_ssl_get1_session(serf_ssl_context_t *ssl_ctx)
+{
+    if (ssl_ctx->ssl == NULL || !SSL_is_init_finished(ssl_ctx->ssl)) {
+        return NULL;
+    }
+    return SSL_get1_session(ssl_ctx->ssl);
+}
+
+/*
+ * PageSpeed addition to offer a session from an earlier connection to the
+ * same server for resumption by the next handshake on ssl_ctx.
+ */
+apr_status_t serf_ssl_set_session(serf_ssl_context_t *ssl_ctx,
+                                  SSL_SESSION *session)
+{
+    if (ssl_ctx->ssl == NULL || SSL_set_session(ssl_ctx->ssl, session) != 1) {
+        ERR_clear_error();
+        return APR_EGENERAL;
+    }
+    return APR_SUCCESS;
+}
+
+void serf_ssl_session_free(SSL_SESSION *session)
+{
+    SSL_SESSION_free(session);
+}
+
 apr_status_t serf_ssl_load_cert_file(
     serf_ssl_certificate_t **cert,
     const char *file_path,